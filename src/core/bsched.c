@@ -43,13 +43,18 @@
 
 #include "lib/compat_sendfile.h"
 #include "lib/entropy.h"
+#include "lib/fd.h"
+#include "lib/file_object.h"
 #include "lib/halloc.h"
 #include "lib/hstrfn.h"
 #include "lib/inputevt.h"
+#include "lib/iouring.h"
 #include "lib/parse.h"
 #include "lib/plist.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/vmm.h"
 #include "lib/walloc.h"
 
@@ -159,6 +164,31 @@ static pslist_t *bws_in_list = NULL;
 static int bws_out_ema = 0;
 static int bws_in_ema = 0;
 
+#define BIO_URING_ENTRIES	256			/**< Submission ring size */
+#define BIO_URING_BUFSIZE	(64 * 1024)	/**< Per-source read buffer */
+
+/**
+ * Asynchronous file-to-socket transfer state, attached to a source.
+ */
+struct bio_uring {
+	bio_source_t *bio;			/**< Source, NULL when detached */
+	char *buf;					/**< Buffer where file data is read */
+	file_object_t *file;		/**< Our reference on the file being sent */
+	int in_fd;					/**< Our own descriptor on that file */
+	int out_fd;					/**< Our own descriptor on the socket */
+	bio_uring_done_t done;		/**< Completion callback */
+	void *arg;					/**< Completion callback argument */
+	size_t amount;				/**< Amount of bytes we asked for */
+	int read_res;				/**< Result of the read(), -errno on error */
+	uint reading:1;				/**< Whether read() is still pending */
+	uint sending:1;				/**< Whether send() is still pending */
+};
+
+static iouring_t *bio_ring;			/**< Shared by all sources */
+static uint bio_ring_evt;			/**< Input event for ring completions */
+static bool bio_ring_failed;		/**< Could not create or use the ring */
+static bool bio_ring_flushing;		/**< Submission has been scheduled */
+
 #define BW_SLOT_MIN		64	 /**< Minimum bandwidth/slot for realloc */
 
 #define BW_OUT_UP_MIN	8192 /**< Minimum out bandwidth for becoming ultra */
@@ -623,6 +653,9 @@ bsched_close(void)
 	pslist_free_null(&bws_out_list);
 	pslist_free_null(&bws_in_list);
 
+	inputevt_remove(&bio_ring_evt);
+	iouring_free_null(&bio_ring);
+
 	for (i = 0; i < NUM_BSCHED_BWS; i++) {
 		bws_set[i] = NULL;
 	}
@@ -827,6 +860,13 @@ bio_enable(bio_source_t *bio)
 	g_assert(0 == (bio->flags & BIO_F_PASSIVE));
 	wrap_io_check(bio->wio);
 
+	/*
+	 * Sources with pending asynchronous I/O are re-enabled on completion.
+	 */
+
+	if (bio->flags & BIO_F_INFLIGHT)
+		return;
+
 	bio->io_tag = inputevt_add(bio->wio->fd(bio->wio),
 			(bio->flags & BIO_F_READ) ? INPUT_EVENT_RX : INPUT_EVENT_WX,
 			bio->io_callback, bio->io_arg);
@@ -1271,6 +1311,21 @@ bsched_source_add(
 	return bio;
 }
 
+/**
+ * Free asynchronous transfer state, once no request is pending.
+ */
+static void
+bio_uring_free(struct bio_uring *bu)
+{
+	g_assert(!bu->reading && !bu->sending);
+
+	fd_close(&bu->in_fd);
+	fd_close(&bu->out_fd);
+	file_object_release(&bu->file);
+	vmm_free(bu->buf, BIO_URING_BUFSIZE);
+	WFREE(bu);
+}
+
 /**
  * Remove bio_source object from the scheduler.
  * The bio_source object is freed and must not be re-used.
@@ -1285,6 +1340,26 @@ bsched_source_remove(bio_source_t *bio)
 		bio->bws = BSCHED_BWS_INVALID;
 	}
 	inputevt_remove(&bio->io_tag);
+
+	/*
+	 * If asynchronous I/O is still pending, detach the source and cancel
+	 * the requests: the completion will free the state, releasing the
+	 * descriptors used by the requests, without invoking the callback.
+	 */
+
+	if (bio->uring != NULL) {
+		struct bio_uring *bu = bio->uring;
+
+		if (bu->reading || bu->sending) {
+			bu->bio = NULL;
+			if (bio_ring != NULL)
+				iouring_cancel(bio_ring, bu);
+		} else {
+			bio_uring_free(bu);
+		}
+		bio->uring = NULL;
+	}
+
 	bio->magic = 0;
 	WFREE(bio);
 }
@@ -2125,6 +2200,321 @@ bio_sendfile(sendfile_ctx_t *ctx, bio_source_t *bio,
 #endif /* !USE_MMAP && !HAS_SENDFILE */
 }
 
+/**
+ * Input callback invoked when the shared ring has completions.
+ */
+static void
+bio_uring_readable(void *unused_data, int unused_source,
+	inputevt_cond_t unused_cond)
+{
+	(void) unused_data;
+	(void) unused_source;
+	(void) unused_cond;
+
+	if (bio_ring != NULL)
+		iouring_reap(bio_ring);
+}
+
+/**
+ * Submit all the requests queued by the sources during the last round
+ * of I/O events, in a single system call.
+ */
+static void
+bio_uring_flush(void *unused_arg)
+{
+	(void) unused_arg;
+
+	bio_ring_flushing = FALSE;
+
+	if (NULL == bio_ring || 0 == iouring_queued(bio_ring))
+		return;
+
+	if (-1 == iouring_submit(bio_ring)) {
+		if (is_temporary_error(errno) || EBUSY == errno) {
+			bio_ring_flushing = TRUE;
+			teq_safe_post(THREAD_MAIN_ID, bio_uring_flush, NULL);
+		} else {
+			size_t n;
+
+			/*
+			 * Stop using the ring and fail the queued requests back to
+			 * their sources with a temporary error: they will resume
+			 * through regular I/O.
+			 */
+
+			g_warning("%s(): io_uring_enter() failed: %s, "
+				"using regular upload I/O", G_STRFUNC, g_strerror(errno));
+
+			bio_ring_failed = TRUE;
+			n = iouring_discard(bio_ring);
+
+			if (GNET_PROPERTY(bsched_debug))
+				g_debug("BSCHED discarded %zu io_uring request%s",
+					n, plural(n));
+		}
+	}
+}
+
+/**
+ * Make sure pending requests will be submitted once the current round
+ * of I/O events has been dispatched.
+ */
+static void
+bio_uring_schedule(void)
+{
+	if (bio_ring_flushing)
+		return;
+
+	bio_ring_flushing = TRUE;
+	teq_safe_post(THREAD_MAIN_ID, bio_uring_flush, NULL);
+}
+
+/**
+ * Is asynchronous I/O through io_uring available and configured?
+ *
+ * The shared ring is created on first use.
+ */
+bool
+bio_uring_enabled(void)
+{
+	if (!GNET_PROPERTY(upload_io_uring) || bio_ring_failed)
+		return FALSE;
+
+	if G_LIKELY(bio_ring != NULL)
+		return TRUE;
+
+	bio_ring = iouring_make(BIO_URING_ENTRIES);
+
+	if (NULL == bio_ring) {
+		bio_ring_failed = TRUE;
+		g_info("io_uring unavailable (%s), using regular upload I/O",
+			g_strerror(errno));
+		return FALSE;
+	}
+
+	bio_ring_evt = inputevt_add(iouring_eventfd(bio_ring), INPUT_EVENT_RX,
+		bio_uring_readable, NULL);
+
+	if (GNET_PROPERTY(bsched_debug))
+		g_debug("BSCHED using io_uring with %u entries", BIO_URING_ENTRIES);
+
+	return TRUE;
+}
+
+/**
+ * Completion of the file read() in an asynchronous transfer.
+ */
+static void
+bio_uring_read_done(void *arg, int result)
+{
+	struct bio_uring *bu = arg;
+
+	g_assert(bu->reading);
+
+	bu->reading = FALSE;
+	bu->read_res = result;
+}
+
+/**
+ * Completion of the socket send() in an asynchronous transfer.
+ */
+static void
+bio_uring_send_done(void *arg, int result)
+{
+	struct bio_uring *bu = arg;
+	bio_source_t *bio = bu->bio;
+	bio_uring_done_t done;
+	ssize_t written;
+	int error = 0;
+
+	g_assert(bu->sending);
+	g_assert(!bu->reading);		/* Linked requests complete in order */
+
+	bu->sending = FALSE;
+
+	if (NULL == bio) {
+		bio_uring_free(bu);
+		return;
+	}
+
+	bio_check(bio);
+	g_assert(bio->flags & BIO_F_INFLIGHT);
+
+	/*
+	 * A short read cancels the linked send(): that is not an error, we
+	 * shall simply retry from the new position at the next round.
+	 * A read() error however is what we have to report.  When both were
+	 * discarded, the source shall retry through regular I/O.
+	 */
+
+	if (result >= 0) {
+		written = result;
+	} else if (-ECANCELED == result && -ECANCELED == bu->read_res) {
+		written = -1;
+		error = VAL_EAGAIN;
+	} else if (bu->read_res < 0) {
+		written = -1;
+		error = -bu->read_res;
+	} else if (-ECANCELED == result) {
+		written = -1;
+		error = 0 == bu->read_res ? EIO : VAL_EAGAIN;
+	} else {
+		written = -1;
+		error = -result;
+	}
+
+	if (written > 0) {
+		bsched_bw_update(bsched_get(bio->bws), written, bu->amount);
+		bio_bw_update(bio, written);
+	}
+
+	bio->flags &= ~BIO_F_INFLIGHT;
+
+	if (
+		bio->io_callback && 0 == bio->io_tag &&
+		!(bio->flags & BIO_F_PASSIVE) &&
+		!(bsched_get(bio->bws)->flags & BS_F_NOBW)
+	)
+		bio_enable(bio);
+
+	/*
+	 * The callback can remove the source, so do not touch anything
+	 * afterwards.
+	 */
+
+	done = bu->done;
+	(*done)(bu->arg, written, error);
+}
+
+/**
+ * Duplicate a descriptor for use by asynchronous requests.
+ *
+ * @return the new descriptor, -1 on error with errno set.
+ */
+static int
+bio_uring_dup(int fd)
+{
+	int d = dup(fd);
+
+	if (d >= 0)
+		fd_set_close_on_exec(d);
+
+	return d;
+}
+
+/**
+ * Asynchronously write at most `len' bytes from `file', starting at
+ * `offset', to the source's socket, as bandwidth permits.
+ *
+ * The read and the send are queued as linked requests on the ring shared
+ * by all the sources and submitted together once the current round of I/O
+ * events has been processed, saving system calls and data copies to user
+ * space when many uploads are active.
+ *
+ * The requests use our own descriptors on the file and on the socket,
+ * and we keep a reference on the file object, so that the descriptors
+ * cannot be closed and reused by other files or connections while the
+ * requests are in flight.
+ *
+ * The source is disabled until the transfer completes, at which time the
+ * `done' callback is invoked with the amount of bytes written.
+ *
+ * @return 0 if the transfer was queued, an errno code otherwise.  EAGAIN
+ * means no bandwidth is available right now, ENOBUFS that the ring is
+ * full and any other error that regular I/O should be used instead.
+ */
+int
+bio_uring_sendfile(bio_source_t *bio, file_object_t *file,
+	fileoffset_t offset, size_t len, bio_uring_done_t done, void *arg)
+{
+	struct bio_uring *bu;
+	size_t available;
+
+	bio_check(bio);
+	wrap_io_check(bio->wio);
+	g_assert(bio->flags & BIO_F_WRITE);
+	g_assert(offset >= 0);
+	g_assert(len > 0);
+	g_assert(done != NULL);
+
+	if (NULL == bio_ring || bio_ring_failed)
+		return ENOTSUP;
+
+	if (bio->flags & BIO_F_INFLIGHT)
+		return VAL_EAGAIN;
+
+	if (iouring_space(bio_ring) < 2)
+		return ENOBUFS;
+
+	if (NULL == bio->uring) {
+		int out_fd = bio_uring_dup(bio->wio->fd(bio->wio));
+
+		if (-1 == out_fd)
+			return errno;
+
+		WALLOC0(bu);
+		bu->bio = bio;
+		bu->buf = vmm_alloc(BIO_URING_BUFSIZE);
+		bu->in_fd = -1;
+		bu->out_fd = out_fd;
+		bio->uring = bu;
+	} else {
+		bu = bio->uring;
+	}
+
+	g_assert(!bu->reading && !bu->sending);
+
+	if (NULL == bu->file || !file_object_same(bu->file, file)) {
+		int fd = file_object_fd(file);
+		int in_fd;
+
+		if (-1 == fd)
+			return EBADF;
+
+		in_fd = bio_uring_dup(fd);
+		if (-1 == in_fd)
+			return errno;
+
+		fd_close(&bu->in_fd);
+		file_object_release(&bu->file);
+		bu->in_fd = in_fd;
+		bu->file = file_object_dup(file);
+	}
+
+	available = bw_available(bio, MIN(len, BIO_URING_BUFSIZE));
+
+	if (0 == available)
+		return VAL_EAGAIN;
+
+	bu->done = done;
+	bu->arg = arg;
+	bu->amount = available;
+	bu->read_res = 0;
+	bu->reading = bu->sending = TRUE;
+
+	if (
+		!iouring_read(bio_ring, bu->in_fd, bu->buf, available, offset, TRUE,
+			bio_uring_read_done, bu) ||
+		!iouring_send(bio_ring, bu->out_fd, bu->buf, available,
+			bio_uring_send_done, bu)
+	) {
+		/* Cannot happen since we checked for space above */
+		g_assert_not_reached();
+	}
+
+	if (GNET_PROPERTY(bsched_debug) > 7)
+		g_debug("BSCHED %s(fd=%d, len=%zu) available=%zu",
+			G_STRFUNC, bu->out_fd, len, available);
+
+	bio->flags |= BIO_F_INFLIGHT;
+	if (bio->io_tag)
+		bio_disable(bio);
+
+	bio_uring_schedule();
+
+	return 0;
+}
+
 /**
  * Read at most `len' bytes from `buf' from source's fd, as bandwidth
  * permits.
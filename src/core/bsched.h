@@ -80,6 +80,22 @@ ssize_t bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 ssize_t bio_sendfile(sendfile_ctx_t *ctx, bio_source_t *bio, int in_fd,
 	fileoffset_t *offset, size_t len);
 ssize_t bio_read(bio_source_t *bio, void *data, size_t len);
+
+/**
+ * Completion callback for bio_uring_sendfile().
+ *
+ * @param arg		the user-supplied argument
+ * @param written	amount of bytes written, -1 on error
+ * @param error		the errno value when `written' is -1
+ */
+typedef void (*bio_uring_done_t)(void *arg, ssize_t written, int error);
+
+struct file_object;
+
+bool bio_uring_enabled(void);
+int bio_uring_sendfile(bio_source_t *bio, struct file_object *file,
+	fileoffset_t offset, size_t len, bio_uring_done_t done, void *arg);
+
 ssize_t bio_readv(bio_source_t *bio, iovec_t *iov, int iovcnt);
 ssize_t bws_write(bsched_bws_t bs, wrap_io_t *wio,
 			const void *data, size_t len);
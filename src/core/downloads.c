@@ -44,6 +44,7 @@
 #include "clock.h"
 #include "ctl.h"
 #include "dmesh.h"
+#include "dwrite.h"
 #include "features.h"
 #include "gdht.h"
 #include "geo_ip.h"
@@ -114,7 +115,6 @@
 #include "lib/magnet.h"
 #include "lib/palloc.h"
 #include "lib/parse.h"
-#include "lib/plist.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sequence.h"
@@ -207,6 +207,10 @@ static void download_got_push_route(const guid_t *guid);
 static bool download_dirty;
 static bool download_shutdown;
 static bool queue_frozen_on_write_error;
+static pslist_t *sl_throttled;		/**< Downloads waiting for write pool */
+
+static void download_write_room(void);
+static bool download_write_data(struct download *d);
 
 static void download_store(void);
 static void download_retrieve(void);
@@ -416,19 +420,27 @@ server_host_info(const struct dl_server *server)
  * This `dl_key' is inserted in the `dl_by_host' hash table were we find a
  * `dl_server' structure describing all the downloads for the given host.
  *
- * All `dl_server' structures are also inserted in the `dl_by_time' struct,
- * where hosts are sorted based on their retry time.
+ * The `dl_server' structures with waiting downloads are also inserted in the
+ * `dl_by_time' heap, where hosts are sorted based on the next time we need
+ * to look at them, which is never before their retry time.  This way,
+ * download_pickup_queued() only visits the servers that are due.
  */
 
 static hikset_t *dl_by_host;
 
-#define DHASH_SIZE	(1UL << 10)	/**< Hash list size, must be a power of 2 */
-#define DHASH_MASK 	(DHASH_SIZE - 1)
-#define DL_HASH(x)	((x) & DHASH_MASK)
+#define DL_SCHED_ARITY	4		/**< Children per node in the scheduling heap */
+#define DL_SCHED_MIN	256		/**< Minimum heap capacity */
+
+struct dl_sched {
+	time_t when;				/**< When server needs to be examined */
+	struct dl_server *server;	/**< The scheduled server */
+};
 
 static struct {
-	plist_t *servers[DHASH_SIZE];	/**< Lists of servers, by retry time */
-	int change[DHASH_SIZE];			/**< Counts changes to the list */
+	struct dl_sched *heap;		/**< d-ary min-heap, keyed by `when' */
+	size_t count;				/**< Amount of scheduled servers */
+	size_t capacity;			/**< Allocated heap entries */
+	struct dl_server *picking;	/**< Server being examined, out of the heap */
 } dl_by_time;
 
 /**
@@ -1136,18 +1148,6 @@ dl_retry_cmp(const void *p, const void *q)
 	return CMP(a->retry_after, b->retry_after);
 }
 
-/**
- * Compare two `dl_server' structures based on the `retry_after' field.
- * The smaller that time, the smaller the structure is.
- */
-static int
-dl_server_retry_cmp(const void *p, const void *q)
-{
-	const struct dl_server *a = p, *b = q;
-
-	return CMP(a->retry_after, b->retry_after);
-}
-
 /**
  * @returns whether download has a blank (fake) GUID.
  */
@@ -1322,6 +1322,8 @@ download_init(void)
 	dl_thex = dualhash_new(guid_hash, guid_eq, guid_hash, guid_eq);
 	local_pushes = aging_make(DOWNLOAD_PUSH_FREQ, dl_key_hash, dl_key_eq, NULL);
 
+	dwrite_init(download_write_room);
+
 	header_features_add_guarded(FEATURES_DOWNLOADS, "browse",
 		BH_VERSION_MAJOR, BH_VERSION_MINOR,
 		GNET_PROPERTY_PTR(browse_host_enabled));
@@ -1757,19 +1759,146 @@ buffers_strip_trailing(struct download *d, size_t amount)
 
 /* ----------------------------------------- */
 
+/**
+ * Store entry at position `pos' in the `dl_by_time' heap.
+ */
+static inline void
+dl_sched_set(size_t pos, const struct dl_sched *ds)
+{
+	dl_by_time.heap[pos] = *ds;		/* Struct copy */
+	ds->server->sched_idx = pos + 1;
+}
+
+/**
+ * Move entry at position `pos' up in the heap until its parent is due
+ * no later than itself.
+ */
+static void
+dl_sched_up(size_t pos)
+{
+	struct dl_sched ds = dl_by_time.heap[pos];
+
+	while (pos != 0) {
+		size_t parent = (pos - 1) / DL_SCHED_ARITY;
+
+		if (delta_time(dl_by_time.heap[parent].when, ds.when) <= 0)
+			break;
+
+		dl_sched_set(pos, &dl_by_time.heap[parent]);
+		pos = parent;
+	}
+
+	dl_sched_set(pos, &ds);
+}
+
+/**
+ * Move entry at position `pos' down in the heap until all its children
+ * are due no earlier than itself.
+ */
+static void
+dl_sched_down(size_t pos)
+{
+	struct dl_sched ds = dl_by_time.heap[pos];
+
+	for (;;) {
+		size_t i, first, last, min;
+
+		first = pos * DL_SCHED_ARITY + 1;
+		if (first >= dl_by_time.count)
+			break;
+
+		last = MIN(first + DL_SCHED_ARITY, dl_by_time.count);
+
+		for (min = first, i = first + 1; i < last; i++) {
+			if (
+				delta_time(dl_by_time.heap[i].when,
+					dl_by_time.heap[min].when) < 0
+			)
+				min = i;
+		}
+
+		if (delta_time(ds.when, dl_by_time.heap[min].when) <= 0)
+			break;
+
+		dl_sched_set(pos, &dl_by_time.heap[min]);
+		pos = min;
+	}
+
+	dl_sched_set(pos, &ds);
+}
+
+/**
+ * Schedule server for examination at time `when'.
+ */
+static void
+dl_sched_push(struct dl_server *server, time_t when)
+{
+	struct dl_sched ds;
+
+	g_assert(0 == server->sched_idx);
+
+	if (dl_by_time.count == dl_by_time.capacity) {
+		dl_by_time.capacity = MAX(DL_SCHED_MIN, dl_by_time.capacity * 2);
+		HREALLOC_ARRAY(dl_by_time.heap, dl_by_time.capacity);
+	}
+
+	ds.when = when;
+	ds.server = server;
+	dl_sched_set(dl_by_time.count++, &ds);
+	dl_sched_up(dl_by_time.count - 1);
+}
+
+/**
+ * Remove server from the scheduling heap.
+ */
+static void
+dl_sched_delete(struct dl_server *server)
+{
+	size_t pos = server->sched_idx - 1;
+
+	g_assert(server->sched_idx != 0);
+	g_assert(pos < dl_by_time.count);
+	g_assert(server == dl_by_time.heap[pos].server);
+
+	server->sched_idx = 0;
+
+	if (pos != --dl_by_time.count) {
+		const struct dl_sched *last = &dl_by_time.heap[dl_by_time.count];
+		time_t when = dl_by_time.heap[pos].when;
+
+		dl_sched_set(pos, last);
+
+		if (delta_time(last->when, when) < 0)
+			dl_sched_up(pos);
+		else
+			dl_sched_down(pos);
+	}
+}
+
+/**
+ * Remove the server due first from the scheduling heap.
+ */
+static struct dl_server *
+dl_sched_pop(void)
+{
+	struct dl_server *server = dl_by_time.heap[0].server;
+
+	dl_sched_delete(server);
+	return server;
+}
+
 /**
  * Insert server by retry time into the `dl_by_time' structure.
  */
 static void
 dl_by_time_insert(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
-
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_insert_sorted(dl_by_time.servers[idx],
-		server, dl_server_retry_cmp);
+	if (server == dl_by_time.picking)
+		dl_by_time.picking = NULL;		/* Rescheduled whilst examined */
+
+	dl_sched_push(server, server->retry_after);
 }
 
 /**
@@ -1778,12 +1907,40 @@ dl_by_time_insert(struct dl_server *server)
 static void
 dl_by_time_remove(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
-
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_remove(dl_by_time.servers[idx], server);
+	if (server == dl_by_time.picking)
+		dl_by_time.picking = NULL;		/* Removed whilst examined */
+
+	if (server->sched_idx != 0)
+		dl_sched_delete(server);
+}
+
+/**
+ * Make sure the server will be examined as soon as the download, which
+ * was just put in its waiting list, can be scheduled.
+ */
+static void
+dl_by_time_waiting(struct dl_server *server, const struct download *d)
+{
+	time_t when;
+
+	if (server == dl_by_time.picking)
+		return;			/* Will be rescheduled by download_pickup_queued() */
+
+	when = delta_time(d->retry_after, server->retry_after) > 0 ?
+		d->retry_after : server->retry_after;
+
+	if (0 == server->sched_idx) {
+		dl_sched_push(server, when);
+	} else {
+		size_t pos = server->sched_idx - 1;
+
+		if (delta_time(when, dl_by_time.heap[pos].when) < 0) {
+			dl_by_time.heap[pos].when = when;
+			dl_sched_up(pos);
+		}
+	}
 }
 
 /**
@@ -3260,6 +3417,9 @@ server_list_insert_download_sorted(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_insert_sorted(server_list_by_index(server, idx), d, dl_retry_cmp);
+
+	if (DL_LIST_WAITING == idx)
+		dl_by_time_waiting(server, d);
 }
 
 static void
@@ -4604,11 +4764,17 @@ download_stop_v(struct download *d, download_status_t new_status,
 		was_active = TRUE;
 
 		/*
-		 * If there is unflushed downloaded data, try to flush it now,
-		 * unless the file is already complete.
+		 * Wait for the data being written in the background, which may
+		 * complete the file, then if there is unflushed downloaded data,
+		 * try to flush it now, unless the file is already complete.
 		 */
 
 		if (d->buffers != NULL) {
+			if (d->buffers->throttled) {
+				sl_throttled = pslist_remove(sl_throttled, d);
+				d->buffers->throttled = FALSE;
+			}
+			dwrite_drain(d);
 			if (FILE_INFO_COMPLETE(d->file_info)) {
 				buffers_discard(d);
 			} else {
@@ -6571,186 +6737,239 @@ download_pick_another(const struct download *d)
 }
 
 /**
- * Pick up new downloads from the queue as needed.
+ * Look at the waiting downloads of a server which is due, and start the
+ * best one if possible.
+ *
+ * The server must not be accessed after the download has been started
+ * since the server could be reclaimed as a side effect.
+ *
+ * @param server	the server to examine
+ * @param now		current time
+ * @param next		where the next time the server should be examined is set,
+ *					when no download was started
+ *
+ * @return TRUE if the server needs to be examined again later, FALSE if
+ * it has no more waiting downloads.
  */
-static void
-download_pickup_queued(void)
+static bool
+download_pickup_server(struct dl_server *server, time_t now, time_t *next)
 {
-	time_t now = tm_time();
-	uint i;
+	list_iter_t *iter;
+	struct download *d;
+	uint n;
+	bool only_special = FALSE, skipped = FALSE;
+
+	g_assert(dl_server_valid(server));
+
+	*next = time_advance(now, 1);
+
+	if (server_list_length(server, DL_LIST_WAITING) == 0)
+		return FALSE;
+
+	if (delta_time(now, server->retry_after) < 0) {
+		*next = server->retry_after;
+		return TRUE;
+	}
+
+	if (
+		count_running_on_server(server)
+			>= GNET_PROPERTY(max_host_downloads)
+	) {
+		download_list_send_head_ping(server->list[DL_LIST_WAITING]);
+
+		/*
+		 * Normally, special downloads are served by remote servents
+		 * regardless of the amount of upload slots or per host
+		 * restrictions (since these downloads are small, usually).
+		 *
+		 * Hence, allow such special downloads to be scheduled even
+		 * if we reached the configured local maximum.
+		 */
+
+		only_special = TRUE;
+	}
 
 	/*
-	 * To select downloads, we iterate over the sorted `dl_by_time' list and
-	 * look for something we could schedule.
-	 *
-	 * Note that we jump from one host to the other, even if we have multiple
-	 * things to schedule on the same host: It's better to spread load among
-	 * all hosts first.
+	 * Avoid hammering servers.  In case we have multiple files queued
+	 * on that server, we must not issue all the requests in a short
+	 * period of time as this can be frowned upon.
 	 */
 
-	for (i = 0; i < DHASH_SIZE; i++) {
-		plist_t *l;
-		int last_change;
+	if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY) {
+		*next = time_advance(server->last_connect, DOWNLOAD_CONNECT_DELAY);
+		return TRUE;
+	}
 
-		if (download_queue_is_frozen())
-			break;
+	/*
+	 * OK, select a download within the waiting list, but do not
+	 * remove it yet.  This will be done by download_start().
+	 */
 
-		if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-			break;
+	g_assert(server->list[DL_LIST_WAITING]);	/* Since count != 0 */
 
-		if (!bws_can_connect(SOCK_TYPE_DOWNLOAD))
-			break;
+	n = 0;
+	d = NULL;
+	iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
+	while (list_iter_has_next(iter)) {
+		struct download *cur;
 
-	retry:
-		l = dl_by_time.servers[i];
-		last_change = dl_by_time.change[i];
+		cur = list_iter_next(iter);
+		download_check(cur);
 
-		for (/* NOTHING */; NULL != l; l = plist_next(l)) {
-			struct dl_server *server = l->data;
-			list_iter_t *iter;
-			struct download *d;
-			uint n;
-			bool only_special = FALSE;
+		if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED)) {
+			skipped = TRUE;
+			continue;
+		}
 
-			g_assert(dl_server_valid(server));
+		if (only_special && !download_is_special(cur)) {
+			skipped = TRUE;
+			continue;
+		}
 
-			if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-				break;
+		if (download_has_enough_active_sources(cur)) {
+			download_send_head_ping(cur);
+			skipped = TRUE;
+			continue;
+		}
 
+		if (
+			delta_time(now, cur->last_update) <=
+				(time_delta_t) cur->timeout_delay
+		) {
+			download_send_head_ping(cur);
+			skipped = TRUE;
+			continue;
+		}
+
+		/* Note that we skip over paused and suspended downloads */
+		if (delta_time(now, cur->retry_after) < 0) {
 			/*
-			 * List is sorted, so as soon as we go beyond the current time,
-			 * we can stop.
+			 * List is sorted: if we did not have to skip anything, the
+			 * server will not have anything to schedule before that
+			 * download becomes due.
 			 */
 
-			if (delta_time(now, server->retry_after) < 0)
-				break;
-
-			if (server_list_length(server, DL_LIST_WAITING) == 0)
-				continue;
-
-			if (
-				count_running_on_server(server)
-					>= GNET_PROPERTY(max_host_downloads)
-			) {
-				download_list_send_head_ping(server->list[DL_LIST_WAITING]);
+			if (NULL == d && !skipped)
+				*next = cur->retry_after;
+			break;
+		}
 
+		if (d) {
+			if ((NULL != d->thex) == (NULL != cur->thex)) {
 				/*
-				 * Normally, special downloads are served by remote servents
-				 * regardless of the amount of upload slots or per host
-				 * restrictions (since these downloads are small, usually).
-				 *
-				 * Hence, allow such special downloads to be scheduled even
-				 * if we reached the configured local maximum.
+				 * Pick the download with the most progress. Otherwise
+				 * we easily end up with dozens of partials from the
+				 * the server.
 				 */
 
-				only_special = TRUE;
+				if (
+					download_total_progress(d)
+						>= download_total_progress(cur)
+				) {
+					download_send_head_ping(cur);
+					continue;
+				}
 			}
 
-			/*
-			 * Avoid hammering servers.  In case we have multiple files queued
-			 * on that server, we must not issue all the requests in a short
-			 * period of time as this can be frowned upon.
-			 */
-
-			if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY)
+			/* Give priority to THEX downloads */
+			if (d->thex && NULL == cur->thex) {
+				download_send_head_ping(cur);
 				continue;
+			}
+		}
 
-			/*
-			 * OK, select a download within the waiting list, but do not
-			 * remove it yet.  This will be done by download_start().
-			 */
+		if (d)
+			download_send_head_ping(d);
 
-			g_assert(server->list[DL_LIST_WAITING]);	/* Since count != 0 */
+		d = cur;
 
-			n = 0;
-			d = NULL;
-			iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
-			while (list_iter_has_next(iter)) {
-				struct download *cur;
+		/*
+		 * If there are a lot of downloads queued at a single server we
+		 * might spend a lot of time scanning the queue of a download
+		 * to pick. Thus limit the amount of items we're going to take
+		 * into account.
+		 */
 
-				cur = list_iter_next(iter);
-				download_check(cur);
+		if (n++ > 100)
+			break;
+	}
+	list_iter_free(&iter);
 
-				if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
-					continue;
+	if (d)
+		download_start(d, FALSE);
 
-				if (only_special && !download_is_special(cur))
-					continue;
+	return TRUE;
+}
 
-				if (download_has_enough_active_sources(cur)) {
-					download_send_head_ping(cur);
-					continue;
-				}
+/**
+ * Pick up new downloads from the queue as needed.
+ */
+static void
+download_pickup_queued(void)
+{
+	time_t now = tm_time();
+	uint examined = 0;
 
-				if (
-					delta_time(now, cur->last_update) <=
-						(time_delta_t) cur->timeout_delay
-				) {
-					download_send_head_ping(cur);
-					continue;
-				}
+	/*
+	 * To select downloads, we extract from the `dl_by_time' heap the servers
+	 * that are due and look for something we could schedule.
+	 *
+	 * Note that we jump from one host to the other, even if we have multiple
+	 * things to schedule on the same host: It's better to spread load among
+	 * all hosts first.
+	 */
 
-				/* Note that we skip over paused and suspended downloads */
-				if (delta_time(now, cur->retry_after) < 0)
-					break;	/* List is sorted */
+	while (dl_by_time.count != 0) {
+		struct dl_server *server;
+		time_t next;
+		bool again;
 
-				if (d) {
-					if ((NULL != d->thex) == (NULL != cur->thex)) {
-						/*
-						 * Pick the download with the most progress. Otherwise
-						 * we easily end up with dozens of partials from the
-						 * the server.
-						 */
+		if (download_queue_is_frozen())
+			break;
 
-						if (
-							download_total_progress(d)
-								>= download_total_progress(cur)
-						) {
-							download_send_head_ping(cur);
-							continue;
-						}
-					}
+		if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
+			break;
 
-					/* Give priority to THEX downloads */
-					if (d->thex && NULL == cur->thex) {
-						download_send_head_ping(cur);
-						continue;
-					}
-				}
+		if (!bws_can_connect(SOCK_TYPE_DOWNLOAD))
+			break;
 
-				if (d)
-					download_send_head_ping(d);
+		/*
+		 * Heap is sorted, so as soon as we go beyond the current time,
+		 * we can stop.
+		 */
 
-				d = cur;
+		if (delta_time(now, dl_by_time.heap[0].when) < 0)
+			break;
 
-				/*
-				 * If there are a lot of downloads queued at a single server we
-				 * might spend a lot of time scanning the queue of a download
-				 * to pick. Thus limit the amount of items we're going to take
-				 * into account.
-				 */
+		server = dl_sched_pop();
+		examined++;
 
-				if (n++ > 100)
-					break;
-			}
-			list_iter_free(&iter);
+		/*
+		 * It's possible that download_start() ends-up rescheduling or
+		 * removing the server we're examining.  That's why it is flagged
+		 * as being picked: dl_by_time_insert() and dl_by_time_remove() will
+		 * clear the flag, and we must then leave the server alone.
+		 *
+		 * When re-inserted, the server is always scheduled in the future so
+		 * we cannot loop here.
+		 */
 
-			if (d) {
-				download_start(d, FALSE);
-			}
+		dl_by_time.picking = server;
+		again = download_pickup_server(server, now, &next);
 
+		if (server == dl_by_time.picking) {
+			dl_by_time.picking = NULL;
+			if (again)
+				dl_sched_push(server, next);
+		}
+	}
 
-			/*
-			 * It's possible that download_start() ended-up changing the
-			 * dl_by_time list we're iterating over.  That's why all changes
-			 * to that list update the dl_by_time_change variable, which we
-			 * snapshot upon entry into the loop.
-			 *		--RAM, 24/08/2002.
-			 */
+	gnet_stats_count_general(GNR_DL_PICKUP_SERVERS_EXAMINED, examined);
+	gnet_stats_set_general(GNR_DL_PICKUP_SERVERS_SCHEDULED, dl_by_time.count);
 
-			if (last_change != dl_by_time.change[i])
-				goto retry;
-		}
+	if (GNET_PROPERTY(download_debug) > 5 && examined != 0) {
+		g_debug("%s(): examined %u server%s out of %zu scheduled",
+			G_STRFUNC, examined, plural(examined), dl_by_time.count);
 	}
 }
 
@@ -9174,6 +9393,29 @@ out:
 	return success;
 }
 
+/**
+ * Freeze the download queue if the write error is due to a disk condition
+ * that will also affect the other downloads.
+ */
+static void
+download_write_error_check(int error)
+{
+	switch (error) {
+	case ENOSPC:	/* No space left */
+		queue_frozen_on_write_error = TRUE;
+		/* FALL THROUGH */
+	case EDQUOT:	/* quota exceeded */
+	case EROFS:		/* read-only filesystem */
+	case EIO:		/* I/O error */
+		if (!download_queue_is_frozen()) {
+			download_freeze_queue();
+			g_warning("freezing download queue due to write error: %s",
+				g_strerror(error));
+		}
+		break;
+	}
+}
+
 /**
  * Flush buffered data to disk.
  *
@@ -9196,6 +9438,21 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	g_assert(b != NULL);
 	g_assert(d->status == GTA_DL_RECEIVING);
 
+	/*
+	 * Data written synchronously must land after the data being written
+	 * in the background, which must have been successfully written.
+	 */
+
+	dwrite_drain(d);
+
+	if (b->error != 0) {
+		if (may_stop) {
+			download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
+				_("Can't save data: %s"), g_strerror(b->error));
+		}
+		return FALSE;
+	}
+
 	if (GNET_PROPERTY(download_debug) > 10)
 		g_debug("flushing %lu bytes (%u buffers) for \"%s\"%s",
 			(ulong) b->held, slist_length(b->list),
@@ -9285,23 +9542,10 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	if ((ssize_t) -1 == written) {
 		const char *error;
 
-		switch (errno) {
-		case ENOSPC:	/* No space left */
-			queue_frozen_on_write_error = TRUE;
-			/* FALL THROUGH */
-		case EDQUOT:	/* quota exceeded */
-		case EROFS:		/* read-only filesystem */
-		case EIO:		/* I/O error */
-			if (!download_queue_is_frozen()) {
-				download_freeze_queue();
-				g_warning("freezing download queue due to write error: %m");
-			}
-			break;
-		}
-
 	   	error = g_strerror(errno);
-		g_warning("write of %lu bytes to file \"%s\" failed: %m",
-			(ulong) b->held, download_basename(d));
+		download_write_error_check(errno);
+		g_warning("write of %lu bytes to file \"%s\" failed: %s",
+			(ulong) b->held, download_basename(d), error);
 
 		/* FIXME: We should never discard downloaded data! This
 		 * causes a re-download of the same data. Instead we should
@@ -9509,6 +9753,141 @@ cleanup:
 	atom_sha1_free_null(&sha1);
 }
 
+/**
+ * Completion callback for data written in the background.
+ *
+ * The download is still active: all its pending writes are drained before
+ * it can be stopped.  We do not stop it here on errors, the error being
+ * recorded and handled the next time we attempt to write data.
+ */
+static void
+download_write_done(void *arg, filesize_t offset, size_t len,
+	size_t written, int error)
+{
+	struct download *d = arg;
+	struct dl_buffers *b;
+	fileinfo_t *fi;
+
+	download_check(d);
+	g_assert(d->buffers != NULL);
+	g_assert(d->buffers->inflight >= len);
+
+	b = d->buffers;
+	fi = d->file_info;
+
+	b->inflight -= len;
+
+	if (fi->buffered >= len)
+		fi->buffered -= len;
+	else
+		fi->buffered = 0;		/* Not critical, be fault-tolerant */
+
+	if (written != 0) {
+		file_info_update(d, offset, offset + written, DL_CHUNK_DONE);
+		gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
+			GNET_PROPERTY(dl_byte_count) + written);
+	}
+
+	if (written < len) {
+		if (0 == error)
+			error = EIO;
+
+		g_warning("background write of %lu bytes at offset %s to "
+			"file \"%s\" failed after %lu byte%s: %s",
+			(ulong) len, uint64_to_string(offset), download_basename(d),
+			(ulong) written, plural(written), g_strerror(error));
+
+		download_write_error_check(error);
+
+		if (0 == b->error)
+			b->error = error;
+	}
+}
+
+/**
+ * Hand buffered data over to the background writer.
+ *
+ * When the write pool is full, reception is disabled and the data are kept
+ * in the buffers until download_write_room() is invoked.
+ *
+ * @return TRUE if data were handled (submitted or kept whilst throttled),
+ * FALSE if they must be written synchronously.
+ */
+static bool
+download_write_async(struct download *d)
+{
+	struct dl_buffers *b;
+	slist_t *data;
+	size_t len;
+
+	download_check(d);
+	g_assert(d->buffers != NULL);
+
+	b = d->buffers;
+	len = b->held;
+
+	if (b->throttled)
+		return TRUE;		/* Already waiting for room */
+
+	if (!dwrite_has_room(len)) {
+		rx_disable(d->rx);
+		b->throttled = TRUE;
+		sl_throttled = pslist_append(sl_throttled, d);
+		gnet_stats_inc_general(GNR_DL_WRITES_THROTTLED);
+		return TRUE;
+	}
+
+	/*
+	 * The data held are now accounted for in b->inflight, until the write
+	 * completes: fi->buffered is left as is, since data are still not
+	 * present in the file.
+	 */
+
+	data = b->list;
+	b->list = slist_new();
+	b->held = 0;
+	b->mode = DL_BUF_READING;
+
+	if (!dwrite_submit(d->out_file, d->pos, data, len, download_write_done, d)) {
+		/* Could not launch the writer, restore buffers */
+		slist_free(&b->list);
+		b->list = data;
+		b->held = len;
+		return FALSE;
+	}
+
+	b->inflight += len;
+	d->pos += len;
+
+	return TRUE;
+}
+
+/**
+ * Called when the background write pool has room again, to resume the
+ * downloads we throttled.
+ */
+static void
+download_write_room(void)
+{
+	while (sl_throttled != NULL) {
+		struct download *d = sl_throttled->data;
+
+		download_check(d);
+		g_assert(d->buffers != NULL);
+		g_assert(d->buffers->throttled);
+
+		if (!dwrite_has_room(d->buffers->held))
+			break;
+
+		sl_throttled = pslist_remove(sl_throttled, d);
+		d->buffers->throttled = FALSE;
+		rx_enable(d->rx);
+
+		if (buffers_should_flush(d))
+			download_write_data(d);
+	}
+}
+
 /**
  * Write data in socket buffer to file.
  *
@@ -9594,8 +9973,31 @@ download_write_data(struct download *d)
 	if (!should_flush)
 		return TRUE;
 
-	if (!download_flush(d, &trimmed, TRUE))
+	if (b->error != 0) {
+		download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
+			_("Can't save data: %s"), g_strerror(b->error));
 		return FALSE;
+	}
+
+	/*
+	 * Unless we are about to complete the chunk or the file, hand the
+	 * data over to the background writer: the chunk status is updated
+	 * as writes complete.  Completing writes are synchronous, after all
+	 * the pending writes for this download have been performed.
+	 */
+
+	if (
+		dwrite_enabled() &&
+		buffers_should_flush(d) &&
+		d->pos + b->held < d->chunk.end &&
+		download_filedone(d) < download_filesize(d) &&
+		download_write_async(d)
+	) {
+		if (b->throttled)
+			return TRUE;		/* Data kept until write pool has room */
+	} else if (!download_flush(d, &trimmed, TRUE)) {
+		return FALSE;
+	}
 
 	/*
 	 * End download if we have completed it.
@@ -16091,6 +16493,10 @@ download_close(void)
 	hikset_free_null(&dl_by_id);
 	htable_free_null(&dhl_by_sha1);
 	dualhash_destroy_null(&dl_thex);
+	HFREE_NULL(dl_by_time.heap);
+	pslist_free_null(&sl_throttled);
+	dwrite_close();
+	dl_by_time.count = dl_by_time.capacity = 0;
 }
 
 static char *
@@ -0,0 +1,620 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Asynchronous write-behind of downloaded data.
+ *
+ * Downloads hand over their filled reception buffers, which are written
+ * to disk by a dedicated thread so that a slow disk does not stall the
+ * main thread, and hence all the other connections.
+ *
+ * Writes to the same file that are adjacent are coalesced into a single
+ * request as long as the writer has not started to process it.  Requests
+ * are processed in submission order and completion callbacks are invoked
+ * in the main thread, in the order of completion, each request invoking
+ * the callbacks of the writes it holds by increasing file offset.
+ *
+ * The data held by the pool are bounded by the "download_write_pool"
+ * property: when a write cannot be accepted, the caller is expected to
+ * throttle its reception until the room callback is invoked.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "dwrite.h"
+#include "gnet_stats.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/cond.h"
+#include "lib/eslist.h"
+#include "lib/halloc.h"
+#include "lib/iovec.h"
+#include "lib/mutex.h"
+#include "lib/pmsg.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define DWRITE_COALESCE_MAX	(1024 * 1024)	/**< Max size of a request */
+
+enum dwrite_req_magic { DWRITE_REQ_MAGIC = 0x2d5e07a1 };
+
+/**
+ * A write submitted by a caller.
+ */
+struct dwrite_seg {
+	dwrite_cb_t cb;				/**< Completion callback */
+	void *arg;					/**< Callback argument */
+	filesize_t offset;			/**< File offset */
+	size_t len;					/**< Length of data */
+	slink_t lk;					/**< Embedded link in request */
+};
+
+/**
+ * A write request, made of one or more adjacent writes to the same file.
+ */
+struct dwrite_req {
+	enum dwrite_req_magic magic;
+	const file_object_t *fo;	/**< File to write to */
+	filesize_t offset;			/**< Starting file offset */
+	size_t len;					/**< Total length of data */
+	slist_t *data;				/**< Data to write (pmsg_t), in file order */
+	eslist_t segs;				/**< Writes held (dwrite_seg), by offset */
+	size_t written;				/**< Amount written by the writer thread */
+	int error;					/**< errno when written < len */
+	slink_t lk;					/**< Embedded link in pool queues */
+};
+
+static inline void
+dwrite_req_check(const struct dwrite_req * const r)
+{
+	g_assert(r != NULL);
+	g_assert(DWRITE_REQ_MAGIC == r->magic);
+}
+
+/**
+ * The pool of pending writes.
+ *
+ * The queues and thread states are protected by the pool lock.  The amount
+ * of data held and the room requests are only handled by the main thread.
+ */
+static struct dwrite_pool {
+	mutex_t lock;				/**< Thread-safe lock for the queues */
+	cond_t work;				/**< Signalled when a request is queued */
+	cond_t done;				/**< Signalled when a request is processed */
+	eslist_t pending;			/**< Requests to process, FIFO */
+	eslist_t completed;			/**< Processed requests, FIFO */
+	struct dwrite_req *active;	/**< Request being processed */
+	dwrite_room_cb_t room;		/**< Invoked when room is available again */
+	size_t bytes;				/**< Data held in the pool */
+	uint8 running;				/**< Whether writer thread is running */
+	uint8 exiting;				/**< Set when writer must terminate */
+	uint8 posted;				/**< Whether dispatching event was posted */
+	uint8 want_room;			/**< Whether room callback is expected */
+	uint8 inited;				/**< Whether pool was initialized */
+} dwrite_pool = {
+	MUTEX_INIT,
+	COND_INIT,
+	COND_INIT,
+	ESLIST_INIT(offsetof(struct dwrite_req, lk)),
+	ESLIST_INIT(offsetof(struct dwrite_req, lk)),
+	NULL,
+	NULL,
+	0,
+	FALSE,
+	FALSE,
+	FALSE,
+	FALSE,
+	FALSE,
+};
+
+#define DWRITE_LOCK		mutex_lock(&dwrite_pool.lock)
+#define DWRITE_UNLOCK	mutex_unlock(&dwrite_pool.lock)
+
+/**
+ * Write request data to the file.
+ *
+ * Runs in the writer thread, without holding the pool lock: the request
+ * is no longer visible to the main thread until it is put in the list of
+ * completed requests.
+ */
+static void
+dwrite_process(struct dwrite_req *r)
+{
+	iovec_t *iov, *v;
+	int cnt;
+	size_t held;
+
+	dwrite_req_check(r);
+
+	iov = pmsg_slist_to_iovec(r->data, &cnt, &held);
+	g_assert(held == r->len);
+
+	v = iov;
+
+	while (r->written < r->len) {
+		ssize_t w;
+		size_t n;
+
+		w = file_object_pwritev(r->fo, v, cnt, r->offset + r->written);
+
+		if ((ssize_t) -1 == w) {
+			if (EINTR == errno)
+				continue;
+			r->error = errno;
+			break;
+		} else if (0 == w) {
+			r->error = EIO;
+			break;
+		}
+
+		r->written += w;
+
+		/*
+		 * Skip what was fully written and adjust the partially written
+		 * vector, if any, before writing the remaining data.
+		 */
+
+		for (n = w; cnt > 0 && n >= iovec_len(v); v++, cnt--)
+			n -= iovec_len(v);
+
+		if (n != 0) {
+			iovec_set_base(v, ptr_add_offset(iovec_base(v), n));
+			iovec_set_len(v, iovec_len(v) - n);
+		}
+	}
+
+	HFREE_NULL(iov);
+}
+
+/**
+ * Free request and its data.
+ */
+static void
+dwrite_req_free(struct dwrite_req *r)
+{
+	dwrite_req_check(r);
+
+	pmsg_slist_free_all(&r->data);
+	eslist_wfree(&r->segs, sizeof(struct dwrite_seg));
+	r->magic = 0;
+	WFREE(r);
+}
+
+/**
+ * Invoke completion callbacks for all the writes held in the request,
+ * then free it.
+ */
+static void
+dwrite_complete(struct dwrite_req *r)
+{
+	struct dwrite_seg *s;
+
+	dwrite_req_check(r);
+
+	ESLIST_FOREACH_DATA(&r->segs, s) {
+		size_t start = s->offset - r->offset;
+		size_t written = 0;
+
+		if (r->written > start)
+			written = MIN(s->len, r->written - start);
+
+		g_assert(dwrite_pool.bytes >= s->len);
+		dwrite_pool.bytes -= s->len;
+
+		(*s->cb)(s->arg, s->offset, s->len, written,
+			written < s->len ? r->error : 0);
+	}
+
+	dwrite_req_free(r);
+}
+
+/**
+ * Invoke completion callbacks for all the processed requests.
+ *
+ * @param room		whether to notify that room is available again
+ */
+static void
+dwrite_dispatch(bool room)
+{
+	for (;;) {
+		struct dwrite_req *r;
+
+		DWRITE_LOCK;
+		r = eslist_shift(&dwrite_pool.completed);
+		if (NULL == r)
+			dwrite_pool.posted = FALSE;
+		DWRITE_UNLOCK;
+
+		if (NULL == r)
+			break;
+
+		dwrite_complete(r);
+	}
+
+	/*
+	 * Let throttled writers resume once the pool is 3/4 full at most.
+	 */
+
+	if (
+		room && dwrite_pool.want_room && dwrite_pool.room != NULL &&
+		dwrite_pool.bytes <= GNET_PROPERTY(download_write_pool) / 4 * 3
+	) {
+		dwrite_pool.want_room = FALSE;
+		(*dwrite_pool.room)();
+	}
+}
+
+/**
+ * Event posted by the writer thread to the main thread to dispatch the
+ * completed requests.
+ */
+static void
+dwrite_dispatch_event(void *unused_arg)
+{
+	(void) unused_arg;
+
+	dwrite_dispatch(TRUE);
+}
+
+/**
+ * Writer thread main loop.
+ */
+static void *
+dwrite_thread_main(void *unused_arg)
+{
+	(void) unused_arg;
+
+	thread_set_name("download writer");
+
+	DWRITE_LOCK;
+
+	for (;;) {
+		struct dwrite_req *r;
+		bool post = FALSE;
+
+		r = eslist_shift(&dwrite_pool.pending);
+
+		if (NULL == r) {
+			if (dwrite_pool.exiting)
+				break;
+			cond_wait(&dwrite_pool.work, &dwrite_pool.lock);
+			continue;
+		}
+
+		dwrite_pool.active = r;
+		DWRITE_UNLOCK;
+
+		dwrite_process(r);
+
+		DWRITE_LOCK;
+		dwrite_pool.active = NULL;
+		eslist_append(&dwrite_pool.completed, r);
+		if (!dwrite_pool.posted)
+			post = dwrite_pool.posted = TRUE;
+		cond_broadcast(&dwrite_pool.done, &dwrite_pool.lock);
+
+		if (post) {
+			DWRITE_UNLOCK;
+			teq_safe_post(THREAD_MAIN_ID, dwrite_dispatch_event, NULL);
+			DWRITE_LOCK;
+		}
+	}
+
+	dwrite_pool.running = FALSE;
+	DWRITE_UNLOCK;
+
+	return NULL;
+}
+
+/**
+ * Make sure the writer thread is running.
+ *
+ * @return TRUE if it is.
+ */
+static bool
+dwrite_spawn(void)
+{
+	int r;
+
+	if G_LIKELY(dwrite_pool.running)
+		return TRUE;
+
+	DWRITE_LOCK;
+	dwrite_pool.running = TRUE;
+	dwrite_pool.exiting = FALSE;
+	DWRITE_UNLOCK;
+
+	/*
+	 * The writer is a detached thread: to end it, we flag the pool
+	 * as exiting and wake it up.
+	 */
+
+	r = thread_create(dwrite_thread_main, NULL,
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_NO_POOL,
+			THREAD_STACK_MIN);
+
+	if (-1 == r) {
+		g_warning("%s(): cannot create writer thread: %s",
+			G_STRFUNC, g_strerror(errno));
+		DWRITE_LOCK;
+		dwrite_pool.running = FALSE;
+		DWRITE_UNLOCK;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Check whether background writing is enabled.
+ */
+bool
+dwrite_enabled(void)
+{
+	return dwrite_pool.inited && GNET_PROPERTY(download_write_async);
+}
+
+/**
+ * Check whether there is room in the pool to accept `len' more bytes.
+ *
+ * When there is not, the room callback will be invoked as soon as the
+ * pool has drained enough.
+ */
+bool
+dwrite_has_room(size_t len)
+{
+	g_assert(thread_is_main());
+
+	if (
+		0 == dwrite_pool.bytes ||
+		dwrite_pool.bytes + len <= GNET_PROPERTY(download_write_pool)
+	)
+		return TRUE;
+
+	dwrite_pool.want_room = TRUE;
+	return FALSE;
+}
+
+/**
+ * Find pending request to which a write can be merged.
+ *
+ * @return the request, NULL if none.
+ */
+static struct dwrite_req *
+dwrite_coalesce(const file_object_t *fo, filesize_t offset,
+	const slist_t *data, size_t len)
+{
+	struct dwrite_req *r;
+
+	ESLIST_FOREACH_DATA(&dwrite_pool.pending, r) {
+		dwrite_req_check(r);
+
+		if (r->fo != fo)
+			continue;
+
+		if (r->len + len > DWRITE_COALESCE_MAX)
+			continue;
+
+		if (slist_length(r->data) + slist_length(data) > MAX_IOV_COUNT)
+			continue;
+
+		if (r->offset + r->len == offset || offset + len == r->offset)
+			return r;
+	}
+
+	return NULL;
+}
+
+/**
+ * Submit data to be written in the background.
+ *
+ * The file object must remain valid until the completion callback has
+ * been invoked, which dwrite_drain() can be used to ensure.
+ *
+ * @param fo		the file to write to
+ * @param offset	the file offset where data must be written
+ * @param data		the list of pmsg_t to write, taken over by the pool
+ * @param len		the total amount of data in the list
+ * @param cb		completion callback, invoked in the main thread
+ * @param arg		additional callback argument
+ *
+ * @return TRUE if data were accepted, FALSE if they were not and must
+ * be written synchronously by the caller.
+ */
+bool
+dwrite_submit(const file_object_t *fo, filesize_t offset,
+	slist_t *data, size_t len, dwrite_cb_t cb, void *arg)
+{
+	struct dwrite_req *r;
+	struct dwrite_seg *s;
+
+	g_assert(thread_is_main());
+	g_assert(fo != NULL);
+	g_assert(data != NULL);
+	g_assert(len != 0);
+	g_assert(cb != NULL);
+
+	if (!dwrite_enabled() || !dwrite_spawn())
+		return FALSE;
+
+	WALLOC0(s);
+	s->cb = cb;
+	s->arg = arg;
+	s->offset = offset;
+	s->len = len;
+
+	DWRITE_LOCK;
+
+	r = dwrite_coalesce(fo, offset, data, len);
+
+	if (r != NULL) {
+		pmsg_t *mb;
+
+		if (offset == r->offset + r->len) {
+			while (NULL != (mb = slist_shift(data)))
+				slist_append(r->data, mb);
+			slist_free(&data);
+			eslist_append(&r->segs, s);
+		} else {
+			while (NULL != (mb = slist_shift(r->data)))
+				slist_append(data, mb);
+			slist_free(&r->data);
+			r->data = data;
+			r->offset = offset;
+			eslist_prepend(&r->segs, s);
+		}
+
+		r->len += len;
+		gnet_stats_inc_general(GNR_DL_WRITES_COALESCED);
+	} else {
+		WALLOC0(r);
+		r->magic = DWRITE_REQ_MAGIC;
+		r->fo = fo;
+		r->offset = offset;
+		r->len = len;
+		r->data = data;
+		eslist_init(&r->segs, offsetof(struct dwrite_seg, lk));
+		eslist_append(&r->segs, s);
+		eslist_append(&dwrite_pool.pending, r);
+		cond_signal(&dwrite_pool.work, &dwrite_pool.lock);
+	}
+
+	DWRITE_UNLOCK;
+
+	dwrite_pool.bytes += len;
+	gnet_stats_inc_general(GNR_DL_WRITES_ASYNC);
+
+	return TRUE;
+}
+
+/**
+ * Check whether request holds writes for the specified callback argument.
+ */
+static bool
+dwrite_req_holds(const struct dwrite_req *r, const void *arg)
+{
+	const struct dwrite_seg *s;
+
+	dwrite_req_check(r);
+
+	ESLIST_FOREACH_DATA(&r->segs, s) {
+		if (NULL == arg || s->arg == arg)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Wait until all the writes submitted with the specified callback argument
+ * have been processed, and invoke their completion callbacks.
+ *
+ * The room callback is not invoked from here, since we can be called
+ * in the middle of some processing by the caller.
+ *
+ * @param arg		the callback argument, NULL meaning all the writes
+ */
+void
+dwrite_drain(const void *arg)
+{
+	g_assert(thread_is_main());
+
+	if (!dwrite_pool.inited)
+		return;
+
+	DWRITE_LOCK;
+
+	for (;;) {
+		const struct dwrite_req *r;
+		bool busy;
+
+		busy = dwrite_pool.active != NULL &&
+			dwrite_req_holds(dwrite_pool.active, arg);
+
+		if (!busy) {
+			ESLIST_FOREACH_DATA(&dwrite_pool.pending, r) {
+				if (dwrite_req_holds(r, arg)) {
+					busy = TRUE;
+					break;
+				}
+			}
+		}
+
+		if (!busy)
+			break;
+
+		cond_wait(&dwrite_pool.done, &dwrite_pool.lock);
+	}
+
+	DWRITE_UNLOCK;
+
+	dwrite_dispatch(FALSE);
+}
+
+/**
+ * Initialize the write pool.
+ *
+ * @param room		callback to invoke when room is available after a
+ *					refusal from dwrite_has_room()
+ */
+void
+dwrite_init(dwrite_room_cb_t room)
+{
+	dwrite_pool.room = room;
+	dwrite_pool.inited = TRUE;
+}
+
+/**
+ * Shutdown the write pool, flushing all pending data.
+ */
+void
+dwrite_close(void)
+{
+	if (!dwrite_pool.inited)
+		return;
+
+	dwrite_drain(NULL);
+
+	DWRITE_LOCK;
+	dwrite_pool.exiting = TRUE;
+	cond_broadcast(&dwrite_pool.work, &dwrite_pool.lock);
+	DWRITE_UNLOCK;
+
+	g_assert(0 == dwrite_pool.bytes);
+
+	dwrite_pool.inited = FALSE;
+	dwrite_pool.room = NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
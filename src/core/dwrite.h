@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Asynchronous write-behind of downloaded data.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_dwrite_h_
+#define _core_dwrite_h_
+
+#include "common.h"
+
+#include "lib/file_object.h"
+#include "lib/slist.h"
+
+/**
+ * Completion callback, invoked in the main thread.
+ *
+ * @param arg		the user-supplied argument
+ * @param offset	file offset of the data
+ * @param len		amount of data that was submitted
+ * @param written	amount of data written, from `offset'
+ * @param error		errno value when written < len
+ */
+typedef void (*dwrite_cb_t)(void *arg,
+	filesize_t offset, size_t len, size_t written, int error);
+
+/**
+ * Callback invoked in the main thread when room becomes available in the
+ * pool after a submission was refused.
+ */
+typedef void (*dwrite_room_cb_t)(void);
+
+/*
+ * Public interface.
+ */
+
+void dwrite_init(dwrite_room_cb_t room);
+void dwrite_close(void);
+
+bool dwrite_enabled(void);
+bool dwrite_has_room(size_t len);
+bool dwrite_submit(const file_object_t *fo, filesize_t offset,
+	slist_t *data, size_t len, dwrite_cb_t cb, void *arg);
+void dwrite_drain(const void *arg);
+
+#endif /* _core_dwrite_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -66,7 +66,9 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
+#include "lib/dbstore.h"
 #include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
@@ -76,8 +78,10 @@
 #include "lib/filename.h"
 #include "lib/glib-missing.h"
 #include "lib/halloc.h"
+#include "lib/hashing.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/http_range.h"
 #include "lib/idtable.h"
@@ -85,6 +89,7 @@
 #include "lib/mempcpy.h"
 #include "lib/parse.h"
 #include "lib/path.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/rbtree.h"
@@ -139,6 +144,8 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded node in fi->chunkmap */
+	rbnode_t enode;					/**< Embedded node in fi->emptymap */
 };
 
 static inline void
@@ -205,6 +212,30 @@ static hikset_t *fi_by_guid;
 
 static const char file_info_file[] = "fileinfo";
 static const char file_info_what[] = "fileinfo database";
+
+/*
+ * Fileinfo records are persisted in a DBMW keyed by the fileinfo GUID, so
+ * that only the records that changed need to be written.
+ */
+
+#define FI_DB_CACHE_SIZE	1			/**< No write-back caching */
+#define FI_DB_VALUE_MAX		(128 * 1024)	/**< Max serialized record size */
+#define FI_DB_VERSION		1			/**< Serialization version */
+
+#define FI_DB_F_SIZE_KNOWN	(1U << 0)	/**< fi->file_size_known */
+#define FI_DB_F_PAUSED		(1U << 1)	/**< FI_F_PAUSED */
+#define FI_DB_F_SWARMING	(1U << 2)	/**< fi->use_swarming */
+
+#define FI_DB_H_SHA1		(1U << 0)	/**< Server SHA1 follows */
+#define FI_DB_H_TTH			(1U << 1)	/**< Server TTH follows */
+#define FI_DB_H_CHA1		(1U << 2)	/**< Computed SHA1 follows */
+
+static dbmw_t *db_fileinfo;
+static char db_fileinfo_base[] = "fileinfo";
+static char db_fileinfo_what[] = "File information";
+
+static pslist_t *fi_db_removed;		/**< GUID atoms of removed records */
+static bool fi_db_migrating;		/**< Legacy text database was loaded */
 static bool fileinfo_dirty = FALSE;
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
@@ -641,6 +672,151 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/**
+ * Compares two offered ranges so that two ranges are equal when they overlap.
+ */
+static int
+fi_chunk_overlap_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+/**
+ * Initialize the chunk indexes of a fileinfo.
+ */
+static void
+fi_chunkmap_init(fileinfo_t *fi)
+{
+	erbtree_init(&fi->chunkmap, fi_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, node));
+	erbtree_init(&fi->emptymap, fi_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, enode));
+}
+
+/**
+ * Index chunk in the fileinfo range trees.
+ *
+ * Chunks must not overlap, but we can be called whilst loading a possibly
+ * corrupted chunk list: overlapping chunks are then left out of the trees
+ * and the whole list will be discarded by file_info_check_chunklist().
+ */
+static void
+fi_chunk_index(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	if (erbtree_insert(&fi->chunkmap, &fc->node) != NULL)
+		return;
+
+	if (DL_CHUNK_EMPTY == fc->status)
+		erbtree_insert(&fi->emptymap, &fc->enode);
+}
+
+/**
+ * Remove chunk from the fileinfo range trees.
+ */
+static void
+fi_chunk_unindex(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	erbtree_remove(&fi->chunkmap, &fc->node);
+
+	if (DL_CHUNK_EMPTY == fc->status)
+		erbtree_remove(&fi->emptymap, &fc->enode);
+}
+
+/**
+ * Append new chunk at the tail of the fileinfo chunk list.
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	dl_file_chunk_check(fc);
+
+	eslist_append(&fi->chunklist, fc);
+	fi_chunk_index(fi, fc);
+}
+
+/**
+ * Insert new chunk `nfc' right after `fc' in the fileinfo chunk list.
+ *
+ * The range of `fc' must have already been adjusted so that `nfc' does
+ * not overlap with any other chunk.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	dl_file_chunk_check(fc);
+	dl_file_chunk_check(nfc);
+	g_assert(fc->to <= nfc->from);
+
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	fi_chunk_index(fi, nfc);
+
+	g_assert(nfc == erbtree_lookup(&fi->chunkmap, nfc));
+}
+
+/**
+ * Remove the chunk following `fc' in the fileinfo chunk list.
+ *
+ * @return the removed chunk, which the caller must free.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *nfc;
+
+	nfc = eslist_remove_after(&fi->chunklist, fc);
+	dl_file_chunk_check(nfc);
+	fi_chunk_unindex(fi, nfc);
+
+	return nfc;
+}
+
+/**
+ * Change the status of an indexed chunk, keeping the empty chunk index
+ * up-to-date.
+ */
+static void
+fi_chunk_set_status(fileinfo_t *fi,
+	struct dl_file_chunk *fc, enum dl_chunk_status status)
+{
+	dl_file_chunk_check(fc);
+
+	if (status == fc->status)
+		return;
+
+	if (DL_CHUNK_EMPTY == fc->status)
+		erbtree_remove(&fi->emptymap, &fc->enode);
+
+	fc->status = status;
+
+	if (DL_CHUNK_EMPTY == status)
+		erbtree_insert(&fi->emptymap, &fc->enode);
+}
+
+/**
+ * Find the chunk holding the byte at offset `pos'.
+ *
+ * @return the chunk, NULL if `pos' lies past the known end of the file.
+ */
+static struct dl_file_chunk *
+fi_chunk_lookup(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return erbtree_lookup(&fi->chunkmap, &key);
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -698,6 +874,7 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 {
 	const struct dl_file_chunk *fc;
 	filesize_t last = 0;
+	size_t empty = 0;
 
 	/*
 	 * This routine ends up being a CPU hog when all the asserts using it
@@ -715,6 +892,9 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 			return FALSE;
 
 		last = fc->to;
+		if (DL_CHUNK_EMPTY == fc->status)
+			empty++;
+
 		if (!fi->file_size_known || 0 == fi->size)
 			continue;
 
@@ -722,6 +902,16 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 			return FALSE;
 	}
 
+	/*
+	 * The range trees must index exactly the same chunks.
+	 */
+
+	if (erbtree_count(&fi->chunkmap) != eslist_count(&fi->chunklist))
+		return FALSE;
+
+	if (erbtree_count(&fi->emptymap) != empty)
+		return FALSE;
+
 	return TRUE;
 }
 
@@ -1022,6 +1212,8 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	erbtree_clear(&fi->chunkmap);
+	erbtree_clear(&fi->emptymap);
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
 }
 
@@ -1182,7 +1374,7 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1766,6 +1958,7 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
+	fi_chunkmap_init(fi);
 	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
 
 	return fi;
@@ -2027,7 +2220,7 @@ G_STMT_START {				\
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2113,163 +2306,632 @@ eof:
 }
 
 /**
- * Stores a file info record to the config_dir/fileinfo file, and
- * appends it to the output file in question if needed.
+ * Compute hash of a serialized fileinfo record, never 0.
  */
-static void
-file_info_store_one(FILE *f, fileinfo_t *fi)
+static uint32
+file_info_db_hash(const void *data, size_t len)
 {
-	slink_t *cl;
-	pslist_t *sl;
-	char *path;
+	uint32 hash = binary_hash(data, len);
 
-	file_info_check(fi);
+	return 0 == hash ? 1 : hash;
+}
 
-	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
-		return;
+/**
+ * Serialize fileinfo record for the fileinfo database.
+ *
+ * @param fi		the fileinfo to serialize
+ * @param chunks	whether to include the chunk list
+ *
+ * @return new message holding the serialized record.
+ */
+static pmsg_t *
+file_info_db_serialize(const fileinfo_t *fi, bool chunks)
+{
+	const pslist_t *sl;
+	const char *name;
+	char *path;
+	size_t size, nlen, plen, aliases = 0;
+	uint8 flags = 0, hashes = 0;
+	pmsg_t *mb;
 
-	if (fi->use_swarming && fi->dirty) {
-		file_info_store_binary(fi, FALSE);
-	}
+	name = filepath_basename(fi->pathname);
+	path = filepath_directory(fi->pathname);
+	nlen = strlen(name);
+	plen = strlen(path);
 
 	/*
-	 * Keep entries for incomplete or not even started downloads so that the
-	 * download is started/resumed as soon as a search gains a source.
+	 * Compute an upper bound of the serialized size: variable-length
+	 * integers take at most 10 bytes.
 	 */
 
-	if (0 == fi->refcount && fi->done == fi->size) {
-		filestat_t st;
+	size = 1 + 10 + nlen + 10 + plen + 4 + 1 + 2 * 10 + 3 * 4 +
+		1 + 2 * SHA1_RAW_SIZE + TTH_RAW_SIZE + 2 * 10;
 
-		if (-1 == stat(fi->pathname, &st)) {
-			return; 	/* Skip: not referenced, and file no longer exists */
-		}
+	PSLIST_FOREACH(fi->alias, sl) {
+		const char *alias = sl->data;
+
+		if (looks_like_urn(alias))
+			continue;
+		size += 10 + strlen(alias);
+		aliases++;
 	}
 
-	path = filepath_directory(fi->pathname);
-	fprintf(f,
-		"# refcount %u\n"
-		"NAME %s\n"
-		"PATH %s\n"
-		"GUID %s\n"
-		"GENR %u\n",
-		fi->refcount,
-		filepath_basename(fi->pathname),
-		path,
-		guid_hex_str(fi->guid),
-		fi->generation);
-	HFREE_NULL(path);
+	if (chunks)
+		size += eslist_count(&fi->chunklist) * (10 + 1);
+
+	mb = pmsg_new(PMSG_P_DATA, NULL, size);
+
+	if (fi->file_size_known)
+		flags |= FI_DB_F_SIZE_KNOWN;
+	if (fi->flags & FI_F_PAUSED)
+		flags |= FI_DB_F_PAUSED;
+	if (fi->use_swarming)
+		flags |= FI_DB_F_SWARMING;
+
+	if (fi->sha1 != NULL)
+		hashes |= FI_DB_H_SHA1;
+	if (fi->tth != NULL)
+		hashes |= FI_DB_H_TTH;
+	if (fi->cha1 != NULL)
+		hashes |= FI_DB_H_CHA1;
+
+	pmsg_write_u8(mb, FI_DB_VERSION);
+	pmsg_write_string(mb, name, nlen);
+	pmsg_write_string(mb, path, plen);
+	pmsg_write_be32(mb, fi->generation);
+	pmsg_write_u8(mb, flags);
+	pmsg_write_ule64(mb, fi->size);
+	pmsg_write_ule64(mb, fi->done);
+	pmsg_write_time(mb, fi->stamp);
+	pmsg_write_time(mb, fi->created);
+	pmsg_write_time(mb, fi->ntime);
+
+	pmsg_write_u8(mb, hashes);
+	if (fi->sha1 != NULL)
+		pmsg_write(mb, fi->sha1, SHA1_RAW_SIZE);
+	if (fi->tth != NULL)
+		pmsg_write(mb, fi->tth, TTH_RAW_SIZE);
+	if (fi->cha1 != NULL)
+		pmsg_write(mb, fi->cha1, SHA1_RAW_SIZE);
+
+	pmsg_write_ule64(mb, aliases);
 
 	PSLIST_FOREACH(fi->alias, sl) {
 		const char *alias = sl->data;
 
-		g_assert(NULL != alias);
-		if (looks_like_urn(alias)) {
-			g_warning("skipping fileinfo alias which looks like a urn: "
-				"\"%s\" (filename=\"%s\")",
-				alias, filepath_basename(fi->pathname));
-		} else
-			fprintf(f, "ALIA %s\n", alias);
+		if (!looks_like_urn(alias))
+			pmsg_write_string(mb, alias, (size_t) -1);
 	}
 
-	if (fi->sha1)
-		fprintf(f, "SHA1 %s\n", sha1_base32(fi->sha1));
-	if (fi->tth)
-		fprintf(f, "TTH %s\n", tth_base32(fi->tth));
-	if (fi->cha1)
-		fprintf(f, "CHA1 %s\n", sha1_base32(fi->cha1));
+	/*
+	 * Chunks are contiguous, hence we only need to record their length.
+	 */
 
-	fprintf(f, "SIZE %s\n", filesize_to_string(fi->size));
-	fprintf(f, "FSKN %u\n", fi->file_size_known ? 1 : 0);
-	fprintf(f, "PAUS %u\n", (FI_F_PAUSED & fi->flags) ? 1 : 0);
-	fprintf(f, "DONE %s\n", filesize_to_string(fi->done));
-	fprintf(f, "TIME %s\n", time_t_to_string(fi->stamp));
-	fprintf(f, "CTIM %s\n", time_t_to_string(fi->created));
-	fprintf(f, "NTIM %s\n", time_t_to_string(fi->ntime));
-	fprintf(f, "SWRM %u\n", fi->use_swarming ? 1 : 0);
+	if (chunks) {
+		const struct dl_file_chunk *fc;
 
-	g_assert(file_info_check_chunklist(fi, TRUE));
+		g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, cl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
+		pmsg_write_ule64(mb, eslist_count(&fi->chunklist));
 
-		dl_file_chunk_check(fc);
-		fprintf(f, "CHNK %s %s %u\n",
-			filesize_to_string(fc->from), filesize_to_string2(fc->to),
-			(uint) fc->status);
+		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+			dl_file_chunk_check(fc);
+			pmsg_write_ule64(mb, fc->to - fc->from);
+			pmsg_write_u8(mb, fc->status);
+		}
+	} else {
+		pmsg_write_ule64(mb, 0);
 	}
-	fprintf(f, "\n");
-}
 
-/**
- * Callback for hash table iterator. Used by file_info_store().
- */
-static void
-file_info_store_list(void *value, void *user_data)
-{
-	fileinfo_t *fi = value;
+	HFREE_NULL(path);
 
-	file_info_check(fi);
-	file_info_store_one(user_data, fi);
+	return mb;
 }
 
 /**
- * Stores the list of output files and their metainfo to the
- * configdir/fileinfo database.
+ * Deserialize fileinfo record from the fileinfo database.
+ *
+ * @param guid		the fileinfo GUID (record key)
+ * @param data		the serialized data
+ * @param len		length of serialized data
+ *
+ * @return new fileinfo, not inserted in the hash tables, NULL on error.
  */
-void
-file_info_store(void)
+static fileinfo_t *
+file_info_db_deserialize(const guid_t *guid, const void *data, size_t len)
 {
-	FILE *f;
-	file_path_t fp;
+	bstr_t *bs;
+	fileinfo_t *fi;
+	char *name = NULL, *path = NULL, *pathname;
+	uint8 version, flags, hashes;
+	uint32 generation;
+	uint64 size, done, count, i;
+	filesize_t from;
 
-	file_path_set(&fp, settings_config_dir(), file_info_file);
-	f = file_config_open_write(file_info_what, &fp);
+	bs = bstr_open(data, len, BSTR_F_ERROR);
+	fi = file_info_allocate();
+	fi->guid = atom_guid_get(guid);
 
-	if (!f)
-		return;
+	if (!bstr_read_u8(bs, &version))
+		goto failed;
 
-	file_config_preamble(f, "Fileinfo database");
+	if (version > FI_DB_VERSION) {
+		g_warning("%s(): unknown serialization version %u",
+			G_STRFUNC, version);
+		goto failed;
+	}
 
-	fputs(
-		"#\n"
-		"# Format is:\n"
-		"#	NAME <file name>\n"
-		"#	PATH <path>\n"
-		"#	GUID <file ID>\n"
-		"#	GENR <generation number>\n"
-		"#	ALIA <alias file name>\n"
-		"#	SIZE <size>\n"
-		"#	FSKN <boolean; file_size_known>\n"
-		"#	PAUS <boolean; paused>\n"
-		"#	SHA1 <server sha1>\n"
-		"#	TTH  <server tth>\n"
-		"#	CHA1 <computed sha1> [when done only]\n"
-		"#	DONE <bytes done>\n"
-		"#	TIME <last update stamp>\n"
-		"#	CTIM <entry creation time>\n"
-		"#	NTIM <time when new source was seen>\n"
-		"#	SWRM <boolean; use_swarming>\n"
-		"#	CHNK <start> <end+1> <0=hole, 1=busy, 2=done>\n"
-		"#	<blank line>\n"
-		"#\n\n",
-		f
-	);
+	if (
+		!bstr_read_string(bs, NULL, &name) ||
+		!bstr_read_string(bs, NULL, &path) ||
+		!bstr_read_be32(bs, &generation) ||
+		!bstr_read_u8(bs, &flags) ||
+		!bstr_read_ule64(bs, &size) ||
+		!bstr_read_ule64(bs, &done) ||
+		!bstr_read_time(bs, &fi->stamp) ||
+		!bstr_read_time(bs, &fi->created) ||
+		!bstr_read_time(bs, &fi->ntime) ||
+		!bstr_read_u8(bs, &hashes)
+	)
+		goto failed;
 
-	hikset_foreach(fi_by_outname, file_info_store_list, f);
+	if (
+		!is_absolute_path(path) ||
+		generation > (uint32) INT_MAX ||
+		size >= ((uint64) 1UL << 63) ||
+		done > size
+	)
+		goto damaged;
 
-	file_config_close(f, &fp);
-	fileinfo_dirty = FALSE;
-}
+	pathname = make_pathname(path, name);
+	fi->pathname = atom_str_get(pathname);
+	HFREE_NULL(pathname);
 
-/**
- * Store global file information cache if dirty.
- */
-void
-file_info_store_if_dirty(void)
-{
-	if (fileinfo_dirty)
-		file_info_store();
-}
+	fi->generation = generation;
+	fi->size = size;
+	fi->done = done;
+	fi->file_size_known = booleanize(flags & FI_DB_F_SIZE_KNOWN);
+	fi->use_swarming = booleanize(flags & FI_DB_F_SWARMING);
+	if (flags & FI_DB_F_PAUSED)
+		fi->flags |= FI_F_PAUSED;
+
+	if (hashes & FI_DB_H_SHA1) {
+		struct sha1 sha1;
+
+		if (!bstr_read(bs, &sha1, SHA1_RAW_SIZE))
+			goto failed;
+		fi->sha1 = atom_sha1_get(&sha1);
+	}
+
+	if (hashes & FI_DB_H_TTH) {
+		struct tth tth;
+
+		if (!bstr_read(bs, &tth, TTH_RAW_SIZE))
+			goto failed;
+		fi->tth = atom_tth_get(&tth);
+	}
+
+	if (hashes & FI_DB_H_CHA1) {
+		struct sha1 cha1;
+
+		if (!bstr_read(bs, &cha1, SHA1_RAW_SIZE))
+			goto failed;
+		fi->cha1 = atom_sha1_get(&cha1);
+	}
+
+	/*
+	 * Aliases are prepended, as file_info_retrieve_finish() expects.
+	 */
+
+	if (!bstr_read_ule64(bs, &count))
+		goto failed;
+
+	for (i = 0; i < count; i++) {
+		char *alias;
+
+		if (!bstr_read_string(bs, NULL, &alias))
+			goto failed;
+
+		fi->alias = pslist_prepend_const(fi->alias, atom_str_get(alias));
+		HFREE_NULL(alias);
+	}
+
+	if (!bstr_read_ule64(bs, &count))
+		goto failed;
+
+	for (i = 0, from = 0; i < count; i++) {
+		struct dl_file_chunk *fc;
+		uint64 length;
+		uint8 status;
+
+		if (!bstr_read_ule64(bs, &length) || !bstr_read_u8(bs, &status))
+			goto failed;
+
+		if (0 == length || length > size - from || status > 2U)
+			goto damaged;
+
+		fc = dl_file_chunk_alloc();
+		fc->from = from;
+		fc->to = from + length;
+		fc->status = DL_CHUNK_BUSY == status ? DL_CHUNK_EMPTY : status;
+		fi_chunk_append(fi, fc);
+
+		from = fc->to;
+	}
+
+	HFREE_NULL(name);
+	HFREE_NULL(path);
+	bstr_free(&bs);
+
+	return fi;
+
+failed:
+	g_warning("discarding fileinfo record %s: %s",
+		guid_hex_str(guid), bstr_has_error(bs) ? bstr_error(bs) : "bad data");
+	goto discard;
+
+damaged:
+	g_warning("discarding damaged fileinfo record %s for \"%s\"",
+		guid_hex_str(guid), NULL_STRING(name));
+	/* FALL THROUGH */
+
+discard:
+	if (NULL == fi->pathname)
+		fi->pathname = atom_str_get("/non-existent");
+	fi_free(fi);
+	HFREE_NULL(name);
+	HFREE_NULL(path);
+	bstr_free(&bs);
+
+	return NULL;
+}
+
+/**
+ * Stores a file info record to the fileinfo database, if it changed since
+ * last time, and appends it to the output file in question if needed.
+ *
+ * @return TRUE if the record was written.
+ */
+static bool
+file_info_store_one(fileinfo_t *fi)
+{
+	pmsg_t *mb;
+	uint32 hash;
+	bool written = FALSE;
+
+	file_info_check(fi);
+
+	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
+		goto discard;
+
+	if (fi->use_swarming && fi->dirty) {
+		file_info_store_binary(fi, FALSE);
+	}
+
+	/*
+	 * Keep entries for incomplete or not even started downloads so that the
+	 * download is started/resumed as soon as a search gains a source.
+	 */
+
+	if (0 == fi->refcount && fi->done == fi->size) {
+		filestat_t st;
+
+		if (-1 == stat(fi->pathname, &st)) {
+			goto discard; 	/* Not referenced, and file no longer exists */
+		}
+	}
+
+	/*
+	 * A record too large to be stored is saved without its chunks, which
+	 * will be recovered from the file trailer when loading.
+	 */
+
+	mb = file_info_db_serialize(fi, TRUE);
+
+	if (pmsg_size(mb) > FI_DB_VALUE_MAX) {
+		pmsg_free(mb);
+		mb = file_info_db_serialize(fi, FALSE);
+
+		if (pmsg_size(mb) > FI_DB_VALUE_MAX) {
+			g_warning("%s(): cannot save fileinfo for \"%s\": "
+				"%d-byte record is too large",
+				G_STRFUNC, fi->pathname, pmsg_size(mb));
+			pmsg_free(mb);
+			return FALSE;
+		}
+	}
+
+	hash = file_info_db_hash(pmsg_start(mb), pmsg_size(mb));
+
+	if (hash != fi->db_hash) {
+		dbmw_write(db_fileinfo, fi->guid, pmsg_start(mb), pmsg_size(mb));
+		fi->db_hash = hash;
+		written = TRUE;
+	}
+
+	pmsg_free(mb);
+	return written;
+
+discard:
+	if (fi->db_hash != 0) {
+		dbmw_delete(db_fileinfo, fi->guid);
+		fi->db_hash = 0;
+	}
+	return FALSE;
+}
+
+/**
+ * Callback for hash table iterator. Used by file_info_store().
+ */
+static void
+file_info_store_list(void *value, void *user_data)
+{
+	fileinfo_t *fi = value;
+	size_t *written = user_data;
+
+	file_info_check(fi);
+
+	if (file_info_store_one(fi))
+		(*written)++;
+}
+
+/**
+ * Move the legacy text database out of the way once it has been migrated,
+ * keeping it as "fileinfo.migrated".
+ */
+static void
+file_info_legacy_retire(void)
+{
+	static const char * const suffix[] = { ".orig", "" };
+	char *path, *migrated;
+	size_t i;
+
+	path = make_pathname(settings_config_dir(), file_info_file);
+	migrated = h_strdup_printf("%s.migrated", path);
+
+	for (i = 0; i < N_ITEMS(suffix); i++) {
+		char *legacy = h_strdup_printf("%s%s", path, suffix[i]);
+
+		if (file_exists(legacy)) {
+			if (-1 == rename(legacy, migrated)) {
+				g_warning("cannot rename \"%s\" as \"%s\": %m",
+					legacy, migrated);
+			} else {
+				g_info("renamed migrated \"%s\" as \"%s\"", legacy, migrated);
+			}
+		}
+		HFREE_NULL(legacy);
+	}
+
+	HFREE_NULL(migrated);
+	HFREE_NULL(path);
+}
+
+/**
+ * Stores a file info record to the config_dir/fileinfo legacy text file,
+ * and appends it to the output file in question if needed.
+ */
+static void
+file_info_store_legacy_one(FILE *f, fileinfo_t *fi)
+{
+	slink_t *cl;
+	pslist_t *sl;
+	char *path;
+
+	file_info_check(fi);
+
+	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
+		return;
+
+	if (fi->use_swarming && fi->dirty) {
+		file_info_store_binary(fi, FALSE);
+	}
+
+	/*
+	 * Keep entries for incomplete or not even started downloads so that the
+	 * download is started/resumed as soon as a search gains a source.
+	 */
+
+	if (0 == fi->refcount && fi->done == fi->size) {
+		filestat_t st;
+
+		if (-1 == stat(fi->pathname, &st)) {
+			return; 	/* Skip: not referenced, and file no longer exists */
+		}
+	}
+
+	path = filepath_directory(fi->pathname);
+	fprintf(f,
+		"# refcount %u\n"
+		"NAME %s\n"
+		"PATH %s\n"
+		"GUID %s\n"
+		"GENR %u\n",
+		fi->refcount,
+		filepath_basename(fi->pathname),
+		path,
+		guid_hex_str(fi->guid),
+		fi->generation);
+	HFREE_NULL(path);
+
+	PSLIST_FOREACH(fi->alias, sl) {
+		const char *alias = sl->data;
+
+		g_assert(NULL != alias);
+		if (looks_like_urn(alias)) {
+			g_warning("skipping fileinfo alias which looks like a urn: "
+				"\"%s\" (filename=\"%s\")",
+				alias, filepath_basename(fi->pathname));
+		} else
+			fprintf(f, "ALIA %s\n", alias);
+	}
+
+	if (fi->sha1)
+		fprintf(f, "SHA1 %s\n", sha1_base32(fi->sha1));
+	if (fi->tth)
+		fprintf(f, "TTH %s\n", tth_base32(fi->tth));
+	if (fi->cha1)
+		fprintf(f, "CHA1 %s\n", sha1_base32(fi->cha1));
+
+	fprintf(f, "SIZE %s\n", filesize_to_string(fi->size));
+	fprintf(f, "FSKN %u\n", fi->file_size_known ? 1 : 0);
+	fprintf(f, "PAUS %u\n", (FI_F_PAUSED & fi->flags) ? 1 : 0);
+	fprintf(f, "DONE %s\n", filesize_to_string(fi->done));
+	fprintf(f, "TIME %s\n", time_t_to_string(fi->stamp));
+	fprintf(f, "CTIM %s\n", time_t_to_string(fi->created));
+	fprintf(f, "NTIM %s\n", time_t_to_string(fi->ntime));
+	fprintf(f, "SWRM %u\n", fi->use_swarming ? 1 : 0);
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+
+	ESLIST_FOREACH(&fi->chunklist, cl) {
+		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
+
+		dl_file_chunk_check(fc);
+		fprintf(f, "CHNK %s %s %u\n",
+			filesize_to_string(fc->from), filesize_to_string2(fc->to),
+			(uint) fc->status);
+	}
+	fprintf(f, "\n");
+}
+
+/**
+ * Callback for hash table iterator. Used by file_info_store_legacy().
+ */
+static void
+file_info_store_legacy_list(void *value, void *user_data)
+{
+	fileinfo_t *fi = value;
+
+	file_info_check(fi);
+	file_info_store_legacy_one(user_data, fi);
+}
+
+/**
+ * Stores the list of output files and their metainfo to the
+ * configdir/fileinfo legacy text database.
+ *
+ * This is only used when the fileinfo database could not be opened.
+ */
+static void
+file_info_store_legacy(void)
+{
+	FILE *f;
+	file_path_t fp;
+	pslist_t *sl;
+
+	/*
+	 * The whole set is rewritten, removed fileinfos are simply not saved.
+	 */
+
+	PSLIST_FOREACH(fi_db_removed, sl) {
+		const guid_t *guid = sl->data;
+		atom_guid_free(guid);
+	}
+	pslist_free_null(&fi_db_removed);
+
+	file_path_set(&fp, settings_config_dir(), file_info_file);
+	f = file_config_open_write(file_info_what, &fp);
+
+	if (!f)
+		return;
+
+	file_config_preamble(f, "Fileinfo database");
+
+	fputs(
+		"#\n"
+		"# Format is:\n"
+		"#	NAME <file name>\n"
+		"#	PATH <path>\n"
+		"#	GUID <file ID>\n"
+		"#	GENR <generation number>\n"
+		"#	ALIA <alias file name>\n"
+		"#	SIZE <size>\n"
+		"#	FSKN <boolean; file_size_known>\n"
+		"#	PAUS <boolean; paused>\n"
+		"#	SHA1 <server sha1>\n"
+		"#	TTH  <server tth>\n"
+		"#	CHA1 <computed sha1> [when done only]\n"
+		"#	DONE <bytes done>\n"
+		"#	TIME <last update stamp>\n"
+		"#	CTIM <entry creation time>\n"
+		"#	NTIM <time when new source was seen>\n"
+		"#	SWRM <boolean; use_swarming>\n"
+		"#	CHNK <start> <end+1> <0=hole, 1=busy, 2=done>\n"
+		"#	<blank line>\n"
+		"#\n\n",
+		f
+	);
+
+	hikset_foreach(fi_by_outname, file_info_store_legacy_list, f);
+
+	file_config_close(f, &fp);
+	fileinfo_dirty = FALSE;
+}
+
+/**
+ * Stores the changed output files metainfo to the fileinfo database,
+ * removing the records of discarded fileinfos.
+ *
+ * When the database could not be opened, the legacy text file is
+ * rewritten instead.
+ */
+void
+file_info_store(void)
+{
+	size_t written = 0, removed = 0;
+	pslist_t *sl;
+
+	if (NULL == db_fileinfo) {
+		file_info_store_legacy();
+		return;
+	}
+
+	/*
+	 * A removed fileinfo can have been re-inserted since, under the same GUID.
+	 */
+
+	PSLIST_FOREACH(fi_db_removed, sl) {
+		const guid_t *guid = sl->data;
+
+		if (!hikset_contains(fi_by_guid, guid)) {
+			dbmw_delete(db_fileinfo, guid);
+			removed++;
+		}
+		atom_guid_free(guid);
+	}
+	pslist_free_null(&fi_db_removed);
+
+	hikset_foreach(fi_by_outname, file_info_store_list, &written);
+	dbstore_sync_flush(db_fileinfo);
+
+	if (GNET_PROPERTY(fileinfo_debug)) {
+		g_debug("FILEINFO wrote %zu record%s, removed %zu, %zu in database",
+			written, plural(written), removed, dbmw_count(db_fileinfo));
+	}
+
+	if (fi_db_migrating) {
+		if (dbmw_has_ioerr(db_fileinfo)) {
+			g_warning("%s(): keeping legacy fileinfo file after I/O error: %s",
+				G_STRFUNC, dbmw_strerror(db_fileinfo));
+		} else {
+			file_info_legacy_retire();
+		}
+		fi_db_migrating = FALSE;
+	}
+
+	fileinfo_dirty = FALSE;
+}
+
+/**
+ * Store global file information cache if dirty.
+ */
+void
+file_info_store_if_dirty(void)
+{
+	if (fileinfo_dirty)
+		file_info_store();
+}
 
 /*
  * Notify interested parties that file info is being removed and free
@@ -2434,6 +3096,7 @@ void G_COLD
 file_info_close(void)
 {
 	unsigned i;
+	pslist_t *sl;
 
 	/*
 	 * Freeing callbacks expect that the freeing of the `fi_by_outname'
@@ -2470,6 +3133,15 @@ file_info_close(void)
 	hikset_free_null(&fi_by_guid);
 	hikset_free_null(&fi_by_outname);
 
+	PSLIST_FOREACH(fi_db_removed, sl) {
+		const guid_t *guid = sl->data;
+		atom_guid_free(guid);
+	}
+	pslist_free_null(&fi_db_removed);
+
+	dbstore_close(db_fileinfo, settings_gnet_db_dir(), db_fileinfo_base);
+	db_fileinfo = NULL;
+
 	HFREE_NULL(tbuf.arena);
 }
 
@@ -2619,6 +3291,16 @@ file_info_hash_remove(fileinfo_t *fi)
 	if (fi->file_size_known)
 		file_info_hash_remove_name_size(fi);
 
+	/*
+	 * Its record will be removed from the database on next store, unless
+	 * the fileinfo is re-inserted by then.
+	 */
+
+	if (fi->db_hash != 0) {
+		fi_db_removed =
+			pslist_prepend_const(fi_db_removed, atom_guid_get(fi->guid));
+	}
+
 transient:
 	hikset_remove(fi_by_guid, fi->guid);
 
@@ -2938,7 +3620,7 @@ fi_reset_chunks(fileinfo_t *fi)
 		fc->from = 0;
 		fc->to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->generation = 0;		/* Restarting from scratch... */
@@ -2964,20 +3646,285 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 		fi->cha1 = atom_sha1_get(trailer->cha1);
 
 	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
+		struct dl_file_chunk *nfc;
+
 		dl_file_chunk_check(fc);
 		g_assert(fc->from <= fc->to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		/*
+		 * Cannot use WCOPY() here: the embedded tree nodes of `fc' are
+		 * linked in the trailer's indexes.
+		 */
+
+		nfc = dl_file_chunk_alloc();
+		nfc->from = fc->from;
+		nfc->to = fc->to;
+		nfc->status = fc->status;
+		nfc->download = fc->download;
+		fi_chunk_append(fi, nfc);
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
 }
 
 /**
- * Loads the fileinfo database from disk, and saves a copy in fileinfo.orig.
+ * Finish loading of a fileinfo record, whose pathname is already known,
+ * checking it against the file trailer and inserting it into the hash tables.
+ *
+ * @param fi			the fileinfo record loaded
+ * @param old_filename	if non-NULL, unsanitized filename to rename
+ *
+ * @return the fileinfo retained, NULL if the record was discarded.
  */
-void G_COLD
-file_info_retrieve(void)
+static fileinfo_t *
+file_info_retrieve_finish(fileinfo_t *fi, const char *old_filename)
+{
+	fileinfo_t *dfi;
+	bool upgraded;
+	bool reload_chunks = FALSE;
+
+	/*
+	 * There can't be duplicates!
+	 */
+
+	dfi = hikset_lookup(fi_by_outname, fi->pathname);
+	if (NULL != dfi) {
+		g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
+			filepath_basename(fi->pathname));
+		goto reset;
+	}
+
+	if (0 == fi->size) {
+		fi->file_size_known = FALSE;
+	}
+
+	/*
+	 * If we deserialized an older version, bring it up to date.
+	 */
+
+	upgraded = fi_upgrade_older_version(fi);
+
+	/*
+	 * Allow reconstruction of missing information: if no CHNK
+	 * entry was found for the file, fake one, all empty, and reset
+	 * DONE and GENR to 0.
+	 *
+	 * If for instance the partition where temporary files are held
+	 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
+	 * will be enough to restart without losing the collected
+	 * files.
+	 *
+	 *		--RAM, 31/12/2003
+	 */
+
+	if (0 == eslist_count(&fi->chunklist)) {
+		if (fi->file_size_known)
+			g_warning("no CHNK info for \"%s\"", fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	} else if (!file_info_check_chunklist(fi, FALSE)) {
+		if (fi->file_size_known)
+			g_warning("invalid set of CHNK info for \"%s\"",
+				fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	}
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+
+	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+
+	/*
+	 * If `old_filename' is not NULL, then we need to rename
+	 * the file bearing that name into the new (sanitized)
+	 * name, making sure there is no filename conflict.
+	 */
+
+	if (NULL != old_filename) {
+		const char *new_pathname;
+		char *old_path;
+		bool renamed = TRUE;
+
+		old_path = filepath_directory(fi->pathname);
+		new_pathname = file_info_new_outname(old_path,
+							filepath_basename(fi->pathname));
+		HFREE_NULL(old_path);
+		if (NULL == new_pathname)
+			goto reset;
+
+		/*
+		 * If fi->done == 0, the file might not exist on disk.
+		 */
+
+		if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
+			renamed = FALSE;
+
+		if (renamed) {
+			g_warning("renamed \"%s\" into sanitized \"%s\"",
+				fi->pathname, new_pathname);
+			atom_str_change(&fi->pathname, new_pathname);
+		} else {
+			g_warning("cannot rename \"%s\" into \"%s\": %m",
+				fi->pathname, new_pathname);
+		}
+		atom_str_free_null(&new_pathname);
+	}
+
+	/*
+	 * Check file trailer information.	The main file is only written
+	 * infrequently and the file's trailer can have more up-to-date
+	 * information.
+	 */
+
+	dfi = file_info_retrieve_binary(fi->pathname);
+
+	/*
+	 * If we resetted the CHNK list above, grab those from the
+	 * trailer: that cannot be worse than having to download
+	 * everything again...  If there was no valid trailer, all the
+	 * data are lost and the whole file will need to be grabbed again.
+	 */
+
+	if (dfi != NULL && reload_chunks) {
+		fi_copy_chunks(fi, dfi);
+		if (0 != eslist_count(&fi->chunklist)) {
+			g_message("recovered %s downloaded bytes "
+				"from trailer of \"%s\"",
+				filesize_to_string(fi->done), fi->pathname);
+		}
+	} else if (reload_chunks)
+		g_warning("lost all CHNK info for \"%s\" -- downloading again",
+			fi->pathname);
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+
+	/*
+	 * Special treatment for the GUID: if not present, it will be
+	 * added during retrieval, but it will be different for the
+	 * one in the fileinfo DB and the one on disk.  Set `upgraded'
+	 * to signal that, so that we resync the metainfo below.
+	 */
+
+	if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
+		upgraded = TRUE;
+
+	/*
+	 * NOTE: The tigertree data is only stored in the trailer, not
+	 * in the common "fileinfo" file. Therefore, it MUST be fetched
+	 * from "dfi".
+	 */
+
+	if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
+		file_info_got_tigertree(fi,
+			dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
+	}
+
+	if (dfi) {
+		fi->modified = dfi->modified;
+	}
+
+	if (NULL == dfi) {
+		if (is_regular(fi->pathname)) {
+			g_warning("got metainfo in fileinfo cache, "
+				"but none in \"%s\"", fi->pathname);
+			upgraded = FALSE;			/* No need to flush twice */
+			file_info_store_binary(fi, TRUE);	/* Create metainfo */
+		} else {
+			file_info_merge_adjacent(fi);		/* Compute fi->done */
+			if (fi->done > 0) {
+				g_warning("discarding cached metainfo for \"%s\": "
+					"file had %s bytes downloaded "
+					"but is now gone!", fi->pathname,
+					filesize_to_string(fi->done));
+				goto reset;
+			}
+		}
+	} else if (dfi->generation > fi->generation) {
+		g_warning("found more recent metainfo in \"%s\"", fi->pathname);
+		fi_free(fi);
+		fi = dfi;
+	} else if (dfi->generation < fi->generation) {
+		g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
+		fi_free(dfi);
+		dfi = NULL;
+		upgraded = FALSE;				/* No need to flush twice */
+		file_info_store_binary(fi, TRUE);/* Resync metainfo */
+	} else {
+		g_assert(dfi->generation == fi->generation);
+		fi_free(dfi);
+		dfi = NULL;
+	}
+
+	/*
+	 * Check whether entry is not another's duplicate.
+	 */
+
+	dfi = file_info_lookup_dup(fi);
+
+	if (NULL != dfi) {
+		g_warning("found DUPLICATE entry for \"%s\" "
+			"(%s bytes) with \"%s\" (%s bytes)",
+			fi->pathname, filesize_to_string(fi->size),
+			dfi->pathname, filesize_to_string2(dfi->size));
+		goto reset;
+	}
+
+	/*
+	 * If we had to upgrade the fileinfo, make sure we resync
+	 * the metadata on disk as well.
+	 */
+
+	if (upgraded) {
+		g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
+		file_info_store_binary(fi, TRUE);		/* Resync metainfo */
+	}
+
+	file_info_merge_adjacent(fi);
+	file_info_hash_insert(fi);
+
+	if (can_publish_partial_sha1 && fi->sha1 != NULL) {
+		publisher_add(fi->sha1);
+	}
+
+	/*
+	 * We could not add the aliases immediately because the file
+	 * is formatted with ALIA coming before SIZE.  To let fi_alias()
+	 * detect conflicting entries, we need to have a valid fi->size.
+	 * And since the `fi' is hashed, we can detect duplicates in
+	 * the `aliases' list itself as an added bonus.
+	 */
+
+	if (fi->alias) {
+		pslist_t *aliases, *sl;
+
+		/* For efficiency each alias has been prepended to
+		 * the list. To preserve the order between sessions,
+		 * the original list order is restored here. */
+		aliases = pslist_reverse(fi->alias);
+		fi->alias = NULL;
+		PSLIST_FOREACH(aliases, sl) {
+			const char *s = sl->data;
+			fi_alias(fi, s, TRUE);
+			atom_str_free_null(&s);
+		}
+		pslist_free_null(&aliases);
+	}
+
+	return fi;
+
+reset:
+	fi_free(fi);
+	return NULL;
+}
+
+/**
+ * Loads the legacy text fileinfo database from disk, renaming it as
+ * fileinfo.orig.
+ *
+ * @return TRUE if the legacy database was found.
+ */
+static bool G_COLD
+file_info_retrieve_legacy(void)
 {
 	FILE *f;
 	char line[1024];
@@ -2989,24 +3936,10 @@ file_info_retrieve(void)
 	const char *path = NULL;
 	const char *filename = NULL;
 
-	/*
-	 * We have a complex interaction here: each time a new entry within the
-	 * download mesh is added, file_info_try_to_swarm_with() will be
-	 * called.	Moreover, the download mesh is initialized before us.
-	 *
-	 * However, we cannot enqueue a download before the download module is
-	 * initialized. And we know it is initialized now because download_init()
-	 * calls us!
-	 *
-	 *		--RAM, 20/08/2002
-	 */
-
-	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
-
 	file_path_set(&fp, settings_config_dir(), file_info_file);
 	f = file_config_open_read(file_info_what, &fp, 1);
 	if (!f)
-		return;
+		return FALSE;
 
 	while (fgets(line, sizeof line, f)) {
 		int error;
@@ -3045,10 +3978,6 @@ file_info_retrieve(void)
 		 */
 
 		if ('\0' == *line && fi) {
-			fileinfo_t *dfi;
-			bool upgraded;
-			bool reload_chunks = FALSE;
-
 			if (filename && path) {
 				char *pathname = make_pathname(path, filename);
 				fi->pathname = atom_str_get(pathname);
@@ -3060,234 +3989,10 @@ file_info_retrieve(void)
 			atom_str_free_null(&filename);
 			atom_str_free_null(&path);
 
-			/*
-			 * There can't be duplicates!
-			 */
-
-			dfi = hikset_lookup(fi_by_outname, fi->pathname);
-			if (NULL != dfi) {
-				g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
-					filepath_basename(fi->pathname));
-				goto reset;
-			}
-
-			if (0 == fi->size) {
-				fi->file_size_known = FALSE;
-			}
-
-			/*
-			 * If we deserialized an older version, bring it up to date.
-			 */
-
-			upgraded = fi_upgrade_older_version(fi);
-
-			/*
-			 * Allow reconstruction of missing information: if no CHNK
-			 * entry was found for the file, fake one, all empty, and reset
-			 * DONE and GENR to 0.
-			 *
-			 * If for instance the partition where temporary files are held
-			 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
-			 * will be enough to restart without losing the collected
-			 * files.
-			 *
-			 *		--RAM, 31/12/2003
-			 */
-
-			if (0 == eslist_count(&fi->chunklist)) {
-				if (fi->file_size_known)
-					g_warning("no CHNK info for \"%s\"", fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			} else if (!file_info_check_chunklist(fi, FALSE)) {
-				if (fi->file_size_known)
-					g_warning("invalid set of CHNK info for \"%s\"",
-						fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			}
-
-			g_assert(file_info_check_chunklist(fi, TRUE));
-
-			file_info_merge_adjacent(fi); /* Recalculates also fi->done */
-
-			/*
-			 * If `old_filename' is not NULL, then we need to rename
-			 * the file bearing that name into the new (sanitized)
-			 * name, making sure there is no filename conflict.
-			 */
-
-			if (NULL != old_filename) {
-				const char *new_pathname;
-				char *old_path;
-				bool renamed = TRUE;
-
-				old_path = filepath_directory(fi->pathname);
-				new_pathname = file_info_new_outname(old_path,
-									filepath_basename(fi->pathname));
-				HFREE_NULL(old_path);
-				if (NULL == new_pathname)
-					goto reset;
-
-				/*
-				 * If fi->done == 0, the file might not exist on disk.
-				 */
-
-				if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
-					renamed = FALSE;
-
-				if (renamed) {
-					g_warning("renamed \"%s\" into sanitized \"%s\"",
-						fi->pathname, new_pathname);
-					atom_str_change(&fi->pathname, new_pathname);
-				} else {
-					g_warning("cannot rename \"%s\" into \"%s\": %m",
-						fi->pathname, new_pathname);
-				}
-				atom_str_free_null(&new_pathname);
-			}
-
-			/*
-			 * Check file trailer information.	The main file is only written
-			 * infrequently and the file's trailer can have more up-to-date
-			 * information.
-			 */
-
-			dfi = file_info_retrieve_binary(fi->pathname);
-
-			/*
-			 * If we resetted the CHNK list above, grab those from the
-			 * trailer: that cannot be worse than having to download
-			 * everything again...  If there was no valid trailer, all the
-			 * data are lost and the whole file will need to be grabbed again.
-			 */
-
-			if (dfi != NULL && reload_chunks) {
-				fi_copy_chunks(fi, dfi);
-				if (0 != eslist_count(&fi->chunklist)) {
-					g_message("recovered %s downloaded bytes "
-						"from trailer of \"%s\"",
-						filesize_to_string(fi->done), fi->pathname);
-				}
-			} else if (reload_chunks)
-				g_warning("lost all CHNK info for \"%s\" -- downloading again",
-					fi->pathname);
-
-			g_assert(file_info_check_chunklist(fi, TRUE));
-
-			/*
-			 * Special treatment for the GUID: if not present, it will be
-			 * added during retrieval, but it will be different for the
-			 * one in the fileinfo DB and the one on disk.  Set `upgraded'
-			 * to signal that, so that we resync the metainfo below.
-			 */
-
-			if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
-				upgraded = TRUE;
-
-			/*
-			 * NOTE: The tigertree data is only stored in the trailer, not
-			 * in the common "fileinfo" file. Therefore, it MUST be fetched
-			 * from "dfi".
-			 */
-
-			if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
-				file_info_got_tigertree(fi,
-					dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
-			}
-
-			if (dfi) {
-				fi->modified = dfi->modified;
-			}
-
-			if (NULL == dfi) {
-				if (is_regular(fi->pathname)) {
-					g_warning("got metainfo in fileinfo cache, "
-						"but none in \"%s\"", fi->pathname);
-					upgraded = FALSE;			/* No need to flush twice */
-					file_info_store_binary(fi, TRUE);	/* Create metainfo */
-				} else {
-					file_info_merge_adjacent(fi);		/* Compute fi->done */
-					if (fi->done > 0) {
-						g_warning("discarding cached metainfo for \"%s\": "
-							"file had %s bytes downloaded "
-							"but is now gone!", fi->pathname,
-							filesize_to_string(fi->done));
-						goto reset;
-					}
-				}
-			} else if (dfi->generation > fi->generation) {
-				g_warning("found more recent metainfo in \"%s\"", fi->pathname);
-				fi_free(fi);
-				fi = dfi;
-			} else if (dfi->generation < fi->generation) {
-				g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
-				fi_free(dfi);
-				dfi = NULL;
-				upgraded = FALSE;				/* No need to flush twice */
-				file_info_store_binary(fi, TRUE);/* Resync metainfo */
-			} else {
-				g_assert(dfi->generation == fi->generation);
-				fi_free(dfi);
-				dfi = NULL;
-			}
-
-			/*
-			 * Check whether entry is not another's duplicate.
-			 */
-
-			dfi = file_info_lookup_dup(fi);
-
-			if (NULL != dfi) {
-				g_warning("found DUPLICATE entry for \"%s\" "
-					"(%s bytes) with \"%s\" (%s bytes)",
-					fi->pathname, filesize_to_string(fi->size),
-					dfi->pathname, filesize_to_string2(dfi->size));
-				goto reset;
-			}
-
-			/*
-			 * If we had to upgrade the fileinfo, make sure we resync
-			 * the metadata on disk as well.
-			 */
-
-			if (upgraded) {
-				g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
-				file_info_store_binary(fi, TRUE);		/* Resync metainfo */
-			}
-
-			file_info_merge_adjacent(fi);
-			file_info_hash_insert(fi);
-
-			if (can_publish_partial_sha1 && fi->sha1 != NULL) {
-				publisher_add(fi->sha1);
-			}
-
-			/*
-			 * We could not add the aliases immediately because the file
-			 * is formatted with ALIA coming before SIZE.  To let fi_alias()
-			 * detect conflicting entries, we need to have a valid fi->size.
-			 * And since the `fi' is hashed, we can detect duplicates in
-			 * the `aliases' list itself as an added bonus.
-			 */
+			if (NULL != file_info_retrieve_finish(fi, old_filename))
+				empty = FALSE;
 
-			if (fi->alias) {
-				pslist_t *aliases, *sl;
-
-				/* For efficiency each alias has been prepended to
-				 * the list. To preserve the order between sessions,
-				 * the original list order is restored here. */
-				aliases = pslist_reverse(fi->alias);
-				fi->alias = NULL;
-				PSLIST_FOREACH(aliases, sl) {
-					const char *s = sl->data;
-					fi_alias(fi, s, TRUE);
-					atom_str_free_null(&s);
-				}
-				pslist_free_null(&aliases);
-			}
-
-			empty = FALSE;
+			atom_str_free_null(&old_filename);
 			fi = NULL;
 			continue;
 		}
@@ -3497,7 +4202,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3535,6 +4240,93 @@ file_info_retrieve(void)
 	atom_str_free_null(&path);
 
 	fclose(f);
+	return TRUE;
+}
+
+/**
+ * DBMW foreach iterator to load a fileinfo record.
+ */
+static void
+file_info_retrieve_record(void *key, void *value, size_t len, void *unused_u)
+{
+	const guid_t *guid = key;
+	fileinfo_t *fi;
+
+	(void) unused_u;
+
+	fi = file_info_db_deserialize(guid, value, len);
+
+	if (fi != NULL)
+		fi = file_info_retrieve_finish(fi, NULL);
+
+	/*
+	 * The record is obsolete if it was discarded or superseded by the
+	 * trailer of the file, bearing another GUID.
+	 */
+
+	if (NULL == fi || !guid_eq(fi->guid, guid)) {
+		fi_db_removed =
+			pslist_prepend_const(fi_db_removed, atom_guid_get(guid));
+		fileinfo_dirty = TRUE;
+	} else {
+		fi->db_hash = file_info_db_hash(value, len);
+	}
+}
+
+/**
+ * Loads the fileinfo database from disk.
+ *
+ * When the database is empty, the legacy text database is loaded instead,
+ * if present: all its records will be written to the database by the next
+ * file_info_store(), which then renames the legacy file.
+ */
+void G_COLD
+file_info_retrieve(void)
+{
+	dbstore_kv_t kv = { GUID_RAW_SIZE, NULL, FI_DB_VALUE_MAX, 0 };
+	dbstore_packing_t packing = { NULL, NULL, NULL };
+
+	/*
+	 * We have a complex interaction here: each time a new entry within the
+	 * download mesh is added, file_info_try_to_swarm_with() will be
+	 * called.	Moreover, the download mesh is initialized before us.
+	 *
+	 * However, we cannot enqueue a download before the download module is
+	 * initialized. And we know it is initialized now because download_init()
+	 * calls us!
+	 *
+	 *		--RAM, 20/08/2002
+	 */
+
+	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
+
+	g_assert(NULL == db_fileinfo);
+
+	db_fileinfo = dbstore_open(db_fileinfo_what, settings_gnet_db_dir(),
+		db_fileinfo_base, kv, packing, FI_DB_CACHE_SIZE,
+		guid_hash, guid_eq, FALSE);
+
+	if (NULL == db_fileinfo) {
+		g_warning("%s(): cannot open the %s database, "
+			"loading and saving the legacy text file instead",
+			G_STRFUNC, db_fileinfo_what);
+		file_info_retrieve_legacy();
+		return;
+	}
+
+	if (0 == dbmw_count(db_fileinfo)) {
+		if (file_info_retrieve_legacy()) {
+			uint n = hikset_count(fi_by_outname);
+
+			g_info("migrating %u fileinfo record%s to the %s database",
+				n, plural(n), db_fileinfo_what);
+
+			fi_db_migrating = TRUE;
+			fileinfo_dirty = TRUE;
+		}
+	} else {
+		dbmw_foreach(db_fileinfo, file_info_retrieve_record, NULL);
+	}
 }
 
 static bool
@@ -3648,7 +4440,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4041,9 +4833,9 @@ file_info_merge_adjacent(fileinfo_t *fi)
 		if (fc1->status == fc2->status && DL_CHUNK_BUSY != fc2->status) {
 			void *removed;
 
-			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
+			fc1->to = fc2->to;
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
 		}
@@ -4113,7 +4905,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
 			fc->to = fi->done;
 
@@ -4124,7 +4916,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
 		}
@@ -4143,7 +4935,7 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
@@ -4176,7 +4968,7 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 	slink_t *sl;
 	fileinfo_t *fi;
 	bool found = FALSE;
-	int n, againcount = 0;
+	int againcount = 0;
 	bool need_merging;
 	const struct download *newval;
 
@@ -4247,13 +5039,20 @@ again:
 	 * because we may be writing data to an already "done" chunk, when a
 	 * previous chunk bumps into a done one.
 	 *		--RAM, 04/11/2002
+	 *
+	 * The chunk map gives us the first chunk covering `from' directly.
 	 */
 
-	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
-		sl != NULL;
-		n++, prevfc = fc, sl = eslist_next(sl)
-	) {
+	fc = fi_chunk_lookup(fi, from);
+	if (fc != NULL) {
+		prevfc = erbtree_data(&fi->chunkmap, erbtree_prev(&fc->node));
+		sl = &fc->lk;
+	} else {
+		prevfc = NULL;
+		sl = NULL;
+	}
+
+	for (; sl != NULL; prevfc = fc, sl = eslist_next(sl)) {
 		fc = eslist_data(&fi->chunklist, sl);
 
 		dl_file_chunk_check(fc);
@@ -4270,7 +5069,7 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
-			fc->status = status;
+			fi_chunk_set_status(fi, fc, status);
 			fc->download = newval;
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4285,7 +5084,7 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
-			fc->status = status;
+			fi_chunk_set_status(fi, fc, status);
 			fc->download = newval;
 			from = fc->to;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4316,9 +5115,9 @@ again:
 				nfc->download = fc->download;
 
 				fc->to = to;
-				fc->status = status;
+				fi_chunk_set_status(fi, fc, status);
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4326,6 +5125,7 @@ again:
 			break;
 
 		} else if (fc->from < from && fc->to >= to) {
+			filesize_t tmp;
 
 			/*
 			 * New chunk [from, to] lies within ]fc->from, fc->to].
@@ -4337,13 +5137,20 @@ again:
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
 
-			if (fc->to > to) {
+			/*
+			 * Shrink `fc' to [fc->from, from[ before inserting the new
+			 * chunks so that the chunk map never sees overlapping ranges.
+			 */
+
+			tmp = fc->to;
+			fc->to = from;
+
+			if (tmp > to) {
 				nfc = dl_file_chunk_alloc();
 				nfc->from = to;
-				nfc->to = fc->to;
+				nfc->to = tmp;
 				nfc->status = fc->status;
 				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
 
 				if (DL_CHUNK_BUSY == nfc->status) {
 					/*
@@ -4355,6 +5162,8 @@ again:
 					nfc->status = DL_CHUNK_EMPTY;
 					nfc->download = NULL;
 				}
+
+				fi_chunk_insert_after(fi, fc, nfc);
 			}
 
 			nfc = dl_file_chunk_alloc();
@@ -4362,9 +5171,7 @@ again:
 			nfc->to = to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-
-			fc->to = from;
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4380,15 +5187,16 @@ again:
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
 
+			tmp = fc->to;
+			fc->to = from;
+
 			nfc = dl_file_chunk_alloc();
 			nfc->from = from;
-			nfc->to = fc->to;
+			nfc->to = tmp;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
-			tmp = fc->to;
-			fc->to = from;
 			from = tmp;
 			g_assert(file_info_check_chunklist(fi, TRUE));
 			goto again;
@@ -4465,7 +5273,7 @@ file_info_clear_download(struct download *d, bool lifecount)
 		if (fc->download == d) {
 		    fc->download = NULL;
 		    if (DL_CHUNK_BUSY == fc->status)
-				fc->status = DL_CHUNK_EMPTY;
+				fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 		}
 	}
 	file_info_merge_adjacent(fi);
@@ -4520,7 +5328,7 @@ restart:
 	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 		dl_file_chunk_check(fc);
 		g_assert(NULL == fc->download);
-		fc->status = DL_CHUNK_EMPTY;
+		fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 	}
 
 	file_info_merge_adjacent(fi);
@@ -4540,10 +5348,12 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, from);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
-		if (from >= fc->from && to <= fc->to)
+		if (to <= fc->to)
 			return fc->status;
 	}
 
@@ -4571,7 +5381,8 @@ file_info_new_chunk_owner(const struct download *d,
 	filesize_t from, filesize_t to)
 {
 	fileinfo_t *fi;
-	const struct download *old = NULL;
+	const struct download *old;
+	struct dl_file_chunk *fc;
 	const slink_t *sl;
 
 	download_check(d);
@@ -4579,43 +5390,35 @@ file_info_new_chunk_owner(const struct download *d,
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	/*
+	 * We're looking for the first busy chunk intersecting with [from, to],
+	 * which happens when one of the segment bounds lies within the chunk.
+	 */
 
-		dl_file_chunk_check(fc);
+	fc = fi_chunk_lookup(fi, from);
 
-		/*
-		 * We're looking for the first busy chunk intersecting with [from, to],
-		 * which happens when one of the segment bounds lies within the chunk.
-		 */
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		fc = fi_chunk_lookup(fi, to);
 
-		if (DL_CHUNK_BUSY != fc->status)
-			continue;
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		return;
 
-		if (
-			(from >= fc->from && from < fc->to) ||
-			(to >= fc->from && to < fc->to)
-		) {
-			g_assert(fc->download != NULL);
-			download_check(fc->download);
-			g_assert(fc->download != d);
+	dl_file_chunk_check(fc);
+	g_assert(fc->download != NULL);
+	download_check(fc->download);
+	g_assert(fc->download != d);
 
-			old = fc->download;
-			fc->download = d;
-			break;
-		}
-	}
+	old = fc->download;
+	fc->download = d;
 
-	if (old != NULL) {
-		for (sl = eslist_next(sl); sl != NULL; sl = eslist_next(sl)) {
-			struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	for (sl = eslist_next(&fc->lk); sl != NULL; sl = eslist_next(sl)) {
+		fc = eslist_data(&fi->chunklist, sl);
 
-			dl_file_chunk_check(fc);
+		dl_file_chunk_check(fc);
 
-			if (DL_CHUNK_BUSY == fc->status && fc->download == old) {
-				fc->status = DL_CHUNK_EMPTY;
-				fc->download = NULL;
-			}
+		if (DL_CHUNK_BUSY == fc->status && fc->download == old) {
+			fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
+			fc->download = NULL;
 		}
 	}
 }
@@ -4632,10 +5435,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -4710,23 +5514,6 @@ fi_busy_count(fileinfo_t *fi, const struct download *d)
 	return count;
 }
 
-/**
- * Compares two offered ranges so that two ranges are equal when they overlap.
- */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_file_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping chunks are equal */
-}
-
 /**
  * Select a chunk randomly among the rarest chunks offered on the network.
  *
@@ -4746,7 +5533,6 @@ fi_chunk_overlap_cmp(const void *a, const void *b)
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
 	http_rangeset_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
@@ -4784,24 +5570,15 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	}
 
 	/*
-	 * The `missing' red-black tree contains the file chunks that are still
+	 * The fi->emptymap tree indexes the file chunks that are still
 	 * empty and need to be downloaded.
 	 *
 	 * The `offered' set contains the HTTP ranges offered by the source,
 	 * if any given.  If NULL, it means the source covers the whole file.
 	 */
 
-	missing = rbtree_create(fi_chunk_overlap_cmp);
 	offered = NULL == d ? NULL : d->ranges;
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
-	}
-
 	/*
 	 * Find the first missing chunk that is also offered, starting with the
 	 * rarest available chunk: the fi->available list is sorted by increasing
@@ -4831,7 +5608,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		crange.from = fa->from;
 		crange.to = fa->to;
 
-		dfc = rbtree_lookup(missing, &crange);
+		dfc = erbtree_lookup(&fi->emptymap, &crange);
 
 		if (dfc != NULL) {
 			/* Rare range overlaps with missing range */
@@ -4943,7 +5720,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -4965,8 +5742,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	if (NULL == candidate)
 		candidate = first;
 
-	rbtree_free_null(&missing);
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		g_debug("%s(): returning [%s, %s] (%u) for \"%s\"",
@@ -4992,14 +5767,12 @@ static const struct dl_file_chunk *
 fi_pick_chunk(fileinfo_t *fi)
 {
 	filesize_t offset = 0;
-	slink_t *sl;
+	struct dl_file_chunk *fc, *nfc;
 
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
 	if (GNET_PROPERTY(pfsp_first_chunk) > 0) {
-		const struct dl_file_chunk *fc;
-
 		/*
 		 * Check whether first chunk is at least "pfsp_first_chunk" bytes
 		 * long.  If not, return that first chunk.
@@ -5016,8 +5789,8 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
-		const struct dl_file_chunk *fc;
 		filesize_t last_chunk_offset;
+		slink_t *sl;
 
 		/*
 		 * Scan for the first gap within the last "pfsp_last_chunk" bytes
@@ -5029,7 +5802,11 @@ fi_pick_chunk(fileinfo_t *fi)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		fc = fi_chunk_lookup(fi, last_chunk_offset);
+		sl = NULL == fc ? NULL : &fc->lk;
+
+		for (; sl != NULL; sl = eslist_next(sl)) {
+			fc = eslist_data(&fi->chunklist, sl);
 			dl_file_chunk_check(fc);
 
 			if (DL_CHUNK_DONE == fc->status)
@@ -5056,65 +5833,53 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	/*
-	 * Pick the first chunk whose start is after the offset.
+	 * Pick the first chunk whose start is after the offset, starting with
+	 * the chunk holding that offset.
 	 */
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
+	fc = fi_chunk_lookup(fi, offset);
 
-		if (fc->from >= offset)
-			return fc;
+	if (NULL == fc)
+		goto first;
 
-		/*
-		 * If offset lies within a free chunk, it will get split below.
-		 * So exit without selecting anything yet.
-		 */
+	dl_file_chunk_check(fc);
 
-		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset)
-			break;
-	}
+	if (fc->from == offset)
+		return fc;
 
 	/*
-	 * If we have not picked anything, it means we have encountered a big chunk
-	 * and the selected offset lies within that chunk.
-	 * Be smarter and break-up any free chunk into two at the selected offset.
+	 * If the offset lies within a big free chunk, be smarter and break-up
+	 * that chunk into two at the selected offset.
 	 */
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset) {
-			struct dl_file_chunk *nfc;
+	if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset) {
+		g_assert(fc->from < offset);	/* Or we'd have returned above */
+		g_assert(fc->download == NULL);	/* Chunk is empty */
 
-			g_assert(fc->from < offset);	/* Or we'd have cloned above */
-			g_assert(fc->download == NULL);	/* Chunk is empty */
-
-			/*
-			 * fc was [from, to[.  It becomes [from, offset[.
-			 * nfc is [offset, to[ and is inserted after fc.
-			 */
+		/*
+		 * fc was [from, to[.  It becomes [from, offset[.
+		 * nfc is [offset, to[ and is inserted after fc.
+		 */
 
-			nfc = dl_file_chunk_alloc();
-			nfc->from = offset;
-			nfc->to = fc->to;
-			nfc->status = DL_CHUNK_EMPTY;
-			fc->to = nfc->from;
+		nfc = dl_file_chunk_alloc();
+		nfc->from = offset;
+		nfc->to = fc->to;
+		nfc->status = DL_CHUNK_EMPTY;
+		fc->to = nfc->from;
 
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-			return nfc;
-		}
+		fi_chunk_insert_after(fi, fc, nfc);
+		return nfc;
 	}
 
-	g_assert(file_info_check_chunklist(fi, TRUE));
+	nfc = eslist_next_data(&fi->chunklist, fc);
+	if (nfc != NULL)
+		return nfc;
 
 	/*
 	 * If still no luck, never mind.  Use first chunk.
 	 */
 
+first:
 	return eslist_head(&fi->chunklist);
 }
 
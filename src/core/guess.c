@@ -5828,7 +5828,8 @@ guess_init(void)
 {
 	dbstore_kv_t kv = { sizeof(gnet_host_t), gnet_host_length,
 		sizeof(struct qkdata),
-		sizeof(struct qkdata) + sizeof(uint8) + MAX_INT_VAL(uint8) };
+		sizeof(struct qkdata) + sizeof(uint8) + MAX_INT_VAL(uint8),
+		DBSTORE_F_FILTER };
 	dbstore_packing_t packing =
 		{ serialize_qkdata, deserialize_qkdata, free_qkdata };
 
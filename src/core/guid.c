@@ -819,7 +819,8 @@ guid_init(void)
 {
 	dbstore_kv_t kv = {
 		sizeof(guid_t), NULL, sizeof(struct guiddata),
-		1 + sizeof(struct guiddata)	/* Version byte not held in structure */
+		1 + sizeof(struct guiddata),	/* Version byte not held in structure */
+		DBSTORE_F_FILTER
 	};
 	dbstore_packing_t packing = {
 		serialize_guiddata, deserialize_guiddata, NULL
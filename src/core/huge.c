@@ -42,28 +42,23 @@
 #include "dmesh.h"
 #include "gmsg.h"
 #include "nodes.h"
-#include "settings.h"
+#include "sha1_cache.h"
 #include "share.h"
 #include "spam.h"
-#include "verify_sha1.h"
+#include "tth_cache.h"
+#include "verify_huge.h"
 #include "verify_tth.h"
 #include "version.h"
 
-#include "lib/atoms.h"
 #include "lib/base32.h"
-#include "lib/file.h"
 #include "lib/gnet_host.h"
-#include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/header.h"
-#include "lib/hikset.h"
-#include "lib/parse.h"
+#include "lib/hset.h"
 #include "lib/pattern.h"
 #include "lib/sha1.h"
 #include "lib/stringify.h"
-#include "lib/tm.h"
 #include "lib/urn.h"
-#include "lib/walloc.h"
 
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
@@ -76,324 +71,19 @@
  ***/
 
 /**
- * There's an in-core cache (the hash table ``sha1_cache''), and a
- * persistent copy (normally in ~/.gtk-gnutella/sha1_cache). The
- * in-core cache is filled with the persistent one at launch. When the
- * "shared_file" (the records describing the shared files, see
- * share.h) are created, a call is made to sha1_set_digest to fill the
- * SHA1 digest part of the shared_file. If the digest isn't found in
- * the in-core cache, it's computed, stored in the in-core cache and
- * appended at the end of the persistent cache. If the digest is found
- * in the cache, a check is made based on the file size and last
- * modification time. If they're identical to the ones in the cache,
- * the digest is considered to be accurate, and is used. If the file
- * size or last modification time don't match, the digest is computed
- * again and stored in the in-core cache, but it isn't stored in the
- * persistent one. Instead, the cache is marked as dirty, and will be
- * entirely overwritten by dump_cache, called when everything has been
- * computed.
+ * The SHA1 and TTH of shared files are kept in a persistent cache (see
+ * sha1_cache.c), indexed by the full path of the file.  When the
+ * "shared_file" (the records describing the shared files, see share.h)
+ * are created, a call is made to request_sha1() to fill the SHA1 digest
+ * part of the shared_file.  If the digest is found in the cache, a check is
+ * made based on the file size and last modification time.  If they're
+ * identical to the ones in the cache, the digest is considered to be
+ * accurate, and is used.  Otherwise the file is queued for its digests to
+ * be computed, and they are recorded in the cache once known.
  */
 
-struct sha1_cache_entry {
-    const char *file_name;		/**< Full path name (atom)          */
-	const struct sha1 *sha1;	/**< SHA-1 (binary; atom)			*/
-	const struct tth *tth;		/**< TTH (binary; atom)				*/
-    filesize_t  size;			/**< File size                      */
-    time_t mtime;				/**< Last modification time         */
-    bool shared;				/**< There's a known entry for this
-                                     file in the share library      */
-};
-
-static hikset_t *sha1_cache;
-
-/**
- * cache_dirty = TRUE means that in-core cache is different from the disk one.
- */
-static bool cache_dirty;
-static time_t cache_dumped;
-
 static cpattern_t *has_http_urls;
-
-/**
- ** Handling of persistent buffer
- **/
-
-/* In-memory cache */
-
-/**
- * Takes an in-memory cached entry, and update its content.
- */
-static void update_volatile_cache(
-	struct sha1_cache_entry *item,
-	filesize_t size,
-	time_t mtime,
-	const struct sha1 *sha1,
-	const struct tth *tth)
-{
-	g_assert(sha1);	/* tth may be NULL but sha1 not */
-
-	item->shared = TRUE;
-	item->size = size;
-	item->mtime = mtime;
-	atom_sha1_change(&item->sha1, sha1);
-	atom_tth_change(&item->tth, tth);
-}
-
-/**
- * Add a new entry to the in-memory cache.
- */
-static void
-add_volatile_cache_entry(const char *filename, filesize_t size, time_t mtime,
-	const struct sha1 *sha1, const struct tth *tth, bool known_to_be_shared)
-{
-	struct sha1_cache_entry *item;
-
-	WALLOC(item);
-	item->file_name = atom_str_get(filename);
-	item->size = size;
-	item->mtime = mtime;
-	item->sha1 = atom_sha1_get(sha1);
-	item->tth = tth ? atom_tth_get(tth) : NULL;
-	item->shared = known_to_be_shared;
-	hikset_insert_key(sha1_cache, &item->file_name);
-}
-
-/* Disk cache */
-
-static const char sha1_persistent_cache_file_header[] =
-"#\n"
-"# gtk-gnutella SHA1 cache file.\n"
-"# This file is automatically generated.\n"
-"# Format is: URN<TAB>file_size<TAB>file_mtime<TAB>file_name\n"
-"# Comment lines start with a sharp (#)\n"
-"#\n"
-"\n";
-
-static void
-cache_entry_print(FILE *f, const char *filename,
-	const struct sha1 *sha1, const struct tth *tth,
-	filesize_t size, time_t mtime)
-{
-	char size_buf[UINT64_DEC_BUFLEN], mtime_buf[UINT64_DEC_BUFLEN];
-
-	g_return_if_fail(f);
-	g_return_if_fail(filename);
-	g_return_if_fail(sha1);
-	g_return_if_fail(size > 0);
-
-	uint64_to_string_buf(size, size_buf, sizeof size_buf);
-	uint64_to_string_buf(mtime, mtime_buf, sizeof mtime_buf);
-
-	fprintf(f, "%s\t%s\t%s\t%s\n", bitprint_to_urn_string(sha1, tth),
-		size_buf, mtime_buf, filename);
-}
-
-/**
- * Add an entry to the persistent cache.
- */
-static void
-add_persistent_cache_entry(const char *filename, filesize_t size,
-	time_t mtime, const struct sha1 *sha1, const struct tth *tth)
-{
-	char *pathname;
-	FILE *f;
-
-	pathname = make_pathname(settings_config_dir(), "sha1_cache");
-	f = file_fopen(pathname, "a");
-	if (f) {
-		filestat_t sb;
-
-		/*
-		 * If we're adding the very first entry (file empty), then emit header.
-		 */
-
-		if (fstat(fileno(f), &sb)) {
-			g_warning("%s(): could not stat \"%s\": %m", G_STRFUNC, pathname);
-		} else {
-			if (0 == sb.st_size) {
-				fputs(sha1_persistent_cache_file_header, f);
-			}
-			cache_entry_print(f, filename, sha1, tth, size, mtime);
-		}
-		fclose(f);
-	} else {
-		g_warning("%s(): could not open \"%s\": %m", G_STRFUNC, pathname);
-	}
-	HFREE_NULL(pathname);
-}
-
-struct dump_cache_context {
-	FILE *f;
-	bool forced;
-};
-
-/**
- * Dump one (in-memory) cache into the persistent cache. This is a callback
- * called by dump_cache to dump the whole in-memory cache onto disk.
- */
-static void
-dump_cache_one_entry(void *value, void *udata)
-{
-	struct sha1_cache_entry *e = value;
-	struct dump_cache_context *ctx = udata;
-
-	if (ctx->forced || e->shared) {
-		cache_entry_print(ctx->f,
-			e->file_name, e->sha1, e->tth, e->size, e->mtime);
-	}
-}
-
-/**
- * Dump the whole in-memory cache onto disk.
- */
-static void
-dump_cache(bool force)
-{
-	FILE *f;
-	file_path_t fp;
-
-	if (!force && !cache_dirty)
-		return;
-
-	file_path_set(&fp, settings_config_dir(), "sha1_cache");
-	f = file_config_open_write("SHA-1 cache", &fp);
-	if (f) {
-		struct dump_cache_context ctx;
-
-		fputs(sha1_persistent_cache_file_header, f);
-		ctx.f = f;
-		ctx.forced = force;
-		hikset_foreach(sha1_cache, dump_cache_one_entry, &ctx);
-		if (file_config_close(f, &fp)) {
-			cache_dirty = FALSE;
-		}
-	}
-
-	/*
-	 * Update the timestamp even on failure to avoid that we retry this
-	 * too frequently.
-	 */
-	cache_dumped = tm_time();
-}
-
-/**
- * This function is used to read the disk cache into memory.
- *
- * It must be passed one line from the cache (ending with '\n'). It
- * performs all the syntactic processing to extract the fields from
- * the line and calls add_volatile_cache_entry() to append the record
- * to the in-memory cache.
- */
-static void G_COLD
-parse_and_append_cache_entry(char *line)
-{
-	const char *p, *end; /* pointers to scan the line */
-	int c, error;
-	filesize_t size;
-	time_t mtime;
-	struct sha1 sha1;
-	struct tth tth;
-	bool has_tth;
-
-	/* Skip comments and blank lines */
-	if (file_line_is_skipable(line))
-		return;
-
-	/* Scan until file size */
-
-	p = line;
-	while ((c = *p) != '\0' && c != '\t') {
-		p++;
-	}
-
-	if (urn_get_bitprint(line, p - line, &sha1, &tth)) {
-		has_tth = TRUE;
-	} else if (urn_get_sha1(line, &sha1)) {
-		has_tth = FALSE;
-	} else {
-		const char *sha1_digest_ascii;
-
-		has_tth = FALSE;
-		sha1_digest_ascii = line; /* SHA1 digest is the first field. */
-
-		if (
-			*p != '\t' ||
-			(p - sha1_digest_ascii) != SHA1_BASE32_SIZE ||
-			SHA1_RAW_SIZE != base32_decode(&sha1, sizeof sha1,
-								sha1_digest_ascii, SHA1_BASE32_SIZE)
-		) {
-			goto failure;
-		}
-	}
-	p++; /* Skip \t */
-
-	/* p is now supposed to point to the beginning of the file size */
-
-	size = parse_uint64(p, &end, 10, &error);
-	if (error || *end != '\t') {
-		goto failure;
-	}
-
-	p = ++end;
-
-	/*
-	 * p is now supposed to point to the beginning of the file last
-	 * modification time.
-	 */
-
-	mtime = parse_uint64(p, &end, 10, &error);
-	if (error || *end != '\t') {
-		goto failure;
-	}
-
-	p = ++end;
-
-	/* p is now supposed to point to the file name */
-
-	if (strchr(p, '\t') != NULL)
-		goto failure;
-
-	add_volatile_cache_entry(p, size, mtime,
-		&sha1, has_tth ? &tth : NULL, FALSE);
-	return;
-
-failure:
-	g_warning("malformed line in SHA1 cache file: %s", line);
-}
-
-/**
- * Read the whole persistent cache into memory.
- */
-static void G_COLD
-sha1_read_cache(void)
-{
-	FILE *f;
-	file_path_t fp[1];
-	bool truncated = FALSE;
-
-	g_return_if_fail(settings_config_dir());
-
-	file_path_set(fp, settings_config_dir(), "sha1_cache");
-	f = file_config_open_read("SHA-1 cache", fp, N_ITEMS(fp));
-	if (f) {
-		for (;;) {
-			char buffer[4096];
-
-			if (NULL == fgets(buffer, sizeof buffer, f))
-				break;
-
-			if (!file_line_chomp_tail(buffer, sizeof buffer, NULL)) {
-				truncated = TRUE;
-			} else if (truncated) {
-				truncated = FALSE;
-			} else {
-				parse_and_append_cache_entry(buffer);
-			}
-		}
-		fclose(f);
-		dump_cache(TRUE);
-	}
-}
+static hset_t *huge_verifying;		/**< Verifications in progress */
 
 static bool
 huge_spam_check(shared_file_t *sf, const struct sha1 *sha1)
@@ -421,7 +111,6 @@ bool
 huge_update_hashes(shared_file_t *sf,
 	const struct sha1 *sha1, const struct tth *tth)
 {
-	struct sha1_cache_entry *cached;
 	filestat_t sb;
 
 	shared_file_check(sf);
@@ -456,25 +145,9 @@ huge_update_hashes(shared_file_t *sf,
 
 	/* Update cache */
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
+	sha1_cache_record(shared_file_path(sf),
+		shared_file_size(sf), shared_file_modification_time(sf), sha1, tth);
 
-	if (cached) {
-		update_volatile_cache(cached, shared_file_size(sf),
-			shared_file_modification_time(sf), sha1, tth);
-		cache_dirty = TRUE;
-
-		/* Dump the cache at most about once per minute. */
-		if (!cache_dumped || delta_time(tm_time(), cache_dumped) > 60) {
-			dump_cache(FALSE);
-		}
-	} else {
-		add_volatile_cache_entry(shared_file_path(sf),
-			shared_file_size(sf), shared_file_modification_time(sf),
-			sha1, tth, TRUE);
-		add_persistent_cache_entry(shared_file_path(sf),
-			shared_file_size(sf), shared_file_modification_time(sf),
-			sha1, tth);
-	}
 	return TRUE;
 }
 
@@ -490,7 +163,7 @@ huge_update_hashes(shared_file_t *sf,
 static bool
 huge_need_sha1(shared_file_t *sf)
 {
-	struct sha1_cache_entry *cached;
+	struct sha1_cache_info cached;
 
 	shared_file_check(sf);
 
@@ -502,12 +175,10 @@ huge_need_sha1(shared_file_t *sf)
 	if (!shared_file_indexed(sf))
 		return FALSE;
 
-	if G_UNLIKELY(NULL == sha1_cache)
+	if G_UNLIKELY(NULL == has_http_urls)
 		return FALSE;		/* Shutdown occurred (processing TEQ event?) */
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
-
-	if (cached != NULL) {
+	if (sha1_cache_lookup(shared_file_path(sf), &cached)) {
 		filestat_t sb;
 
 		if (-1 == stat(shared_file_path(sf), &sb)) {
@@ -516,8 +187,8 @@ huge_need_sha1(shared_file_t *sf)
 			return FALSE;
 		}
 		if (
-			cached->size + (fileoffset_t) 0 == sb.st_size + (filesize_t) 0 &&
-			cached->mtime == sb.st_mtime
+			cached.size + (fileoffset_t) 0 == sb.st_size + (filesize_t) 0 &&
+			cached.mtime == sb.st_mtime
 		) {
 			if (GNET_PROPERTY(share_debug) > 1) {
 				g_warning("ignoring duplicate SHA1 work for \"%s\"",
@@ -540,6 +211,44 @@ huge_need_sha1(shared_file_t *sf)
  * is put in a queue for it's SHA1 digest to be computed.
  */
 
+/**
+ * Record that a SHA1 / TTH verification started.
+ *
+ * Several files can be hashed concurrently: the "rebuilding" properties
+ * are raised when the first verification starts.
+ */
+static void
+huge_verifying_add(const struct verify *ctx)
+{
+	hset_insert(huge_verifying, ctx);
+
+	if (1 == hset_count(huge_verifying)) {
+		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, TRUE);
+		gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, TRUE);
+	}
+}
+
+/**
+ * Record that a verification ended, clearing the "rebuilding" properties
+ * when it was the last one running.
+ *
+ * Verifications which were never started (discarded or flushed from the
+ * queue) are ignored.
+ */
+static void
+huge_verifying_remove(const struct verify *ctx)
+{
+	if (NULL == huge_verifying || !hset_contains(huge_verifying, ctx))
+		return;
+
+	hset_remove(huge_verifying, ctx);
+
+	if (0 == hset_count(huge_verifying)) {
+		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, FALSE);
+		gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, FALSE);
+	}
+}
+
 static bool
 huge_verify_callback(const struct verify *ctx, enum verify_status status,
 	void *user_data)
@@ -551,17 +260,25 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 	case VERIFY_START:
 		if (!huge_need_sha1(sf))
 			return FALSE;
-		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, TRUE);
+		huge_verifying_add(ctx);
 		return TRUE;
 	case VERIFY_PROGRESS:
 		return 0 != (SHARE_F_INDEXED & shared_file_flags(sf));
 	case VERIFY_DONE:
-		huge_update_hashes(sf, verify_sha1_digest(ctx), NULL);
-		request_tigertree(sf, TRUE);
+		{
+			const struct tth *tth = verify_huge_tth(ctx);
+
+			huge_update_hashes(sf, verify_huge_sha1(ctx), tth);
+
+			if (shared_file_indexed(sf)) {
+				tth_cache_insert(tth, verify_huge_leaves(ctx),
+					verify_huge_leave_count(ctx));
+			}
+		}
 		/* FALL THROUGH */
 	case VERIFY_ERROR:
 	case VERIFY_SHUTDOWN:
-		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, FALSE);
+		huge_verifying_remove(ctx);
 		shared_file_unref(&sf);
 		return TRUE;
 	case VERIFY_INVALID:
@@ -574,8 +291,8 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 /**
  * Put the shared file on the stack of the things to do.
  *
- * We first begin with the computation of the SHA1, and when completed we
- * will continue with the TTH computation.
+ * Both the SHA1 and the TTH are computed in one single pass over the file,
+ * since a file whose SHA1 is unknown or outdated cannot have a valid TTH.
  */
 static void
 queue_shared_file_for_sha1_computation(shared_file_t *sf)
@@ -584,7 +301,7 @@ queue_shared_file_for_sha1_computation(shared_file_t *sf)
 
  	shared_file_check(sf);
 
-	inserted = verify_sha1_enqueue(FALSE, shared_file_path(sf),
+	inserted = verify_huge_enqueue(FALSE, shared_file_path(sf),
 					shared_file_size(sf), huge_verify_callback,
 					shared_file_ref(sf));
 
@@ -598,7 +315,7 @@ queue_shared_file_for_sha1_computation(shared_file_t *sf)
  * @return true (in the C sense) if it is, or false otherwise.
  */
 static bool
-cached_entry_up_to_date(const struct sha1_cache_entry *cache_entry,
+cached_entry_up_to_date(const struct sha1_cache_info *cache_entry,
 	const shared_file_t *sf)
 {
 	return cache_entry->size == shared_file_size(sf)
@@ -611,10 +328,10 @@ cached_entry_up_to_date(const struct sha1_cache_entry *cache_entry,
 bool
 sha1_is_cached(const shared_file_t *sf)
 {
-	const struct sha1_cache_entry *cached;
+	struct sha1_cache_info cached;
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
-	return cached && cached_entry_up_to_date(cached, sf);
+	return sha1_cache_lookup(shared_file_path(sf), &cached) &&
+		cached_entry_up_to_date(&cached, sf);
 }
 
 
@@ -624,29 +341,29 @@ sha1_is_cached(const shared_file_t *sf)
 void
 request_sha1(shared_file_t *sf)
 {
-	struct sha1_cache_entry *cached;
+	struct sha1_cache_info cached;
+	bool found;
 
 	shared_file_check(sf);
 
 	if (!shared_file_indexed(sf))
 		return;		/* "stale" shared file, has been superseded or removed */
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
+	found = sha1_cache_lookup(shared_file_path(sf), &cached);
 
-	if (cached && cached_entry_up_to_date(cached, sf)) {
-		cache_dirty = TRUE;
-		cached->shared = TRUE;
-		shared_file_set_sha1(sf, cached->sha1);
-		shared_file_set_tth(sf, cached->tth);
-		request_tigertree(sf, NULL == cached->tth);
+	if (found && cached_entry_up_to_date(&cached, sf)) {
+		sha1_cache_mark_shared(shared_file_path(sf));
+		shared_file_set_sha1(sf, &cached.sha1);
+		shared_file_set_tth(sf, cached.has_tth ? &cached.tth : NULL);
+		request_tigertree(sf, !cached.has_tth);
 	} else {
 
 		if (GNET_PROPERTY(share_debug) > 1) {
-			if (cached)
+			if (found)
 				g_debug("cached SHA1 entry for \"%s\" outdated: "
 					"had mtime %lu, now %lu",
 					shared_file_path(sf),
-					(ulong) cached->mtime,
+					(ulong) cached.mtime,
 					(ulong) shared_file_modification_time(sf));
 			else
 				g_debug("queuing \"%s\" for SHA1 computation",
@@ -898,26 +615,9 @@ huge_collect_locations(const sha1_t *sha1, const header_t *header,
 void
 huge_init(void)
 {
-	sha1_cache = hikset_create(		/* Keys are atoms */
-		offsetof(struct sha1_cache_entry, file_name), HASH_KEY_SELF, 0);
-	sha1_read_cache();
+	sha1_cache_init();
 	has_http_urls = pattern_compile("http://");
-}
-
-/**
- * Free SHA1 cache entry.
- */
-static void
-cache_free_entry(void *v, void *unused_udata)
-{
-	struct sha1_cache_entry *e = v;
-
-	(void) unused_udata;
-
-	atom_str_free_null(&e->file_name);
-	atom_sha1_free_null(&e->sha1);
-	atom_tth_free_null(&e->tth);
-	WFREE(e);
+	huge_verifying = hset_create(HASH_KEY_SELF, 0);
 }
 
 /**
@@ -926,13 +626,11 @@ cache_free_entry(void *v, void *unused_udata)
 void
 huge_close(void)
 {
-	dump_cache(FALSE);
-
-	hikset_foreach(sha1_cache, cache_free_entry, NULL);
-	hikset_free_null(&sha1_cache);
+	sha1_cache_close();
 
 	pattern_free(has_http_urls);
 	has_http_urls = NULL;
+	hset_free_null(&huge_verifying);
 }
 
 /*
@@ -25,25 +25,32 @@
 
 #include "common.h"
 
+#define SEARCH_SOURCES
+#include "search.h"				/* For lazy_safe_search() */
+
 #include "matching.h"
 
 #include "alias.h"
 #include "gnet_stats.h"
 #include "qrp.h"				/* For qhvec_add() */
-#include "search.h"				/* For lazy_safe_search() */
 #include "share.h"
 
+#include "lib/aging.h"
 #include "lib/ascii.h"
 #include "lib/atomic.h"
 #include "lib/atoms.h"
 #include "lib/halloc.h"
+#include "lib/hashing.h"
+#include "lib/hikset.h"
 #include "lib/hset.h"
 #include "lib/pattern.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"	/* For hex_escape() */
+#include "lib/thread.h"
 #include "lib/utf8.h"
 #include "lib/walloc.h"
 #include "lib/wordvec.h"
+#include "lib/xsort.h"
 
 #include "if/gnet_property_priv.h"
 
@@ -51,6 +58,10 @@
 
 #define WOVEC_DFLT	10			/**< Default size of word-vectors */
 
+#define ST_CACHE_DELAY		60		/**< Seconds we keep cached query results */
+#define ST_CACHE_MAX		1024	/**< Max amount of cached queries */
+#define ST_CACHE_MAX_HITS	512		/**< Don't cache larger result sets */
+
 typedef uint64 st_mask_t;
 
 /*
@@ -65,28 +76,39 @@ typedef uint64 st_mask_t;
  * Search table searching routines.
  *
  * We're building an inverted index of all the file names by linking
- * together all the names having in common sequences of two chars.
+ * together all the names having in common sequences of three chars
+ * (trigrams), and of two chars (bigrams) to be able to serve words of
+ * only two letters.  Grams spanning a space are not indexed.
  *
  * For instance, given the filenames "foo", "bar", "ar" and "arc", we'll
- * have the following bins:
- *
- *    bin["fo"] = { "foo" };
- *    bin["oo"] = { "foo" };
- *    bin["ba"] = { "bar" };
- *    bin["ar"] = { "bar", "ar", "arc" };
- *    bin["rc"] = { "arc" };
+ * have the following posting lists:
  *
- * Now assume we're looking for "arc". We're scanning the pattern to find
- * the bin which has the less amount of files listed insided.  The patterns
- * gives us the bins "ar" and "rc", and:
+ *    gram["fo"]  = { "foo" };
+ *    gram["oo"]  = { "foo" };
+ *    gram["foo"] = { "foo" };
+ *    gram["ba"]  = { "bar" };
+ *    gram["ar"]  = { "bar", "ar", "arc" };
+ *    gram["bar"] = { "bar" };
+ *    gram["rc"]  = { "arc" };
+ *    gram["arc"] = { "arc" };
  *
- *    bin["ar"] has 3 items
- *    bin["rc"] has 1
+ * Now assume we're looking for "arc".  Words of three letters or more
+ * only select the trigrams, so the pattern gives us the list for "arc",
+ * which we intersect with the lists of all the other trigrams in the query,
+ * starting with the smallest one.  Only the surviving entries are then
+ * submitted to the pattern matching.
  *
- * Therefore we'll look for "arc" in the bin["rc"] list.
+ * Posting lists record the index of the entry in the set, which we append
+ * in increasing order, hence we can store them as variable-length deltas:
+ * most of the time a single byte per entry instead of a pointer.
  */
 
 #define ST_MIN_BIN_SIZE		4
+#define ST_POSTINGS_MIN		8		/* Initial posting list size, in bytes */
+#define ST_VARINT_MAX		5		/* Max bytes to encode a 32-bit delta */
+
+#define ST_GRAM_BIGRAM		(1U << 24)	/* Tags bigram keys */
+#define ST_GRAM_TRIGRAM		(1U << 25)	/* Tags trigram keys */
 
 struct st_entry {
 	const char *string;				/* atom */
@@ -99,9 +121,21 @@ struct st_bin {
 	struct st_entry **vals;
 };
 
+/**
+ * A posting list, recording all the entries bearing a given gram.
+ */
+struct st_postings {
+	uint key;					/* Gram key, embedded for the hikset */
+	uint count;					/* Amount of entries listed */
+	uint last;					/* Last entry index appended */
+	uint len;					/* Bytes used in data[] */
+	uint size;					/* Bytes allocated in data[] */
+	uchar *data;				/* Delta-encoded entry indices */
+};
+
 struct st_set {
-	uint nentries, nchars, nbins;
-	struct st_bin **bins;
+	uint nentries, nchars;
+	hikset_t *grams;			/* gram key -> struct st_postings */
 	struct st_bin all_entries;
 	uchar index_map[MAX_INT_VAL(uchar)];
 	uchar fold_map[MAX_INT_VAL(uchar)];
@@ -112,6 +146,7 @@ enum search_table_magic { SEARCH_TABLE_MAGIC = 0x0cf66242 };
 struct search_table {
 	enum search_table_magic magic;
 	int refcnt;
+	uint generation;			/* Changes whenever the table is modified */
 	struct st_set plain;		/* Plain table, original names */
 	struct st_set alias;		/* Normalized names */
 };
@@ -123,6 +158,35 @@ search_table_check(const struct search_table * const st)
 	g_assert(SEARCH_TABLE_MAGIC == st->magic);
 }
 
+/**
+ * Search tables are re-created on each library rescan and filled before
+ * being installed, hence each table gets a new generation number when it
+ * is created or modified.  This number is part of the query cache key,
+ * so that results computed on older tables can no longer be returned.
+ */
+static uint st_generation;
+
+/**
+ * Key of the query cache.
+ */
+struct st_cache_key {
+	const char *query;				/* Canonized query string (atom) */
+	filesize_t minsize, maxsize;	/* Size limits, if size_restrictions */
+	uint generation;				/* Generation of the search table */
+	uint32 media_types;				/* Media types requested */
+	bool size_restrictions;			/* Whether size limits apply */
+};
+
+/**
+ * Value of the query cache: the list of all the files that matched.
+ */
+struct st_cache_value {
+	pslist_t *files;				/* Matching files, with a reference */
+	uint count;						/* Amount of files in the list */
+};
+
+static aging_table_t *st_cache;		/* Recently run queries */
+
 static void
 destroy_entry(struct st_entry *entry)
 {
@@ -149,19 +213,6 @@ bin_initialize(struct st_bin *bin, int size)
 		bin->vals[i] = NULL;
 }
 
-/**
- * Allocate a bin.
- */
-static struct st_bin *
-bin_allocate(void)
-{
-	struct st_bin *bin;
-
-	WALLOC(bin);
-	bin_initialize(bin, ST_MIN_BIN_SIZE);
-	return bin;
-}
-
 /**
  * Destroy a bin.
  *
@@ -198,6 +249,163 @@ bin_compact(struct st_bin *bin)
 	bin->nslots = bin->nvals;
 }
 
+/**
+ * Allocate a new empty posting list for given gram key.
+ */
+static struct st_postings *
+postings_alloc(uint key)
+{
+	struct st_postings *p;
+
+	WALLOC0(p);
+	p->key = key;
+	return p;
+}
+
+/**
+ * Free posting list, hikset iterator callback.
+ */
+static void
+postings_free(void *data, void *unused_udata)
+{
+	struct st_postings *p = data;
+
+	(void) unused_udata;
+
+	HFREE_NULL(p->data);
+	WFREE(p);
+}
+
+/**
+ * Append entry index to the posting list.
+ *
+ * Indices are appended in increasing order, so we only record the delta
+ * with the previous one, 7 bits per byte, the highest bit flagging that
+ * more bytes follow.
+ */
+static void
+postings_append(struct st_postings *p, uint id)
+{
+	uint delta;
+
+	g_assert(0 == p->count || id > p->last);
+
+	if (p->size - p->len < ST_VARINT_MAX) {
+		p->size = MAX(p->size * 2, ST_POSTINGS_MIN);
+		HREALLOC_ARRAY(p->data, p->size);
+	}
+
+	delta = id - p->last;
+
+	do {
+		uchar b = delta & 0x7f;
+		delta >>= 7;
+		p->data[p->len++] = b | (0 == delta ? 0 : 0x80);
+	} while (delta != 0);
+
+	p->last = id;
+	p->count++;
+}
+
+/**
+ * Decode next entry index from a posting list.
+ *
+ * @param q		pointer within the posting list data
+ * @param id	the previous index, updated with the decoded index
+ *
+ * @return pointer to the next encoded index.
+ */
+static inline const uchar *
+postings_next(const uchar *q, uint *id)
+{
+	uint v = 0, shift = 0;
+	uchar b;
+
+	do {
+		b = *q++;
+		v |= (b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+
+	*id += v;
+	return q;
+}
+
+/**
+ * Decode the whole posting list into the supplied array.
+ *
+ * @return the amount of indices written, the posting list count.
+ */
+static uint
+postings_decode(const struct st_postings *p, uint *ids)
+{
+	const uchar *q = p->data, *end = &p->data[p->len];
+	uint i = 0, id = 0;
+
+	while (q < end) {
+		q = postings_next(q, &id);
+		ids[i++] = id;
+	}
+
+	g_assert(i == p->count);
+
+	return i;
+}
+
+/**
+ * Intersect the sorted array of indices with the posting list, in place.
+ *
+ * @return the new amount of indices in the array.
+ */
+static uint
+postings_intersect(const struct st_postings *p, uint *ids, uint n)
+{
+	const uchar *q = p->data, *end = &p->data[p->len];
+	uint i = 0, j = 0, id = 0;
+
+	while (i < n && q < end) {
+		q = postings_next(q, &id);
+
+		while (i < n && ids[i] < id)
+			i++;
+
+		if (i < n && ids[i] == id)
+			ids[j++] = ids[i++];
+	}
+
+	return j;
+}
+
+/**
+ * Makes a posting list take as little memory as needed, hikset iterator.
+ */
+static void
+postings_compact(void *data, void *unused_udata)
+{
+	struct st_postings *p = data;
+
+	(void) unused_udata;
+
+	if (p->len != p->size) {
+		HREALLOC_ARRAY(p->data, p->len);
+		p->size = p->len;
+	}
+}
+
+/**
+ * qsort() callback to sort posting lists by increasing size.
+ */
+static int
+postings_cmp(const void *a, const void *b)
+{
+	const struct st_postings * const *pa = a, * const *pb = b;
+
+	if ((*pa)->count != (*pb)->count)
+		return CMP((*pa)->count, (*pb)->count);
+
+	return ptr_cmp(*pa, *pb);
+}
+
 static uchar map[MAX_INT_VAL(uchar)];
 
 static void
@@ -243,7 +451,7 @@ st_set_initialize(struct st_set *set)
 	set->nentries = set->nchars = 0;
 
 	/*
-	 * The indexing map is used to avoid having 256*256 bins.
+	 * The indexing map is used to reduce the amount of possible grams.
 	 */
 
 	for (i = 0; i < N_ITEMS(set->index_map); i++) {
@@ -259,17 +467,19 @@ st_set_initialize(struct st_set *set)
 	}
 
 	set->nchars = cur_char;
-	set->nbins = set->nchars * set->nchars;
-	set->bins = NULL;
+	set->grams = NULL;
 	set->all_entries.vals = 0;
 
+	g_assert(set->nchars * set->nchars * set->nchars < ST_GRAM_BIGRAM);
+
 	if (GNET_PROPERTY(matching_debug)) {
 		static bool done;
 
 		if (!done) {
 			done = TRUE;
-			g_debug("MATCH search sets will use %d bins max "
-				"(%d indexing chars)", set->nbins, set->nchars);
+			g_debug("MATCH search sets will use %u trigrams max "
+				"(%u indexing chars)",
+				set->nchars * set->nchars * set->nchars, set->nchars);
 		}
 	}
 }
@@ -283,6 +493,7 @@ st_initialize(search_table_t *table)
 	search_table_check(table);
 
 	table->refcnt = 1;
+	table->generation = atomic_uint_inc(&st_generation);
 	st_setup_map();
 	st_set_initialize(&table->plain);
 	st_set_initialize(&table->alias);
@@ -294,15 +505,12 @@ st_initialize(search_table_t *table)
 static void
 st_set_recreate(struct st_set *set)
 {
-	uint i;
+	g_assert(NULL == set->grams);
 
-	g_assert(NULL == set->bins);
+	set->grams = hikset_create(
+		offsetof(struct st_postings, key), HASH_KEY_FIXED, sizeof(uint));
 
-	HALLOC_ARRAY(set->bins, set->nbins);
-	for (i = 0; i < set->nbins; i++)
-		set->bins[i] = NULL;
-
-    bin_initialize(&set->all_entries, ST_MIN_BIN_SIZE);
+	bin_initialize(&set->all_entries, ST_MIN_BIN_SIZE);
 }
 
 /**
@@ -325,16 +533,9 @@ st_set_destroy(struct st_set *set)
 {
 	uint i;
 
-	if (set->bins) {
-		for (i = 0; i < set->nbins; i++) {
-			struct st_bin *bin = set->bins[i];
-
-			if (bin) {
-				bin_destroy(bin);
-				WFREE(bin);
-			}
-		}
-		HFREE_NULL(set->bins);
+	if (set->grams != NULL) {
+		hikset_foreach(set->grams, postings_free, NULL);
+		hikset_free_null(&set->grams);
 	}
 
 	if (set->all_entries.vals) {
@@ -471,10 +672,43 @@ mask_hash(const char *s) {
  * Get key of two-char pair.
  */
 static inline uint
-st_key(struct st_set *set, const char k[2])
+st_bigram_key(const struct st_set *set, const char k[2])
 {
-	return set->index_map[(uchar) k[0]] * set->nchars +
-		set->index_map[(uchar) k[1]];
+	return ST_GRAM_BIGRAM | (
+		set->index_map[(uchar) k[0]] * set->nchars +
+		set->index_map[(uchar) k[1]]);
+}
+
+/**
+ * Get key of three-char sequence.
+ */
+static inline uint
+st_trigram_key(const struct st_set *set, const char k[3])
+{
+	return ST_GRAM_TRIGRAM | (
+		(set->index_map[(uchar) k[0]] * set->nchars +
+		 set->index_map[(uchar) k[1]]) * set->nchars +
+		set->index_map[(uchar) k[2]]);
+}
+
+/**
+ * Record entry index in the posting list of the gram.
+ */
+static void
+st_gram_add(struct st_set *set, uint key, uint id)
+{
+	struct st_postings *p;
+
+	p = hikset_lookup(set->grams, &key);
+
+	if (NULL == p) {
+		p = postings_alloc(key);
+		hikset_insert(set->grams, p);
+	} else if (p->last == id) {
+		return;		/* Don't insert item into same list twice */
+	}
+
+	postings_append(p, id);
 }
 
 /**
@@ -488,8 +722,8 @@ st_insert_item(search_table_t *table,
 	enum match_set which, const char *s, const shared_file_t *sf)
 {
 	size_t i, len;
+	uint id;
 	struct st_entry *entry;
-	hset_t *seen_keys;
 	struct st_set *set = NULL;
 
 	search_table_check(table);
@@ -505,33 +739,30 @@ st_insert_item(search_table_t *table,
 
 	g_assert(set != NULL);
 
-	seen_keys = hset_create(HASH_KEY_SELF, 0);
-
 	WALLOC(entry);
 	entry->string = atom_str_get(s);
 	entry->sf = shared_file_ref(sf);
 	entry->mask = mask_hash(entry->string);
 
-	len = strlen(entry->string);
-	for (i = 0; i < len - 1; i++) {
-		uint key = st_key(set, &entry->string[i]);
-
-		/* don't insert item into same bin twice */
-		if (hset_contains(seen_keys, int_to_pointer(key)))
-			continue;
-
-		hset_insert(seen_keys, int_to_pointer(key));
+	/*
+	 * The entry is identified in posting lists by its index in the set.
+	 */
 
-		g_assert(key < set->nbins);
-		if (set->bins[key] == NULL)
-			set->bins[key] = bin_allocate();
+	id = set->all_entries.nvals;
+	s = entry->string;
+	len = strlen(s);
 
-		bin_insert_item(set->bins[key], entry);
+	for (i = 0; i < len - 1; i++) {
+		if (is_ascii_space(s[i]) || is_ascii_space(s[i+1]))
+			continue;
+		st_gram_add(set, st_bigram_key(set, &s[i]), id);
+		if (i + 2 < len && !is_ascii_space(s[i+2]))
+			st_gram_add(set, st_trigram_key(set, &s[i]), id);
 	}
 	bin_insert_item(&set->all_entries, entry);
 	set->nentries++;
+	table->generation = atomic_uint_inc(&st_generation);
 
-	hset_free_null(&seen_keys);
 	return TRUE;
 }
 
@@ -541,17 +772,11 @@ st_insert_item(search_table_t *table,
 static void
 st_set_compact(struct st_set *set)
 {
-	uint i;
-
 	if (!set->all_entries.nvals)
 		return;			/* Nothing in set */
 
 	bin_compact(&set->all_entries);
-
-	for (i = 0; i < set->nbins; i++) {
-		if (set->bins[i])
-			bin_compact(set->bins[i]);
-	}
+	hikset_foreach(set->grams, postings_compact, NULL);
 }
 
 /**
@@ -568,34 +793,26 @@ st_compact(search_table_t *table)
 
 /**
  * Apply pattern matching on text, matching at the *beginning* of words.
- * Patterns are lazily compiled as needed, using pattern_compile_fast().
+ *
+ * All the words are looked for in a single pass over the text, each word
+ * having to occur as many times as it appears in the query.  The matching
+ * automaton is lazily compiled when first needed.
  */
 static bool
 entry_match(const char *text, size_t tlen,
-	cpattern_t **pw, word_vec_t *wovec, size_t wn)
+	mpattern_t **mp, word_vec_t *wovec, size_t wn)
 {
-	size_t i;
-
-	for (i = 0; i < wn; i++) {
-		size_t j, offset = 0, amount = wovec[i].amount;
+	if (NULL == *mp) {
+		size_t i;
 
-		if (pw[i] == NULL)
-			pw[i] = pattern_compile_fast(wovec[i].word, wovec[i].len);
-
-		for (j = 0; j < amount; j++) {
-			const char *pos;
-
-			pos = pattern_qsearch(pw[i], text, tlen, offset, qs_begin);
-			if (pos)
-				offset = (pos - text) + pattern_len(pw[i]);
-			else
-				break;
+		*mp = mpattern_make(wn);
+		for (i = 0; i < wn; i++) {
+			mpattern_add(*mp, wovec[i].word, wovec[i].len, wovec[i].amount);
 		}
-		if (j != amount)	/* Word does not occur as many times as we want */
-			return FALSE;
+		mpattern_compile(*mp);
 	}
 
-	return TRUE;
+	return mpattern_qmatch(*mp, text, tlen, qs_begin);
 }
 
 /**
@@ -633,27 +850,98 @@ st_fill_qhv(const char *search_term, query_hashvec_t *qhv)
 }
 
 /**
- * Compute search bin "name" (2 consecutive indexing letters) given
- * the matching start string whose first 2 characters were used to select
- * the bin.
+ * Compute the candidate entries for the search string, by intersecting
+ * the posting lists of all the grams it contains.
+ *
+ * Words of three characters or more contribute all their trigrams, words
+ * of two characters contribute their bigram and single-letter words do not
+ * contribute anything.
  *
- * @param str	start of 2 chars that make up the bin name
+ * @param set		the set where grams are indexed
+ * @param search	the query string (canonized)
+ * @param len		length of search string
+ * @param count		where amount of candidates is written
+ * @param grams		where amount of distinct grams looked at is written
  *
- * @return the bin name, as a pointer to a static buffer
+ * @return array of candidate entry indices (to be freed via hfree), NULL
+ * if we can be sure nothing will match.
  */
-static const char *
-st_bin_name(const char *str)
+static uint *
+st_candidates(const struct st_set *set, const char *search, size_t len,
+	uint *count, uint *grams)
 {
-	static char buf[3];
+	struct st_postings **lists;
+	uint *ids;
+	size_t i, start, n = 0;
+
+	*count = *grams = 0;
+
+	if (len < 2)
+		return NULL;
+
+	HALLOC_ARRAY(lists, len);
+
+	for (i = 0, start = 0; i <= len; i++) {
+		size_t j, run;
+
+		if (i != len && !is_ascii_space(search[i]))
+			continue;
+
+		run = i - start;
+
+		for (j = start; j < i && run >= 2; j++) {
+			struct st_postings *p;
+			uint key;
+
+			if (2 == run)
+				key = st_bigram_key(set, &search[j]);
+			else if (j + 2 < i)
+				key = st_trigram_key(set, &search[j]);
+			else
+				break;
+
+			p = hikset_lookup(set->grams, &key);
+			if (NULL == p) {
+				n = 0;
+				goto done;		/* Gram never seen, cannot match */
+			}
+
+			lists[n++] = p;
+
+			if (2 == run)
+				break;
+		}
+
+		start = i + 1;
+	}
+
+	if (0 == n)
+		goto done;
+
+	/*
+	 * Start with the smallest list, and intersect with the others by
+	 * increasing size.  Sorting brings duplicate grams next to each other.
+	 */
+
+	xqsort(lists, n, sizeof lists[0], postings_cmp);
 
-	g_assert(str != NULL);
-	g_assert(str[0] != '\0' && str[1] != '\0');
+	HALLOC_ARRAY(ids, lists[0]->count);
+	*count = postings_decode(lists[0], ids);
+	*grams = 1;
 
-	buf[0] = is_ascii_print(str[0]) ? str[0] : ' ';
-	buf[1] = is_ascii_print(str[1]) ? str[1] : ' ';
-	buf[2] = '\0';
+	for (i = 1; i < n && *count != 0; i++) {
+		if (lists[i] == lists[i - 1])
+			continue;
+		*count = postings_intersect(lists[i], ids, *count);
+		(*grams)++;
+	}
+
+	HFREE_NULL(lists);
+	return ids;
 
-	return buf;
+done:
+	HFREE_NULL(lists);
+	return NULL;
 }
 
 enum search_mode {
@@ -687,15 +975,12 @@ st_run_search(
 	pslist_t **result,
 	query_hashvec_t *qhv)
 {
-	uint key, nres = 0;
+	uint nres = 0;
 	uint i, len;
-	struct st_bin *best_bin = NULL;
-	uint best_bin_size = UINT_MAX;
+	uint *cands, ncands, ngrams;
 	word_vec_t *wovec;
 	uint wocnt;
-	cpattern_t **pattern;
-	struct st_entry **vals;
-	uint vcnt;
+	mpattern_t *pattern = NULL;
 	int scanned = 0;		/* measure search mask efficiency */
 	pslist_t *local;
 	st_mask_t search_mask;
@@ -708,48 +993,30 @@ st_run_search(
 	len = strlen(search);
 
 	/*
-	 * Find smallest bin
+	 * Intersect the posting lists of the query grams.
 	 */
 
-	if (len >= 2) {
-		uint b = 0;
+	cands = st_candidates(set, search, len, &ncands, &ngrams);
 
-		for (i = 0; i < len - 1; i++) {
-			struct st_bin *bin;
-			if (is_ascii_space(search[i]) || is_ascii_space(search[i+1]))
-				continue;
-			key = st_key(set, search + i);
-			if ((bin = set->bins[key]) == NULL) {
-				best_bin = NULL;
-				break;
-			}
-			if (bin->nvals < best_bin_size) {
-				best_bin = bin;
-				best_bin_size = bin->nvals;
-				b = i;		/* Best bin starting index */
-			}
-		}
-
-		if (GNET_PROPERTY(matching_debug) > 1) {
-			g_debug("MATCH %s(): mode=%s, str=\"%s\", len=%d, "
-				"best bin: {\"%s\", size=%d}",
-				G_STRFUNC, SEARCH_NORMAL == mode ? "normal" : "alias",
-				lazy_safe_search(search), len,
-				NULL == best_bin ? "" : st_bin_name(&search[b]),
-				NULL == best_bin ? 0 : best_bin_size);
-		}
+	if (GNET_PROPERTY(matching_debug) > 1) {
+		g_debug("MATCH %s(): mode=%s, str=\"%s\", len=%d, "
+			"%u candidate%s from %u gram%s",
+			G_STRFUNC, SEARCH_NORMAL == mode ? "normal" : "alias",
+			lazy_safe_search(search), len,
+			ncands, plural(ncands), ngrams, plural(ngrams));
 	}
 
 	/*
-	 * If the best_bin is NULL, we did not find a matching bin, and we're
-	 * sure we won't be able to find the search string.
+	 * If we have no candidates, either a gram was never indexed or the
+	 * intersection is empty, and we're sure we won't be able to find the
+	 * search string.
 	 *
 	 * Note that on search strings like "r e m ", we always have a letter
 	 * followed by spaces, so we won't search that.
 	 *		--RAM, 06/10/2001
 	 */
 
-	if (best_bin == NULL) {
+	if (0 == ncands) {
 		/*
 		 * If we have a `qhv', we need to compute the word vector anyway,
 		 * for query routing...
@@ -796,16 +1063,12 @@ st_run_search(
 		}
 	}
 
-	if (wocnt == 0 || best_bin == NULL) {
+	if (wocnt == 0 || 0 == ncands) {
 		if (wocnt > 0)
 			word_vec_free(wovec, wocnt);
 		goto finish;
 	}
 
-	g_assert(best_bin_size > 0);	/* Allocated bin, it must hold something */
-
-	WALLOC0_ARRAY(pattern, wocnt);
-
 	/*
 	 * Prepare matching optimization, an idea from Mike Green.
 	 *
@@ -840,16 +1103,13 @@ st_run_search(
 		shared_file_name_canonic_len : shared_file_name_normalized_len;
 
 	/*
-	 * Search through the smallest bin
+	 * Search through the candidates
 	 */
 
-	vcnt = best_bin->nvals;
-	vals = best_bin->vals;
-
 	nres = 0;
 	local = *result;
-	for (i = 0; i < vcnt; i++) {
-		const struct st_entry *e = vals[i];
+	for (i = 0; i < ncands; i++) {
+		const struct st_entry *e = set->all_entries.vals[cands[i]];
 		const shared_file_t *sf;
 		size_t filename_len;
 
@@ -883,7 +1143,7 @@ st_run_search(
 
 		scanned++;
 
-		if (entry_match(e->string, filename_len, pattern, wovec, wocnt)) {
+		if (entry_match(e->string, filename_len, &pattern, wovec, wocnt)) {
 			if (GNET_PROPERTY(matching_debug) > 3) {
 				g_debug("MATCH \"%s\" matches %s",
 					search, shared_file_name_nfc(sf));
@@ -897,42 +1157,222 @@ st_run_search(
 	*result = local;
 
 	if (GNET_PROPERTY(matching_debug) > 2) {
-		uint compiled = 0;
+		g_debug("MATCH %s(): "
+			"scanned %d/%u candidate%s, "
+			"%s %u pattern%s, got %d match%s",
+			G_STRFUNC, scanned, ncands, plural(ncands),
+			NULL == pattern ? "did not compile" : "compiled",
+			wocnt, plural(wocnt), nres, plural_es(nres));
+	}
 
-		for (i = 0; i < wocnt; i++) {
-			if (NULL == pattern[i])
-				break;
-			compiled++;
-		}
+	mpattern_free_null(&pattern);
+	word_vec_free(wovec, wocnt);
 
-		g_debug("MATCH %s(): "
-			"scanned %d/%d bin entr%s, "
-			"compiled %u/%u pattern%s, got %d match%s",
-			G_STRFUNC, scanned, best_bin_size, plural_y(scanned),
-			compiled, wocnt, plural(compiled), nres, plural_es(nres));
+	/* FALL THROUGH */
+
+finish:
+	hset_free_null(&already_matched);
+	HFREE_NULL(cands);
+
+	return nres;
+}
+
+/**
+ * Hash a query cache key.
+ */
+static uint
+st_cache_key_hash(const void *key)
+{
+	const struct st_cache_key *k = key;
+
+	return string_mix_hash(k->query) ^
+		integer_hash(k->generation) ^
+		integer_hash2(k->media_types) ^
+		(k->size_restrictions ?
+			binary_hash(&k->minsize, sizeof k->minsize) ^
+			binary_hash2(&k->maxsize, sizeof k->maxsize) : 0);
+}
+
+/**
+ * Test query cache keys for equality.
+ */
+static bool
+st_cache_key_eq(const void *a, const void *b)
+{
+	const struct st_cache_key *ka = a, *kb = b;
+
+	if (
+		ka->generation != kb->generation ||
+		ka->media_types != kb->media_types ||
+		ka->size_restrictions != kb->size_restrictions
+	)
+		return FALSE;
+
+	if (
+		ka->size_restrictions &&
+		(ka->minsize != kb->minsize || ka->maxsize != kb->maxsize)
+	)
+		return FALSE;
+
+	return ka->query == kb->query || 0 == strcmp(ka->query, kb->query);
+}
+
+/**
+ * Free query cache key and value.
+ */
+static void
+st_cache_kvfree(void *key, void *value)
+{
+	struct st_cache_key *k = key;
+	struct st_cache_value *v = value;
+	pslist_t *sl;
+
+	PSLIST_FOREACH(v->files, sl) {
+		shared_file_t *sf = sl->data;
+		shared_file_unref(&sf);
+	}
+	pslist_free_null(&v->files);
+	atom_str_free_null(&k->query);
+	WFREE(k);
+	WFREE(v);
+}
+
+/**
+ * Fill query cache key for the search.
+ *
+ * The query string is not an atom, this is only suitable for lookups.
+ */
+static void
+st_cache_key_fill(struct st_cache_key *k, const search_table_t *table,
+	const char *search, const search_request_info_t *sri)
+{
+	ZERO(k);
+	k->query = search;
+	k->generation = table->generation;
+	k->media_types = sri->media_types;
+	k->size_restrictions = booleanize(sri->size_restrictions);
+	if (k->size_restrictions) {
+		k->minsize = sri->minsize;
+		k->maxsize = sri->maxsize;
+	}
+}
+
+/**
+ * Look whether the search was recently run against the table.
+ *
+ * The cache is only used by the main thread, the one processing queries.
+ *
+ * @param table		the search table
+ * @param search	the canonized query string
+ * @param sri		search meta-information, which is part of the key
+ * @param result	where the list of matching files is returned on hits
+ *
+ * @return the amount of matching files if found, -1 if not cached.
+ */
+static int
+st_cache_lookup(const search_table_t *table, const char *search,
+	const search_request_info_t *sri, pslist_t **result)
+{
+	struct st_cache_key k;
+	const struct st_cache_value *v;
+	const pslist_t *sl;
+	pslist_t *local = NULL;
+	int n = 0;
+
+	if (NULL == st_cache || !thread_is_main())
+		return -1;
+
+	st_cache_key_fill(&k, table, search, sri);
+	v = aging_lookup(st_cache, &k);
+
+	if (NULL == v) {
+		gnet_stats_inc_general(GNR_LOCAL_QUERY_CACHE_MISSES);
+		return -1;
 	}
 
+	gnet_stats_inc_general(GNR_LOCAL_QUERY_CACHE_HITS);
+
 	/*
-	 * Matching patterns are lazily compiled by entry_match(), as they are
-	 * needed, but in order.  Therefore we can stop as soon as we hit a NULL
-	 * entry in the array.
+	 * Files may have been unshared since we cached the query results.
 	 */
 
-	for (i = 0; i < wocnt; i++) {
-		if (NULL == pattern[i])
+	PSLIST_FOREACH(v->files, sl) {
+		const shared_file_t *sf = sl->data;
+
+		if (!shared_file_is_shareable(sf))
+			continue;
+
+		local = pslist_prepend_const(local, sf);
+		n++;
+	}
+
+	if (GNET_PROPERTY(matching_debug) > 1) {
+		g_debug("MATCH %s(): str=\"%s\" cached, %d/%u match%s",
+			G_STRFUNC, lazy_safe_search(search), n, v->count, plural_es(n));
+	}
+
+	*result = local;
+	return n;
+}
+
+/**
+ * Remember the results of the search against the table.
+ *
+ * @param table		the search table
+ * @param search	the canonized query string
+ * @param sri		search meta-information, which is part of the key
+ * @param result	the list of all the matching files
+ * @param count		amount of items in the list
+ */
+static void
+st_cache_insert(const search_table_t *table, const char *search,
+	const search_request_info_t *sri, const pslist_t *result, uint count)
+{
+	struct st_cache_key *k;
+	struct st_cache_value *v;
+	const pslist_t *sl;
+
+	if (!thread_is_main() || count > ST_CACHE_MAX_HITS)
+		return;
+
+	if (NULL == st_cache) {
+		st_cache = aging_make(ST_CACHE_DELAY,
+			st_cache_key_hash, st_cache_key_eq, st_cache_kvfree);
+	}
+
+	/*
+	 * When full, evict the oldest entries to make room: they are the
+	 * least likely to be hit again, since repeated queries come in
+	 * bursts, and entries from older table generations cannot match
+	 * anymore.  This also releases their shared file references early.
+	 */
+
+	while (aging_count(st_cache) >= ST_CACHE_MAX) {
+		if (!aging_remove_oldest(st_cache))
 			break;
-		pattern_free(pattern[i]);
 	}
 
-	WFREE_ARRAY(pattern, wocnt);
-	word_vec_free(wovec, wocnt);
+	WALLOC(k);
+	st_cache_key_fill(k, table, search, sri);
+	k->query = atom_str_get(search);
 
-	/* FALL THROUGH */
+	WALLOC0(v);
+	v->count = count;
 
-finish:
-	hset_free_null(&already_matched);
+	PSLIST_FOREACH(result, sl) {
+		v->files = pslist_prepend(v->files, shared_file_ref(sl->data));
+	}
 
-	return nres;
+	aging_insert(st_cache, k, v);
+}
+
+/**
+ * Discard all the cached query results.
+ */
+void
+st_cache_close(void)
+{
+	aging_destroy(&st_cache);
 }
 
 /**
@@ -960,6 +1400,7 @@ st_search(
 {
 	uint nres = 0;
 	uint i;
+	int cached;
 	pslist_t *result = NULL;
 	char *search, *alias;
 
@@ -985,6 +1426,19 @@ st_search(
 	}
 
 
+	/*
+	 * Popular queries are repeated by many hosts within a short time
+	 * window: look whether we already know the results.
+	 */
+
+	cached = st_cache_lookup(table, search, sri, &result);
+
+	if (cached >= 0) {
+		st_fill_qhv(search, qhv);
+		nres = cached;
+		goto dispatch;
+	}
+
 	/*
 	 * Run the original query, unmangled.
 	 */
@@ -1015,10 +1469,13 @@ st_search(
 			gnet_stats_count_general(GNR_LOCAL_ALIASED_HITS, ares);
 	}
 
+	st_cache_insert(table, search, sri, result, nres);
+
 	/*
 	 * Randomly shuffle the results and pick the first max_res items.
 	 */
 
+dispatch:
 	if (result != NULL) {
 		if (nres > max_res)
 			result = pslist_shuffle(result);
@@ -30,11 +30,12 @@
  * Basic explanation of how search table works:
  *
  *    A search_table is a global object.  Only one of these is expected to
- *  exist.  It consists of a number of "bins", each bin containing all
- *  entries which have a certain sequence of two characters in a row, plus
- *  some metadata.
+ *  exist.  It consists of a number of posting lists, each list recording
+ *  all entries which have a certain sequence of three (or two) characters
+ *  in a row, plus some metadata.
  *
- *    Each bin is a simple array, without repetitions, of items.  Each item
+ *    Each posting list is a compact array, without repetitions, of item
+ *  indices which are intersected at search time.  Each item
  *  consists of a string to which a certain mapping of characters onto
  *  characters has been applied, plus a void * representing the actual data
  *  mapped to.  (I used void * to make this code reasonably generic, so that
@@ -106,6 +107,7 @@ int st_search(
 	struct query_hashvec *qhv);
 
 void st_fill_qhv(const char *search_term, struct query_hashvec *qhv);
+void st_cache_close(void);
 
 #endif	/* _core_matching_h_ */
 
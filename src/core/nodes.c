@@ -2243,6 +2243,7 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 		qrt_receive_free(n->qrt_receive);
 		n->qrt_receive = NULL;
 	}
+	qrt_patch_cancel(n);
 	if (n->recv_query_table) {
 		qrt_unref(n->recv_query_table);
 		n->recv_query_table = NULL;
@@ -9304,11 +9305,8 @@ node_parse(gnutella_node_t *n)
 			bool done;
 			if (!qrt_receive_next(n->qrt_receive, &done))
 				return;				/* Node BYE-ed */
-			if (done) {
-				qrt_receive_free(n->qrt_receive);
-				n->qrt_receive = NULL;
-				node_fire_node_flags_changed(n);
-			}
+			if (done)
+				node_qrt_received(n);
 		}
 		goto reset_header;
 	case GTA_MSG_SEARCH_RESULTS:	/* "semi-pongs" */
@@ -11518,6 +11516,20 @@ node_qrt_new(gnutella_node_t *n, struct routing_table *query_table)
 	return changed;
 }
 
+/**
+ * Invoked when the last message of the QRP sequence sent by remote node
+ * was handled, to dispose of the receiving state.
+ */
+void
+node_qrt_received(gnutella_node_t *n)
+{
+	g_assert(n->qrt_receive != NULL);
+
+	qrt_receive_free(n->qrt_receive);
+	n->qrt_receive = NULL;
+	node_fire_node_flags_changed(n);
+}
+
 /**
  * Invoked for ultra nodes to install new Query Routing Table.
  */
@@ -11538,14 +11550,22 @@ node_qrt_install(gnutella_node_t *n, struct routing_table *query_table)
 /**
  * Invoked for ultra nodes when the Query Routing Table of remote node
  * was fully patched (i.e. we got a new generation).
+ *
+ * When the patch was applied to a copy of the table, the new table
+ * supersedes the one we had.
  */
 void
 node_qrt_patched(gnutella_node_t *n, struct routing_table *query_table)
 {
 	g_assert(NODE_IS_LEAF(n) || NODE_IS_ULTRA(n));
-	g_assert(n->recv_query_table == query_table);
+	g_assert(n->recv_query_table != NULL);
 	g_assert(n->qrt_info != NULL);
 
+	if (n->recv_query_table != query_table) {
+		qrt_unref(n->recv_query_table);
+		n->recv_query_table = qrt_ref(query_table);
+	}
+
 	if (node_qrt_new(n, query_table))
 		node_fire_node_flags_changed(n);
 }
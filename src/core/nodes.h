@@ -654,6 +654,7 @@ bool node_remove_worst(bool non_local);
 
 void node_qrt_changed(struct routing_table *query_table);
 void node_qrt_discard(struct gnutella_node *n);
+void node_qrt_received(struct gnutella_node *n);
 void node_qrt_install(struct gnutella_node *n, struct routing_table *);
 void node_qrt_patched(struct gnutella_node *n, struct routing_table *);
 
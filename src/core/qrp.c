@@ -61,8 +61,11 @@
 
 #include "lib/atoms.h"
 #include "lib/bg.h"
+#include "lib/cond.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
+#include "lib/eslist.h"
+#include "lib/getcpucount.h"
 #include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/hset.h"
@@ -73,9 +76,12 @@
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sha1.h"
+#include "lib/slotset.h"
 #include "lib/spinlock.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/utf8.h"
@@ -97,6 +103,9 @@
 #define MAX_TABLE_SIZE		(1 << MAX_TABLE_BITS)
 #define MAX_UP_TABLE_SIZE	131072 /**< Max size for inter-UP QRP: 128 Kslots */
 #define EMPTY_TABLE_SIZE	8
+#define QRT_INDEX_BITS		16		/**< Resolution of the slot index */
+
+#define QRT_INDEX_SLOTS		(1 << QRT_INDEX_BITS)
 
 #define qrp_debugging(lvl)	G_UNLIKELY(GNET_PROPERTY(qrp_debug) > (lvl))
 
@@ -188,6 +197,8 @@ struct routing_table {
 	int pass_throw;			/**< Query must pass a d100 throw to be forwarded */
 	const struct sha1 *digest;	/**< SHA1 digest of the whole table (atom) */
 	char *name;				/**< Name for dumping purposes */
+	uint8 *fold;			/**< Slots set per index slot, for large tables */
+	int member;				/**< Member in the slot index, -1 if none */
 	unsigned reset:1;		/**< This is a new table, after a RESET */
 	unsigned compacted:1;	/**< Table was compacted */
 	unsigned cancelled:1;	/**< Must supersede with next version */
@@ -469,6 +480,223 @@ RT_SLOT_READ(const uint8 *arena, uint i)
 	return RT_SLOT_READ_and128(arena, i);
 }
 
+/*
+ * Slot index of received routing tables.
+ *
+ * To avoid probing the QRT of each neighbour when routing a query, we keep
+ * a transposed index giving, for each slot, the set of received tables that
+ * have the slot set.  Routing a query then only requires combining the sets
+ * of the few slots it hashes to, which is done for all the tables at once.
+ *
+ * The index has a fixed resolution of QRT_INDEX_BITS.  Each slot of a smaller
+ * table covers several index slots.  Larger tables are folded: each index
+ * slot covers several table slots and we count how many of these are set.
+ * Folding loses precision, so for these tables the index is only a prefilter
+ * and a match must be confirmed by probing the table itself.
+ *
+ * The index is kept up-to-date as patches are applied to the tables.
+ */
+
+static slotset_t *qrt_index;	/**< Slot -> received routing tables */
+
+/**
+ * Update the amount of memory used by QRP.
+ */
+static void
+qrt_index_account(ssize_t delta)
+{
+	if (delta != 0) {
+		gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
+			GNET_PROPERTY(qrp_memory) + delta);
+	}
+}
+
+/**
+ * Record new received routing table, whose slots are all cleared, in the
+ * slot index.
+ */
+static void
+qrt_index_add(struct routing_table *rt)
+{
+	size_t mem;
+
+	STATIC_ASSERT(MAX_TABLE_BITS - QRT_INDEX_BITS < 8);	/* Fold counts */
+
+	qrt_check(rt);
+	g_assert(-1 == rt->member);
+	g_assert(NULL == rt->fold);
+
+	if G_UNLIKELY(NULL == qrt_index)
+		qrt_index = slotset_make(QRT_INDEX_BITS);
+
+	mem = slotset_memory(qrt_index);
+	rt->member = slotset_member_alloc(qrt_index);
+	mem = slotset_memory(qrt_index) - mem;
+
+	if (rt->bits > QRT_INDEX_BITS) {
+		rt->fold = halloc0(QRT_INDEX_SLOTS);
+		mem += QRT_INDEX_SLOTS;
+	}
+
+	qrt_index_account(mem);
+}
+
+/**
+ * Remove routing table from the slot index.
+ */
+static void
+qrt_index_remove(struct routing_table *rt)
+{
+	if (-1 == rt->member)
+		return;
+
+	if (qrt_index != NULL)
+		slotset_member_free(qrt_index, rt->member);
+
+	rt->member = -1;
+
+	if (rt->fold != NULL) {
+		HFREE_NULL(rt->fold);
+		qrt_index_account(-QRT_INDEX_SLOTS);
+	}
+}
+
+/**
+ * Propagate the change of slot ``i'' in the routing table to the index.
+ *
+ * @param rt		the routing table
+ * @param i			the table slot which changed
+ * @param set		whether slot is now set
+ */
+static void
+qrt_index_update(struct routing_table *rt, uint i, bool set)
+{
+	int shift;
+
+	if (-1 == rt->member)
+		return;
+
+	shift = rt->bits - QRT_INDEX_BITS;
+
+	if (shift > 0) {
+		uint s = i >> shift;
+
+		if (set) {
+			if (0 == rt->fold[s]++)
+				slotset_add(qrt_index, s, rt->member);
+		} else {
+			g_assert(rt->fold[s] != 0);
+
+			if (0 == --rt->fold[s])
+				slotset_remove(qrt_index, s, rt->member);
+		}
+	} else {
+		uint s = i << -shift, n = 1U << -shift;
+
+		while (n-- != 0) {
+			if (set)
+				slotset_add(qrt_index, s++, rt->member);
+			else
+				slotset_remove(qrt_index, s++, rt->member);
+		}
+	}
+}
+
+/**
+ * Propagate the change of a whole compacted byte of the routing table,
+ * once its slots have been flipped by the bits set in ``flip''.
+ */
+static void
+qrt_index_update_byte(struct routing_table *rt, uint byte, uint8 flip)
+{
+	uint b;
+
+	if (-1 == rt->member || 0 == flip)
+		return;
+
+	for (b = 0; b < 8; b++) {
+		uint8 mask = 0x80U >> b;
+
+		if (flip & mask) {
+			bool set = 0 != (rt->arena[byte] & mask);
+			qrt_index_update(rt, (byte << 3) + b, set);
+		}
+	}
+}
+
+/**
+ * Propagate to the index the changes made by replacing the arena of the
+ * routing table, ``old'' being the previous arena.
+ */
+static void
+qrt_index_replace(struct routing_table *rt, const uint8 *old)
+{
+	uint i, bytes = rt->slots / 8;
+
+	if (-1 == rt->member)
+		return;
+
+	for (i = 0; i < bytes; i++)
+		qrt_index_update_byte(rt, i, old[i] ^ rt->arena[i]);
+}
+
+/**
+ * Compute the set of received routing tables that can route the query,
+ * using the slot index.
+ *
+ * This follows the logic of qrp_can_route_default(): any matching URN is
+ * enough, otherwise 2/3 of the words must match, or all of them when there
+ * are less than 3 words.
+ *
+ * @return set of index members, NULL if the index cannot be used, which
+ * is also the case for an empty query hash vector.
+ */
+static const uint64 *
+qrt_index_match(const query_hashvec_t *qhv)
+{
+	uint32 words[SLOTSET_MAX_HITS], urns[SLOTSET_MAX_HITS];
+	uint i, nw = 0, nu = 0, need;
+
+	STATIC_ASSERT(N_ITEMS(words) >= MAX_INT_VAL(uint8));	/* qhv->count */
+
+	if (NULL == qrt_index || 0 == slotset_members(qrt_index))
+		return NULL;
+
+	/*
+	 * A query without any word or URN is not something the index can
+	 * answer: let the routing callback of each table decide.
+	 */
+
+	if (0 == qhv->count)
+		return NULL;
+
+	for (i = 0; i < qhv->count; i++) {
+		const struct query_hash *qh = &qhv->vec[i];
+		uint32 slot = qh->hashcode >> (32 - QRT_INDEX_BITS);
+
+		if (qhv->has_urn && QUERY_H_URN == qh->source)
+			urns[nu++] = slot;
+		else
+			words[nw++] = slot;
+	}
+
+	need = nw < 3 ? nw : (2 * nw + 2) / 3;	/* 3 * need / nw >= 2 */
+
+	return slotset_match(qrt_index, words, nw, need, urns, nu);
+}
+
+/**
+ * Release the slot index.
+ */
+static void
+qrt_index_close(void)
+{
+	if (qrt_index != NULL) {
+		qrt_index_account(-(ssize_t) slotset_memory(qrt_index));
+		slotset_free_null(&qrt_index);
+	}
+}
+
 /**
  * In a compressed routing table, patch entry ``i'' with ``v'', the value
  * we got from the routing patch.
@@ -483,9 +711,13 @@ qrt_patch_slot(struct routing_table *rt, uint i, uint8 v)
 
 	if G_UNLIKELY(v) {
 		if G_LIKELY(v & 0x80) {		/* Negative value -> set bit */
+			if (0 == (rt->arena[i >> 3] & b))
+				qrt_index_update(rt, i, TRUE);
 			rt->arena[i >> 3] |= b;
 			rt->set_count++;
 		} else { 					/* Positive value -> clear bit */
+			if (0 != (rt->arena[i >> 3] & b))
+				qrt_index_update(rt, i, FALSE);
 			rt->arena[i >> 3] &= ~b;
 		}
 	} else {
@@ -1076,6 +1308,7 @@ qrt_create(const char *name, char *arena, int slots, int max)
 	rt->compacted     = FALSE;
 	rt->digest        = NULL;
 	rt->reset         = FALSE;
+	rt->member        = -1;
 	rt->can_route_urn = qrp_can_route_default;
 	rt->can_route     = qrp_can_route_default;
 
@@ -1119,6 +1352,7 @@ qrt_free(struct routing_table *rt)
 {
 	g_assert(rt->refcnt == 0);
 
+	qrt_index_remove(rt);
 	atom_sha1_free_null(&rt->digest);
 	HFREE_NULL(rt->arena);
 	HFREE_NULL(rt->name);
@@ -1259,10 +1493,16 @@ struct merge_context {
 	pslist_t *tables;			/* Leaf routing tables */
 	uchar *arena;				/* Working arena (not compacted) */
 	int slots;					/* Amount of slots used for merged table */
+	struct qrt_job *job;		/* Merging job run by worker threads */
+	bool merged;				/* Whether job merged all the tables */
 };
 
 static struct merge_context *merge_ctx;
 
+static bool qrt_pool_enabled(void);
+static void qrt_merge_submit(struct merge_context *ctx, struct bgtask *bt);
+static void qrt_merge_detach(struct merge_context *ctx);
+
 /**
  * Free merge context.
  */
@@ -1281,6 +1521,14 @@ merge_context_free(void *p)
 
 	QRP_TASK_UNLOCK;
 
+	/*
+	 * If a worker thread is still merging the tables, they must stay
+	 * referenced until it is done: the job will release them.
+	 */
+
+	if (ctx->job != NULL)
+		qrt_merge_detach(ctx);
+
 	PSLIST_FOREACH(ctx->tables, sl) {
 		struct routing_table *rt = sl->data;
 
@@ -1357,14 +1605,18 @@ mrg_step_get_list(struct bgtask *unused_h, void *u, int unused_ticks)
 }
 
 /**
- * Merge routing table into specified arena.
+ * Merge compacted routing table into specified arena.
+ *
+ * This only accesses the supplied memory areas and can be run by the
+ * worker threads.
  *
- * @param rt is the routing table to merge
+ * @param table is the compacted arena of the routing table to merge
+ * @param tslots is the number of slots in the routing table
  * @param arena is a non-compacted arena
  * @param slots is the number of slots in the arena
  */
 static void
-merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
+merge_table_into_arena(const uint8 *table, int tslots, uchar *arena, int slots)
 {
 	int ratio;
 	int expand;
@@ -1378,20 +1630,19 @@ merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
 	 * be smaller than the arena size.
 	 */
 
-	g_assert(rt->slots <= slots);
-	g_assert(rt->compacted);
+	g_assert(tslots <= slots);
 	g_assert(is_pow2(slots));
-	g_assert(is_pow2(rt->slots));
-	g_assert(rt->slots >= 8);
+	g_assert(is_pow2(tslots));
+	g_assert(tslots >= 8);
 
-	ratio = highest_bit_set(slots) - highest_bit_set(rt->slots);
+	ratio = highest_bit_set(slots) - highest_bit_set(tslots);
 
 	g_assert(ratio >= 0);
 
 	expand = 1 << ratio;
-	bytes = rt->slots / 8;
+	bytes = tslots / 8;
 
-	g_assert(rt->slots * expand <= slots);	/* Won't overflow */
+	g_assert(tslots * expand <= slots);	/* Won't overflow */
 
 	/*
 	 * Loop over the supplied QRT, and expand each slot `expand' times into
@@ -1406,7 +1657,7 @@ merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
 
 #define RT_FOR_EACH_BIT_SET(ON_CHANGE)				\
 for (b = 0, i = 0; b < bytes; b++) {				\
-	uint8 entry = rt->arena[b];						\
+	uint8 entry = table[b];							\
 	unsigned mask = 0x80;							\
 													\
 	do {											\
@@ -1481,12 +1732,11 @@ for (b = 0, i = 0; b < bytes; b++) {				\
  * Merge next leaf QRT table if node is still there.
  */
 static bgret_t
-mrg_step_merge_one(struct bgtask *unused_h, void *u, int ticks)
+mrg_step_merge_one(struct bgtask *bt, void *u, int ticks)
 {
 	struct merge_context *ctx = u;
 	int ticks_used = 0;
 
-	(void) unused_h;
 	g_assert(MERGE_MAGIC == ctx->magic);
 
 	/*
@@ -1497,6 +1747,28 @@ mrg_step_merge_one(struct bgtask *unused_h, void *u, int ticks)
 	if (!settings_is_ultra())
 		return BGR_DONE;
 
+	/*
+	 * When the tables are merged by the worker threads, we sleep until
+	 * the job is completed and then release the tables.
+	 */
+
+	if (ctx->merged) {
+		pslist_t *sl;
+
+		PSLIST_FOREACH(ctx->tables, sl) {
+			qrt_unref(sl->data);
+		}
+		pslist_free_null(&ctx->tables);
+		return BGR_NEXT;
+	}
+
+	if (ctx->job != NULL || (ctx->tables != NULL && qrt_pool_enabled())) {
+		if (NULL == ctx->job)
+			qrt_merge_submit(ctx, bt);
+		bg_task_sleep(bt);
+		return BGR_MORE;	/* When woken up, redo this step */
+	}
+
 	while (ctx->tables != NULL && ticks_used < ticks) {
 		struct routing_table *rt = ctx->tables->data;
 
@@ -1508,7 +1780,9 @@ mrg_step_merge_one(struct bgtask *unused_h, void *u, int ticks)
 		 */
 
 		if (rt->refcnt > 1) {
-			merge_table_into_arena(rt, ctx->arena, ctx->slots);
+			g_assert(rt->compacted);
+			merge_table_into_arena(rt->arena, rt->slots,
+				ctx->arena, ctx->slots);
 			ticks_used++;
 		}
 
@@ -3713,8 +3987,71 @@ struct qrt_receive {
 	bool deflated;			/**< Is data deflated? */
 	bool (*patch)(struct qrt_receive *qrcv, const uchar *data, int len,
 						const struct qrp_patch *patch);
+	struct qrt_job *job;	/**< Job processing the patch, NULL if none */
+	int error_code;			/**< BYE code for the first error, 0 if none */
+	char error[128];		/**< Error message, if `error_code' is set */
+	eslist_t deferred;		/**< Messages deferred until previous table done */
+	bool waiting;			/**< Waiting for previous table to be installed */
+};
+
+/**
+ * A QRP message received whilst the previous table sent by the node is
+ * still processed by the worker threads.
+ */
+struct qrt_deferred {
+	uint8 type;					/**< GTA_MSGV_QRP_RESET or _PATCH */
+	struct qrp_reset reset;		/**< The RESET message */
+	struct qrp_patch patch;		/**< The PATCH message, with its data copy */
+	slink_t lk;					/**< Links deferred messages */
 };
 
+static void qrt_job_release(struct qrt_receive *qrcv);
+static bool qrt_node_pending(const gnutella_node_t *n);
+
+/**
+ * Record error while processing the received patch.
+ *
+ * Only the first error is kept, to be reported by qrt_receive_report() from
+ * the main thread: this can be called by the worker threads.
+ *
+ * @param qrcv		the receiving state
+ * @param code		the BYE code to use
+ * @param fmt		printf-like format of the error message
+ *
+ * @return FALSE, as a convenience for callers.
+ */
+static G_PRINTF(3, 4) bool
+qrt_receive_fail(struct qrt_receive *qrcv, int code, const char *fmt, ...)
+{
+	va_list args;
+
+	if (0 == qrcv->error_code) {
+		qrcv->error_code = code;
+		va_start(args, fmt);
+		str_vbprintf(qrcv->error, sizeof qrcv->error, fmt, args);
+		va_end(args);
+	}
+
+	return FALSE;
+}
+
+/**
+ * Report the error recorded whilst processing the patch and BYE the node.
+ *
+ * @param n			the node which sent us the patch
+ * @param qrcv		the receiving state where error was recorded
+ */
+static void
+qrt_receive_report(gnutella_node_t *n, const struct qrt_receive *qrcv)
+{
+	g_assert(qrcv->error_code != 0);
+
+	g_warning("QRP %d-bit patch of %s slots from %s failed: %s",
+		qrcv->entry_bits, compact_size(qrcv->table->client_slots, FALSE),
+		node_infostr(n), qrcv->error);
+	node_bye_if_writable(n, qrcv->error_code, "%s", qrcv->error);
+}
+
 /**
  * A default handler that should never be called.
  *
@@ -3735,6 +4072,63 @@ qrt_unknown_patch(struct qrt_receive *unused_qrcv,
 	return FALSE;
 }
 
+/**
+ * Bind the receiving state to the existing query table of the node, which
+ * the incoming messages will patch unless a RESET comes.
+ *
+ * @param qrcv			the receiving state
+ * @param query_table	the existing query table, NULL if none
+ */
+static void
+qrt_receive_bind(struct qrt_receive *qrcv, struct routing_table *query_table)
+{
+	struct routing_table *table = query_table;
+
+	g_assert(NULL == qrcv->table);
+	g_assert(NULL == qrcv->expansion);
+
+	qrcv->waiting = FALSE;
+
+	/*
+	 * We don't know yet whether we'll receive a RESET, but if we already
+	 * have a table, increase its generation number.  If a RESET comes,
+	 * we'll create a new table anyway.
+	 *
+	 * Also compute proper shrink factor and allocate `expansion'.
+	 */
+
+	if (table != NULL) {
+		int length = table->client_slots;
+
+		qrcv->table = qrt_ref(table);
+		table->generation++;
+		table->reset = FALSE;
+
+		/*
+		 * Since we know the table_length is a power of two, to
+		 * know the shrinking factor, we need only count the amount
+		 * of right shifts required to make it be MAX_TABLE_SIZE.
+		 */
+
+		while (length > MAX_TABLE_SIZE) {
+			length >>= 1;
+			qrcv->shrink_factor <<= 1;
+		}
+
+		qrcv->expansion = walloc(qrcv->shrink_factor);
+	}
+}
+
+/**
+ * Free deferred QRP message.
+ */
+static void
+qrt_deferred_free(struct qrt_deferred *m)
+{
+	HFREE_NULL(m->patch.data);
+	WFREE(m);
+}
+
 /**
  * Create a new QRT receiving handler, to process all incoming QRP messages
  * from the leaf node.
@@ -3775,7 +4169,7 @@ qrt_receive_create(gnutella_node_t *n, struct routing_table *query_table)
 	WALLOC(qrcv);
 	qrcv->magic = QRT_RECEIVE_MAGIC;
 	qrcv->node = n;
-	qrcv->table = table ? qrt_ref(table) : NULL;
+	qrcv->table = NULL;
 	qrcv->shrink_factor = 1;		/* Assume none for now */
 	qrcv->seqsize = 0;				/* Unknown yet */
 	qrcv->seqno = 1;				/* Expecting message #1 */
@@ -3786,34 +4180,20 @@ qrt_receive_create(gnutella_node_t *n, struct routing_table *query_table)
 	qrcv->data = halloc(qrcv->len);
 	qrcv->expansion = NULL;
 	qrcv->patch = qrt_unknown_patch;
+	qrcv->job = NULL;
+	qrcv->error_code = 0;
+	eslist_init(&qrcv->deferred, offsetof(struct qrt_deferred, lk));
 
 	/*
-	 * We don't know yet whether we'll receive a RESET, but if we already
-	 * have a table, increase its generation number.  If a RESET comes,
-	 * we'll create a new table anyway.
-	 *
-	 * Also compute proper shrink factor and allocate `expansion'.
+	 * If the previous table sent by the node is still being processed by
+	 * the worker threads, the messages are deferred until it is installed:
+	 * we cannot know which table they will patch before that.
 	 */
 
-	if (table != NULL) {
-		int length = table->client_slots;
-
-		table->generation++;
-		table->reset = FALSE;
-
-		/*
-		 * Since we know the table_length is a power of two, to
-		 * know the shrinking factor, we need only count the amount
-		 * of right shifts required to make it be MAX_TABLE_SIZE.
-		 */
-
-		while (length > MAX_TABLE_SIZE) {
-			length >>= 1;
-			qrcv->shrink_factor <<= 1;
-		}
-
-		qrcv->expansion = walloc(qrcv->shrink_factor);
-	}
+	if (qrt_node_pending(n))
+		qrcv->waiting = TRUE;
+	else
+		qrt_receive_bind(qrcv, table);
 
 	return qrcv;
 }
@@ -3824,8 +4204,16 @@ qrt_receive_create(gnutella_node_t *n, struct routing_table *query_table)
 void
 qrt_receive_free(struct qrt_receive *qrcv)
 {
+	struct qrt_deferred *m;
+
 	g_assert(qrcv->magic == QRT_RECEIVE_MAGIC);
 
+	if (qrcv->job != NULL)
+		qrt_job_release(qrcv);
+
+	while (NULL != (m = eslist_shift(&qrcv->deferred)))
+		qrt_deferred_free(m);
+
 	(void) inflateEnd(qrcv->inz);
 	WFREE(qrcv->inz);
 	if (qrcv->table)
@@ -3846,7 +4234,7 @@ qrt_receive_free(struct qrt_receive *qrcv)
  * @param len			length of patch data (amount of data bytes)
  * @param patch			the PATCH message, for logging purposes
  *
- * @returns TRUE on sucess, FALSE on error with the node being BYE-ed.
+ * @returns TRUE on sucess, FALSE on error, recorded in ``qrcv''.
  */
 static bool
 qrt_apply_patch(struct qrt_receive *qrcv, const uchar *data, int len,
@@ -3872,16 +4260,11 @@ qrt_apply_patch(struct qrt_receive *qrcv, const uchar *data, int len,
 		return TRUE;
 
 	if G_UNLIKELY(qrcv->current_index >= rt->slots) {
-		gnutella_node_t *n = qrcv->node;
-		g_warning("%s overflowed its QRP %d-bit patch of %s slots"
-			" (%s message #%d/%d)",
-			node_infostr(n), qrcv->entry_bits,
+		return qrt_receive_fail(qrcv, 413,
+			"QRP patch overflowed table (%s slots) at %s message #%u/%u",
 			compact_size(rt->client_slots, FALSE),
 			patch->compressor ? "compressed" : "plain",
-			patch->seq_no, patch->seq_size);
-		node_bye_if_writable(n, 413, "QRP patch overflowed table (%s slots)",
-			compact_size(rt->client_slots, FALSE));
-		return FALSE;
+			(uint) patch->seq_no, (uint) patch->seq_size);
 	}
 
 	/*
@@ -4043,16 +4426,9 @@ qrt_apply_patch(struct qrt_receive *qrcv, const uchar *data, int len,
 
 			if ((uint) qrcv->current_slot >= rt->client_slots) {
 				if (j != (epb - 1) || i != (len - 1)) {
-					gnutella_node_t *n = qrcv->node;
-					g_warning("%s overflowed its QRP "
-						"%d-bit patch of %s slots",
-						node_infostr(n),
-						qrcv->entry_bits,
-						compact_size(rt->client_slots, FALSE));
-					node_bye_if_writable(n, 413,
+					return qrt_receive_fail(qrcv, 413,
 						"QRP patch overflowed table (%s slots)",
 						compact_size(rt->client_slots, FALSE));
-					return FALSE;
 				}
 			}
 		}
@@ -4064,7 +4440,7 @@ qrt_apply_patch(struct qrt_receive *qrcv, const uchar *data, int len,
 /**
  * Sanity checks at each patch reception.
  *
- * @return FALSE if there was an error reported and the patch message
+ * @return FALSE if there was an error recorded and the patch message
  * must be ignored.
  */
 static bool
@@ -4081,17 +4457,11 @@ qrt_patch_is_valid(struct qrt_receive *qrcv, int len, int slots_per_byte,
 	 */
 
 	if G_UNLIKELY(qrcv->current_index >= rt->slots) {
-		gnutella_node_t *n = qrcv->node;
-		g_warning("%s overflowed its QRP %d-bit patch of %s slots"
-			" (current_index=%d, slots=%d at %s message #%u/%u)",
-			node_infostr(n), qrcv->entry_bits,
+		return qrt_receive_fail(qrcv, 413,
+			"QRP patch overflowed table (%s slots) at %s message #%u/%u",
 			compact_size(rt->client_slots, FALSE),
-			qrcv->current_index, rt->slots,
 			patch->compressor ? "compressed" : "plain",
-			patch->seq_no, patch->seq_size);
-		node_bye_if_writable(n, 413, "QRP patch overflowed table (%s slots)",
-			compact_size(rt->client_slots, FALSE));
-		return FALSE;
+			(uint) patch->seq_no, (uint) patch->seq_size);
 	}
 
 	/*
@@ -4102,17 +4472,13 @@ qrt_patch_is_valid(struct qrt_receive *qrcv, int len, int slots_per_byte,
 	last_patch_slot = (uint) qrcv->current_slot + len * slots_per_byte;
 
 	if G_UNLIKELY(last_patch_slot > rt->client_slots) {
-		gnutella_node_t *n = qrcv->node;
-		g_warning("%s overflowed its QRP %d-bit patch of "
-			"%s slots by extra %s at %s message #%u/%u",
-			node_infostr(n), qrcv->entry_bits,
+		return qrt_receive_fail(qrcv, 413,
+			"QRP patch overflowed table (%s slots) by extra %u"
+			" at %s message #%u/%u",
 			compact_size(rt->client_slots, FALSE),
-			uint32_to_string(last_patch_slot - rt->client_slots),
+			last_patch_slot - rt->client_slots,
 			patch->compressor ? "compressed" : "plain",
-			patch->seq_no, patch->seq_size);
-		node_bye_if_writable(n, 413, "QRP patch overflowed table (%s slots)",
-			compact_size(rt->client_slots, FALSE));
-		return FALSE;
+			(uint) patch->seq_no, (uint) patch->seq_size);
 	}
 
 	return TRUE;
@@ -4126,7 +4492,7 @@ qrt_patch_is_valid(struct qrt_receive *qrcv, int len, int slots_per_byte,
  * @param len			length of patch data (amount of data bytes)
  * @param patch			the PATCH message, for logging purposes
  *
- * @returns TRUE on sucess, FALSE on error with the node being BYE-ed.
+ * @returns TRUE on sucess, FALSE on error, recorded in ``qrcv''.
  */
 static bool
 qrt_apply_patch8(struct qrt_receive *qrcv, const uchar *data, int len,
@@ -4167,7 +4533,7 @@ qrt_apply_patch8(struct qrt_receive *qrcv, const uchar *data, int len,
  * @param len			length of patch data (amount of data bytes)
  * @param patch			the PATCH message, for logging purposes
  *
- * @returns TRUE on sucess, FALSE on error with the node being BYE-ed.
+ * @returns TRUE on sucess, FALSE on error, recorded in ``qrcv''.
  */
 static bool
 qrt_apply_patch4(struct qrt_receive *qrcv, const uchar *data, int len,
@@ -4216,7 +4582,7 @@ qrt_apply_patch4(struct qrt_receive *qrcv, const uchar *data, int len,
  * @param len			length of patch data (amount of data bytes)
  * @param patch			the PATCH message, for logging purposes
  *
- * @returns TRUE on sucess, FALSE on error with the node being BYE-ed.
+ * @returns TRUE on sucess, FALSE on error, recorded in ``qrcv''.
  */
 static bool
 qrt_apply_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
@@ -4250,6 +4616,7 @@ qrt_apply_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 
 		rt->arena[i >> 3] ^= data[i];
 		rt->set_count += bits_set(rt->arena[i >> 3]);
+		qrt_index_update_byte(rt, i >> 3, data[i]);
 	}
 
 	qrcv->current_index += len * 8;
@@ -4267,7 +4634,7 @@ qrt_apply_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
  * @param len			length of patch data (amount of data bytes)
  * @param patch			the PATCH message, for logging purposes
  *
- * @returns TRUE on sucess, FALSE on error with the node being BYE-ed.
+ * @returns TRUE on sucess, FALSE on error, recorded in ``qrcv''.
  */
 static bool
 qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
@@ -4292,6 +4659,8 @@ qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 	g_assert(qrcv->current_index + len * 8 <= rt->slots);
 
 	for (i = 0; i < len; i++) {
+		uint8 flip = reverse_byte(data[i]);
+
 		/*
 		 * Bits are processed in little-endian way (since patch is "reversed").
 		 *
@@ -4299,8 +4668,9 @@ qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 		 * flipped, a zero bit means we need to keep it as-is.
 		 */
 
-		rt->arena[i >> 3] ^= reverse_byte(data[i]);
+		rt->arena[i >> 3] ^= flip;
 		rt->set_count += bits_set(rt->arena[i >> 3]);
+		qrt_index_update_byte(rt, i >> 3, flip);
 	}
 
 	qrcv->current_index += len * 8;
@@ -4501,28 +4871,1054 @@ qrt_dynamic_bind_empty(struct routing_table *rt)
 }
 
 /**
- * Handle reception of QRP RESET.
+ * Inflate the data of a PATCH message, if needed, and apply it to the table
+ * being received.
  *
- * @returns TRUE if we handled the message correctly, FALSE if an error
- * was found and the node BYE-ed.
+ * This does not access the node and can be run by the worker threads.
+ *
+ * @param qrcv		the receiving state
+ * @param patch		the PATCH message
+ *
+ * @returns TRUE if OK, FALSE on error, recorded in ``qrcv''.
  */
 static bool
-qrt_handle_reset(
-	gnutella_node_t *n, struct qrt_receive *qrcv, struct qrp_reset *reset)
+qrt_patch_process(struct qrt_receive *qrcv, const struct qrp_patch *patch)
 {
-	struct routing_table *rt;
-	int ret;
-	int slots;
-	int old_generation = -1;
+	bool last = patch->seq_no == qrcv->seqsize;
 
-	ret = inflateReset(qrcv->inz);
-	if G_UNLIKELY(ret != Z_OK) {
-		g_warning("unable to reset QRP decompressor for %s: %s",
-			node_infostr(n), zlib_strerror(ret));
-		node_bye_if_writable(n, 500, "Error resetting QRP inflater: %s",
-			zlib_strerror(ret));
-		return FALSE;
-	}
+	if (qrcv->deflated) {
+		z_streamp inz = qrcv->inz;
+		int ret;
+		bool seen_end = FALSE;
+
+		inz->next_in = patch->data;
+		inz->avail_in = patch->len;
+
+		while (!seen_end && inz->avail_in > 0) {
+			inz->next_out = cast_to_pointer(qrcv->data);
+			inz->avail_out = qrcv->len;
+
+			ret = inflate(inz, Z_SYNC_FLUSH);
+
+			if (ret == Z_STREAM_END && last) {
+				seen_end = TRUE;
+				ret = Z_OK;
+			}
+
+			if G_UNLIKELY(ret != Z_OK) {
+				return qrt_receive_fail(qrcv, 413,
+					"QRP patch #%u/%u decompression failed: %s",
+					(uint) patch->seq_no, (uint) patch->seq_size,
+					zlib_strerror(ret));
+			}
+
+			if (
+				!qrcv->patch(qrcv, (uchar *) qrcv->data,
+					qrcv->len - inz->avail_out, patch)
+			)
+				return FALSE;
+		}
+
+		/*
+		 * If we reached the end of the stream, make sure we were at
+		 * the last patch of the sequence.
+		 */
+
+		if G_UNLIKELY(seen_end && !last) {
+			return qrt_receive_fail(qrcv, 413,
+				"Early end of compressed QRP patch at #%u/%u",
+				(uint) patch->seq_no, (uint) patch->seq_size);
+		}
+	} else if (!qrcv->patch(qrcv, patch->data, patch->len, patch))
+		return FALSE;
+
+	/*
+	 * Make sure the servent sent us a patch that covers the whole table.
+	 * We've reached the end of the patch sequence, but that does not
+	 * necessarily means it applied to all the slots.
+	 */
+
+	if G_UNLIKELY(last && qrcv->current_index < qrcv->table->slots) {
+		return qrt_receive_fail(qrcv, 413,
+			"Incomplete %d-bit QRP patch covered %d/%d slots",
+			qrcv->entry_bits, qrcv->current_index, qrcv->table->slots);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Finalize a routing table whose PATCH sequence was fully processed and
+ * install it in the node.
+ *
+ * @param n			the node which sent us the table
+ * @param rt		the routing table
+ * @param qrcv		the receiving state used to patch the table
+ */
+static void
+qrt_patch_finish(gnutella_node_t *n, struct routing_table *rt,
+	const struct qrt_receive *qrcv)
+{
+	g_assert(qrcv->current_index == rt->slots);
+	atom_sha1_free_null(&rt->digest);
+
+	if (qrp_debugging(2))
+		rt->digest = atom_sha1_get(qrt_sha1(rt));
+
+	rt->fill_ratio = (int) (100.0 * rt->set_count / rt->slots);
+
+	/*
+	 * If table is more than 5% full, each query will go through a
+	 * random d100 throw, and will pass only if the score is below
+	 * the value of the pass throw threshold.
+	 *
+	 * The function below quickly drops and then flattens:
+	 *
+	 *   x =  6%  -> throw = 84
+	 *   x =  7%  -> throw = 79
+	 *   x =  8%  -> throw = 75
+	 *   x = 10%  -> throw = 69
+	 *   x = 20%  -> throw = 53
+	 *   x = 50%  -> throw = 27
+	 *   x = 90%  -> throw = 6
+	 *   x = 99%  -> throw = 2
+	 *
+	 * throw = 100 * (1 - (x - 0.05)^1/2.5)
+	 *
+	 * Function was adjusted to cut at 5% now instead of 1% since we
+	 * now filter SHA1 queries via the QRP, so leaf traffic is far
+	 * diminished.
+	 *		--RAM, 03/01/2004
+	 */
+
+	if (rt->fill_ratio > 5)
+		rt->pass_throw = (int)
+			(100.0 * (1 - pow((rt->fill_ratio - 5) / 100.0, 1/2.5)));
+	else
+		rt->pass_throw = 100;		/* Always forward if QRT says so */
+
+	if (qrp_debugging(2)) {
+		g_debug("QRP got whole %d-bit patch "
+			"(gen=%d, slots=%d (*%d), fill=%d%%, throw=%d) "
+			"from %s: SHA1=%s",
+			qrcv->entry_bits, rt->generation, rt->slots,
+			qrcv->shrink_factor, rt->fill_ratio, rt->pass_throw,
+			node_infostr(n),
+			rt->digest ? sha1_base32(rt->digest) : "<not computed>");
+	}
+
+	/*
+	 * If table is empty, supersede the routing entries.
+	 */
+
+	if (qrt_is_empty(rt)) {
+		rt->is_empty = TRUE;
+		qrt_dynamic_bind_empty(rt);
+	} else {
+		rt->is_empty = FALSE;
+	}
+
+	/*
+	 * Install the table in the node, if it was a new table.
+	 * Otherwise, we only finished patching it.
+	 */
+
+	if (rt->reset)
+		node_qrt_install(n, rt);
+	else
+		node_qrt_patched(n, rt);
+
+	if (NODE_IS_LEAF(n))
+		qrp_leaf_changed();
+
+	if (qrp_debugging(4))
+		(void) qrt_dump(rt, GNET_PROPERTY(qrp_debug) > 19);
+}
+
+/***
+ *** Processing of received tables by worker threads.
+ ***
+ *** When all the leaves send their tables at the same time, inflating and
+ *** applying the patches, then merging the tables, would stall the main
+ *** thread.  The PATCH sequences are therefore applied by a pool of worker
+ *** threads to a private copy of the table, which supersedes the current
+ *** one when complete, and the merging of leaf tables is done by the pool.
+ ***/
+
+#define QRP_WORKER_MAX		8		/**< Max amount of worker threads */
+
+enum qrt_job_magic {
+	QRT_JOB_MAGIC = 0x5e21c0d7
+};
+
+enum qrt_job_kind {
+	QRT_JOB_PATCH,				/**< Apply a PATCH sequence */
+	QRT_JOB_MERGE				/**< Merge leaf tables */
+};
+
+/**
+ * A PATCH message queued for processing.
+ */
+struct qrt_job_msg {
+	struct qrp_patch patch;		/**< The message, with its own data copy */
+	slink_t lk;					/**< Links queued messages */
+};
+
+/**
+ * A leaf table to merge, as seen by the worker threads.
+ */
+struct qrt_merge_item {
+	const uint8 *arena;			/**< Compacted arena of the table */
+	int slots;					/**< Amount of slots in the table */
+};
+
+/**
+ * A job processed by the worker threads.
+ *
+ * Workers only access the private arenas and receiving state held by the
+ * job.  The node, the routing tables and the merging context are only used
+ * by the main thread, when the job is created and dispatched.
+ *
+ * The state flags are protected by the pool lock.
+ */
+struct qrt_job {
+	enum qrt_job_magic magic;
+	enum qrt_job_kind kind;		/**< Type of job */
+	slink_t lk;					/**< Links jobs in the pool queues */
+	gnutella_node_t *node;		/**< Node which sent the patch, or NULL */
+	struct routing_table *table;	/**< Table being patched (referenced) */
+	struct qrt_receive *owner;	/**< Receiving state feeding us messages */
+	struct qrt_receive rcv;		/**< Private state, patching a private table */
+	eslist_t msgs;				/**< Queued PATCH messages */
+	struct merge_context *ctx;	/**< Merging context, NULL when detached */
+	struct bgtask *task;		/**< Merging task (referenced) */
+	struct qrt_merge_item *items;	/**< Leaf tables to merge */
+	size_t count;				/**< Amount of tables to merge */
+	pslist_t *tables;			/**< Referenced tables, once detached */
+	uchar *arena;				/**< Merging arena (not compacted) */
+	int slots;					/**< Amount of slots in merging arena */
+	uint8 queued;				/**< Whether job is in the ready queue */
+	uint8 active;				/**< Whether job is being processed */
+	uint8 last;					/**< Whether all messages were queued */
+	uint8 finished;				/**< Whether processing is over */
+	uint8 failed;				/**< Whether an error was recorded */
+	uint8 cancelled;			/**< Whether result is no longer wanted */
+	uint8 dispatched;			/**< Whether job was dispatched */
+};
+
+static inline void
+qrt_job_check(const struct qrt_job * const job)
+{
+	g_assert(job != NULL);
+	g_assert(QRT_JOB_MAGIC == job->magic);
+}
+
+/**
+ * The pool of worker threads.
+ *
+ * The queues and the job states are protected by the pool lock.  The list
+ * of jobs and the merging count are only handled by the main thread.
+ */
+static struct qrt_pool {
+	mutex_t lock;				/**< Thread-safe lock for the pool */
+	cond_t work;				/**< Signalled when a job is ready */
+	cond_t done;				/**< Signalled when a job is finished */
+	eslist_t ready;				/**< Jobs with work to process, FIFO */
+	eslist_t completed;			/**< Finished jobs, FIFO */
+	pslist_t *jobs;				/**< Jobs not dispatched yet, by creation */
+	unsigned running;			/**< Amount of worker threads running */
+	unsigned merging;			/**< Amount of merging jobs */
+	uint8 exiting;				/**< Set when workers must terminate */
+	uint8 posted;				/**< Whether dispatching event was posted */
+} qrt_pool = {
+	MUTEX_INIT,
+	COND_INIT,
+	COND_INIT,
+	ESLIST_INIT(offsetof(struct qrt_job, lk)),
+	ESLIST_INIT(offsetof(struct qrt_job, lk)),
+	NULL,
+	0,
+	0,
+	FALSE,
+	FALSE,
+};
+
+#define QRT_POOL_LOCK		mutex_lock(&qrt_pool.lock)
+#define QRT_POOL_UNLOCK		mutex_unlock(&qrt_pool.lock)
+
+#define assert_qrt_pool_locked() \
+	assert_mutex_is_owned(&qrt_pool.lock)
+
+/**
+ * @return the targeted amount of worker threads.
+ */
+static unsigned
+qrt_pool_target(void)
+{
+	unsigned n = GNET_PROPERTY(qrp_workers);
+
+	/*
+	 * By default, use all the CPUs but the one running the main thread.
+	 */
+
+	if (0 == n) {
+		long cpus = getcpucount();
+		n = cpus > 1 ? cpus - 1 : 1;
+	}
+
+	return MIN(n, QRP_WORKER_MAX);
+}
+
+/**
+ * Free queued PATCH message.
+ */
+static void
+qrt_job_msg_free(struct qrt_job_msg *m)
+{
+	HFREE_NULL(m->patch.data);
+	WFREE(m);
+}
+
+/**
+ * Free job, once dispatched and no longer fed by a receiving state.
+ */
+static void
+qrt_job_free(struct qrt_job *job)
+{
+	struct qrt_job_msg *m;
+	pslist_t *sl;
+
+	qrt_job_check(job);
+	g_assert(job->dispatched);
+	g_assert(NULL == job->owner);
+
+	while (NULL != (m = eslist_shift(&job->msgs)))
+		qrt_job_msg_free(m);
+
+	if (QRT_JOB_PATCH == job->kind) {
+		struct qrt_receive *rcv = &job->rcv;
+
+		(void) inflateEnd(rcv->inz);
+		WFREE(rcv->inz);
+		wfree(rcv->expansion, rcv->shrink_factor);
+		HFREE_NULL(rcv->data);
+		HFREE_NULL(rcv->table->arena);
+		rcv->table->magic = 0;
+		WFREE(rcv->table);
+		qrt_unref(job->table);
+	} else {
+		PSLIST_FOREACH(job->tables, sl) {
+			qrt_unref(sl->data);
+		}
+		pslist_free_null(&job->tables);
+		HFREE_NULL(job->items);
+		HFREE_NULL(job->arena);
+	}
+
+	job->magic = 0;
+	WFREE(job);
+}
+
+/**
+ * Put job in the ready queue, unless it is already queued, processed or
+ * finished.
+ */
+static void
+qrt_pool_schedule(struct qrt_job *job)
+{
+	assert_qrt_pool_locked();
+
+	if (job->queued || job->active || job->finished)
+		return;
+
+	job->queued = TRUE;
+	eslist_append(&qrt_pool.ready, job);
+	cond_signal(&qrt_pool.work, &qrt_pool.lock);
+}
+
+/**
+ * Record that the processing of the job is over.
+ *
+ * @return whether the dispatching event must be posted to the main thread,
+ * once the pool is unlocked.
+ */
+static bool
+qrt_pool_finished(struct qrt_job *job)
+{
+	assert_qrt_pool_locked();
+	g_assert(!job->queued && !job->active && !job->finished);
+
+	job->finished = TRUE;
+	eslist_append(&qrt_pool.completed, job);
+	cond_broadcast(&qrt_pool.done, &qrt_pool.lock);
+
+	if (qrt_pool.posted)
+		return FALSE;
+
+	return qrt_pool.posted = TRUE;
+}
+
+/**
+ * Apply the queued PATCH messages of the job.
+ *
+ * Called and returns with the pool locked.
+ *
+ * @return whether the processing of the job is over.
+ */
+static bool
+qrt_job_patch(struct qrt_job *job)
+{
+	struct qrt_job_msg *m;
+
+	assert_qrt_pool_locked();
+
+	while (
+		!job->cancelled && !job->failed &&
+		NULL != (m = eslist_shift(&job->msgs))
+	) {
+		bool ok;
+
+		QRT_POOL_UNLOCK;
+		ok = qrt_patch_process(&job->rcv, &m->patch);
+		qrt_job_msg_free(m);
+		QRT_POOL_LOCK;
+
+		if (!ok)
+			job->failed = TRUE;
+	}
+
+	return job->cancelled || job->failed || job->last;
+}
+
+/**
+ * Merge the leaf tables of the job.
+ *
+ * Called and returns with the pool locked.
+ *
+ * @return TRUE, the processing of the job being over.
+ */
+static bool
+qrt_job_merge(struct qrt_job *job)
+{
+	size_t i;
+
+	assert_qrt_pool_locked();
+
+	QRT_POOL_UNLOCK;
+
+	for (i = 0; i < job->count; i++) {
+		const struct qrt_merge_item *item = &job->items[i];
+
+		merge_table_into_arena(item->arena, item->slots,
+			job->arena, job->slots);
+	}
+
+	QRT_POOL_LOCK;
+
+	return TRUE;
+}
+
+static void qrt_pool_dispatch_event(void *unused_arg);
+static void qrt_receive_resume(gnutella_node_t *n);
+
+/**
+ * Worker thread main loop.
+ */
+static void *
+qrt_worker_main(void *p)
+{
+	thread_set_name_atom(str_smsg("QRP worker #%u", pointer_to_uint(p)));
+
+	QRT_POOL_LOCK;
+
+	/*
+	 * Process jobs until the pool is shut down or resized below the
+	 * amount of running threads.
+	 */
+
+	while (!qrt_pool.exiting && qrt_pool.running <= qrt_pool_target()) {
+		struct qrt_job *job;
+		bool over;
+
+		job = eslist_shift(&qrt_pool.ready);
+
+		if (NULL == job) {
+			cond_wait(&qrt_pool.work, &qrt_pool.lock);
+			continue;
+		}
+
+		job->queued = FALSE;
+		job->active = TRUE;
+
+		over = QRT_JOB_MERGE == job->kind ?
+			qrt_job_merge(job) : qrt_job_patch(job);
+
+		job->active = FALSE;
+
+		if (over && qrt_pool_finished(job)) {
+			QRT_POOL_UNLOCK;
+			teq_safe_post(THREAD_MAIN_ID, qrt_pool_dispatch_event, NULL);
+			QRT_POOL_LOCK;
+		}
+	}
+
+	qrt_pool.running--;
+	cond_signal(&qrt_pool.work, &qrt_pool.lock);	/* Pass wake-up along */
+	QRT_POOL_UNLOCK;
+
+	return NULL;
+}
+
+/**
+ * Make sure we have as many workers running as configured.
+ *
+ * @return whether received tables can be processed by the worker threads.
+ */
+static bool
+qrt_pool_enabled(void)
+{
+	unsigned target, first, n = 0;
+	bool enabled;
+
+	if (!GNET_PROPERTY(qrp_async_processing) || qrt_pool.exiting)
+		return FALSE;
+
+	target = qrt_pool_target();
+
+	QRT_POOL_LOCK;
+
+	first = qrt_pool.running;
+	if (qrt_pool.running < target) {
+		n = target - qrt_pool.running;
+		qrt_pool.running = target;
+	}
+
+	QRT_POOL_UNLOCK;
+
+	/*
+	 * The worker threads are created as detached threads because we
+	 * do not expect any result from them.  To end them, we flag the pool
+	 * as exiting and wake them up.
+	 */
+
+	while (n-- != 0) {
+		int r = thread_create(qrt_worker_main, uint_to_pointer(first++),
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_NO_POOL,
+			THREAD_STACK_MIN);
+
+		if G_UNLIKELY(-1 == r) {
+			g_warning("%s(): cannot create QRP worker thread: %m", G_STRFUNC);
+			QRT_POOL_LOCK;
+			qrt_pool.running--;
+			QRT_POOL_UNLOCK;
+		}
+	}
+
+	QRT_POOL_LOCK;
+	enabled = qrt_pool.running != 0;
+	QRT_POOL_UNLOCK;
+
+	return enabled;
+}
+
+/**
+ * Create a job to process the PATCH sequence being received in the worker
+ * threads.
+ *
+ * The job patches a private copy of the table, which will supersede the
+ * table being patched once the whole sequence was processed.
+ *
+ * @return the new job, NULL if the patch must be processed synchronously.
+ */
+static struct qrt_job *
+qrt_job_make(struct qrt_receive *qrcv)
+{
+	struct routing_table *rt = qrcv->table, *shadow;
+	struct qrt_receive *rcv;
+	struct qrt_job *job;
+	size_t size = rt->slots / 8;
+	z_streamp inz;
+
+	g_assert(NULL == qrcv->job);
+
+	if (0 == size || !qrt_pool_enabled())
+		return NULL;
+
+	WALLOC(inz);
+	inz->zalloc = zlib_alloc_func;
+	inz->zfree = zlib_free_func;
+	inz->opaque = NULL;
+
+	if G_UNLIKELY(inflateInit(inz) != Z_OK) {
+		WFREE(inz);
+		return NULL;
+	}
+
+	WALLOC0(shadow);
+	shadow->magic = QRP_ROUTE_MAGIC;
+	shadow->refcnt = 1;
+	shadow->slots = rt->slots;
+	shadow->bits = rt->bits;
+	shadow->infinity = rt->infinity;
+	shadow->client_slots = rt->client_slots;
+	shadow->compacted = TRUE;
+	shadow->member = -1;		/* Never part of the slot index */
+	shadow->arena = rt->reset ? halloc0(size) : hcopy(rt->arena, size);
+
+	WALLOC0(job);
+	job->magic = QRT_JOB_MAGIC;
+	job->kind = QRT_JOB_PATCH;
+	job->node = qrcv->node;
+	job->table = qrt_ref(rt);
+	job->owner = qrcv;
+	eslist_init(&job->msgs, offsetof(struct qrt_job_msg, lk));
+
+	rcv = &job->rcv;
+	*rcv = *qrcv;
+	rcv->node = NULL;			/* Workers must not access the node */
+	rcv->table = shadow;
+	rcv->inz = inz;
+	rcv->data = halloc(rcv->len);
+	rcv->expansion = walloc(rcv->shrink_factor);
+	rcv->job = NULL;
+	rcv->error_code = 0;
+	eslist_init(&rcv->deferred, offsetof(struct qrt_deferred, lk));
+
+	qrcv->job = job;
+	qrt_pool.jobs = pslist_append(qrt_pool.jobs, job);
+
+	return job;
+}
+
+/**
+ * Queue PATCH message for processing by the job.
+ */
+static void
+qrt_job_submit(struct qrt_job *job, const struct qrp_patch *patch)
+{
+	struct qrt_job_msg *m;
+
+	qrt_job_check(job);
+
+	WALLOC(m);
+	m->patch = *patch;
+	m->patch.data = 0 == patch->len ? NULL : hcopy(patch->data, patch->len);
+
+	QRT_POOL_LOCK;
+
+	job->last = patch->seq_no == job->rcv.seqsize;
+
+	/*
+	 * Messages received after an error are ignored: the node is going
+	 * to be BYE-ed when the job is dispatched.
+	 */
+
+	if (!job->finished) {
+		eslist_append(&job->msgs, m);
+		m = NULL;
+		qrt_pool_schedule(job);
+	}
+
+	QRT_POOL_UNLOCK;
+
+	if (m != NULL)
+		qrt_job_msg_free(m);
+}
+
+/**
+ * Cancel job, whose result is no longer wanted.
+ */
+static void
+qrt_job_cancel(struct qrt_job *job)
+{
+	bool post = FALSE;
+
+	qrt_job_check(job);
+
+	QRT_POOL_LOCK;
+
+	job->cancelled = TRUE;
+
+	/*
+	 * A job waiting for more messages is not going to be processed again.
+	 */
+
+	if (!job->queued && !job->active && !job->finished)
+		post = qrt_pool_finished(job);
+
+	QRT_POOL_UNLOCK;
+
+	if (post)
+		teq_safe_post(THREAD_MAIN_ID, qrt_pool_dispatch_event, NULL);
+}
+
+/**
+ * Detach the job from the receiving state feeding it with messages.
+ *
+ * If the PATCH sequence was not fully received, the job is cancelled.
+ */
+static void
+qrt_job_release(struct qrt_receive *qrcv)
+{
+	struct qrt_job *job = qrcv->job;
+
+	qrt_job_check(job);
+	g_assert(job->owner == qrcv);
+
+	qrcv->job = NULL;
+	job->owner = NULL;
+
+	if (!job->last)
+		qrt_job_cancel(job);
+
+	if (job->dispatched)
+		qrt_job_free(job);
+}
+
+/**
+ * Install the table patched by the job in the node.
+ */
+static void
+qrt_job_install(struct qrt_job *job)
+{
+	gnutella_node_t *n = job->node;
+	struct routing_table *rt = job->table, *shadow = job->rcv.table;
+	uint8 *old;
+
+	g_assert(rt->slots == shadow->slots);
+
+	/*
+	 * A new table, after a RESET, is not referenced by anything else, so
+	 * we can simply switch its arena.  Otherwise, the current table may be
+	 * read by a merging in progress: we create a new table object which
+	 * supersedes the current one in the node and becomes the member of
+	 * the slot index.
+	 */
+
+	if (rt->reset) {
+		if G_UNLIKELY(n->recv_query_table != NULL)
+			return;
+
+		old = rt->arena;
+		rt->arena = shadow->arena;
+	} else {
+		struct routing_table *nrt;
+
+		if G_UNLIKELY(n->recv_query_table != rt)
+			return;
+
+		WALLOC(nrt);
+		*nrt = *rt;
+		nrt->refcnt = 0;
+		nrt->name = h_strdup(rt->name);
+		nrt->digest = NULL;
+		nrt->arena = shadow->arena;
+		rt->member = -1;
+		rt->fold = NULL;
+
+		gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
+			GNET_PROPERTY(qrp_memory) + rt->slots / 8);
+
+		old = rt->arena;
+		rt = nrt;
+	}
+
+	shadow->arena = NULL;
+	rt->set_count = shadow->set_count;
+	qrt_index_replace(rt, old);
+
+	if (rt == job->table)
+		hfree(old);			/* Arena was switched */
+
+	qrt_dynamic_bind(rt);
+	qrt_patch_finish(n, rt, &job->rcv);
+}
+
+/**
+ * Dispatch finished job from the main thread.
+ */
+static void
+qrt_job_dispatch(struct qrt_job *job)
+{
+	gnutella_node_t *resume = NULL;
+
+	qrt_job_check(job);
+	g_assert(thread_is_main());
+	g_assert(job->finished);
+	g_assert(!job->dispatched);
+
+	qrt_pool.jobs = pslist_remove(qrt_pool.jobs, job);
+
+	if (QRT_JOB_MERGE == job->kind) {
+		struct merge_context *ctx = job->ctx;
+
+		g_assert(qrt_pool.merging != 0);
+
+		qrt_pool.merging--;
+
+		if (ctx != NULL) {
+			g_assert(ctx->job == job);
+
+			ctx->job = NULL;
+			ctx->arena = job->arena;
+			ctx->merged = TRUE;
+			job->arena = NULL;
+			bg_task_wakeup(job->task);
+		}
+		bg_task_unref(job->task);
+	} else if (job->node != NULL && !job->cancelled) {
+		if (job->failed) {
+			qrt_receive_report(job->node, &job->rcv);
+		} else {
+			qrt_job_install(job);
+			resume = job->node;
+		}
+	}
+
+	/*
+	 * Reporting an error can remove the node, releasing the job: we only
+	 * flag the job as dispatched now so that it is not freed too early.
+	 */
+
+	job->dispatched = TRUE;
+
+	if (NULL == job->owner)
+		qrt_job_free(job);
+
+	/*
+	 * Now that the table is installed, process the messages the node
+	 * sent meanwhile.
+	 */
+
+	if (resume != NULL)
+		qrt_receive_resume(resume);
+}
+
+/**
+ * Dispatch all the finished jobs.
+ */
+static void
+qrt_pool_dispatch(void)
+{
+	for (;;) {
+		struct qrt_job *job;
+
+		QRT_POOL_LOCK;
+		job = eslist_shift(&qrt_pool.completed);
+		if (NULL == job)
+			qrt_pool.posted = FALSE;
+		QRT_POOL_UNLOCK;
+
+		if (NULL == job)
+			break;
+
+		qrt_job_dispatch(job);
+	}
+}
+
+/**
+ * Event posted by the worker threads to the main thread to dispatch the
+ * finished jobs.
+ */
+static void
+qrt_pool_dispatch_event(void *unused_arg)
+{
+	(void) unused_arg;
+
+	qrt_pool_dispatch();
+}
+
+/**
+ * Is a table sent by the node still being processed by the worker threads?
+ *
+ * Messages received from the node meanwhile must be deferred until that
+ * table is installed, so that tables are installed in sequence.
+ */
+static bool
+qrt_node_pending(const gnutella_node_t *n)
+{
+	const pslist_t *sl;
+
+	g_assert(thread_is_main());
+
+	PSLIST_FOREACH(qrt_pool.jobs, sl) {
+		const struct qrt_job *job = sl->data;
+
+		if (job->node == n && NULL == job->owner && !job->cancelled)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Cancel the processing of the tables sent by the node, which is removed.
+ */
+void
+qrt_patch_cancel(const gnutella_node_t *n)
+{
+	const pslist_t *sl;
+
+	PSLIST_FOREACH(qrt_pool.jobs, sl) {
+		struct qrt_job *job = sl->data;
+
+		if (job->node == n) {
+			job->node = NULL;
+			qrt_job_cancel(job);
+		}
+	}
+}
+
+/**
+ * Hand the merging of the leaf tables over to the worker threads.
+ *
+ * The task will be woken up when the merging is done.
+ */
+static void
+qrt_merge_submit(struct merge_context *ctx, struct bgtask *bt)
+{
+	struct qrt_job *job;
+	const pslist_t *sl;
+	size_t n = 0;
+
+	g_assert(NULL == ctx->job);
+	g_assert(ctx->tables != NULL);
+
+	WALLOC0(job);
+	job->magic = QRT_JOB_MAGIC;
+	job->kind = QRT_JOB_MERGE;
+	job->ctx = ctx;
+	job->task = bg_task_ref(bt);
+	eslist_init(&job->msgs, offsetof(struct qrt_job_msg, lk));
+	HALLOC_ARRAY(job->items, pslist_length(ctx->tables));
+
+	/*
+	 * If we're the only referer to a table, it means the node is dead and
+	 * therefore this table should be skipped.
+	 */
+
+	PSLIST_FOREACH(ctx->tables, sl) {
+		const struct routing_table *rt = sl->data;
+
+		if (rt->refcnt > 1) {
+			g_assert(rt->compacted);
+
+			job->items[n].arena = rt->arena;
+			job->items[n].slots = rt->slots;
+			n++;
+		}
+	}
+
+	job->count = n;
+	job->arena = ctx->arena;
+	job->slots = ctx->slots;
+	ctx->arena = NULL;
+	ctx->job = job;
+
+	qrt_pool.merging++;
+	qrt_pool.jobs = pslist_append(qrt_pool.jobs, job);
+
+	QRT_POOL_LOCK;
+	qrt_pool_schedule(job);
+	QRT_POOL_UNLOCK;
+}
+
+/**
+ * Detach the merging context from its job, which keeps the tables merged
+ * by the worker threads referenced until it is dispatched.
+ */
+static void
+qrt_merge_detach(struct merge_context *ctx)
+{
+	struct qrt_job *job = ctx->job;
+
+	qrt_job_check(job);
+	g_assert(job->ctx == ctx);
+
+	job->ctx = NULL;
+	job->tables = ctx->tables;
+	ctx->tables = NULL;
+	ctx->job = NULL;
+}
+
+/**
+ * Shutdown the pool of worker threads, cancelling all the jobs.
+ */
+static void
+qrt_pool_close(void)
+{
+	struct qrt_job *job;
+	const pslist_t *sl;
+
+	QRT_POOL_LOCK;
+
+	qrt_pool.exiting = TRUE;
+	cond_broadcast(&qrt_pool.work, &qrt_pool.lock);
+
+	while (NULL != (job = eslist_shift(&qrt_pool.ready))) {
+		job->queued = FALSE;
+		job->cancelled = TRUE;
+		(void) qrt_pool_finished(job);
+	}
+
+	/*
+	 * Wait for the jobs being processed, finishing the idle ones.
+	 */
+
+	for (;;) {
+		bool busy = FALSE;
+
+		PSLIST_FOREACH(qrt_pool.jobs, sl) {
+			job = sl->data;
+			job->cancelled = TRUE;
+
+			if (job->active)
+				busy = TRUE;
+			else if (!job->finished)
+				(void) qrt_pool_finished(job);
+		}
+
+		if (!busy)
+			break;
+
+		cond_wait(&qrt_pool.done, &qrt_pool.lock);
+	}
+
+	QRT_POOL_UNLOCK;
+
+	PSLIST_FOREACH(qrt_pool.jobs, sl) {
+		job = sl->data;
+
+		if (job->ctx != NULL)
+			qrt_merge_detach(job->ctx);
+	}
+
+	qrt_pool_dispatch();
+}
+
+/**
+ * Handle reception of QRP RESET.
+ *
+ * @returns TRUE if we handled the message correctly, FALSE if an error
+ * was found and the node BYE-ed.
+ */
+static bool
+qrt_handle_reset(
+	gnutella_node_t *n, struct qrt_receive *qrcv, struct qrp_reset *reset)
+{
+	struct routing_table *rt;
+	int ret;
+	int slots;
+	int old_generation = -1;
+
+	ret = inflateReset(qrcv->inz);
+	if G_UNLIKELY(ret != Z_OK) {
+		g_warning("unable to reset QRP decompressor for %s: %s",
+			node_infostr(n), zlib_strerror(ret));
+		node_bye_if_writable(n, 500, "Error resetting QRP inflater: %s",
+			zlib_strerror(ret));
+		return FALSE;
+	}
 
 	/*
 	 * If the advertized table size is not a power of two, good bye.
@@ -4558,6 +5954,9 @@ qrt_handle_reset(
 	 * the table's size exceeds our maximum size.
 	 */
 
+	if (qrcv->job != NULL)
+		qrt_job_release(qrcv);		/* Sequence interrupted */
+
 	node_qrt_discard(n);
 
 	if (qrcv->table) {
@@ -4578,6 +5977,8 @@ qrt_handle_reset(
 	rt->compacted = TRUE;		/* We'll compact it on the fly */
 	rt->digest = NULL;
 	rt->reset = TRUE;
+	rt->fold = NULL;
+	rt->member = -1;
 
 	qrcv->table = rt;
 	qrcv->shrink_factor = 1;		/* Assume none for now */
@@ -4621,6 +6022,8 @@ qrt_handle_reset(
 	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
 		GNET_PROPERTY(qrp_memory) + slots);
 
+	qrt_index_add(rt);
+
 	/*
 	 * We're now ready to handle PATCH messages.
 	 */
@@ -4679,11 +6082,8 @@ qrt_handle_patch(
 		qrcv->deflated = patch->compressor == 0x1;
 		qrcv->entry_bits = patch->entry_bits;
 		qrcv->current_index = qrcv->current_slot = 0;
-		qrcv->table->set_count = 0;
 		qrcv->patch = qrt_apply_patch; /* Default handler. */
 
-		qrt_dynamic_bind(qrcv->table);	/* Reset initial `can_route' */
-
 		switch (qrcv->entry_bits) {
 		case 8:
 			if (1 == qrcv->shrink_factor)
@@ -4734,6 +6134,16 @@ qrt_handle_patch(
 				qrcv->entry_bits);
 			return FALSE;
 		}
+
+		/*
+		 * The sequence is applied either to the table directly, or to
+		 * a private copy of it by the worker threads.
+		 */
+
+		if (NULL == qrt_job_make(qrcv)) {
+			qrcv->table->set_count = 0;
+			qrt_dynamic_bind(qrcv->table);	/* Reset initial `can_route' */
+		}
 	} else if G_UNLIKELY(patch->seq_size != qrcv->seqsize) {
 		g_warning("%s changed QRP seqsize to %u at message #%d "
 			"(started with %u)",
@@ -4764,10 +6174,27 @@ qrt_handle_patch(
 	qrcv->seqno++;
 
 	/*
-	 * Attempt to relocate the table if it is a standalone memory fragment.
+	 * When processed by the worker threads, the table will be installed
+	 * once the whole sequence has been applied.
 	 */
 
-	{
+	if (qrcv->job != NULL) {
+		qrt_job_submit(qrcv->job, patch);
+
+		if (qrcv->seqno > qrcv->seqsize) {
+			qrt_job_release(qrcv);
+			*done = TRUE;
+		}
+
+		return TRUE;
+	}
+
+	/*
+	 * Attempt to relocate the table if it is a standalone memory fragment,
+	 * unless the worker threads could be reading it to merge it.
+	 */
+
+	if (0 == qrt_pool.merging) {
 		struct routing_table *rt = qrcv->table;
 
 		qrt_check(rt);
@@ -4780,162 +6207,53 @@ qrt_handle_patch(
 	 * Process the patch data.
 	 */
 
-	if (qrcv->deflated) {
-		z_streamp inz = qrcv->inz;
-		int ret;
-		bool seen_end = FALSE;
-
-		inz->next_in = patch->data;
-		inz->avail_in = patch->len;
-
-		while (!seen_end && inz->avail_in > 0) {
-			inz->next_out = cast_to_pointer(qrcv->data);
-			inz->avail_out = qrcv->len;
-
-			ret = inflate(inz, Z_SYNC_FLUSH);
-
-			if (ret == Z_STREAM_END && qrcv->seqno > qrcv->seqsize) {
-				seen_end = TRUE;
-				ret = Z_OK;
-			}
-
-			if G_UNLIKELY(ret != Z_OK) {
-				g_warning("decompression of QRP patch #%u/%u failed for %s: %s",
-					(uint) patch->seq_no, (uint) patch->seq_size,
-					node_infostr(n), zlib_strerror(ret));
-				node_bye_if_writable(n, 413,
-					"QRP patch #%u/%u decompression failed: %s",
-					(uint) patch->seq_no, (uint) patch->seq_size,
-					zlib_strerror(ret));
-				return FALSE;
-			}
-
-			if (
-				!qrcv->patch(qrcv, (uchar *) qrcv->data,
-					qrcv->len - inz->avail_out, patch)
-			)
-				return FALSE;
-		}
-
-		/*
-		 * If we reached the end of the stream, make sure we were at
-		 * the last patch of the sequence.
-		 */
-
-		if G_UNLIKELY(seen_end && qrcv->seqno <= qrcv->seqsize) {
-			g_warning("saw end of compressed QRP patch at #%u/%u for %s",
-				(uint) patch->seq_no, (uint) patch->seq_size,
-				node_infostr(n));
-			node_bye_if_writable(n, 413,
-				"Early end of compressed QRP patch at #%u/%u",
-				(uint) patch->seq_no, (uint) patch->seq_size);
-			return FALSE;
-		}
-	} else if (!qrcv->patch(qrcv, patch->data, patch->len, patch))
+	if (!qrt_patch_process(qrcv, patch)) {
+		qrt_receive_report(n, qrcv);
 		return FALSE;
+	}
 
 	/*
 	 * Was the PATCH sequence fully processed?
 	 */
 
 	if (qrcv->seqno > qrcv->seqsize) {
-		struct routing_table *rt = qrcv->table;
-
 		*done = TRUE;
+		qrt_patch_finish(n, qrcv->table, qrcv);
+	}
 
-		/*
-		 * Make sure the servent sent us a patch that covers the whole table.
-		 * We've reached the end of the patch sequence, but that does not
-		 * necessarily means it applied to all the slots.
-		 */
-
-		if G_UNLIKELY(qrcv->current_index < rt->slots) {
-			g_warning("QRP %d-bit patch from %s covered only %d/%d slots",
-				qrcv->entry_bits, node_infostr(n),
-				qrcv->current_index, rt->slots);
-			node_bye_if_writable(n, 413,
-				"Incomplete %d-bit QRP patch covered %d/%d slots",
-				qrcv->entry_bits, qrcv->current_index, rt->slots);
-			return FALSE;
-		}
-
-		g_assert(qrcv->current_index == rt->slots);
-		atom_sha1_free_null(&rt->digest);
-
-		if (qrp_debugging(2))
-			rt->digest = atom_sha1_get(qrt_sha1(rt));
-
-		rt->fill_ratio = (int) (100.0 * rt->set_count / rt->slots);
-
-		/*
-		 * If table is more than 5% full, each query will go through a
-		 * random d100 throw, and will pass only if the score is below
-		 * the value of the pass throw threshold.
-		 *
-		 * The function below quickly drops and then flattens:
-		 *
-		 *   x =  6%  -> throw = 84
-		 *   x =  7%  -> throw = 79
-		 *   x =  8%  -> throw = 75
-		 *   x = 10%  -> throw = 69
-		 *   x = 20%  -> throw = 53
-		 *   x = 50%  -> throw = 27
-		 *   x = 90%  -> throw = 6
-		 *   x = 99%  -> throw = 2
-		 *
-		 * throw = 100 * (1 - (x - 0.05)^1/2.5)
-		 *
-		 * Function was adjusted to cut at 5% now instead of 1% since we
-		 * now filter SHA1 queries via the QRP, so leaf traffic is far
-		 * diminished.
-		 *		--RAM, 03/01/2004
-		 */
-
-		if (rt->fill_ratio > 5)
-			rt->pass_throw = (int)
-				(100.0 * (1 - pow((rt->fill_ratio - 5) / 100.0, 1/2.5)));
-		else
-			rt->pass_throw = 100;		/* Always forward if QRT says so */
+	return TRUE;
+}
 
-		if (qrp_debugging(2)) {
-			g_debug("QRP got whole %d-bit patch "
-				"(gen=%d, slots=%d (*%d), fill=%d%%, throw=%d) "
-				"from %s: SHA1=%s",
-				qrcv->entry_bits, rt->generation, rt->slots,
-				qrcv->shrink_factor, rt->fill_ratio, rt->pass_throw,
-				node_infostr(n),
-				rt->digest ? sha1_base32(rt->digest) : "<not computed>");
-		}
+/**
+ * Defer processing of the QRP message until the previous table sent by the
+ * node is installed.
+ */
+static void
+qrt_receive_defer(struct qrt_receive *qrcv, uint8 type,
+	const struct qrp_reset *reset, const struct qrp_patch *patch)
+{
+	struct qrt_deferred *m;
 
-		/*
-		 * If table is empty, supersede the routing entries.
-		 */
+	g_assert(qrcv->waiting);
 
-		if (qrt_is_empty(rt)) {
-			rt->is_empty = TRUE;
-			qrt_dynamic_bind_empty(rt);
-		} else {
-			rt->is_empty = FALSE;
-		}
+	WALLOC0(m);
+	m->type = type;
 
-		/*
-		 * Install the table in the node, if it was a new table.
-		 * Otherwise, we only finished patching it.
-		 */
+	if (reset != NULL)
+		m->reset = *reset;
 
-		if (rt->reset)
-			node_qrt_install(n, rt);
-		else
-			node_qrt_patched(n, rt);
+	if (patch != NULL) {
+		m->patch = *patch;
+		m->patch.data = 0 == patch->len ? NULL : hcopy(patch->data, patch->len);
+	}
 
-		if (NODE_IS_LEAF(n))
-			qrp_leaf_changed();
+	eslist_append(&qrcv->deferred, m);
 
-		if (qrp_debugging(4))
-			(void) qrt_dump(rt, GNET_PROPERTY(qrp_debug) > 19);
+	if (qrp_debugging(1)) {
+		g_debug("QRP deferring %s #%zu from %s, previous table pending",
+			GTA_MSGV_QRP_RESET == type ? "RESET" : "PATCH",
+			eslist_count(&qrcv->deferred), node_infostr(qrcv->node));
 	}
-
-	return TRUE;
 }
 
 /**
@@ -4968,6 +6286,11 @@ qrt_receive_next(struct qrt_receive *qrcv, bool *done)
 			if (!qrp_recv_reset(n, &reset))
 				goto dropped;
 
+			if (qrcv->waiting) {
+				qrt_receive_defer(qrcv, type, &reset, NULL);
+				return TRUE;
+			}
+
 			return qrt_handle_reset(n, qrcv, &reset);
 		}
 		break;
@@ -4978,6 +6301,11 @@ qrt_receive_next(struct qrt_receive *qrcv, bool *done)
 			if (!qrp_recv_patch(n, &patch))
 				goto dropped;
 
+			if (qrcv->waiting) {
+				qrt_receive_defer(qrcv, type, NULL, &patch);
+				return TRUE;
+			}
+
 			return qrt_handle_patch(n, qrcv, &patch, done);
 		}
 		break;
@@ -4990,6 +6318,68 @@ dropped:
 	return TRUE;		/* Everything is fine, even if we dropped message */
 }
 
+/**
+ * Process the QRP messages received from the node whilst the previous table
+ * it sent was processed by the worker threads, now that it is installed.
+ */
+static void
+qrt_receive_resume(gnutella_node_t *n)
+{
+	struct qrt_receive *qrcv = n->qrt_receive;
+	struct qrt_deferred *m;
+
+	g_assert(thread_is_main());
+
+	if (NULL == qrcv || !qrcv->waiting || qrt_node_pending(n))
+		return;
+
+	qrt_receive_bind(qrcv, n->recv_query_table);
+
+	while (NULL != (m = eslist_shift(&qrcv->deferred))) {
+		struct qrt_receive *nrcv;
+		bool ok, done = FALSE;
+
+		if (GTA_MSGV_QRP_RESET == m->type)
+			ok = qrt_handle_reset(n, qrcv, &m->reset);
+		else
+			ok = qrt_handle_patch(n, qrcv, &m->patch, &done);
+
+		qrt_deferred_free(m);
+
+		if (!ok)
+			return;				/* Node BYE-ed */
+
+		if (!done)
+			continue;
+
+		/*
+		 * The sequence is complete: the next messages, if any, start a new
+		 * one, which must wait if this table is now processed by the worker
+		 * threads.
+		 */
+
+		if (0 == eslist_count(&qrcv->deferred)) {
+			node_qrt_received(n);
+			return;
+		}
+
+		nrcv = qrt_receive_create(n, n->recv_query_table);
+
+		if G_UNLIKELY(NULL == nrcv) {
+			node_qrt_received(n);
+			return;
+		}
+
+		eslist_append_list(&nrcv->deferred, &qrcv->deferred);
+		n->qrt_receive = nrcv;
+		qrt_receive_free(qrcv);
+		qrcv = nrcv;
+
+		if (qrcv->waiting)
+			return;
+	}
+}
+
 static bool qrt_leaf_change_notified = FALSE;
 
 /**
@@ -5071,6 +6461,7 @@ qrp_close(void)
 {
 	qrp_cancel_computation();
 	cq_periodic_remove(&qrp_monitor_ev);
+	qrt_pool_close();
 
 	if (routing_table)
 		qrt_unref(routing_table);
@@ -5083,6 +6474,7 @@ qrp_close(void)
 	if (merged_table)
 		qrt_unref(merged_table);
 
+	qrt_index_close();
 	HFREE_NULL(buffer.arena);
 }
 
@@ -5376,6 +6768,34 @@ qrp_node_can_route(const gnutella_node_t *n, const query_hashvec_t *qhv)
 	   rt->can_route(qhv, rt);
 }
 
+/**
+ * Check whether we can route a query to the node owning the routing table.
+ *
+ * @param rt		the routing table of the target node
+ * @param qhv		the query hash vector
+ * @param targets	tables matching the query in the slot index (NULL if none)
+ */
+static inline bool
+qrt_can_route(const struct routing_table *rt, const query_hashvec_t *qhv,
+	const uint64 *targets)
+{
+	/*
+	 * The slot index is exact unless the table was folded, in which case
+	 * it can only tell us whether the table cannot route the query.
+	 */
+
+	if (targets != NULL && rt->member != -1) {
+		if (!slotset_result_has(targets, rt->member))
+			return FALSE;
+		if (NULL == rt->fold)
+			return TRUE;
+	}
+
+	return qhv->has_urn ?
+		rt->can_route_urn(qhv, rt) :
+		rt->can_route(qhv, rt);
+}
+
 /**
  * Compute list of nodes to send the query to, based on node's QRT.
  * The query is identified by its list of QRP hashes, by its hop count, TTL
@@ -5403,6 +6823,7 @@ qrt_build_query_target(
 {
 	pslist_t *nodes = NULL;		/* Targets for the query */
 	const pslist_t *sl;
+	const uint64 *targets;
 	bool sha1_query;
 	bool whats_new;
 
@@ -5429,6 +6850,13 @@ qrt_build_query_target(
 
 	sha1_query = qhvec_has_urn(qhvec);
 
+	/*
+	 * Determine once and for all which of the received tables can route
+	 * the query, instead of probing each of them in turn.
+	 */
+
+	targets = whats_new ? NULL : qrt_index_match(qhvec);
+
 	/*
 	 * We need to special case processing of queries with TTL=1 so that they
 	 * get set to ultra peers that support last-hop QRP only if they can
@@ -5504,9 +6932,7 @@ qrt_build_query_target(
 
 		node_inc_qrp_query(dn);			/* We have a QRT, mark we try routing */
 
-		if (!(qhvec->has_urn ?
-			  rt->can_route_urn(qhvec, rt) :
-			  rt->can_route(qhvec, rt)))
+		if (!qrt_can_route(rt, qhvec, targets))
 			continue;
 
 		if (!is_leaf)
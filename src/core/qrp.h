@@ -92,6 +92,7 @@ struct qrt_receive *qrt_receive_create(struct gnutella_node *n,
 						struct routing_table *);
 void qrt_receive_free(struct qrt_receive *);
 bool qrt_receive_next(struct qrt_receive *, bool *done);
+void qrt_patch_cancel(const struct gnutella_node *n);
 
 struct routing_table *qrt_get_table(void);
 struct routing_table *qrt_ref(struct routing_table *);
@@ -58,6 +58,7 @@
 #include "sockets.h"
 #include "tx.h"					/* For tx_debug_set_addrs() */
 #include "udp.h"				/* For udp_received() */
+#include "udp_ingress.h"
 #include "upload_stats.h"
 
 #include "upnp/upnp.h"
@@ -1725,6 +1726,33 @@ get_bind_addr(enum net_type net)
 	return addr;
 }
 
+/**
+ * Have the Gnutella UDP socket read by the UDP ingress thread or by the
+ * main thread, depending on the "udp_ingress_thread" property.
+ */
+static void
+settings_udp_ingress(struct gnutella_socket *s)
+{
+	if (NULL == s)
+		return;
+
+	if (GNET_PROPERTY(udp_ingress_thread))
+		udp_ingress_attach(s);
+	else
+		udp_ingress_detach(s);
+}
+
+static bool
+udp_ingress_thread_changed(property_t prop)
+{
+	(void) prop;
+
+	settings_udp_ingress(s_udp_listen);
+	settings_udp_ingress(s_udp_listen6);
+
+	return FALSE;
+}
+
 static bool
 enable_udp_changed(property_t prop)
 {
@@ -1748,6 +1776,8 @@ enable_udp_changed(property_t prop)
 				gcu_statusbar_warning(_("Failed to create IPv6 UDP socket"));
 			}
 		}
+		settings_udp_ingress(s_udp_listen);
+		settings_udp_ingress(s_udp_listen6);
 	} else {
 		/* Also takes care of freeing s_udp_listen and s_udp_listen6 */
 		node_udp_disable();
@@ -2038,6 +2068,8 @@ request_new_sockets(uint16 port, bool check_firewalled)
 	}
 
 	if (GNET_PROPERTY(enable_udp)) {
+		settings_udp_ingress(s_udp_listen);
+		settings_udp_ingress(s_udp_listen6);
 		node_update_udp_socket();
 	}
 
@@ -2653,6 +2685,17 @@ inputevt_debug_changed(property_t prop)
     return FALSE;
 }
 
+static bool
+io_reactors_changed(property_t prop)
+{
+	uint32 val;
+
+	gnet_prop_get_guint32_val(prop, &val);
+	inputevt_set_reactors(val);
+
+    return FALSE;
+}
+
 static bool
 http_range_debug_changed(property_t prop)
 {
@@ -3248,6 +3291,11 @@ static prop_map_t property_map[] = {
         inputevt_debug_changed,
         TRUE
     },
+    {
+        PROP_IO_REACTORS,
+        io_reactors_changed,
+        TRUE
+    },
     {
         PROP_HTTP_RANGE_DEBUG,
         http_range_debug_changed,
@@ -3358,6 +3406,11 @@ static prop_map_t property_map[] = {
 		enable_udp_changed,
 		FALSE,				/* UDP socket inited via listen_port_changed() */
 	},
+	{
+		PROP_UDP_INGRESS_THREAD,
+		udp_ingress_thread_changed,
+		FALSE,				/* Handled when UDP sockets are created */
+	},
 	{
 		PROP_ENABLE_DHT,
 		enable_dht_changed,
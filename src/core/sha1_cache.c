@@ -0,0 +1,1185 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Persistent cache of SHA1 and TTH digests for shared files.
+ *
+ * The cache is made of two files in the configuration directory:
+ *
+ * - "sha1_cache.bin" is an immutable snapshot which is memory-mapped.  It
+ *   holds a fixed-size record per file, an open-addressing index hashing
+ *   the file names to records, and the NUL-terminated file names.  Looking
+ *   up a file only touches the pages holding the relevant index slots, the
+ *   record and the name, so nothing needs to be loaded at startup.
+ *
+ * - "sha1_cache.log" is an append-only journal where each digest computed
+ *   since the last snapshot is recorded.  It is replayed at startup into
+ *   a small in-core table which supersedes the snapshot.  Each journal
+ *   record is protected by a CRC32 so that a torn write after a crash is
+ *   detected and the journal truncated there.
+ *
+ * When the journal grows too large, or when too many snapshot entries refer
+ * to files that are no longer shared, the snapshot is rewritten (compacted)
+ * with the journaled entries merged in, and the journal is emptied.  The
+ * new snapshot is written aside and renamed over the old one, and since
+ * journal records are full upserts, replaying a journal over a snapshot
+ * which already includes its records is harmless.
+ *
+ * The former text "sha1_cache" file is imported once, when no snapshot
+ * exists yet.
+ *
+ * All multi-byte quantities are stored in little-endian order.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "sha1_cache.h"
+
+#include "settings.h"
+
+#include "lib/atoms.h"
+#include "lib/base32.h"
+#include "lib/bit_array.h"
+#include "lib/crc.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/hashing.h"
+#include "lib/hikset.h"
+#include "lib/hstrfn.h"
+#include "lib/parse.h"
+#include "lib/path.h"
+#include "lib/pow2.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/urn.h"
+#include "lib/vmm.h"
+#include "lib/walloc.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define SHA1_CACHE_TEXT		"sha1_cache"		/**< Legacy text format */
+#define SHA1_CACHE_BASE		"sha1_cache.bin"	/**< Memory-mapped snapshot */
+#define SHA1_CACHE_LOG		"sha1_cache.log"	/**< Journal */
+
+#define SHA1_CACHE_VERSION	1
+
+/*
+ * Snapshot header layout.
+ */
+#define SC_HDR_MAGIC		0		/**< 8 bytes: magic string */
+#define SC_HDR_VERSION		8		/**< uint32: format version */
+#define SC_HDR_RECSIZE		12		/**< uint32: record size */
+#define SC_HDR_COUNT		16		/**< uint32: amount of records */
+#define SC_HDR_SLOTS		20		/**< uint32: amount of index slots */
+#define SC_HDR_STRLEN		24		/**< uint64: size of the name area */
+#define SC_HDR_STAMP		32		/**< uint64: creation time */
+#define SC_HDR_SIZE			64		/**< Header size, with reserved space */
+
+/*
+ * Snapshot record layout.
+ */
+#define SC_REC_SIZE			0		/**< uint64: file size */
+#define SC_REC_MTIME		8		/**< uint64: modification time */
+#define SC_REC_NAME_OFF		16		/**< uint32: offset in name area */
+#define SC_REC_NAME_LEN		20		/**< uint16: name length, no NUL */
+#define SC_REC_FLAGS		22		/**< uint16: flags */
+#define SC_REC_SHA1			24		/**< SHA1_RAW_SIZE bytes */
+#define SC_REC_TTH			44		/**< TTH_RAW_SIZE bytes */
+#define SC_REC_HASH			68		/**< uint32: name hash */
+#define SC_REC_LEN			72		/**< Record size */
+
+/*
+ * Journal record layout.
+ */
+#define SC_LOG_CRC			0		/**< uint32: CRC32 of what follows */
+#define SC_LOG_NAME_LEN		4		/**< uint16: name length */
+#define SC_LOG_FLAGS		6		/**< uint16: flags */
+#define SC_LOG_SIZE			8		/**< uint64: file size */
+#define SC_LOG_MTIME		16		/**< uint64: modification time */
+#define SC_LOG_SHA1			24		/**< SHA1_RAW_SIZE bytes */
+#define SC_LOG_TTH			44		/**< TTH_RAW_SIZE bytes */
+#define SC_LOG_NAME			68		/**< Start of file name */
+#define SC_LOG_HDR_LEN		68		/**< Fixed part of journal records */
+
+#define SC_F_TTH			(1U << 0)	/**< TTH is present */
+
+#define SC_NAME_MAXLEN		MAX_INT_VAL(uint16)
+#define SC_SLOT_NONE		0			/**< Empty index slot */
+
+#define SC_JOURNAL_MIN		4096		/**< Min records before compaction */
+#define SC_COMPACT_DELAY	60			/**< Min secs between compactions */
+
+static const char sc_base_magic[8] = "GTKGSHC\n";
+static const char sc_log_magic[8]  = "GTKGSHJ\n";
+
+/**
+ * The memory-mapped snapshot.
+ */
+static struct sha1_cache_base {
+	const char *map;			/**< Start of mapped file */
+	size_t map_len;				/**< Length of mapping */
+	const char *index;			/**< Index slots (uint32 each) */
+	const char *records;		/**< Records */
+	const char *names;			/**< Name area */
+	size_t names_len;			/**< Length of name area */
+	uint32 count;				/**< Amount of records */
+	uint32 slots;				/**< Amount of index slots (power of 2) */
+	bit_array_t *shared;		/**< Records known to be shared */
+} sc_base;
+
+/**
+ * An in-core entry, superseding any snapshot entry for the same file.
+ */
+struct sha1_cache_entry {
+	const char *file_name;			/**< Full path name (atom) */
+	struct sha1_cache_info info;	/**< Cached hashes */
+	bool shared;					/**< Known to be shared */
+};
+
+static hikset_t *sc_overlay;		/**< Entries more recent than snapshot */
+static int sc_journal_fd = -1;		/**< Journal, opened for appending */
+static size_t sc_journal_records;	/**< Records in journal */
+static uint32 sc_superseded;		/**< Snapshot entries in overlay */
+static size_t sc_shared;			/**< Entries known to be shared */
+static time_t sc_compacted;			/**< Last compaction time */
+static time_t sc_started;			/**< When cache was initialized */
+
+/**
+ * Stable hashing of file names, used by the on-disk index.
+ */
+static inline uint32
+sha1_cache_hash(const char *name, size_t len)
+{
+	return universal_mix_hash(name, len);
+}
+
+/**
+ * @return amount of live entries in the cache.
+ */
+static size_t
+sha1_cache_count(void)
+{
+	return sc_base.count - sc_superseded + hikset_count(sc_overlay);
+}
+
+/**
+ * @return pointer to snapshot record `r'.
+ */
+static inline const char *
+sha1_cache_base_record(uint32 r)
+{
+	g_assert(r < sc_base.count);
+
+	return &sc_base.records[(size_t) r * SC_REC_LEN];
+}
+
+/**
+ * Get the name of snapshot record `r', making sure it lies within the
+ * name area.
+ *
+ * @return the NUL-terminated name, NULL if the record is corrupted.
+ */
+static const char *
+sha1_cache_base_name(uint32 r, size_t *lenptr)
+{
+	const char *rec = sha1_cache_base_record(r);
+	size_t off = peek_le32(&rec[SC_REC_NAME_OFF]);
+	size_t len = peek_le16(&rec[SC_REC_NAME_LEN]);
+
+	if G_UNLIKELY(
+		0 == len || off >= sc_base.names_len ||
+		len >= sc_base.names_len - off || '\0' != sc_base.names[off + len]
+	)
+		return NULL;
+
+	if (lenptr != NULL)
+		*lenptr = len;
+
+	return &sc_base.names[off];
+}
+
+/**
+ * Fill `info' from snapshot record `r'.
+ */
+static void
+sha1_cache_base_info(uint32 r, struct sha1_cache_info *info)
+{
+	const char *rec = sha1_cache_base_record(r);
+
+	info->size = peek_le64(&rec[SC_REC_SIZE]);
+	info->mtime = (time_t) (int64) peek_le64(&rec[SC_REC_MTIME]);
+	info->has_tth = booleanize(peek_le16(&rec[SC_REC_FLAGS]) & SC_F_TTH);
+	memcpy(info->sha1.data, &rec[SC_REC_SHA1], SHA1_RAW_SIZE);
+	if (info->has_tth)
+		memcpy(info->tth.data, &rec[SC_REC_TTH], TTH_RAW_SIZE);
+	else
+		ZERO(&info->tth);
+}
+
+/**
+ * Look for `name' in the snapshot.
+ *
+ * @return the record number, or (uint32) -1 if not found.
+ */
+static uint32
+sha1_cache_base_lookup(const char *name)
+{
+	uint32 h, i, n, mask;
+	size_t len;
+
+	if (0 == sc_base.count)
+		return (uint32) -1;
+
+	len = strlen(name);
+	h = sha1_cache_hash(name, len);
+	mask = sc_base.slots - 1;
+
+	for (i = h & mask, n = 0; n < sc_base.slots; i = (i + 1) & mask, n++) {
+		uint32 v = peek_le32(&sc_base.index[i * 4]);
+		const char *rec, *rname;
+		size_t rlen;
+
+		if (SC_SLOT_NONE == v)
+			break;
+
+		if G_UNLIKELY(v > sc_base.count)
+			continue;			/* Corrupted slot */
+
+		rec = sha1_cache_base_record(v - 1);
+		if (peek_le32(&rec[SC_REC_HASH]) != h)
+			continue;
+
+		rname = sha1_cache_base_name(v - 1, &rlen);
+		if (rname != NULL && rlen == len && 0 == memcmp(rname, name, len))
+			return v - 1;
+	}
+
+	return (uint32) -1;
+}
+
+/**
+ * Unmap the snapshot.
+ */
+static void
+sha1_cache_base_unmap(void)
+{
+	if (sc_base.map != NULL)
+		vmm_munmap(deconstify_pointer(sc_base.map), sc_base.map_len);
+
+	HFREE_NULL(sc_base.shared);
+
+	ZERO(&sc_base);
+}
+
+/**
+ * Map the snapshot file, checking its consistency.
+ *
+ * @return TRUE if the snapshot exists, even if it had to be ignored.
+ */
+static bool
+sha1_cache_base_map(void)
+{
+	char *path;
+	filestat_t sb;
+	const char *map = NULL;
+	uint32 count, slots;
+	uint64 names_len, expected;
+	int fd;
+
+	g_assert(NULL == sc_base.map);
+
+	path = make_pathname(settings_config_dir(), SHA1_CACHE_BASE);
+	fd = file_open_missing(path, O_RDONLY);
+
+	if (-1 == fd) {
+		HFREE_NULL(path);
+		return FALSE;
+	}
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat \"%s\": %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	if (sb.st_size < SC_HDR_SIZE || (fileoffset_t) sb.st_size != sb.st_size)
+		goto corrupted;
+
+	map = vmm_mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == map) {
+		g_warning("%s(): cannot mmap() \"%s\": %m", G_STRFUNC, path);
+		map = NULL;
+		goto done;
+	}
+
+	if (
+		0 != memcmp(&map[SC_HDR_MAGIC], sc_base_magic, sizeof sc_base_magic) ||
+		SHA1_CACHE_VERSION != peek_le32(&map[SC_HDR_VERSION]) ||
+		SC_REC_LEN != peek_le32(&map[SC_HDR_RECSIZE])
+	)
+		goto corrupted;
+
+	count = peek_le32(&map[SC_HDR_COUNT]);
+	slots = peek_le32(&map[SC_HDR_SLOTS]);
+	names_len = peek_le64(&map[SC_HDR_STRLEN]);
+
+	if (!is_pow2(slots) || slots <= count)
+		goto corrupted;
+
+	expected = SC_HDR_SIZE + (uint64) slots * 4 +
+		(uint64) count * SC_REC_LEN + names_len;
+
+	if (expected != (uint64) sb.st_size)
+		goto corrupted;
+
+	sc_base.map = map;
+	sc_base.map_len = sb.st_size;
+	sc_base.count = count;
+	sc_base.slots = slots;
+	sc_base.index = &map[SC_HDR_SIZE];
+	sc_base.records = &sc_base.index[(size_t) slots * 4];
+	sc_base.names = &sc_base.records[(size_t) count * SC_REC_LEN];
+	sc_base.names_len = names_len;
+	sc_base.shared = halloc0(BIT_ARRAY_BYTE_SIZE(MAX(count, 1)));
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("%s(): mapped %u entr%s from \"%s\" (%s)",
+			G_STRFUNC, count, plural_y(count), path,
+			short_size(sb.st_size, FALSE));
+	}
+	goto done;
+
+corrupted:
+	g_warning("%s(): ignoring corrupted \"%s\"", G_STRFUNC, path);
+	if (map != NULL)
+		vmm_munmap(deconstify_pointer(map), sb.st_size);
+	/* FALL THROUGH */
+
+done:
+	fd_close(&fd);
+	HFREE_NULL(path);
+	return TRUE;
+}
+
+/**
+ * Insert or update an entry in the in-core overlay.
+ */
+static void
+sha1_cache_overlay_put(const char *name, const struct sha1_cache_info *info,
+	bool shared)
+{
+	struct sha1_cache_entry *e;
+
+	e = hikset_lookup(sc_overlay, name);
+
+	if (NULL == e) {
+		uint32 r = sha1_cache_base_lookup(name);
+
+		if ((uint32) -1 != r) {
+			sc_superseded++;
+			if (bit_array_get(sc_base.shared, r))
+				sc_shared--;		/* Snapshot entry no longer counted */
+		}
+
+		WALLOC0(e);
+		e->file_name = atom_str_get(name);
+		hikset_insert_key(sc_overlay, &e->file_name);
+	}
+
+	e->info = *info;
+
+	if (shared && !e->shared) {
+		e->shared = TRUE;
+		sc_shared++;
+	}
+}
+
+/**
+ * Free overlay entry.
+ */
+static void
+sha1_cache_entry_free(void *v, void *unused_udata)
+{
+	struct sha1_cache_entry *e = v;
+
+	(void) unused_udata;
+
+	atom_str_free_null(&e->file_name);
+	WFREE(e);
+}
+
+/**
+ * Write the journal header at the start of the (empty) journal.
+ */
+static bool
+sha1_cache_journal_reset(void)
+{
+	g_assert(sc_journal_fd >= 0);
+
+	if (
+		-1 == ftruncate(sc_journal_fd, 0) ||
+		sizeof sc_log_magic !=
+			(size_t) write(sc_journal_fd, sc_log_magic, sizeof sc_log_magic)
+	) {
+		g_warning("%s(): cannot reset SHA1 cache journal: %m", G_STRFUNC);
+		return FALSE;
+	}
+
+	sc_journal_records = 0;
+	return TRUE;
+}
+
+/**
+ * Append entry to the journal.
+ */
+static void
+sha1_cache_journal_append(const char *name,
+	const struct sha1_cache_info *info)
+{
+	char buf[SC_LOG_HDR_LEN + 1024], *rec = buf;
+	size_t len, total;
+	ssize_t w;
+
+	if (sc_journal_fd < 0)
+		return;
+
+	len = strlen(name);
+	g_return_unless(len <= SC_NAME_MAXLEN);
+
+	total = SC_LOG_HDR_LEN + len;
+	if (total > sizeof buf)
+		rec = halloc(total);
+
+	poke_le16(&rec[SC_LOG_NAME_LEN], len);
+	poke_le16(&rec[SC_LOG_FLAGS], info->has_tth ? SC_F_TTH : 0);
+	poke_le64(&rec[SC_LOG_SIZE], info->size);
+	poke_le64(&rec[SC_LOG_MTIME], (uint64) (int64) info->mtime);
+	memcpy(&rec[SC_LOG_SHA1], info->sha1.data, SHA1_RAW_SIZE);
+	if (info->has_tth)
+		memcpy(&rec[SC_LOG_TTH], info->tth.data, TTH_RAW_SIZE);
+	else
+		memset(&rec[SC_LOG_TTH], 0, TTH_RAW_SIZE);
+	memcpy(&rec[SC_LOG_NAME], name, len);
+	poke_le32(&rec[SC_LOG_CRC],
+		crc32_update(0, &rec[SC_LOG_NAME_LEN], total - SC_LOG_NAME_LEN));
+
+	w = write(sc_journal_fd, rec, total);
+
+	if (UNSIGNED(w) != total) {
+		if (-1 == w)
+			g_warning("%s(): cannot append to SHA1 cache journal: %m",
+				G_STRFUNC);
+		else
+			g_warning("%s(): partial write to SHA1 cache journal", G_STRFUNC);
+	} else {
+		sc_journal_records++;
+	}
+
+	if (rec != buf)
+		hfree(rec);
+}
+
+/**
+ * Replay the journal into the overlay, truncating it at the first record
+ * which cannot be read back.
+ */
+static void
+sha1_cache_journal_replay(void)
+{
+	filestat_t sb;
+	char *data;
+	size_t pos, len;
+	ssize_t r;
+
+	g_assert(sc_journal_fd >= 0);
+
+	if (-1 == fstat(sc_journal_fd, &sb)) {
+		g_warning("%s(): cannot stat SHA1 cache journal: %m", G_STRFUNC);
+		return;
+	}
+
+	if (sb.st_size < (fileoffset_t) sizeof sc_log_magic) {
+		sha1_cache_journal_reset();
+		return;
+	}
+
+	len = sb.st_size;
+	if ((fileoffset_t) len != sb.st_size) {
+		g_warning("%s(): SHA1 cache journal too large, discarding", G_STRFUNC);
+		sha1_cache_journal_reset();
+		return;
+	}
+
+	data = halloc(len);
+	r = pread(sc_journal_fd, data, len, 0);
+
+	if (UNSIGNED(r) != len) {
+		g_warning("%s(): cannot read SHA1 cache journal: %m", G_STRFUNC);
+		hfree(data);
+		sha1_cache_journal_reset();
+		return;
+	}
+
+	if (0 != memcmp(data, sc_log_magic, sizeof sc_log_magic)) {
+		g_warning("%s(): discarding corrupted SHA1 cache journal", G_STRFUNC);
+		hfree(data);
+		sha1_cache_journal_reset();
+		return;
+	}
+
+	pos = sizeof sc_log_magic;
+
+	while (len - pos >= SC_LOG_HDR_LEN) {
+		const char *rec = &data[pos];
+		struct sha1_cache_info info;
+		size_t nlen = peek_le16(&rec[SC_LOG_NAME_LEN]);
+		size_t total = SC_LOG_HDR_LEN + nlen;
+		char *name;
+
+		if (0 == nlen || total > len - pos)
+			break;
+
+		if (
+			peek_le32(&rec[SC_LOG_CRC]) !=
+				crc32_update(0, &rec[SC_LOG_NAME_LEN], total - SC_LOG_NAME_LEN)
+		)
+			break;
+
+		info.size = peek_le64(&rec[SC_LOG_SIZE]);
+		info.mtime = (time_t) (int64) peek_le64(&rec[SC_LOG_MTIME]);
+		info.has_tth = booleanize(peek_le16(&rec[SC_LOG_FLAGS]) & SC_F_TTH);
+		memcpy(info.sha1.data, &rec[SC_LOG_SHA1], SHA1_RAW_SIZE);
+		memcpy(info.tth.data, &rec[SC_LOG_TTH], TTH_RAW_SIZE);
+
+		name = h_strndup(&rec[SC_LOG_NAME], nlen);
+		sha1_cache_overlay_put(name, &info, FALSE);
+		hfree(name);
+
+		sc_journal_records++;
+		pos += total;
+	}
+
+	if (pos != len) {
+		g_warning("%s(): truncating SHA1 cache journal at offset %zu "
+			"(%zu trailing byte%s ignored)",
+			G_STRFUNC, pos, len - pos, plural(len - pos));
+		if (-1 == ftruncate(sc_journal_fd, pos))
+			g_warning("%s(): cannot truncate journal: %m", G_STRFUNC);
+	}
+
+	hfree(data);
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("%s(): replayed %zu SHA1 cache journal record%s",
+			G_STRFUNC, sc_journal_records, plural(sc_journal_records));
+	}
+}
+
+/**
+ * Open the journal, creating it if missing.
+ */
+static void
+sha1_cache_journal_open(void)
+{
+	char *path;
+
+	path = make_pathname(settings_config_dir(), SHA1_CACHE_LOG);
+	sc_journal_fd = file_open(path, O_RDWR | O_CREAT | O_APPEND,
+		S_IRUSR | S_IWUSR);
+
+	if (sc_journal_fd >= 0)
+		sha1_cache_journal_replay();
+
+	HFREE_NULL(path);
+}
+
+/**
+ * A cache entry, as seen during compaction.
+ */
+struct sha1_cache_view {
+	const char *name;					/**< NUL-terminated file name */
+	size_t len;							/**< Name length */
+	const struct sha1_cache_info *info;	/**< Cached hashes */
+	bool shared;						/**< Known to be shared */
+};
+
+typedef void (*sha1_cache_view_cb_t)(const struct sha1_cache_view *, void *);
+
+struct sha1_cache_iter {
+	sha1_cache_view_cb_t cb;			/**< Callback to invoke */
+	void *data;							/**< Callback data */
+	bool prune;							/**< Skip entries not shared */
+};
+
+static void
+sha1_cache_foreach_overlay(void *value, void *udata)
+{
+	const struct sha1_cache_entry *e = value;
+	const struct sha1_cache_iter *it = udata;
+	struct sha1_cache_view v;
+
+	if (it->prune && !e->shared)
+		return;
+
+	v.name = e->file_name;
+	v.len = strlen(e->file_name);
+	v.info = &e->info;
+	v.shared = e->shared;
+
+	if (0 == v.len || v.len > SC_NAME_MAXLEN)
+		return;
+
+	(*it->cb)(&v, it->data);
+}
+
+/**
+ * Iterate over all the live entries, in a stable order as long as the
+ * cache is not modified.
+ *
+ * @param prune		whether to skip entries not known to be shared
+ * @param cb		callback to invoke on each entry
+ * @param data		additional callback argument
+ */
+static void
+sha1_cache_foreach(bool prune, sha1_cache_view_cb_t cb, void *data)
+{
+	struct sha1_cache_iter it;
+	uint32 r;
+
+	for (r = 0; r < sc_base.count; r++) {
+		struct sha1_cache_info info;
+		struct sha1_cache_view v;
+
+		if (prune && !bit_array_get(sc_base.shared, r))
+			continue;
+
+		v.name = sha1_cache_base_name(r, &v.len);
+		if (NULL == v.name)
+			continue;
+
+		if (NULL != hikset_lookup(sc_overlay, v.name))
+			continue;			/* Superseded by more recent entry */
+
+		sha1_cache_base_info(r, &info);
+		v.info = &info;
+		v.shared = bit_array_get(sc_base.shared, r);
+		(*cb)(&v, data);
+	}
+
+	it.cb = cb;
+	it.data = data;
+	it.prune = prune;
+
+	hikset_foreach(sc_overlay, sha1_cache_foreach_overlay, &it);
+}
+
+/**
+ * Compaction context.
+ */
+struct sha1_cache_writer {
+	FILE *f;					/**< Where new snapshot is written */
+	char *index;				/**< Index being built */
+	bit_array_t *shared;		/**< Shared records in new snapshot */
+	uint64 names_len;			/**< Size of name area */
+	uint32 count;				/**< Amount of records */
+	uint32 slots;				/**< Amount of index slots */
+	size_t shared_count;		/**< Amount of shared records */
+	bool error;					/**< Write error occurred */
+};
+
+static void
+sha1_cache_count_entry(const struct sha1_cache_view *v, void *data)
+{
+	struct sha1_cache_writer *w = data;
+
+	w->count++;
+	w->names_len += v->len + 1;
+}
+
+static void
+sha1_cache_write_record(const struct sha1_cache_view *v, void *data)
+{
+	struct sha1_cache_writer *w = data;
+	char rec[SC_REC_LEN];
+	uint32 h, i, mask = w->slots - 1;
+
+	h = sha1_cache_hash(v->name, v->len);
+
+	ZERO(&rec);
+	poke_le64(&rec[SC_REC_SIZE], v->info->size);
+	poke_le64(&rec[SC_REC_MTIME], (uint64) (int64) v->info->mtime);
+	poke_le32(&rec[SC_REC_NAME_OFF], w->names_len);
+	poke_le16(&rec[SC_REC_NAME_LEN], v->len);
+	poke_le16(&rec[SC_REC_FLAGS], v->info->has_tth ? SC_F_TTH : 0);
+	memcpy(&rec[SC_REC_SHA1], v->info->sha1.data, SHA1_RAW_SIZE);
+	if (v->info->has_tth)
+		memcpy(&rec[SC_REC_TTH], v->info->tth.data, TTH_RAW_SIZE);
+	poke_le32(&rec[SC_REC_HASH], h);
+
+	if (1 != fwrite(rec, sizeof rec, 1, w->f))
+		w->error = TRUE;
+
+	for (i = h & mask; /* empty */; i = (i + 1) & mask) {
+		if (SC_SLOT_NONE == peek_le32(&w->index[i * 4])) {
+			poke_le32(&w->index[i * 4], w->count + 1);
+			break;
+		}
+	}
+
+	if (v->shared) {
+		bit_array_set(w->shared, w->count);
+		w->shared_count++;
+	}
+
+	w->count++;
+	w->names_len += v->len + 1;
+}
+
+static void
+sha1_cache_write_name(const struct sha1_cache_view *v, void *data)
+{
+	struct sha1_cache_writer *w = data;
+
+	if (1 != fwrite(v->name, v->len + 1, 1, w->f))
+		w->error = TRUE;
+}
+
+/**
+ * Rewrite the snapshot, merging the overlay and emptying the journal.
+ *
+ * @param prune		whether entries not known to be shared are dropped
+ */
+static void
+sha1_cache_compact(bool prune)
+{
+	struct sha1_cache_writer w;
+	file_path_t fp;
+	char hdr[SC_HDR_SIZE];
+	size_t records;
+	tm_t start, end;
+
+	tm_now_exact(&start);
+	sc_compacted = tm_time();		/* Even on failure, to avoid retrying */
+
+	ZERO(&w);
+	sha1_cache_foreach(prune, sha1_cache_count_entry, &w);
+
+	if (w.names_len > MAX_INT_VAL(uint32) || w.count >= (1U << 30)) {
+		g_warning("%s(): SHA1 cache too large, cannot compact", G_STRFUNC);
+		return;
+	}
+
+	records = w.count;
+	w.slots = next_pow2(MAX(64, records + records / 3 + 1));
+	w.index = halloc0((size_t) w.slots * 4);
+	w.shared = halloc0(BIT_ARRAY_BYTE_SIZE(MAX(records, 1)));
+
+	file_path_set(&fp, settings_config_dir(), SHA1_CACHE_BASE);
+	w.f = file_config_open_write("SHA-1 cache", &fp);
+	if (NULL == w.f)
+		goto done;
+
+	w.count = 0;
+	w.names_len = 0;
+
+	if (0 != fseek(w.f, SC_HDR_SIZE + (long) w.slots * 4, SEEK_SET))
+		w.error = TRUE;
+
+	sha1_cache_foreach(prune, sha1_cache_write_record, &w);
+	sha1_cache_foreach(prune, sha1_cache_write_name, &w);
+
+	g_assert(w.count == records);
+
+	ZERO(&hdr);
+	memcpy(&hdr[SC_HDR_MAGIC], sc_base_magic, sizeof sc_base_magic);
+	poke_le32(&hdr[SC_HDR_VERSION], SHA1_CACHE_VERSION);
+	poke_le32(&hdr[SC_HDR_RECSIZE], SC_REC_LEN);
+	poke_le32(&hdr[SC_HDR_COUNT], w.count);
+	poke_le32(&hdr[SC_HDR_SLOTS], w.slots);
+	poke_le64(&hdr[SC_HDR_STRLEN], w.names_len);
+	poke_le64(&hdr[SC_HDR_STAMP], (uint64) tm_time());
+
+	if (
+		w.error ||
+		0 != fseek(w.f, 0, SEEK_SET) ||
+		1 != fwrite(hdr, sizeof hdr, 1, w.f) ||
+		1 != fwrite(w.index, (size_t) w.slots * 4, 1, w.f)
+	) {
+		g_warning("%s(): cannot write SHA1 cache: %m", G_STRFUNC);
+		fclose(w.f);
+		goto done;
+	}
+
+	if (!file_config_close(w.f, &fp))
+		goto done;
+
+	/*
+	 * The new snapshot now holds everything: switch to it, then empty the
+	 * journal.  Should we crash before the journal is emptied, replaying
+	 * it at next startup will simply restore the same entries.
+	 */
+
+	hikset_foreach(sc_overlay, sha1_cache_entry_free, NULL);
+	hikset_clear(sc_overlay);
+	sha1_cache_base_unmap();
+	sc_superseded = 0;
+	sc_shared = 0;
+
+	if (sha1_cache_base_map() && sc_base.count == w.count) {
+		HFREE_NULL(sc_base.shared);
+		sc_base.shared = w.shared;
+		sc_shared = w.shared_count;
+		w.shared = NULL;
+	}
+
+	if (sc_journal_fd >= 0)
+		sha1_cache_journal_reset();
+
+	if (GNET_PROPERTY(share_debug)) {
+		tm_now_exact(&end);
+		g_debug("%s(): wrote %u entr%s (%s) in %u ms",
+			G_STRFUNC, w.count, plural_y(w.count),
+			prune ? "pruned" : "all kept",
+			(uint) tm_elapsed_ms(&end, &start));
+	}
+
+done:
+	HFREE_NULL(w.index);
+	HFREE_NULL(w.shared);
+}
+
+/**
+ * Check whether the journal has grown large enough to warrant compaction.
+ */
+static bool
+sha1_cache_journal_full(void)
+{
+	return sc_journal_records >= MAX(SC_JOURNAL_MIN, sc_base.count / 4);
+}
+
+/**
+ * Parse one line of the former text cache, which is formatted as:
+ *
+ *     URN<TAB>file_size<TAB>file_mtime<TAB>file_name
+ *
+ * and append it to the overlay.
+ */
+static void G_COLD
+sha1_cache_parse_text(char *line)
+{
+	const char *p, *end; /* pointers to scan the line */
+	int c, error;
+	struct sha1_cache_info info;
+
+	/* Skip comments and blank lines */
+	if (file_line_is_skipable(line))
+		return;
+
+	ZERO(&info);
+
+	/* Scan until file size */
+
+	p = line;
+	while ((c = *p) != '\0' && c != '\t') {
+		p++;
+	}
+
+	if (urn_get_bitprint(line, p - line, &info.sha1, &info.tth)) {
+		info.has_tth = TRUE;
+	} else if (urn_get_sha1(line, &info.sha1)) {
+		info.has_tth = FALSE;
+	} else {
+		const char *sha1_digest_ascii;
+
+		info.has_tth = FALSE;
+		sha1_digest_ascii = line; /* SHA1 digest is the first field. */
+
+		if (
+			*p != '\t' ||
+			(p - sha1_digest_ascii) != SHA1_BASE32_SIZE ||
+			SHA1_RAW_SIZE != base32_decode(&info.sha1, sizeof info.sha1,
+								sha1_digest_ascii, SHA1_BASE32_SIZE)
+		) {
+			goto failure;
+		}
+	}
+	p++; /* Skip \t */
+
+	/* p is now supposed to point to the beginning of the file size */
+
+	info.size = parse_uint64(p, &end, 10, &error);
+	if (error || *end != '\t') {
+		goto failure;
+	}
+
+	p = ++end;
+
+	/*
+	 * p is now supposed to point to the beginning of the file last
+	 * modification time.
+	 */
+
+	info.mtime = parse_uint64(p, &end, 10, &error);
+	if (error || *end != '\t') {
+		goto failure;
+	}
+
+	p = ++end;
+
+	/* p is now supposed to point to the file name */
+
+	if (strchr(p, '\t') != NULL || '\0' == *p || strlen(p) > SC_NAME_MAXLEN)
+		goto failure;
+
+	sha1_cache_overlay_put(p, &info, FALSE);
+	return;
+
+failure:
+	g_warning("malformed line in SHA1 cache file: %s", line);
+}
+
+/**
+ * Import the former text cache, when there is no snapshot yet.
+ */
+static void G_COLD
+sha1_cache_import_text(void)
+{
+	FILE *f;
+	file_path_t fp[1];
+	bool truncated = FALSE;
+	char *path, *old;
+
+	file_path_set(fp, settings_config_dir(), SHA1_CACHE_TEXT);
+	f = file_config_open_read("SHA-1 cache", fp, N_ITEMS(fp));
+	if (NULL == f)
+		return;
+
+	for (;;) {
+		char buffer[4096];
+
+		if (NULL == fgets(buffer, sizeof buffer, f))
+			break;
+
+		if (!file_line_chomp_tail(buffer, sizeof buffer, NULL)) {
+			truncated = TRUE;
+		} else if (truncated) {
+			truncated = FALSE;
+		} else {
+			sha1_cache_parse_text(buffer);
+		}
+	}
+	fclose(f);
+
+	g_info("converting %zu SHA1 cache entr%s to binary format",
+		hikset_count(sc_overlay), plural_y(hikset_count(sc_overlay)));
+
+	sha1_cache_compact(FALSE);
+
+	/*
+	 * Once converted, move the text file aside so that it is not imported
+	 * again should the snapshot be removed.
+	 */
+
+	if (0 == hikset_count(sc_overlay)) {
+		path = make_pathname(settings_config_dir(), SHA1_CACHE_TEXT);
+		old = h_strconcat(path, ".old", NULL_PTR);
+		if (-1 == rename(path, old))
+			g_warning("%s(): cannot rename \"%s\": %m", G_STRFUNC, path);
+		HFREE_NULL(old);
+		HFREE_NULL(path);
+	}
+}
+
+/**
+ * Look up cached hashes for a file.
+ *
+ * @param path		the full path of the file
+ * @param info		where cached information is written
+ *
+ * @return TRUE if we had an entry for the file.
+ */
+bool
+sha1_cache_lookup(const char *path, struct sha1_cache_info *info)
+{
+	const struct sha1_cache_entry *e;
+	uint32 r;
+
+	g_assert(path != NULL);
+	g_assert(info != NULL);
+
+	if G_UNLIKELY(NULL == sc_overlay)
+		return FALSE;		/* Shutdown occurred */
+
+	e = hikset_lookup(sc_overlay, path);
+	if (e != NULL) {
+		*info = e->info;
+		return TRUE;
+	}
+
+	r = sha1_cache_base_lookup(path);
+	if ((uint32) -1 == r)
+		return FALSE;
+
+	sha1_cache_base_info(r, info);
+	return TRUE;
+}
+
+/**
+ * Flag the cached entry for the file as belonging to the share library,
+ * so that it is kept when the cache is pruned.
+ */
+void
+sha1_cache_mark_shared(const char *path)
+{
+	struct sha1_cache_entry *e;
+	uint32 r;
+
+	g_assert(path != NULL);
+
+	if G_UNLIKELY(NULL == sc_overlay)
+		return;
+
+	e = hikset_lookup(sc_overlay, path);
+	if (e != NULL) {
+		if (!e->shared) {
+			e->shared = TRUE;
+			sc_shared++;
+		}
+		return;
+	}
+
+	r = sha1_cache_base_lookup(path);
+	if ((uint32) -1 != r && !bit_array_get(sc_base.shared, r)) {
+		bit_array_set(sc_base.shared, r);
+		sc_shared++;
+	}
+}
+
+/**
+ * Record freshly computed hashes for a shared file.
+ *
+ * @param path		the full path of the file
+ * @param size		the file size
+ * @param mtime		the file modification time
+ * @param sha1		the SHA1 of the file
+ * @param tth		the TTH root of the file (may be NULL)
+ */
+void
+sha1_cache_record(const char *path, filesize_t size, time_t mtime,
+	const struct sha1 *sha1, const struct tth *tth)
+{
+	struct sha1_cache_info info;
+
+	g_assert(path != NULL);
+	g_assert(sha1 != NULL);		/* tth may be NULL but sha1 not */
+
+	if G_UNLIKELY(NULL == sc_overlay)
+		return;
+
+	ZERO(&info);
+	info.sha1 = *sha1;
+	info.size = size;
+	info.mtime = mtime;
+	if (tth != NULL) {
+		info.tth = *tth;
+		info.has_tth = TRUE;
+	}
+
+	sha1_cache_overlay_put(path, &info, TRUE);
+	sha1_cache_journal_append(path, &info);
+
+	if (
+		sha1_cache_journal_full() &&
+		delta_time(tm_time(), sc_compacted) > SC_COMPACT_DELAY
+	)
+		sha1_cache_compact(FALSE);
+}
+
+/**
+ * Initialize the SHA1 cache.
+ */
+void G_COLD
+sha1_cache_init(void)
+{
+	g_return_if_fail(settings_config_dir());
+
+	sc_started = tm_time();
+	sc_overlay = hikset_create(
+		offsetof(struct sha1_cache_entry, file_name), HASH_KEY_STRING, 0);
+
+	if (!sha1_cache_base_map())
+		sha1_cache_import_text();
+
+	sha1_cache_journal_open();
+
+	if (sha1_cache_journal_full())
+		sha1_cache_compact(FALSE);
+}
+
+/**
+ * Close the SHA1 cache.
+ */
+void G_COLD
+sha1_cache_close(void)
+{
+	size_t total;
+	bool prune;
+
+	if (NULL == sc_overlay)
+		return;
+
+	/*
+	 * We can only drop the entries of files that are no longer shared when
+	 * the library was fully scanned during this session, otherwise we do
+	 * not know which files are still shared.
+	 */
+
+	prune = !GNET_PROPERTY(library_rebuilding) &&
+		delta_time(GNET_PROPERTY(library_rescan_finished), sc_started) >= 0;
+
+	total = sha1_cache_count();
+
+	if (
+		sha1_cache_journal_full() ||
+		(prune && total - sc_shared > total / 8)
+	)
+		sha1_cache_compact(prune);
+
+	fd_close(&sc_journal_fd);
+	sha1_cache_base_unmap();
+
+	hikset_foreach(sc_overlay, sha1_cache_entry_free, NULL);
+	hikset_free_null(&sc_overlay);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
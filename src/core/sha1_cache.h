@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Persistent cache of SHA1 and TTH digests for shared files.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_sha1_cache_h_
+#define _core_sha1_cache_h_
+
+#include "common.h"
+
+#include "lib/misc.h"		/* For struct sha1 and struct tth */
+
+/**
+ * What we know about a file.
+ */
+struct sha1_cache_info {
+	struct sha1 sha1;			/**< SHA-1 of the file */
+	struct tth tth;				/**< TTH root, valid if has_tth */
+	filesize_t size;			/**< File size when hashed */
+	time_t mtime;				/**< Last modification time when hashed */
+	bool has_tth;				/**< Whether TTH is known */
+};
+
+/*
+ * Public interface.
+ */
+
+void sha1_cache_init(void);
+void sha1_cache_close(void);
+
+bool sha1_cache_lookup(const char *path, struct sha1_cache_info *info);
+void sha1_cache_mark_shared(const char *path);
+void sha1_cache_record(const char *path, filesize_t size, time_t mtime,
+	const struct sha1 *sha1, const struct tth *tth);
+
+#endif /* _core_sha1_cache_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
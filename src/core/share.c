@@ -3223,6 +3223,7 @@ share_close(void)
 	oob_close();			/* References hits, so needs ``sha1_to_share'' */
 	qhit_close();
 	st_free(&shared_libfile.partial_table);
+	st_cache_close();
 	htable_free_null(&share_media_types);
 	hset_free_null(&partial_files);
 	hikset_free_null(&sha1_to_share);
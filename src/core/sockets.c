@@ -112,6 +112,8 @@
 #define MAX_UDP_LOOP_MS		37		/**< Amount of CPU time we can spend */
 #define UDP_QUEUED_GUESS	65536	/**< Guess amount of pending RX input */
 #define UDP_QUEUE_DELAY_MS	250		/**< RX queue processing delay */
+#define UDP_MMSG_MAX		32		/**< Max datagrams per batched syscall */
+#define UDP_MMSG_TXSZ		4096	/**< Max size of a batched TX datagram */
 #define TLS_BAN_FREQ		300		/**< Avoid TLS for 5 minutes */
 
 enum {
@@ -1366,8 +1368,14 @@ socket_timer(time_t now)
 static inline void
 socket_disable(struct gnutella_socket *s)
 {
-	if (s != NULL)
+	if (s != NULL) {
 		socket_evt_clear(s);
+
+		if ((s->flags & SOCK_F_UDP) && s->resource.udp->offload != NULL) {
+			(*s->resource.udp->offload)(s);
+			s->resource.udp->offload = NULL;
+		}
+	}
 }
 
 /**
@@ -1537,6 +1545,70 @@ socket_udp_qfree(void *item, void *unused_data)
 	socket_udpq_free(item);
 }
 
+#ifdef HAS_MMSG
+/**
+ * Ring of datagrams read by a single recvmmsg() call, which are then
+ * delivered one at a time by socket_udp_accept().
+ */
+struct udp_rxbatch {
+	struct mmsghdr msgs[UDP_MMSG_MAX];
+	iovec_t iov[UDP_MMSG_MAX];
+	socket_addr_t from[UDP_MMSG_MAX];
+	union {
+		struct cmsghdr hdr;
+		size_t align;
+		char bytes[CMSG_SPACE(512)];
+	} cmsg[UDP_MMSG_MAX];
+	char *arena;			/**< UDP_MMSG_MAX buffers of `size' bytes */
+	size_t size;			/**< Size of each reception buffer */
+	unsigned count;			/**< Amount of datagrams read in the ring */
+	unsigned next;			/**< Index of next datagram to deliver */
+};
+
+/**
+ * Datagrams accumulated by socket_plain_sendto() whilst batching is active,
+ * to be emitted by a single sendmmsg() call.
+ */
+struct udp_txbatch {
+	struct mmsghdr msgs[UDP_MMSG_MAX];
+	iovec_t iov[UDP_MMSG_MAX];
+	socket_addr_t to[UDP_MMSG_MAX];
+	char *arena;			/**< UDP_MMSG_MAX buffers of UDP_MMSG_TXSZ bytes */
+	unsigned count;			/**< Amount of pending datagrams */
+	bool active;			/**< Whether sendto() requests are batched */
+};
+
+static bool socket_mmsg_unavailable;	/**< Set when kernel returns ENOSYS */
+
+static inline int
+socket_recvmmsg(int fd, struct mmsghdr *vec, unsigned n)
+{
+	return recvmmsg(fd, vec, n, MSG_DONTWAIT, NULL);
+}
+
+static inline int
+socket_sendmmsg(int fd, struct mmsghdr *vec, unsigned n)
+{
+	return sendmmsg(fd, vec, n, MSG_DONTWAIT);
+}
+
+/**
+ * Free the datagram batching rings of an UDP socket.
+ */
+static void
+socket_udp_batch_free(struct udpctx *uctx)
+{
+	if (uctx->rx != NULL) {
+		HFREE_NULL(uctx->rx->arena);
+		WFREE_TYPE_NULL(uctx->rx);
+	}
+	if (uctx->tx != NULL) {
+		HFREE_NULL(uctx->tx->arena);
+		WFREE_TYPE_NULL(uctx->tx);
+	}
+}
+#endif	/* HAS_MMSG */
+
 /**
  * Dispose of socket, closing connection, removing input callback, and
  * reclaiming attached getline buffer.
@@ -1556,9 +1628,13 @@ socket_free(struct gnutella_socket *s)
 	if (s->flags & SOCK_F_UDP) {
 		struct udpctx *uctx = s->resource.udp;
 		if (uctx != NULL) {
-			WFREE_NULL(uctx->socket_addr, sizeof(socket_addr_t));
+			if (uctx->offload != NULL)
+				(*uctx->offload)(s);
 			eslist_foreach(&uctx->queue, socket_udp_qfree, NULL);
 			cq_cancel(&uctx->queue_ev);
+#ifdef HAS_MMSG
+			socket_udp_batch_free(uctx);
+#endif
 			WFREE(s->resource.udp);
 		}
 	} else {
@@ -2721,9 +2797,10 @@ socket_udp_extract_dst_addr(const struct msghdr *msg, host_addr_t *dst_addr)
  * Note: for the Gnutella datagram socket this is udp_received().
  */
 static inline void
-socket_udp_process(gnutella_socket_t *s, bool truncated)
+socket_udp_process(gnutella_socket_t *s, void *data, size_t len,
+	bool truncated)
 {
-	(*s->resource.udp->data_ind)(s, s->buf, s->pos, truncated);
+	(*s->resource.udp->data_ind)(s, data, len, truncated);
 }
 
 /**
@@ -2789,40 +2866,127 @@ socket_udp_is_old(const gnutella_socket_t *s)
 	return booleanize(s->flags & SOCK_F_OLD);
 }
 
+#ifdef HAS_MMSG
 /**
- * Someone is sending us a datagram.  Read it into the socket's buffer.
+ * Reset slot of the reception ring before it is handed to recvmmsg().
+ */
+static void
+socket_udp_rxbatch_reset(const struct gnutella_socket *s,
+	struct udp_rxbatch *rx, unsigned i)
+{
+	struct msghdr *msg = &rx->msgs[i].msg_hdr;
+
+	ZERO(msg);
+	msg->msg_namelen = socket_addr_init(&rx->from[i], s->net);
+	msg->msg_name = socket_addr_get_sockaddr(&rx->from[i]);
+	iovec_set(&rx->iov[i], &rx->arena[i * rx->size], rx->size);
+	msg->msg_iov = &rx->iov[i];
+	msg->msg_iovlen = 1;
+	ZERO(&rx->cmsg[i].hdr);
+	msg->msg_control = rx->cmsg[i].bytes;
+	msg->msg_controllen = sizeof rx->cmsg[i].bytes;
+}
+
+/**
+ * Refill the (empty) reception ring with as many datagrams as the kernel
+ * can give us through a single recvmmsg() call.
  *
- * @param s				the socket which receives a datagram
- * @param truncation	written with whether datagram was truncated
+ * @return the amount of datagrams read, -1 on error with errno set.
+ */
+static int
+socket_udp_rxbatch_fill(struct gnutella_socket *s)
+{
+	struct udpctx *uctx = s->resource.udp;
+	struct udp_rxbatch *rx = uctx->rx;
+	unsigned i;
+	int r;
+
+	if (NULL == rx) {
+		WALLOC0(rx);
+		rx->size = s->buf_size;
+		rx->arena = halloc(UDP_MMSG_MAX * rx->size);
+		rx->count = rx->next = UDP_MMSG_MAX;	/* All slots need a reset */
+		uctx->rx = rx;
+	}
+
+	g_assert(rx->next >= rx->count);
+
+	/*
+	 * Only the slots filled by the previous call were modified by the
+	 * kernel, the others are still ready for reception.
+	 */
+
+	for (i = 0; i < rx->count; i++) {
+		socket_udp_rxbatch_reset(s, rx, i);
+	}
+
+	rx->count = rx->next = 0;
+	r = socket_recvmmsg(s->file_desc, rx->msgs, UDP_MMSG_MAX);
+
+	if (-1 == r)
+		return -1;
+
+	g_assert(r <= UDP_MMSG_MAX);
+
+	rx->count = r;
+	gnet_stats_inc_general(GNR_UDP_RX_BATCHES);
+	gnet_stats_count_general(GNR_UDP_RX_BATCHED, r);
+
+	return r;
+}
+#endif	/* HAS_MMSG */
+
+/**
+ * @return whether datagrams read in a batch are still pending delivery.
+ */
+static inline bool
+socket_udp_rx_pending(const struct gnutella_socket *s)
+{
+#ifdef HAS_MMSG
+	const struct udp_rxbatch *rx = s->resource.udp->rx;
+
+	return rx != NULL && rx->next < rx->count;
+#else
+	(void) s;
+	return FALSE;
+#endif	/* HAS_MMSG */
+}
+
+/**
+ * Read a datagram from the UDP socket into the supplied buffer.
+ *
+ * This routine only uses the socket descriptor and its network type, hence
+ * it can be called from another thread than the one owning the socket.
+ *
+ * @param s			the socket which receives a datagram
+ * @param buf		the buffer where data is read
+ * @param size		size of buffer
+ * @param dg		filled with the origin and the reception attributes
  *
  * @return -1 on error, the size of the datagram otherwise.
  */
-static ssize_t
-socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+ssize_t
+socket_udp_recv(const struct gnutella_socket *s, void *buf, size_t size,
+	struct udp_dgram *dg)
 {
-	socket_addr_t *from_addr;
+	socket_addr_t from_addr;
 	struct sockaddr *from;
 	socklen_t from_len;
 	ssize_t r;
-	bool truncated = FALSE, has_dst_addr = FALSE;
-	host_addr_t dst_addr;
 
 	socket_check(s);
 	g_assert(s->flags & SOCK_F_UDP);
-	g_assert(s->type == SOCK_TYPE_UDP);
-
-	/*
-	 * Receive the datagram in the socket's buffer.
-	 */
+	g_assert(dg != NULL);
 
-	from_addr = s->resource.udp->socket_addr;
+	dg->truncated = FALSE;
+	dg->has_dst = FALSE;
 
 	/* Initialize from_addr so that it matches the socket's network type. */
-	from_len = socket_addr_init(from_addr, s->net);
+	from_len = socket_addr_init(&from_addr, s->net);
 	g_assert(from_len > 0);
-	g_assert(from_len == socket_addr_get_len(from_addr));
+	g_assert(from_len == socket_addr_get_len(&from_addr));
 
-	from = socket_addr_get_sockaddr(from_addr);
+	from = socket_addr_get_sockaddr(&from_addr);
 	g_assert(from);
 
 #ifdef HAS_RECVMSG
@@ -2838,7 +3002,7 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 		struct msghdr msg;
 		iovec_t iov;
 
-		iovec_set(&iov, s->buf, s->buf_size);
+		iovec_set(&iov, buf, size);
 
 		msg = zero_msg;
 		msg.msg_name = cast_to_pointer(from);
@@ -2867,22 +3031,46 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 
 		/* msg_flags is missing at least in some versions of IRIX. */
 #if defined(HAS_MSGHDR_MSG_FLAGS)
-		truncated = 0 != (MSG_TRUNC & msg.msg_flags);
+		dg->truncated = 0 != (MSG_TRUNC & msg.msg_flags);
 #endif
 
 		if ((ssize_t) -1 != r && !GNET_PROPERTY(force_local_ip)) {
-			has_dst_addr = socket_udp_extract_dst_addr(&msg, &dst_addr);
+			dg->has_dst = socket_udp_extract_dst_addr(&msg, &dg->dst);
 		}
 	}
 #else	/* !HAS_RECVMSG */
-	r = recvfrom(s->file_desc, s->buf, s->buf_size, 0,
+	r = recvfrom(s->file_desc, buf, size, 0,
 			cast_to_pointer(from), &from_len);
 #endif	/* HAS_RECVMSG */
 
 	if ((ssize_t) -1 == r)
 		return (ssize_t) -1;
 
-	g_assert((size_t) r <= s->buf_size);
+	g_assert((size_t) r <= size);
+
+	dg->addr = socket_addr_get_addr(&from_addr);
+	dg->port = socket_addr_get_port(&from_addr);
+
+	return r;
+}
+
+/**
+ * Record the origin of a datagram read from the UDP socket, before it is
+ * given to the application.
+ *
+ * @param s			the socket which received the datagram
+ * @param len		the size of the datagram
+ * @param dg		the reception attributes, as filled by socket_udp_recv()
+ *
+ * @return TRUE if datagram can be processed, FALSE if it must be ignored,
+ * with errno set.
+ */
+bool
+socket_udp_received(struct gnutella_socket *s, size_t len,
+	const struct udp_dgram *dg)
+{
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
 
 	/*
 	 * We're too low level to account for the proper bandwidth here as we
@@ -2891,26 +3079,24 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 	 * This will be done in udp_receieved() which we're about to call.
 	 */
 
-	s->pos = r;
-
 	/*
 	 * Record remote address.
 	 */
 
-	s->addr = socket_addr_get_addr(from_addr);
-	s->port = socket_addr_get_port(from_addr);
+	s->addr = dg->addr;
+	s->port = dg->port;
 
 	if (!is_host_addr(s->addr)) {
 		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
-		bws_udp_count_read(r, FALSE);	/* Assume not from DHT */
+		bws_udp_count_read(len, FALSE);	/* Assume not from DHT */
 		errno = EINVAL;
-		return (ssize_t) -1;
+		return FALSE;
 	}
 
-	if (has_dst_addr) {
+	if (dg->has_dst) {
 		static host_addr_t last_addr;
 
-		settings_addr_changed(dst_addr, s->addr);
+		settings_addr_changed(dg->dst, s->addr);
 
 		/*
 		 * Show the destination address only when it differs from
@@ -2919,20 +3105,116 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 
 		if (
 			GNET_PROPERTY(socket_debug) > 1 ||
-			!host_addr_equiv(last_addr, dst_addr)
+			!host_addr_equiv(last_addr, dg->dst)
 		) {
-			last_addr = dst_addr;
+			last_addr = dg->dst;
 			if (GNET_PROPERTY(socket_debug)) {
 				g_debug("%s(): dst_addr=%s",
-					G_STRFUNC, host_addr_to_string(dst_addr));
+					G_STRFUNC, host_addr_to_string(dg->dst));
 			}
 		}
 	}
 
-	if (truncated)
+	if (dg->truncated)
 		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
 
-	*truncation = truncated;
+	return TRUE;
+}
+
+/**
+ * Someone is sending us a datagram.  Read it into the socket's buffer.
+ *
+ * When the "udp_mmsg" property is set and the system supports it, several
+ * datagrams are read at once and then delivered from the reception ring
+ * on subsequent calls.
+ *
+ * @param s				the socket which receives a datagram
+ * @param data			written with the address of the datagram data
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_accept(struct gnutella_socket *s, void **data, bool *truncation)
+{
+	struct udp_dgram dg;
+	ssize_t r;
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(s->type == SOCK_TYPE_UDP);
+
+#ifdef HAS_MMSG
+	if (
+		socket_udp_rx_pending(s) ||
+		(
+			GNET_PROPERTY(udp_mmsg) && !socket_mmsg_unavailable &&
+			!(s->flags & SOCK_F_SINGLE)
+		)
+	) {
+		struct udp_rxbatch *rx;
+		const struct msghdr *msg;
+		unsigned i;
+
+		if (!socket_udp_rx_pending(s)) {
+			if (-1 == socket_udp_rxbatch_fill(s)) {
+				if (ENOSYS != errno)
+					return (ssize_t) -1;
+				socket_mmsg_unavailable = TRUE;
+				goto unbatched;
+			}
+			if (!socket_udp_rx_pending(s)) {
+				errno = VAL_EAGAIN;		/* Paranoid, cannot happen */
+				return (ssize_t) -1;
+			}
+		}
+
+		rx = s->resource.udp->rx;
+		i = rx->next++;
+		msg = &rx->msgs[i].msg_hdr;
+		r = rx->msgs[i].msg_len;
+		*data = &rx->arena[i * rx->size];
+
+		dg.addr = socket_addr_get_addr(&rx->from[i]);
+		dg.port = socket_addr_get_port(&rx->from[i]);
+		dg.truncated = FALSE;
+		dg.has_dst = FALSE;
+
+#if defined(HAS_MSGHDR_MSG_FLAGS)
+		dg.truncated = 0 != (MSG_TRUNC & msg->msg_flags);
+#endif
+
+		if (!GNET_PROPERTY(force_local_ip))
+			dg.has_dst = socket_udp_extract_dst_addr(msg, &dg.dst);
+
+		goto received;
+	}
+
+unbatched:
+#endif	/* HAS_MMSG */
+
+	/*
+	 * Receive the datagram in the socket's buffer.
+	 */
+
+	*data = s->buf;
+	r = socket_udp_recv(s, s->buf, s->buf_size, &dg);
+
+	if ((ssize_t) -1 == r)
+		return (ssize_t) -1;
+
+#ifdef HAS_MMSG
+received:
+#endif
+
+	g_assert((size_t) r <= s->buf_size);
+
+	s->pos = r;
+
+	if (!socket_udp_received(s, r, &dg))
+		return (ssize_t) -1;
+
+	*truncation = dg.truncated;
 	return r;
 }
 
@@ -2940,7 +3222,8 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
  * Enqueue UDP datagram for deferred processing.
  */
 static void
-socket_udp_queue(gnutella_socket_t *s, bool truncated)
+socket_udp_queue(gnutella_socket_t *s, const void *data, size_t len,
+	bool truncated)
 {
 	struct udpctx *uctx;
 	struct udpq *uq;
@@ -2950,8 +3233,8 @@ socket_udp_queue(gnutella_socket_t *s, bool truncated)
 	uctx = s->resource.udp;
 
 	WALLOC(uq);
-	uq->buf = wcopy(s->buf, s->pos);
-	uq->len = s->pos;
+	uq->buf = wcopy(data, len);
+	uq->len = len;
 	uq->queued = tm_time();
 	uq->truncated = booleanize(truncated);
 	uq->addr = s->addr;
@@ -3104,9 +3387,10 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 
 	for(;;) {
 		ssize_t r;
+		void *dgram;
 
 		i++;
-		r = socket_udp_accept(s, &truncated);		/* Read datagram */
+		r = socket_udp_accept(s, &dgram, &truncated);	/* Read datagram */
 
 		if ((ssize_t) -1 == r) {
 			/* ECONNRESET is meaningless with UDP but happens on Windows */
@@ -3133,24 +3417,26 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 		 */
 
 		if (enqueue) {
-			socket_udp_queue(s, truncated);				/* Enqueue it */
+			socket_udp_queue(s, dgram, r, truncated);		/* Enqueue it */
 			qd += r;
 			qn++;
 		} else {
-			socket_udp_process(s, truncated);			/* Process it */
+			socket_udp_process(s, dgram, r, truncated);	/* Process it */
 		}
 
 		avail = size_saturate_sub(avail, r);
 
 		/* kevent() reports 32 more bytes than there are, maybe
-		 * it refers to header or control msg data. */
-		if (avail <= 32)
+		 * it refers to header or control msg data.
+		 * Datagrams already read in a batch must be delivered though,
+		 * since no further input event will be triggered for them. */
+		if (avail <= 32 && !socket_udp_rx_pending(s))
 			break;
 
 	next:
 
 		/* Process one event at a time if configured as such */
-		if (s->flags & SOCK_F_SINGLE)
+		if ((s->flags & SOCK_F_SINGLE) && !socket_udp_rx_pending(s))
 			break;
 
 		if (!enqueue) {
@@ -4342,13 +4628,6 @@ socket_udp_listen(host_addr_t bind_addr, uint16 port,
 
 	eslist_init(&s->resource.udp->queue, offsetof(struct udpq, lnk));
 
-	/*
-	 * Attach the socket information so that we may record the origin
-	 * of the datagrams we receive.
-	 */
-
-	s->resource.udp->socket_addr = walloc(sizeof(socket_addr_t));
-
 	/* Get the port of the socket, if needed */
 
 	if (port) {
@@ -4379,6 +4658,37 @@ socket_udp_listen(host_addr_t bind_addr, uint16 port,
 	return s;
 }
 
+/**
+ * Let another thread read the datagrams received on the UDP socket, through
+ * socket_udp_recv(), or resume reading them from the main thread.
+ *
+ * The callback is invoked when the socket is disabled or freed, and must
+ * synchronously ensure the socket is no longer read by the other thread.
+ *
+ * @param s		the UDP socket
+ * @param cb	callback to detach the socket, NULL to resume local reading
+ */
+void
+socket_udp_offload(struct gnutella_socket *s, socket_udp_offload_t cb)
+{
+	struct udpctx *uctx;
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+
+	uctx = s->resource.udp;
+
+	if (NULL == cb) {
+		if (uctx->offload != NULL) {
+			uctx->offload = NULL;
+			socket_evt_set(s, INPUT_EVENT_R, socket_udp_event, s);
+		}
+	} else {
+		socket_evt_clear(s);
+		uctx->offload = cb;
+	}
+}
+
 void
 socket_disable_token(struct gnutella_socket *s)
 {
@@ -4658,6 +4968,187 @@ socket_plain_readv(struct wrap_io *wio, iovec_t *iov, int iovcnt)
 	return s_readv(s->file_desc, iov, iovcnt);
 }
 
+#ifdef HAS_MMSG
+/**
+ * Fill slot of the emission batch with a copy of the datagram.
+ */
+static void
+socket_udp_txbatch_set(struct udp_txbatch *tx, unsigned i,
+	const socket_addr_t *to, socklen_t len, const void *data, size_t size)
+{
+	struct msghdr *msg = &tx->msgs[i].msg_hdr;
+	char *p = &tx->arena[i * UDP_MMSG_TXSZ];
+
+	g_assert(i < UDP_MMSG_MAX);
+	g_assert(size <= UDP_MMSG_TXSZ);
+
+	if (p != data)
+		memcpy(p, data, size);
+	if (&tx->to[i] != to)
+		tx->to[i] = *to;
+	iovec_set(&tx->iov[i], p, size);
+
+	ZERO(msg);
+	msg->msg_name = socket_addr_get_sockaddr(&tx->to[i]);
+	msg->msg_namelen = len;
+	msg->msg_iov = &tx->iov[i];
+	msg->msg_iovlen = 1;
+}
+
+/**
+ * Emit the datagrams pending in the emission batch.
+ *
+ * Datagrams that cannot be sent because the kernel is out of buffers are
+ * kept for the next flush, moved at the head of the batch.  Datagrams
+ * rejected for any other reason are dropped.
+ */
+static void
+socket_udp_txbatch_send(struct gnutella_socket *s)
+{
+	struct udp_txbatch *tx = s->resource.udp->tx;
+	unsigned i = 0, j;
+
+	while (i < tx->count) {
+		const struct msghdr *msg;
+		int r;
+
+		if (!socket_mmsg_unavailable) {
+			r = socket_sendmmsg(s->file_desc, &tx->msgs[i], tx->count - i);
+
+			if (r > 0) {
+				g_assert(UNSIGNED(r) <= tx->count - i);
+				gnet_stats_inc_general(GNR_UDP_TX_BATCHES);
+				gnet_stats_count_general(GNR_UDP_TX_BATCHED, r);
+				i += r;
+				continue;
+			}
+
+			if (-1 == r && ENOSYS == errno)
+				socket_mmsg_unavailable = TRUE;
+		}
+
+		/*
+		 * Either sendmmsg() failed on the first datagram, or it is not
+		 * supported by the kernel and we fall back to plain sendto().
+		 */
+
+		msg = &tx->msgs[i].msg_hdr;
+
+		if (socket_mmsg_unavailable) {
+			r = sendto(s->file_desc,
+				iovec_base(msg->msg_iov), iovec_len(msg->msg_iov), 0,
+				msg->msg_name, msg->msg_namelen);
+
+			if (-1 != r) {
+				i++;
+				continue;
+			}
+		}
+
+		if (is_temporary_error(errno) || ENOBUFS == errno)
+			break;
+
+		gnet_stats_inc_general(GNR_UDP_TX_BATCH_LOST);
+
+		if (GNET_PROPERTY(udp_debug)) {
+			g_warning("%s(): dropping %zu-byte datagram to %s: %m",
+				G_STRFUNC, iovec_len(msg->msg_iov),
+				host_addr_port_to_string(
+					socket_addr_get_addr(&tx->to[i]),
+					socket_addr_get_port(&tx->to[i])));
+		}
+
+		i++;
+	}
+
+	/*
+	 * Move the datagrams we could not send at the head of the batch.
+	 */
+
+	for (j = 0; i < tx->count; i++, j++) {
+		const struct msghdr *msg = &tx->msgs[i].msg_hdr;
+
+		socket_udp_txbatch_set(tx, j, &tx->to[i], msg->msg_namelen,
+			iovec_base(msg->msg_iov), iovec_len(msg->msg_iov));
+	}
+
+	tx->count = j;
+}
+
+/**
+ * Record datagram in the emission batch.
+ *
+ * @return the size of the datagram, -1 with errno set if the batch is full
+ * and cannot be flushed.
+ */
+static ssize_t
+socket_udp_txbatch_add(struct gnutella_socket *s,
+	const socket_addr_t *to, socklen_t len, const void *data, size_t size)
+{
+	struct udp_txbatch *tx = s->resource.udp->tx;
+
+	if (UDP_MMSG_MAX == tx->count) {
+		socket_udp_txbatch_send(s);
+		if (UDP_MMSG_MAX == tx->count) {
+			errno = VAL_EAGAIN;
+			return -1;
+		}
+	}
+
+	socket_udp_txbatch_set(tx, tx->count++, to, len, data, size);
+	return size;
+}
+#endif	/* HAS_MMSG */
+
+/**
+ * Start batching of datagrams sent on the UDP socket.
+ *
+ * Until socket_udp_batch_flush() is called, small datagrams given to the
+ * sendto() routine are copied and emitted by a single system call, when
+ * the "udp_mmsg" property is set and the system supports it.
+ */
+void
+socket_udp_batch_start(struct gnutella_socket *s)
+{
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+
+#ifdef HAS_MMSG
+	if (GNET_PROPERTY(udp_mmsg) && !socket_mmsg_unavailable) {
+		struct udpctx *uctx = s->resource.udp;
+
+		if (NULL == uctx->tx) {
+			WALLOC0(uctx->tx);
+			uctx->tx->arena = halloc(UDP_MMSG_MAX * UDP_MMSG_TXSZ);
+		}
+		uctx->tx->active = TRUE;
+	}
+#endif	/* HAS_MMSG */
+}
+
+/**
+ * Stop batching of datagrams sent on the UDP socket and emit the pending
+ * datagrams.
+ */
+void
+socket_udp_batch_flush(struct gnutella_socket *s)
+{
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+
+#ifdef HAS_MMSG
+	{
+		struct udp_txbatch *tx = s->resource.udp->tx;
+
+		if (tx != NULL) {
+			tx->active = FALSE;
+			if (tx->count != 0)
+				socket_udp_txbatch_send(s);
+		}
+	}
+#endif	/* HAS_MMSG */
+}
+
 static ssize_t
 socket_plain_sendto(
 	struct wrap_io *wio, const gnet_host_t *to, const void *buf, size_t size)
@@ -4682,6 +5173,16 @@ socket_plain_sendto(
 	}
 
 	len = socket_addr_set(&addr, ha, gnet_host_get_port(to));
+
+#ifdef HAS_MMSG
+	if (s->flags & SOCK_F_UDP) {
+		const struct udp_txbatch *tx = s->resource.udp->tx;
+
+		if (tx != NULL && tx->active && size <= UDP_MMSG_TXSZ)
+			return socket_udp_txbatch_add(s, &addr, len, buf, size);
+	}
+#endif	/* HAS_MMSG */
+
 	ret = sendto(s->file_desc, buf, size, 0,
 			socket_addr_get_const_sockaddr(&addr), len);
 
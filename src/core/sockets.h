@@ -136,6 +136,23 @@ typedef struct gnutella_socket {
 typedef void (*socket_udp_data_ind_t)(const gnutella_socket_t *s,
 	const void *data, size_t len, bool truncated);
 
+/**
+ * Invoked when an UDP socket whose reception was offloaded to another
+ * thread is disabled or freed, to stop that thread from reading it.
+ */
+typedef void (*socket_udp_offload_t)(gnutella_socket_t *s);
+
+/**
+ * Attributes of a datagram read by socket_udp_recv().
+ */
+struct udp_dgram {
+	host_addr_t addr;			/**< Host sending us the datagram */
+	host_addr_t dst;			/**< Our address, to which it was sent */
+	uint16 port;				/**< Remote UDP sender port */
+	uint8 has_dst;				/**< Whether destination address is known */
+	uint8 truncated;			/**< Whether data was truncated */
+};
+
 /**
  * TCP socket callback operations.
  */
@@ -170,11 +187,13 @@ struct udpq {
  * UDP socket context.
  */
 struct udpctx {
-	void *socket_addr;					/**< To get reception address */
 	socket_udp_data_ind_t data_ind;		/**< Callback on datagram reception */
+	socket_udp_offload_t offload;		/**< Set when read by another thread */
 	struct cevent *queue_ev;			/**< Queue processing event */
 	eslist_t queue;						/**< Queued items (read-ahead) */
 	size_t queued;						/**< Amount of bytes queued */
+	struct udp_rxbatch *rx;				/**< Batched reception ring */
+	struct udp_txbatch *tx;				/**< Batched emission ring */
 };
 
 static inline void
@@ -294,6 +313,13 @@ int socket_evt_fd(struct gnutella_socket *s);
 bool socket_is_local(const struct gnutella_socket *s);
 bool socket_local_addr(const struct gnutella_socket *s, host_addr_t *ap);
 bool socket_udp_is_old(const struct gnutella_socket *s);
+void socket_udp_batch_start(struct gnutella_socket *s);
+void socket_udp_batch_flush(struct gnutella_socket *s);
+ssize_t socket_udp_recv(const struct gnutella_socket *s,
+	void *buf, size_t size, struct udp_dgram *dg);
+bool socket_udp_received(struct gnutella_socket *s,
+	size_t len, const struct udp_dgram *dg);
+void socket_udp_offload(struct gnutella_socket *s, socket_udp_offload_t cb);
 
 void socket_tls_upgrade(struct gnutella_socket *s, notify_fn_t cb, void *arg);
 
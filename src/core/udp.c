@@ -84,7 +84,8 @@ enum udp_traffic {
 	RUDP,					/* RUDP traffic */
 	SEMI_RELIABLE_GTA,		/* Semi-reliable UDP, "GTA" tag (Gnutella) */
 	SEMI_RELIABLE_GND,		/* Semi-reliable UDP, "GND" tag (G2) */
-	UNKNOWN					/* Unknown traffic */
+	UNKNOWN,				/* Unknown traffic */
+	AMBIGUOUS				/* Gnutella or semi-reliable, to inspect */
 };
 
 /**
@@ -98,6 +99,7 @@ udp_traffic_to_string(enum udp_traffic utp)
 	case DHT:					return "DHT";
 	case RUDP:					return "RUDP";
 	case UNKNOWN:				return "UNKNOWN";
+	case AMBIGUOUS:				return "ambiguous";
 	case SEMI_RELIABLE_GTA:		return "semi-reliable GTA";
 	case SEMI_RELIABLE_GND:		return "semi-reliable GND";
 	}
@@ -515,6 +517,7 @@ udp_is_valid_semi_reliable(enum udp_traffic utp, const gnutella_socket_t *s,
 	case DHT:
 	case RUDP:
 	case UNKNOWN:
+	case AMBIGUOUS:
 		g_assert_not_reached();
 	}
 
@@ -686,6 +689,58 @@ tag_known:
 	return utp;
 }
 
+/**
+ * Classify the traffic received on the UDP socket, by only looking at the
+ * leading bytes of the datagram.
+ *
+ * Messages whose header appears to be both that of a Gnutella message
+ * and that of a semi-reliable UDP fragment are flagged as AMBIGUOUS, to be
+ * further inspected by udp_intuit_traffic_type().
+ *
+ * This routine is thread-safe.
+ *
+ * @return classified type
+ */
+static enum udp_traffic
+udp_classify_traffic(const void *data, size_t len)
+{
+	enum udp_traffic utp;
+
+	utp = udp_check_semi_reliable(data, len);
+
+	if (len >= GTA_HEADER_SIZE) {
+		uint16 size;			/* Payload size, from the Gnutella message */
+
+		switch (gmsg_size_valid(data, &size)) {
+		case GMSG_VALID:
+		case GMSG_VALID_MARKED:
+			if ((size_t) size + GTA_HEADER_SIZE == len) {
+				uint8 function;
+
+				/*
+				 * If the header cannot be that of a known semi-reliable
+				 * UDP protocol, there is no ambiguity.
+				 */
+
+				if (UNKNOWN != utp)
+					return AMBIGUOUS;
+
+				function = gnutella_header_get_function(data);
+
+				return GTA_MSG_DHT == function ?
+					DHT : GTA_MSG_RUDP == function ?
+					RUDP : GNUTELLA;
+			}
+			break;
+		case GMSG_VALID_NO_PROCESS:
+		case GMSG_INVALID:
+			break;
+		}
+	}
+
+	return utp;
+}
+
 /**
  * Identify the traffic type received on the UDP socket.
  *
@@ -699,248 +754,244 @@ tag_known:
  * header inspections) is brought down to less than 1 in a billion, making
  * it perfectly safe in practice.
  *
+ * @param s			the receiving socket
+ * @param data		start of received data
+ * @param len		length of received data
+ * @param utp		the type returned by udp_classify_traffic()
+ *
  * @return intuited type
  */
 static enum udp_traffic
 udp_intuit_traffic_type(const gnutella_socket_t *s,
-	const void *data, size_t len)
+	const void *data, size_t len, enum udp_traffic utp)
 {
-	enum udp_traffic utp;
+	uint16 size;			/* Payload size, from the Gnutella message */
+	gmsg_valid_t valid;
+	uint8 function, hops, ttl;
+
+	if G_LIKELY(AMBIGUOUS != utp)
+		return utp;
+
+	/*
+	 * Message is ambiguous: its leading header appears to be
+	 * both a legitimate Gnutella message and a semi-reliable UDP
+	 * header.
+	 *
+	 * We have to apply some heuristics to decide whether to handle
+	 * the message as a Gnutella one or as a semi-reliable UDP one,
+	 * knowing that if we improperly classify it, the message will
+	 * not be handled correctly.
+	 *
+	 * Note that this is highly unlikely.  There is about 1 chance
+	 * in 10 millions (1 / 2^23 exactly) to mis-interpret a random
+	 * Gnutella MUID as the start of one of the semi-reliable
+	 * protocols we support.  Our discriminating logic probes a
+	 * few more bytes (say 2 at least) which are going to let us
+	 * decide with about 99% certainety.  So mis-classification
+	 * will occur only once per billion -- a ratio which is OK.
+	 *
+	 * We could also mistakenely handle a semi-reliable UDP message
+	 * as a Gnutella one.  For that to happen, the payload must
+	 * contain a field that will be exactly the message size,
+	 * a 1 / 2^32 event (since the size is 4 bytes in Gnutella).
+	 * However, if message flags are put to use for Gnutella UDP,
+	 * this ratio could lower to 1 / 2^16 and that is too large
+	 * a chance (about 1.5 in 100,000).
+	 *
+	 * So when we think an ambiguous message could be a valid
+	 * Gnutella message, we also check whether the message could
+	 * not be interpreted as a valid semi-reliable UDP one, and
+	 * we give priority to that classification if we have a match:
+	 * correct sequence number, consistent count and emitting host.
+	 * This checks roughly 3 more bytes in the message, yielding
+	 * a misclassification for about 1 / 2^(16+24) random cases.
+	 */
 
 	utp = udp_check_semi_reliable(data, len);
+	valid = gmsg_size_valid(data, &size);
+	function = gnutella_header_get_function(data);
+	hops = gnutella_header_get_hops(data);
+	ttl = gnutella_header_get_ttl(data);
 
-	if (len >= GTA_HEADER_SIZE) {
-		uint16 size;			/* Payload size, from the Gnutella message */
-		gmsg_valid_t valid;
+	gnet_stats_inc_general(GNR_UDP_AMBIGUOUS);
 
-		valid = gmsg_size_valid(data, &size);
+	if (GNET_PROPERTY(udp_debug)) {
+		g_debug("UDP ambiguous datagram from %s: "
+			"%zu bytes (%u-byte payload), "
+			"function=%u, hops=%u, TTL=%u, size=%u",
+			host_addr_port_to_string(s->addr, s->port),
+			len, size, function, hops, ttl,
+			gnutella_header_get_size(data));
+		dump_hex(stderr, "UDP ambiguous datagram", data, len);
+	}
 
-		switch (valid) {
-		case GMSG_VALID:
-		case GMSG_VALID_MARKED:
-			if ((size_t) size + GTA_HEADER_SIZE == len) {
-				uint8 function, hops, ttl;
+	switch (function) {
+	case GTA_MSG_DHT:
+		/*
+		 * A DHT message must be larger than KDA_HEADER_SIZE bytes.
+		 */
 
-				function = gnutella_header_get_function(data);
+		if (len < KDA_HEADER_SIZE)
+			break;		/* Not a DHT message */
 
-				/*
-				 * If the header cannot be that of a known semi-reliable
-				 * UDP protocol, there is no ambiguity.
-				 */
+		/*
+		 * DHT messages have no bits defined in the size field
+		 * to mark them.
+		 */
 
-				if (UNKNOWN == utp) {
-					return GTA_MSG_DHT == function ?
-						DHT : GTA_MSG_RUDP == function ?
-						RUDP : GNUTELLA;
-				}
+		if (valid != GMSG_VALID)
+			break;		/* Higest bit set, not a DHT message */
 
-				/*
-				 * Message is ambiguous: its leading header appears to be
-				 * both a legitimate Gnutella message and a semi-reliable UDP
-				 * header.
-				 *
-				 * We have to apply some heuristics to decide whether to handle
-				 * the message as a Gnutella one or as a semi-reliable UDP one,
-				 * knowing that if we improperly classify it, the message will
-				 * not be handled correctly.
-				 *
-				 * Note that this is highly unlikely.  There is about 1 chance
-				 * in 10 millions (1 / 2^23 exactly) to mis-interpret a random
-				 * Gnutella MUID as the start of one of the semi-reliable
-				 * protocols we support.  Our discriminating logic probes a
-				 * few more bytes (say 2 at least) which are going to let us
-				 * decide with about 99% certainety.  So mis-classification
-				 * will occur only once per billion -- a ratio which is OK.
-				 *
-				 * We could also mistakenely handle a semi-reliable UDP message
-				 * as a Gnutella one.  For that to happen, the payload must
-				 * contain a field that will be exactly the message size,
-				 * a 1 / 2^32 event (since the size is 4 bytes in Gnutella).
-				 * However, if message flags are put to use for Gnutella UDP,
-				 * this ratio could lower to 1 / 2^16 and that is too large
-				 * a chance (about 1.5 in 100,000).
-				 *
-				 * So when we think an ambiguous message could be a valid
-				 * Gnutella message, we also check whether the message could
-				 * not be interpreted as a valid semi-reliable UDP one, and
-				 * we give priority to that classification if we have a match:
-				 * correct sequence number, consistent count and emitting host.
-				 * This checks roughly 3 more bytes in the message, yielding
-				 * a misclassification for about 1 / 2^(16+24) random cases.
-				 */
+		/*
+		 * If it is a DHT message, it must have a valid opcode.
+		 */
 
-				hops = gnutella_header_get_hops(data);
-				ttl = gnutella_header_get_ttl(data);
+		function = kademlia_header_get_function(data);
 
-				gnet_stats_inc_general(GNR_UDP_AMBIGUOUS);
+		if (function > KDA_MSG_MAX_ID)
+			break;		/* Not a valid DHT opcode */
 
-				if (GNET_PROPERTY(udp_debug)) {
-					g_debug("UDP ambiguous datagram from %s: "
-						"%zu bytes (%u-byte payload), "
-						"function=%u, hops=%u, TTL=%u, size=%u",
-						host_addr_port_to_string(s->addr, s->port),
-						len, size, function, hops, ttl,
-						gnutella_header_get_size(data));
-					dump_hex(stderr, "UDP ambiguous datagram", data, len);
-				}
+		/*
+		 * Check the contact address length: it must be 4 in the
+		 * header, because there is only room for an IPv4 address.
+		 */
 
-				switch (function) {
-				case GTA_MSG_DHT:
-					/*
-					 * A DHT message must be larger than KDA_HEADER_SIZE bytes.
-					 */
-
-					if (len < KDA_HEADER_SIZE)
-						break;		/* Not a DHT message */
-
-					/*
-					 * DHT messages have no bits defined in the size field
-					 * to mark them.
-					 */
-
-					if (valid != GMSG_VALID)
-						break;		/* Higest bit set, not a DHT message */
-
-					/*
-					 * If it is a DHT message, it must have a valid opcode.
-					 */
-
-					function = kademlia_header_get_function(data);
-
-					if (function > KDA_MSG_MAX_ID)
-						break;		/* Not a valid DHT opcode */
-
-					/*
-					 * Check the contact address length: it must be 4 in the
-					 * header, because there is only room for an IPv4 address.
-					 */
-
-					if (!kademlia_header_constants_ok(data))
-						break;		/* Not a valid Kademlia header */
-
-					/*
-					 * Make sure we're not mistaking a valid semi-reliable UDP
-					 * message as a DHT message.
-					 */
-
-					if (udp_is_valid_semi_reliable(utp, s, data, len))
-						break;		/* Validated it as semi-reliable UDP */
-
-					g_warning("UDP ambiguous message from %s (%zu bytes total),"
-						" DHT function is %s",
-						host_addr_port_to_string(s->addr, s->port),
-						len, kmsg_name(function));
-
-					return DHT;
-
-				case GTA_MSG_INIT:
-				case GTA_MSG_PUSH_REQUEST:
-				case GTA_MSG_SEARCH:
-					/*
-					 * No incoming messages of this type can have a TTL
-					 * indicating a deflated payload, since there is no
-					 * guarantee the host would be able to read it (deflated
-					 * UDP is negotiated and can therefore only come from a
-					 * response).
-					 */
-
-					if (ttl & GTA_UDP_DEFLATED)
-						break;			/* Not Gnutella, we're positive */
-
-					/* FALL THROUGH */
-
-				case GTA_MSG_INIT_RESPONSE:
-				case GTA_MSG_VENDOR:
-				case GTA_MSG_SEARCH_RESULTS:
-					/*
-					 * To further discriminate, look at the hop count.
-					 * Over UDP, the hop count will be low (0 or 1 mostly)
-					 * and definitely less than 3 since the only UDP-relayed
-					 * messages are from GUESS, and they can travel at most
-					 * through a leaf and an ultra node before reaching us.
-					 */
-
-					if (hops >= 3U)
-						break;			/* Gnutella is very unlikely */
-
-					/*
-					 * Check the TTL, cleared from bits that indicate
-					 * support for deflated UDP or a deflated payload.
-					 * No servent should send a TTL greater than 7, which
-					 * was the de-facto limit in the early Gnutella days.
-					 */
-
-					if ((ttl & ~(GTA_UDP_CAN_INFLATE | GTA_UDP_DEFLATED)) > 7U)
-						break;			/* Gnutella is very unlikely */
-
-					/*
-					 * Make sure we're not mistaking a valid semi-reliable UDP
-					 * message as a Gnutella message.
-					 */
-
-					if (udp_is_valid_semi_reliable(utp, s, data, len))
-						break;		/* Validated it as semi-reliable UDP */
-
-					g_warning("UDP ambiguous message from %s (%zu bytes total),"
-						" Gnutella function is %s, hops=%u, TTL=%u",
-						host_addr_port_to_string(s->addr, s->port),
-						len, gmsg_name(function), hops, ttl);
-
-					return GNUTELLA;
-
-				case GTA_MSG_RUDP:
-					/*
-					 * RUDP traffic is special: the only meaningful fields
-					 * of the Gnutella header are the opcode field (which we
-					 * have read here since we fall into this case) and the
-					 * Gnutella header size.
-					 *
-					 * The TTL and hops fields cannot be interpreted to
-					 * disambiguate, so our only option is deeper inspection.
-					 */
-
-					if (udp_is_valid_semi_reliable(utp, s, data, len))
-						break;		/* Validated it as semi-reliable UDP */
-
-					g_warning("UDP ambiguous message from %s (%zu bytes total),"
-						" interpreted as RUDP packet",
-						host_addr_port_to_string(s->addr, s->port), len);
-
-					return RUDP;
-
-				case GTA_MSG_STANDARD:	/* Nobody is using this function code */
-				default:
-					break;				/* Not a function we expect over UDP */
-				}
+		if (!kademlia_header_constants_ok(data))
+			break;		/* Not a valid Kademlia header */
 
-				/*
-				 * Will be handled as semi-reliable UDP.
-				 */
+		/*
+		 * Make sure we're not mistaking a valid semi-reliable UDP
+		 * message as a DHT message.
+		 */
 
-				gnet_stats_inc_general(GNR_UDP_AMBIGUOUS_AS_SEMI_RELIABLE);
+		if (udp_is_valid_semi_reliable(utp, s, data, len))
+			break;		/* Validated it as semi-reliable UDP */
 
-				{
-					udp_tag_t tag;
+		g_warning("UDP ambiguous message from %s (%zu bytes total),"
+			" DHT function is %s",
+			host_addr_port_to_string(s->addr, s->port),
+			len, kmsg_name(function));
 
-					memcpy(tag.value, data, sizeof tag.value);
+		return DHT;
 
-					g_warning("UDP ambiguous message (%zu bytes total), "
-						"not Gnutella (function is %d, hops=%u, TTL=%u) "
-						"handling as semi-reliable UDP (tag=\"%s\")",
-						len, function, hops, ttl, udp_tag_to_string(tag));
-				}
-				return utp;
-			}
-			/* FALL THROUGH */
-		case GMSG_VALID_NO_PROCESS:
-		case GMSG_INVALID:
-			break;
-		}
+	case GTA_MSG_INIT:
+	case GTA_MSG_PUSH_REQUEST:
+	case GTA_MSG_SEARCH:
+		/*
+		 * No incoming messages of this type can have a TTL
+		 * indicating a deflated payload, since there is no
+		 * guarantee the host would be able to read it (deflated
+		 * UDP is negotiated and can therefore only come from a
+		 * response).
+		 */
+
+		if (ttl & GTA_UDP_DEFLATED)
+			break;			/* Not Gnutella, we're positive */
+
+		/* FALL THROUGH */
+
+	case GTA_MSG_INIT_RESPONSE:
+	case GTA_MSG_VENDOR:
+	case GTA_MSG_SEARCH_RESULTS:
+		/*
+		 * To further discriminate, look at the hop count.
+		 * Over UDP, the hop count will be low (0 or 1 mostly)
+		 * and definitely less than 3 since the only UDP-relayed
+		 * messages are from GUESS, and they can travel at most
+		 * through a leaf and an ultra node before reaching us.
+		 */
+
+		if (hops >= 3U)
+			break;			/* Gnutella is very unlikely */
+
+		/*
+		 * Check the TTL, cleared from bits that indicate
+		 * support for deflated UDP or a deflated payload.
+		 * No servent should send a TTL greater than 7, which
+		 * was the de-facto limit in the early Gnutella days.
+		 */
+
+		if ((ttl & ~(GTA_UDP_CAN_INFLATE | GTA_UDP_DEFLATED)) > 7U)
+			break;			/* Gnutella is very unlikely */
+
+		/*
+		 * Make sure we're not mistaking a valid semi-reliable UDP
+		 * message as a Gnutella message.
+		 */
+
+		if (udp_is_valid_semi_reliable(utp, s, data, len))
+			break;		/* Validated it as semi-reliable UDP */
+
+		g_warning("UDP ambiguous message from %s (%zu bytes total),"
+			" Gnutella function is %s, hops=%u, TTL=%u",
+			host_addr_port_to_string(s->addr, s->port),
+			len, gmsg_name(function), hops, ttl);
+
+		return GNUTELLA;
+
+	case GTA_MSG_RUDP:
+		/*
+		 * RUDP traffic is special: the only meaningful fields
+		 * of the Gnutella header are the opcode field (which we
+		 * have read here since we fall into this case) and the
+		 * Gnutella header size.
+		 *
+		 * The TTL and hops fields cannot be interpreted to
+		 * disambiguate, so our only option is deeper inspection.
+		 */
+
+		if (udp_is_valid_semi_reliable(utp, s, data, len))
+			break;		/* Validated it as semi-reliable UDP */
+
+		g_warning("UDP ambiguous message from %s (%zu bytes total),"
+			" interpreted as RUDP packet",
+			host_addr_port_to_string(s->addr, s->port), len);
+
+		return RUDP;
+
+	case GTA_MSG_STANDARD:	/* Nobody is using this function code */
+	default:
+		break;				/* Not a function we expect over UDP */
 	}
 
+	/*
+	 * Will be handled as semi-reliable UDP.
+	 */
+
+	gnet_stats_inc_general(GNR_UDP_AMBIGUOUS_AS_SEMI_RELIABLE);
+
+	{
+		udp_tag_t tag;
+
+		memcpy(tag.value, data, sizeof tag.value);
+
+		g_warning("UDP ambiguous message (%zu bytes total), "
+			"not Gnutella (function is %d, hops=%u, TTL=%u) "
+			"handling as semi-reliable UDP (tag=\"%s\")",
+			len, function, hops, ttl, udp_tag_to_string(tag));
+	}
 	return utp;
 }
 
+/**
+ * Classify a datagram received on the UDP socket, without consulting any
+ * other information than the datagram itself.
+ *
+ * This routine is thread-safe, allowing the classification to be done
+ * by the thread reading the socket.
+ *
+ * @param data			start of received data
+ * @param len			length of received data
+ * @param truncated		whether received datagram was truncated
+ *
+ * @return opaque traffic type, to give to udp_received_classified().
+ */
+uint8
+udp_traffic_classify(const void *data, size_t len, bool truncated)
+{
+	return truncated ? UNKNOWN : udp_classify_traffic(data, len);
+}
+
 /**
  * Notification from the socket layer that we got a new datagram.
  *
@@ -955,6 +1006,23 @@ udp_intuit_traffic_type(const gnutella_socket_t *s,
 void
 udp_received(const gnutella_socket_t *s,
 	const void *data, size_t len, bool truncated)
+{
+	udp_received_classified(s, data, len, truncated,
+		udp_traffic_classify(data, len, truncated));
+}
+
+/**
+ * Process new datagram, already classified by udp_traffic_classify().
+ *
+ * @param s				the receiving socket (with s->addr and s->port set)
+ * @param data			start of received data
+ * @param len			length of received data
+ * @param truncated		whether received datagram was truncated
+ * @param traffic		the traffic type computed by udp_traffic_classify()
+ */
+void
+udp_received_classified(const gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated, uint8 traffic)
 {
 	gnutella_node_t *n;
 	bool bogus = FALSE, dht = FALSE, rudp = FALSE, g2 = FALSE;
@@ -984,7 +1052,7 @@ udp_received(const gnutella_socket_t *s,
 		enum udp_traffic utp;
 		rxdrv_t *rx;
 
-		utp = udp_intuit_traffic_type(s, data, len);
+		utp = udp_intuit_traffic_type(s, data, len, traffic);
 
 		switch (utp) {
 		case GNUTELLA:
@@ -998,6 +1066,8 @@ udp_received(const gnutella_socket_t *s,
 			goto unreliable;
 		case UNKNOWN:
 			goto unknown;
+		case AMBIGUOUS:
+			g_assert_not_reached();
 		case SEMI_RELIABLE_GTA:
 			break;
 		case SEMI_RELIABLE_GND:
@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * UDP ingress thread.
+ *
+ * When the "udp_ingress_thread" property is set, the Gnutella UDP sockets
+ * are no longer read by the main thread: a dedicated thread receives the
+ * datagrams, drops the empty ones and classifies the others (Gnutella, DHT,
+ * RUDP or semi-reliable UDP) by looking at their headers.
+ *
+ * Accepted datagrams are handed over to the main thread through a ring with
+ * a single producer (the ingress thread) and a single consumer (the main
+ * thread), which needs no locking.  The main thread is only notified when
+ * the ring becomes non-empty, and it processes the datagrams in batches.
+ * When the ring is full, new datagrams are dropped.
+ *
+ * Everything that depends on the state of the main thread, such as the
+ * bogon and hostile address checks or the semi-reliable UDP sequence
+ * checks needed to disambiguate a datagram, is still performed by the
+ * main thread when processing the datagram.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "udp_ingress.h"
+
+#include "gnet_stats.h"
+#include "sockets.h"
+#include "udp.h"
+
+#include "lib/atomic.h"
+#include "lib/compat_poll.h"
+#include "lib/halloc.h"
+#include "lib/misc.h"
+#include "lib/mutex.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define UDP_INGRESS_RING	1024	/**< Ring size, must be a power of 2 */
+#define UDP_INGRESS_SOCKETS	2		/**< Max sockets read (IPv4 and IPv6) */
+#define UDP_INGRESS_BURST	64		/**< Max datagrams read per socket */
+#define UDP_INGRESS_DRAIN	256		/**< Max datagrams processed per event */
+#define UDP_INGRESS_POLL_MS	250		/**< Poll period, to notice exiting */
+
+/**
+ * A datagram held in the ring.
+ */
+struct udp_ingress_dgram {
+	void *data;					/**< Datagram data (walloc()'ed) */
+	size_t len;					/**< Length of data */
+	struct udp_dgram dg;		/**< Reception attributes */
+	uint serial;				/**< Serial number of socket attachment */
+	uint8 traffic;				/**< Type from udp_traffic_classify() */
+};
+
+/**
+ * A socket read by the ingress thread.
+ */
+struct udp_ingress_sock {
+	gnutella_socket_t *s;		/**< The socket, NULL if slot unused */
+	void *buf;					/**< Reception buffer */
+	size_t size;				/**< Size of reception buffer */
+	int fd;						/**< Socket descriptor */
+	uint serial;				/**< Serial number of attachment */
+};
+
+/**
+ * The ingress thread state.
+ *
+ * The socket table is only modified by the main thread, with the lock held,
+ * hence the main thread can read it without locking.  The ring head is only
+ * written by the ingress thread and the ring tail by the main thread.
+ */
+static struct udp_ingress {
+	mutex_t lock;				/**< Protects the socket table and flags */
+	struct udp_ingress_sock sock[UDP_INGRESS_SOCKETS];
+	struct udp_ingress_dgram ring[UDP_INGRESS_RING];
+	uint head;					/**< Next ring slot to fill */
+	uint tail;					/**< Next ring slot to process */
+	uint serial;				/**< Last attachment serial number */
+	uint tid;					/**< Ingress thread ID, when running */
+	atomic_lock_t posted;		/**< Whether processing event was posted */
+	uint8 running;				/**< Whether ingress thread was created */
+	uint8 exiting;				/**< Set when thread must terminate */
+} udp_ingress = {
+	MUTEX_INIT,		/* All other fields zeroed */
+};
+
+#define UDP_INGRESS_LOCK	mutex_lock(&udp_ingress.lock)
+#define UDP_INGRESS_UNLOCK	mutex_unlock(&udp_ingress.lock)
+
+/**
+ * Find attachment by serial number.
+ *
+ * @return the attached socket slot, NULL if socket was detached.
+ */
+static struct udp_ingress_sock *
+udp_ingress_by_serial(uint serial)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(udp_ingress.sock); i++) {
+		struct udp_ingress_sock *is = &udp_ingress.sock[i];
+
+		if (is->s != NULL && serial == is->serial)
+			return is;
+	}
+
+	return NULL;
+}
+
+/**
+ * Find attachment of socket.
+ *
+ * @return the attached socket slot, NULL if socket is not attached.
+ */
+static struct udp_ingress_sock *
+udp_ingress_find(const gnutella_socket_t *s)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(udp_ingress.sock); i++) {
+		struct udp_ingress_sock *is = &udp_ingress.sock[i];
+
+		if (s == is->s)
+			return is;
+	}
+
+	return NULL;
+}
+
+/**
+ * Process the datagrams held in the ring, in the main thread.
+ *
+ * @return TRUE if datagrams remain in the ring.
+ */
+static bool
+udp_ingress_drain(void)
+{
+	uint head, tail = udp_ingress.tail, n = 0;
+
+	head = atomic_uint_get(&udp_ingress.head);
+	atomic_mb();		/* Read ring slots after head */
+
+	gnet_stats_max_general(GNR_UDP_INGRESS_BACKLOG_MAX, head - tail);
+
+	while (tail != head && n++ < UDP_INGRESS_DRAIN) {
+		struct udp_ingress_dgram *d;
+		struct udp_ingress_sock *is;
+
+		d = &udp_ingress.ring[tail & (UDP_INGRESS_RING - 1)];
+
+		/*
+		 * The socket may have been detached since the datagram was read,
+		 * in which case the datagram is dropped.  The lookup is done for
+		 * each datagram because processing may close the socket.
+		 */
+
+		is = udp_ingress_by_serial(d->serial);
+
+		if (is != NULL && socket_udp_received(is->s, d->len, &d->dg)) {
+			udp_received_classified(is->s,
+				d->data, d->len, d->dg.truncated, d->traffic);
+		}
+
+		wfree(d->data, d->len);
+		d->data = NULL;
+
+		atomic_mb();		/* Slot consumed before tail is moved */
+		atomic_uint_set(&udp_ingress.tail, ++tail);
+	}
+
+	return tail != head;
+}
+
+/**
+ * Event posted to the main thread when datagrams were queued.
+ */
+static void
+udp_ingress_drain_event(void *unused_arg)
+{
+	(void) unused_arg;
+
+	/*
+	 * Clear the flag before draining: datagrams queued from now on will
+	 * cause a new event to be posted.
+	 */
+
+	atomic_release(&udp_ingress.posted);
+
+	if (udp_ingress_drain() && atomic_acquire(&udp_ingress.posted))
+		teq_safe_post(THREAD_MAIN_ID, udp_ingress_drain_event, NULL);
+}
+
+/**
+ * Queue datagram read by the ingress thread in the ring.
+ *
+ * @return TRUE if queued, FALSE if the ring was full.
+ */
+static bool
+udp_ingress_push(const struct udp_ingress_sock *is,
+	size_t len, const struct udp_dgram *dg)
+{
+	struct udp_ingress_dgram *d;
+	uint head = udp_ingress.head;
+
+	if (head - atomic_uint_get(&udp_ingress.tail) >= UDP_INGRESS_RING) {
+		gnet_stats_inc_general(GNR_UDP_INGRESS_OVERFLOW);
+		return FALSE;
+	}
+
+	d = &udp_ingress.ring[head & (UDP_INGRESS_RING - 1)];
+	d->data = wcopy(is->buf, len);
+	d->len = len;
+	d->dg = *dg;
+	d->serial = is->serial;
+	d->traffic = udp_traffic_classify(d->data, len, dg->truncated);
+
+	atomic_mb();		/* Slot filled before head is moved */
+	atomic_uint_set(&udp_ingress.head, head + 1);
+
+	return TRUE;
+}
+
+/**
+ * Read the datagrams pending on the socket, in the ingress thread.
+ *
+ * This is called with the lock held, so that the socket cannot be detached.
+ *
+ * @return the amount of datagrams queued.
+ */
+static uint
+udp_ingress_read(const struct udp_ingress_sock *is)
+{
+	uint i, n = 0;
+
+	for (i = 0; i < UDP_INGRESS_BURST; i++) {
+		struct udp_dgram dg;
+		ssize_t r;
+
+		r = socket_udp_recv(is->s, is->buf, is->size, &dg);
+
+		if ((ssize_t) -1 == r) {
+			/* ECONNRESET is meaningless with UDP but happens on Windows */
+			if (!is_temporary_error(errno) && errno != ECONNRESET) {
+				s_warning("%s(): ignoring datagram reception error: %m",
+					G_STRFUNC);
+			}
+			break;
+		}
+
+		if G_UNLIKELY(0 == r) {
+			gnet_stats_inc_general(GNR_UDP_UNPROCESSED_MESSAGE);
+			continue;
+		}
+
+		if (udp_ingress_push(is, r, &dg))
+			n++;
+	}
+
+	if (n != 0)
+		gnet_stats_count_general(GNR_UDP_INGRESS_QUEUED, n);
+
+	return n;
+}
+
+/**
+ * Ingress thread main loop.
+ */
+static void *
+udp_ingress_thread_main(void *unused_arg)
+{
+	(void) unused_arg;
+
+	thread_set_name("UDP ingress");
+
+	for (;;) {
+		struct pollfd fds[UDP_INGRESS_SOCKETS];
+		uint serial[UDP_INGRESS_SOCKETS];
+		uint i, n = 0, queued = 0;
+		int r;
+
+		/*
+		 * Snapshot the attached sockets: the socket table may change whilst
+		 * we are waiting, hence sockets are looked up again by serial number
+		 * before being read.
+		 */
+
+		UDP_INGRESS_LOCK;
+
+		if (udp_ingress.exiting) {
+			UDP_INGRESS_UNLOCK;
+			break;
+		}
+
+		for (i = 0; i < N_ITEMS(udp_ingress.sock); i++) {
+			const struct udp_ingress_sock *is = &udp_ingress.sock[i];
+
+			if (NULL == is->s)
+				continue;
+
+			fds[n].fd = is->fd;
+			fds[n].events = POLLIN;
+			fds[n].revents = 0;
+			serial[n] = is->serial;
+			n++;
+		}
+
+		UDP_INGRESS_UNLOCK;
+
+		r = compat_poll(fds, n, UDP_INGRESS_POLL_MS);
+
+		if (r <= 0) {
+			if (-1 == r && !is_temporary_error(errno)) {
+				s_warning("%s(): poll() failed: %m", G_STRFUNC);
+				thread_sleep_ms(UDP_INGRESS_POLL_MS);
+			}
+			continue;
+		}
+
+		UDP_INGRESS_LOCK;
+
+		for (i = 0; i < n; i++) {
+			const struct udp_ingress_sock *is;
+
+			if (0 == fds[i].revents)
+				continue;
+
+			is = udp_ingress_by_serial(serial[i]);
+
+			if (is != NULL)
+				queued += udp_ingress_read(is);
+		}
+
+		UDP_INGRESS_UNLOCK;
+
+		if (queued != 0 && atomic_acquire(&udp_ingress.posted))
+			teq_safe_post(THREAD_MAIN_ID, udp_ingress_drain_event, NULL);
+	}
+
+	return NULL;
+}
+
+/**
+ * Make sure the ingress thread is running.
+ *
+ * @return TRUE if it is.
+ */
+static bool
+udp_ingress_spawn(void)
+{
+	int r;
+
+	if G_LIKELY(udp_ingress.running)
+		return TRUE;
+
+	udp_ingress.exiting = FALSE;
+
+	r = thread_create(udp_ingress_thread_main, NULL,
+			THREAD_F_NO_CANCEL | THREAD_F_NO_POOL, THREAD_STACK_MIN);
+
+	if (-1 == r) {
+		g_warning("%s(): cannot create UDP ingress thread: %m", G_STRFUNC);
+		return FALSE;
+	}
+
+	udp_ingress.tid = r;
+	udp_ingress.running = TRUE;
+	return TRUE;
+}
+
+/**
+ * Forget about socket, which will no longer be read by the ingress thread.
+ *
+ * This is also the callback invoked by the socket layer when the socket
+ * is disabled or freed.
+ */
+static void
+udp_ingress_remove(gnutella_socket_t *s)
+{
+	struct udp_ingress_sock *is;
+
+	socket_check(s);
+
+	is = udp_ingress_find(s);
+
+	if (NULL == is)
+		return;
+
+	/*
+	 * The ingress thread only reads sockets with the lock held, so once
+	 * we have removed the socket from the table, it can no longer read it.
+	 * Datagrams already queued for the socket will be dropped.
+	 */
+
+	UDP_INGRESS_LOCK;
+	HFREE_NULL(is->buf);
+	ZERO(is);
+	UDP_INGRESS_UNLOCK;
+}
+
+/**
+ * Let the ingress thread read the datagrams received on the UDP socket.
+ *
+ * When the thread cannot be created, the socket stays read by the main
+ * thread.
+ */
+void
+udp_ingress_attach(gnutella_socket_t *s)
+{
+	struct udp_ingress_sock *is;
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(thread_is_main());
+
+	if (udp_ingress_find(s) != NULL)
+		return;
+
+	is = udp_ingress_find(NULL);		/* Look for a free slot */
+
+	if (NULL == is) {
+		g_carp("%s(): cannot attach more than %u sockets",
+			G_STRFUNC, (uint) N_ITEMS(udp_ingress.sock));
+		return;
+	}
+
+	if (!udp_ingress_spawn())
+		return;
+
+	/*
+	 * Stop reading from the main thread before registering the socket.
+	 */
+
+	socket_udp_offload(s, udp_ingress_remove);
+
+	UDP_INGRESS_LOCK;
+	is->size = s->buf_size;
+	is->buf = halloc(is->size);
+	is->fd = s->file_desc;
+	is->serial = ++udp_ingress.serial;
+	if G_UNLIKELY(0 == is->serial)
+		is->serial = ++udp_ingress.serial;
+	is->s = s;
+	UDP_INGRESS_UNLOCK;
+}
+
+/**
+ * Resume reading the datagrams of the UDP socket from the main thread.
+ */
+void
+udp_ingress_detach(gnutella_socket_t *s)
+{
+	socket_check(s);
+	g_assert(thread_is_main());
+
+	if (NULL == udp_ingress_find(s))
+		return;
+
+	udp_ingress_remove(s);
+	socket_udp_offload(s, NULL);
+}
+
+/**
+ * Stop the ingress thread and discard the datagrams it queued.
+ */
+void
+udp_ingress_close(void)
+{
+	uint i;
+
+	if (!udp_ingress.running)
+		return;
+
+	UDP_INGRESS_LOCK;
+	udp_ingress.exiting = TRUE;
+	UDP_INGRESS_UNLOCK;
+
+	if (-1 == thread_join(udp_ingress.tid, NULL))
+		g_warning("%s(): cannot join with UDP ingress thread: %m", G_STRFUNC);
+
+	udp_ingress.running = FALSE;
+
+	while (udp_ingress.tail != udp_ingress.head) {
+		struct udp_ingress_dgram *d;
+
+		d = &udp_ingress.ring[udp_ingress.tail++ & (UDP_INGRESS_RING - 1)];
+		wfree(d->data, d->len);
+		d->data = NULL;
+	}
+
+	for (i = 0; i < N_ITEMS(udp_ingress.sock); i++) {
+		struct udp_ingress_sock *is = &udp_ingress.sock[i];
+
+		HFREE_NULL(is->buf);
+		ZERO(is);
+	}
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * UDP ingress thread.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_udp_ingress_h_
+#define _core_udp_ingress_h_
+
+#include "common.h"
+
+struct gnutella_socket;
+
+/*
+ * Public interface.
+ */
+
+void udp_ingress_attach(struct gnutella_socket *s);
+void udp_ingress_detach(struct gnutella_socket *s);
+void udp_ingress_close(void);
+
+#endif /* _core_udp_ingress_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -792,6 +792,34 @@ udp_sched_service(udp_sched_t *us, struct udp_service_ctx *ctx)
 	hash_list_foreach(us->stacks, udp_sched_tx_service, ctx);
 }
 
+/**
+ * Start or stop batching of the datagrams sent on our UDP sockets.
+ *
+ * @param us		the UDP scheduler
+ * @param start		TRUE to start batching, FALSE to flush batched datagrams
+ */
+static void
+udp_sched_batch(const udp_sched_t *us, bool start)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(us->bio); i++) {
+		gnutella_socket_t *s;
+
+		if (NULL == us->bio[i])
+			continue;
+
+		s = (*us->get_socket)(udp_sched_net_type[i]);
+
+		if (s != NULL) {
+			if (start)
+				socket_udp_batch_start(s);
+			else
+				socket_udp_batch_flush(s);
+		}
+	}
+}
+
 /**
  * Invoked each time a new bandwidth timeslice begins.
  */
@@ -825,6 +853,7 @@ udp_sched_begin(void *data, int source, inputevt_cond_t cond)
 	 */
 
 	us->used_all = FALSE;
+	udp_sched_batch(us, TRUE);
 
 	do {
 		udp_sched_seen_clear(us);
@@ -850,6 +879,8 @@ udp_sched_begin(void *data, int source, inputevt_cond_t cond)
 		udp_sched_service(us, &ctx);
 	}
 
+	udp_sched_batch(us, FALSE);
+
 	udp_sched_log(4, "%p: done (b/w %s, %zu bytes buffered%s)",
 		us, us->used_all ? "gone" : "available", us->buffered,
 		us->flow_controlled ? ", flow-controlled" : "");
@@ -5779,6 +5779,59 @@ upload_handle_exception(struct upload *u, inputevt_cond_t cond)
 	return FALSE;
 }
 
+/**
+ * Account for `written' bytes sent from the file to the remote host, and
+ * complete the upload when everything was sent.
+ */
+static void
+upload_sent(struct upload *u, ssize_t written)
+{
+	upload_check(u);
+	g_assert(written > 0);
+
+	gnet_prop_set_guint64_val(PROP_UL_BYTE_COUNT,
+		GNET_PROPERTY(ul_byte_count) + written);
+
+	u->last_update = tm_time();
+	u->sent += written;
+	if (u->file_info) {
+		fi_increase_uploaded(u->file_info, written);
+	}
+
+	/* This upload is complete */
+	if (u->pos > u->end) {
+
+		if (u->sf) {
+			upload_stats_file_complete(u->sf, u->end - u->skip + 1);
+			u->accounted = TRUE;	/* Called upload_stats_file_complete() */
+		}
+		upload_completed(u);
+	}
+}
+
+/**
+ * Completion callback for bio_uring_sendfile().
+ */
+static void
+upload_uring_sent(void *arg, ssize_t written, int error)
+{
+	struct upload *u = cast_to_upload(arg);
+
+	if ((ssize_t) -1 == written) {
+		if (!is_temporary_error(error)) {
+			socket_eof(u->socket);
+			upload_remove(u, N_("Data write error: %s"), g_strerror(error));
+		}
+		return;
+	} else if (0 == written) {
+		upload_remove(u, N_("No bytes written, source may be gone"));
+		return;
+	}
+
+	u->pos += written;
+	upload_sent(u, written);
+}
+
 /**
  * Called when output source can accept more data.
  */
@@ -5808,6 +5861,28 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 	amount = u->end - u->pos + 1;
 	g_assert(amount > 0);
 
+	/*
+	 * When io_uring is available, the file read and the socket write are
+	 * queued and performed asynchronously, batched with all the other
+	 * active uploads.  Completion is handled by upload_uring_sent().
+	 */
+
+	if (!socket_uses_tls(u->socket) && bio_uring_enabled()) {
+		int e;
+
+		e = bio_uring_sendfile(u->bio, u->file, u->pos,
+				MIN(amount, READ_BUF_SIZE), upload_uring_sent, u);
+
+		if (0 == e) {
+			u->bpos = u->bsize = 0;		/* Buffered data now stale */
+			return;
+		}
+		if (is_temporary_error(e))
+			return;
+
+		/* ENOBUFS or unsupported: fall back to regular I/O */
+	}
+
 	using_sendfile = use_sendfile(u);
 
 	if (using_sendfile) {
@@ -5905,24 +5980,7 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		u->bpos += written;
 	}
 
-	gnet_prop_set_guint64_val(PROP_UL_BYTE_COUNT,
-		GNET_PROPERTY(ul_byte_count) + written);
-
-	u->last_update = tm_time();
-	u->sent += written;
-	if (u->file_info) {
-		fi_increase_uploaded(u->file_info, written);
-	}
-
-	/* This upload is complete */
-	if (u->pos > u->end) {
-
-		if (u->sf) {
-			upload_stats_file_complete(u->sf, u->end - u->skip + 1);
-			u->accounted = TRUE;	/* Called upload_stats_file_complete() */
-		}
-		upload_completed(u);
-	}
+	upload_sent(u, written);
 }
 
 static inline ssize_t
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2002-2003, 2013 Raphael Manfredi
+ * Copyright (c) 2002-2003, 2013, 2016 Raphael Manfredi
  *
  *----------------------------------------------------------------------
  * This file is part of gtk-gnutella.
@@ -27,28 +27,33 @@
  *
  * Asynchronous hash computation.
  *
- * Computation is done in a separate thread, but this is invisible to the
+ * Computation is done in separate threads, but this is invisible to the
  * calling thread as callbacks happen in the calling thread context.
  *
- * Each verification thread is given a thread event queue (TEQ), and the
- * calling thread needs to also create its own TEQ so that we can properly
- * dispatch callbacks.
+ * Each verifier (a set of digests to compute, such as SHA1 or SHA1+TTH) owns
+ * a work queue per device, files being moved to the queue of the device
+ * holding them by the workers, which determine that device when they pick
+ * new files, sparing the main thread a stat() per file.  All the verifiers
+ * share a pool of worker threads, sized by the "verify_workers" property,
+ * which pick work from these queues.
  *
- * As work is concurrently inserted into the verification lists, a notification
- * event is sent to the computing thread to wake it up.
+ * To avoid thrashing a single spindle with concurrent reads at different
+ * places, no more than "verify_device_workers" threads can be reading from
+ * the same device at any given time.  A worker will preferably stick to the
+ * device it last processed, and only steal work from the queues of other
+ * devices when there is nothing it can process on its own device.
  *
- * On systems with 2 CPUs only, all the verifications are handled by one single
- * thread, so we continue to use the legacy code, relying on the background
- * task scheduler to properly arbitrate processing between the various hash
- * verifications.
+ * A verification context can compute several digests at once: each chunk
+ * read from the file is then fed to all the hash routines before the next
+ * read is issued, so that the file is only read once from disk regardless
+ * of the amount of digests computed.
  *
- * As soon as there are 3 CPUs or more, all the verifications are handled in
- * separate threads, but there are distinct background task schedulers created,
- * so each thread can use almost all its processing ticks to actually compute
- * the hash value.
+ * Large files are hashed through a sliding mmap() window rather than read
+ * into a buffer, and the kernel is told to drop the pages we have hashed.
+ * Should mapping fail, we fall back to plain reading.
  *
  * @author Raphael Manfredi
- * @date 2002-2003, 2013
+ * @date 2002-2003, 2013, 2016
  */
 
 #include "common.h"
@@ -58,11 +63,9 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
-#include "lib/atomic.h"
 #include "lib/atoms.h"
-#include "lib/barrier.h"
-#include "lib/bg.h"
 #include "lib/compat_misc.h"
+#include "lib/cond.h"
 #include "lib/constants.h"
 #include "lib/cq.h"
 #include "lib/entropy.h"
@@ -72,35 +75,68 @@
 #include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/hashlist.h"
+#include "lib/mutex.h"
+#include "lib/pslist.h"
 #include "lib/str.h"
-#include "lib/stringify.h"		/* For short_time_ascii() */
+#include "lib/stringify.h"
 #include "lib/teq.h"
 #include "lib/thread.h"
 #include "lib/tm.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"	/* Must be the last header included */
 
 #define HASH_BUF_SIZE		(128 * 1024)	/**< Size of the reading buffer */
+#define HASH_MAP_SIZE		(4 * 1024 * 1024)	/**< Size of mapping window */
+#define HASH_MAP_MIN		(16 * 1024 * 1024)	/**< Min size to use mmap() */
 
-#define HASH_THREAD_MAX			2			/**< At most 2 hashing threads */
 #define VERIFY_DEFERRED			10			/**< ms: deferred free timeout */
 #define VERIFY_PROGRESS_NOTIFY	1			/**< s: progress notification */
 
-#define VERIFY_INVALID_LOCAL_ID -1U
+enum verifier_magic { VERIFIER_MAGIC = 0x5e0a61c4U };
+
+/**
+ * A verifier, processing queued files to compute a given set of digests.
+ */
+struct verifier {
+	enum verifier_magic magic;	/**< Magic number. */
+	struct verify_hash hash[VERIFY_HASH_MAX];	/**< Hash-specific callbacks */
+	size_t hash_count;			/**< Amount of hashes computed in one pass */
+	const char *name;			/**< Name of the computed digest(s) */
+	pslist_t *queues;			/**< Work queues, one per device */
+	hash_list_t *unsorted;		/**< Files whose device is not known yet */
+	hash_list_t *sorting;		/**< Files whose device is being determined */
+	struct verify_stats stats;	/**< Cumulated statistics */
+	int running;				/**< Amount of files being processed */
+	uint8 shutdowned;			/**< Flag indicating verifier was shutdown */
+};
+
+static inline void
+verifier_check(const struct verifier * const vf)
+{
+	g_assert(vf);
+	g_assert(VERIFIER_MAGIC == vf->magic);
+}
+
+/**
+ * Work queue of a verifier, for a given device.
+ */
+struct verify_queue {
+	dev_t dev;					/**< Device holding the files */
+	hash_list_t *files;			/**< Queued files (struct verify_file) */
+};
 
 enum verify_magic { VERIFY_MAGIC = 0x2dc84379U };
 
 /**
- * Verification task context.
+ * Verification of a file in progress, given to user callbacks.
  */
 struct verify {
 	enum verify_magic magic;	/**< Magic number. */
-	hash_list_t *files_to_hash;	/**< Work queue */
-	const struct verify_hash hash;	/**< Hash-specific processing callbacks */
-	struct bgtask *task;		/**< Background task handling the processing */
-	bgsched_t *sched;			/**< Task scheduler for this thread */
-	unsigned verify_stid;		/**< Verification thread ID */
+	struct verifier *vf;		/**< Verifier to which this work belongs */
+	struct verify_worker *w;	/**< Worker processing the file */
+	void *state[VERIFY_HASH_MAX];	/**< Hash-specific computation states */
 
 	file_object_t *file;		/**< The file object to access the file. */
 	filesize_t offset;			/**< Current offset into the file. */
@@ -108,13 +144,14 @@ struct verify {
 	filesize_t end;				/**< End offset of range to verify . */
 	time_t started;				/**< Start time, to determine comp. rate */
 	time_t last_progress;		/**< Last time we informed about progress */
-	char *buffer;				/**< Read buffer */
-	size_t buffer_size;			/**< Size of buffer in bytes. */
+	char *map;					/**< Current mapping window, if any */
+	fileoffset_t map_start;		/**< File offset of mapping window */
+	size_t map_len;				/**< Length of mapping window */
+	uint8 use_mmap;				/**< Whether to hash via mmap() */
 
 	enum verify_status status;	/**< Used for callback multiplexing. */
-	uint8 shutdowned;			/**< Flag indicating context was shutdown */
+	struct verify_stats stats;	/**< Statistics for this file */
 
-	/* Fields copied from currently processed verify_file entry */
 	verify_callback	callback;	/**< User-specified callback function. */
 	void *user_data;			/**< User-specified callback parameter. */
 };
@@ -126,28 +163,106 @@ verify_check(const struct verify * const ctx)
 	g_assert(VERIFY_MAGIC == ctx->magic);
 }
 
+/**
+ * A verification worker thread.
+ */
+struct verify_worker {
+	unsigned index;				/**< Index in the pool */
+	unsigned stid;				/**< Thread small ID, when running */
+	char *buffer;				/**< Read buffer */
+	size_t buffer_size;			/**< Size of buffer in bytes. */
+	dev_t dev;					/**< Device last (or being) processed */
+	tm_t job_start;				/**< Start time of current file */
+	uint64 busy_ms;				/**< Time spent processing files */
+	struct verify_stats stats;	/**< Cumulated statistics */
+	uint8 running;				/**< Whether thread is running */
+	uint8 active;				/**< Whether thread is processing a file */
+	uint8 has_dev;				/**< Whether ``dev'' is meaningful */
+};
+
+/**
+ * Usage count for a device.
+ */
+struct verify_device {
+	dev_t dev;					/**< The device */
+	unsigned busy;				/**< Amount of workers reading from it */
+};
+
+/**
+ * The pool of worker threads, shared by all the verifiers.
+ *
+ * All the queues and the worker states are protected by the pool lock.
+ */
+static struct verify_pool {
+	mutex_t lock;				/**< Thread-safe lock for the whole pool */
+	cond_t work;				/**< Signalled when work is enqueued */
+	pslist_t *verifiers;		/**< Known verifiers, by creation order */
+	pslist_t *devices;			/**< Device usage (struct verify_device) */
+	struct verify_worker worker[VERIFY_WORKER_MAX];
+	uint8 exiting;				/**< Set when workers must terminate */
+} verify_pool = {
+	MUTEX_INIT,
+	COND_INIT,
+	NULL,
+	NULL,
+	{ { 0 } },
+	FALSE,
+};
+
+#define VERIFY_POOL_LOCK	mutex_lock(&verify_pool.lock)
+#define VERIFY_POOL_UNLOCK	mutex_unlock(&verify_pool.lock)
+
+#define assert_verify_pool_locked() \
+	assert_mutex_is_owned(&verify_pool.lock)
+
 static inline void
 verify_hash_init(const struct verify * const ctx)
 {
-	ctx->hash.init(ctx->end - ctx->start);
+	const struct verifier *vf = ctx->vf;
+	size_t i;
+
+	for (i = 0; i < vf->hash_count; i++)
+		vf->hash[i].init(ctx->state[i], ctx->end - ctx->start);
 }
 
+/**
+ * Feed the same data to all the hashes computed by the context.
+ *
+ * @return 0 if OK, -1 on error.
+ */
 static inline int
-verify_hash_update(const struct verify * const ctx, const void *data, size_t n)
+verify_hash_update(struct verify * const ctx, const void *data, size_t n)
 {
-	return ctx->hash.update(data, n);
+	const struct verifier *vf = ctx->vf;
+	size_t i;
+
+	for (i = 0; i < vf->hash_count; i++) {
+		if (0 != vf->hash[i].update(ctx->state[i], data, n))
+			return -1;
+		ctx->stats.hashed += n;
+	}
+
+	return 0;
 }
 
 static inline int
 verify_hash_final(const struct verify * const ctx)
 {
-	return ctx->hash.final();
+	const struct verifier *vf = ctx->vf;
+	size_t i;
+
+	for (i = 0; i < vf->hash_count; i++) {
+		if (0 != vf->hash[i].final(ctx->state[i]))
+			return -1;
+	}
+
+	return 0;
 }
 
 static inline const char *
 verify_hash_name(const struct verify * const ctx)
 {
-	return ctx->hash.name();
+	return ctx->vf->name;
 }
 
 enum verify_file_magic { VERIFY_FILE_MAGIC = 0x063ac7adU };
@@ -159,6 +274,7 @@ struct verify_file {
 	filesize_t amount;				/**< Amount of bytes to hash */
 	verify_callback	callback;		/**< User-specified callback function */
 	void *user_data;				/**< Callback argument */
+	uint8 high_priority;			/**< Whether to process ASAP */
 };
 
 static inline void
@@ -197,6 +313,63 @@ verify_file_free(struct verify_file **ptr)
 		atom_str_free_null(&item->pathname);
 		item->magic = 0;
 		WFREE(item);
+		*ptr = NULL;
+	}
+}
+
+/**
+ * Create a new verification context for processing a queued file.
+ */
+static struct verify *
+verify_ctx_new(struct verifier *vf, struct verify_worker *w,
+	const struct verify_file *item)
+{
+	struct verify *ctx;
+	size_t i;
+
+	verifier_check(vf);
+	verify_file_check(item);
+
+	WALLOC0(ctx);
+	ctx->magic = VERIFY_MAGIC;
+	ctx->vf = vf;
+	ctx->w = w;
+	ctx->user_data = item->user_data;
+	ctx->callback = item->callback;
+	ctx->start = item->offset;
+	ctx->end = item->offset + item->amount;
+	ctx->offset = ctx->start;
+	ctx->status = VERIFY_INVALID;
+
+	for (i = 0; i < vf->hash_count; i++)
+		ctx->state[i] = vf->hash[i].alloc();
+
+	return ctx;
+}
+
+/**
+ * Free verification context and nullify its pointer.
+ */
+static void
+verify_ctx_free(struct verify **ctx_ptr)
+{
+	struct verify *ctx = *ctx_ptr;
+
+	if (ctx != NULL) {
+		const struct verifier *vf;
+		size_t i;
+
+		verify_check(ctx);
+		g_assert(NULL == ctx->file);
+
+		vf = ctx->vf;
+
+		for (i = 0; i < vf->hash_count; i++)
+			vf->hash[i].free(ctx->state[i]);
+
+		ctx->magic = 0;
+		WFREE(ctx);
+		*ctx_ptr = NULL;
 	}
 }
 
@@ -220,8 +393,12 @@ verify_file_free(struct verify_file **ptr)
  *		--RAM, 2013-10-13
  *
  * The teq_safe_rpc() routine is a cancellation point, but the verification
- * thread is created as non-cancellable, so we do not have to worry about
+ * threads are created as non-cancellable, so we do not have to worry about
  * possible cancellation.
+ *
+ * Since several workers can issue their RPCs concurrently, the main thread
+ * will see the callbacks for different files interleaved, but the callbacks
+ * for a given file are always strictly ordered.
  */
 
 /**
@@ -294,6 +471,31 @@ verify_done(struct verify *ctx)
 	ctx->status = VERIFY_INVALID;
 }
 
+/**
+ * Notify the callback of a queued file that it will not be processed
+ * because the verifier is shutdown.
+ */
+static void
+verify_file_shutdown(struct verifier *vf, const struct verify_file *item)
+{
+	struct verify ctx;
+
+	/* Setup minimal context to call the callback */
+	ZERO(&ctx);
+	ctx.magic = VERIFY_MAGIC;
+	ctx.vf = vf;
+	ctx.user_data = item->user_data;
+	ctx.callback = item->callback;
+	ctx.status = VERIFY_SHUTDOWN;
+
+	if (thread_is_main())
+		(void) verify_cb(&ctx);
+	else
+		(void) teq_safe_rpc(THREAD_MAIN_ID, verify_cb, &ctx);
+
+	ctx.magic = 0;
+}
+
 /**
  * @return current verification status.
  */
@@ -335,6 +537,97 @@ verify_elapsed(const struct verify *ctx)
 	return d;
 }
 
+/**
+ * Fetch the computation state of a given hash in the verification context.
+ *
+ * This is meant to be used by the hash-specific layers to access the
+ * computed digest from the user callbacks.
+ *
+ * @param ctx		the verification context
+ * @param hash		the hash description given at verifier creation
+ *
+ * @return the state allocated by the hash "alloc" callback, NULL if the
+ * verification context does not compute that hash.
+ */
+void *
+verify_hash_state(const struct verify *ctx, const struct verify_hash *hash)
+{
+	const struct verifier *vf;
+	size_t i;
+
+	verify_check(ctx);
+	g_assert(hash != NULL);
+
+	vf = ctx->vf;
+
+	for (i = 0; i < vf->hash_count; i++) {
+		if (vf->hash[i].name == hash->name)
+			return ctx->state[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Fill supplied structure with the statistics about the files processed
+ * by the verifier so far.
+ *
+ * The amount of bytes hashed is larger than the amount of bytes read when
+ * the verifier computes several digests at once.
+ */
+void
+verify_stats_get(const struct verifier *vf, struct verify_stats *vs)
+{
+	verifier_check(vf);
+	g_assert(vs != NULL);
+
+	VERIFY_POOL_LOCK;
+	*vs = vf->stats;
+	VERIFY_POOL_UNLOCK;
+}
+
+/**
+ * Fill supplied array with the statistics of each worker thread.
+ *
+ * @param vws		the array to fill
+ * @param count		the amount of entries in the array
+ *
+ * @return the amount of entries filled.
+ */
+size_t
+verify_worker_stats(struct verify_worker_stats *vws, size_t count)
+{
+	size_t i, n = MIN(count, VERIFY_WORKER_MAX);
+
+	g_assert(vws != NULL || 0 == count);
+
+	VERIFY_POOL_LOCK;
+
+	for (i = 0; i < n; i++) {
+		const struct verify_worker *w = &verify_pool.worker[i];
+		struct verify_worker_stats *s = &vws[i];
+
+		s->stid = w->running ? w->stid : -1U;
+		s->running = w->running;
+		s->active = w->active;
+		s->files = w->stats.files;
+		s->read = w->stats.read;
+		s->hashed = w->stats.hashed;
+		s->busy_ms = w->busy_ms;
+
+		if (w->active) {
+			tm_t now;
+
+			tm_now_exact(&now);
+			s->busy_ms += tm_elapsed_ms(&now, &w->job_start);
+		}
+	}
+
+	VERIFY_POOL_UNLOCK;
+
+	return n;
+}
+
 static uint
 verify_item_hash(const void *key)
 {
@@ -366,412 +659,462 @@ verify_item_equal(const void *p, const void *q)
 }
 
 /**
- * Variables controlling asynchronous "cancellation" of verification threads.
- *
- * The verify_exit[] array is index by a small number (the "local thread ID")
- * and tells the thread whether it has received a TSIG_TERM signal.
- *
- * The verify_threads[] array contains the ID of threads, and a linear lookup
- * is used to find the proper "local thread ID", the index at which we find
- * a matching thread ID.
- */
-static bool verify_exit[HASH_THREAD_MAX];
-static unsigned verify_threads[HASH_THREAD_MAX];
-static int verify_thread_count;
-
-/**
- * Structure passed to verify_thread_has_work().
+ * @return the targeted amount of worker threads.
  */
-struct verify_work {
-	bgsched_t *bs;		/**< Background task scheduler */
-	int id;				/**< Local thread ID */
-};
-
-/**
- * Is there work pending in the scheduler, or is thread terminated?
- */
-static bool
-verify_thread_has_work(void *arg)
+static unsigned
+verify_pool_target(void)
 {
-	struct verify_work *w = arg;
+	unsigned n = GNET_PROPERTY(verify_workers);
 
 	/*
-	 * When the thread should exit, as indicated by verify_exit[] being set,
-	 * we return TRUE to make sure we exit from the teq_wait() call.
+	 * When the property is 0, size the pool automatically: we leave one CPU
+	 * for the main thread, but always have at least one worker.
 	 */
 
-	return verify_exit[w->id] || 0 != bg_sched_runcount(w->bs);
+	if (0 == n) {
+		long cpus = getcpucount();
+		n = cpus > 1 ? cpus - 1 : 1;
+	}
+
+	return MIN(n, VERIFY_WORKER_MAX);
 }
 
 /**
- * Compute local thread ID of verification thread.
+ * @return the amount of workers that can concurrently read from a device.
  */
 static unsigned
-verify_thread_local_id(unsigned stid, bool panic)
+verify_device_max(void)
 {
-	unsigned i;
-
-	for (i = 0; i < N_ITEMS(verify_threads); i++) {
-		if (verify_threads[i] == stid)
-			return i;
-	}
-
-	if (panic)
-		s_error("%s(): cannot find %s", G_STRFUNC, thread_id_name(stid));
+	unsigned n = GNET_PROPERTY(verify_device_workers);
 
-	return VERIFY_INVALID_LOCAL_ID;		/* Invalid ID, meaning not found */
+	return MAX(n, 1);
 }
 
 /**
- * Signal handler to terminate the thread.
+ * Get the usage record for a device, creating it if needed.
+ *
+ * The pool must be locked.
  */
-static void
-verify_thread_terminate(int sig)
+static struct verify_device *
+verify_device_get(dev_t dev)
 {
-	unsigned i;
+	struct verify_device *vd;
+	pslist_t *sl;
 
-	g_assert(TSIG_TERM == sig);
+	assert_verify_pool_locked();
 
-	i = verify_thread_local_id(thread_small_id(), TRUE);
-	verify_exit[i] = TRUE;
-}
+	PSLIST_FOREACH(verify_pool.devices, sl) {
+		vd = sl->data;
+		if (vd->dev == dev)
+			return vd;
+	}
 
-/**
- * Arguments passed to the verification thread.
- */
-struct verify_thread_arg {
-	const char *name;			/* Thread name */
-	barrier_t *b;				/* Setup barrier */
-	bgsched_t *sched;			/* Background task scheduler to run */
-};
+	WALLOC0(vd);
+	vd->dev = dev;
+	verify_pool.devices = pslist_prepend(verify_pool.devices, vd);
+
+	return vd;
+}
 
 /**
- * Verfication thread main loop.
+ * Get the work queue of the verifier for the given device.
+ *
+ * The pool must be locked.
+ *
+ * @param vf		the verifier
+ * @param dev		the device
+ * @param create	whether to create the queue if missing
+ *
+ * @return the work queue, NULL if none and not creating.
  */
-static void *
-verify_thread_main(void *p)
+static struct verify_queue *
+verify_queue_get(struct verifier *vf, dev_t dev, bool create)
 {
-	struct verify_thread_arg *args = p;
-	struct verify_work winfo;
-	int i;
-
-	thread_set_name(args->name);
-	teq_create();				/* Queue to receive incoming work */
-	barrier_wait(args->b);		/* Thread has initialized */
-	barrier_free_null(&args->b);
-	winfo.bs = args->sched;
-	WFREE_TYPE_NULL(args);
-
-	if (GNET_PROPERTY(verify_debug))
-		g_debug("verification %s started", thread_name());
+	struct verify_queue *vq;
+	pslist_t *sl;
 
-	/*
-	 * Prepare for termination when receiveing a TSIG_TERM.
-	 */
+	assert_verify_pool_locked();
 
-	winfo.id = i = atomic_int_inc(&verify_thread_count);
+	PSLIST_FOREACH(vf->queues, sl) {
+		vq = sl->data;
+		if (vq->dev == dev)
+			return vq;
+	}
 
-	g_assert(i < HASH_THREAD_MAX);		/* Not creating too many threads */
+	if (!create)
+		return NULL;
 
-	verify_threads[i] = thread_small_id();
-	thread_signal(TSIG_TERM, verify_thread_terminate);
+	WALLOC0(vq);
+	vq->dev = dev;
+	vq->files = hash_list_new(verify_item_hash, verify_item_equal);
+	vf->queues = pslist_append(vf->queues, vq);
 
-	g_assert(verify_threads[i] != 0);	/* Not the main thread */
+	return vq;
+}
 
-	/*
-	 * Process incoming work, until thread is terminated.
-	 */
+/**
+ * Free work queue, which must be empty.
+ */
+static void
+verify_queue_free(void *data, void *unused_udata)
+{
+	struct verify_queue *vq = data;
 
-	while (!verify_exit[i]) {
-		if (GNET_PROPERTY(verify_debug))
-			g_debug("verification %s sleeping", thread_name());
+	(void) unused_udata;
 
-		teq_wait(verify_thread_has_work, &winfo);
+	g_assert(0 == hash_list_length(vq->files));
 
-		if (GNET_PROPERTY(verify_debug))
-			g_debug("verification %s awoken", thread_name());
+	hash_list_free(&vq->files);
+	WFREE(vq);
+}
 
-		while (0 != bg_sched_run(winfo.bs))
-			thread_check_suspended();
-	}
+/**
+ * Determine the device holding the file, for scheduling purposes.
+ *
+ * This is called by the workers, outside of the pool lock.
+ */
+static dev_t
+verify_file_device(const char *pathname)
+{
+	filestat_t sb;
 
-	g_debug("verification %s exiting", thread_name());
+	/*
+	 * If we cannot stat() the file, it will be queued on a pseudo-device
+	 * and the open() will fail anyway when we get to processing it.
+	 */
 
-	bg_sched_destroy_null(&winfo.bs);
-	verify_threads[i] = 0;			/* Signals: can destroy verify context */
+	if (-1 == stat(pathname, &sb))
+		return 0;
 
-	return NULL;
+	return sb.st_dev;
 }
 
 /**
- * Create a new verification thread with given name.
+ * Pick the next file whose device must be determined before it can be
+ * scheduled, flagging it as being sorted.
  *
- * This routine does not return until the verification thread has been
- * correctly initialized, so that the caller can immediately start to
- * enqueue work to the thread.
+ * The pool must be locked.
  *
- * @param v			the verification context for which we create a thread
- * @param name		the background task scheduler to use in that thread
- * @param name		the created thread name
+ * @param vf_ptr	where the verifier to which the file belongs is written
  *
- * @return thread ID, -1 on error.
+ * @return the file to sort, NULL if there is none.
  */
-static int
-verify_thread_create(struct verify *v, bgsched_t *bs, const char *name)
+static struct verify_file *
+verify_pool_unsorted(struct verifier **vf_ptr)
 {
-	barrier_t *b;
-	struct verify_thread_arg *args;
-	int r;
+	pslist_t *sl;
 
-	b = barrier_new(2);
+	assert_verify_pool_locked();
 
-	WALLOC(args);
-	args->name = name;
-	args->b = barrier_refcnt_inc(b);
-	args->sched = bs;
+	PSLIST_FOREACH(verify_pool.verifiers, sl) {
+		struct verifier *vf = sl->data;
+		struct verify_file *item;
 
-	/*
-	 * The verification thread is created as a detached thread because we
-	 * do not expect any result from it.
-	 *
-	 * It is created as non-cancelable: to end it, we send it a TSIG_TERM.
-	 */
+		verifier_check(vf);
 
-	r = thread_create(verify_thread_main, args,
-			THREAD_F_DETACH | THREAD_F_NO_CANCEL |
-				THREAD_F_NO_POOL | THREAD_F_PANIC,
-			THREAD_STACK_MIN);
+		if (vf->shutdowned)
+			continue;
 
-	v->verify_stid = r;
-	v->sched = bs;
+		item = hash_list_shift(vf->unsorted);
 
-	barrier_wait(b);		/* Wait for thread to initialize */
-	barrier_free_null(&b);
+		if (item != NULL) {
+			verify_file_check(item);
+			hash_list_append(vf->sorting, item);
+			*vf_ptr = vf;
+			return item;
+		}
+	}
 
-	return r;
+	return NULL;
 }
 
 /**
- * Create a new verification thread if necessary.
+ * Move file whose device was determined to the work queue of that device.
+ *
+ * The pool must be locked.
  */
 static void
-verify_thread_create_if_needed(struct verify *v)
+verify_pool_sort(struct verifier *vf, struct verify_file *item, dev_t dev)
 {
-	static unsigned verify_id;
-	static bgsched_t *verify_bs;
-	long cpus = getcpucount();
+	struct verify_queue *vq;
 
-	g_assert(thread_is_main());		/* Always called from main thread */
+	assert_verify_pool_locked();
+	g_assert(!vf->shutdowned);
 
-	/*
-	 * When there are more than 2 CPUs, we are on a multi-core system and we
-	 * create one thread per verification.  If they have only 2 CPUs, then we
-	 * just create a single thread to handle all the verifications.
-	 */
-
-	if (cpus <= 2) {
-		if G_UNLIKELY(NULL == verify_bs) {
-			static const char name[] = "verify";
+	hash_list_remove(vf->sorting, item);
+	vq = verify_queue_get(vf, dev, TRUE);
 
-			verify_bs = bg_sched_create(name, 500000);		/* 500 ms */
-			verify_id = verify_thread_create(v, verify_bs, name);
-		} else {
-			v->sched = verify_bs;
-			v->verify_stid = verify_id;
-		}
-	} else {
-		const char *tname = str_smsg("verify %s", verify_hash_name(v));
-		const char *name = constant_str(tname);
+	if (item->high_priority)
+		hash_list_prepend(vq->files, item);
+	else
+		hash_list_append(vq->files, item);
 
-		bgsched_t *bs = bg_sched_create(name, 1000000);		/* 1 sec */
-		(void) verify_thread_create(v, bs, name);
-	}
+	cond_signal(&verify_pool.work, &verify_pool.lock);
 }
 
 /**
- * Create a new verification context.
+ * Pick the next file to process for the given worker.
  *
- * @param hash		Hash-specific callbacks for this hash verification
+ * Files waiting on a device which is already read by as many workers as
+ * allowed are skipped.  High-priority files are processed first, then we
+ * prefer files on the device the worker last processed, and only then do
+ * we steal work from the queues of other devices.
+ *
+ * The pool must be locked.
+ *
+ * @param w			the worker thread
+ * @param vf_ptr	where the verifier to which the file belongs is written
  *
- * @return verification context to which work can be requested via
- * verify_enqueue()
+ * @return the file to process, NULL if there is nothing we can process.
  */
-struct verify *
-verify_new(const struct verify_hash *hash)
+static struct verify_file *
+verify_pool_pick(struct verify_worker *w, struct verifier **vf_ptr)
 {
-	struct verify *ctx;
+	struct verify_queue *best = NULL;
+	struct verifier *best_vf = NULL;
+	int best_score = 0;
+	unsigned dmax = verify_device_max();
+	pslist_t *sl, *sq;
+	struct verify_file *item;
 
-	g_assert(hash);
+	assert_verify_pool_locked();
 
-	WALLOC0(ctx);
-	ctx->magic = VERIFY_MAGIC;
-	ctx->buffer_size = HASH_BUF_SIZE;
-	ctx->buffer = halloc(ctx->buffer_size);
-	STATIC_ASSERT(sizeof ctx->hash == sizeof(struct verify_hash));
-	*(struct verify_hash *) &ctx->hash = *hash;		/* Assignment to "const" */
-	ctx->files_to_hash = hash_list_new(verify_item_hash, verify_item_equal);
-	hash_list_thread_safe(ctx->files_to_hash);
+	PSLIST_FOREACH(verify_pool.verifiers, sl) {
+		struct verifier *vf = sl->data;
 
-	verify_thread_create_if_needed(ctx);
+		verifier_check(vf);
 
-	return ctx;
+		if (vf->shutdowned)
+			continue;
+
+		PSLIST_FOREACH(vf->queues, sq) {
+			struct verify_queue *vq = sq->data;
+			const struct verify_file *head;
+			int score = 1;
+
+			head = hash_list_head(vq->files);
+			if (NULL == head)
+				continue;
+
+			if (verify_device_get(vq->dev)->busy >= dmax)
+				continue;
+
+			if (head->high_priority)
+				score += 2;
+			if (w->has_dev && vq->dev == w->dev)
+				score += 1;
+
+			if (score > best_score) {
+				best = vq;
+				best_vf = vf;
+				best_score = score;
+			}
+		}
+	}
+
+	if (NULL == best)
+		return NULL;
+
+	item = hash_list_shift(best->files);
+	verify_file_check(item);
+
+	verify_device_get(best->dev)->busy++;
+	best_vf->running++;
+	w->dev = best->dev;
+	w->has_dev = TRUE;
+	w->active = TRUE;
+	tm_now_exact(&w->job_start);
+
+	*vf_ptr = best_vf;
+	return item;
 }
 
 /**
- * Callout queue callback to check whether we can free the verify context.
+ * Record that the worker has completed the processing of its current file.
+ *
+ * The pool must be locked.
  */
 static void
-verify_deferred_free(cqueue_t *cq, void *data)
+verify_pool_done(struct verify_worker *w, struct verifier *vf,
+	const struct verify *ctx)
 {
-	struct verify *ctx = data;
-	unsigned i;
+	struct verify_device *vd;
+	tm_t now;
 
-	verify_check(ctx);
+	assert_verify_pool_locked();
+	g_assert(w->active);
+	g_assert(w->has_dev);
 
-	/*
-	 * We do not free the verification context until the thread that uses it
-	 * has not marked it was about to exit by clearing its corresponding
-	 * entry in verify_threads[].
-	 */
+	vd = verify_device_get(w->dev);
+	g_assert(vd->busy != 0);
+	vd->busy--;
 
-	i = verify_thread_local_id(ctx->verify_stid, FALSE);
+	g_assert(vf->running > 0);
+	vf->running--;
 
-	if (i != VERIFY_INVALID_LOCAL_ID) {
-		/*
-		 * Thread has not terminated yet, could have pending RPCs...
-		 */
+	tm_now_exact(&now);
+	w->busy_ms += tm_elapsed_ms(&now, &w->job_start);
+	w->active = FALSE;
 
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("verification %s for %s not terminated yet",
-				thread_id_name(ctx->verify_stid), verify_hash_name(ctx));
-		}
+	w->stats.files++;
+	w->stats.read += ctx->stats.read;
+	w->stats.hashed += ctx->stats.hashed;
 
-		cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, ctx);
-	} else {
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("freeing %s verification context", verify_hash_name(ctx));
-		}
+	vf->stats.files++;
+	vf->stats.read += ctx->stats.read;
+	vf->stats.hashed += ctx->stats.hashed;
 
-		hash_list_free(&ctx->files_to_hash);
-		ctx->magic = 0;
-		WFREE(ctx);
-	}
+	/*
+	 * A device slot was released, and other workers may be waiting for it.
+	 */
+
+	cond_broadcast(&verify_pool.work, &verify_pool.lock);
 }
 
 /**
- * Free verification context and nullify its pointer.
+ * Open the file and prepare hashing.
  *
- * The actual physical disposal of the verification context is deferred until
- * the thread responsible for handling the work has terminated.
+ * @return TRUE if we can proceed with the computation.
  */
-void
-verify_free(struct verify **ptr)
+static bool
+verify_open(struct verify *ctx, const struct verify_file *item)
 {
-	struct verify *ctx = *ptr;
-
-	if (ctx != NULL) {
-		verify_check(ctx);
-		g_assert(!ctx->shutdowned);
+	verify_check(ctx);
+	g_assert(NULL == ctx->file);
 
-		if (ctx->task != NULL) {
-			bg_task_cancel(ctx->task);
-			ctx->task = NULL;
+	if (!verify_start(ctx)) {
+		if (GNET_PROPERTY(verify_debug)) {
+			g_debug("discarding request of %s digest for %s",
+				verify_hash_name(ctx), item->pathname);
 		}
+		verify_shutdown(ctx);
+		return FALSE;
+	}
 
-		ctx->shutdowned = TRUE;
-		thread_kill(ctx->verify_stid, TSIG_TERM);
-		*ptr = NULL;
-
-		/*
-		 * Defer freeing of the context until the thread is dead
-		 *
-		 * We leave the ctx->files_to_hash list around as well because
-		 * it could still be accessed by other threads.
-		 */
+	ctx->file = file_object_open(item->pathname, O_RDONLY);
 
-		cq_main_insert(VERIFY_DEFERRED, verify_deferred_free, ctx);
+	if (NULL == ctx->file) {
+		g_warning("failed to open \"%s\" for %s hashing: %m",
+			item->pathname, verify_hash_name(ctx));
+		verify_failure(ctx);
+		return FALSE;
 	}
-}
 
-static void
-verify_context_free(void *data)
-{
-	struct verify *ctx = data;
+	if (GNET_PROPERTY(verify_debug)) {
+		g_debug("verifying %s digest for %s in %s",
+			verify_hash_name(ctx), file_object_pathname(ctx->file),
+			thread_name());
+	}
 
-	verify_check(ctx);
-	/* If we're called, the task is being terminated */
+	verify_hash_init(ctx);
+	file_object_fadvise_sequential(ctx->file);
+	ctx->last_progress = ctx->started = tm_time_exact();
 
+#ifdef HAS_MMAP
 	/*
-	 * There's nothing to free here.  We're managing the overall context
-	 * ourselves, and this overall context is given as the task's context.
-	 * We just need to record the fact that the task has been terminated
-	 * here so verify_free() does not try to cancel it.
+	 * Large files are hashed through a sliding memory mapping window to
+	 * avoid copying all their data into our reading buffer.
 	 */
 
-	ctx->task = NULL;
+	ctx->use_mmap = booleanize(ctx->end - ctx->start >= HASH_MAP_MIN);
+#endif
+
+	return TRUE;
+}
 
-	if (GNET_PROPERTY(verify_debug) > 1) {
-		g_debug("destroying task for %s verification", verify_hash_name(ctx));
+/**
+ * Release the current mapping window, if any.
+ *
+ * The kernel is told that we no longer need the pages we just hashed so
+ * that they do not needlessly evict other pages from the cache, such as
+ * the ones of files being actively uploaded.
+ */
+static void
+verify_unmap(struct verify *ctx)
+{
+	if (ctx->map != NULL) {
+		vmm_munmap(ctx->map, ctx->map_len);
+		compat_fadvise_dontneed(file_object_fd(ctx->file),
+			ctx->map_start, ctx->map_len);
+		ctx->map = NULL;
 	}
 }
 
+/**
+ * Close the file being verified.
+ */
 static void
-verify_next_file(struct verify *ctx)
+verify_close(struct verify *ctx)
 {
-	struct verify_file *item;
-	bool skipped = FALSE;
+	verify_unmap(ctx);
+	file_object_release(&ctx->file);
+}
 
-	verify_check(ctx);
-	g_assert(NULL == ctx->file);
+/**
+ * Map the next window of the file being verified.
+ *
+ * When mapping fails, we permanently fall back to reading the file for the
+ * remaining of the computation.
+ *
+ * @param ctx		the verification context
+ * @param len		where the amount of bytes available is written
+ *
+ * @return pointer to the data at the current offset, NULL on failure.
+ */
+static const void *
+verify_map_next(struct verify *ctx, size_t *len)
+{
+#ifdef HAS_MMAP
+	fileoffset_t start;
+	filestat_t sb;
+	size_t n;
+	void *p;
+	int fd;
 
-	item = hash_list_shift(ctx->files_to_hash);
-	if (item != NULL) {
-		verify_file_check(item);
+	verify_unmap(ctx);
 
-		ctx->user_data = item->user_data;
-		ctx->callback = item->callback;
-		ctx->start = item->offset;
-		ctx->end = item->offset + item->amount;
-		ctx->offset = ctx->start;
-
-		if (verify_start(ctx)) {
-			ctx->file = file_object_open(item->pathname, O_RDONLY);
-			if (NULL == ctx->file) {
-				g_warning("failed to open \"%s\" for %s hashing: %m",
-					verify_hash_name(ctx), item->pathname);
-			}
-		} else {
-			if (GNET_PROPERTY(verify_debug)) {
-				g_debug("discarding request of %s digest for %s",
-					verify_hash_name(ctx), item->pathname);
-			}
-			skipped = TRUE;
-		}
+	fd = file_object_fd(ctx->file);
+	start = ctx->offset - ctx->offset % compat_pagesize();
+	n = MIN(HASH_MAP_SIZE, ctx->end - start);
 
-		verify_file_free(&item);
+	/*
+	 * Accessing a mapped page beyond the end of the file would raise a
+	 * SIGBUS, so make sure the file was not truncated behind our back.
+	 * The read() path will then properly report the shrunk file.
+	 */
 
-		if (NULL == ctx->file)
-			goto done;
-	}
+	if (-1 == file_object_fstat(ctx->file, &sb))
+		goto fallback;
 
-	if (ctx->file) {
-		if (GNET_PROPERTY(verify_debug)) {
-			g_debug("verifying %s digest for %s",
-				verify_hash_name(ctx), file_object_pathname(ctx->file));
-		}
-		verify_hash_init(ctx);
-		file_object_fadvise_sequential(ctx->file);
-		ctx->last_progress = ctx->started = tm_time_exact();
+	if (UNSIGNED(sb.st_size) < start + n) {
+		errno = ERANGE;
+		goto fallback;
 	}
-	return;
 
-done:
-	if (skipped)
-		verify_shutdown(ctx);
-	else
-		verify_failure(ctx);
+	p = vmm_mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, start);
+	if (MAP_FAILED == p)
+		goto fallback;
 
-	file_object_release(&ctx->file);
+	vmm_madvise_sequential(p, n);
+
+	ctx->map = p;
+	ctx->map_start = start;
+	ctx->map_len = n;
+
+	*len = start + n - ctx->offset;
+	return ctx->map + (ctx->offset - start);
+
+fallback:
+	if (GNET_PROPERTY(verify_debug)) {
+		g_debug("cannot map \"%s\" at offset %s, reading instead: %m",
+			file_object_pathname(ctx->file),
+			filesize_to_string(ctx->offset));
+	}
+#endif	/* HAS_MMAP */
+
+	(void) len;
+	ctx->use_mmap = FALSE;
+	return NULL;
 }
 
 static void
@@ -787,25 +1130,42 @@ verify_final(struct verify *ctx)
 			file_object_pathname(ctx->file));
 		verify_failure(ctx);
 	} else {
+		if (GNET_PROPERTY(verify_debug)) {
+			g_debug("%s verification of \"%s\" done: "
+				"read %s byte%s, hashed %s byte%s",
+				verify_hash_name(ctx), file_object_pathname(ctx->file),
+				uint64_to_string(ctx->stats.read), plural(ctx->stats.read),
+				uint64_to_string2(ctx->stats.hashed),
+				plural(ctx->stats.hashed));
+		}
 		verify_done(ctx);
 	}
-	file_object_release(&ctx->file);
+	verify_close(ctx);
 }
 
 static void
 verify_update(struct verify *ctx)
 {
+	const void *data = NULL;
 	ssize_t r;
 
 	verify_check(ctx);
 
 	if (ctx->offset < ctx->end) {
-		filesize_t amount;
 		size_t n;
 
-		amount = ctx->end - ctx->offset;
-		n = MIN(amount, ctx->buffer_size);
-		r = file_object_pread(ctx->file, ctx->buffer, n, ctx->offset);
+		if (ctx->use_mmap) {
+			data = verify_map_next(ctx, &n);
+			r = n;
+		}
+
+		if (NULL == data) {
+			filesize_t amount = ctx->end - ctx->offset;
+
+			data = ctx->w->buffer;
+			n = MIN(amount, ctx->w->buffer_size);
+			r = file_object_pread(ctx->file, ctx->w->buffer, n, ctx->offset);
+		}
 	} else {
 		r = 0;
 	}
@@ -822,18 +1182,18 @@ verify_update(struct verify *ctx)
 		time_t now;
 
 		ctx->offset += (size_t) r;
+		ctx->stats.read += (size_t) r;
 
-		if (verify_hash_update(ctx, ctx->buffer, r)) {
+		if (verify_hash_update(ctx, data, r)) {
 			g_warning("%s computation error for \"%s\"",
 				verify_hash_name(ctx), file_object_pathname(ctx->file));
 			goto error;
 		}
 
 		/*
-		 * Don't inform about progress too frequently: if we're running in
-		 * a dedicated thread, the notification will issue a cross-thread RPC
-		 * which is slowing down the computation since we need to wait for
-		 * the reply before resuming.
+		 * Don't inform about progress too frequently: the notification
+		 * issues a cross-thread RPC which is slowing down the computation
+		 * since we need to wait for the reply before resuming.
 		 */
 
 		now = tm_time();
@@ -849,200 +1209,350 @@ verify_update(struct verify *ctx)
 
 error:
 	verify_failure(ctx);
-	file_object_release(&ctx->file);
+	verify_close(ctx);
 }
 
 /**
- * Drop all the queued items for the verification thread.
- *
- * This is dispatched to the main thread.
+ * Process a file picked from the queue by the worker.
  */
 static void
-verify_queue_flush(void *data)
+verify_process(struct verify_worker *w, struct verifier *vf,
+	const struct verify_file *item)
 {
-	struct verify *ctx = data;
-	struct verify_file *item;
-
-	verify_check(ctx);
-	g_assert(thread_is_main());
+	struct verify *ctx;
 
-	while (NULL != (item = hash_list_shift(ctx->files_to_hash))) {
-		/* Setup minimal context to call verify_shutdown() */
-		ctx->user_data = item->user_data;
-		ctx->callback = item->callback;
+	ctx = verify_ctx_new(vf, w, item);
 
-		verify_shutdown(ctx);
-		verify_file_free(&item);
+	if (verify_open(ctx, item)) {
+		while (ctx->file != NULL) {
+			if G_UNLIKELY(vf->shutdowned) {
+				verify_shutdown(ctx);
+				verify_close(ctx);
+				break;
+			}
+			verify_update(ctx);
+			thread_check_suspended();
+		}
 	}
+
+	VERIFY_POOL_LOCK;
+	verify_pool_done(w, vf, ctx);
+	VERIFY_POOL_UNLOCK;
+
+	verify_ctx_free(&ctx);
 }
 
 /**
- * Signal handler for task termination.
- *
- * This handler is invoked from the background task scheduler and is therefore
- * run in the thread that is handling verification.
+ * Verification worker main loop.
  */
-static void
-verify_bg_sighandler(struct bgtask *bt, void *data, bgsig_t sig)
+static void *
+verify_worker_main(void *p)
 {
-	struct verify *ctx = data;
+	struct verify_worker *w = p;
 
-	verify_check(ctx);
-	g_assert(BG_SIG_TERM == sig);
+	thread_set_name_atom(str_smsg("verify #%u", w->index));
 
-	if (GNET_PROPERTY(verify_debug)) {
-		g_debug("cancelling background task \"%s\" in %s",
-			bg_task_name(bt), thread_name());
-	}
+	w->buffer_size = HASH_BUF_SIZE;
+	w->buffer = halloc(w->buffer_size);
+
+	if (GNET_PROPERTY(verify_debug))
+		g_debug("verification %s started", thread_name());
+
+	VERIFY_POOL_LOCK;
+
+	w->stid = thread_small_id();
 
 	/*
-	 * Abort current file hashing.
+	 * Process incoming work, until the pool is shut down or resized below
+	 * our index.
 	 */
 
-	if (ctx->file != NULL) {
-		verify_shutdown(ctx);
-		file_object_release(&ctx->file);
+	while (!verify_pool.exiting && w->index < verify_pool_target()) {
+		struct verify_file *item;
+		struct verifier *vf;
+
+		/*
+		 * Determine the device of newly queued files first, so that they
+		 * can be scheduled.
+		 */
+
+		item = verify_pool_unsorted(&vf);
+
+		if (item != NULL) {
+			dev_t dev;
+
+			VERIFY_POOL_UNLOCK;
+			dev = verify_file_device(item->pathname);
+			VERIFY_POOL_LOCK;
+
+			if G_UNLIKELY(vf->shutdowned) {
+				VERIFY_POOL_UNLOCK;
+				verify_file_shutdown(vf, item);
+				VERIFY_POOL_LOCK;
+				hash_list_remove(vf->sorting, item);
+				verify_file_free(&item);
+			} else {
+				verify_pool_sort(vf, item, dev);
+			}
+			continue;
+		}
+
+		item = verify_pool_pick(w, &vf);
+
+		if (NULL == item) {
+			if (GNET_PROPERTY(verify_debug) > 1)
+				g_debug("verification %s sleeping", thread_name());
+
+			cond_wait(&verify_pool.work, &verify_pool.lock);
+			continue;
+		}
+
+		VERIFY_POOL_UNLOCK;
+		verify_process(w, vf, item);
+		verify_file_free(&item);
+		VERIFY_POOL_LOCK;
 	}
-	HFREE_NULL(ctx->buffer);
 
 	/*
-	 * Flush the queue.
-	 *
-	 * To speed things up, we'll redirect this work to the main thread: since
-	 * we're shutdowning, there's no real processing done in the main thread,
-	 * and it will be more efficient if we're currently in the library thread
-	 * since we will avoid all these TEQ RPCs between the two threads.
+	 * Release the buffer before flagging the slot as free: as soon as
+	 * we clear w->running, verify_pool_spawn() can reuse it for a new
+	 * worker, which will allocate its own buffer.
 	 */
 
-	teq_post(THREAD_MAIN_ID, verify_queue_flush, ctx);
-}
+	HFREE_NULL(w->buffer);
+	w->running = FALSE;
+	VERIFY_POOL_UNLOCK;
 
-/**
- * First verification step, intalling signal handler to trap termination.
- */
-static bgret_t
-verify_step_setup(struct bgtask *bt, void *unused_data, int unused_ticks)
-{
-	(void) unused_data;
-	(void) unused_ticks;
+	if (GNET_PROPERTY(verify_debug))
+		g_debug("verification %s exiting", thread_name());
 
-	bg_task_signal(bt, BG_SIG_TERM, verify_bg_sighandler);
-	bg_task_ticks_used(bt, 0);
-	return BGR_NEXT;
+	return NULL;
 }
 
 /**
- * Incremental verification step, invoked through the background task scheduler.
+ * Make sure we have as many workers running as configured.
  */
-static bgret_t
-verify_step_compute(struct bgtask *bt, void *data, int ticks)
+static void
+verify_pool_spawn(void)
 {
-	struct verify *ctx = data;
-	int i = ticks;
-	int used = 0;		/* Amount used for CPU-intensive tasks */
-	int light = 0;		/* Amount used for system-intensive tasks */
+	unsigned i, target;
+	bool spawn[VERIFY_WORKER_MAX];
 
-	verify_check(ctx);
-	(void) bt;
+	target = verify_pool_target();
 
-	while (i-- > 0) {
-		bg_task_cancel_test(bt);
-		if (NULL == ctx->file) {
-			verify_next_file(ctx);
-		}
-		if (ctx->file) {
-			verify_update(ctx);
-			used++;
-		} else {
-			light++;	/* Did not open file, still processed something */
+	VERIFY_POOL_LOCK;
+
+	for (i = 0; i < VERIFY_WORKER_MAX; i++) {
+		struct verify_worker *w = &verify_pool.worker[i];
+
+		spawn[i] = i < target && !w->running && !verify_pool.exiting;
+
+		if (spawn[i]) {
+			w->index = i;
+			w->running = TRUE;
 		}
-		if (NULL == ctx->file && 0 == hash_list_length(ctx->files_to_hash))
-			break;
 	}
 
-	/*
-	 * If we don't use all our ticks, we need to tell the scheduler
-	 * otherwise the average tick cost will be wrong and when we start
-	 * using all our ticks, the whole process could "freeze" during several
-	 * seconds, if not minutes!
-	 */
+	VERIFY_POOL_UNLOCK;
 
-	used += light / 10;			/* Arbitrary decimation factor */
+	for (i = 0; i < VERIFY_WORKER_MAX; i++) {
+		if (!spawn[i])
+			continue;
 
-	if (used < ticks)
-		bg_task_ticks_used(bt, used);
+		/*
+		 * The worker threads are created as detached threads because we
+		 * do not expect any result from them.
+		 *
+		 * They are created as non-cancelable: to end them, we flag the pool
+		 * as exiting and wake them up.
+		 */
 
-	if (ctx->file || hash_list_length(ctx->files_to_hash) > 0) {
-		return BGR_MORE;
-	} else {
-		return BGR_DONE;
+		thread_create(verify_worker_main, &verify_pool.worker[i],
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL |
+				THREAD_F_NO_POOL | THREAD_F_PANIC,
+			THREAD_STACK_MIN);
 	}
 }
 
 /**
- * Termination callback for verification task.
+ * Create a new verifier computing several digests in one pass.
+ *
+ * @param hash		array of hash-specific callbacks, one per digest
+ * @param count		amount of entries in the array
  *
- * This handler is invoked from the background task scheduler and is therefore
- * run in the thread that is handling verification.
+ * @return verifier to which work can be requested via verify_enqueue()
  */
-static void
-verify_bg_done(struct bgtask *bt, void *data, bgstatus_t status, void *uarg)
+struct verifier *
+verify_new_multi(const struct verify_hash *hash, size_t count)
 {
-	struct verify *ctx = data;
+	struct verifier *vf;
+	str_t *s;
+	size_t i;
 
-	verify_check(ctx);
+	g_assert(hash);
+	g_assert(size_is_positive(count));
+	g_assert(count <= VERIFY_HASH_MAX);
+
+	WALLOC0(vf);
+	vf->magic = VERIFIER_MAGIC;
+	vf->hash_count = count;
+	vf->unsorted = hash_list_new(verify_item_hash, verify_item_equal);
+	vf->sorting = hash_list_new(verify_item_hash, verify_item_equal);
+
+	s = str_new(0);
+
+	for (i = 0; i < count; i++) {
+		vf->hash[i] = hash[i];
+		if (i != 0)
+			STR_CAT(s, "+");
+		str_cat(s, hash[i].name());
+	}
+
+	vf->name = constant_str(str_2c(s));
+	str_destroy_null(&s);
+
+	VERIFY_POOL_LOCK;
+	verify_pool.exiting = FALSE;
+	verify_pool.verifiers = pslist_append(verify_pool.verifiers, vf);
+	VERIFY_POOL_UNLOCK;
+
+	return vf;
+}
+
+/**
+ * Create a new verifier.
+ *
+ * @param hash		Hash-specific callbacks for this hash verification
+ *
+ * @return verifier to which work can be requested via verify_enqueue()
+ */
+struct verifier *
+verify_new(const struct verify_hash *hash)
+{
+	return verify_new_multi(hash, 1);
+}
 
-	(void) uarg;
+/**
+ * Callout queue callback to check whether we can free the verifier.
+ */
+static void
+verify_deferred_free(cqueue_t *cq, void *data)
+{
+	struct verifier *vf = data;
+	int running;
+
+	verifier_check(vf);
 
 	/*
-	 * Sole purpose here is to trace task termination and print execution
-	 * statistics, for debugging.
+	 * We do not free the verifier until no worker is processing a file
+	 * on its behalf anymore.
 	 */
 
-	if (GNET_PROPERTY(verify_debug)) {
-		g_debug("terminating background task \"%s\" in %s, status=%s, "
-			"ran %'lu ms (%s)",
-			bg_task_name(bt), thread_name(), bgstatus_to_string(status),
-			bg_task_wtime(bt), short_time_ascii(bg_task_wtime(bt) / 1000));
+	VERIFY_POOL_LOCK;
+	running = vf->running + hash_list_length(vf->sorting);
+	VERIFY_POOL_UNLOCK;
+
+	if (running != 0) {
+		/*
+		 * Workers still have files to finish, could have pending RPCs...
+		 */
+
+		if (GNET_PROPERTY(verify_debug) > 1) {
+			g_debug("%s verification still has %d running file%s",
+				vf->name, running, plural(running));
+		}
+
+		cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, vf);
+	} else {
+		if (GNET_PROPERTY(verify_debug) > 1) {
+			g_debug("freeing %s verifier", vf->name);
+		}
+
+		pslist_foreach(vf->queues, verify_queue_free, NULL);
+		pslist_free_null(&vf->queues);
+		g_assert(0 == hash_list_length(vf->unsorted));
+		g_assert(0 == hash_list_length(vf->sorting));
+		hash_list_free(&vf->unsorted);
+		hash_list_free(&vf->sorting);
+		vf->magic = 0;
+		WFREE(vf);
 	}
 }
 
 /**
- * Create background task to perform the verification if not already there.
+ * Flush all the queued items of the verifier, notifying callbacks.
  */
 static void
-verify_create_task(struct verify *ctx)
+verify_queue_flush(struct verifier *vf)
 {
-	verify_check(ctx);
+	pslist_t *sl;
 
-	if (NULL == ctx->task) {
-		static const bgstep_cb_t step[] = {
-			verify_step_setup,
-			verify_step_compute
-		};
+	verifier_check(vf);
+	g_assert(thread_is_main());
 
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("creating new task for %s verification",
-				verify_hash_name(ctx));
+	for (;;) {
+		struct verify_file *item;
+
+		VERIFY_POOL_LOCK;
+		item = hash_list_shift(vf->unsorted);
+		if (NULL == item) {
+			PSLIST_FOREACH(vf->queues, sl) {
+				struct verify_queue *vq = sl->data;
+
+				item = hash_list_shift(vq->files);
+				if (item != NULL)
+					break;
+			}
 		}
+		VERIFY_POOL_UNLOCK;
 
-		ctx->task = bg_task_create(ctx->sched, verify_hash_name(ctx),
-							step, N_ITEMS(step),
-			  				ctx, verify_context_free,
-							verify_bg_done, NULL);
+		if (NULL == item)
+			break;
+
+		verify_file_shutdown(vf, item);
+		verify_file_free(&item);
 	}
 }
 
 /**
- * Notified that work was enqueued and should be processed by the
- * verification thread attached to the context.
+ * Free verifier and nullify its pointer.
  *
- * This is called in the thread that is running the verification task.
+ * Queued files are discarded, and files being processed are aborted.
+ * The actual physical disposal of the verifier is deferred until the
+ * workers have stopped processing files on its behalf.
  */
-static void
-verify_enqueued(void *arg)
+void
+verify_free(struct verifier **ptr)
 {
-	verify_create_task(arg);
+	struct verifier *vf = *ptr;
+
+	if (vf != NULL) {
+		verifier_check(vf);
+		g_assert(!vf->shutdowned);
+
+		vf->shutdowned = TRUE;
+		*ptr = NULL;
+
+		verify_queue_flush(vf);
+
+		/*
+		 * When the last verifier is gone, the workers can exit.
+		 */
+
+		VERIFY_POOL_LOCK;
+		verify_pool.verifiers = pslist_remove(verify_pool.verifiers, vf);
+		if (NULL == verify_pool.verifiers) {
+			verify_pool.exiting = TRUE;
+			cond_broadcast(&verify_pool.work, &verify_pool.lock);
+		}
+		VERIFY_POOL_UNLOCK;
+
+		/*
+		 * Defer freeing of the verifier until workers are done with it.
+		 */
+
+		cq_main_insert(VERIFY_DEFERRED, verify_deferred_free, vf);
+	}
 }
 
 /**
@@ -1052,7 +1562,7 @@ verify_enqueued(void *arg)
  * not from the verification thread, so that multi-threading be transparent
  * for the calling thread.
  *
- * @param ctx			the verification context
+ * @param vf			the verifier
  * @param high_priority	whether item should be treated quickly
  * @param pathname		file to be verified
  * @param offset		starting offset where verification should start
@@ -1068,59 +1578,83 @@ verify_enqueued(void *arg)
  * already enqueued.
  */
 bool
-verify_enqueue(struct verify *ctx, int high_priority,
+verify_enqueue(struct verifier *vf, int high_priority,
 	const char *pathname, filesize_t offset, filesize_t amount,
 	verify_callback callback, void *user_data)
 {
-	struct verify_file *item;
+	struct verify_file *item, *orig = NULL;
+	hash_list_t *hl = NULL;
+	pslist_t *sl;
 	int inserted;
 
-	verify_check(ctx);
+	verifier_check(vf);
 	g_return_val_if_fail(pathname, FALSE);
 	g_return_val_if_fail(callback, FALSE);
-	g_return_val_if_fail(!ctx->shutdowned, FALSE);
+	g_return_val_if_fail(!vf->shutdowned, FALSE);
 
 	entropy_harvest_many(
-		PTRLEN(ctx), VARLEN(high_priority),
+		PTRLEN(vf), VARLEN(high_priority),
 		pathname, strsize(pathname),
 		VARLEN(amount), NULL);
 
 	item = verify_file_new(pathname, offset, amount, callback, user_data);
 
-	hash_list_lock(ctx->files_to_hash);
+	/*
+	 * The file is queued without knowing its device yet: the workers will
+	 * determine it and move the file to the proper queue.  An equivalent
+	 * item can therefore be anywhere in the queues of the verifier.
+	 */
+
+	VERIFY_POOL_LOCK;
+
+	if (NULL != (orig = hash_list_lookup(vf->unsorted, item))) {
+		hl = vf->unsorted;
+	} else if (NULL != (orig = hash_list_lookup(vf->sorting, item))) {
+		hl = vf->sorting;
+	} else {
+		PSLIST_FOREACH(vf->queues, sl) {
+			struct verify_queue *vq = sl->data;
 
-	if (hash_list_contains(ctx->files_to_hash, item)) {
-		if (high_priority)
-			hash_list_moveto_head(ctx->files_to_hash, item);
+			if (NULL != (orig = hash_list_lookup(vq->files, item))) {
+				hl = vq->files;
+				break;
+			}
+		}
+	}
+
+	if (orig != NULL) {
+		if (high_priority) {
+			orig->high_priority = TRUE;
+			hash_list_moveto_head(hl, orig);
+		}
 		inserted = FALSE;
 	} else {
+		item->high_priority = booleanize(high_priority);
 		if (high_priority) {
-			hash_list_prepend(ctx->files_to_hash, item);
+			hash_list_prepend(vf->unsorted, item);
 		} else {
-			hash_list_append(ctx->files_to_hash, item);
+			hash_list_append(vf->unsorted, item);
 		}
 		inserted = TRUE;
+		cond_signal(&verify_pool.work, &verify_pool.lock);
 	}
 
-	hash_list_unlock(ctx->files_to_hash);
+	VERIFY_POOL_UNLOCK;
 
 	if (GNET_PROPERTY(verify_debug)) {
 		g_debug("%s %s digest verification for %s",
 			inserted ? "enqueued" : "already had queued",
-			verify_hash_name(ctx), pathname);
+			vf->name, pathname);
 	}
 
 	/*
-	 * When work was inserted into the queue (represented by the hash list
-	 * here), we signal the thread handling the verification so that it can
-	 * be awoken if it was sleeping: the TSIG_TEQ signal will let the thread
-	 * out of the teq_wait() call in its main processing loop, and the
-	 * verify_enqueued() event callback will make sure we have a background
-	 * task to actually process the work.
+	 * When work was inserted into a queue, a sleeping worker was signalled.
+	 * Make sure we have all the workers we are configured for, since the
+	 * pool size can be changed dynamically.
 	 */
 
 	if (inserted)
-		teq_post(ctx->verify_stid, verify_enqueued, ctx);
+		verify_pool_spawn();
 	else
 		verify_file_free(&item);
 
@@ -50,27 +50,66 @@ enum verify_status {
 };
 
 struct verify;
+struct verifier;
 
 typedef bool (*verify_callback)(const struct verify *,
 										enum verify_status, void *user_data);
 
+/**
+ * Hash-specific callbacks.
+ *
+ * Each file being verified gets its own computation state, allocated via
+ * alloc(), so that several files can be hashed concurrently.
+ */
 struct verify_hash {
 	const char *	(*name)(void);
-	void 			(*init)(filesize_t amount);
-	int  			(*update)(const void *data, size_t size);
-	int 			(*final)(void);
+	void *			(*alloc)(void);
+	void			(*free)(void *state);
+	void 			(*init)(void *state, filesize_t amount);
+	int  			(*update)(void *state, const void *data, size_t size);
+	int 			(*final)(void *state);
+};
+
+#define VERIFY_HASH_MAX	2	/**< Max amount of digests computed in one pass */
+
+#define VERIFY_WORKER_MAX	8	/**< Max amount of verification threads */
+
+/**
+ * Statistics about verified files.
+ */
+struct verify_stats {
+	uint64 files;		/**< Amount of files processed */
+	uint64 read;		/**< Amount of bytes read from files */
+	uint64 hashed;		/**< Amount of bytes fed to the hash routines */
+};
+
+/**
+ * Statistics about a verification worker thread.
+ */
+struct verify_worker_stats {
+	unsigned stid;		/**< Thread small ID, -1U if not running */
+	bool running;		/**< Whether thread is running */
+	bool active;		/**< Whether thread is processing a file */
+	uint64 files;		/**< Amount of files processed */
+	uint64 read;		/**< Amount of bytes read from files */
+	uint64 hashed;		/**< Amount of bytes fed to the hash routines */
+	uint64 busy_ms;		/**< Time spent processing files, in ms */
 };
 
-struct verify *verify_new(const struct verify_hash *);
-void verify_free(struct verify **ptr);
+struct verifier *verify_new(const struct verify_hash *);
+struct verifier *verify_new_multi(const struct verify_hash *, size_t count);
+void verify_free(struct verifier **ptr);
 
-bool verify_enqueue(struct verify *, int high_priority,
+bool verify_enqueue(struct verifier *, int high_priority,
 	const char *pathname, filesize_t offset, filesize_t filesize,
 	verify_callback callback, void *user_data);
 
 enum verify_status verify_status(const struct verify *);
 filesize_t verify_hashed(const struct verify *);
 uint verify_elapsed(const struct verify *);
+void *verify_hash_state(const struct verify *, const struct verify_hash *);
+void verify_stats_get(const struct verifier *, struct verify_stats *);
+size_t verify_worker_stats(struct verify_worker_stats *, size_t count);
 
 #endif	/* _core_verify_h_ */
 
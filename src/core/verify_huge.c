@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Combined SHA1 and TTH verification.
+ *
+ * When a library file needs to be (re)hashed, both its SHA1 and its TTH
+ * must be computed.  Rather than reading the file twice, once for each
+ * digest, this verification context feeds each chunk read from the file
+ * to both the SHA1 and the Tiger tree computations.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "verify_huge.h"
+
+#include "verify_sha1.h"
+#include "verify_tth.h"
+
+#include "lib/once.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+static struct {
+	struct verifier	*verify;
+} verify_huge;
+
+/**
+ * Enqueue file for combined SHA1 and TTH computation.
+ *
+ * @return TRUE if the item was enqueued, FALSE if it was already present.
+ */
+bool
+verify_huge_enqueue(int high_priority,
+	const char *pathname, filesize_t filesize,
+	verify_callback callback, void *user_data)
+{
+	return verify_enqueue(verify_huge.verify, high_priority,
+		pathname, 0, filesize, callback, user_data);
+}
+
+const struct sha1 *
+verify_huge_sha1(const struct verify *ctx)
+{
+	return verify_sha1_digest(ctx);
+}
+
+const struct tth *
+verify_huge_tth(const struct verify *ctx)
+{
+	return verify_tth_digest(ctx);
+}
+
+const struct tth *
+verify_huge_leaves(const struct verify *ctx)
+{
+	return verify_tth_leaves(ctx);
+}
+
+size_t
+verify_huge_leave_count(const struct verify *ctx)
+{
+	return verify_tth_leave_count(ctx);
+}
+
+static void G_COLD
+verify_huge_init_once(void)
+{
+	struct verify_hash hash[2];
+
+	hash[0] = *verify_sha1_hash();
+	hash[1] = *verify_tth_hash();
+
+	verify_huge.verify = verify_new_multi(hash, N_ITEMS(hash));
+}
+
+void G_COLD
+verify_huge_init(void)
+{
+	static once_flag_t initialized;
+
+	/*
+	 * Must use once_flag_runwait() because verify_new_multi() can create
+	 * a thread, see verify_sha1_init() for details.
+	 */
+
+	once_flag_runwait(&initialized, verify_huge_init_once);
+}
+
+/**
+ * Stops the combined verification.
+ */
+void G_COLD
+verify_huge_shutdown(void)
+{
+	verify_free(&verify_huge.verify);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -38,16 +38,23 @@
 #include "lib/misc.h"
 #include "lib/once.h"
 #include "lib/sha1.h"
+#include "lib/walloc.h"
 
 #include "core/verify_sha1.h"
 
 #include "lib/override.h"	/* Must be the last header included */
 
 static struct {
-	struct verify	*verify;
+	struct verifier	*verify;
+} verify_sha1;
+
+/**
+ * SHA1 computation state, one per file being verified.
+ */
+struct verify_sha1_state {
 	SHA1_context	context;
 	struct sha1		digest;
-} verify_sha1;
+};
 
 static const char *
 verify_sha1_name(void)
@@ -55,41 +62,72 @@ verify_sha1_name(void)
 	return "SHA-1";
 }
 
+static void *
+verify_sha1_alloc(void)
+{
+	struct verify_sha1_state *vs;
+
+	WALLOC0(vs);
+	return vs;
+}
+
 static void
-verify_sha1_reset(filesize_t amount)
+verify_sha1_free(void *state)
 {
+	struct verify_sha1_state *vs = state;
+
+	WFREE(vs);
+}
+
+static void
+verify_sha1_reset(void *state, filesize_t amount)
+{
+	struct verify_sha1_state *vs = state;
 	int ret;
 
 	(void) amount;
-	ret = SHA1_reset(&verify_sha1.context);
+	ret = SHA1_reset(&vs->context);
 	g_assert(SHA_SUCCESS == ret);
 }
 
 static int
-verify_sha1_update(const void *data, size_t size)
+verify_sha1_update(void *state, const void *data, size_t size)
 {
+	struct verify_sha1_state *vs = state;
 	int ret;
 
-	ret = SHA1_input(&verify_sha1.context, data, size);
+	ret = SHA1_input(&vs->context, data, size);
 	return SHA_SUCCESS == ret ? 0 : -1;
 }
 
 static int
-verify_sha1_final(void)
+verify_sha1_final(void *state)
 {
+	struct verify_sha1_state *vs = state;
 	int ret;
 
-	ret = SHA1_result(&verify_sha1.context, &verify_sha1.digest);
+	ret = SHA1_result(&vs->context, &vs->digest);
 	return SHA_SUCCESS == ret ? 0 : -1;
 }
 
 static const struct verify_hash verify_hash_sha1 = {
 	verify_sha1_name,
+	verify_sha1_alloc,
+	verify_sha1_free,
 	verify_sha1_reset,
 	verify_sha1_update,
 	verify_sha1_final,
 };
 
+/**
+ * @return the SHA1 hash callbacks, to build a verifier computing SHA1.
+ */
+const struct verify_hash *
+verify_sha1_hash(void)
+{
+	return &verify_hash_sha1;
+}
+
 int
 verify_sha1_enqueue(int high_priority,
 	const char *pathname, filesize_t filesize,
@@ -102,8 +140,14 @@ verify_sha1_enqueue(int high_priority,
 const struct sha1 *
 verify_sha1_digest(const struct verify *ctx)
 {
+	const struct verify_sha1_state *vs;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return &verify_sha1.digest;
+
+	vs = verify_hash_state(ctx, &verify_hash_sha1);
+	g_return_val_if_fail(vs != NULL, NULL);
+
+	return &vs->digest;
 }
 
 static void G_COLD
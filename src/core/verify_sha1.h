@@ -43,6 +43,7 @@ int verify_sha1_enqueue(int high_priority,
 	verify_callback callback, void *user_data);
 
 const struct sha1 *verify_sha1_digest(const struct verify *);
+const struct verify_hash *verify_sha1_hash(void);
 
 void verify_sha1_init(void);
 void verify_sha1_close(void);
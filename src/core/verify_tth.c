@@ -47,14 +47,21 @@
 #include "lib/tiger.h"
 #include "lib/tigertree.h"
 #include "lib/tm.h"
+#include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last inclusion */
 
 static struct {
-	struct verify	*verify;
+	struct verifier	*verify;
+} verify_tth;
+
+/**
+ * TTH computation state, one per file being verified.
+ */
+struct verify_tth_state {
 	TTH_CONTEXT		*context;
 	struct tth		digest;
-} verify_tth;
+};
 
 static const char *
 verify_tth_name(void)
@@ -62,65 +69,107 @@ verify_tth_name(void)
 	return "TTH";
 }
 
+static void *
+verify_tth_alloc(void)
+{
+	struct verify_tth_state *vs;
+
+	WALLOC0(vs);
+	vs->context = halloc(tt_size());
+	return vs;
+}
+
+static void
+verify_tth_free(void *state)
+{
+	struct verify_tth_state *vs = state;
+
+	HFREE_NULL(vs->context);
+	WFREE(vs);
+}
+
 static void
-verify_tth_reset(filesize_t size)
+verify_tth_reset(void *state, filesize_t size)
 {
-	if G_LIKELY(verify_tth.context != NULL)
-		tt_init(verify_tth.context, size);
+	struct verify_tth_state *vs = state;
+
+	tt_init(vs->context, size);
 }
 
 static int
-verify_tth_update(const void *data, size_t size)
+verify_tth_update(void *state, const void *data, size_t size)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_state *vs = state;
 
-	tt_update(verify_tth.context, data, size);
+	tt_update(vs->context, data, size);
 	return 0;
 }
 
 static int
-verify_tth_final(void)
+verify_tth_final(void *state)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_state *vs = state;
 
-	tt_digest(verify_tth.context, &verify_tth.digest);
+	tt_digest(vs->context, &vs->digest);
 	return 0;
 }
 
 static const struct verify_hash verify_hash_tth = {
 	verify_tth_name,
+	verify_tth_alloc,
+	verify_tth_free,
 	verify_tth_reset,
 	verify_tth_update,
 	verify_tth_final,
 };
 
+/**
+ * @return the TTH hash callbacks, to build a verifier computing TTH.
+ */
+const struct verify_hash *
+verify_tth_hash(void)
+{
+	return &verify_hash_tth;
+}
+
+/**
+ * @return the TTH computation state of the verification context.
+ */
+static const struct verify_tth_state *
+verify_tth_state(const struct verify *ctx)
+{
+	const struct verify_tth_state *vs;
+
+	vs = verify_hash_state(ctx, &verify_hash_tth);
+	g_assert(vs != NULL);
+
+	return vs;
+}
+
 const struct tth *
 verify_tth_digest(const struct verify *ctx)
 {
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return &verify_tth.digest;
+	return &verify_tth_state(ctx)->digest;
 }
 
 const struct tth *
 verify_tth_leaves(const struct verify *ctx)
 {
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return tt_leaves(verify_tth.context);
+	return tt_leaves(verify_tth_state(ctx)->context);
 }
 
 size_t
 verify_tth_leave_count(const struct verify *ctx)
 {
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, 0);
-	return tt_leave_count(verify_tth.context);
+	return tt_leave_count(verify_tth_state(ctx)->context);
 }
 
 static void G_COLD
 verify_tth_init_once(void)
 {
-	verify_tth.context = halloc(tt_size());
 	verify_tth.verify = verify_new(&verify_hash_tth);
 }
 
@@ -151,15 +200,6 @@ verify_tth_shutdown(void)
 	verify_free(&verify_tth.verify);
 }
 
-/**
- * Release memory resources used by tigertree verification.
- */
-void G_COLD
-verify_tth_close(void)
-{
-	HFREE_NULL(verify_tth.context);
-}
-
 static bool
 request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 	void *user_data)
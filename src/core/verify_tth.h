@@ -38,6 +38,7 @@
 #include "verify.h"
 
 struct tth;
+struct shared_file;
 
 bool verify_tth_append(const char *pathname,
 		filesize_t offset, filesize_t amount,
@@ -50,10 +51,10 @@ bool verify_tth_prepend(const char *pathname,
 const struct tth *verify_tth_digest(const struct verify *);
 const struct tth *verify_tth_leaves(const struct verify *);
 size_t verify_tth_leave_count(const struct verify *);
+const struct verify_hash *verify_tth_hash(void);
 
 void verify_tth_init(void);
 void verify_tth_shutdown(void);
-void verify_tth_close(void);
 
 void request_tigertree(struct shared_file *sf, bool high_priority);
 
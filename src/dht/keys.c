@@ -1610,7 +1610,8 @@ void G_COLD
 keys_init(void)
 {
 	size_t i;
-	dbstore_kv_t kv = { KUID_RAW_SIZE, NULL, sizeof(struct keydata), 0 };
+	dbstore_kv_t kv = { KUID_RAW_SIZE, NULL, sizeof(struct keydata), 0,
+		DBSTORE_F_MMAP_COW | DBSTORE_F_FILTER };
 	dbstore_packing_t packing =
 		{ serialize_keydata, deserialize_keydata, NULL };
 
@@ -2085,8 +2085,10 @@ values_init(void)
 {
 	dbstore_kv_t value_kv =
 		{ sizeof(uint64), NULL, sizeof(struct valuedata), 0 };
-	dbstore_kv_t raw_kv		= { sizeof(uint64), NULL, DHT_VALUE_MAX_LEN, 0 };
-	dbstore_kv_t expired_kv	= { 2 * KUID_RAW_SIZE, NULL, 0, 0 };
+	dbstore_kv_t raw_kv		=
+		{ sizeof(uint64), NULL, DHT_VALUE_MAX_LEN, 0, DBSTORE_F_MMAP_COW };
+	dbstore_kv_t expired_kv	=
+		{ 2 * KUID_RAW_SIZE, NULL, 0, 0, DBSTORE_F_FILTER };
 	dbstore_packing_t value_packing =
 		{ serialize_valuedata, deserialize_valuedata, NULL };
 	dbstore_packing_t no_packing = { NULL, NULL, NULL };
@@ -2112,6 +2114,16 @@ values_init(void)
 		expired_kv, no_packing, 0, kuid_pair_hash, kuid_pair_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
 
+	/*
+	 * Journal updates to the persistent value store so that it can be
+	 * recovered after a crash without a rebuild.
+	 */
+
+	if (GNET_PROPERTY(dht_storage_wal)) {
+		dbmw_set_wal(db_valuedata, TRUE);
+		dbmw_set_wal(db_rawdata, TRUE);
+	}
+
 	values_per_ip = acct_net_create();
 	values_per_class_c = acct_net_create();
 	expired = hset_create_any(uint64_hash, NULL, uint64_eq);
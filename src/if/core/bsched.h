@@ -71,6 +71,7 @@ typedef struct bio_source {
 	uint bw_last_bps;				/**< B/w used last period (bps) */
 	uint bw_fast_ema;				/**< Fast EMA of actual bandwidth used */
 	uint bw_slow_ema;				/**< Slow EMA of actual bandwidth used */
+	struct bio_uring *uring;		/**< Asynchronous I/O state, if any */
 } bio_source_t;
 
 /*
@@ -83,6 +84,7 @@ typedef struct bio_source {
 #define BIO_F_USED			(1 << 3)	/**< Source used this period */
 #define BIO_F_FAVOUR		(1 << 4)	/**< Try to favour source this period */
 #define BIO_F_PASSIVE		(1 << 5)	/**< Don't insert source for events */
+#define BIO_F_INFLIGHT		(1 << 6)	/**< Asynchronous I/O in progress */
 
 #define BIO_F_RW			(BIO_F_READ|BIO_F_WRITE)
 
@@ -103,6 +103,7 @@ struct dl_server {
 	uint speed_avg;			/**< Average (EMA) upload speed, in bytes/sec */
 	unsigned latency;		/**< HTTP latency, in ms (EMA) */
 	uint32 attrs;
+	uint sched_idx;			/**< Position in scheduling heap + 1, 0 if none */
 	uint16 country;			/**< Country of origin -- encoded ISO3166 */
 };
 
@@ -165,6 +166,9 @@ struct dl_buffers {
 	slist_t *list;			/**< List of pmsg_t items */
 	size_t amount;			/**< Amount to buffer (extra is read-ahead) */
 	size_t held;			/**< Amount of data held in read buffers */
+	size_t inflight;		/**< Amount of data being written in background */
+	int error;				/**< Last background write error (errno) */
+	bool throttled;			/**< Reception disabled until pool has room */
 };
 
 /**
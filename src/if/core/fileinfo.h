@@ -26,6 +26,7 @@
 
 #include "common.h"
 
+#include "lib/erbtree.h"
 #include "lib/eslist.h"
 #include "lib/http_range.h"
 #include "lib/path.h"
@@ -170,9 +171,12 @@ typedef struct dl_file_info {
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
 	eslist_t chunklist;		/**< List of ranges within file */
+	erbtree_t chunkmap;		/**< Same chunks, indexed by range */
+	erbtree_t emptymap;		/**< Empty chunks only, indexed by range */
 	eslist_t available;		/**< List of ranges available, with source count */
 	http_rangeset_t *seen_on_network;  /**< Ranges available on network */
 	uint32 generation;		/**< Generation number, incremented on disk update */
+	uint32 db_hash;			/**< Hash of record saved in DB, 0 if none */
 	struct shared_file *sf;	/**< When PFSP-server is enabled, share this file */
 	uint32 active_queued;	/**< Actively queued sources */
 	uint32 passive_queued;	/**< Passively queued sources */
@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Nov  6 23:31:52 2016 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Sat Oct 17 04:28:27 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -37,6 +37,8 @@ static const char *stats_symbols[] = {
 	"local_g2_hits",
 	"local_g2_partial_hits",
 	"local_aliased_hits",
+	"local_query_cache_hits",
+	"local_query_cache_misses",
 	"oob_proxied_query_hits",
 	"oob_queries",
 	"oob_queries_stripped",
@@ -116,6 +118,14 @@ static const char *stats_symbols[] = {
 	"udp_bogus_source_ip",
 	"udp_shunned_source_ip",
 	"udp_rx_truncated",
+	"udp_rx_batches",
+	"udp_rx_batched",
+	"udp_tx_batches",
+	"udp_tx_batched",
+	"udp_tx_batch_lost",
+	"udp_ingress_queued",
+	"udp_ingress_overflow",
+	"udp_ingress_backlog_max",
 	"udp_alien_message",
 	"udp_unprocessed_message",
 	"udp_tx_compressed",
@@ -176,6 +186,11 @@ static const char *stats_symbols[] = {
 	"udp_g2_hits_undelivered",
 	"consolidated_servers",
 	"dup_downloads_in_consolidation",
+	"dl_pickup_servers_examined",
+	"dl_pickup_servers_scheduled",
+	"dl_writes_async",
+	"dl_writes_coalesced",
+	"dl_writes_throttled",
 	"discovered_server_guid",
 	"changed_server_guid",
 	"guid_collisions",
@@ -367,6 +382,8 @@ static const char *stats_text[] = {
 	N_("G2 hits on local DB"),
 	N_("G2 hits on local partial files"),
 	N_("Hits on aliased queries"),
+	N_("Local searches served from the query cache"),
+	N_("Local searches missing the query cache"),
 	N_("Query hits received for OOB-proxied queries"),
 	N_("Queries requesting OOB hit delivery"),
 	N_("Stripped OOB flag on queries"),
@@ -446,6 +463,14 @@ static const char *stats_text[] = {
 	N_("UDP messages with bogus source IP"),
 	N_("UDP messages from shunned IP (discarded)"),
 	N_("UDP truncated incoming messages"),
+	N_("UDP datagram batches received via recvmmsg()"),
+	N_("UDP datagrams received in batches"),
+	N_("UDP datagram batches sent via sendmmsg()"),
+	N_("UDP datagrams sent in batches"),
+	N_("UDP batched datagrams lost on send errors"),
+	N_("UDP datagrams queued by the ingress thread"),
+	N_("UDP datagrams dropped on ingress ring overflow"),
+	N_("Max UDP datagrams held in the ingress ring"),
 	N_("Alien UDP messages (non-Gnutella)"),
 	N_("Unprocessed UDP Gnutella messages"),
 	N_("Compressed UDP messages enqueued"),
@@ -506,6 +531,11 @@ static const char *stats_text[] = {
 	N_("UDP G2 hits undelivered"),
 	N_("Consolidated servers (after GUID and IP address linking)"),
 	N_("Duplicate downloads found during server consolidation"),
+	N_("Servers examined for download scheduling"),
+	N_("Servers scheduled for download examination"),
+	N_("Downloaded data blocks written in the background"),
+	N_("Downloaded data blocks coalesced with others"),
+	N_("Download receptions throttled by full write pool"),
 	N_("Discovered server GUIDs"),
 	N_("Changed server GUIDs"),
 	N_("Detected GUID collisions"),
@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Nov  6 23:31:52 2016 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Sat Oct 17 04:28:27 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,7 +8,7 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 309
+ * Enum count: 324
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
@@ -33,6 +33,8 @@ typedef enum {
 	GNR_LOCAL_G2_HITS,
 	GNR_LOCAL_G2_PARTIAL_HITS,
 	GNR_LOCAL_ALIASED_HITS,
+	GNR_LOCAL_QUERY_CACHE_HITS,
+	GNR_LOCAL_QUERY_CACHE_MISSES,
 	GNR_OOB_PROXIED_QUERY_HITS,
 	GNR_OOB_QUERIES,
 	GNR_OOB_QUERIES_STRIPPED,
@@ -112,6 +114,14 @@ typedef enum {
 	GNR_UDP_BOGUS_SOURCE_IP,
 	GNR_UDP_SHUNNED_SOURCE_IP,
 	GNR_UDP_RX_TRUNCATED,
+	GNR_UDP_RX_BATCHES,
+	GNR_UDP_RX_BATCHED,
+	GNR_UDP_TX_BATCHES,
+	GNR_UDP_TX_BATCHED,
+	GNR_UDP_TX_BATCH_LOST,
+	GNR_UDP_INGRESS_QUEUED,
+	GNR_UDP_INGRESS_OVERFLOW,
+	GNR_UDP_INGRESS_BACKLOG_MAX,
 	GNR_UDP_ALIEN_MESSAGE,
 	GNR_UDP_UNPROCESSED_MESSAGE,
 	GNR_UDP_TX_COMPRESSED,
@@ -172,6 +182,11 @@ typedef enum {
 	GNR_UDP_G2_HITS_UNDELIVERED,
 	GNR_CONSOLIDATED_SERVERS,
 	GNR_DUP_DOWNLOADS_IN_CONSOLIDATION,
+	GNR_DL_PICKUP_SERVERS_EXAMINED,
+	GNR_DL_PICKUP_SERVERS_SCHEDULED,
+	GNR_DL_WRITES_ASYNC,
+	GNR_DL_WRITES_COALESCED,
+	GNR_DL_WRITES_THROTTLED,
 	GNR_DISCOVERED_SERVER_GUID,
 	GNR_CHANGED_SERVER_GUID,
 	GNR_GUID_COLLISIONS,
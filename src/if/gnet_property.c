@@ -1124,6 +1124,28 @@ gboolean gnet_property_variable_tcp_no_listening     = FALSE;
 static const gboolean gnet_property_variable_tcp_no_listening_default = FALSE;
 gboolean gnet_property_variable_query_trace     = FALSE;
 static const gboolean gnet_property_variable_query_trace_default = FALSE;
+guint32  gnet_property_variable_verify_workers     = 0;
+static const guint32  gnet_property_variable_verify_workers_default = 0;
+guint32  gnet_property_variable_verify_device_workers     = 1;
+static const guint32  gnet_property_variable_verify_device_workers_default = 1;
+guint32  gnet_property_variable_io_reactors     = 0;
+static const guint32  gnet_property_variable_io_reactors_default = 0;
+gboolean gnet_property_variable_upload_io_uring     = FALSE;
+static const gboolean gnet_property_variable_upload_io_uring_default = FALSE;
+gboolean gnet_property_variable_download_write_async     = TRUE;
+static const gboolean gnet_property_variable_download_write_async_default = TRUE;
+guint32  gnet_property_variable_download_write_pool     = 4194304;
+static const guint32  gnet_property_variable_download_write_pool_default = 4194304;
+gboolean gnet_property_variable_dht_storage_wal     = TRUE;
+static const gboolean gnet_property_variable_dht_storage_wal_default = TRUE;
+gboolean gnet_property_variable_udp_mmsg     = TRUE;
+static const gboolean gnet_property_variable_udp_mmsg_default = TRUE;
+gboolean gnet_property_variable_udp_ingress_thread     = FALSE;
+static const gboolean gnet_property_variable_udp_ingress_thread_default = FALSE;
+gboolean gnet_property_variable_qrp_async_processing     = TRUE;
+static const gboolean gnet_property_variable_qrp_async_processing_default = TRUE;
+guint32  gnet_property_variable_qrp_workers     = 0;
+static const guint32  gnet_property_variable_qrp_workers_default = 0;
 
 static prop_set_t *gnet_property;
 
@@ -11313,6 +11335,230 @@ gnet_prop_init(void) {
     gnet_property->props[483].data.boolean.def   = (void *) &gnet_property_variable_query_trace_default;
     gnet_property->props[483].data.boolean.value = (void *) &gnet_property_variable_query_trace;
 
+
+    /*
+     * PROP_VERIFY_WORKERS:
+     *
+     * General data:
+     */
+    gnet_property->props[484].name = "verify_workers";
+    gnet_property->props[484].desc = _("Amount of threads used to compute file digests.  When set to 0, the amount is derived from the number of CPUs.");
+    gnet_property->props[484].ev_changed = event_new("verify_workers_changed");
+    gnet_property->props[484].save = TRUE;
+    gnet_property->props[484].internal = FALSE;
+    gnet_property->props[484].vector_size = 1;
+	mutex_init(&gnet_property->props[484].lock);
+
+    /* Type specific data: */
+    gnet_property->props[484].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[484].data.guint32.def   = (void *) &gnet_property_variable_verify_workers_default;
+    gnet_property->props[484].data.guint32.value = (void *) &gnet_property_variable_verify_workers;
+    gnet_property->props[484].data.guint32.choices = NULL;
+    gnet_property->props[484].data.guint32.max   = 8;
+    gnet_property->props[484].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_VERIFY_DEVICE_WORKERS:
+     *
+     * General data:
+     */
+    gnet_property->props[485].name = "verify_device_workers";
+    gnet_property->props[485].desc = _("Maximum amount of threads allowed to concurrently read files from the same device when computing digests.");
+    gnet_property->props[485].ev_changed = event_new("verify_device_workers_changed");
+    gnet_property->props[485].save = TRUE;
+    gnet_property->props[485].internal = FALSE;
+    gnet_property->props[485].vector_size = 1;
+	mutex_init(&gnet_property->props[485].lock);
+
+    /* Type specific data: */
+    gnet_property->props[485].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[485].data.guint32.def   = (void *) &gnet_property_variable_verify_device_workers_default;
+    gnet_property->props[485].data.guint32.value = (void *) &gnet_property_variable_verify_device_workers;
+    gnet_property->props[485].data.guint32.choices = NULL;
+    gnet_property->props[485].data.guint32.max   = 8;
+    gnet_property->props[485].data.guint32.min   = 1;
+
+
+    /*
+     * PROP_IO_REACTORS:
+     *
+     * General data:
+     */
+    gnet_property->props[486].name = "io_reactors";
+    gnet_property->props[486].desc = _("Amount of reactor threads collecting network I/O events with epoll(), the callbacks still running in the main thread.  When set to 0, all the events are collected by the main thread.  Changing the amount once reactors have been started requires a restart.");
+    gnet_property->props[486].ev_changed = event_new("io_reactors_changed");
+    gnet_property->props[486].save = TRUE;
+    gnet_property->props[486].internal = FALSE;
+    gnet_property->props[486].vector_size = 1;
+	mutex_init(&gnet_property->props[486].lock);
+
+    /* Type specific data: */
+    gnet_property->props[486].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[486].data.guint32.def   = (void *) &gnet_property_variable_io_reactors_default;
+    gnet_property->props[486].data.guint32.value = (void *) &gnet_property_variable_io_reactors;
+    gnet_property->props[486].data.guint32.choices = NULL;
+    gnet_property->props[486].data.guint32.max   = 16;
+    gnet_property->props[486].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_UPLOAD_IO_URING:
+     *
+     * General data:
+     */
+    gnet_property->props[487].name = "upload_io_uring";
+    gnet_property->props[487].desc = _("Whether uploads should read files and write to sockets through the Linux io_uring interface, which batches the I/O of all the active uploads.  This has no effect when the kernel does not support it or for TLS connections.");
+    gnet_property->props[487].ev_changed = event_new("upload_io_uring_changed");
+    gnet_property->props[487].save = TRUE;
+    gnet_property->props[487].internal = FALSE;
+    gnet_property->props[487].vector_size = 1;
+	mutex_init(&gnet_property->props[487].lock);
+
+    /* Type specific data: */
+    gnet_property->props[487].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[487].data.boolean.def   = (void *) &gnet_property_variable_upload_io_uring_default;
+    gnet_property->props[487].data.boolean.value = (void *) &gnet_property_variable_upload_io_uring;
+
+
+    /*
+     * PROP_DOWNLOAD_WRITE_ASYNC:
+     *
+     * General data:
+     */
+    gnet_property->props[488].name = "download_write_async";
+    gnet_property->props[488].desc = _("Whether downloaded data should be written to disk by a background thread, so that a slow disk does not stall the whole process.");
+    gnet_property->props[488].ev_changed = event_new("download_write_async_changed");
+    gnet_property->props[488].save = TRUE;
+    gnet_property->props[488].internal = FALSE;
+    gnet_property->props[488].vector_size = 1;
+	mutex_init(&gnet_property->props[488].lock);
+
+    /* Type specific data: */
+    gnet_property->props[488].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[488].data.boolean.def   = (void *) &gnet_property_variable_download_write_async_default;
+    gnet_property->props[488].data.boolean.value = (void *) &gnet_property_variable_download_write_async;
+
+
+    /*
+     * PROP_DOWNLOAD_WRITE_POOL:
+     *
+     * General data:
+     */
+    gnet_property->props[489].name = "download_write_pool";
+    gnet_property->props[489].desc = _("Maximum amount of downloaded data, in bytes, that can be held whilst waiting to be written to disk by the background thread.  When full, reception is throttled.");
+    gnet_property->props[489].ev_changed = event_new("download_write_pool_changed");
+    gnet_property->props[489].save = TRUE;
+    gnet_property->props[489].internal = FALSE;
+    gnet_property->props[489].vector_size = 1;
+	mutex_init(&gnet_property->props[489].lock);
+
+    /* Type specific data: */
+    gnet_property->props[489].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[489].data.guint32.def   = (void *) &gnet_property_variable_download_write_pool_default;
+    gnet_property->props[489].data.guint32.value = (void *) &gnet_property_variable_download_write_pool;
+    gnet_property->props[489].data.guint32.choices = NULL;
+    gnet_property->props[489].data.guint32.max   = 268435456;
+    gnet_property->props[489].data.guint32.min   = 131072;
+
+
+    /*
+     * PROP_DHT_STORAGE_WAL:
+     *
+     * General data:
+     */
+    gnet_property->props[490].name = "dht_storage_wal";
+    gnet_property->props[490].desc = _("If TRUE, updates to the DHT value store on disk go through a write-ahead log, so that it can be recovered without a rebuild after a crash.");
+    gnet_property->props[490].ev_changed = event_new("dht_storage_wal_changed");
+    gnet_property->props[490].save = TRUE;
+    gnet_property->props[490].internal = FALSE;
+    gnet_property->props[490].vector_size = 1;
+	mutex_init(&gnet_property->props[490].lock);
+
+    /* Type specific data: */
+    gnet_property->props[490].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[490].data.boolean.def   = (void *) &gnet_property_variable_dht_storage_wal_default;
+    gnet_property->props[490].data.boolean.value = (void *) &gnet_property_variable_dht_storage_wal;
+
+
+    /*
+     * PROP_UDP_MMSG:
+     *
+     * General data:
+     */
+    gnet_property->props[491].name = "udp_mmsg";
+    gnet_property->props[491].desc = _("Whether UDP datagrams should be received and sent in batches, using recvmmsg() and sendmmsg() when the kernel supports them, to reduce the amount of system calls.");
+    gnet_property->props[491].ev_changed = event_new("udp_mmsg_changed");
+    gnet_property->props[491].save = TRUE;
+    gnet_property->props[491].internal = FALSE;
+    gnet_property->props[491].vector_size = 1;
+	mutex_init(&gnet_property->props[491].lock);
+
+    /* Type specific data: */
+    gnet_property->props[491].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[491].data.boolean.def   = (void *) &gnet_property_variable_udp_mmsg_default;
+    gnet_property->props[491].data.boolean.value = (void *) &gnet_property_variable_udp_mmsg;
+
+
+    /*
+     * PROP_UDP_INGRESS_THREAD:
+     *
+     * General data:
+     */
+    gnet_property->props[492].name = "udp_ingress_thread";
+    gnet_property->props[492].desc = _("Whether datagrams received on the Gnutella UDP sockets should be read and classified by a dedicated thread, leaving only their processing to the main thread.");
+    gnet_property->props[492].ev_changed = event_new("udp_ingress_thread_changed");
+    gnet_property->props[492].save = TRUE;
+    gnet_property->props[492].internal = FALSE;
+    gnet_property->props[492].vector_size = 1;
+	mutex_init(&gnet_property->props[492].lock);
+
+    /* Type specific data: */
+    gnet_property->props[492].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[492].data.boolean.def   = (void *) &gnet_property_variable_udp_ingress_thread_default;
+    gnet_property->props[492].data.boolean.value = (void *) &gnet_property_variable_udp_ingress_thread;
+
+
+    /*
+     * PROP_QRP_ASYNC_PROCESSING:
+     *
+     * General data:
+     */
+    gnet_property->props[493].name = "qrp_async_processing";
+    gnet_property->props[493].desc = _("Whether received QRP patches are decompressed and applied, and leaf QRP tables merged, by background threads instead of the main thread.");
+    gnet_property->props[493].ev_changed = event_new("qrp_async_processing_changed");
+    gnet_property->props[493].save = TRUE;
+    gnet_property->props[493].internal = FALSE;
+    gnet_property->props[493].vector_size = 1;
+	mutex_init(&gnet_property->props[493].lock);
+
+    /* Type specific data: */
+    gnet_property->props[493].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[493].data.boolean.def   = (void *) &gnet_property_variable_qrp_async_processing_default;
+    gnet_property->props[493].data.boolean.value = (void *) &gnet_property_variable_qrp_async_processing;
+
+
+    /*
+     * PROP_QRP_WORKERS:
+     *
+     * General data:
+     */
+    gnet_property->props[494].name = "qrp_workers";
+    gnet_property->props[494].desc = _("Amount of threads used to process received QRP tables.  When set to 0, the amount is derived from the number of CPUs.");
+    gnet_property->props[494].ev_changed = event_new("qrp_workers_changed");
+    gnet_property->props[494].save = TRUE;
+    gnet_property->props[494].internal = FALSE;
+    gnet_property->props[494].vector_size = 1;
+	mutex_init(&gnet_property->props[494].lock);
+
+    /* Type specific data: */
+    gnet_property->props[494].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[494].data.guint32.def   = (void *) &gnet_property_variable_qrp_workers_default;
+    gnet_property->props[494].data.guint32.value = (void *) &gnet_property_variable_qrp_workers;
+    gnet_property->props[494].data.guint32.choices = NULL;
+    gnet_property->props[494].data.guint32.max   = 8;
+    gnet_property->props[494].data.guint32.min   = 0;
+
     gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
     for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
         htable_insert(gnet_property->by_name,
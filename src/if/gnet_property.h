@@ -520,6 +520,17 @@ typedef enum {
     PROP_SESSION_START_STAMP,
     PROP_TCP_NO_LISTENING,
     PROP_QUERY_TRACE,
+    PROP_VERIFY_WORKERS,
+    PROP_VERIFY_DEVICE_WORKERS,
+    PROP_IO_REACTORS,
+    PROP_UPLOAD_IO_URING,
+    PROP_DOWNLOAD_WRITE_ASYNC,
+    PROP_DOWNLOAD_WRITE_POOL,
+    PROP_DHT_STORAGE_WAL,
+    PROP_UDP_MMSG,
+    PROP_UDP_INGRESS_THREAD,
+    PROP_QRP_ASYNC_PROCESSING,
+    PROP_QRP_WORKERS,
     GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -535,6 +535,17 @@ extern const time_t  gnet_property_variable_session_start_stamp;
 extern const gboolean gnet_property_variable_tcp_no_listening;
 extern const gboolean gnet_property_variable_query_trace;
 
+extern const guint32  gnet_property_variable_verify_workers;
+extern const guint32  gnet_property_variable_verify_device_workers;
+extern const guint32  gnet_property_variable_io_reactors;
+extern const gboolean gnet_property_variable_upload_io_uring;
+extern const gboolean gnet_property_variable_download_write_async;
+extern const guint32  gnet_property_variable_download_write_pool;
+extern const gboolean gnet_property_variable_dht_storage_wal;
+extern const gboolean gnet_property_variable_udp_mmsg;
+extern const gboolean gnet_property_variable_udp_ingress_thread;
+extern const gboolean gnet_property_variable_qrp_async_processing;
+extern const guint32  gnet_property_variable_qrp_workers;
 
 prop_set_t *gnet_prop_init(void);
 void gnet_prop_shutdown(void);
@@ -398,6 +398,34 @@ done:
 	aging_return(ag, found);
 }
 
+/**
+ * Remove the oldest entry from the table, freeing it if we have a key
+ * free routine.
+ *
+ * This is useful to make room in a table whose size is bounded.
+ *
+ * @return whether an entry was removed, FALSE when the table was empty.
+ */
+bool
+aging_remove_oldest(aging_table_t *ag)
+{
+	struct aging_value *aval;
+
+	aging_check(ag);
+
+	aging_synchronize(ag);
+
+	aval = elist_head(&ag->list);
+
+	if (NULL == aval)
+		aging_return(ag, FALSE);
+
+	hikset_remove(ag->table, aval->key);
+	aging_free(aval, ag);
+
+	aging_return(ag, TRUE);
+}
+
 /**
  * Add value to the table.
  *
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Counting Bloom filter.
+ *
+ * A Bloom filter answers set membership queries with no false negatives
+ * but with a tunable rate of false positives.  Using small counters instead
+ * of single bits allows keys to be removed from the set as well, which is
+ * what we need to track the keys present in a database that is updated.
+ *
+ * Counters are 8-bit wide and saturate: once a counter reaches its maximum
+ * value it is never decremented again since we no longer know how many keys
+ * map to it.  This can only increase the false positive rate, never create
+ * false negatives.
+ *
+ * With CBLOOM_RATIO counters per key and CBLOOM_HASHES hash functions, the
+ * false positive rate stays around 1% as long as the amount of keys in the
+ * filter does not exceed its capacity.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cbloom.h"
+
+#include "halloc.h"
+#include "hashing.h"
+#include "pow2.h"
+#include "walloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define CBLOOM_RATIO	10		/**< Counters per expected key */
+#define CBLOOM_HASHES	7		/**< Amount of hash functions */
+#define CBLOOM_MIN		64		/**< Minimum capacity */
+#define CBLOOM_MAX		(1U << 31)	/**< Maximum amount of counters */
+
+enum cbloom_magic { CBLOOM_MAGIC = 0x0c1b5a3e };
+
+/**
+ * A counting Bloom filter.
+ */
+struct cbloom {
+	enum cbloom_magic magic;
+	uint8 *counters;			/**< Array of counters */
+	size_t size;				/**< Amount of counters, a power of 2 */
+	size_t capacity;			/**< Expected maximum amount of keys */
+	size_t count;				/**< Amount of keys currently held */
+};
+
+static inline void
+cbloom_check(const struct cbloom * const cb)
+{
+	g_assert(cb != NULL);
+	g_assert(CBLOOM_MAGIC == cb->magic);
+}
+
+/**
+ * Compute the counter indices for a key, using double hashing to derive
+ * all the hash values from two independent ones.
+ */
+static void
+cbloom_indices(const cbloom_t *cb, const void *key, size_t len,
+	size_t idx[CBLOOM_HASHES])
+{
+	unsigned h1, h2, i;
+	size_t mask = cb->size - 1;
+
+	h1 = binary_hash(key, len);
+	h2 = binary_hash2(key, len) | 1;	/* Odd, hence coprime with size */
+
+	for (i = 0; i < CBLOOM_HASHES; i++) {
+		idx[i] = h1 & mask;
+		h1 += h2;
+	}
+}
+
+/**
+ * Create a new counting Bloom filter.
+ *
+ * @param capacity		expected maximum amount of keys held
+ *
+ * @return new filter, to be freed with cbloom_free_null().
+ */
+cbloom_t *
+cbloom_make(size_t capacity)
+{
+	cbloom_t *cb;
+	size_t n;
+
+	capacity = MAX(capacity, CBLOOM_MIN);
+	n = MIN(capacity, CBLOOM_MAX / CBLOOM_RATIO) * CBLOOM_RATIO;
+
+	WALLOC0(cb);
+	cb->magic = CBLOOM_MAGIC;
+	cb->size = next_pow2(n);
+	cb->capacity = cb->size / CBLOOM_RATIO;
+	cb->counters = halloc0(cb->size);
+
+	return cb;
+}
+
+/**
+ * Free filter and nullify its pointer.
+ */
+void
+cbloom_free_null(cbloom_t **cb_ptr)
+{
+	cbloom_t *cb = *cb_ptr;
+
+	if (cb != NULL) {
+		cbloom_check(cb);
+		HFREE_NULL(cb->counters);
+		cb->magic = 0;
+		WFREE(cb);
+		*cb_ptr = NULL;
+	}
+}
+
+/**
+ * Record key in the filter.
+ */
+void
+cbloom_add(cbloom_t *cb, const void *key, size_t len)
+{
+	size_t idx[CBLOOM_HASHES];
+	unsigned i;
+
+	cbloom_check(cb);
+
+	cbloom_indices(cb, key, len, idx);
+
+	for (i = 0; i < CBLOOM_HASHES; i++) {
+		uint8 *c = &cb->counters[idx[i]];
+		if (*c != MAX_INT_VAL(uint8))
+			(*c)++;
+	}
+
+	cb->count++;
+}
+
+/**
+ * Remove key from the filter.
+ *
+ * The key must have been previously added, otherwise we could create false
+ * negatives for other keys.  When one of the counters is already zero, the
+ * key cannot be present and the filter is left untouched.
+ */
+void
+cbloom_remove(cbloom_t *cb, const void *key, size_t len)
+{
+	size_t idx[CBLOOM_HASHES];
+	unsigned i;
+
+	cbloom_check(cb);
+
+	cbloom_indices(cb, key, len, idx);
+
+	for (i = 0; i < CBLOOM_HASHES; i++) {
+		if G_UNLIKELY(0 == cb->counters[idx[i]])
+			return;
+	}
+
+	for (i = 0; i < CBLOOM_HASHES; i++) {
+		uint8 *c = &cb->counters[idx[i]];
+		if (*c != MAX_INT_VAL(uint8))
+			(*c)--;				/* Saturated counters are sticky */
+	}
+
+	if (cb->count != 0)
+		cb->count--;
+}
+
+/**
+ * Check whether key may be present in the filter.
+ *
+ * @return FALSE if the key is definitely absent, TRUE if it may be present.
+ */
+bool
+cbloom_contains(const cbloom_t *cb, const void *key, size_t len)
+{
+	size_t idx[CBLOOM_HASHES];
+	unsigned i;
+
+	cbloom_check(cb);
+
+	cbloom_indices(cb, key, len, idx);
+
+	for (i = 0; i < CBLOOM_HASHES; i++) {
+		if (0 == cb->counters[idx[i]])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Forget about all the keys held in the filter.
+ */
+void
+cbloom_clear(cbloom_t *cb)
+{
+	cbloom_check(cb);
+
+	memset(cb->counters, 0, cb->size);
+	cb->count = 0;
+}
+
+/**
+ * @return the amount of keys the filter was sized for.
+ */
+size_t
+cbloom_capacity(const cbloom_t *cb)
+{
+	cbloom_check(cb);
+
+	return cb->capacity;
+}
+
+/**
+ * @return the amount of keys held in the filter.
+ */
+size_t
+cbloom_count(const cbloom_t *cb)
+{
+	cbloom_check(cb);
+
+	return cb->count;
+}
+
+/**
+ * @return the amount of memory used by the filter, in bytes.
+ */
+size_t
+cbloom_memory(const cbloom_t *cb)
+{
+	cbloom_check(cb);
+
+	return sizeof *cb + cb->size;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -1389,6 +1389,85 @@ dbmap_rebuild(dbmap_t *dm)
 	return FALSE;
 }
 
+/**
+ * Start an incremental rebuild of the database (to compact it on disk).
+ * @return TRUE if no error occurred.
+ */
+bool
+dbmap_rebuild_start(dbmap_t *dm)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return TRUE;
+	case DBMAP_SDBM:
+		return 0 == sdbm_rebuild_start(dm->u.s.sdbm);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return FALSE;
+}
+
+/**
+ * Perform the next slice of an incremental rebuild.
+ *
+ * @param dm		the DB map
+ * @param pages		maximum amount of pages to copy
+ *
+ * @return 1 if more work remains, 0 when done, -1 on error with errno set.
+ */
+int
+dbmap_rebuild_step(dbmap_t *dm, long pages)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		return sdbm_rebuild_step(dm->u.s.sdbm, pages);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return -1;
+}
+
+/**
+ * Abort incremental rebuild, if any.
+ */
+void
+dbmap_rebuild_abort(dbmap_t *dm)
+{
+	dbmap_check(dm);
+
+	if (DBMAP_SDBM == dm->type)
+		sdbm_rebuild_abort(dm->u.s.sdbm);
+}
+
+/**
+ * Fetch progress of the incremental rebuild, in pages.
+ *
+ * @return whether an incremental rebuild is in progress.
+ */
+bool
+dbmap_rebuild_progress(const dbmap_t *dm, long *done, long *total)
+{
+	dbmap_check(dm);
+
+	if (DBMAP_SDBM == dm->type)
+		return sdbm_rebuild_progress(dm->u.s.sdbm, done, total);
+
+	if (done != NULL)
+		*done = 0;
+	if (total != NULL)
+		*total = 0;
+
+	return FALSE;
+}
+
 /**
  * Discard all data from the database.
  * @return TRUE if no error occurred.
@@ -1459,6 +1538,48 @@ dbmap_set_deferred_writes(dbmap_t *dm, bool on)
 	return 0;
 }
 
+/**
+ * Turn the SDBM write-ahead log on or off.
+ * @return 0 if OK, -1 on errors with errno set.
+ */
+int
+dbmap_set_wal(dbmap_t *dm, bool on)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		return sdbm_set_wal(dm->u.s.sdbm, on);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return 0;
+}
+
+/**
+ * Configure how SDBM reads pages from memory-mapped files (DBM_MMAP_*).
+ * @return 0 if OK, -1 on errors with errno set.
+ */
+int
+dbmap_set_mmap(dbmap_t *dm, int mode)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		return sdbm_set_mmap(dm->u.s.sdbm, mode);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return 0;
+}
+
 /**
  * Tell SDBM whether it is volatile.
  * @return 0 if OK, -1 on errors with errno set.
@@ -119,10 +119,16 @@ bool dbmap_store(dbmap_t *dm, const char *base, bool inplace);
 bool dbmap_copy(dbmap_t *from, dbmap_t *to);
 bool dbmap_shrink(dbmap_t *dm);
 bool dbmap_rebuild(dbmap_t *dm);
+bool dbmap_rebuild_start(dbmap_t *dm);
+int dbmap_rebuild_step(dbmap_t *dm, long pages);
+void dbmap_rebuild_abort(dbmap_t *dm);
+bool dbmap_rebuild_progress(const dbmap_t *dm, long *done, long *total);
 bool dbmap_clear(dbmap_t *dm);
 ssize_t dbmap_sync(dbmap_t *dm);
 int dbmap_set_cachesize(dbmap_t *dm, long pages);
 int dbmap_set_deferred_writes(dbmap_t *dm, bool on);
+int dbmap_set_wal(dbmap_t *dm, bool on);
+int dbmap_set_mmap(dbmap_t *dm, int mode);
 int dbmap_set_volatile(dbmap_t *dm, bool is_volatile);
 void dbmap_set_debugging(dbmap_t *dm, const struct dbg_config *dbg);
 
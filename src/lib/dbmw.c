@@ -36,10 +36,13 @@
 
 #include "dbmw.h"
 
+#include "atoms.h"
 #include "bstr.h"
+#include "cbloom.h"
 #include "dbmap.h"
 #include "debug.h"
 #include "hashlist.h"
+#include "hset.h"
 #include "map.h"
 #include "pmsg.h"
 #include "pslist.h"
@@ -51,6 +54,8 @@
 #include "override.h"			/* Must be the last header included */
 
 #define DBMW_CACHE	128			/**< Default amount of items to cache */
+#define DBMW_GHOSTS	64			/**< Minimum amount of ghost keys kept */
+#define DBMW_FRESH	4			/**< 1/4 of cache budget for fresh entries */
 
 enum dbmw_magic { DBMW_MAGIC = 0x28e7e7d2U };
 
@@ -63,17 +68,28 @@ struct dbmw {
 	const char *name;			/**< DB name, for logging */
 	pmsg_t *mb;					/**< Message block used for serialization */
 	bstr_t *bs;					/**< Binary stream used for deserialization */
-	hash_list_t *keys;			/**< LRU list of keys cached */
+	hash_list_t *keys;			/**< LRU list of frequently used keys */
+	hash_list_t *fresh;			/**< FIFO list of recently cached keys */
+	hash_list_t *ghosts;		/**< Keys recently evicted from fresh list */
 	map_t *values;				/**< Map of values cached */
 	uint64 r_access;			/**< Number of read accesses */
 	uint64 w_access;			/**< Number of write accesses */
 	uint64 r_hits;				/**< Number of read cache hits */
 	uint64 w_hits;				/**< Number of write cache hits */
+	uint64 g_hits;				/**< Number of cache misses on ghost keys */
+	uint64 evicted;				/**< Number of cache evictions */
+	uint64 f_probes;			/**< Map probes checked against filter */
+	uint64 f_avoided;			/**< Map probes avoided by filter */
+	uint64 f_false;				/**< Filter false positives */
+	cbloom_t *filter;			/**< Optional filter of keys in dbmap */
 	size_t key_size;			/**< Size of keys (constant or maximum) */
 	dbmap_keylen_t key_len;		/**< Optional, computes actual key length */
 	size_t value_size;			/**< Maximum size of values (structure) */
 	size_t value_data_size;		/**< Maximum size of values (serialized form) */
 	size_t max_cached;			/**< Max amount of items to cache */
+	size_t max_bytes;			/**< Memory budget for cached entries */
+	size_t bytes;				/**< Memory used by cached entries */
+	size_t fresh_bytes;			/**< Memory used by fresh cached entries */
 	ssize_t cached;				/**< Cached entries not present in dbmap */
 	dbmw_serialize_t pack;		/**< Serialization routine for values */
 	dbmw_deserialize_t unpack;	/**< Deserialization routine for values */
@@ -84,6 +100,7 @@ struct dbmw {
 	unsigned ioerr:1;			/**< Had I/O error */
 	unsigned count_needs_sync:1;/**< Whether we need to sync to get count */
 	unsigned is_volatile:1;		/**< Whether database dies when map dies */
+	unsigned traversing:1;		/**< Whether we are iterating over dbmap */
 };
 
 static inline void
@@ -93,6 +110,8 @@ dbmw_check(const dbmw_t *dw)
 	g_assert(DBMW_MAGIC == dw->magic);
 }
 
+static hset_t *dbmw_all;		/**< All the DBMW objects, for statistics */
+
 /**
  * A cached entry (deserialized value).
  *
@@ -108,6 +127,7 @@ struct cached {
 	unsigned absent:1;			/**< Whether entry is absent from database */
 	unsigned traversed:1;		/**< Whether entry was traversed by iteration */
 	unsigned removable:1;		/**< Entry must be removed after iteration? */
+	unsigned hot:1;				/**< In frequently used list? */
 };
 
 /**
@@ -125,6 +145,131 @@ dbmw_keylen(const dbmw_t *dw, const void *key)
 	}
 }
 
+/**
+ * Iterator callback to record all the keys of the map into the filter.
+ */
+static void
+dbmw_filter_fill(void *key, dbmap_datum_t *d, void *arg)
+{
+	dbmw_t *dw = arg;
+
+	(void) d;
+	cbloom_add(dw->filter, key, dbmw_keylen(dw, key));
+}
+
+/**
+ * Rebuild the key filter from the keys present in the underlying map,
+ * sizing it with enough room for the map to double before we have to
+ * rebuild it again.
+ *
+ * On I/O error the filter is dropped since it could now report existing
+ * keys as being absent.
+ */
+static void
+dbmw_filter_rebuild(dbmw_t *dw)
+{
+	g_assert(!dw->traversing);
+
+	cbloom_free_null(&dw->filter);
+	dw->filter = cbloom_make(2 * dbmap_count(dw->dm));
+
+	dw->traversing = TRUE;
+	dbmap_foreach(dw->dm, dbmw_filter_fill, dw);
+	dw->traversing = FALSE;
+
+	if (dbmap_has_ioerr(dw->dm)) {
+		s_warning("DBMW \"%s\" I/O error whilst building key filter: %s",
+			dw->name, dbmap_strerror(dw->dm));
+		cbloom_free_null(&dw->filter);
+		return;
+	}
+
+	if (common_dbg) {
+		s_debug("DBMW \"%s\" key filter holds %zu key%s "
+			"(capacity %zu, %zu bytes)",
+			dw->name, cbloom_count(dw->filter), plural(cbloom_count(dw->filter)),
+			cbloom_capacity(dw->filter), cbloom_memory(dw->filter));
+	}
+}
+
+/**
+ * Check whether the key may be present in the underlying map, before we
+ * actually probe it.
+ *
+ * @return FALSE if the key is known to be absent from the map.
+ */
+static inline bool
+dbmw_filter_contains(dbmw_t *dw, const void *key)
+{
+	if (NULL == dw->filter)
+		return TRUE;
+
+	dw->f_probes++;
+
+	if (cbloom_contains(dw->filter, key, dbmw_keylen(dw, key)))
+		return TRUE;
+
+	dw->f_avoided++;
+	return FALSE;
+}
+
+/**
+ * Insert key/value in the underlying map, keeping the key filter updated.
+ *
+ * @return TRUE on success.
+ */
+static bool
+dbmw_map_insert(dbmw_t *dw, const void *key, dbmap_datum_t dval)
+{
+	size_t count = dbmap_count(dw->dm);
+	bool ok;
+
+	ok = dbmap_insert(dw->dm, key, dval);
+
+	if (dw->filter != NULL && dbmap_count(dw->dm) > count) {
+		cbloom_add(dw->filter, key, dbmw_keylen(dw, key));
+
+		/*
+		 * When the map outgrows the filter, the false positive rate
+		 * increases quickly: rebuild a larger filter, unless we are
+		 * iterating over the map, in which case we will retry later.
+		 */
+
+		if (
+			cbloom_count(dw->filter) > cbloom_capacity(dw->filter) &&
+			!dw->traversing
+		)
+			dbmw_filter_rebuild(dw);
+	}
+
+	return ok;
+}
+
+/**
+ * Remove key from the underlying map, keeping the key filter updated.
+ *
+ * @return TRUE on success.
+ */
+static bool
+dbmw_map_remove(dbmw_t *dw, const void *key)
+{
+	size_t count = dbmap_count(dw->dm);
+	bool ok;
+
+	ok = dbmap_remove(dw->dm, key);
+
+	/*
+	 * Only remove the key from the filter if we know it was physically
+	 * present in the map, otherwise we could remove another key that
+	 * happens to share the same counters.
+	 */
+
+	if (dw->filter != NULL && dbmap_count(dw->dm) < count)
+		cbloom_remove(dw->filter, key, dbmw_keylen(dw, key));
+
+	return ok;
+}
+
 /**
  * Check whether I/O error has occurred during last operation.
  */
@@ -246,6 +391,8 @@ dbmw_create(dbmap_t *dm, const char *name,
 	}
 
 	dw->keys = hash_list_new(hash_func, eq_func);
+	dw->fresh = hash_list_new(hash_func, eq_func);
+	dw->ghosts = hash_list_new(hash_func, eq_func);
 	dw->pack = pack;
 	dw->unpack = unpack;
 	dw->valfree = valfree;
@@ -280,12 +427,32 @@ dbmw_create(dbmap_t *dm, const char *name,
 	else
 		dw->max_cached = cache_size;
 
+	/*
+	 * The cache is bounded by the memory held by cached entries, not by
+	 * their amount.  The amount of items requested is turned into a budget
+	 * based on the maximum value size, so that stores with values smaller
+	 * than their maximum can cache more entries.
+	 *
+	 * A zero budget means we only keep the latest entry around.
+	 */
+
+	if (dw->max_cached > 1) {
+		dw->max_bytes = dw->max_cached *
+			(sizeof(struct cached) + dw->key_size + dw->value_size);
+	}
+
+	if (NULL == dbmw_all)
+		dbmw_all = hset_create(HASH_KEY_SELF, 0);
+
+	hset_insert(dbmw_all, dw);
+
 	if (common_dbg)
 		s_debug("DBMW created \"%s\" with %s back-end "
-			"(max cached = %zu, key=%zu bytes, value=%zu bytes, "
+			"(max cached = %zu, %zu bytes, key=%zu bytes, value=%zu bytes, "
 			"%zu max serialized)",
 			dw->name, dbmw_map_type(dw) == DBMAP_SDBM ? "sdbm" : "map",
-			dw->max_cached, dw->key_size, dw->value_size, dw->value_data_size);
+			dw->max_cached, dw->max_bytes,
+			dw->key_size, dw->value_size, dw->value_data_size);
 
 	return dw;
 }
@@ -357,7 +524,7 @@ write_back(dbmw_t *dw, const void *key, struct cached *value)
 
 	dw->ioerr = FALSE;
 	ok = value->absent ?
-		dbmap_remove(dw->dm, key) : dbmap_insert(dw->dm, key, dval);
+		dbmw_map_remove(dw, key) : dbmw_map_insert(dw, key, dval);
 
 	if (ok) {
 		value->dirty = FALSE;
@@ -401,15 +568,140 @@ free_value(const dbmw_t *dw, struct cached *cv, bool reclaim)
 	}
 }
 
+/*
+ * The cache follows the "2Q" replacement policy, which is resistant to
+ * scans and adapts to skewed access patterns:
+ *
+ * - New entries are appended to the ``fresh'' FIFO list, which is limited
+ *   to 1/DBMW_FRESH of the memory budget.  Hits there do not change the
+ *   entry position, so that correlated accesses (read, modify, write) do
+ *   not make the entry look popular.
+ *
+ * - Entries evicted from the ``fresh'' list have their key remembered in
+ *   the ``ghosts'' list.  When a ghost key is requested again, the entry is
+ *   put in the ``keys'' LRU list, which holds the frequently used entries.
+ *
+ * Only cached entries are accounted for in the memory budget, not the keys
+ * held in the ghost list.
+ */
+
+/**
+ * @return memory used by cached entry.
+ */
+static inline size_t
+cache_cost(const dbmw_t *dw, const void *key, const struct cached *entry)
+{
+	return sizeof *entry + dbmw_keylen(dw, key) + entry->len;
+}
+
+/**
+ * @return the list holding the cached key.
+ */
+static inline hash_list_t *
+cache_list(const dbmw_t *dw, const struct cached *entry)
+{
+	return entry->hot ? dw->keys : dw->fresh;
+}
+
+/**
+ * @return amount of cached entries.
+ */
+static inline size_t
+cache_count(const dbmw_t *dw)
+{
+	return hash_list_length(dw->keys) + hash_list_length(dw->fresh);
+}
+
+/**
+ * Account for the memory used by a cached entry.
+ *
+ * @param dw		the DBM wrapper
+ * @param entry		the cached entry
+ * @param add		amount of memory to add to the entry
+ * @param sub		amount of memory to remove from the entry
+ */
+static void
+cache_account(dbmw_t *dw, const struct cached *entry, size_t add, size_t sub)
+{
+	g_assert(dw->bytes + add >= sub);
+
+	dw->bytes = dw->bytes + add - sub;
+
+	if (!entry->hot) {
+		g_assert(dw->fresh_bytes + add >= sub);
+		dw->fresh_bytes = dw->fresh_bytes + add - sub;
+	}
+}
+
 /**
- * Remove cached entry for key, optionally disposing of the whole structure.
- * Cached entry is flushed if it was dirty and flush is set.
+ * Record key of an entry evicted from the fresh list.
+ */
+static void
+cache_ghost(dbmw_t *dw, const void *key)
+{
+	size_t max;
+
+	g_assert(!hash_list_contains(dw->ghosts, key));
+
+	hash_list_append(dw->ghosts, wcopy(key, dbmw_keylen(dw, key)));
+
+	/*
+	 * Keep about half as many ghosts as we have cached entries.
+	 */
+
+	max = MAX(DBMW_GHOSTS, cache_count(dw) / 2);
+
+	while (hash_list_length(dw->ghosts) > max) {
+		void *old = hash_list_shift(dw->ghosts);
+		wfree(old, dbmw_keylen(dw, old));
+	}
+}
+
+/**
+ * Forget key from the ghost list.
  *
- * @return the reusable cached entry if dispose was FALSE and the key was
- * indeed cached, NULL otherwise.
+ * @return TRUE if the key was a ghost.
  */
-static struct cached *
-remove_entry(dbmw_t *dw, const void *key, bool dispose, bool flush)
+static bool
+cache_unghost(dbmw_t *dw, const void *key)
+{
+	void *old;
+
+	old = hash_list_remove(dw->ghosts, key);
+	if (NULL == old)
+		return FALSE;
+
+	wfree(old, dbmw_keylen(dw, old));
+	return TRUE;
+}
+
+/**
+ * Free ghost key.
+ */
+static void
+cache_free_ghost(void *key, void *data)
+{
+	dbmw_t *dw = data;
+
+	wfree(key, dbmw_keylen(dw, key));
+}
+
+/**
+ * Record hit on cached entry.
+ */
+static inline void
+cache_touch(dbmw_t *dw, const void *key, const struct cached *entry)
+{
+	if (entry->hot)
+		hash_list_moveto_tail(dw->keys, key);
+}
+
+/**
+ * Remove cached entry for key, disposing of the whole structure.
+ * Cached entry is flushed if it was dirty and flush is set.
+ */
+static void
+remove_entry(dbmw_t *dw, const void *key, bool flush)
 {
 	struct cached *old;
 	void *old_key;
@@ -418,13 +710,13 @@ remove_entry(dbmw_t *dw, const void *key, bool dispose, bool flush)
 	found = map_lookup_extended(dw->values, key, &old_key, (void *) &old);
 
 	if (!found)
-		return NULL;
+		return;
 
 	g_assert(old != NULL);
 
 	if (dbg_ds_debugging(dw->dbg, 3, DBG_DSF_CACHING)) {
-		dbg_ds_log(dw->dbg, dw, "%s: %s key=%s (%s)",
-			G_STRFUNC, old->dirty ? "dirty" : "clean",
+		dbg_ds_log(dw->dbg, dw, "%s: %s %s key=%s (%s)",
+			G_STRFUNC, old->hot ? "hot" : "fresh", old->dirty ? "dirty" : "clean",
 			dbg_ds_keystr(dw->dbg, key, (size_t) -1),
 			flush ? "flushing" : " discarding");
 	}
@@ -432,21 +724,46 @@ remove_entry(dbmw_t *dw, const void *key, bool dispose, bool flush)
 	if (old->dirty && flush)
 		write_back(dw, key, old);
 
-	hash_list_remove(dw->keys, key);
-	map_remove(dw->values, key);
+	cache_account(dw, old, 0, cache_cost(dw, old_key, old));
+	hash_list_remove(cache_list(dw, old), old_key);
+	map_remove(dw->values, old_key);
 	wfree(old_key, dbmw_keylen(dw, old_key));
 
-	if (!dispose)
-		return old;
-
-	/*
-	 * Dispose of the cache structure.
-	 */
-
 	free_value(dw, old, TRUE);
 	WFREE(old);
+}
 
-	return NULL;
+/**
+ * Evict one entry from the cache.
+ *
+ * Entries from the fresh list are evicted first when that list exceeds its
+ * share of the budget, and their key is remembered as a ghost.  Otherwise,
+ * the least recently used frequent entry is evicted.
+ */
+static void
+cache_evict(dbmw_t *dw)
+{
+	void *key;
+
+	g_assert(cache_count(dw) != 0);
+
+	dw->evicted++;
+
+	if (
+		0 != hash_list_length(dw->fresh) &&
+		(
+			0 == hash_list_length(dw->keys) ||
+			dw->fresh_bytes > dw->max_bytes / DBMW_FRESH
+		)
+	) {
+		key = hash_list_head(dw->fresh);
+		if (dw->max_bytes != 0)
+			cache_ghost(dw, key);
+	} else {
+		key = hash_list_head(dw->keys);
+	}
+
+	remove_entry(dw, key, TRUE);
 }
 
 /**
@@ -456,11 +773,9 @@ remove_entry(dbmw_t *dw, const void *key, bool dispose, bool flush)
  * @param key		key we want a cache entry for
  * @param filled	optionally, a new cache entry already filled with the data
  *
- * @attention
- * An older cache entry structure can be returned, and it will still
- * point to the previous data.  Caller should normally invoke fill_entry()
- * immediately to make sure these stale data are not associated wrongly
- * with the new key, or supply his own filled structure directly.
+ * Older entries are evicted, and flushed if dirty, to make room for the new
+ * entry, which is added to the cache.  Caller should normally invoke
+ * fill_entry() immediately when it did not supply a filled structure.
  *
  * @return a cache entry object that can be filled with the value.
  */
@@ -469,45 +784,47 @@ allocate_entry(dbmw_t *dw, const void *key, struct cached *filled)
 {
 	struct cached *entry;
 	void *saved_key;
+	size_t cost;
 
 	g_assert(!hash_list_contains(dw->keys, key));
+	g_assert(!hash_list_contains(dw->fresh, key));
 	g_assert(!map_contains(dw->values, key));
 	g_assert(!filled || (!filled->len == !filled->data));
 
-	saved_key = wcopy(key, dbmw_keylen(dw, key));
+	if (filled)
+		entry = filled;
+	else
+		WALLOC0(entry);
 
 	/*
-	 * If we have less keys cached than our maximum, add it.
-	 * Otherwise evict the least recently used key, at the head.
+	 * A key that was recently evicted from the fresh list is requested
+	 * again: it is frequently used.
 	 */
 
-	if (hash_list_length(dw->keys) < dw->max_cached) {
-		if (filled)
-			entry = filled;
-		else
-			WALLOC0(entry);
+	if (cache_unghost(dw, key)) {
+		dw->g_hits++;
+		entry->hot = TRUE;
 	} else {
-		void *head;
-
-		g_assert(hash_list_length(dw->keys) == dw->max_cached);
+		entry->hot = FALSE;
+	}
 
-		head = hash_list_head(dw->keys);
-		entry = remove_entry(dw, head, filled != NULL, TRUE);
+	/*
+	 * Evict older entries until the new entry fits in the budget.
+	 */
 
-		g_assert(filled != NULL || entry != NULL);
+	cost = cache_cost(dw, key, entry);
 
-		if (filled)
-			entry = filled;
-	}
+	while (cache_count(dw) != 0 && dw->bytes + cost > dw->max_bytes)
+		cache_evict(dw);
 
 	/*
 	 * Add entry into cache.
 	 */
 
-	g_assert(entry);
-
-	hash_list_append(dw->keys, saved_key);
+	saved_key = wcopy(key, dbmw_keylen(dw, key));
+	hash_list_append(cache_list(dw, entry), saved_key);
 	map_insert(dw->values, saved_key, entry);
+	cache_account(dw, entry, cost, 0);
 
 	return entry;
 }
@@ -516,8 +833,7 @@ allocate_entry(dbmw_t *dw, const void *key, struct cached *filled)
  * Fill cache entry structure with value data, marking it dirty and present.
  */
 static void
-fill_entry(const dbmw_t *dw,
-	struct cached *entry, void *value, size_t length)
+fill_entry(dbmw_t *dw, struct cached *entry, void *value, size_t length)
 {
 	/*
 	 * Try to reuse old entry arena if same size.
@@ -533,6 +849,7 @@ fill_entry(const dbmw_t *dw,
 
 		if (length)
 			arena = wcopy(value, length);
+		cache_account(dw, entry, length, entry->len);
 		free_value(dw, entry, TRUE);
 		entry->data = arena;
 		entry->len = length;
@@ -679,8 +996,9 @@ cache_free_removable(void *key, void *value, void *data)
 	if (!entry->removable)
 		return FALSE;
 
+	cache_account(dw, entry, 0, cache_cost(dw, key, entry));
 	free_value(dw, entry, TRUE);
-	hash_list_remove(dw->keys, key);
+	hash_list_remove(cache_list(dw, entry), key);
 	wfree(key, dbmw_keylen(dw, key));
 	WFREE(entry);
 
@@ -828,6 +1146,57 @@ dbmw_rebuild(dbmw_t *dw)
 	return dbmap_rebuild(dw->dm);
 }
 
+/**
+ * Start an incremental rebuild of the DB on disk.
+ *
+ * The database remains usable, the rebuild being performed by subsequent
+ * dbmw_rebuild_step() calls.
+ *
+ * @return TRUE if successful.
+ */
+bool
+dbmw_rebuild_start(dbmw_t *dw)
+{
+	/*
+	 * Cached updates do not need to be flushed: they will be propagated
+	 * to the rebuilt database when they reach SDBM.
+	 */
+
+	return dbmap_rebuild_start(dw->dm);
+}
+
+/**
+ * Perform the next slice of an incremental rebuild, copying at most the
+ * specified amount of pages.
+ *
+ * @return 1 if more work remains, 0 when done, -1 on error with errno set.
+ */
+int
+dbmw_rebuild_step(dbmw_t *dw, long pages)
+{
+	return dbmap_rebuild_step(dw->dm, pages);
+}
+
+/**
+ * Abort incremental rebuild, if any.
+ */
+void
+dbmw_rebuild_abort(dbmw_t *dw)
+{
+	dbmap_rebuild_abort(dw->dm);
+}
+
+/**
+ * Fetch progress of the incremental rebuild, in pages.
+ *
+ * @return whether an incremental rebuild is in progress.
+ */
+bool
+dbmw_rebuild_progress(const dbmw_t *dw, long *done, long *total)
+{
+	return dbmap_rebuild_progress(dw->dm, done, total);
+}
+
 /**
  * Wrapper to the user-supplied deserialization routine for values.
  *
@@ -909,7 +1278,7 @@ dbmw_write_nocache(dbmw_t *dw, const void *key, void *value, size_t length)
 	 */
 
 	write_immediately(dw, key, value, length);
-	(void) remove_entry(dw, key, TRUE, FALSE);	/* Discard any cached data */
+	remove_entry(dw, key, FALSE);	/* Discard any cached data */
 }
 
 /**
@@ -951,7 +1320,7 @@ dbmw_write(dbmw_t *dw, const void *key, void *value, size_t length)
 		if (entry->absent)
 			dw->cached++;			/* Key exists now, in unflushed status */
 		fill_entry(dw, entry, value, length);
-		hash_list_moveto_tail(dw->keys, key);
+		cache_touch(dw, key, entry);
 
 	} else if (dw->max_cached > 1) {
 		if (dbg_ds_debugging(dw->dbg, 2, DBG_DSF_CACHING | DBG_DSF_UPDATE)) {
@@ -1010,16 +1379,22 @@ dbmw_read(dbmw_t *dw, const void *key, size_t *lenptr)
 		}
 
 		dw->r_hits++;
+		cache_touch(dw, key, entry);
 		if (lenptr)
 			*lenptr = entry->len;
 		return entry->data;
 	}
 
 	/*
-	 * Not cached, must read from DB.
+	 * Not cached, must read from DB, unless the filter tells us the
+	 * key is not there.
 	 */
 
 	dw->ioerr = FALSE;
+
+	if (!dbmw_filter_contains(dw, key))
+		return NULL;
+
 	dval = dbmap_lookup(dw->dm, key);
 
 	if (dbmap_has_ioerr(dw->dm)) {
@@ -1029,8 +1404,11 @@ dbmw_read(dbmw_t *dw, const void *key, size_t *lenptr)
 			"DBMW \"%s\" I/O error whilst reading entry: %s",
 			dw->name, dbmap_strerror(dw->dm));
 		return NULL;
-	} else if (NULL == dval.data)
+	} else if (NULL == dval.data) {
+		if (dw->filter != NULL)
+			dw->f_false++;
 		return NULL;	/* Not found in DB */
+	}
 
 	/*
 	 * Value was found, allocate a cache entry object for it.
@@ -1121,10 +1499,20 @@ dbmw_exists(dbmw_t *dw, const void *key)
 		}
 
 		dw->r_hits++;
+		cache_touch(dw, key, entry);
 		return !entry->absent;
 	}
 
 	dw->ioerr = FALSE;
+
+	/*
+	 * When the filter says the key is absent, there is no need to cache
+	 * the negative lookup: checking the filter is cheap.
+	 */
+
+	if (!dbmw_filter_contains(dw, key))
+		return FALSE;
+
 	ret = dbmap_contains(dw->dm, key);
 
 	if (dbmap_has_ioerr(dw->dm)) {
@@ -1135,6 +1523,9 @@ dbmw_exists(dbmw_t *dw, const void *key)
 		return FALSE;
 	}
 
+	if (!ret && dw->filter != NULL)
+		dw->f_false++;
+
 	/*
 	 * If the maximum value length of the DB is 0, then it is used as a
 	 * "search table" only, meaning there will be no read to get values,
@@ -1208,7 +1599,7 @@ dbmw_delete(dbmw_t *dw, const void *key)
 			fill_entry(dw, entry, NULL, 0);
 			entry->absent = TRUE;
 		}
-		hash_list_moveto_tail(dw->keys, key);
+		cache_touch(dw, key, entry);
 
 	} else {
 		if (dbg_ds_debugging(dw->dbg, 2, DBG_DSF_DELETE)) {
@@ -1217,7 +1608,7 @@ dbmw_delete(dbmw_t *dw, const void *key)
 		}
 
 		dw->ioerr = FALSE;
-		dbmap_remove(dw->dm, key);
+		dbmw_map_remove(dw, key);
 
 		if (dbmap_has_ioerr(dw->dm)) {
 			dw->ioerr = TRUE;
@@ -1282,7 +1673,12 @@ dbmw_clear_cache(dbmw_t *dw)
 	 */
 
 	hash_list_clear(dw->keys);
+	hash_list_clear(dw->fresh);
 	map_foreach_remove(dw->values, free_cached, dw);
+	dw->bytes = dw->fresh_bytes = 0;
+
+	hash_list_foreach(dw->ghosts, cache_free_ghost, dw);
+	hash_list_clear(dw->ghosts);
 }
 
 /**
@@ -1301,6 +1697,9 @@ dbmw_clear(dbmw_t *dw)
 	dw->count_needs_sync = FALSE;
 	dw->cached = 0;
 
+	if (dw->filter != NULL)
+		cbloom_clear(dw->filter);
+
 	return TRUE;
 }
 
@@ -1321,6 +1720,14 @@ dbmw_destroy(dbmw_t *dw, bool close_map)
 			uint64_to_string(dw->r_access), plural(dw->r_access),
 			dw->w_hits * 100.0 / MAX(1, dw->w_access),
 			uint64_to_string2(dw->w_access), plural(dw->w_access));
+
+		if (dw->f_probes != 0) {
+			s_debug("DBMW \"%s\" key filter avoided %.2f%% of %s map probe%s "
+				"(%s false positive%s)",
+				dw->name, dw->f_avoided * 100.0 / dw->f_probes,
+				uint64_to_string(dw->f_probes), plural(dw->f_probes),
+				uint64_to_string2(dw->f_false), plural(dw->f_false));
+		}
 	}
 
 	if (dbg_ds_debugging(dw->dbg, 1, DBG_DSF_DESTROY)) {
@@ -1345,7 +1752,11 @@ dbmw_destroy(dbmw_t *dw, bool close_map)
 
 	dbmw_clear_cache(dw);
 	hash_list_free(&dw->keys);
+	hash_list_free(&dw->fresh);
+	hash_list_free(&dw->ghosts);
 	map_destroy(dw->values);
+	hset_remove(dbmw_all, dw);
+	cbloom_free_null(&dw->filter);
 
 	if (dw->mb)
 		pmsg_free(dw->mb);
@@ -1475,6 +1886,24 @@ dbmw_foreach_remove_trampoline(void *key, dbmap_datum_t *d, void *arg)
 	return dbmw_foreach_common(TRUE, key, d, arg);
 }
 
+/**
+ * Trampoline to invoke the DB map removal iterator, updating the key filter.
+ */
+static bool
+dbmw_foreach_remove_map_trampoline(void *key, dbmap_datum_t *d, void *arg)
+{
+	struct foreach_ctx *ctx = arg;
+	dbmw_t *dw = ctx->dw;
+
+	if (!dbmw_foreach_common(TRUE, key, d, arg))
+		return FALSE;
+
+	if (dw->filter != NULL)
+		cbloom_remove(dw->filter, key, dbmw_keylen(dw, key));
+
+	return TRUE;
+}
+
 /**
  * Iterate over the DB, invoking the callback on each item along with the
  * supplied argument.
@@ -1515,7 +1944,9 @@ dbmw_foreach(dbmw_t *dw, dbmw_cb_t cb, void *arg)
 	ctx.dw = dw;
 
 	map_foreach(dw->values, cache_reset_before_traversal, NULL);
+	dw->traversing = TRUE;
 	dbmap_foreach(dw->dm, dbmw_foreach_trampoline, &ctx);
+	dw->traversing = FALSE;
 
 	/*
 	 * Continue traversal with all the cached entries that were not traversed
@@ -1585,7 +2016,18 @@ dbmw_foreach_remove(dbmw_t *dw, dbmw_cbr_t cbr, void *arg)
 	ctx.dw = dw;
 
 	map_foreach(dw->values, cache_reset_before_traversal, NULL);
-	pruned = dbmap_foreach_remove(dw->dm, dbmw_foreach_remove_trampoline, &ctx);
+	dw->traversing = TRUE;
+	pruned = dbmap_foreach_remove(dw->dm,
+		dbmw_foreach_remove_map_trampoline, &ctx);
+	dw->traversing = FALSE;
+
+	/*
+	 * If some of the keys we removed from the filter could not be physically
+	 * removed from the map, the filter would now report them as absent.
+	 */
+
+	if (dw->filter != NULL && dbmap_has_ioerr(dw->dm))
+		dbmw_filter_rebuild(dw);
 
 	ZERO(&fctx);
 	fctx.removing = TRUE;
@@ -1675,6 +2117,8 @@ dbmw_store(dbmw_t *dw, const char *base, bool inplace)
 bool
 dbmw_copy(dbmw_t *from, dbmw_t *to)
 {
+	bool ok;
+
 	dbmw_check(from);
 	dbmw_check(to);
 
@@ -1687,7 +2131,12 @@ dbmw_copy(dbmw_t *from, dbmw_t *to)
 	 * we can ignore caches and handle the copy at the dbmap level.
 	 */
 
-	return dbmap_copy(from->dm, to->dm);
+	ok = dbmap_copy(from->dm, to->dm);
+
+	if (to->filter != NULL)
+		dbmw_filter_rebuild(to);
+
+	return ok;
 }
 
 /**
@@ -1702,6 +2151,69 @@ dbmw_set_map_cache(dbmw_t *dw, long pages)
 	return 0 == dbmap_set_cachesize(dw->dm, pages);
 }
 
+/**
+ * Turn the write-ahead log of the underlying map on or off.
+ *
+ * @return TRUE on success.
+ */
+bool
+dbmw_set_wal(dbmw_t *dw, bool on)
+{
+	dbmw_check(dw);
+
+	return 0 == dbmap_set_wal(dw->dm, on);
+}
+
+/**
+ * Set the memory budget for cached entries, evicting entries as needed.
+ *
+ * A zero budget means only the latest entry is kept around.
+ */
+void
+dbmw_set_cache_budget(dbmw_t *dw, size_t bytes)
+{
+	dbmw_check(dw);
+
+	dw->max_bytes = bytes;
+
+	while (cache_count(dw) > 1 && dw->bytes > dw->max_bytes)
+		cache_evict(dw);
+}
+
+/**
+ * Turn the key filter on or off.
+ *
+ * The filter keeps track of the keys present in the underlying map so that
+ * lookups for keys that are absent can be answered without probing the map.
+ * It is only worth it for disk-based maps where most lookups are for keys
+ * which are not present.
+ *
+ * Turning the filter on requires a full traversal of the map to record the
+ * existing keys.
+ *
+ * @return TRUE on success.
+ */
+bool
+dbmw_set_filter(dbmw_t *dw, bool on)
+{
+	dbmw_check(dw);
+
+	if (!on) {
+		cbloom_free_null(&dw->filter);
+		return TRUE;
+	}
+
+	if (dw->filter != NULL)
+		return TRUE;
+
+	if (dw->traversing)
+		return FALSE;
+
+	dbmw_filter_rebuild(dw);
+
+	return dw->filter != NULL;
+}
+
 /**
  * Flag whether database is volatile (never outlives a close).
  *
@@ -1747,4 +2259,73 @@ dbmw_set_debugging(dbmw_t *dw, const dbg_config_t *dbg)
 	dbmap_set_debugging(dw->dm, dw->dbmap_dbg);
 }
 
+static void
+dbmw_info_get(const void *key, void *data)
+{
+	const dbmw_t *dw = key;
+	pslist_t **sl_ptr = data;
+	dbmw_info_t *di;
+
+	dbmw_check(dw);
+
+	WALLOC0(di);
+	di->magic = DBMW_INFO_MAGIC;
+	di->name = atom_str_get(dw->name);
+	di->count = cache_count(dw);
+	di->hot = hash_list_length(dw->keys);
+	di->bytes = dw->bytes;
+	di->max_bytes = dw->max_bytes;
+	di->r_access = dw->r_access;
+	di->r_hits = dw->r_hits;
+	di->w_access = dw->w_access;
+	di->w_hits = dw->w_hits;
+	di->g_hits = dw->g_hits;
+	di->evicted = dw->evicted;
+	di->f_probes = dw->f_probes;
+	di->f_avoided = dw->f_avoided;
+
+	*sl_ptr = pslist_prepend(*sl_ptr, di);
+}
+
+/**
+ * Build list of cache statistics for all the DBMW objects.
+ *
+ * @return list of dbmw_info_t that must be freed by calling
+ * dbmw_info_list_free_null().
+ */
+pslist_t *
+dbmw_info_list(void)
+{
+	pslist_t *sl = NULL;
+
+	if (dbmw_all != NULL)
+		hset_foreach(dbmw_all, dbmw_info_get, &sl);
+
+	return sl;
+}
+
+static void
+dbmw_info_free(void *data, void *udata)
+{
+	dbmw_info_t *di = data;
+
+	dbmw_info_check(di);
+	(void) udata;
+
+	atom_str_free_null(&di->name);
+	WFREE(di);
+}
+
+/**
+ * Free list created by dbmw_info_list() and nullify pointer.
+ */
+void
+dbmw_info_list_free_null(pslist_t **sl_ptr)
+{
+	pslist_t *sl = *sl_ptr;
+
+	pslist_foreach(sl, dbmw_info_free, NULL);
+	pslist_free_null(sl_ptr);
+}
+
 /* vi: set ts=4 sw=4 cindent: */
@@ -84,6 +84,35 @@ typedef void (*dbmw_free_t)(void *valptr, size_t len);
 typedef void (*dbmw_cb_t)(void *key, void *value, size_t len, void *u);
 typedef bool (*dbmw_cbr_t)(void *key, void *value, size_t len, void *u);
 
+/**
+ * Cache statistics, as returned by dbmw_info_list().
+ */
+enum dbmw_info_magic { DBMW_INFO_MAGIC = 0x1a7c04e9 };
+
+typedef struct dbmw_info {
+	enum dbmw_info_magic magic;
+	const char *name;			/**< Database name (atom) */
+	size_t count;				/**< Amount of cached entries */
+	size_t hot;					/**< Amount of frequently used entries */
+	size_t bytes;				/**< Memory used by cached entries */
+	size_t max_bytes;			/**< Memory budget for cached entries */
+	uint64 r_access;			/**< Number of read accesses */
+	uint64 r_hits;				/**< Number of read cache hits */
+	uint64 w_access;			/**< Number of write accesses */
+	uint64 w_hits;				/**< Number of write cache hits */
+	uint64 g_hits;				/**< Number of cache misses on ghost keys */
+	uint64 evicted;				/**< Number of cache evictions */
+	uint64 f_probes;			/**< Map probes checked against filter */
+	uint64 f_avoided;			/**< Map probes avoided by filter */
+} dbmw_info_t;
+
+static inline void
+dbmw_info_check(const dbmw_info_t * const di)
+{
+	g_assert(di != NULL);
+	g_assert(DBMW_INFO_MAGIC == di->magic);
+}
+
 /**
  * Flags for dbmw_sync().
  */
@@ -111,9 +140,16 @@ bool dbmw_has_ioerr(const dbmw_t *dw);
 const char *dbmw_name(const dbmw_t *dw);
 bool dbmw_set_map_cache(dbmw_t *dw, long pages);
 bool dbmw_set_volatile(dbmw_t *dw, bool is_volatile);
+bool dbmw_set_wal(dbmw_t *dw, bool on);
+bool dbmw_set_filter(dbmw_t *dw, bool on);
+void dbmw_set_cache_budget(dbmw_t *dw, size_t bytes);
 void dbmw_set_debugging(dbmw_t *dw, const struct dbg_config *dbg);
 bool dbmw_shrink(dbmw_t *dw);
 bool dbmw_rebuild(dbmw_t *dw);
+bool dbmw_rebuild_start(dbmw_t *dw);
+int dbmw_rebuild_step(dbmw_t *dw, long pages);
+void dbmw_rebuild_abort(dbmw_t *dw);
+bool dbmw_rebuild_progress(const dbmw_t *dw, long *done, long *total);
 bool dbmw_clear(dbmw_t *dw);
 const char *dbmw_strerror(const dbmw_t *dw);
 
@@ -123,6 +159,9 @@ void dbmw_free_all_keys(const dbmw_t *dw, struct pslist *keys);
 void dbmw_foreach(dbmw_t *dw, dbmw_cb_t cb, void *arg);
 size_t dbmw_foreach_remove(dbmw_t *dw, dbmw_cbr_t cbr, void *arg);
 
+struct pslist *dbmw_info_list(void);
+void dbmw_info_list_free_null(struct pslist **sl_ptr);
+
 bool dbmw_store(dbmw_t *dw, const char *base, bool inplace);
 bool dbmw_copy(dbmw_t *from, dbmw_t *to);
 
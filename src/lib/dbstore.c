@@ -42,20 +42,48 @@
 #include "if/gnet_property_priv.h"
 
 #include "atoms.h"
+#include "bg.h"
 #include "dbmap.h"
 #include "dbmw.h"
 #include "file.h"
 #include "halloc.h"
 #include "hstrfn.h"
+#include "htable.h"
 #include "log.h"
 #include "path.h"
+#include "pslist.h"
 #include "stringify.h"
+#include "tm.h"
+#include "walloc.h"
 
 #include "override.h"		/* Must be the last header included */
 
 static const mode_t STORAGE_FILE_MODE = S_IRUSR | S_IWUSR; /* 0600 */
 static unsigned dbstore_debug;
 
+#define DBSTORE_COMPACT_TICK_PAGES	16	/**< Pages copied per scheduling tick */
+
+enum dbstore_compact_magic { DBSTORE_COMPACT_MAGIC = 0x5c0a7d21 };
+
+/**
+ * Background compaction context.
+ */
+struct dbstore_compact {
+	enum dbstore_compact_magic magic;
+	dbmw_t *dw;					/**< Database being compacted, NULL if gone */
+	bgtask_t *task;				/**< Background task performing the copy */
+	time_t start;				/**< Start time */
+};
+
+static inline void
+dbstore_compact_check(const struct dbstore_compact * const dc)
+{
+	g_assert(dc != NULL);
+	g_assert(DBSTORE_COMPACT_MAGIC == dc->magic);
+}
+
+static htable_t *dbstore_compacting;	/**< dbmw_t -> struct dbstore_compact */
+
 /**
  * Set debugging level.
  */
@@ -111,6 +139,16 @@ dbstore_create_internal(const char *name, const char *dir, const char *base,
 
 		if (dm != NULL) {
 			dbmap_set_deferred_writes(dm, TRUE);
+
+			/*
+			 * Read-mostly stores can read their pages from a memory mapping
+			 * instead of issuing a system call for each cache miss.
+			 */
+
+			if (kv.flags & DBSTORE_F_MMAP_COW)
+				dbmap_set_mmap(dm, DBM_MMAP_COW);
+			else if (kv.flags & DBSTORE_F_MMAP_RDONLY)
+				dbmap_set_mmap(dm, DBM_MMAP_RDONLY);
 		} else {
 			s_warning("DBSTORE cannot open SDBM at %s for %s: %m", path, name);
 		}
@@ -133,6 +171,14 @@ dbstore_create_internal(const char *name, const char *dir, const char *base,
 			packing.pack, packing.unpack, packing.valfree,
 			adjusted_cache_size, hash_func, eq_func);
 
+	/*
+	 * Stores mostly probed for keys they do not hold can avoid most of
+	 * the disk accesses by filtering lookups first.
+	 */
+
+	if ((kv.flags & DBSTORE_F_FILTER) && DBMAP_SDBM == dbmap_type(dm))
+		dbmw_set_filter(dw, TRUE);
+
 	return dw;
 }
 
@@ -282,6 +328,33 @@ dbstore_sync_flush(dbmw_t *dw)
 	dbstore_sync(dw);		/* ...then sync database layer */
 }
 
+/**
+ * Cancel background compaction of the database, if any.
+ */
+static void
+dbstore_compact_cancel(dbmw_t *dw)
+{
+	struct dbstore_compact *dc;
+
+	if (NULL == dbstore_compacting)
+		return;
+
+	dc = htable_lookup(dbstore_compacting, dw);
+	if (NULL == dc)
+		return;
+
+	dbstore_compact_check(dc);
+
+	if (dbstore_debug) {
+		g_debug("DBSTORE cancelling rebuild of DBMW \"%s\"", dbmw_name(dw));
+	}
+
+	htable_remove(dbstore_compacting, dw);
+	dbmw_rebuild_abort(dw);
+	dc->dw = NULL;					/* Task will not touch database anymore */
+	bg_task_cancel(dc->task);
+}
+
 /**
  * Close DM map, keeping the SDBM file around.
  *
@@ -296,6 +369,7 @@ dbstore_close(dbmw_t *dw, const char *dir, const char *base)
 	if (NULL == dw)
 		return;
 
+	dbstore_compact_cancel(dw);
 	path = make_pathname(dir, base);
 
 	if (dbstore_debug > 1)
@@ -320,8 +394,180 @@ dbstore_close(dbmw_t *dw, const char *dir, const char *base)
 void
 dbstore_delete(dbmw_t *dw)
 {
-	if (dw)
+	if (dw) {
+		dbstore_compact_cancel(dw);
 		dbmw_destroy(dw, TRUE);
+	}
+}
+
+/**
+ * Background task step: copy the next pages of the database being rebuilt.
+ */
+static bgret_t
+dbstore_compact_step(bgtask_t *h, void *u, int ticks)
+{
+	struct dbstore_compact *dc = u;
+	int r;
+
+	dbstore_compact_check(dc);
+	(void) h;
+
+	if (NULL == dc->dw)
+		return BGR_DONE;			/* Cancelled */
+
+	r = dbmw_rebuild_step(dc->dw, ticks * DBSTORE_COMPACT_TICK_PAGES);
+
+	switch (r) {
+	case 1:
+		return BGR_MORE;
+	case 0:
+		return BGR_DONE;
+	default:
+		g_warning("DBSTORE unable to rebuild DBMW \"%s\": %m",
+			dbmw_name(dc->dw));
+		return BGR_ERROR;
+	}
+}
+
+/**
+ * Background task termination callback.
+ */
+static void
+dbstore_compact_done(bgtask_t *h, void *u, bgstatus_t status, void *arg)
+{
+	struct dbstore_compact *dc = u;
+
+	dbstore_compact_check(dc);
+	(void) h;
+	(void) arg;
+
+	if (NULL == dc->dw)
+		return;						/* Cancelled, already forgotten */
+
+	if (dbstore_debug) {
+		g_debug("DBSTORE database DBMW \"%s\" %s after %s",
+			dbmw_name(dc->dw), BGS_OK == status ? "rebuilt" : "not rebuilt",
+			compact_time(delta_time(tm_time(), dc->start)));
+	}
+
+	htable_remove(dbstore_compacting, dc->dw);
+	dc->dw = NULL;
+}
+
+/**
+ * Free background compaction context.
+ */
+static void
+dbstore_compact_free(void *u)
+{
+	struct dbstore_compact *dc = u;
+
+	dbstore_compact_check(dc);
+
+	if (dc->dw != NULL)
+		htable_remove(dbstore_compacting, dc->dw);
+
+	dc->magic = 0;
+	WFREE(dc);
+}
+
+/**
+ * Launch background rebuild of the database.
+ *
+ * @return TRUE if the rebuild was started (or is already running).
+ */
+static bool
+dbstore_compact_launch(dbmw_t *dw)
+{
+	struct dbstore_compact *dc;
+	static const bgstep_cb_t step[] = { dbstore_compact_step };
+
+	if (NULL == dbstore_compacting)
+		dbstore_compacting = htable_create(HASH_KEY_SELF, 0);
+
+	if (htable_contains(dbstore_compacting, dw))
+		return TRUE;
+
+	if (!dbmw_rebuild_start(dw))
+		return FALSE;
+
+	WALLOC0(dc);
+	dc->magic = DBSTORE_COMPACT_MAGIC;
+	dc->dw = dw;
+	dc->start = tm_time();
+
+	dc->task = bg_task_create(NULL, "DBSTORE compaction",
+		step, N_ITEMS(step), dc, dbstore_compact_free,
+		dbstore_compact_done, NULL);
+
+	if (NULL == dc->task) {
+		/* Background task layer shutdown already: rebuild synchronously */
+		WFREE(dc);
+		return dbmw_rebuild(dw);
+	}
+
+	htable_insert(dbstore_compacting, dw, dc);
+	return TRUE;
+}
+
+static void
+dbstore_compact_info_get(const void *key, void *value, void *data)
+{
+	const struct dbstore_compact *dc = value;
+	pslist_t **sl_ptr = data;
+	dbstore_info_t *di;
+
+	dbstore_compact_check(dc);
+	(void) key;
+
+	WALLOC0(di);
+	di->magic = DBSTORE_INFO_MAGIC;
+	di->name = atom_str_get(dbmw_name(dc->dw));
+	di->elapsed = delta_time(tm_time(), dc->start);
+	dbmw_rebuild_progress(dc->dw, &di->done, &di->total);
+
+	*sl_ptr = pslist_prepend(*sl_ptr, di);
+}
+
+/**
+ * Build list of background compactions in progress.
+ *
+ * @return list of dbstore_info_t that must be freed by calling
+ * dbstore_compact_info_list_free_null().
+ */
+pslist_t *
+dbstore_compact_info_list(void)
+{
+	pslist_t *sl = NULL;
+
+	if (dbstore_compacting != NULL)
+		htable_foreach(dbstore_compacting, dbstore_compact_info_get, &sl);
+
+	return sl;
+}
+
+static void
+dbstore_info_free(void *data, void *udata)
+{
+	dbstore_info_t *di = data;
+
+	dbstore_info_check(di);
+	(void) udata;
+
+	atom_str_free_null(&di->name);
+	WFREE(di);
+}
+
+/**
+ * Free list created by dbstore_compact_info_list() and nullify pointer.
+ */
+void
+dbstore_compact_info_list_free_null(pslist_t **sl_ptr)
+{
+	pslist_t *sl = *sl_ptr;
+
+	pslist_foreach(sl, dbstore_info_free, NULL);
+	pslist_free_null(sl_ptr);
 }
 
 /**
@@ -330,6 +576,9 @@ dbstore_delete(dbmw_t *dw)
  * The aim is to reduce the disk size of the database since it can grow very
  * large after many insertions and deletions, with most pages being empty or
  * holding only a few keys.
+ *
+ * Rebuilding is done by a background task, copying a few pages at a time
+ * whilst the database remains usable.
  */
 void
 dbstore_compact(dbmw_t *dw)
@@ -343,6 +592,7 @@ dbstore_compact(dbmw_t *dw)
 	 */
 
 	if (0 == dbmw_count(dw)) {
+		dbstore_compact_cancel(dw);
 		if (dbstore_debug > 1) {
 			g_debug("DBSTORE clearing database DBMW \"%s\"", dbmw_name(dw));
 		}
@@ -357,13 +607,14 @@ dbstore_compact(dbmw_t *dw)
 		if (dbstore_debug > 1) {
 			g_debug("DBSTORE rebuilding database DBMW \"%s\"", dbmw_name(dw));
 		}
-		if (!dbmw_rebuild(dw)) {
+		if (!dbstore_compact_launch(dw)) {
 			if (dbstore_debug) {
-				g_warning("DBSTORE unable to rebuild DBMW \"%s\"",
+				g_warning("DBSTORE unable to rebuild DBMW \"%s\": %m",
 					dbmw_name(dw));
 			}
-		} else if (dbstore_debug) {
-			g_debug("DBSTORE database DBMW \"%s\" rebuilt", dbmw_name(dw));
+		} else if (dbstore_debug > 1) {
+			g_debug("DBSTORE database DBMW \"%s\" being rebuilt",
+				dbmw_name(dw));
 		}
 	}
 }
@@ -404,6 +655,7 @@ dbstore_move(const char *src, const char *dst, const char *base)
 	dbstore_move_file(old_path, new_path, DBM_DIRFEXT);
 	dbstore_move_file(old_path, new_path, DBM_PAGFEXT);
 	dbstore_move_file(old_path, new_path, DBM_DATFEXT);
+	dbstore_move_file(old_path, new_path, DBM_WALFEXT);
 
 	HFREE_NULL(old_path);
 	HFREE_NULL(new_path);
@@ -439,6 +691,7 @@ dbstore_unlink(const char *dir, const char *base)
 	dbstore_unlink_file(path, DBM_DIRFEXT);
 	dbstore_unlink_file(path, DBM_PAGFEXT);
 	dbstore_unlink_file(path, DBM_DATFEXT);
+	dbstore_unlink_file(path, DBM_WALFEXT);
 
 	HFREE_NULL(path);
 }
@@ -36,6 +36,7 @@
 
 #include "dbmw.h"
 #include "dbmap.h"
+#include "tm.h"			/* For time_delta_t */
 
 /**
  * Key/value description.
@@ -46,14 +47,25 @@
  * based on its serialized form.
  *
  * When value_data_size is 0, it is taken as being identical to value_size.
+ *
+ * The flags are only relevant for SDBM-backed stores (DBSTORE_F_*).
  */
 typedef struct dbstore_kv {
 	size_t key_size;			/**< Constant key size, in bytes */
 	dbmap_keylen_t key_len;		/**< Optional, computes serialized key length */
 	size_t value_size;			/**< Maximum value size, (bytes, structure) */
 	size_t value_data_size;		/**< Maximum value size, (bytes, serialized) */
+	uint32 flags;				/**< Creation flags */
 } dbstore_kv_t;
 
+/*
+ * Creation flags.
+ */
+
+#define DBSTORE_F_MMAP_RDONLY	(1U << 0)	/**< Read pages via mmap() */
+#define DBSTORE_F_MMAP_COW		(1U << 1)	/**< Idem, copy mapped pages */
+#define DBSTORE_F_FILTER		(1U << 2)	/**< Filter lookups of absent keys */
+
 /**
  * Key/value serialization description.
  */
@@ -63,6 +75,26 @@ typedef struct dbstore_packing {
 	dbmw_free_t valfree;		/**< Free allocated deserialization data */
 } dbstore_packing_t;
 
+/**
+ * Information about a background compaction, for the shell.
+ */
+enum dbstore_info_magic { DBSTORE_INFO_MAGIC = 0x1b9e4c63 };
+
+typedef struct {
+	enum dbstore_info_magic magic;
+	const char *name;		/**< Database name (atom) */
+	long done;				/**< Pages copied so far */
+	long total;				/**< Pages to copy */
+	time_delta_t elapsed;	/**< Time elapsed since start, in seconds */
+} dbstore_info_t;
+
+static inline void
+dbstore_info_check(const dbstore_info_t * const di)
+{
+	g_assert(di != NULL);
+	g_assert(DBSTORE_INFO_MAGIC == di->magic);
+}
+
 /*
  * Public interface.
  */
@@ -85,6 +117,8 @@ void dbstore_sync_flush(dbmw_t *dw);
 void dbstore_close(dbmw_t *dw, const char *dir, const char *base);
 void dbstore_delete(dbmw_t *dw);
 void dbstore_compact(dbmw_t *dw);
+struct pslist *dbstore_compact_info_list(void);
+void dbstore_compact_info_list_free_null(struct pslist **sl_ptr);
 void dbstore_move(const char *src, const char *dst, const char *base);
 void dbstore_unlink(const char *dir, const char *base);
 
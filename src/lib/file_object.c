@@ -696,6 +696,41 @@ file_object_release(file_object_t **fo_ptr)
 	}
 }
 
+/**
+ * Get a new file object sharing the file descriptor of an existing one,
+ * with the same access mode.
+ *
+ * This allows a file to remain opened even if the original object is
+ * released meanwhile.
+ *
+ * @param fo		the file object to duplicate
+ * @param file		location where file is duplicated
+ * @param line		line number where file is duplicated
+ *
+ * @return a new file object, to be released via file_object_release().
+ */
+file_object_t *
+file_object_dup_from(const file_object_t * const fo,
+	const char *file, int line)
+{
+	file_object_check(fo);
+
+	atomic_int_inc(&fo->fd->refcnt);
+	return file_object_alloc(fo->fd, fo->accmode, file, line);
+}
+
+/**
+ * @return whether the two file objects share the same file descriptor.
+ */
+bool
+file_object_same(const file_object_t * const a, const file_object_t * const b)
+{
+	file_object_check(a);
+	file_object_check(b);
+
+	return a->fd == b->fd;
+}
+
 /**
  * Special operations that we can perform on file objects.
  *
@@ -71,10 +71,15 @@ void file_object_close(void);
 #define file_object_open(p,a) \
 	file_object_open_from((p), (a), _WHERE_, __LINE__)
 
+#define file_object_dup(f) \
+	file_object_dup_from((f), _WHERE_, __LINE__)
+
 file_object_t *file_object_create_from(const char *path, int accmode,
 	mode_t mode, const char *file, int line);
 file_object_t *file_object_open_from(const char *path, int accmode,
 	const char *file, int line);
+file_object_t *file_object_dup_from(const file_object_t *fo,
+	const char *file, int line);
 
 ssize_t file_object_pwrite(const file_object_t *fo,
 					const void *data, size_t buf, filesize_t offset);
@@ -87,6 +92,7 @@ ssize_t file_object_preadv(const file_object_t *fo,
 
 int file_object_fd(const file_object_t *fo);
 const char *file_object_pathname(const file_object_t *fo);
+bool file_object_same(const file_object_t *a, const file_object_t *b);
 
 void file_object_release(file_object_t **fo_ptr);
 bool file_object_rename(const char * const o, const char * const n);
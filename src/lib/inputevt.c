@@ -119,8 +119,11 @@ typedef struct {
 #include "mutex.h"
 #include "plist.h"
 #include "pslist.h"
+#include "spinlock.h"
 #include "stacktrace.h"
+#include "str.h"
 #include "stringify.h"
+#include "teq.h"
 #include "thread.h"			/* For thread_in_syscall_set() */
 #include "tm.h"
 #include "walloc.h"
@@ -185,6 +188,9 @@ typedef struct relay_list {
 	size_t readers;
 	size_t writers;
 	unsigned poll_idx;
+	unsigned serial;					/**< Tells recycled descriptors apart */
+	unsigned stid;						/**< Thread owning the descriptor */
+	struct inputevt_reactor *reactor;	/**< Reactor the fd is pinned to */
 } relay_list_t;
 
 struct event {
@@ -216,8 +222,10 @@ struct poll_ctx {
 	unsigned num_poll_idx;		/**< Length of used_poll_idx array */
 	unsigned max_poll_idx;
 	unsigned num_ready;			/**< Used for /dev/poll only */
+	unsigned dispatching;		/**< Amount of threads dispatching events */
+	unsigned serial;			/**< Serial number of last relay list */
 	unsigned initialized:1;		/**< TRUE if the context has been initialized */
-	unsigned dispatching:1;		/**< TRUE if dispatching events */
+	unsigned in_timer:1;		/**< TRUE if within inputevt_timer() */
 	unsigned collecting:1;		/**< TRUE when collecing / waiting for events */
 
 #ifdef HAS_KQUEUE
@@ -226,6 +234,9 @@ struct poll_ctx {
 
 #ifdef HAS_EPOLL
 	struct epoll_event *ep_arr;
+	struct inputevt_reactor **reactors;	/**< Reactor threads, if any */
+	unsigned num_reactors;		/**< Length of the "reactors" array */
+	int reactor_stop[2];		/**< Pipe used to stop reactors */
 #endif	/* HAS_EPOLL */
 
 	struct pollfd *pfd_arr;
@@ -251,9 +262,63 @@ struct poll_ctx {
 #define CTX_UNLOCK(c)		mutex_unlock(&c->lock)
 #define CTX_IS_LOCKED(c)	mutex_is_owned(&c->lock)
 
+#ifdef HAS_EPOLL
+#define INPUTEVT_REACTOR_EVENTS	256		/**< Max events per epoll_wait() */
+
+/**
+ * A reactor thread watches the network sockets pinned to it through its
+ * own edge-triggered epoll descriptor and forwards batches of ready events
+ * to the thread owning each descriptor, via its thread event queue.
+ *
+ * Descriptors are registered with EPOLLONESHOT so that no further event is
+ * collected until the owning thread has run the callbacks and re-armed the
+ * descriptor: handlers therefore do not need to read until EAGAIN, and no
+ * more than one batch can refer to a given descriptor at a time.
+ */
+struct inputevt_reactor {
+	int epfd;					/**< The epoll descriptor */
+	unsigned index;				/**< Reactor index, for logging */
+	unsigned stid;				/**< Thread running the reactor */
+	unsigned sockets;			/**< Pinned descriptors (context lock) */
+	spinlock_t lock;			/**< Protects the statistics below */
+	struct inputevt_reactor_stats stats;
+	struct epoll_event ev[INPUTEVT_REACTOR_EVENTS];
+};
+
+/**
+ * A batch of events collected by a reactor for a given thread.
+ */
+struct inputevt_batch {
+	struct inputevt_reactor *reactor;
+	tm_nano_t stamp;			/**< When events were collected */
+	unsigned count;				/**< Amount of events in batch */
+	struct epoll_event ev[];
+};
+
+/*
+ * The 64-bit epoll data of a reactor-pinned descriptor holds the fd in the
+ * lower 32 bits, the lower 24 bits of the relay list serial number and
+ * the ID of the owning thread in the upper byte.
+ */
+#define INPUTEVT_SERIAL_MASK	0xffffffU
+#define INPUTEVT_REACTOR_STOP	((uint64) -1)
+
+static inline uint64
+inputevt_reactor_data(int fd, const relay_list_t *rl)
+{
+	STATIC_ASSERT(THREAD_MAX <= 256);
+
+	return (uint64) (uint32) fd |
+		((uint64) (rl->serial & INPUTEVT_SERIAL_MASK) << 32) |
+		((uint64) rl->stid << 56);
+}
+#endif	/* HAS_EPOLL */
+
 static unsigned data_available;
 
 static void inputevt_process_added(struct poll_ctx *ctx);
+static struct inputevt_reactor *inputevt_reactor_pick(struct poll_ctx *, int);
+static void inputevt_reactor_unpin(struct poll_ctx *, relay_list_t *);
 
 /**
  * @return A positive value indicates how much data is available for reading.
@@ -474,6 +539,14 @@ event_check_all_with_kqueue(struct poll_ctx *ctx)
 #endif /* HAS_KQUEUE */
 
 #ifdef HAS_EPOLL
+static inline inputevt_cond_t
+event_cond_from_epoll(uint32 events)
+{
+	return ((EPOLLIN | EPOLLPRI | EPOLLHUP) & events ? INPUT_EVENT_R : 0)
+		| (EPOLLOUT & events ? INPUT_EVENT_W : 0)
+		| (EPOLLERR & events ? INPUT_EVENT_EXCEPTION : 0);
+}
+
 static struct event
 event_get_with_epoll(const struct poll_ctx *ctx, unsigned idx)
 {
@@ -483,10 +556,7 @@ event_get_with_epoll(const struct poll_ctx *ctx, unsigned idx)
 	g_assert(CTX_IS_LOCKED(ctx));
 
 	event.fd = pointer_to_int(ev->data.ptr);
-	event.condition =
-		((EPOLLIN | EPOLLPRI | EPOLLHUP) & ev->events ? INPUT_EVENT_R : 0)
-		| (EPOLLOUT & ev->events ? INPUT_EVENT_W : 0)
-		| (EPOLLERR & ev->events ? INPUT_EVENT_EXCEPTION : 0);
+	event.condition = event_cond_from_epoll(ev->events);
 	event.data_available = 0;
 	return event;
 }
@@ -533,6 +603,61 @@ event_check_all_with_epoll(struct poll_ctx *ctx)
 
 	return epoll_wait(ctx->master_fd, ctx->ep_arr, ctx->num_ev, 0);
 }
+
+/**
+ * Compute the epoll event mask for a reactor-pinned descriptor.
+ */
+static inline uint32
+event_reactor_mask(inputevt_cond_t cond)
+{
+	uint32 events = EPOLLET | EPOLLONESHOT;
+
+	if (INPUT_EVENT_R & cond)
+		events |= EPOLLIN | EPOLLPRI;
+	if (INPUT_EVENT_W & cond)
+		events |= EPOLLOUT;
+
+	return events;
+}
+
+/**
+ * Event mask setting when reactors are running: descriptors pinned to
+ * a reactor are registered there, the others remain in the master epoll
+ * descriptor which is watched by the main I/O loop.
+ */
+static int
+event_set_mask_with_reactor(struct poll_ctx *ctx, int fd,
+	inputevt_cond_t old, inputevt_cond_t cur)
+{
+	static const struct epoll_event zero_ev;
+	struct epoll_event ev;
+	relay_list_t *rl;
+	int op;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	rl = htable_lookup(ctx->ht, int_to_pointer(fd));
+	if (NULL == rl || NULL == rl->reactor)
+		return event_set_mask_with_epoll(ctx, fd, old, cur);
+
+	old &= INPUT_EVENT_RW;
+	cur &= INPUT_EVENT_RW;
+	if (cur == old)
+		return 0;
+
+	ev = zero_ev;
+	ev.data.u64 = inputevt_reactor_data(fd, rl);
+	ev.events = event_reactor_mask(cur);
+
+	if (0 == old)
+		op = EPOLL_CTL_ADD;
+	else if (0 == cur)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+
+	return epoll_ctl(rl->reactor->epfd, op, fd, &ev);
+}
 #endif	/* HAS_EPOLL */
 
 #ifdef HAS_DEV_POLL
@@ -895,6 +1020,7 @@ relay_list_remove(struct poll_ctx *ctx, unsigned id)
 	if (NULL == rl->sl) {
 		g_assert(0 == rl->readers && 0 == rl->writers);
 		inputevt_poll_idx_free(ctx, &rl->poll_idx);
+		inputevt_reactor_unpin(ctx, rl);
 		hash_list_remove(ctx->readable, int_to_pointer(relay->fd));
 		htable_remove(ctx->ht, int_to_pointer(relay->fd));
 		WFREE(rl);
@@ -931,6 +1057,109 @@ inputevt_purge_removed(struct poll_ctx *ctx)
 	pslist_free_null(&ctx->removed);
 }
 
+/**
+ * Invoke the callbacks registered on a file descriptor for the condition.
+ *
+ * Must be called without the context lock, whilst ctx->dispatching is
+ * non-zero to prevent the relay list from being freed.
+ */
+static void
+inputevt_relays_invoke(struct poll_ctx *ctx, int fd, inputevt_cond_t cond)
+{
+	relay_list_t *rl;
+	pslist_t *sl;
+
+	rl = htable_lookup(ctx->ht, int_to_pointer(fd));
+	g_assert(NULL != rl);
+	g_assert((0 == rl->readers && 0 == rl->writers) || NULL != rl->sl);
+
+	for (sl = rl->sl; NULL != sl; /* NOTHING */) {
+		inputevt_relay_t *relay;
+		unsigned id;
+
+		id = pointer_to_uint(sl->data);
+		g_assert(id > 0);
+		g_assert(id < ctx->num_ev);
+
+		sl = pslist_next(sl);
+
+		relay = ctx->relay[id];
+		g_assert(relay);
+		g_assert(relay->fd == fd);
+
+		if G_UNLIKELY(zero_handler == relay->handler)
+			continue;
+
+		if (relay->condition & cond)
+			relay->handler(relay->data, relay->fd, cond);
+	}
+}
+
+/**
+ * Dispatch fake events on the file descriptors flagged as readable.
+ *
+ * Must be called with the context lock held, and whilst dispatching.
+ */
+static void
+inputevt_readable_dispatch(struct poll_ctx *ctx)
+{
+	plist_t *iter, *list;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+	g_assert(ctx->dispatching != 0);
+
+	if (0 == hash_list_length(ctx->readable))
+		return;
+
+	list = hash_list_list(ctx->readable);
+	hash_list_clear(ctx->readable);
+
+	/*
+	 * Now that we snapshot the list of readable file descriptors, we
+	 * can release the context lock to make sure callbacks are invoked
+	 * with not locks held.
+	 *
+	 * Same as above for regular fd events, we hope that the relay list
+	 * will not be concurrently updated in a way that would corrupt our
+	 * processing whilst we no longer hold the lock.	--RAM
+	 */
+
+	CTX_UNLOCK(ctx);
+
+	if (inputevt_debug > 2) {
+		unsigned long count = plist_length(list);
+		s_debug("%s(): %lu fake event%s", G_STRFUNC, count, plural(count));
+	}
+
+	PLIST_FOREACH(list, iter) {
+		int fd = pointer_to_int(iter->data);
+
+		g_assert(is_valid_fd(fd));
+
+		data_available = 0;
+		inputevt_relays_invoke(ctx, fd, INPUT_EVENT_R);
+	}
+	plist_free_null(&list);
+	CTX_LOCK(ctx);
+}
+
+/**
+ * Signal end of event dispatching, purging removed sources when the last
+ * dispatching thread is done.
+ */
+static void
+inputevt_dispatch_end(struct poll_ctx *ctx)
+{
+	g_assert(CTX_IS_LOCKED(ctx));
+	g_assert(ctx->dispatching != 0);
+
+	ctx->dispatching--;
+
+	if (0 == ctx->dispatching && ctx->removed) {
+		inputevt_purge_removed(ctx);
+	}
+}
+
 /**
  * Our main I/O event dispatching loop.
  */
@@ -947,7 +1176,7 @@ inputevt_timer(struct poll_ctx *ctx)
 	g_assert(ctx->ht != NULL);
 
 	/* Maybe this must safely fail for general use, thus no assertion */
-	if (ctx->dispatching) {
+	if (ctx->in_timer) {
 		CTX_UNLOCK(ctx);
 		s_critical("%s(): called recursively / concurrently", G_STRFUNC);
 		return;
@@ -960,7 +1189,8 @@ inputevt_timer(struct poll_ctx *ctx)
 			stacktrace_function_name(ctx->event_check_all));
 	}
 
-	ctx->dispatching = TRUE;
+	ctx->in_timer = TRUE;
+	ctx->dispatching++;
 
 	if (num_events > 0) {
 		unsigned idx;
@@ -984,44 +1214,17 @@ inputevt_timer(struct poll_ctx *ctx)
 		/*
 		 * Invoke I/O callbacks without any locks.
 		 *
-		 * Becauuse ctx->dispatching is TRUE, no changes to the relay list
+		 * Becauuse ctx->dispatching is non-zero, no changes to the relay list
 		 * can happen concurrently (hopefully -- RAM).
 		 */
 
 		CTX_UNLOCK(ctx);
 
 		PSLIST_FOREACH(evlist, es) {
-			relay_list_t *rl;
-			pslist_t *sl;
 			struct event *event = es->data;
 
-			rl = htable_lookup(ctx->ht, int_to_pointer(event->fd));
-			g_assert(NULL != rl);
-			g_assert((0 == rl->readers && 0 == rl->writers) || NULL != rl->sl);
-
-			for (sl = rl->sl; NULL != sl; /* NOTHING */) {
-				inputevt_relay_t *relay;
-				unsigned id;
-
-				id = pointer_to_uint(sl->data);
-				g_assert(id > 0);
-				g_assert(id < ctx->num_ev);
-
-				sl = pslist_next(sl);
-
-				relay = ctx->relay[id];
-				g_assert(relay);
-				g_assert(relay->fd == event->fd);
-
-				if G_UNLIKELY(zero_handler == relay->handler)
-					continue;
-
-				if (relay->condition & event->condition) {
-					data_available = event->data_available;
-					relay->handler(relay->data, relay->fd, event->condition);
-				}
-			}
-
+			data_available = event->data_available;
+			inputevt_relays_invoke(ctx, event->fd, event->condition);
 			WFREE(event);
 		}
 
@@ -1029,71 +1232,10 @@ inputevt_timer(struct poll_ctx *ctx)
 		CTX_LOCK(ctx);
 	}
 
-	if (hash_list_length(ctx->readable) > 0) {
-		plist_t *iter, *list = hash_list_list(ctx->readable);
-
-		hash_list_clear(ctx->readable);
-
-		/*
-		 * Now that we snapshot the list of readable file descriptors, we
-		 * can release the context lock to make sure callbacks are invoked
-		 * with not locks held.
-		 *
-		 * Same as above for regular fd events, we hope that the relay list
-		 * will not be concurrently updated in a way that would corrupt our
-		 * processing whilst we no longer hold the lock.	--RAM
-		 */
-
-		CTX_UNLOCK(ctx);
-
-		if (inputevt_debug > 2) {
-			unsigned long count = plist_length(list);
-			s_debug("%s(): %lu fake event%s", G_STRFUNC, count, plural(count));
-		}
-
-		PLIST_FOREACH(list, iter) {
-			int fd = pointer_to_int(iter->data);
-			relay_list_t *rl;
-			pslist_t *sl;
+	inputevt_readable_dispatch(ctx);
 
-			g_assert(is_valid_fd(fd));
-
-			rl = htable_lookup(ctx->ht, int_to_pointer(fd));
-			g_assert(NULL != rl);
-			g_assert((0 == rl->readers && 0 == rl->writers) || NULL != rl->sl);
-
-			for (sl = rl->sl; NULL != sl; /* NOTHING */) {
-				inputevt_relay_t *relay;
-				unsigned id;
-
-				id = pointer_to_uint(sl->data);
-				sl = pslist_next(sl);
-
-				g_assert(id > 0);
-				g_assert(id < ctx->num_ev);
-
-				relay = ctx->relay[id];
-				g_assert(relay);
-				g_assert(relay->fd == fd);
-
-				if G_UNLIKELY(zero_handler == relay->handler)
-					continue;
-
-				if (INPUT_EVENT_R & relay->condition) {
-					data_available = 0;
-					relay->handler(relay->data, relay->fd, INPUT_EVENT_R);
-				}
-			}
-		}
-		plist_free_null(&list);
-		CTX_LOCK(ctx);
-	}
-
-	ctx->dispatching = FALSE;
-
-	if (ctx->removed) {
-		inputevt_purge_removed(ctx);
-	}
+	ctx->in_timer = FALSE;
+	inputevt_dispatch_end(ctx);
 
 	CTX_UNLOCK(ctx);
 }
@@ -1351,6 +1493,9 @@ inputevt_add_source(struct poll_ctx *ctx, inputevt_relay_t *relay, uint id)
 			rl->writers = 0;
 			rl->sl = NULL;
 			rl->poll_idx = inputevt_poll_idx_new(ctx, relay->fd);
+			rl->serial = ++ctx->serial;
+			rl->stid = thread_small_id();
+			rl->reactor = inputevt_reactor_pick(ctx, relay->fd);
 			old = 0;
 			htable_insert(ctx->ht, key, rl);
 		}
@@ -1394,6 +1539,590 @@ inputevt_process_added(struct poll_ctx *ctx)
 	pslist_free_null(&ctx->added_relays);
 }
 
+#ifdef HAS_EPOLL
+#define INPUTEVT_REACTOR_STACK	THREAD_STACK_MIN
+
+/**
+ * Is file descriptor a network socket?
+ *
+ * Only these are pinned to reactors: local sockets and pipes are used
+ * by waiter objects, notably to wake up the thread event queue of the
+ * main thread, and must therefore remain watched by the main I/O loop.
+ */
+static bool
+inputevt_is_network_socket(int fd)
+{
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof addr;
+
+	if (-1 == getsockname(fd, cast_to_pointer(&addr), &len))
+		return FALSE;
+
+	switch (addr.ss_family) {
+	case AF_INET:
+#ifdef AF_INET6
+	case AF_INET6:
+#endif
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Select the reactor to which a new file descriptor will be pinned.
+ *
+ * @return the least loaded reactor, NULL if the descriptor must be
+ * handled by the main I/O loop.
+ */
+static struct inputevt_reactor *
+inputevt_reactor_pick(struct poll_ctx *ctx, int fd)
+{
+	struct inputevt_reactor *r = NULL;
+	unsigned i;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	if (0 == ctx->num_reactors || !inputevt_is_network_socket(fd))
+		return NULL;
+
+	for (i = 0; i < ctx->num_reactors; i++) {
+		struct inputevt_reactor *x = ctx->reactors[i];
+
+		if (NULL == r || x->sockets < r->sockets)
+			r = x;
+	}
+
+	r->sockets++;
+	return r;
+}
+
+/**
+ * Unpin relay list from its reactor, if any.
+ */
+static void
+inputevt_reactor_unpin(struct poll_ctx *ctx, relay_list_t *rl)
+{
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	if (rl->reactor != NULL) {
+		g_assert(rl->reactor->sockets != 0);
+		rl->reactor->sockets--;
+		rl->reactor = NULL;
+	}
+}
+
+/**
+ * Re-arm a reactor-pinned descriptor after its events were dispatched.
+ */
+static void
+inputevt_reactor_arm(struct poll_ctx *ctx, int fd, const relay_list_t *rl)
+{
+	static const struct epoll_event zero_ev;
+	struct epoll_event ev;
+	inputevt_cond_t cur;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+	g_assert(rl->reactor != NULL);
+
+	cur = (rl->readers ? INPUT_EVENT_R : 0) |
+		(rl->writers ? INPUT_EVENT_W : 0);
+
+	if (0 == cur)
+		return;
+
+	ev = zero_ev;
+	ev.data.u64 = inputevt_reactor_data(fd, rl);
+	ev.events = event_reactor_mask(cur);
+
+	if (-1 == epoll_ctl(rl->reactor->epfd, EPOLL_CTL_MOD, fd, &ev)) {
+		if (inputevt_debug) {
+			s_debug("%s(): cannot re-arm fd=%d in reactor #%u: %m",
+				G_STRFUNC, fd, rl->reactor->index);
+		}
+	}
+}
+
+/**
+ * Dispatch events on the file descriptors flagged as readable.
+ *
+ * This is a TEQ callback, used when reactors are running because the
+ * master descriptor may then stay quiet for a long time.
+ */
+static void
+inputevt_readable_flush(void *data)
+{
+	struct poll_ctx *ctx = data;
+
+	if G_UNLIKELY(!ctx->initialized)
+		return;
+
+	CTX_LOCK(ctx);
+	ctx->dispatching++;
+	inputevt_readable_dispatch(ctx);
+	inputevt_dispatch_end(ctx);
+	CTX_UNLOCK(ctx);
+}
+
+/**
+ * Dispatch a batch of events collected by a reactor.
+ *
+ * This is a TEQ callback, invoked in the thread owning the descriptors.
+ */
+static void
+inputevt_reactor_dispatch(void *data)
+{
+	struct inputevt_batch *b = data;
+	struct poll_ctx *ctx = get_global_poll_ctx();
+	struct inputevt_reactor *r;
+	tm_nano_t now, elapsed;
+	unsigned i, stale = 0;
+	uint64 latency;
+
+	if G_UNLIKELY(!ctx->initialized)
+		goto done;		/* Reactors are gone */
+
+	tm_precise_time(&now);
+	tm_precise_elapsed(&elapsed, &now, &b->stamp);
+	latency = tmn2ns(&elapsed) / 1000;
+
+	CTX_LOCK(ctx);
+	ctx->dispatching++;
+
+	for (i = 0; i < b->count; i++) {
+		const struct epoll_event *ev = &b->ev[i];
+		int fd = (int) (uint32) ev->data.u64;
+		unsigned serial = (ev->data.u64 >> 32) & INPUTEVT_SERIAL_MASK;
+		relay_list_t *rl;
+
+		/*
+		 * The descriptor may have been removed, and its number recycled,
+		 * since events were collected: the serial number tells.
+		 */
+
+		rl = htable_lookup(ctx->ht, int_to_pointer(fd));
+		if (
+			NULL == rl || NULL == rl->reactor ||
+			serial != (rl->serial & INPUTEVT_SERIAL_MASK)
+		) {
+			stale++;
+			continue;
+		}
+
+		CTX_UNLOCK(ctx);
+
+		data_available = 0;
+		inputevt_relays_invoke(ctx, fd, event_cond_from_epoll(ev->events));
+
+		CTX_LOCK(ctx);
+
+		/*
+		 * The relay list cannot be freed whilst we are dispatching, but
+		 * the callbacks may have removed all the sources of the descriptor,
+		 * in which case inputevt_reactor_arm() will not re-arm it.
+		 */
+
+		inputevt_reactor_arm(ctx, fd, rl);
+	}
+
+	inputevt_readable_dispatch(ctx);
+	inputevt_dispatch_end(ctx);
+	CTX_UNLOCK(ctx);
+
+	r = b->reactor;
+
+	spinlock(&r->lock);
+	r->stats.dispatched++;
+	r->stats.stale += stale;
+	r->stats.latency_us += latency;
+	if (latency > r->stats.latency_max_us)
+		r->stats.latency_max_us = latency;
+	spinunlock(&r->lock);
+
+done:
+	xfree(b);
+}
+
+/**
+ * Post batch of events to the thread owning the descriptors.
+ *
+ * Threads without an event queue cannot get events marshalled to them,
+ * so their batches go to the main I/O thread.
+ */
+static void
+inputevt_reactor_post(struct inputevt_reactor *r,
+	struct inputevt_batch *b, unsigned stid)
+{
+	spinlock(&r->lock);
+	r->stats.batches++;
+	spinunlock(&r->lock);
+
+	if (stid != inputevt_stid && teq_is_supported(stid))
+		teq_post(stid, inputevt_reactor_dispatch, b);
+	else
+		teq_safe_post(inputevt_stid, inputevt_reactor_dispatch, b);
+}
+
+/**
+ * Reactor thread main loop.
+ */
+static void *
+inputevt_reactor_main(void *arg)
+{
+	struct inputevt_reactor *r = arg;
+	bool stop = FALSE;
+
+	thread_set_name_atom(str_smsg("reactor #%u", r->index));
+
+	while (!stop) {
+		struct inputevt_batch *b = NULL;
+		unsigned stid = THREAD_INVALID_ID;
+		tm_nano_t now;
+		int i, n;
+
+		thread_in_syscall_set(TRUE);
+		n = epoll_wait(r->epfd, r->ev, N_ITEMS(r->ev), -1);
+		thread_in_syscall_set(FALSE);
+
+		if (-1 == n) {
+			if (EINTR != errno)
+				s_error("%s(): epoll_wait(%d) failed: %m", G_STRFUNC, r->epfd);
+			continue;
+		}
+
+		tm_precise_time(&now);
+
+		spinlock(&r->lock);
+		r->stats.wakeups++;
+		r->stats.events += n;
+		spinunlock(&r->lock);
+
+		/*
+		 * Consecutive events for descriptors owned by the same thread
+		 * are sent as a single batch.
+		 */
+
+		for (i = 0; i < n; i++) {
+			const struct epoll_event *ev = &r->ev[i];
+			unsigned owner;
+
+			if G_UNLIKELY(INPUTEVT_REACTOR_STOP == ev->data.u64) {
+				stop = TRUE;
+				continue;
+			}
+
+			owner = ev->data.u64 >> 56;
+
+			if (b != NULL && owner != stid) {
+				inputevt_reactor_post(r, b, stid);
+				b = NULL;
+			}
+
+			if (NULL == b) {
+				b = xmalloc(sizeof *b + (n - i) * sizeof b->ev[0]);
+				b->reactor = r;
+				b->stamp = now;
+				b->count = 0;
+				stid = owner;
+			}
+
+			b->ev[b->count++] = *ev;
+		}
+
+		if (b != NULL)
+			inputevt_reactor_post(r, b, stid);
+	}
+
+	return NULL;
+}
+
+/**
+ * Move an already registered network socket to a reactor.
+ *
+ * This is an htable_foreach() callback.
+ */
+static void
+inputevt_reactor_migrate(const void *key, void *value, void *data)
+{
+	static const struct epoll_event zero_ev;
+	struct poll_ctx *ctx = data;
+	relay_list_t *rl = value;
+	struct epoll_event ev;
+	inputevt_cond_t cur;
+	int fd = pointer_to_int(key);
+
+	g_assert(NULL == rl->reactor);
+
+	rl->reactor = inputevt_reactor_pick(ctx, fd);
+	if (NULL == rl->reactor)
+		return;
+
+	cur = (rl->readers ? INPUT_EVENT_R : 0) |
+		(rl->writers ? INPUT_EVENT_W : 0);
+
+	if (0 == cur)
+		return;		/* Not registered anywhere */
+
+	if (-1 == event_set_mask_with_epoll(ctx, fd, cur, 0)) {
+		s_warning("%s(): cannot remove fd=%d from epoll descriptor #%d: %m",
+			G_STRFUNC, fd, ctx->master_fd);
+	}
+
+	ev = zero_ev;
+	ev.data.u64 = inputevt_reactor_data(fd, rl);
+	ev.events = event_reactor_mask(cur);
+
+	if (-1 == epoll_ctl(rl->reactor->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		s_error("%s(): cannot add fd=%d to reactor #%u: %m",
+			G_STRFUNC, fd, rl->reactor->index);
+	}
+}
+
+/**
+ * Create a new reactor.
+ *
+ * @return the reactor, NULL on failure.
+ */
+static struct inputevt_reactor *
+inputevt_reactor_new(struct poll_ctx *ctx, unsigned index)
+{
+	static const struct epoll_event zero_ev;
+	struct inputevt_reactor *r;
+	struct epoll_event ev;
+	int epfd, stid;
+
+	epfd = epoll_create(1024 /* Just an arbitrary value as hint */);
+	if (!is_valid_fd(epfd)) {
+		s_warning("%s(): epoll_create() failed: %m", G_STRFUNC);
+		return NULL;
+	}
+
+	fd_set_close_on_exec(epfd);
+
+	ev = zero_ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = INPUTEVT_REACTOR_STOP;
+
+	if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, ctx->reactor_stop[0], &ev)) {
+		s_warning("%s(): cannot watch stopping pipe: %m", G_STRFUNC);
+		fd_close(&epfd);
+		return NULL;
+	}
+
+	XMALLOC0(r);
+	r->epfd = epfd;
+	r->index = index;
+	spinlock_init(&r->lock);
+
+	stid = thread_create(inputevt_reactor_main, r,
+			THREAD_F_NO_POOL | THREAD_F_PANIC, INPUTEVT_REACTOR_STACK);
+
+	r->stid = stid;
+	return r;
+}
+
+/**
+ * Start the requested amount of reactor threads.
+ *
+ * From then on, network sockets are watched by the reactors, each socket
+ * being pinned to the least loaded reactor when it is first registered.
+ * Events are sent back in batches to the thread that registered the
+ * socket, through its thread event queue, so callbacks still run in the
+ * same thread as before.
+ *
+ * Reactors can only be started once: changing their amount afterwards
+ * requires a restart.
+ *
+ * @param count		amount of reactors wanted, 0 meaning none
+ */
+void
+inputevt_set_reactors(unsigned count)
+{
+	struct poll_ctx *ctx = get_global_poll_ctx();
+	unsigned i;
+
+	g_assert(ctx->initialized);
+
+	count = MIN(count, INPUTEVT_REACTOR_MAX);
+
+	CTX_LOCK(ctx);
+
+	if (count == ctx->num_reactors)
+		goto done;
+
+	if (ctx->num_reactors != 0) {
+		s_message("INPUTEVT running %u reactor%s, will use %u after restart",
+			ctx->num_reactors, plural(ctx->num_reactors), count);
+		goto done;
+	}
+
+	if (ctx->event_set_mask != event_set_mask_with_epoll) {
+		s_warning("%s(): reactors require epoll(), not using any with %s",
+			G_STRFUNC, ctx->polling_method);
+		goto done;
+	}
+
+	if (!teq_is_supported(inputevt_stid)) {
+		s_warning("%s(): %s has no event queue, not using any reactor",
+			G_STRFUNC, thread_id_name(inputevt_stid));
+		goto done;
+	}
+
+	if (-1 == pipe(ctx->reactor_stop)) {
+		s_warning("%s(): pipe() failed: %m", G_STRFUNC);
+		goto done;
+	}
+
+	fd_set_close_on_exec(ctx->reactor_stop[0]);
+	fd_set_close_on_exec(ctx->reactor_stop[1]);
+
+	XMALLOC0_ARRAY(ctx->reactors, count);
+
+	for (i = 0; i < count; i++) {
+		struct inputevt_reactor *r = inputevt_reactor_new(ctx, i);
+
+		if (NULL == r)
+			break;
+
+		ctx->reactors[i] = r;
+	}
+
+	if (0 == i) {
+		XFREE_NULL(ctx->reactors);
+		fd_close(&ctx->reactor_stop[0]);
+		fd_close(&ctx->reactor_stop[1]);
+		goto done;
+	}
+
+	ctx->num_reactors = i;
+	ctx->event_set_mask = event_set_mask_with_reactor;
+
+	/*
+	 * Move the network sockets already registered to the reactors.
+	 */
+
+	htable_foreach(ctx->ht, inputevt_reactor_migrate, ctx);
+
+	s_info("INPUTEVT dispatching network I/O from %u reactor thread%s",
+		i, plural(i));
+
+done:
+	CTX_UNLOCK(ctx);
+}
+
+/**
+ * Stop the reactor threads, if any.
+ */
+static void
+inputevt_reactors_stop(struct poll_ctx *ctx)
+{
+	unsigned i;
+	char c = 0;
+
+	if (0 == ctx->num_reactors)
+		return;
+
+	/*
+	 * The stopping pipe is watched in level-triggered mode by all the
+	 * reactors, hence writing a single byte is enough to stop them all.
+	 */
+
+	if (-1 == write(ctx->reactor_stop[1], &c, sizeof c))
+		s_error("%s(): cannot signal reactors: %m", G_STRFUNC);
+
+	for (i = 0; i < ctx->num_reactors; i++) {
+		struct inputevt_reactor *r = ctx->reactors[i];
+
+		if (-1 == thread_join(r->stid, NULL)) {
+			s_warning("%s(): cannot join %s: %m",
+				G_STRFUNC, thread_id_name(r->stid));
+		}
+		fd_close(&r->epfd);
+		xfree(r);
+	}
+
+	XFREE_NULL(ctx->reactors);
+	ctx->num_reactors = 0;
+	fd_close(&ctx->reactor_stop[0]);
+	fd_close(&ctx->reactor_stop[1]);
+}
+
+/**
+ * Fetch statistics about the running reactors.
+ *
+ * @param vec		where statistics are written
+ * @param n			amount of entries in vector
+ *
+ * @return amount of entries filled.
+ */
+size_t
+inputevt_reactor_stats(struct inputevt_reactor_stats *vec, size_t n)
+{
+	struct poll_ctx *ctx = get_global_poll_ctx();
+	size_t i, count;
+
+	g_assert(vec != NULL || 0 == n);
+
+	if G_UNLIKELY(!ctx->initialized)
+		return 0;
+
+	CTX_LOCK(ctx);
+
+	count = MIN(n, ctx->num_reactors);
+
+	for (i = 0; i < count; i++) {
+		struct inputevt_reactor *r = ctx->reactors[i];
+
+		spinlock(&r->lock);
+		vec[i] = r->stats;
+		spinunlock(&r->lock);
+
+		vec[i].stid = r->stid;
+		vec[i].sockets = r->sockets;
+	}
+
+	CTX_UNLOCK(ctx);
+
+	return count;
+}
+#else	/* !HAS_EPOLL */
+static struct inputevt_reactor *
+inputevt_reactor_pick(struct poll_ctx *ctx, int fd)
+{
+	(void) ctx;
+	(void) fd;
+	return NULL;
+}
+
+static void
+inputevt_reactor_unpin(struct poll_ctx *ctx, relay_list_t *rl)
+{
+	(void) ctx;
+	g_assert(NULL == rl->reactor);
+}
+
+static void
+inputevt_reactors_stop(struct poll_ctx *ctx)
+{
+	(void) ctx;
+}
+
+void
+inputevt_set_reactors(unsigned count)
+{
+	if (count != 0)
+		s_warning("%s(): reactors require epoll()", G_STRFUNC);
+}
+
+size_t
+inputevt_reactor_stats(struct inputevt_reactor_stats *vec, size_t n)
+{
+	(void) vec;
+	(void) n;
+	return 0;
+}
+#endif	/* HAS_EPOLL */
+
 void
 inputevt_set_readable(int fd)
 {
@@ -1412,6 +2141,16 @@ inputevt_set_readable(int fd)
 		!hash_list_contains(ctx->readable, key)
 	) {
 		hash_list_append(ctx->readable, key);
+
+#ifdef HAS_EPOLL
+		/*
+		 * When reactors run, the master descriptor may stay quiet for long,
+		 * so make sure the fake events are dispatched soon.
+		 */
+
+		if (ctx->num_reactors != 0 && 1 == hash_list_length(ctx->readable))
+			teq_safe_post(inputevt_stid, inputevt_readable_flush, ctx);
+#endif	/* HAS_EPOLL */
 	}
 
 	CTX_UNLOCK(ctx);
@@ -1724,6 +2463,7 @@ inputevt_close(void)
 	struct poll_ctx *ctx;
 
 	ctx = get_global_poll_ctx();
+	inputevt_reactors_stop(ctx);
 	inputevt_stid = THREAD_INVALID_ID;
 
 	CTX_LOCK(ctx);
@@ -65,6 +65,23 @@ typedef void (*inputevt_handler_t) (
 	inputevt_cond_t condition
 );
 
+#define INPUTEVT_REACTOR_MAX	16	/**< Maximum amount of reactor threads */
+
+/**
+ * Statistics about a reactor thread.
+ */
+struct inputevt_reactor_stats {
+	unsigned stid;			/**< Thread ID of the reactor */
+	unsigned sockets;		/**< Amount of sockets pinned to the reactor */
+	uint64 wakeups;			/**< Amount of epoll_wait() returns */
+	uint64 events;			/**< Amount of events collected */
+	uint64 batches;			/**< Amount of event batches posted */
+	uint64 dispatched;		/**< Amount of event batches dispatched */
+	uint64 stale;			/**< Events for sources removed meanwhile */
+	uint64 latency_us;		/**< Cumulated batch dispatching latency (us) */
+	uint64 latency_max_us;	/**< Maximum batch dispatching latency (us) */
+};
+
 /*
  * Module initialization and cleanup functions.
  */
@@ -76,6 +93,9 @@ void inputevt_dispatch(void);
 void inputevt_set_debug(unsigned level);
 unsigned inputevt_thread_id(void);
 
+void inputevt_set_reactors(unsigned count);
+size_t inputevt_reactor_stats(struct inputevt_reactor_stats *vec, size_t n);
+
 /**
  * This emulates the GDK input interface.
  */
@@ -0,0 +1,876 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Batched asynchronous I/O through the Linux io_uring interface.
+ *
+ * Requests are queued in the submission ring by iouring_read() and
+ * iouring_send(), then handed to the kernel all at once by iouring_submit(),
+ * in a single system call.  The kernel signals completions through an
+ * eventfd descriptor which can be watched by the I/O event loop, at which
+ * point iouring_reap() invokes the completion callbacks.
+ *
+ * We talk to the kernel directly through the system calls, since we do not
+ * want to depend on liburing for the little we need.  When the kernel does
+ * not support io_uring, or does not know about the operations we need,
+ * iouring_make() fails and callers are expected to use plain system calls.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#ifdef HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "iouring.h"
+
+#include "atomic.h"
+#include "elist.h"
+#include "fd.h"
+#include "log.h"
+#include "stringify.h"
+#include "vmm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#ifdef HAS_IO_URING
+
+enum iouring_magic { IOURING_MAGIC = 0x1e6a0f93 };
+
+/**
+ * A mapped ring, submission or completion.
+ */
+struct iouring_ring {
+	void *base;					/**< Base of the mapped area */
+	size_t size;				/**< Size of the mapped area */
+	uint32 *head;				/**< Consumer index */
+	uint32 *tail;				/**< Producer index */
+	uint32 mask;				/**< Ring mask */
+	uint32 entries;				/**< Amount of entries in the ring */
+};
+
+/**
+ * An io_uring instance.
+ */
+struct iouring {
+	enum iouring_magic magic;
+	int fd;						/**< The io_uring descriptor */
+	int efd;					/**< The eventfd signaled on completions */
+	struct iouring_ring sq;		/**< Submission ring */
+	struct iouring_ring cq;		/**< Completion ring */
+	uint32 *sq_array;			/**< Indirection array of the submission ring */
+	struct io_uring_sqe *sqes;	/**< Submission entries */
+	struct io_uring_cqe *cqes;	/**< Completion entries */
+	size_t sqes_size;			/**< Size of the mapped submission entries */
+	uint32 sq_tail;				/**< Our view of the submission tail */
+	uint32 sq_submitted;		/**< Submission tail given to the kernel */
+	unsigned inflight;			/**< Requests submitted, not completed yet */
+	elist_t pending;			/**< Requests with a callback, not completed */
+	uint8 closing;				/**< Set when ring is being destroyed */
+};
+
+static inline void
+iouring_check(const struct iouring * const ur)
+{
+	g_assert(ur != NULL);
+	g_assert(IOURING_MAGIC == ur->magic);
+}
+
+/**
+ * A pending request, whose address is the user data of the entry.
+ */
+struct iouring_req {
+	iouring_cb_t cb;
+	void *arg;
+	link_t lk;					/**< Links pending requests */
+	uint8 cancelled;			/**< Report -ECANCELED on completion */
+};
+
+static int
+iouring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+iouring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		NULL, (size_t) 0);
+}
+
+static int
+iouring_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+/**
+ * Check that the kernel supports the operations we need.
+ */
+static bool
+iouring_probe(int fd)
+{
+	static const uint8 ops[] = {
+		IORING_OP_READ, IORING_OP_SEND, IORING_OP_ASYNC_CANCEL
+	};
+	struct io_uring_probe *probe;
+	size_t len, i;
+	bool ok = TRUE;
+
+	len = sizeof *probe + 256 * sizeof probe->ops[0];
+	probe = walloc0(len);
+
+	if (-1 == iouring_register(fd, IORING_REGISTER_PROBE, probe, 256)) {
+		ok = FALSE;
+		goto done;
+	}
+
+	for (i = 0; i < N_ITEMS(ops); i++) {
+		if (
+			ops[i] > probe->last_op ||
+			!(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)
+		) {
+			errno = ENOTSUP;
+			ok = FALSE;
+			break;
+		}
+	}
+
+done:
+	wfree(probe, len);
+	return ok;
+}
+
+/**
+ * Unmap all the rings.
+ */
+static void
+iouring_unmap(struct iouring *ur)
+{
+	if (ur->sqes != NULL)
+		vmm_munmap(ur->sqes, ur->sqes_size);
+	if (ur->cq.base != NULL && ur->cq.base != ur->sq.base)
+		vmm_munmap(ur->cq.base, ur->cq.size);
+	if (ur->sq.base != NULL)
+		vmm_munmap(ur->sq.base, ur->sq.size);
+}
+
+/**
+ * Map the rings shared with the kernel.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+iouring_map(struct iouring *ur, const struct io_uring_params *p)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_SHARED | MAP_POPULATE;
+	void *base;
+
+	ur->sq.size = p->sq_off.array + p->sq_entries * sizeof(uint32);
+	ur->cq.size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP)
+		ur->sq.size = ur->cq.size = MAX(ur->sq.size, ur->cq.size);
+
+	base = vmm_mmap(NULL, ur->sq.size, prot, flags, ur->fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == base)
+		return FALSE;
+
+	ur->sq.base = base;
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq.base = base;
+	} else {
+		base = vmm_mmap(NULL, ur->cq.size, prot, flags,
+			ur->fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == base)
+			return FALSE;
+		ur->cq.base = base;
+	}
+
+	ur->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	base = vmm_mmap(NULL, ur->sqes_size, prot, flags, ur->fd, IORING_OFF_SQES);
+	if (MAP_FAILED == base)
+		return FALSE;
+
+	ur->sqes = base;
+
+	ur->sq.head = ptr_add_offset(ur->sq.base, p->sq_off.head);
+	ur->sq.tail = ptr_add_offset(ur->sq.base, p->sq_off.tail);
+	ur->sq.mask = *(uint32 *) ptr_add_offset(ur->sq.base, p->sq_off.ring_mask);
+	ur->sq.entries = p->sq_entries;
+	ur->sq_array = ptr_add_offset(ur->sq.base, p->sq_off.array);
+
+	ur->cq.head = ptr_add_offset(ur->cq.base, p->cq_off.head);
+	ur->cq.tail = ptr_add_offset(ur->cq.base, p->cq_off.tail);
+	ur->cq.mask = *(uint32 *) ptr_add_offset(ur->cq.base, p->cq_off.ring_mask);
+	ur->cq.entries = p->cq_entries;
+	ur->cqes = ptr_add_offset(ur->cq.base, p->cq_off.cqes);
+
+	ur->sq_tail = ur->sq_submitted = *ur->sq.tail;
+
+	return TRUE;
+}
+
+/**
+ * Create a new io_uring instance.
+ *
+ * @param entries	amount of submission entries wanted
+ *
+ * @return the new instance, NULL with errno set when io_uring is not usable.
+ */
+iouring_t *
+iouring_make(unsigned entries)
+{
+	static const struct io_uring_params zero_params;
+	struct io_uring_params p;
+	struct iouring *ur;
+	int saved_errno;
+
+	g_assert(entries != 0);
+
+	p = zero_params;
+
+	WALLOC0(ur);
+	ur->magic = IOURING_MAGIC;
+	ur->efd = -1;
+	elist_init(&ur->pending, offsetof(struct iouring_req, lk));
+
+	ur->fd = iouring_setup(entries, &p);
+	if (!is_valid_fd(ur->fd))
+		goto failed;
+
+	fd_set_close_on_exec(ur->fd);
+
+	/*
+	 * Requests are only ever submitted by ourselves and completions must
+	 * not be lost when we are slow at reaping them.
+	 */
+
+	if (!(p.features & IORING_FEAT_NODROP)) {
+		errno = ENOTSUP;
+		goto failed;
+	}
+
+	if (!iouring_probe(ur->fd) || !iouring_map(ur, &p))
+		goto failed;
+
+	ur->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!is_valid_fd(ur->efd))
+		goto failed;
+
+	if (-1 == iouring_register(ur->fd, IORING_REGISTER_EVENTFD, &ur->efd, 1))
+		goto failed;
+
+	return ur;
+
+failed:
+	saved_errno = errno;
+	iouring_free_null(&ur);
+	errno = saved_errno;
+	return NULL;
+}
+
+/**
+ * Queue a cancellation request for a submitted request.
+ *
+ * @return TRUE if queued, FALSE if there is no more room.
+ */
+static bool
+iouring_cancel_req(struct iouring *ur, const struct iouring_req *req)
+{
+	static const struct io_uring_sqe zero_sqe;
+	struct io_uring_sqe *sqe;
+	uint32 idx;
+
+	if (0 == iouring_space(ur))
+		return FALSE;
+
+	idx = ur->sq_tail & ur->sq.mask;
+	sqe = &ur->sqes[idx];
+	*sqe = zero_sqe;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = pointer_to_ulong(req);
+	ur->sq_array[idx] = idx;
+	ur->sq_tail++;
+
+	return TRUE;
+}
+
+/**
+ * Wait for all the requests in flight to complete, after having asked
+ * the kernel to cancel them.
+ */
+static void
+iouring_drain(struct iouring *ur)
+{
+	struct iouring_req *req;
+
+	(void) iouring_discard(ur);
+
+	/*
+	 * Cancellation requests need a submission entry each: when the ring
+	 * is full, the remaining requests are simply waited for.
+	 */
+
+	ELIST_FOREACH_DATA(&ur->pending, req) {
+		if (!iouring_cancel_req(ur, req))
+			break;
+	}
+
+	if (-1 == iouring_submit(ur))
+		(void) iouring_discard(ur);
+
+	while (ur->inflight != 0) {
+		if (-1 == iouring_enter(ur->fd, 0, 1, IORING_ENTER_GETEVENTS)) {
+			if (EINTR == errno)
+				continue;
+			s_carp("%s(): cannot wait for %u pending request%s: %m",
+				G_STRFUNC, ur->inflight, plural(ur->inflight));
+			break;
+		}
+		iouring_reap(ur);
+	}
+
+	/*
+	 * If we could not wait, release the requests nonetheless.
+	 */
+
+	while (NULL != (req = elist_shift(&ur->pending))) {
+		iouring_cb_t cb = req->cb;
+		void *arg = req->arg;
+
+		WFREE(req);
+		(*cb)(arg, -ECANCELED);
+	}
+}
+
+/**
+ * Destroy io_uring instance and nullify its pointer.
+ *
+ * Requests not submitted yet are discarded and those in flight are
+ * cancelled and waited for, so that all the completion callbacks are
+ * invoked before the ring goes away, letting callers release the
+ * resources attached to the requests.  Callbacks cannot queue new
+ * requests at this stage.
+ */
+void
+iouring_free_null(iouring_t **ur_ptr)
+{
+	struct iouring *ur = *ur_ptr;
+
+	if (ur != NULL) {
+		iouring_check(ur);
+
+		ur->closing = TRUE;
+
+		if (ur->sqes != NULL && ur->cqes != NULL)
+			iouring_drain(ur);
+
+		iouring_unmap(ur);
+		fd_close(&ur->efd);
+		fd_close(&ur->fd);
+		ur->magic = 0;
+		WFREE(ur);
+		*ur_ptr = NULL;
+	}
+}
+
+/**
+ * @return the eventfd descriptor signaled when requests complete.
+ */
+int
+iouring_eventfd(const iouring_t *ur)
+{
+	iouring_check(ur);
+
+	return ur->efd;
+}
+
+/**
+ * @return the amount of requests that can still be queued.
+ *
+ * This accounts for requests in flight, so that the completion ring
+ * cannot be overrun.
+ */
+unsigned
+iouring_space(const iouring_t *ur)
+{
+	unsigned used;
+
+	iouring_check(ur);
+
+	used = (ur->sq_tail - ur->sq_submitted) + ur->inflight;
+
+	return used >= ur->sq.entries ? 0 : ur->sq.entries - used;
+}
+
+/**
+ * @return the amount of requests queued and not submitted yet.
+ */
+unsigned
+iouring_queued(const iouring_t *ur)
+{
+	iouring_check(ur);
+
+	return ur->sq_tail - ur->sq_submitted;
+}
+
+/**
+ * Get a new submission entry.
+ *
+ * @return the cleared entry, NULL if there is no more room.
+ */
+static struct io_uring_sqe *
+iouring_sqe(struct iouring *ur, iouring_cb_t cb, void *arg)
+{
+	static const struct io_uring_sqe zero_sqe;
+	struct io_uring_sqe *sqe;
+	uint32 idx;
+
+	if (0 == iouring_space(ur) || ur->closing)
+		return NULL;
+
+	idx = ur->sq_tail & ur->sq.mask;
+	sqe = &ur->sqes[idx];
+	*sqe = zero_sqe;
+	ur->sq_array[idx] = idx;
+	ur->sq_tail++;
+
+	if (cb != NULL) {
+		struct iouring_req *req;
+
+		WALLOC(req);
+		req->cb = cb;
+		req->arg = arg;
+		sqe->user_data = pointer_to_ulong(req);
+		elist_append(&ur->pending, req);
+	}
+
+	return sqe;
+}
+
+/**
+ * Queue a read request.
+ *
+ * @param ur		the io_uring instance
+ * @param fd		the file descriptor to read from
+ * @param buf		where data is read, must remain valid until completion
+ * @param len		amount of bytes to read
+ * @param offset	file offset where reading starts
+ * @param link		whether next request must only start after this one
+ * @param cb		completion callback (may be NULL)
+ * @param arg		additional callback argument
+ *
+ * @return TRUE if request was queued, FALSE if there is no more room.
+ */
+bool
+iouring_read(iouring_t *ur, int fd, void *buf, size_t len,
+	filesize_t offset, bool link, iouring_cb_t cb, void *arg)
+{
+	struct io_uring_sqe *sqe;
+
+	iouring_check(ur);
+	g_assert(is_valid_fd(fd));
+	g_assert(buf != NULL);
+	g_assert(len <= MAX_INT_VAL(uint32));
+
+	sqe = iouring_sqe(ur, cb, arg);
+	if (NULL == sqe)
+		return FALSE;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = pointer_to_ulong(buf);
+	sqe->len = len;
+	if (link)
+		sqe->flags |= IOSQE_IO_LINK;
+
+	return TRUE;
+}
+
+/**
+ * Queue a send request on a socket.
+ *
+ * @param ur		the io_uring instance
+ * @param fd		the socket to write to
+ * @param buf		data to send, must remain valid until completion
+ * @param len		amount of bytes to send
+ * @param cb		completion callback (may be NULL)
+ * @param arg		additional callback argument
+ *
+ * @return TRUE if request was queued, FALSE if there is no more room.
+ */
+bool
+iouring_send(iouring_t *ur, int fd, const void *buf, size_t len,
+	iouring_cb_t cb, void *arg)
+{
+	struct io_uring_sqe *sqe;
+
+	iouring_check(ur);
+	g_assert(is_valid_fd(fd));
+	g_assert(buf != NULL);
+	g_assert(len <= MAX_INT_VAL(uint32));
+
+	sqe = iouring_sqe(ur, cb, arg);
+	if (NULL == sqe)
+		return FALSE;
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = pointer_to_ulong(buf);
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+
+	return TRUE;
+}
+
+/**
+ * Hand all the queued requests to the kernel, in one system call.
+ *
+ * @return the amount of requests submitted, -1 on error with errno set.
+ */
+int
+iouring_submit(iouring_t *ur)
+{
+	unsigned n;
+	int r;
+
+	iouring_check(ur);
+
+	n = ur->sq_tail - ur->sq_submitted;
+	if (0 == n)
+		return 0;
+
+	/*
+	 * Make sure the entries are visible before the new tail.
+	 */
+
+	atomic_mb();
+	*ur->sq.tail = ur->sq_tail;
+	atomic_mb();
+
+	r = iouring_enter(ur->fd, n, 0, 0);
+	if (r > 0) {
+		ur->sq_submitted += r;
+		ur->inflight += r;
+	}
+
+	return r;
+}
+
+/**
+ * Discard the requests queued and not submitted yet, invoking their
+ * completion callbacks with -ECANCELED, in queuing order.
+ *
+ * @return the amount of requests discarded.
+ */
+size_t
+iouring_discard(iouring_t *ur)
+{
+	struct iouring_req **reqs;
+	size_t i, n;
+
+	iouring_check(ur);
+
+	n = ur->sq_tail - ur->sq_submitted;
+	if (0 == n)
+		return 0;
+
+	/*
+	 * Rewind the submission tail first, including the one we may have
+	 * already exposed to the kernel on a failed submission, since the
+	 * callbacks can queue new requests.
+	 */
+
+	WALLOC_ARRAY(reqs, n);
+
+	for (i = 0; i < n; i++) {
+		uint32 idx = (ur->sq_submitted + i) & ur->sq.mask;
+		reqs[i] = ulong_to_pointer(ur->sqes[idx].user_data);
+	}
+
+	ur->sq_tail = ur->sq_submitted;
+	atomic_mb();
+	*ur->sq.tail = ur->sq_tail;
+	atomic_mb();
+
+	for (i = 0; i < n; i++) {
+		struct iouring_req *req = reqs[i];
+
+		if (req != NULL) {
+			iouring_cb_t cb = req->cb;
+			void *arg = req->arg;
+
+			elist_remove(&ur->pending, req);
+			WFREE(req);
+			(*cb)(arg, -ECANCELED);
+		}
+	}
+
+	WFREE_ARRAY(reqs, n);
+
+	return n;
+}
+
+/**
+ * Process completed requests, invoking their callbacks.
+ *
+ * @return the amount of requests completed.
+ */
+size_t
+iouring_reap(iouring_t *ur)
+{
+	uint32 head, tail;
+	size_t n = 0;
+	uint64 count;
+
+	iouring_check(ur);
+
+	/* Acknowledge the eventfd signal, we process everything below */
+	(void) read(ur->efd, &count, sizeof count);
+
+	head = *ur->cq.head;
+
+	for (;;) {
+		atomic_mb();
+		tail = *ur->cq.tail;
+
+		if (head == tail)
+			break;
+
+		while (head != tail) {
+			const struct io_uring_cqe *cqe = &ur->cqes[head & ur->cq.mask];
+			struct iouring_req *req = ulong_to_pointer(cqe->user_data);
+			int res = cqe->res;
+
+			head++;
+			n++;
+
+			/*
+			 * Release the entry before invoking the callback, which could
+			 * queue and submit new requests.
+			 */
+
+			atomic_mb();
+			*ur->cq.head = head;
+
+			g_assert(ur->inflight != 0);
+			ur->inflight--;
+
+			if (req != NULL) {
+				iouring_cb_t cb = req->cb;
+				void *arg = req->arg;
+
+				if (req->cancelled)
+					res = -ECANCELED;
+
+				elist_remove(&ur->pending, req);
+				WFREE(req);
+				(*cb)(arg, res);
+			}
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Cancel all the pending requests bearing the specified callback argument.
+ *
+ * Requests not submitted yet are turned into no-ops and those in flight
+ * are asked to abort.  Their callbacks will still be invoked, with
+ * -ECANCELED, and any resource the kernel may still be using for them
+ * must be kept around until then.
+ *
+ * Cancellations are submitted immediately: should that fail, all the
+ * requests not submitted yet are discarded.
+ *
+ * @return the amount of requests being cancelled.
+ */
+size_t
+iouring_cancel(iouring_t *ur, const void *arg)
+{
+	struct iouring_req *req;
+	size_t n = 0;
+	uint32 i;
+
+	iouring_check(ur);
+
+	/*
+	 * Requests not submitted yet are simply neutralized, keeping their
+	 * user data and link flag so that they complete in order.
+	 */
+
+	for (i = ur->sq_submitted; i != ur->sq_tail; i++) {
+		struct io_uring_sqe *sqe = &ur->sqes[i & ur->sq.mask];
+
+		req = ulong_to_pointer(sqe->user_data);
+
+		if (req != NULL && arg == req->arg && !req->cancelled) {
+			sqe->opcode = IORING_OP_NOP;
+			sqe->flags &= IOSQE_IO_LINK;
+			sqe->fd = -1;
+			sqe->off = sqe->addr = 0;
+			sqe->len = 0;
+			sqe->msg_flags = 0;
+			req->cancelled = TRUE;
+			n++;
+		}
+	}
+
+	/*
+	 * Requests in flight are cancelled through their user data, which is
+	 * why the cancellation must be submitted now: once they complete and
+	 * are reaped, their address can be reused by a new request.
+	 */
+
+	ELIST_FOREACH_DATA(&ur->pending, req) {
+		if (arg == req->arg && !req->cancelled) {
+			if (!iouring_cancel_req(ur, req)) {
+				s_carp("%s(): ring full, cannot cancel request", G_STRFUNC);
+				break;
+			}
+			req->cancelled = TRUE;
+			n++;
+		}
+	}
+
+	if (n != 0 && -1 == iouring_submit(ur)) {
+		s_carp("%s(): cannot submit cancellation: %m", G_STRFUNC);
+		(void) iouring_discard(ur);
+	}
+
+	return n;
+}
+
+#else	/* !HAS_IO_URING */
+
+iouring_t *
+iouring_make(unsigned entries)
+{
+	(void) entries;
+	errno = ENOTSUP;
+	return NULL;
+}
+
+void
+iouring_free_null(iouring_t **ur_ptr)
+{
+	g_assert(NULL == *ur_ptr);
+}
+
+int
+iouring_eventfd(const iouring_t *ur)
+{
+	(void) ur;
+	g_assert_not_reached();
+	return -1;
+}
+
+unsigned
+iouring_space(const iouring_t *ur)
+{
+	(void) ur;
+	return 0;
+}
+
+unsigned
+iouring_queued(const iouring_t *ur)
+{
+	(void) ur;
+	return 0;
+}
+
+bool
+iouring_read(iouring_t *ur, int fd, void *buf, size_t len,
+	filesize_t offset, bool link, iouring_cb_t cb, void *arg)
+{
+	(void) ur;
+	(void) fd;
+	(void) buf;
+	(void) len;
+	(void) offset;
+	(void) link;
+	(void) cb;
+	(void) arg;
+	return FALSE;
+}
+
+bool
+iouring_send(iouring_t *ur, int fd, const void *buf, size_t len,
+	iouring_cb_t cb, void *arg)
+{
+	(void) ur;
+	(void) fd;
+	(void) buf;
+	(void) len;
+	(void) cb;
+	(void) arg;
+	return FALSE;
+}
+
+size_t
+iouring_discard(iouring_t *ur)
+{
+	(void) ur;
+	return 0;
+}
+
+int
+iouring_submit(iouring_t *ur)
+{
+	(void) ur;
+	errno = ENOTSUP;
+	return -1;
+}
+
+size_t
+iouring_reap(iouring_t *ur)
+{
+	(void) ur;
+	return 0;
+}
+
+size_t
+iouring_cancel(iouring_t *ur, const void *arg)
+{
+	(void) ur;
+	(void) arg;
+	return 0;
+}
+#endif	/* HAS_IO_URING */
+
+/* vi: set ts=4 sw=4 cindent: */
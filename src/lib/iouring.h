@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Batched asynchronous I/O through the Linux io_uring interface.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _iouring_h_
+#define _iouring_h_
+
+typedef struct iouring iouring_t;
+
+/**
+ * Completion callback.
+ *
+ * @param arg		the user-supplied argument
+ * @param result	what the system call returned, or -errno on failure
+ */
+typedef void (*iouring_cb_t)(void *arg, int result);
+
+/*
+ * Public interface.
+ */
+
+iouring_t *iouring_make(unsigned entries);
+void iouring_free_null(iouring_t **ur_ptr);
+
+int iouring_eventfd(const iouring_t *ur);
+unsigned iouring_space(const iouring_t *ur);
+unsigned iouring_queued(const iouring_t *ur);
+
+bool iouring_read(iouring_t *ur, int fd, void *buf, size_t len,
+	filesize_t offset, bool link, iouring_cb_t cb, void *arg);
+bool iouring_send(iouring_t *ur, int fd, const void *buf, size_t len,
+	iouring_cb_t cb, void *arg);
+
+int iouring_submit(iouring_t *ur);
+size_t iouring_discard(iouring_t *ur);
+size_t iouring_reap(iouring_t *ur);
+size_t iouring_cancel(iouring_t *ur, const void *arg);
+
+#endif /* _iouring_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
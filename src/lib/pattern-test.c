@@ -0,0 +1,438 @@
+/*
+ * pattern-test -- multi-pattern matching tests and benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/halloc.h"
+#include "lib/misc.h"
+#include "lib/pattern.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_FILES		20000	/* Default amount of file names */
+#define TEST_QUERIES	200		/* Default amount of queries */
+#define TEST_WORDS		4		/* Max amount of words per query */
+
+/*
+ * Vocabulary used to build file names that look like what is found
+ * in a typical library, once canonized: lowercase words separated by
+ * single spaces, the punctuation being turned into spaces.
+ */
+static const char *vocabulary[] = {
+	"the", "a", "of", "and", "in", "love", "night", "day", "live", "remix",
+	"feat", "ft", "vs", "original", "mix", "edit", "radio", "version",
+	"album", "single", "cd1", "cd2", "disc", "track", "01", "02", "03",
+	"04", "05", "06", "07", "08", "09", "10", "11", "12", "1999", "2004",
+	"2016", "mp3", "ogg", "flac", "avi", "mkv", "mp4", "pdf", "epub",
+	"320kbps", "128kbps", "vbr", "x264", "xvid", "h264", "aac", "ac3",
+	"720p", "1080p", "dvdrip", "bdrip", "hdtv", "webrip", "s01e01",
+	"s01e02", "s02e10", "english", "french", "german", "subs", "sub",
+	"complete", "collection", "best", "greatest", "hits", "unplugged",
+	"acoustic", "symphony", "concerto", "in", "major", "minor", "no",
+	"op", "bach", "mozart", "beethoven", "chopin", "beatles", "queen",
+	"madonna", "metallica", "nirvana", "pink", "floyd", "wall", "dark",
+	"side", "moon", "abbey", "road", "let", "it", "be", "yesterday",
+	"bohemian", "rhapsody", "smells", "like", "teen", "spirit", "linux",
+	"debian", "ubuntu", "iso", "amd64", "i386", "install", "guide",
+	"manual", "handbook", "tutorial", "programming", "python", "perl",
+	"gnutella", "network", "protocol", "rfc", "draft", "specification",
+};
+
+static const char *extensions[] = {
+	"mp3", "ogg", "flac", "avi", "mkv", "mp4", "pdf", "epub", "iso", "zip",
+};
+
+static bool silent_mode, verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htSV] [-f files] [-q queries] [-R seed]\n"
+		"  -f : amount of file names in the corpus (default %d)\n"
+		"  -h : prints this help message\n"
+		"  -q : amount of queries to run (default %d)\n"
+		"  -t : time single-pattern versus multi-pattern matching\n"
+		"  -R : seed for repeatable random data\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		"  -V : verbose mode -- print each query and its matches\n"
+		, getprogname(), TEST_FILES, TEST_QUERIES);
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *query, const char *text, const char *mode)
+{
+	printf("query \"%s\" on \"%s\" (%s) - FAILED\n", query, text, mode);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+struct query {
+	char *string;					/* The query, for messages */
+	const char *word[TEST_WORDS];	/* Distinct words */
+	size_t len[TEST_WORDS];			/* Their length */
+	size_t amount[TEST_WORDS];		/* Times they must appear */
+	size_t count;					/* Amount of distinct words */
+};
+
+static const char *
+random_word(void)
+{
+	return vocabulary[rand31_value(N_ITEMS(vocabulary) - 1)];
+}
+
+/*
+ * Build a file name made of 3 to 12 words, plus an extension.
+ */
+static char *
+random_filename(void)
+{
+	str_t *s = str_new(80);
+	int i, n = 3 + rand31_value(9);
+
+	for (i = 0; i < n; i++) {
+		str_cat(s, random_word());
+		str_putc(s, ' ');
+	}
+	str_cat(s, extensions[rand31_value(N_ITEMS(extensions) - 1)]);
+
+	return str_s2c_null(&s);
+}
+
+static void
+query_add_word(struct query *q, const char *word, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < q->count; i++) {
+		if (q->len[i] == len && 0 == memcmp(q->word[i], word, len)) {
+			q->amount[i]++;
+			return;
+		}
+	}
+
+	if (q->count < TEST_WORDS) {
+		q->word[q->count] = word;
+		q->len[q->count] = len;
+		q->amount[q->count] = 1;
+		q->count++;
+	}
+}
+
+/*
+ * Build a query of 1 to TEST_WORDS words, mostly taken from the vocabulary,
+ * sometimes truncated (matching at the start of words), sometimes repeated,
+ * sometimes with words not present in any file name.
+ */
+static void
+random_query(struct query *q)
+{
+	str_t *s = str_new(40);
+	int i, n = 1 + rand31_value(TEST_WORDS - 1);
+
+	ZERO(q);
+
+	for (i = 0; i < n; i++) {
+		const char *w;
+		size_t len;
+
+		switch (rand31_value(9)) {
+		case 0:
+			w = "zorglub";			/* Not in the vocabulary */
+			len = strlen(w);
+			break;
+		case 1:
+			w = (0 == q->count) ? random_word() : q->word[0];
+			len = (0 == q->count) ? strlen(w) : q->len[0];
+			break;
+		case 2:
+		case 3:
+			w = random_word();
+			len = strlen(w);
+			len = 1 + rand31_value(len - 1);	/* Prefix only */
+			break;
+		default:
+			w = random_word();
+			len = strlen(w);
+			break;
+		}
+
+		query_add_word(q, w, len);
+
+		if (i != 0)
+			str_putc(s, ' ');
+		str_cat_len(s, w, len);
+	}
+
+	q->string = str_s2c_null(&s);
+}
+
+/*
+ * Reference matching, as done before with one pattern per word.
+ */
+static bool
+single_match(cpattern_t **pw, const struct query *q,
+	const char *text, size_t tlen, qsearch_mode_t mode)
+{
+	size_t i;
+
+	for (i = 0; i < q->count; i++) {
+		size_t j, offset = 0;
+
+		for (j = 0; j < q->amount[i]; j++) {
+			const char *pos;
+
+			pos = pattern_qsearch(pw[i], text, tlen, offset, mode);
+			if (pos)
+				offset = (pos - text) + pattern_len(pw[i]);
+			else
+				break;
+		}
+		if (j != q->amount[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static const char *
+mode_string(qsearch_mode_t mode)
+{
+	switch (mode) {
+	case qs_any:	return "any";
+	case qs_begin:	return "begin";
+	case qs_whole:	return "whole";
+	}
+	return "?";
+}
+
+/*
+ * Check that the multi-pattern matcher gives the same results as the
+ * single pattern matcher.
+ */
+static void
+test_query(const struct query *q, char **files, size_t nfiles,
+	qsearch_mode_t mode)
+{
+	cpattern_t *pw[TEST_WORDS];
+	mpattern_t *mp;
+	size_t i, matched = 0;
+
+	mp = mpattern_make(q->count);
+
+	for (i = 0; i < q->count; i++) {
+		pw[i] = pattern_compile_fast(q->word[i], q->len[i]);
+		mpattern_add(mp, q->word[i], q->len[i], q->amount[i]);
+	}
+
+	mpattern_compile(mp);
+
+	for (i = 0; i < nfiles; i++) {
+		size_t len = strlen(files[i]);
+		bool single = single_match(pw, q, files[i], len, mode);
+		bool multi = mpattern_qmatch(mp, files[i], len, mode);
+
+		if (single != multi)
+			test_abort(q->string, files[i], mode_string(mode));
+
+		if (multi)
+			matched++;
+	}
+
+	if (verbose_mode) {
+		printf("query \"%s\" (%s) - %zu match%s - OK\n",
+			q->string, mode_string(mode), matched, plural_es(matched));
+	}
+
+	for (i = 0; i < q->count; i++) {
+		pattern_free(pw[i]);
+	}
+	mpattern_free(mp);
+}
+
+static void
+timeit(const struct query *queries, size_t nqueries,
+	char **files, size_t nfiles)
+{
+	tm_t start, end;
+	double single, multi;
+	size_t i, j, sm = 0, mm = 0;
+	size_t *len;
+
+	XMALLOC_ARRAY(len, nfiles);
+	for (j = 0; j < nfiles; j++) {
+		len[j] = strlen(files[j]);
+	}
+
+	tm_now_exact(&start);
+	for (i = 0; i < nqueries; i++) {
+		const struct query *q = &queries[i];
+		cpattern_t *pw[TEST_WORDS];
+		size_t k;
+
+		for (k = 0; k < q->count; k++) {
+			pw[k] = pattern_compile_fast(q->word[k], q->len[k]);
+		}
+		for (j = 0; j < nfiles; j++) {
+			if (single_match(pw, q, files[j], len[j], qs_begin))
+				sm++;
+		}
+		for (k = 0; k < q->count; k++) {
+			pattern_free(pw[k]);
+		}
+	}
+	tm_now_exact(&end);
+	single = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	for (i = 0; i < nqueries; i++) {
+		const struct query *q = &queries[i];
+		mpattern_t *mp = mpattern_make(q->count);
+		size_t k;
+
+		for (k = 0; k < q->count; k++) {
+			mpattern_add(mp, q->word[k], q->len[k], q->amount[k]);
+		}
+		mpattern_compile(mp);
+		for (j = 0; j < nfiles; j++) {
+			if (mpattern_qmatch(mp, files[j], len[j], qs_begin))
+				mm++;
+		}
+		mpattern_free(mp);
+	}
+	tm_now_exact(&end);
+	multi = tm_elapsed_f(&end, &start);
+
+	xfree(len);
+
+	g_assert(sm == mm);
+
+	printf("%zu queries on %zu files, %zu match%s:\n",
+		nqueries, nfiles, mm, plural_es(mm));
+	printf("single-pattern: %.3gs (%.0f names/s)\n",
+		single, nqueries * nfiles / single);
+	printf(" multi-pattern: %.3gs (%.0f names/s)\n",
+		multi, nqueries * nfiles / multi);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t nfiles = TEST_FILES;
+	size_t nqueries = TEST_QUERIES;
+	unsigned rseed = 0;
+	const char options[] = "f:hq:tR:SV";
+	struct query *queries;
+	char **files;
+	size_t i;
+	int c;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'f':			/* amount of file names */
+			nfiles = atol(optarg);
+			break;
+		case 'q':			/* amount of queries */
+			nqueries = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || 0 == nfiles || 0 == nqueries)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	XMALLOC_ARRAY(files, nfiles);
+	for (i = 0; i < nfiles; i++) {
+		files[i] = random_filename();
+	}
+
+	XMALLOC_ARRAY(queries, nqueries);
+	for (i = 0; i < nqueries; i++) {
+		random_query(&queries[i]);
+	}
+
+	for (i = 0; i < nqueries; i++) {
+		test_query(&queries[i], files, nfiles, qs_any);
+		test_query(&queries[i], files, nfiles, qs_begin);
+		test_query(&queries[i], files, nfiles, qs_whole);
+	}
+
+	if (!silent_mode)
+		printf("multi-pattern matching - OK\n");
+
+	if (tflag)
+		timeit(queries, nqueries, files, nfiles);
+
+	for (i = 0; i < nqueries; i++) {
+		hfree(queries[i].string);
+	}
+	for (i = 0; i < nfiles; i++) {
+		hfree(files[i]);
+	}
+	xfree(queries);
+	xfree(files);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -33,9 +33,19 @@
 
 #include "common.h"
 
+/*
+ * SSE2 is part of the x86_64 baseline, we can use it unconditionally there.
+ */
+#if defined(__x86_64__) && defined(__SSE2__)
+#define PATTERN_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "pattern.h"
 #include "ascii.h"
 #include "misc.h"
+#include "pow2.h"
+#include "unsigned.h"
 #include "walloc.h"
 #include "xmalloc.h"
 
@@ -276,4 +286,482 @@ pattern_qsearch(
 	return NULL;		/* Not found */
 }
 
+/*
+ * Multi-pattern matching.
+ *
+ * When all the words of a query must be found in a text, running one
+ * pattern_qsearch() per word and per required occurrence means scanning
+ * the text over and over.  Instead we build an Aho-Corasick automaton
+ * for all the words, which finds all their occurrences in a single pass.
+ *
+ * The automaton is turned into a full DFA over a reduced alphabet: bytes
+ * that do not appear in any pattern all map to the same class, which always
+ * leads back to the root state.  Given the typical size of query words,
+ * the transition table stays small enough to be cache-friendly.
+ *
+ * When matching at the beginning of words, occurrences can only start at
+ * the beginning of the text or after a space, so we do not need to run the
+ * automaton over the whole text: we merely walk down the trie from each
+ * word start.  Moreover, when patterns start with a handful of distinct
+ * bytes, we locate the word starts bearing one of these bytes 16 at a time
+ * using SSE2, in the spirit of the "Teddy" matcher: this is what makes the
+ * multi-pattern search faster than running pattern_qsearch() on each word.
+ */
+
+#define MPATTERN_FIRST_MAX	8	/**< Max first bytes for prefiltering */
+
+enum mpattern_magic { MPATTERN_MAGIC = 0x561a1e0b };
+
+struct mpattern {				/**< Compiled multi-pattern */
+	enum mpattern_magic magic;	/**< Magic number */
+	const char **pattern;		/**< The patterns (not copied) */
+	size_t *len;				/**< Pattern lengths */
+	size_t *min;				/**< Minimum amount of occurrences wanted */
+	size_t *count;				/**< Scratch: occurrences seen */
+	size_t *last;				/**< Scratch: end of last occurrence */
+	uint *same;					/**< Next pattern identical to this one + 1 */
+	uint *delta;				/**< Transitions: delta[state * nclass + c] */
+	uint *term;					/**< Pattern ending at state + 1, or 0 */
+	uint *dict;					/**< Next state with an output, 0 if none */
+	uint *depth;				/**< State depth in the trie */
+	size_t npatterns;			/**< Amount of patterns added */
+	size_t capacity;			/**< Amount of patterns we can hold */
+	size_t nstates;				/**< Amount of automaton states */
+	size_t nclass;				/**< Amount of byte classes */
+	size_t nfirst;				/**< Amount of distinct first bytes */
+	uchar first[MPATTERN_FIRST_MAX];	/**< Distinct first bytes */
+	uint16 byteclass[ALPHA_SIZE];	/**< Byte class, 0 if not in any pattern */
+	bool starts[ALPHA_SIZE];	/**< Whether byte starts a pattern */
+	bool compiled;				/**< Was automaton built? */
+};
+
+static inline void
+mpattern_check(const mpattern_t * const mp)
+{
+	g_assert(mp != NULL);
+	g_assert(MPATTERN_MAGIC == mp->magic);
+}
+
+/**
+ * Create a new multi-pattern, able to hold the specified amount of patterns.
+ *
+ * Patterns are then added with mpattern_add() and the automaton is built
+ * by mpattern_compile().
+ *
+ * @param n		the amount of patterns we are going to add
+ *
+ * @return a new multi-pattern, to be freed with mpattern_free().
+ */
+mpattern_t *
+mpattern_make(size_t n)
+{
+	mpattern_t *mp;
+
+	g_assert(size_is_positive(n));
+
+	WALLOC0(mp);
+	mp->magic = MPATTERN_MAGIC;
+	mp->capacity = n;
+
+	XMALLOC_ARRAY(mp->pattern, n);
+	XMALLOC_ARRAY(mp->len, n);
+	XMALLOC_ARRAY(mp->min, n);
+	XMALLOC_ARRAY(mp->count, n);
+	XMALLOC_ARRAY(mp->last, n);
+	XMALLOC0_ARRAY(mp->same, n);
+
+	return mp;
+}
+
+/**
+ * Add a pattern to the multi-pattern.
+ *
+ * As with pattern_compile_fast(), the pattern string is NOT duplicated,
+ * hence it must remain valid for the whole lifetime of the multi-pattern.
+ *
+ * @param mp		the multi-pattern
+ * @param pattern	the pattern string
+ * @param plen		the pattern length (must be non-zero)
+ * @param min		minimum amount of non-overlapping occurrences required
+ *
+ * @return the index of the pattern.
+ */
+size_t
+mpattern_add(mpattern_t *mp, const char *pattern, size_t plen, size_t min)
+{
+	size_t i;
+
+	mpattern_check(mp);
+	g_assert(!mp->compiled);
+	g_assert(mp->npatterns < mp->capacity);
+	g_assert(size_is_positive(plen));
+
+	i = mp->npatterns++;
+	mp->pattern[i] = pattern;
+	mp->len[i] = plen;
+	mp->min[i] = min;
+
+	return i;
+}
+
+/**
+ * Build the Aho-Corasick automaton for all the patterns added so far.
+ */
+void
+mpattern_compile(mpattern_t *mp)
+{
+	size_t i, maxstates, nc, head, tail;
+	uint *fail, *queue, *delta;
+
+	mpattern_check(mp);
+	g_assert(!mp->compiled);
+
+	/*
+	 * Compute byte classes and the maximum amount of states.
+	 */
+
+	ZERO(&mp->byteclass);
+	ZERO(&mp->starts);
+	mp->nfirst = 0;
+	nc = 1;				/* Class 0 is for bytes not in any pattern */
+	maxstates = 1;		/* Root state */
+
+	for (i = 0; i < mp->npatterns; i++) {
+		const uchar *p = (const uchar *) mp->pattern[i];
+		size_t j;
+
+		if (!mp->starts[p[0]]) {
+			mp->starts[p[0]] = TRUE;
+			if (mp->nfirst < N_ITEMS(mp->first))
+				mp->first[mp->nfirst] = p[0];
+			mp->nfirst++;		/* Prefiltering disabled if too many */
+		}
+
+		for (j = 0; j < mp->len[i]; j++) {
+			if (0 == mp->byteclass[p[j]])
+				mp->byteclass[p[j]] = nc++;
+		}
+		maxstates += mp->len[i];
+	}
+
+	g_assert(maxstates <= MAX_INT_VAL(uint));
+
+	mp->nclass = nc;
+	XMALLOC0_ARRAY(delta, maxstates * nc);
+	XMALLOC0_ARRAY(mp->term, maxstates);
+	XMALLOC0_ARRAY(mp->dict, maxstates);
+	XMALLOC0_ARRAY(mp->depth, maxstates);
+	XMALLOC0_ARRAY(fail, maxstates);
+	XMALLOC_ARRAY(queue, maxstates);
+
+	/*
+	 * Build the trie.  Since the root is state 0, a 0 transition in any
+	 * other state means there is no edge yet.
+	 */
+
+	mp->nstates = 1;
+
+	for (i = 0; i < mp->npatterns; i++) {
+		const uchar *p = (const uchar *) mp->pattern[i];
+		size_t j;
+		uint s = 0;
+
+		for (j = 0; j < mp->len[i]; j++) {
+			uint *t = &delta[s * nc + mp->byteclass[p[j]]];
+
+			if (0 == *t) {
+				*t = mp->nstates++;
+				mp->depth[*t] = j + 1;
+			}
+			s = *t;
+		}
+
+		if (mp->term[s] != 0) {
+			size_t k = mp->term[s] - 1;		/* Same pattern seen before */
+			while (mp->same[k] != 0)
+				k = mp->same[k] - 1;
+			mp->same[k] = i + 1;
+		} else {
+			mp->term[s] = i + 1;
+		}
+	}
+
+	/*
+	 * Compute failure links breadth-first, completing the transitions
+	 * into a DFA as we go: a missing edge is the edge of the failure state.
+	 */
+
+	head = tail = 0;
+
+	for (i = 1; i < nc; i++) {
+		uint t = delta[i];
+		if (t != 0)
+			queue[tail++] = t;		/* Failure of depth-1 states is the root */
+	}
+
+	while (head < tail) {
+		uint s = queue[head++];
+
+		for (i = 1; i < nc; i++) {
+			uint *t = &delta[s * nc + i];
+			uint f = delta[fail[s] * nc + i];
+
+			if (*t != 0) {
+				fail[*t] = f;
+				mp->dict[*t] = 0 != mp->term[f] ? f : mp->dict[f];
+				queue[tail++] = *t;
+			} else {
+				*t = f;
+			}
+		}
+	}
+
+	mp->delta = delta;
+	mp->compiled = TRUE;
+
+	xfree(fail);
+	xfree(queue);
+}
+
+/**
+ * Dispose of compiled multi-pattern.
+ */
+void
+mpattern_free(mpattern_t *mp)
+{
+	mpattern_check(mp);
+
+	xfree(mp->pattern);
+	xfree(mp->len);
+	xfree(mp->min);
+	xfree(mp->count);
+	xfree(mp->last);
+	xfree(mp->same);
+	XFREE_NULL(mp->delta);
+	XFREE_NULL(mp->term);
+	XFREE_NULL(mp->dict);
+	XFREE_NULL(mp->depth);
+	mp->magic = 0;
+	WFREE(mp);
+}
+
+/**
+ * Dispose of compiled multi-pattern and nullify its pointer.
+ */
+void
+mpattern_free_null(mpattern_t **mp_ptr)
+{
+	mpattern_t *mp = *mp_ptr;
+
+	if (mp != NULL) {
+		mpattern_free(mp);
+		*mp_ptr = NULL;
+	}
+}
+
+/**
+ * Record occurrence of the patterns ending at state ``s'', which ends at
+ * the specified position in the text.
+ *
+ * @return TRUE if all the patterns have now been seen as many times as needed.
+ */
+static inline bool
+mpattern_record(mpattern_t *mp, uint s, const uchar *t, size_t end,
+	size_t tlen, qsearch_mode_t word, size_t *remain)
+{
+	size_t k;
+
+	for (k = mp->term[s]; k != 0; k = mp->same[k - 1]) {
+		size_t p = k - 1;
+		size_t start = end - mp->len[p];
+
+		if (start < mp->last[p])
+			continue;		/* Overlaps previous occurrence */
+
+		if (word != qs_any) {
+			if (start != 0 && !is_ascii_space(t[start - 1]))
+				continue;	/* Not at the beginning of a word */
+
+			if (word == qs_whole && end != tlen && !is_ascii_space(t[end]))
+				continue;	/* Not at the end of a word */
+		}
+
+		mp->last[p] = end;
+
+		if (++mp->count[p] == mp->min[p] && 0 == --(*remain))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Walk down the trie from given word start, following only true trie edges
+ * (the ones leading one level deeper), which means we are still reading a
+ * prefix of some pattern, and record the patterns we recognize.
+ *
+ * Only the patterns ending at the states we traverse are reported, not the
+ * ones reachable through the dictionary links: those start later and will
+ * be seen when we reach their word start.
+ *
+ * @return TRUE if all the patterns have now been seen as many times as needed.
+ */
+static inline bool
+mpattern_walk(mpattern_t *mp, const uchar *t, size_t i,
+	size_t tlen, qsearch_mode_t word, size_t *remain)
+{
+	const uint *delta = mp->delta, *depth = mp->depth;
+	size_t j, nc = mp->nclass;
+	uint s = 0;
+
+	for (j = i; j < tlen; j++) {
+		uint n = delta[s * nc + mp->byteclass[t[j]]];
+
+		if (depth[n] != depth[s] + 1)
+			break;		/* Not a prefix of any pattern */
+
+		s = n;
+
+		if (
+			0 != mp->term[s] &&
+			mpattern_record(mp, s, t, j + 1, tlen, word, remain)
+		)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Look whether all the patterns occur in the text, each of them at least
+ * the minimum amount of times specified when it was added, in a single
+ * pass over the text.
+ *
+ * Occurrences of a given pattern are counted the same way successive
+ * pattern_qsearch() calls would, starting each search after the end of
+ * the previous match: overlapping occurrences are not counted.
+ *
+ * The multi-pattern holds the scratch counters, hence it cannot be used
+ * concurrently by several threads.
+ *
+ * @param mp		the compiled multi-pattern
+ * @param text		the text we're scanning
+ * @param tlen		text length, 0 = compute strlen(text)
+ * @param word		beginning/whole word matching?
+ *
+ * @return TRUE if all the patterns matched as many times as required.
+ */
+bool G_HOT
+mpattern_qmatch(mpattern_t *mp,
+	const char *text, size_t tlen, qsearch_mode_t word)
+{
+	const uchar *t = (const uchar *) text;
+	const uint *delta, *term, *dict;
+	const uint16 *byteclass;
+	size_t i, nc, remain = 0;
+
+	mpattern_check(mp);
+	g_assert(mp->compiled);
+	g_assert(word == qs_any || word == qs_begin || word == qs_whole);
+
+	for (i = 0; i < mp->npatterns; i++) {
+		mp->count[i] = 0;
+		mp->last[i] = 0;
+		if (mp->min[i] != 0)
+			remain++;
+	}
+
+	if (0 == remain)
+		return TRUE;
+
+	if (!tlen)
+		tlen = strlen(text);
+
+	delta = mp->delta;
+	term = mp->term;
+	dict = mp->dict;
+	byteclass = mp->byteclass;
+	nc = mp->nclass;
+
+	if (word == qs_any) {
+		uint s = 0;
+
+		for (i = 0; i < tlen; i++) {
+			uint o;
+
+			s = delta[s * nc + byteclass[t[i]]];
+
+			for (o = 0 != term[s] ? s : dict[s]; o != 0; o = dict[o]) {
+				if (mpattern_record(mp, o, t, i + 1, tlen, word, &remain))
+					return TRUE;
+			}
+		}
+
+		return FALSE;
+	}
+
+	/*
+	 * Anchored matching: look at word starts bearing the first byte of
+	 * some pattern.
+	 */
+
+	i = 0;
+
+#ifdef PATTERN_SSE2
+	if (mp->nfirst <= N_ITEMS(mp->first)) {
+		__m128i fv[MPATTERN_FIRST_MAX];
+		const __m128i blank = _mm_set1_epi8(' ');
+		const __m128i nine = _mm_set1_epi8(9);
+		const __m128i four = _mm_set1_epi8(4);
+		uint carry = 1;		/* Start of text is a word start */
+		size_t k;
+
+		for (k = 0; k < mp->nfirst; k++) {
+			fv[k] = _mm_set1_epi8(mp->first[k]);
+		}
+
+		for (/* empty */; i + 16 <= tlen; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) &t[i]);
+			__m128i c = _mm_sub_epi8(v, nine);
+			__m128i f = _mm_cmpeq_epi8(v, fv[0]);
+			uint spaces, cand;
+
+			/* is_ascii_space(): 32, or within [9, 13] */
+			spaces = _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(v, blank),
+				_mm_cmpeq_epi8(_mm_min_epu8(c, four), c)));
+
+			for (k = 1; k < mp->nfirst; k++) {
+				f = _mm_or_si128(f, _mm_cmpeq_epi8(v, fv[k]));
+			}
+
+			cand = ((spaces << 1) | carry) & _mm_movemask_epi8(f);
+			carry = (spaces >> 15) & 1;
+
+			while (cand != 0) {
+				size_t start = i + ctz(cand);
+
+				cand &= cand - 1;		/* Clear lowest bit set */
+
+				if (mpattern_walk(mp, t, start, tlen, word, &remain))
+					return TRUE;
+			}
+		}
+	}
+#endif	/* PATTERN_SSE2 */
+
+	for (/* empty */; i < tlen; i++) {
+		if (i != 0 && !is_ascii_space(t[i - 1]))
+			continue;		/* Not at the beginning of a word */
+
+		if (
+			mp->starts[t[i]] &&
+			mpattern_walk(mp, t, i, tlen, word, &remain)
+		)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 /* vi: set ts=4 sw=4 cindent: */
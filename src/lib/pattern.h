@@ -37,6 +37,7 @@
 #include "common.h"
 
 typedef struct cpattern cpattern_t;
+typedef struct mpattern mpattern_t;
 
 typedef enum {
 	qs_any = 0,					/**< Match anywhere */
@@ -55,6 +56,15 @@ const char *pattern_qsearch(const cpattern_t *cpat,
 	const char *text, size_t tlen, size_t toffset, qsearch_mode_t word);
 size_t pattern_len(const cpattern_t *p);
 
+mpattern_t *mpattern_make(size_t n);
+size_t mpattern_add(mpattern_t *mp, const char *pattern, size_t plen,
+	size_t min);
+void mpattern_compile(mpattern_t *mp);
+void mpattern_free(mpattern_t *mp);
+void mpattern_free_null(mpattern_t **mp_ptr);
+bool mpattern_qmatch(mpattern_t *mp,
+	const char *text, size_t tlen, qsearch_mode_t word);
+
 #endif /* _pattern_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
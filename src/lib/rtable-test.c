@@ -0,0 +1,607 @@
+/*
+ * rtable-test -- routing table tests and benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/atoms.h"			/* For guid_hash() and guid_eq() */
+#include "lib/endian.h"
+#include "lib/hashing.h"
+#include "lib/hset.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/pslist.h"
+#include "lib/rand31.h"
+#include "lib/rtable.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
+
+#include "if/core/guid.h"
+
+#define TEST_ENTRIES	(1 << 16)	/* Default table size, for tests */
+#define TEST_MESSAGES	2000000		/* Default amount of messages to route */
+#define TEST_ROUTES		64			/* Amount of distinct routes */
+#define TEST_DUPS		4			/* 1 message out of 4 is a duplicate */
+#define TEST_HITS		8			/* 1 message out of 8 revitalizes */
+#define TEST_CYCLE		3600		/* Rotation period, never reached */
+
+static bool silent_mode, verbose_mode;
+static unsigned initial_seed;
+
+static int refs[TEST_ROUTES];		/* References held on each route */
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htSV] [-m messages] [-n entries] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -m : amount of messages to route when timing (default %d)\n"
+		"  -n : amount of entries in the routing table (default %d)\n"
+		"  -t : time flat table versus hashed message list\n"
+		"  -R : seed for repeatable random data\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), TEST_MESSAGES, TEST_ENTRIES);
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what)
+{
+	printf("%s - FAILED\n", what);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static void
+test_ok(const char *what)
+{
+	if (verbose_mode)
+		printf("%s - OK\n", what);
+}
+
+static void *
+route_ptr(uint i)
+{
+	return &refs[i % TEST_ROUTES];
+}
+
+static void
+route_free(void *route)
+{
+	int *r = route;
+
+	g_assert(*r > 0);
+	(*r)--;
+}
+
+static bool
+route_is_odd(void *route, uint8 ttl, void *unused_data)
+{
+	int *r = route;
+
+	(void) unused_data;
+
+	if (ttl & 1) {
+		(*r)--;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static int
+refs_total(void)
+{
+	size_t i;
+	int total = 0;
+
+	for (i = 0; i < N_ITEMS(refs); i++) {
+		total += refs[i];
+	}
+	return total;
+}
+
+/*
+ * Each test entry gets (i % 11) routes, the j-th route being route_ptr(i + j)
+ * with a TTL of j, so that contents can be checked without being recorded.
+ */
+static void
+entry_fill(rtable_entry_t *e, uint i)
+{
+	uint j;
+
+	for (j = 0; j < i % 11; j++) {
+		if (!rtable_entry_add_route(e, route_ptr(i + j), j))
+			test_abort("adding route");
+		refs[(i + j) % TEST_ROUTES]++;
+	}
+}
+
+static void
+entry_verify(const rtable_entry_t *e, uint i)
+{
+	uint j;
+
+	if (rtable_entry_route_count(e) != i % 11)
+		test_abort("route count");
+
+	for (j = 0; j < i % 11; j++) {
+		if (rtable_entry_route(e, j) != route_ptr(i + j))
+			test_abort("route order");
+		if (rtable_entry_route_ttl(e, j) != j)
+			test_abort("route TTL");
+	}
+}
+
+static void
+test_table(const struct guid *keys, size_t nkeys, size_t max)
+{
+	rtable_t *rt;
+	size_t i, held = 0, capacity, count;
+	rtable_entry_t *e;
+
+	rt = rtable_make(max, TEST_CYCLE, route_free);
+
+	/*
+	 * Fill the table with more entries than it can hold: the oldest ones
+	 * must be superseded in FIFO order.
+	 */
+
+	for (i = 0; i < nkeys; i++) {
+		e = rtable_insert(rt, &keys[i], i & 0xff);
+		entry_fill(e, i);
+	}
+
+	capacity = rtable_capacity(rt);
+	count = rtable_count(rt);
+
+	if (capacity < max || count != MIN(nkeys, capacity))
+		test_abort("table capacity");
+
+	for (i = 0; i < nkeys; i++) {
+		e = rtable_lookup(rt, &keys[i], i & 0xff);
+
+		if (i < nkeys - count) {
+			if (e != NULL)
+				test_abort("superseded entry still present");
+			continue;
+		}
+
+		if (NULL == e || rtable_lookup(rt, &keys[i], (i + 1) & 0xff) != NULL)
+			test_abort("lookup");
+
+		entry_verify(e, i);
+		held += i % 11;
+	}
+
+	if (UNSIGNED(refs_total()) != held)
+		test_abort("route references");
+
+	test_ok("FIFO insertion");
+
+	/*
+	 * When the table is full, revitalizing an entry from the middle of
+	 * the table moves it over the oldest one.  Inserting half a table
+	 * worth of entries must then supersede the oldest entries but leave
+	 * the revitalized one alone.
+	 */
+
+	if (count == capacity && rtable_chunks(rt) > 1) {
+		size_t j, oldest = nkeys - count;
+		struct guid g;
+
+		i = oldest + count / 2;
+		e = rtable_lookup(rt, &keys[i], i & 0xff);
+		e = rtable_revitalize(rt, e);
+		entry_verify(e, i);
+
+		if (rtable_lookup(rt, &keys[i], i & 0xff) != e)
+			test_abort("revitalized entry lookup");
+
+		if (rtable_lookup(rt, &keys[oldest], oldest & 0xff) != NULL)
+			test_abort("oldest entry not superseded");
+
+		held -= oldest % 11;
+		if (UNSIGNED(refs_total()) != held)
+			test_abort("route references after revitalization");
+
+		ZERO(&g);
+
+		for (j = 0; j < count / 2; j++) {
+			poke_be32(&g, j);
+			rtable_insert(rt, &g, 0xff);
+		}
+
+		e = rtable_lookup(rt, &keys[i], i & 0xff);
+		if (NULL == e)
+			test_abort("revitalized entry superseded");
+		entry_verify(e, i);
+
+		if (rtable_lookup(rt, &keys[i - 1], (i - 1) & 0xff) != NULL)
+			test_abort("old entry still present");
+
+		test_ok("revitalization");
+	}
+
+	/*
+	 * Route removal, which must preserve order.
+	 */
+
+	for (i = nkeys - 1; i != 0 && i % 11 != 10; i--)
+		/* empty */;
+
+	e = rtable_lookup(rt, &keys[i], i & 0xff);
+	if (NULL == e)
+		test_abort("lookup of entry with spilled routes");
+
+	if (rtable_entry_foreach_remove(e, route_is_odd, NULL) != 5)
+		test_abort("route removal");
+
+	if (rtable_entry_route_count(e) != 5)
+		test_abort("route count after removal");
+
+	{
+		uint j;
+
+		for (j = 0; j < 5; j++) {
+			if (rtable_entry_route(e, j) != route_ptr(i + 2 * j))
+				test_abort("route order after removal");
+		}
+
+		rtable_entry_remove_route(e, 0);
+		refs[i % TEST_ROUTES]--;
+
+		if (
+			rtable_entry_route_count(e) != 4 ||
+			rtable_entry_route_index(e, route_ptr(i + 2)) != 0 ||
+			rtable_entry_route_index(e, route_ptr(i + 8)) != 3
+		)
+			test_abort("route index after removal");
+	}
+
+	test_ok("route removal");
+
+	rtable_clear(rt);
+
+	if (rtable_count(rt) != 0 || refs_total() != 0)
+		test_abort("table clearing");
+
+	for (i = 0; i < nkeys / 2; i++) {
+		e = rtable_insert(rt, &keys[i], i & 0xff);
+		entry_fill(e, i);
+	}
+
+	rtable_free_null(&rt);
+
+	if (rt != NULL || refs_total() != 0)
+		test_abort("table freeing");
+
+	test_ok("table freeing");
+}
+
+/*
+ * Former layout of the routing table in the core: an array of pointers to
+ * separately allocated entries, indexed by a hash set, with routes and TTLs
+ * kept in lists.
+ */
+struct message {
+	struct guid muid;
+	pslist_t *routes;
+	pslist_t *ttls;
+	uint8 function;
+	uint8 ttl;
+};
+
+static uint
+message_hash(const void *key)
+{
+	const struct message *m = key;
+
+	return integer_hash_fast(m->function) ^
+		universal_hash(&m->muid, GUID_RAW_SIZE);
+}
+
+static uint
+message_hash2(const void *key)
+{
+	const struct message *m = key;
+
+	return integer_hash2(m->function) ^ guid_hash(&m->muid);
+}
+
+static int
+message_eq(const void *p, const void *q)
+{
+	const struct message *a = p, *b = q;
+
+	return a->function == b->function && guid_eq(&a->muid, &b->muid);
+}
+
+struct workload {
+	uint32 *key;			/* Index of the key used by each message */
+	uint8 *function;		/* Function of each message */
+	uint8 *route;			/* Route of each message */
+	bool *hit;				/* Whether message revitalizes its entry */
+};
+
+/*
+ * Roughly what an ultrapeer sees: mostly new queries, some duplicates
+ * coming from another route, and query hits revitalizing recent entries.
+ */
+static void
+workload_make(struct workload *w, size_t nmsg)
+{
+	size_t i, next = 0;
+
+	XMALLOC_ARRAY(w->key, nmsg);
+	XMALLOC_ARRAY(w->function, nmsg);
+	XMALLOC_ARRAY(w->route, nmsg);
+	XMALLOC_ARRAY(w->hit, nmsg);
+
+	for (i = 0; i < nmsg; i++) {
+		if (next > 1000 && 0 == rand31_value(TEST_DUPS - 1))
+			w->key[i] = next - 1 - rand31_value(1000);
+		else
+			w->key[i] = next++;
+		w->function[i] = rand31_value(3) ? 0x80 : 0x40;
+		w->route[i] = rand31_value(TEST_ROUTES - 1);
+		w->hit[i] = 0 == rand31_value(TEST_HITS - 1);
+	}
+}
+
+static void
+workload_free(struct workload *w)
+{
+	xfree(w->key);
+	xfree(w->function);
+	xfree(w->route);
+	xfree(w->hit);
+}
+
+static inline void
+workload_guid(struct guid *g, uint32 key)
+{
+	poke_be32(&g->v[0], key);
+	poke_be32(&g->v[4], key * 2654435761U);
+	poke_be32(&g->v[8], ~key);
+	poke_be32(&g->v[12], key ^ 0x5a5a5a5a);
+}
+
+static double
+time_rtable(const struct workload *w, size_t nmsg, size_t max)
+{
+	rtable_t *rt = rtable_make(max, TEST_CYCLE, route_free);
+	tm_t start, end;
+	size_t i;
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < nmsg; i++) {
+		struct guid g;
+		rtable_entry_t *e;
+		void *route = route_ptr(w->route[i]);
+
+		workload_guid(&g, w->key[i]);
+		e = rtable_lookup(rt, &g, w->function[i]);
+
+		if (NULL == e) {
+			e = rtable_insert(rt, &g, w->function[i]);
+			rtable_entry_set_ttl(e, 4);
+		} else if (w->hit[i]) {
+			e = rtable_revitalize(rt, e);
+		}
+
+		if (rtable_entry_route_index(e, route) < 0) {
+			if (rtable_entry_add_route(e, route, 4))
+				refs[w->route[i]]++;
+		}
+	}
+
+	tm_now_exact(&end);
+	rtable_free_null(&rt);
+
+	g_assert(0 == refs_total());
+
+	return tm_elapsed_f(&end, &start);
+}
+
+static void
+message_free(struct message *m)
+{
+	pslist_free_null(&m->routes);
+	pslist_free_null(&m->ttls);
+	WFREE(m);
+}
+
+static double
+time_hashed(const struct workload *w, size_t nmsg, size_t max)
+{
+	hset_t *hs;
+	struct message **slots;
+	tm_t start, end;
+	size_t i, next = 0;
+
+	XMALLOC0_ARRAY(slots, max);
+	hs = hset_create_any(message_hash, message_hash2, message_eq);
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < nmsg; i++) {
+		struct message key, *m;
+		const void *orig;
+		void *route = route_ptr(w->route[i]);
+
+		workload_guid(&key.muid, w->key[i]);
+		key.function = w->function[i];
+
+		if (hset_contains_extended(hs, &key, &orig)) {
+			m = deconstify_pointer(orig);
+			if (w->hit[i]) {
+				size_t j = next++ % max;
+
+				if (slots[j] != NULL && slots[j] != m) {
+					hset_remove(hs, slots[j]);
+					message_free(slots[j]);
+				}
+				slots[j] = m;
+			}
+		} else {
+			size_t j = next++ % max;
+
+			if (slots[j] != NULL) {
+				hset_remove(hs, slots[j]);
+				message_free(slots[j]);
+			}
+			WALLOC0(m);
+			m->muid = key.muid;
+			m->function = key.function;
+			m->ttl = 4;
+			slots[j] = m;
+			hset_insert(hs, m);
+		}
+
+		if (NULL == pslist_find(m->routes, route)) {
+			m->routes = pslist_append(m->routes, route);
+			m->ttls = pslist_append(m->ttls, GUINT_TO_POINTER(4));
+		}
+	}
+
+	tm_now_exact(&end);
+
+	/*
+	 * Revitalized entries leave a stale slot behind: only free each
+	 * message once, through the hash set.
+	 */
+
+	for (i = 0; i < max; i++) {
+		if (slots[i] != NULL && hset_contains(hs, slots[i])) {
+			hset_remove(hs, slots[i]);
+			message_free(slots[i]);
+		}
+	}
+
+	hset_free_null(&hs);
+	xfree(slots);
+
+	return tm_elapsed_f(&end, &start);
+}
+
+static void
+timeit(size_t nmsg, size_t max)
+{
+	struct workload w;
+	double flat, hashed;
+
+	workload_make(&w, nmsg);
+
+	flat = time_rtable(&w, nmsg, max);
+	hashed = time_hashed(&w, nmsg, max);
+
+	printf("%zu messages routed through %zu entries:\n", nmsg, max);
+	printf("  flat table: %.3gs (%.0f msg/s)\n", flat, nmsg / flat);
+	printf("hashed table: %.3gs (%.0f msg/s)\n", hashed, nmsg / hashed);
+	fflush(stdout);
+
+	workload_free(&w);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t nentries = TEST_ENTRIES;
+	size_t nmsg = TEST_MESSAGES;
+	unsigned rseed = 0;
+	const char options[] = "hm:n:tR:SV";
+	struct guid *keys;
+	size_t i, nkeys;
+	int c;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'm':			/* amount of messages */
+			nmsg = atol(optarg);
+			break;
+		case 'n':			/* amount of entries */
+			nentries = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || nentries < 2 || 0 == nmsg)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	nkeys = nentries + nentries / 2;
+	XMALLOC_ARRAY(keys, nkeys);
+	for (i = 0; i < nkeys; i++) {
+		rand31_bytes(&keys[i], sizeof keys[i]);
+	}
+
+	test_table(keys, nkeys, nentries);
+
+	if (!silent_mode)
+		printf("routing table - OK\n");
+
+	if (tflag)
+		timeit(nmsg, nentries);
+
+	xfree(keys);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,964 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Flat routing table, keyed by GUID and message function.
+ *
+ * Entries are stored by value in large chunks which are filled in a FIFO
+ * manner: the oldest entry is superseded when we cycle back over the table.
+ * The aim is to not cycle back to the beginning of the table, loosing all
+ * the routing information, before at least "cycle" seconds have elapsed,
+ * unless we reach the maximum amount of chunks we can allocate.  When the
+ * table rotates faster than necessary, the extra chunks are released.
+ *
+ * Lookups are done through an open-addressing index using linear probing,
+ * each bucket recording the entry hash value to avoid touching the entries
+ * unless there is a likely match.  Removals use backward-shift deletion
+ * so that probing sequences never accumulate tombstones, which would
+ * otherwise happen quickly given the constant replacement of entries.
+ *
+ * Each entry can record a few routes inline, along with a TTL per route.
+ * Only entries having more than RTABLE_ROUTES routes need an extra array,
+ * which is allocated on the side and grows as needed.
+ *
+ * Pointers to entries remain valid until the next insertion, revitalization
+ * or clearing of the table.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "rtable.h"
+#include "atoms.h"			/* For guid_eq() */
+#include "halloc.h"
+#include "hashing.h"
+#include "pow2.h"
+#include "unsigned.h"
+#include "walloc.h"
+
+#include "if/core/guid.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define RTABLE_CHUNK_BITS	14		/**< log2 of # entries stored in a chunk */
+#define RTABLE_MAX_CHUNKS	256		/**< Max # of chunks */
+#define RTABLE_ROUTES		4		/**< Routes recorded inline */
+#define RTABLE_SPILL		4		/**< Minimum size of extra route array */
+#define RTABLE_MAX_ROUTES	MAX_INT_VAL(uint8)
+
+#define RTABLE_CHUNK		(1U << RTABLE_CHUNK_BITS)
+#define CHUNK_INDEX(x)		((x) >> RTABLE_CHUNK_BITS)
+#define ENTRY_INDEX(x)		((x) & (RTABLE_CHUNK - 1))
+
+enum rtable_magic { RTABLE_MAGIC = 0x5a1c0e37 };
+
+/**
+ * A routing table entry, sized to fit a 64-byte cache line on 64-bit
+ * machines.
+ *
+ * The extra route array, when present, holds the routes beyond the first
+ * RTABLE_ROUTES ones, followed by their TTLs.
+ */
+struct rtable_entry {
+	struct guid muid;				/**< Message UID */
+	void *route[RTABLE_ROUTES];		/**< First routes */
+	void **spill;					/**< Extra routes, then extra TTLs */
+	uint8 rttl[RTABLE_ROUTES];		/**< TTL of the first routes */
+	uint8 function;					/**< Type of the message */
+	uint8 ttl;						/**< Max TTL seen for this message */
+	uint8 routes;					/**< Amount of routes recorded */
+	uint8 used;						/**< Whether entry is in use */
+};
+
+/**
+ * An index bucket, referring to an entry.
+ */
+struct rtable_bucket {
+	uint32 hash;					/**< Hashed entry key */
+	uint32 idx;						/**< Entry index + 1, 0 if empty */
+};
+
+/**
+ * The routing table.
+ */
+struct rtable {
+	enum rtable_magic magic;		/**< Magic number */
+	uint debug;						/**< Debugging level */
+	uint max_chunks;				/**< Max amount of chunks */
+	uint nchunks;					/**< Amount of allocated chunks */
+	uint next_idx;					/**< Next entry to use */
+	size_t capacity;				/**< Capacity in terms of entries */
+	size_t count;					/**< Amount of entries held */
+	rtable_entry_t **chunks;		/**< Chunks of entries */
+	struct rtable_bucket *index;	/**< Open-addressing index */
+	size_t index_mask;				/**< Index size - 1 (a power of 2) */
+	rtable_free_t rfree;			/**< Route freeing callback */
+	time_delta_t cycle;				/**< Minimum rotation cycle, in seconds */
+	time_t last_rotation;			/**< Last time we restarted from idx=0 */
+};
+
+static inline void
+rtable_check(const struct rtable * const rt)
+{
+	g_assert(rt != NULL);
+	g_assert(RTABLE_MAGIC == rt->magic);
+}
+
+static inline void
+rtable_entry_check(const struct rtable_entry * const e)
+{
+	g_assert(e != NULL);
+	g_assert(e->used);
+}
+
+/**
+ * Hash entry key.
+ */
+static inline uint32
+rtable_hash(const struct guid *muid, uint8 function)
+{
+	return integer_hash_fast(function) ^ universal_hash(muid, GUID_RAW_SIZE);
+}
+
+/**
+ * @return entry at given index.
+ */
+static inline rtable_entry_t *
+rtable_entry_at(const rtable_t *rt, uint idx)
+{
+	g_assert(CHUNK_INDEX(idx) < rt->nchunks);
+
+	return &rt->chunks[CHUNK_INDEX(idx)][ENTRY_INDEX(idx)];
+}
+
+/**
+ * Size of the extra route array for a given amount of extra routes.
+ */
+static inline size_t
+rtable_spill_capacity(uint n)
+{
+	return 0 == n ? 0 : MAX(RTABLE_SPILL, next_pow2(n));
+}
+
+/**
+ * @return the TTL array of the extra routes.
+ */
+static inline uint8 *
+rtable_spill_ttl(const rtable_entry_t *e)
+{
+	g_assert(e->routes > RTABLE_ROUTES);
+
+	size_t cap = rtable_spill_capacity(e->routes - RTABLE_ROUTES);
+
+	return (uint8 *) &e->spill[cap];
+}
+
+/**
+ * Resize the extra route array when going from ``old'' to ``new'' extra
+ * routes, preserving the routes and TTLs that are still needed.
+ *
+ * The entry route count must not have been updated yet.
+ */
+static void
+rtable_spill_resize(rtable_entry_t *e, uint old, uint new)
+{
+	size_t ocap = rtable_spill_capacity(old);
+	size_t ncap = rtable_spill_capacity(new);
+	void **spill = NULL;
+
+	if (ocap == ncap)
+		return;
+
+	if (ncap != 0) {
+		uint n = MIN(old, new);
+
+		spill = walloc(ncap * (sizeof spill[0] + sizeof(uint8)));
+
+		if (n != 0) {
+			memcpy(spill, e->spill, n * sizeof spill[0]);
+			memcpy(&spill[ncap], &e->spill[ocap], n * sizeof(uint8));
+		}
+	}
+
+	if (ocap != 0)
+		wfree(e->spill, ocap * (sizeof e->spill[0] + sizeof(uint8)));
+
+	e->spill = spill;
+}
+
+/**
+ * Set route and its TTL at given position.
+ */
+static inline void
+rtable_entry_set(rtable_entry_t *e, uint i, void *route, uint8 ttl)
+{
+	if (i < RTABLE_ROUTES) {
+		e->route[i] = route;
+		e->rttl[i] = ttl;
+	} else {
+		e->spill[i - RTABLE_ROUTES] = route;
+		rtable_spill_ttl(e)[i - RTABLE_ROUTES] = ttl;
+	}
+}
+
+/**
+ * Free all the routes of an entry, flagging it as unused.
+ */
+static void
+rtable_entry_free_routes(const rtable_t *rt, rtable_entry_t *e)
+{
+	uint i;
+
+	if (rt->rfree != NULL) {
+		for (i = 0; i < e->routes; i++) {
+			(*rt->rfree)(rtable_entry_route(e, i));
+		}
+	}
+
+	if (e->routes > RTABLE_ROUTES)
+		rtable_spill_resize(e, e->routes - RTABLE_ROUTES, 0);
+
+	ZERO(e);		/* Resets the "used" field as well */
+}
+
+/**
+ * Insert entry in the index.
+ */
+static void
+rtable_index_insert(rtable_t *rt, uint32 hash, uint idx)
+{
+	size_t i = hash & rt->index_mask;
+
+	while (rt->index[i].idx != 0) {
+		i = (i + 1) & rt->index_mask;
+	}
+
+	rt->index[i].hash = hash;
+	rt->index[i].idx = idx + 1;
+}
+
+/**
+ * Locate the index bucket referring to the given entry.
+ *
+ * @return the bucket position in the index.
+ */
+static size_t
+rtable_index_find(const rtable_t *rt, const rtable_entry_t *e)
+{
+	uint32 hash = rtable_hash(&e->muid, e->function);
+	size_t i = hash & rt->index_mask;
+
+	for (;;) {
+		const struct rtable_bucket *b = &rt->index[i];
+
+		g_assert(b->idx != 0);		/* Entry must be present */
+
+		if (b->hash == hash && e == rtable_entry_at(rt, b->idx - 1))
+			return i;
+
+		i = (i + 1) & rt->index_mask;
+	}
+}
+
+/**
+ * Remove bucket at given position in the index, shifting back the
+ * following buckets of the probing sequence so that no hole is left.
+ */
+static void
+rtable_index_remove_at(rtable_t *rt, size_t pos)
+{
+	size_t mask = rt->index_mask;
+	size_t i = pos, j = pos;
+
+	for (;;) {
+		size_t k;
+
+		j = (j + 1) & mask;
+
+		if (0 == rt->index[j].idx)
+			break;
+
+		/*
+		 * Bucket at ``j'' can fill the hole at ``i'' only if its home
+		 * position ``k'' does not lie cyclically within (i, j].
+		 */
+
+		k = rt->index[j].hash & mask;
+
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		rt->index[i] = rt->index[j];
+		i = j;
+	}
+
+	rt->index[i].hash = 0;
+	rt->index[i].idx = 0;
+}
+
+/**
+ * Resize the index to keep its load factor under 50% for the current
+ * capacity of the table.
+ */
+static void
+rtable_index_resize(rtable_t *rt)
+{
+	struct rtable_bucket *old = rt->index;
+	size_t osize = NULL == old ? 0 : rt->index_mask + 1;
+	size_t nsize = 2 * next_pow2(MAX(rt->capacity, RTABLE_CHUNK));
+	size_t i;
+
+	if (osize == nsize)
+		return;
+
+	HALLOC0_ARRAY(rt->index, nsize);
+	rt->index_mask = nsize - 1;
+
+	for (i = 0; i < osize; i++) {
+		if (old[i].idx != 0)
+			rtable_index_insert(rt, old[i].hash, old[i].idx - 1);
+	}
+
+	hfree(old);
+
+	if (rt->debug > 1) {
+		s_debug("RT index resized from %zu to %zu buckets (holds %zu / %zu)",
+			osize, nsize, rt->count, rt->capacity);
+	}
+}
+
+/**
+ * Discard entry, removing it from the index.
+ */
+static void
+rtable_discard(rtable_t *rt, rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	rtable_index_remove_at(rt, rtable_index_find(rt, e));
+	rtable_entry_free_routes(rt, e);
+	rt->count--;
+}
+
+/**
+ * Release all the chunks starting with specified chunk index.
+ */
+static void
+rtable_clear_from(rtable_t *rt, uint cidx)
+{
+	uint i;
+
+	for (i = cidx; i < rt->nchunks; i++) {
+		rtable_entry_t *chunk = rt->chunks[i];
+		size_t j;
+
+		if (rt->debug) {
+			s_debug("RT freeing chunk #%u at %p, now holds %zu / %zu",
+				i, (void *) chunk, rt->count, rt->capacity);
+		}
+
+		for (j = 0; j < RTABLE_CHUNK; j++) {
+			if (chunk[j].used)
+				rtable_discard(rt, &chunk[j]);
+		}
+
+		rt->capacity -= RTABLE_CHUNK;
+		HFREE_NULL(rt->chunks[i]);
+	}
+
+	rt->nchunks = cidx;
+	rtable_index_resize(rt);
+}
+
+/**
+ * Advance entry index so that the next call to rtable_next_slot() will
+ * return the next available entry.
+ */
+static inline void
+rtable_advance(rtable_t *rt)
+{
+	/*
+	 * It's OK to go beyond the last allocated chunk (a new chunk will
+	 * be allocated next time) unless we already reached the last chunk.
+	 */
+
+	rt->next_idx++;
+
+	if (CHUNK_INDEX(rt->next_idx) >= rt->max_chunks)
+		rt->next_idx = 0;		/* Will force cycling over next time */
+}
+
+/**
+ * Compute the index of the next entry to use, allocating a new chunk or
+ * cycling back to the start of the table as needed.
+ *
+ * When `trial' is TRUE, the entry index is not advanced, allowing the caller
+ * to see where the entry would be allocated.  If it decides to keep it, it
+ * must call rtable_advance().  A trial allocation never releases chunks,
+ * and FALSE is returned if that would be needed.
+ *
+ * @param rt		the routing table
+ * @param trial		whether this is a trial allocation
+ * @param idx		where the index of the allocated entry is returned
+ *
+ * @return TRUE if OK, FALSE if trial allocation is not possible.
+ */
+static bool
+rtable_next_slot(rtable_t *rt, bool trial, uint *idx)
+{
+	uint i = rt->next_idx;
+	uint cidx = CHUNK_INDEX(i);
+	bool allocated = cidx < rt->nchunks;
+	time_t now = tm_time();
+	time_delta_t elapsed = delta_time(now, rt->last_rotation);
+
+	g_assert(cidx < rt->max_chunks);
+
+	/*
+	 * If we get back here with an index of zero and the chunk is
+	 * allocated, it means we've cycled over, either naturally or because
+	 * we have allocated the maximum amount of chunks.
+	 */
+
+	if G_UNLIKELY(0 == i && allocated) {
+		if (rt->debug) {
+			s_debug("RT cycled over table%s, elapsed=%ld, holds %zu / %zu",
+				rt->max_chunks == rt->nchunks ? " (FORCED)" : "",
+				(long) elapsed, rt->count, rt->capacity);
+		}
+		rt->last_rotation = now;
+		elapsed = 0;
+	}
+
+	/*
+	 * If we've taken more than "cycle" seconds since the last rotation
+	 * and reach the start of an allocated chunk, it means we have more
+	 * chunks than we need.  Discard all remaining chunks before rotating.
+	 */
+
+	if G_UNLIKELY(elapsed > rt->cycle && allocated && 0 == ENTRY_INDEX(i)) {
+		if (trial)
+			return FALSE;
+
+		rtable_clear_from(rt, cidx);
+		allocated = FALSE;
+	}
+
+	if (!allocated) {
+		g_assert(i >= rt->capacity);
+
+		/*
+		 * Chunk does not exist yet, determine whether we should create
+		 * it or recycle the table by going back to the start.
+		 */
+
+		if (i > 0 && elapsed > rt->cycle) {
+			if (rt->debug) {
+				s_debug("RT cycling over table, elapsed=%ld, holds %zu / %zu",
+					(long) elapsed, rt->count, rt->capacity);
+			}
+
+			i = rt->next_idx = 0;
+			rt->last_rotation = now;
+		} else {
+			g_assert(cidx == rt->nchunks);
+
+			HALLOC0_ARRAY(rt->chunks[cidx], RTABLE_CHUNK);
+			rt->nchunks++;
+			rt->capacity += RTABLE_CHUNK;
+			rtable_index_resize(rt);
+
+			if (rt->debug) {
+				s_debug("RT created new chunk #%u at %p, now holds %zu / %zu",
+					cidx, (void *) rt->chunks[cidx], rt->count, rt->capacity);
+			}
+		}
+	}
+
+	g_assert(i == rt->next_idx);
+	g_assert(i < rt->capacity);
+
+	if (!trial)
+		rtable_advance(rt);
+
+	*idx = i;
+	return TRUE;
+}
+
+/**
+ * Create a new routing table.
+ *
+ * @param max		maximum amount of entries we can hold
+ * @param cycle		minimum rotation period, in seconds, before recycling
+ * @param rfree		optional callback to free routes of discarded entries
+ *
+ * @return new routing table.
+ */
+rtable_t *
+rtable_make(size_t max, time_delta_t cycle, rtable_free_t rfree)
+{
+	rtable_t *rt;
+	size_t n;
+
+	g_assert(size_is_positive(max));
+	g_assert(cycle >= 0);
+
+	n = (max + RTABLE_CHUNK - 1) / RTABLE_CHUNK;
+
+	WALLOC0(rt);
+	rt->magic = RTABLE_MAGIC;
+	rt->max_chunks = MIN(n, RTABLE_MAX_CHUNKS);
+	rt->cycle = cycle;
+	rt->rfree = rfree;
+	rt->last_rotation = tm_time();
+	HALLOC0_ARRAY(rt->chunks, rt->max_chunks);
+	rtable_index_resize(rt);
+
+	return rt;
+}
+
+/**
+ * Free routing table and nullify its pointer.
+ *
+ * Routes are freed through the callback supplied at creation time.
+ */
+void
+rtable_free_null(rtable_t **rt_ptr)
+{
+	rtable_t *rt = *rt_ptr;
+
+	if (rt != NULL) {
+		uint i;
+
+		rtable_check(rt);
+
+		for (i = 0; i < rt->nchunks; i++) {
+			rtable_entry_t *chunk = rt->chunks[i];
+			size_t j;
+
+			for (j = 0; j < RTABLE_CHUNK; j++) {
+				if (chunk[j].used)
+					rtable_entry_free_routes(rt, &chunk[j]);
+			}
+			hfree(chunk);
+		}
+
+		hfree(rt->chunks);
+		hfree(rt->index);
+		rt->magic = 0;
+		WFREE(rt);
+		*rt_ptr = NULL;
+	}
+}
+
+/**
+ * Set debugging level.
+ */
+void
+rtable_set_debug(rtable_t *rt, uint level)
+{
+	rtable_check(rt);
+
+	rt->debug = level;
+}
+
+/**
+ * Look for an entry in the routing table.
+ *
+ * @return the entry if found, NULL otherwise.
+ */
+rtable_entry_t *
+rtable_lookup(const rtable_t *rt, const struct guid *muid, uint8 function)
+{
+	uint32 hash;
+	size_t i;
+
+	rtable_check(rt);
+	g_assert(muid != NULL);
+
+	hash = rtable_hash(muid, function);
+	i = hash & rt->index_mask;
+
+	for (;;) {
+		const struct rtable_bucket *b = &rt->index[i];
+
+		if (0 == b->idx)
+			return NULL;
+
+		if (b->hash == hash) {
+			rtable_entry_t *e = rtable_entry_at(rt, b->idx - 1);
+
+			if (e->function == function && guid_eq(&e->muid, muid))
+				return e;
+		}
+
+		i = (i + 1) & rt->index_mask;
+	}
+}
+
+/**
+ * Create a new entry in the routing table, superseding the oldest one
+ * if needed.
+ *
+ * The key must not already be present in the table.
+ *
+ * @return the new entry, with no routes.
+ */
+rtable_entry_t *
+rtable_insert(rtable_t *rt, const struct guid *muid, uint8 function)
+{
+	rtable_entry_t *e;
+	uint idx;
+
+	rtable_check(rt);
+	g_assert(muid != NULL);
+
+	(void) rtable_next_slot(rt, FALSE, &idx);
+	e = rtable_entry_at(rt, idx);
+
+	if (e->used)
+		rtable_discard(rt, e);
+
+	e->muid = *muid;
+	e->function = function;
+	e->used = TRUE;
+	rtable_index_insert(rt, rtable_hash(muid, function), idx);
+	rt->count++;
+
+	return e;
+}
+
+/**
+ * Revitalize entry by moving it to the tail of the table, thereby making
+ * it unlikely that it expires soon.
+ *
+ * Entries are only moved when they would land in another chunk, since
+ * entries in the same chunk will roughly have the same lifetime.
+ *
+ * @return the new location of the entry.
+ */
+rtable_entry_t *
+rtable_revitalize(rtable_t *rt, rtable_entry_t *e)
+{
+	rtable_entry_t *d;
+	size_t pos;
+	uint idx;
+
+	rtable_check(rt);
+	rtable_entry_check(e);
+
+	if (!rtable_next_slot(rt, TRUE, &idx))
+		return e;			/* Table about to shrink, leave entry alone */
+
+	pos = rtable_index_find(rt, e);
+
+	if (CHUNK_INDEX(idx) == CHUNK_INDEX(rt->index[pos].idx - 1))
+		return e;			/* Same chunk being used */
+
+	/*
+	 * Discard the entry we supersede, if any, then move `e' to its slot.
+	 */
+
+	rtable_advance(rt);
+	d = rtable_entry_at(rt, idx);
+
+	if (d->used) {
+		rtable_discard(rt, d);
+		pos = rtable_index_find(rt, e);		/* Index may have been shifted */
+	}
+
+	*d = *e;
+	ZERO(e);
+	rt->index[pos].idx = idx + 1;
+
+	return d;
+}
+
+/**
+ * Clear the whole routing table.
+ */
+void
+rtable_clear(rtable_t *rt)
+{
+	rtable_check(rt);
+
+	if (rt->debug) {
+		s_debug("RT clearing whole table (holds %zu / %zu)",
+			rt->count, rt->capacity);
+	}
+
+	rtable_clear_from(rt, 0);
+	rt->next_idx = 0;
+	rt->last_rotation = tm_time();
+
+	g_assert(0 == rt->count);
+}
+
+/**
+ * @return amount of entries held in the table.
+ */
+size_t
+rtable_count(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return rt->count;
+}
+
+/**
+ * @return capacity of the table, in entries.
+ */
+size_t
+rtable_capacity(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return rt->capacity;
+}
+
+/**
+ * @return amount of allocated chunks.
+ */
+size_t
+rtable_chunks(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return rt->nchunks;
+}
+
+/**
+ * @return the MUID of the entry.
+ */
+const struct guid *
+rtable_entry_muid(const rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	return &e->muid;
+}
+
+/**
+ * @return the function of the entry.
+ */
+uint8
+rtable_entry_function(const rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	return e->function;
+}
+
+/**
+ * @return the TTL recorded in the entry.
+ */
+uint8
+rtable_entry_ttl(const rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	return e->ttl;
+}
+
+/**
+ * Record TTL in the entry.
+ */
+void
+rtable_entry_set_ttl(rtable_entry_t *e, uint8 ttl)
+{
+	rtable_entry_check(e);
+
+	e->ttl = ttl;
+}
+
+/**
+ * @return amount of routes in the entry.
+ */
+uint
+rtable_entry_route_count(const rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	return e->routes;
+}
+
+/**
+ * @return the i-th route of the entry.
+ */
+void *
+rtable_entry_route(const rtable_entry_t *e, uint i)
+{
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	return i < RTABLE_ROUTES ? e->route[i] : e->spill[i - RTABLE_ROUTES];
+}
+
+/**
+ * @return the TTL of the i-th route of the entry.
+ */
+uint8
+rtable_entry_route_ttl(const rtable_entry_t *e, uint i)
+{
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	return i < RTABLE_ROUTES ?
+		e->rttl[i] : rtable_spill_ttl(e)[i - RTABLE_ROUTES];
+}
+
+/**
+ * Update the TTL of the i-th route of the entry.
+ */
+void
+rtable_entry_set_route_ttl(rtable_entry_t *e, uint i, uint8 ttl)
+{
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	if (i < RTABLE_ROUTES)
+		e->rttl[i] = ttl;
+	else
+		rtable_spill_ttl(e)[i - RTABLE_ROUTES] = ttl;
+}
+
+/**
+ * Look for a route in the entry.
+ *
+ * @return index of the route, -1 if not found.
+ */
+int
+rtable_entry_route_index(const rtable_entry_t *e, const void *route)
+{
+	uint i, n;
+
+	rtable_entry_check(e);
+
+	n = MIN(e->routes, RTABLE_ROUTES);
+
+	for (i = 0; i < n; i++) {
+		if (e->route[i] == route)
+			return i;
+	}
+
+	for (/* empty */; i < e->routes; i++) {
+		if (e->spill[i - RTABLE_ROUTES] == route)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Append a route to the entry.
+ *
+ * @return TRUE if route was added, FALSE if the entry already holds the
+ * maximum amount of routes.
+ */
+bool
+rtable_entry_add_route(rtable_entry_t *e, void *route, uint8 ttl)
+{
+	rtable_entry_check(e);
+
+	if G_UNLIKELY(RTABLE_MAX_ROUTES == e->routes)
+		return FALSE;
+
+	if (e->routes >= RTABLE_ROUTES) {
+		uint extra = e->routes - RTABLE_ROUTES;
+		rtable_spill_resize(e, extra, extra + 1);
+	}
+
+	e->routes++;
+	rtable_entry_set(e, e->routes - 1, route, ttl);
+
+	return TRUE;
+}
+
+/**
+ * Remove the i-th route from the entry, preserving the order of the
+ * remaining routes.
+ */
+void
+rtable_entry_remove_route(rtable_entry_t *e, uint i)
+{
+	uint j;
+
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	for (j = i + 1; j < e->routes; j++) {
+		rtable_entry_set(e, j - 1,
+			rtable_entry_route(e, j), rtable_entry_route_ttl(e, j));
+	}
+
+	if (e->routes > RTABLE_ROUTES) {
+		uint extra = e->routes - RTABLE_ROUTES;
+		rtable_spill_resize(e, extra, extra - 1);
+	}
+
+	e->routes--;
+}
+
+/**
+ * Traverse the routes of the entry, removing those for which the callback
+ * returns TRUE.  The order of the remaining routes is preserved.
+ *
+ * @return amount of routes removed.
+ */
+size_t
+rtable_entry_foreach_remove(rtable_entry_t *e,
+	rtable_route_cb_t cb, void *data)
+{
+	uint i, j;
+
+	rtable_entry_check(e);
+	g_assert(cb != NULL);
+
+	for (i = j = 0; i < e->routes; i++) {
+		void *route = rtable_entry_route(e, i);
+		uint8 ttl = rtable_entry_route_ttl(e, i);
+
+		if (!(*cb)(route, ttl, data)) {
+			if (i != j)
+				rtable_entry_set(e, j, route, ttl);
+			j++;
+		}
+	}
+
+	if (i != j) {
+		if (e->routes > RTABLE_ROUTES) {
+			rtable_spill_resize(e, e->routes - RTABLE_ROUTES,
+				j > RTABLE_ROUTES ? j - RTABLE_ROUTES : 0);
+		}
+		e->routes = j;
+	}
+
+	return i - j;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
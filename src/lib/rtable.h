@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Flat routing table, keyed by GUID and message function.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _rtable_h_
+#define _rtable_h_
+
+#include "common.h"
+
+#include "tm.h"			/* For time_delta_t */
+
+struct guid;
+
+typedef struct rtable rtable_t;
+typedef struct rtable_entry rtable_entry_t;
+
+/**
+ * Route freeing callback, invoked for each route of an entry being discarded.
+ */
+typedef void (*rtable_free_t)(void *route);
+
+/**
+ * Route selection callback.
+ *
+ * @param route		the route
+ * @param ttl		the TTL recorded for the route
+ * @param data		user-supplied argument
+ *
+ * @return TRUE if the route must be removed from the entry.
+ */
+typedef bool (*rtable_route_cb_t)(void *route, uint8 ttl, void *data);
+
+/*
+ * Public interface.
+ */
+
+rtable_t *rtable_make(size_t max, time_delta_t cycle, rtable_free_t rfree);
+void rtable_free_null(rtable_t **rt_ptr);
+void rtable_set_debug(rtable_t *rt, uint level);
+
+rtable_entry_t *rtable_lookup(const rtable_t *rt,
+	const struct guid *muid, uint8 function);
+rtable_entry_t *rtable_insert(rtable_t *rt,
+	const struct guid *muid, uint8 function);
+rtable_entry_t *rtable_revitalize(rtable_t *rt, rtable_entry_t *e);
+void rtable_clear(rtable_t *rt);
+
+size_t rtable_count(const rtable_t *rt);
+size_t rtable_capacity(const rtable_t *rt);
+size_t rtable_chunks(const rtable_t *rt);
+
+const struct guid *rtable_entry_muid(const rtable_entry_t *e);
+uint8 rtable_entry_function(const rtable_entry_t *e);
+uint8 rtable_entry_ttl(const rtable_entry_t *e);
+void rtable_entry_set_ttl(rtable_entry_t *e, uint8 ttl);
+
+uint rtable_entry_route_count(const rtable_entry_t *e);
+void *rtable_entry_route(const rtable_entry_t *e, uint i);
+uint8 rtable_entry_route_ttl(const rtable_entry_t *e, uint i);
+void rtable_entry_set_route_ttl(rtable_entry_t *e, uint i, uint8 ttl);
+int rtable_entry_route_index(const rtable_entry_t *e, const void *route);
+bool rtable_entry_add_route(rtable_entry_t *e, void *route, uint8 ttl);
+void rtable_entry_remove_route(rtable_entry_t *e, uint i);
+size_t rtable_entry_foreach_remove(rtable_entry_t *e,
+	rtable_route_cb_t cb, void *data);
+
+#endif /* _rtable_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,344 @@
+/*
+ * sha1-test -- SHA1 tests and benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/base16.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/sha1.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_MESSAGES	8		/* Default amount of messages for multi-buffer */
+#define TEST_SIZE		1024	/* Default message size, in KiB */
+#define TEST_LOOPS		64		/* Default amount of loops */
+
+static const char *engines[] = { "scalar", "sse2", "shani" };
+
+static bool silent_mode, verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htSV] [-m messages] [-n loops] [-s size] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -m : amount of messages to hash at once (default %d)\n"
+		"  -n : amount of benchmarking loops (default %d)\n"
+		"  -s : message size in KiB (default %d)\n"
+		"  -t : time each engine\n"
+		"  -R : seed for repeatable random data\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), TEST_MESSAGES, TEST_LOOPS, TEST_SIZE);
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *engine, const char *what)
+{
+	printf("%6s - %s - FAILED\n", engine, what);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static void
+compute_sha1(sha1_t *digest, const void *p, size_t len, size_t chunk)
+{
+	SHA1_context ctx;
+	const char *q = p;
+
+	SHA1_reset(&ctx);
+	while (len != 0) {
+		size_t n = MIN(len, chunk);
+		SHA1_input(&ctx, q, n);
+		q += n;
+		len -= n;
+	}
+	SHA1_result(&ctx, digest);
+}
+
+/*
+ * Check engine against the FIPS 180-1 test vectors.
+ */
+static void
+test_vectors(const char *engine)
+{
+	static const struct {
+		const char *msg;
+		const char *digest;
+	} vectors[] = {
+		{ "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+			"84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+	};
+	uint i;
+
+	for (i = 0; i < N_ITEMS(vectors); i++) {
+		sha1_t digest;
+		char hex[SHA1_RAW_SIZE * 2 + 1];
+
+		compute_sha1(&digest, vectors[i].msg, strlen(vectors[i].msg), 64);
+		base16_encode(hex, sizeof hex, &digest, sizeof digest);
+		hex[sizeof hex - 1] = '\0';
+
+		if (0 != strcmp(hex, vectors[i].digest))
+			test_abort(engine, "FIPS 180-1 test vector");
+	}
+
+	if (verbose_mode)
+		printf("%6s - FIPS 180-1 test vectors - OK\n", engine);
+}
+
+/*
+ * Check engine against reference digests, computed by the scalar engine,
+ * feeding data with various chunk sizes and alignments.
+ */
+static void
+test_engine(const char *engine, const char *data, size_t len,
+	const sha1_t *reference, size_t messages)
+{
+	static const size_t chunks[] = { 1, 3, 64, 100, 4096, 65536 };
+	SHA1_context *ctx, **cp;
+	const void **dp;
+	uint i, j;
+
+	for (i = 0; i < N_ITEMS(chunks); i++) {
+		sha1_t digest;
+
+		compute_sha1(&digest, data, len, chunks[i]);
+		if (0 != memcmp(&digest, &reference[0], sizeof digest))
+			test_abort(engine, "single message");
+	}
+
+	XMALLOC_ARRAY(ctx, messages);
+	XMALLOC_ARRAY(cp, messages);
+	XMALLOC_ARRAY(dp, messages);
+
+	for (i = 0; i < messages; i++) {
+		SHA1_reset(&ctx[i]);
+		cp[i] = &ctx[i];
+		dp[i] = data + i;			/* Unaligned for odd messages */
+	}
+
+	SHA1_input_multi(cp, dp, messages, len);
+
+	for (i = 0; i < messages; i++) {
+		sha1_t digest;
+
+		SHA1_result(&ctx[i], &digest);
+		if (0 != memcmp(&digest, &reference[i + 1], sizeof digest))
+			test_abort(engine, "multiple messages");
+	}
+
+	/* Same test, but contexts are not on a block boundary */
+
+	for (i = 0; i < messages; i++) {
+		SHA1_reset(&ctx[i]);
+		SHA1_input(&ctx[i], dp[i], 1);
+	}
+
+	for (i = 0; i < messages; i++) {
+		dp[i] = data + i + 1;
+	}
+
+	SHA1_input_multi(cp, dp, messages, len - 1);
+
+	for (j = 0; j < messages; j++) {
+		sha1_t digest;
+
+		SHA1_result(&ctx[j], &digest);
+		if (0 != memcmp(&digest, &reference[j + 1], sizeof digest))
+			test_abort(engine, "multiple unaligned messages");
+	}
+
+	xfree(ctx);
+	xfree(cp);
+	xfree(dp);
+
+	if (verbose_mode)
+		printf("%6s - %zu-byte messages - OK\n", engine, len);
+}
+
+static void
+timeit(const char *engine, const char *data, size_t len,
+	size_t messages, size_t loops)
+{
+	SHA1_context *ctx, **cp;
+	const void **dp;
+	tm_t start, end;
+	double single, multi;
+	size_t i;
+
+	XMALLOC_ARRAY(ctx, messages);
+	XMALLOC_ARRAY(cp, messages);
+	XMALLOC_ARRAY(dp, messages);
+
+	tm_now_exact(&start);
+	for (i = 0; i < loops * messages; i++) {
+		SHA1_reset(&ctx[0]);
+		SHA1_input(&ctx[0], data, len);
+	}
+	tm_now_exact(&end);
+	single = tm_elapsed_f(&end, &start);
+
+	for (i = 0; i < messages; i++) {
+		cp[i] = &ctx[i];
+		dp[i] = data;
+	}
+
+	tm_now_exact(&start);
+	for (i = 0; i < loops; i++) {
+		size_t j;
+
+		for (j = 0; j < messages; j++) {
+			SHA1_reset(&ctx[j]);
+		}
+		SHA1_input_multi(cp, dp, messages, len);
+	}
+	tm_now_exact(&end);
+	multi = tm_elapsed_f(&end, &start);
+
+	xfree(ctx);
+	xfree(cp);
+	xfree(dp);
+
+	printf("%6s - single: %.3gs (%.0f MiB/s), %zu at once: %.3gs (%.0f MiB/s)\n",
+		engine, single, loops * messages * len / single / 1048576.0,
+		messages, multi, loops * messages * len / multi / 1048576.0);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t messages = TEST_MESSAGES;
+	size_t size = TEST_SIZE;
+	size_t loops = TEST_LOOPS;
+	unsigned rseed = 0;
+	const char options[] = "hm:n:s:tR:SV";
+	sha1_t *reference;
+	char *data;
+	size_t len, i;
+	int c;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'm':			/* amount of messages */
+			messages = atol(optarg);
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 's':			/* message size, in KiB */
+			size = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || 0 == messages || 0 == size || 0 == loops)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	/*
+	 * Message i of the multi-buffer tests starts at offset i in the data.
+	 */
+
+	len = size * 1024;
+	data = xmalloc(len + messages);
+	rand31_bytes(data, len + messages);
+
+	XMALLOC_ARRAY(reference, messages + 1);
+
+	if (!SHA1_engine_set("scalar"))
+		test_abort("scalar", "engine selection");
+
+	compute_sha1(&reference[0], data, len, len);
+	for (i = 0; i < messages; i++) {
+		compute_sha1(&reference[i + 1], data + i, len, len);
+	}
+
+	for (i = 0; i < N_ITEMS(engines); i++) {
+		const char *engine = engines[i];
+
+		if (!SHA1_engine_set(engine)) {
+			if (!silent_mode)
+				printf("%6s - not supported\n", engine);
+			continue;
+		}
+
+		test_vectors(engine);
+		test_engine(engine, data, len, reference, messages);
+
+		if (tflag)
+			timeit(engine, data, len, messages, loops);
+		else if (!silent_mode && !verbose_mode)
+			printf("%6s - OK\n", engine);
+	}
+
+	SHA1_engine_set("auto");
+	if (!silent_mode)
+		printf("default engine is \"%s\"\n", SHA1_engine());
+
+	xfree(reference);
+	xfree(data);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -55,26 +55,55 @@
  *      implementation only works with messages with a length that is
  *      a multiple of the size of an 8-bit character.
  *
+ * The block processing routine is selected at runtime: on x86 CPUs with
+ * the SHA extensions, we use the dedicated SHA1 instructions, otherwise
+ * the portable C version is used.  A multi-buffer variant is also provided
+ * to compute the digests of several independent messages at once, using
+ * one SSE2 vector lane per message.
+ *
  * @note
  * This file comes from RFC 3174. Inclusion in gtk-gnutella with additional
  * optimizations and adaptation to coding standards and specific library
  * routines were made by Raphael Manfredi.
  *
  * @author Raphael Manfredi
- * @date 2002-2003, 2015
+ * @date 2002-2003, 2015-2016
  */
 
 #include "common.h"
+
+/*
+ * The SIMD kernels rely on the ability to compile routines for a specific
+ * target instruction set, which is then selected at runtime.
+ */
+#if defined(__x86_64__) && defined(HASATTRIBUTE) && HAS_GCC(4, 9)
+#define SHA1_X86_SIMD
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA1_TARGET(x)	__attribute__((target(x)))
+#endif
+
 #include "endian.h"
 #include "sha1.h"
 #include "misc.h"			/* For RCSID */
 #include "override.h"		/* Must be the last header included */
 
 #define SHA1_BLEN	64		/**< Message block length */
+#define SHA1_LANES	4		/**< Messages processed by multi-buffer kernel */
+
+typedef void (*sha1_process_t)(uint32 *ihash, const void *data, size_t n);
 
 /* Local Function Prototyptes */
 static void SHA1_pad_message(SHA1_context *);
-static void SHA1_process_message_block(SHA1_context *, const void *mblock);
+static void SHA1_process_message_block(uint32 *ihash, const void *mblock);
+static void SHA1_process_resolve(uint32 *ihash, const void *data, size_t n);
+
+/**
+ * Block processing routine, selected at runtime on first usage.
+ */
+static sha1_process_t SHA1_process = SHA1_process_resolve;
+static const char *SHA1_process_name = "auto";
+static bool SHA1_multi_lanes;		/* Whether to use multi-buffer kernel */
 
 /**
  *  SHA1_reset
@@ -252,16 +281,26 @@ SHA1_input(SHA1_context *context, const void *data, size_t length)
 		goto slowpath;
 
 fastpath:
-	for (/**/; length >= SHA1_BLEN; mp += SHA1_BLEN, length -= SHA1_BLEN) {
-		context->length += 8 * SHA1_BLEN;		/* Counts bits, not bytes */
+	if (length >= SHA1_BLEN) {
+		size_t n = length / SHA1_BLEN;
+		uint64 bits = (uint64) n * 8 * SHA1_BLEN;	/* Counts bits */
+
+		context->length += bits;
 
-		if G_UNLIKELY(context->length < 8 * SHA1_BLEN) {
+		if G_UNLIKELY(context->length < bits) {
 			/* Message is too long */
 			context->corrupted = SHA_INPUT_TOO_LONG;
 			return SHA_INPUT_TOO_LONG;
 		}
 
-		SHA1_process_message_block(context, mp);
+		/*
+		 * Process all the blocks at once, which allows SIMD kernels to keep
+		 * the intermediate hash in registers between blocks.
+		 */
+
+		(*SHA1_process)(context->ihash, mp, n);
+		mp += n * SHA1_BLEN;
+		length -= n * SHA1_BLEN;
 	}
 
 	/* FALL THROUGH */
@@ -282,7 +321,8 @@ slowpath:
 		}
 
 		if G_UNLIKELY(SHA1_BLEN == context->midx) {
-			SHA1_process_message_block(context, context->mblock);
+			(*SHA1_process)(context->ihash, context->mblock, 1);
+			context->midx = 0;
 			if (length >= SHA1_BLEN && 0 == pointer_to_long(mp) % 4)
 				goto fastpath;		/* Can use faster processing now */
 		}
@@ -299,8 +339,11 @@ slowpath:
  *      stored in the mblock parameter.
  *
  *  Parameters:
+ *      ihash: [in/out]
+ *          The intermediate hash to update
  *      mblock: [in]
- *          Start of the next 64 message bytes to process
+ *          Start of the next 64 message bytes to process, which must
+ *          be aligned on a 32-bit boundary
  *
  *  Returns:
  *      Nothing.
@@ -311,7 +354,7 @@ slowpath:
  *      names used in the publication.
  */
 static void G_HOT
-SHA1_process_message_block(SHA1_context *context, const void *mblock)
+SHA1_process_message_block(uint32 *ihash, const void *mblock)
 {
 	const uint32 K[] = {       /* Constants defined in SHA-1 */
 		0x5A827999,
@@ -365,11 +408,11 @@ SHA1_process_message_block(SHA1_context *context, const void *mblock)
 		CRUNCH; wp++;		/* t+9 */
 	}
 
-	a = context->ihash[0];
-	b = context->ihash[1];
-	c = context->ihash[2];
-	d = context->ihash[3];
-	e = context->ihash[4];
+	a = ihash[0];
+	b = ihash[1];
+	c = ihash[2];
+	d = ihash[3];
+	e = ihash[4];
 
 	wp = &W[0];
 
@@ -489,13 +532,457 @@ SHA1_process_message_block(SHA1_context *context, const void *mblock)
 	ROTATE(3, c, d, e, a, b, M3);
 	ROTATE(3, b, c, d, e, a, M3);
 
-	context->ihash[0] += a;
-	context->ihash[1] += b;
-	context->ihash[2] += c;
-	context->ihash[3] += d;
-	context->ihash[4] += e;
+	ihash[0] += a;
+	ihash[1] += b;
+	ihash[2] += c;
+	ihash[3] += d;
+	ihash[4] += e;
+}
 
-	context->midx = 0;
+/**
+ * Process consecutive message blocks with the portable C implementation.
+ */
+static void
+SHA1_process_scalar(uint32 *ihash, const void *data, size_t n)
+{
+	const uint8 *p = data;
+
+	for (/**/; n != 0; n--, p += SHA1_BLEN) {
+		SHA1_process_message_block(ihash, p);
+	}
+}
+
+#ifdef SHA1_X86_SIMD
+/**
+ * Process consecutive message blocks using the x86 SHA extensions.
+ *
+ * The SHA1RNDS4 instruction performs 4 rounds at once, on the A, B, C and
+ * D words held in one register, the E word being folded into the message
+ * schedule by SHA1NEXTE.  SHA1MSG1 and SHA1MSG2 compute the message
+ * schedule, 4 words at a time.
+ */
+static void SHA1_TARGET("sha,sse4.1")
+SHA1_process_shani(uint32 *ihash, const void *data, size_t n)
+{
+	const __m128i mask =
+		_mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+	const uint8 *p = data;
+
+	abcd = _mm_loadu_si128((const __m128i *) ihash);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e0 = _mm_set_epi32(ihash[4], 0, 0, 0);
+
+#define LOAD(m, i) \
+	m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + 16 * i)), mask)
+
+	/*
+	 * Four rounds, using message words ``ma'', with ``ea'' holding E and
+	 * ``eb'' being set to the next E.  The message schedule is expanded
+	 * in parallel: ``mb'', ``mc'' and ``md'' are the next message words.
+	 */
+#define ROUNDS4(ea, eb, ma, mb, mc, md, f) \
+	ea = _mm_sha1nexte_epu32(ea, ma); \
+	eb = abcd; \
+	mb = _mm_sha1msg2_epu32(mb, ma); \
+	abcd = _mm_sha1rnds4_epu32(abcd, ea, f); \
+	md = _mm_sha1msg1_epu32(md, ma); \
+	mc = _mm_xor_si128(mc, ma);
+
+	for (/**/; n != 0; n--, p += SHA1_BLEN) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* Rounds 0-15: the message schedule is the message itself */
+
+		LOAD(m0, 0);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		LOAD(m1, 1);
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		LOAD(m2, 2);
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		LOAD(m3, 3);
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		m0 = _mm_sha1msg2_epu32(m0, m3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m2 = _mm_sha1msg1_epu32(m2, m3);
+		m1 = _mm_xor_si128(m1, m3);
+
+		/* Rounds 16-63 */
+
+		ROUNDS4(e0, e1, m0, m1, m2, m3, 0);		/* 16-19 */
+		ROUNDS4(e1, e0, m1, m2, m3, m0, 1);		/* 20-23 */
+		ROUNDS4(e0, e1, m2, m3, m0, m1, 1);		/* 24-27 */
+		ROUNDS4(e1, e0, m3, m0, m1, m2, 1);		/* 28-31 */
+		ROUNDS4(e0, e1, m0, m1, m2, m3, 1);		/* 32-35 */
+		ROUNDS4(e1, e0, m1, m2, m3, m0, 1);		/* 36-39 */
+		ROUNDS4(e0, e1, m2, m3, m0, m1, 2);		/* 40-43 */
+		ROUNDS4(e1, e0, m3, m0, m1, m2, 2);		/* 44-47 */
+		ROUNDS4(e0, e1, m0, m1, m2, m3, 2);		/* 48-51 */
+		ROUNDS4(e1, e0, m1, m2, m3, m0, 2);		/* 52-55 */
+		ROUNDS4(e0, e1, m2, m3, m0, m1, 2);		/* 56-59 */
+		ROUNDS4(e1, e0, m3, m0, m1, m2, 3);		/* 60-63 */
+
+		/* Rounds 64-79: the message schedule is winding down */
+
+		ROUNDS4(e0, e1, m0, m1, m2, m3, 3);		/* 64-67 */
+
+		e1 = _mm_sha1nexte_epu32(e1, m1);		/* 68-71 */
+		e0 = abcd;
+		m2 = _mm_sha1msg2_epu32(m2, m1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		m3 = _mm_xor_si128(m3, m1);
+
+		e0 = _mm_sha1nexte_epu32(e0, m2);		/* 72-75 */
+		e1 = abcd;
+		m3 = _mm_sha1msg2_epu32(m3, m2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+		e1 = _mm_sha1nexte_epu32(e1, m3);		/* 76-79 */
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		/* Add this block's hash to the intermediate result */
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+#undef LOAD
+#undef ROUNDS4
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *) ihash, abcd);
+	ihash[4] = _mm_extract_epi32(e0, 3);
+}
+
+/**
+ * Process one message block for each of SHA1_LANES independent messages,
+ * each message being computed in its own SSE2 vector lane.
+ *
+ * @param ihash		the intermediate hashes of each message
+ * @param data		the message blocks to process, no alignment required
+ * @param n			amount of consecutive blocks to process in each message
+ */
+static void
+SHA1_process_lanes(uint32 *ihash[], const void *data[], size_t n)
+{
+	__m128i h[5], w[16];
+	const uint8 *p[SHA1_LANES];
+	unsigned i, t;
+
+	STATIC_ASSERT(4 == SHA1_LANES);		/* Lanes in a __m128i */
+
+	for (i = 0; i < 5; i++) {
+		h[i] = _mm_set_epi32(ihash[3][i], ihash[2][i], ihash[1][i], ihash[0][i]);
+	}
+
+	for (i = 0; i < SHA1_LANES; i++) {
+		p[i] = data[i];
+	}
+
+#define ROTL(x, n) \
+	_mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+#define W(t)	w[(t) & 0xf]
+#define SCHEDULE(t) \
+	W(t) = ROTL(_mm_xor_si128( \
+		_mm_xor_si128(W((t) - 3), W((t) - 8)), \
+		_mm_xor_si128(W((t) - 14), W(t))), 1)
+#define VM0(b, c, d)	_mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d)))
+#define VM1(b, c, d)	_mm_xor_si128(_mm_xor_si128(b, c), d)
+#define VM2(b, c, d) \
+	_mm_or_si128(_mm_and_si128(b, _mm_or_si128(c, d)), _mm_and_si128(c, d))
+#define VROUND(k, mix) G_STMT_START { \
+	__m128i tmp_; \
+	tmp_ = _mm_add_epi32(_mm_add_epi32(ROTL(a, 5), mix(b, c, d)), \
+		_mm_add_epi32(_mm_add_epi32(e, W(t)), k)); \
+	e = d; d = c; c = ROTL(b, 30); b = a; a = tmp_; \
+} G_STMT_END
+
+	for (/**/; n != 0; n--) {
+		const __m128i k0 = _mm_set1_epi32(0x5A827999);
+		const __m128i k1 = _mm_set1_epi32(0x6ED9EBA1);
+		const __m128i k2 = _mm_set1_epi32(0x8F1BBCDC);
+		const __m128i k3 = _mm_set1_epi32(0xCA62C1D6);
+		__m128i a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+		for (t = 0; t < 16; t++) {
+			W(t) = _mm_set_epi32(
+				peek_be32(p[3] + 4 * t), peek_be32(p[2] + 4 * t),
+				peek_be32(p[1] + 4 * t), peek_be32(p[0] + 4 * t));
+		}
+
+		for (t = 0; t < 16; t++)
+			VROUND(k0, VM0);
+		for (/**/; t < 20; t++) {
+			SCHEDULE(t);
+			VROUND(k0, VM0);
+		}
+		for (/**/; t < 40; t++) {
+			SCHEDULE(t);
+			VROUND(k1, VM1);
+		}
+		for (/**/; t < 60; t++) {
+			SCHEDULE(t);
+			VROUND(k2, VM2);
+		}
+		for (/**/; t < 80; t++) {
+			SCHEDULE(t);
+			VROUND(k3, VM1);
+		}
+
+		h[0] = _mm_add_epi32(h[0], a);
+		h[1] = _mm_add_epi32(h[1], b);
+		h[2] = _mm_add_epi32(h[2], c);
+		h[3] = _mm_add_epi32(h[3], d);
+		h[4] = _mm_add_epi32(h[4], e);
+
+		for (i = 0; i < SHA1_LANES; i++) {
+			p[i] += SHA1_BLEN;
+		}
+	}
+
+#undef ROTL
+#undef W
+#undef SCHEDULE
+#undef VM0
+#undef VM1
+#undef VM2
+#undef VROUND
+
+	for (i = 0; i < 5; i++) {
+		uint32 v[SHA1_LANES];
+
+		_mm_storeu_si128((__m128i *) v, h[i]);
+		ihash[0][i] = v[0];
+		ihash[1][i] = v[1];
+		ihash[2][i] = v[2];
+		ihash[3][i] = v[3];
+	}
+}
+
+/**
+ * @return whether the CPU supports the SHA extensions.
+ */
+static bool
+SHA1_cpu_has_shani(void)
+{
+	uint eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return FALSE;
+
+	if (0 == (ecx & bit_SSE4_1))
+		return FALSE;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return FALSE;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return booleanize(ebx & (1U << 29));		/* SHA extensions */
+}
+#endif	/* SHA1_X86_SIMD */
+
+/**
+ * Select the block processing routine.
+ *
+ * @param name		the routine name, "auto" to pick the fastest available
+ *
+ * @return TRUE if routine was installed, FALSE if not supported.
+ */
+static bool
+SHA1_process_select(const char *name)
+{
+	bool automatic = 0 == strcmp(name, "auto");
+
+#ifdef SHA1_X86_SIMD
+	if (
+		(automatic || 0 == strcmp(name, "shani")) && SHA1_cpu_has_shani()
+	) {
+		/*
+		 * The SHA extensions are faster than the multi-buffer kernel, even
+		 * when several messages are hashed at once.
+		 */
+
+		SHA1_process_name = "shani";
+		SHA1_multi_lanes = FALSE;
+		SHA1_process = SHA1_process_shani;
+		return TRUE;
+	}
+
+	if (automatic || 0 == strcmp(name, "sse2")) {
+		SHA1_process_name = "sse2";
+		SHA1_multi_lanes = TRUE;
+		SHA1_process = SHA1_process_scalar;
+		return TRUE;
+	}
+#endif	/* SHA1_X86_SIMD */
+
+	if (automatic || 0 == strcmp(name, "scalar")) {
+		SHA1_process_name = "scalar";
+		SHA1_multi_lanes = FALSE;
+		SHA1_process = SHA1_process_scalar;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Initial block processing routine, selecting the one to use on the fly.
+ */
+static void
+SHA1_process_resolve(uint32 *ihash, const void *data, size_t n)
+{
+	/*
+	 * There is no need to protect against concurrent selection: all the
+	 * threads would select the same routine.
+	 */
+
+	SHA1_process_select("auto");
+	(*SHA1_process)(ihash, data, n);
+}
+
+/**
+ * Select the SHA1 computing engine.
+ *
+ * This is only meant to be used by benchmarking code, to compare the
+ * various engines: "auto" selects the fastest one, "scalar" is the portable
+ * C version, and on x86 CPUs "shani" uses the SHA extensions and "sse2"
+ * uses the multi-buffer kernel for SHA1_input_multi().
+ *
+ * @return TRUE if the engine was selected, FALSE if it is not supported.
+ */
+bool
+SHA1_engine_set(const char *name)
+{
+	g_assert(name != NULL);
+
+	return SHA1_process_select(name);
+}
+
+/**
+ * @return the name of the SHA1 computing engine being used.
+ */
+const char *
+SHA1_engine(void)
+{
+	if (SHA1_process_resolve == SHA1_process)
+		SHA1_process_select("auto");
+
+	return SHA1_process_name;
+}
+
+/**
+ *  SHA1_input_multi
+ *
+ *  Description:
+ *      This function feeds the same amount of data into several independent
+ *      SHA1 contexts.  When a multi-buffer kernel is available, the data
+ *      are processed for several contexts at once.
+ *
+ *      NOTE: This routine is not part of the original SHA1 API.
+ *
+ *  Parameters:
+ *      context: [in/out]
+ *          The SHA contexts to update
+ *      data: [in]
+ *          The next portion of each message, data[i] going to context[i]
+ *      count: [in]
+ *          The amount of contexts
+ *      length: [in]
+ *          The length of each message portion
+ *
+ *  Returns:
+ *      sha Error Code, the first error returned for one of the contexts.
+ */
+int
+SHA1_input_multi(SHA1_context *context[], const void *data[],
+	size_t count, size_t length)
+{
+	size_t i = 0;
+	int ret = SHA_SUCCESS;
+
+	g_assert(context != NULL);
+	g_assert(data != NULL);
+
+	if G_UNLIKELY(SHA1_process_resolve == SHA1_process)
+		SHA1_process_select("auto");
+
+#ifdef SHA1_X86_SIMD
+	if (SHA1_multi_lanes && length >= SHA1_BLEN) {
+		size_t n = length / SHA1_BLEN;
+		uint64 bits = (uint64) n * 8 * SHA1_BLEN;
+
+		/*
+		 * Contexts are processed by groups of SHA1_LANES, as long as all the
+		 * contexts in the group are at a block boundary and can accept data.
+		 */
+
+		while (i + SHA1_LANES <= count) {
+			uint32 *ihash[SHA1_LANES];
+			const void *lanes[SHA1_LANES];
+			unsigned j;
+
+			for (j = 0; j < SHA1_LANES; j++) {
+				SHA1_context *c = context[i + j];
+
+				SHA1_check(c);
+
+				if (
+					NULL == c || NULL == data[i + j] ||
+					c->computed || c->corrupted || c->midx != 0 ||
+					c->length + bits < bits
+				)
+					break;
+
+				ihash[j] = c->ihash;
+				lanes[j] = data[i + j];
+			}
+
+			if (j != SHA1_LANES)
+				break;		/* Let SHA1_input() handle the remaining contexts */
+
+			SHA1_process_lanes(ihash, lanes, n);
+
+			for (j = 0; j < SHA1_LANES; j++) {
+				SHA1_context *c = context[i + j];
+				const uint8 *p = data[i + j];
+				int r;
+
+				c->length += bits;
+				r = SHA1_input(c, p + n * SHA1_BLEN, length - n * SHA1_BLEN);
+				if (SHA_SUCCESS == ret)
+					ret = r;
+			}
+
+			i += SHA1_LANES;
+		}
+	}
+#endif	/* SHA1_X86_SIMD */
+
+	for (/**/; i < count; i++) {
+		int r = SHA1_input(context[i], data[i], length);
+		if (SHA_SUCCESS == ret)
+			ret = r;
+	}
+
+	return ret;
 }
 
 /**
@@ -534,7 +1021,8 @@ SHA1_pad_message(SHA1_context *context)
 			context->mblock[context->midx++] = 0;
 		}
 
-		SHA1_process_message_block(context, context->mblock);
+		(*SHA1_process)(context->ihash, context->mblock, 1);
+		context->midx = 0;
 
 		while (context->midx < SHA1_BUP) {
 			context->mblock[context->midx++] = 0;
@@ -551,7 +1039,8 @@ SHA1_pad_message(SHA1_context *context)
 	 */
 
 	poke_be64(&context->mblock[SHA1_BUP], context->length);
-	SHA1_process_message_block(context, context->mblock);
+	(*SHA1_process)(context->ihash, context->mblock, 1);
+	context->midx = 0;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
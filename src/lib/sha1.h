@@ -84,6 +84,10 @@ int SHA1_reset(SHA1_context *);
 int SHA1_input(SHA1_context *, const void *, size_t);
 int SHA1_result(SHA1_context *, struct sha1 *digest);
 int SHA1_intermediate(const SHA1_context *, struct sha1 *digest);
+int SHA1_input_multi(SHA1_context *[], const void *[], size_t, size_t);
+
+bool SHA1_engine_set(const char *name);
+const char *SHA1_engine(void);
 
 /**
  * Feed the SHA1 context with the content of a variable.
@@ -0,0 +1,453 @@
+/*
+ * slotset-test -- slot set tests and benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/slotset.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_BITS		16			/* Default log2 of the amount of slots */
+#define TEST_MEMBERS	600			/* Default amount of members */
+#define TEST_QUERIES	200000		/* Default amount of queries to route */
+#define TEST_FILL		5			/* Default fill ratio of bitmaps, in % */
+#define TEST_WORDS		6			/* Max amount of words in a query */
+#define TEST_URNS		8			/* 1 query out of 8 has an URN */
+
+static bool silent_mode, verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htSV] [-b bits] [-f fill] [-m members] [-q queries]\n"
+		"       [-R seed]\n"
+		"  -b : log2 of the amount of slots (default %d)\n"
+		"  -f : fill ratio of member bitmaps, in percent (default %d)\n"
+		"  -h : prints this help message\n"
+		"  -m : amount of members (default %d)\n"
+		"  -q : amount of queries to route when timing (default %d)\n"
+		"  -t : time slot set versus probing of each bitmap\n"
+		"  -R : seed for repeatable random data\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), TEST_BITS, TEST_FILL, TEST_MEMBERS, TEST_QUERIES);
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what)
+{
+	printf("%s - FAILED\n", what);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static void
+test_ok(const char *what)
+{
+	if (verbose_mode)
+		printf("%s - OK\n", what);
+}
+
+/*
+ * Member bitmaps, laid out as compacted QRP tables: slot #i is bit 7-(i&7)
+ * of byte i>>3.
+ */
+static inline bool
+bitmap_get(const uint8 *map, uint32 i)
+{
+	return 0 != (0x80U & (map[i >> 3] << (i & 0x7)));
+}
+
+static inline void
+bitmap_set(uint8 *map, uint32 i)
+{
+	map[i >> 3] |= 0x80U >> (i & 0x7);
+}
+
+static uint8 **
+bitmaps_make(slotset_t *ss, uint bits, size_t members, uint fill)
+{
+	uint8 **maps;
+	size_t i, slots = (size_t) 1 << bits;
+
+	XMALLOC_ARRAY(maps, members);
+
+	for (i = 0; i < members; i++) {
+		size_t j;
+		uint m;
+
+		maps[i] = xmalloc0(slots / 8 + 1);
+		m = slotset_member_alloc(ss);
+		if (m != i)
+			test_abort("member allocation");
+
+		for (j = 0; j < slots; j++) {
+			if (rand31_value(99) < fill) {
+				bitmap_set(maps[i], j);
+				slotset_add(ss, j, m);
+			}
+		}
+	}
+
+	return maps;
+}
+
+static void
+bitmaps_free(uint8 **maps, size_t members)
+{
+	size_t i;
+
+	for (i = 0; i < members; i++) {
+		xfree(maps[i]);
+	}
+	xfree(maps);
+}
+
+static void
+test_members(uint bits)
+{
+	slotset_t *ss = slotset_make(bits);
+	uint32 slot = rand31_value((1U << bits) - 1);
+	uint i, m;
+
+	for (i = 0; i < 200; i++) {
+		if (slotset_member_alloc(ss) != i)
+			test_abort("member numbering");
+		slotset_add(ss, slot, i);
+	}
+
+	slotset_member_free(ss, 70);
+	slotset_member_free(ss, 3);
+
+	if (slotset_members(ss) != 198)
+		test_abort("member count");
+
+	if (slotset_contains(ss, slot, 70) || !slotset_contains(ss, slot, 71))
+		test_abort("member removal");
+
+	m = slotset_member_alloc(ss);
+	if (m != 3 || slotset_contains(ss, slot, m))
+		test_abort("member reuse");
+
+	slotset_remove(ss, slot, 150);
+	if (slotset_contains(ss, slot, 150) || !slotset_contains(ss, slot, 149))
+		test_abort("slot removal");
+
+	slotset_free_null(&ss);
+	if (ss != NULL)
+		test_abort("slot set freeing");
+
+	test_ok("member allocation");
+}
+
+static void
+test_match(uint bits, size_t members, uint fill)
+{
+	slotset_t *ss = slotset_make(bits);
+	uint8 **maps;
+	size_t q;
+
+	maps = bitmaps_make(ss, bits, members, fill);
+
+	for (q = 0; q < 2000; q++) {
+		uint32 all[TEST_WORDS * 2], any[2];
+		uint n = rand31_value(N_ITEMS(all));
+		uint an = rand31_value(N_ITEMS(any));
+		uint need = rand31_value(n + 1);
+		const uint64 *r;
+		size_t i;
+
+		/*
+		 * Bias slots towards set ones, otherwise hardly any member would
+		 * match when more than a few slots are needed.
+		 */
+
+		for (i = 0; i < n; i++) {
+			all[i] = rand31_value((1U << bits) - 1);
+			if (rand31_value(1)) {
+				uint m = rand31_value(members - 1);
+				bitmap_set(maps[m], all[i]);
+				slotset_add(ss, all[i], m);
+			}
+		}
+		for (i = 0; i < an; i++) {
+			any[i] = rand31_value((1U << bits) - 1);
+		}
+
+		r = slotset_match(ss, all, n, need, any, an);
+
+		for (i = 0; i < members; i++) {
+			uint j, hits = 0;
+			bool match = FALSE;
+
+			for (j = 0; j < n; j++) {
+				if (bitmap_get(maps[i], all[j]))
+					hits++;
+			}
+			if (n != 0 && hits >= need)
+				match = TRUE;
+			for (j = 0; j < an; j++) {
+				if (bitmap_get(maps[i], any[j]))
+					match = TRUE;
+			}
+
+			if (match != slotset_result_has(r, i))
+				test_abort("slot matching");
+		}
+	}
+
+	bitmaps_free(maps, members);
+	slotset_free_null(&ss);
+
+	test_ok("slot matching");
+}
+
+/*
+ * The QRP routing rule: with no URN, 2/3 of the words must be present,
+ * or all of them if there are less than 3.  When URNs are present, a
+ * matching URN is enough.
+ */
+struct query {
+	uint32 hash[TEST_WORDS + 1];	/* Words, then URN */
+	uint8 words;
+	uint8 urn;
+};
+
+static inline uint
+query_need(uint words)
+{
+	return words < 3 ? words : (2 * words + 2) / 3;
+}
+
+static struct query *
+queries_make(size_t nq)
+{
+	struct query *qv;
+	size_t i;
+
+	XMALLOC_ARRAY(qv, nq);
+
+	for (i = 0; i < nq; i++) {
+		struct query *q = &qv[i];
+		uint j;
+
+		q->words = 1 + rand31_value(TEST_WORDS - 1);
+		q->urn = 0 == rand31_value(TEST_URNS - 1);
+		for (j = 0; j < N_ITEMS(q->hash); j++) {
+			q->hash[j] = rand31_u32();
+		}
+	}
+
+	return qv;
+}
+
+static double
+time_probing(uint8 * const *maps, size_t members, uint bits,
+	const struct query *qv, size_t nq, size_t *matches)
+{
+	tm_t start, end;
+	size_t i, found = 0;
+	uint shift = 32 - bits;
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < nq; i++) {
+		const struct query *q = &qv[i];
+		uint need = query_need(q->words);
+		size_t m;
+
+		for (m = 0; m < members; m++) {
+			const uint8 *map = maps[m];
+			uint j, hit = 0;
+
+			if (q->urn && bitmap_get(map, q->hash[q->words] >> shift)) {
+				found++;
+				continue;
+			}
+			for (j = 0; j < q->words; j++) {
+				if (bitmap_get(map, q->hash[j] >> shift))
+					hit++;
+			}
+			if (hit >= need)
+				found++;
+		}
+	}
+
+	tm_now_exact(&end);
+	*matches = found;
+
+	return tm_elapsed_f(&end, &start);
+}
+
+static double
+time_slotset(slotset_t *ss, size_t members, uint bits,
+	const struct query *qv, size_t nq, size_t *matches)
+{
+	tm_t start, end;
+	size_t i, found = 0;
+	uint shift = 32 - bits;
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < nq; i++) {
+		const struct query *q = &qv[i];
+		uint32 all[TEST_WORDS], urn;
+		const uint64 *r;
+		uint j;
+		size_t m;
+
+		for (j = 0; j < q->words; j++) {
+			all[j] = q->hash[j] >> shift;
+		}
+		urn = q->hash[q->words] >> shift;
+
+		r = slotset_match(ss, all, q->words, query_need(q->words),
+				&urn, q->urn ? 1 : 0);
+
+		for (m = 0; m < members; m++) {
+			if (slotset_result_has(r, m))
+				found++;
+		}
+	}
+
+	tm_now_exact(&end);
+	*matches = found;
+
+	return tm_elapsed_f(&end, &start);
+}
+
+static void
+timeit(uint bits, size_t members, uint fill, size_t nq)
+{
+	slotset_t *ss = slotset_make(bits);
+	uint8 **maps;
+	struct query *qv;
+	double probing, indexed;
+	size_t pm, im;
+
+	maps = bitmaps_make(ss, bits, members, fill);
+	qv = queries_make(nq);
+
+	probing = time_probing(maps, members, bits, qv, nq, &pm);
+	indexed = time_slotset(ss, members, bits, qv, nq, &im);
+
+	if (pm != im)
+		test_abort("matching members");
+
+	printf("%zu queries routed to %zu members (%u-bit, %u%% filled), "
+		"%zu matches:\n", nq, members, bits, fill, pm);
+	printf("  probing: %.3gs (%.0f queries/s)\n", probing, nq / probing);
+	printf(" slot set: %.3gs (%.0f queries/s), %zu KiB\n",
+		indexed, nq / indexed, slotset_memory(ss) / 1024);
+	fflush(stdout);
+
+	xfree(qv);
+	bitmaps_free(maps, members);
+	slotset_free_null(&ss);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	uint bits = TEST_BITS, fill = TEST_FILL;
+	size_t members = TEST_MEMBERS;
+	size_t nq = TEST_QUERIES;
+	unsigned rseed = 0;
+	const char options[] = "b:f:hm:q:tR:SV";
+	int c;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* log2 of the amount of slots */
+			bits = atoi(optarg);
+			break;
+		case 'f':			/* fill ratio */
+			fill = atoi(optarg);
+			break;
+		case 'm':			/* amount of members */
+			members = atol(optarg);
+			break;
+		case 'q':			/* amount of queries */
+			nq = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (
+		(argc -= optind) != 0 || bits < 3 || bits > 24 ||
+		fill > 100 || 0 == members || 0 == nq
+	)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	test_members(bits);
+	test_match(bits, members, fill);
+
+	if (!silent_mode)
+		printf("slot set - OK\n");
+
+	if (tflag)
+		timeit(bits, members, fill, nq);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
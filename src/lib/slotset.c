@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Slot sets -- transposed bitmap index mapping slots to member sets.
+ *
+ * Given a set of members each owning a bitmap of 2^bits slots, a slot set
+ * records, for each slot, the set of members having that slot set.  It is
+ * the transposition of the members' bitmaps.
+ *
+ * Instead of probing each member's bitmap in turn to determine whether a
+ * list of slots is present, we can then combine the few member sets of
+ * these slots to get the answer for all the members at once.  This is done
+ * one 64-bit word at a time, with simple loops that the compiler can turn
+ * into vector operations.
+ *
+ * Besides plain intersections and unions, slotset_match() can select the
+ * members having at least a given amount of the slots set: the amount of
+ * hits is counted for all the members of a word in parallel, using a
+ * bit-sliced counter (each plane holding one bit of the 64 counters).
+ *
+ * Members are numbered from 0 and allocated compactly, so that the member
+ * sets remain as small as possible.  The member sets are expanded as needed
+ * when more members are allocated, but never shrunk.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "slotset.h"
+#include "halloc.h"
+#include "pow2.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define SLOTSET_MAX_BITS	24		/**< Max log2 of the amount of slots */
+#define SLOTSET_PLANES		8		/**< Bit-sliced counter planes */
+
+enum slotset_magic { SLOTSET_MAGIC = 0x1a7d5e93 };
+
+/**
+ * The slot set.
+ *
+ * The member sets are stored in a single matrix, row ``i'' being the set of
+ * members for slot ``i'', made of ``words'' 64-bit words.
+ */
+struct slotset {
+	enum slotset_magic magic;		/**< Magic number */
+	uint bits;						/**< log2 of the amount of slots */
+	size_t slots;					/**< Amount of slots */
+	size_t words;					/**< Length of member sets, in words */
+	size_t count;					/**< Amount of allocated members */
+	uint64 *matrix;					/**< Member sets, one row per slot */
+	uint64 *used;					/**< Allocated members */
+	uint64 *result;					/**< Set computed by slotset_match() */
+};
+
+static inline void
+slotset_check(const struct slotset * const ss)
+{
+	g_assert(ss != NULL);
+	g_assert(SLOTSET_MAGIC == ss->magic);
+}
+
+#define SLOTSET_WORD(m)		((m) >> 6)
+#define SLOTSET_BIT(m)		((uint64) 1 << ((m) & 0x3f))
+
+static inline uint64 *
+slotset_row(const slotset_t *ss, uint32 slot)
+{
+	return &ss->matrix[slot * ss->words];
+}
+
+/**
+ * @return position of the lowest bit set in a non-zero 64-bit word.
+ */
+static inline uint
+slotset_lowest(uint64 v)
+{
+	uint32 lo = v & 0xffffffffU;
+
+	return 0 != lo ? ctz(lo) : 32 + ctz(v >> 32);
+}
+
+/**
+ * Make a new slot set.
+ *
+ * @param bits		log2 of the amount of slots
+ *
+ * @return new slot set, with no member.
+ */
+slotset_t *
+slotset_make(uint bits)
+{
+	slotset_t *ss;
+
+	g_assert(bits <= SLOTSET_MAX_BITS);
+
+	WALLOC0(ss);
+	ss->magic = SLOTSET_MAGIC;
+	ss->bits = bits;
+	ss->slots = (size_t) 1 << bits;
+
+	return ss;
+}
+
+/**
+ * Free slot set and nullify its pointer.
+ */
+void
+slotset_free_null(slotset_t **ss_ptr)
+{
+	slotset_t *ss = *ss_ptr;
+
+	if (ss != NULL) {
+		slotset_check(ss);
+
+		HFREE_NULL(ss->matrix);
+		HFREE_NULL(ss->used);
+		HFREE_NULL(ss->result);
+		ss->magic = 0;
+		WFREE(ss);
+		*ss_ptr = NULL;
+	}
+}
+
+/**
+ * @return log2 of the amount of slots.
+ */
+uint
+slotset_bits(const slotset_t *ss)
+{
+	slotset_check(ss);
+
+	return ss->bits;
+}
+
+/**
+ * @return amount of allocated members.
+ */
+size_t
+slotset_members(const slotset_t *ss)
+{
+	slotset_check(ss);
+
+	return ss->count;
+}
+
+/**
+ * @return amount of memory used by the slot set, in bytes.
+ */
+size_t
+slotset_memory(const slotset_t *ss)
+{
+	slotset_check(ss);
+
+	return sizeof *ss + (ss->slots + 2) * ss->words * sizeof(uint64);
+}
+
+/**
+ * Expand the member sets by one word.
+ *
+ * Since every slot holds a member set, this is a costly operation but
+ * growing linearly keeps the memory footprint as low as possible.  It only
+ * happens when the amount of members crosses a multiple of 64.
+ */
+static void
+slotset_expand(slotset_t *ss)
+{
+	size_t i, words = ss->words + 1;
+	uint64 *matrix;
+
+	matrix = halloc0(ss->slots * words * sizeof matrix[0]);
+
+	if (ss->matrix != NULL) {
+		for (i = 0; i < ss->slots; i++) {
+			memcpy(&matrix[i * words], slotset_row(ss, i),
+				ss->words * sizeof matrix[0]);
+		}
+		hfree(ss->matrix);
+	}
+
+	ss->matrix = matrix;
+	ss->used = hrealloc(ss->used, words * sizeof ss->used[0]);
+	ss->result = hrealloc(ss->result, words * sizeof ss->result[0]);
+	memset(&ss->used[ss->words], 0,
+		(words - ss->words) * sizeof ss->used[0]);
+	ss->words = words;
+}
+
+/**
+ * Allocate a new member, initially absent from all the slots.
+ *
+ * @return the lowest member number available.
+ */
+uint
+slotset_member_alloc(slotset_t *ss)
+{
+	size_t i;
+	uint m;
+
+	slotset_check(ss);
+
+	if (ss->count == ss->words * 64)
+		slotset_expand(ss);
+
+	for (i = 0; i < ss->words; i++) {
+		if (ss->used[i] != MAX_INT_VAL(uint64))
+			break;
+	}
+
+	g_assert(i < ss->words);
+
+	m = i * 64 + slotset_lowest(~ss->used[i]);
+	ss->used[i] |= SLOTSET_BIT(m);
+	ss->count++;
+
+	return m;
+}
+
+/**
+ * Free member, removing it from all the slots.
+ */
+void
+slotset_member_free(slotset_t *ss, uint m)
+{
+	size_t i, w = SLOTSET_WORD(m);
+	uint64 mask = ~SLOTSET_BIT(m);
+
+	slotset_check(ss);
+	g_assert(w < ss->words);
+	g_assert(0 != (ss->used[w] & SLOTSET_BIT(m)));
+
+	for (i = 0; i < ss->slots; i++) {
+		slotset_row(ss, i)[w] &= mask;
+	}
+
+	ss->used[w] &= mask;
+	ss->count--;
+}
+
+/**
+ * Record member ``m'' as having slot ``slot'' set.
+ */
+void
+slotset_add(slotset_t *ss, uint32 slot, uint m)
+{
+	slotset_check(ss);
+	g_assert(slot < ss->slots);
+	g_assert(SLOTSET_WORD(m) < ss->words);
+
+	slotset_row(ss, slot)[SLOTSET_WORD(m)] |= SLOTSET_BIT(m);
+}
+
+/**
+ * Record member ``m'' as no longer having slot ``slot'' set.
+ */
+void
+slotset_remove(slotset_t *ss, uint32 slot, uint m)
+{
+	slotset_check(ss);
+	g_assert(slot < ss->slots);
+	g_assert(SLOTSET_WORD(m) < ss->words);
+
+	slotset_row(ss, slot)[SLOTSET_WORD(m)] &= ~SLOTSET_BIT(m);
+}
+
+/**
+ * @return whether member ``m'' has slot ``slot'' set.
+ */
+bool
+slotset_contains(const slotset_t *ss, uint32 slot, uint m)
+{
+	slotset_check(ss);
+	g_assert(slot < ss->slots);
+	g_assert(SLOTSET_WORD(m) < ss->words);
+
+	return slotset_result_has(slotset_row(ss, slot), m);
+}
+
+/**
+ * Compute, for each word of the member sets, the members which are present
+ * in at least ``need'' of the ``n'' rows, with 1 < need < n.
+ */
+static void
+slotset_threshold(const slotset_t *ss,
+	const uint64 **rows, uint n, uint need, uint64 *r)
+{
+	uint planes = highest_bit_set(n) + 1;
+	size_t w;
+
+	g_assert(planes <= SLOTSET_PLANES);
+
+	for (w = 0; w < ss->words; w++) {
+		uint64 c[SLOTSET_PLANES], ge = 0, eq = MAX_INT_VAL(uint64);
+		uint i, p;
+
+		ZERO(&c);
+
+		/*
+		 * Add each row to the 64 counters held in the planes, propagating
+		 * the carries from plane to plane.
+		 */
+
+		for (i = 0; i < n; i++) {
+			uint64 x = rows[i][w];
+
+			for (p = 0; x != 0 && p < planes; p++) {
+				uint64 carry = c[p] & x;
+				c[p] ^= x;
+				x = carry;
+			}
+		}
+
+		/*
+		 * Compare all the counters with ``need'', from the most
+		 * significant plane downwards: ``eq'' tracks the counters equal
+		 * to ``need'' so far, ``ge'' the ones known to be greater.
+		 */
+
+		p = planes;
+		while (p-- > 0) {
+			if (need & (1U << p)) {
+				eq &= c[p];
+			} else {
+				ge |= eq & c[p];
+				eq &= ~c[p];
+			}
+		}
+
+		r[w] = ge | eq;
+	}
+}
+
+/**
+ * Compute the set of members which have at least ``need'' of the slots
+ * listed in ``all'' set, or any of the slots listed in ``any''.
+ *
+ * When ``n'' is 0, only the ``any'' slots are considered.  Slots may be
+ * listed more than once, each occurrence counting as a hit.
+ *
+ * @param ss		the slot set
+ * @param all		the slots to count (may be NULL if ``n'' is 0)
+ * @param n			amount of slots in ``all''
+ * @param need		amount of ``all'' slots to have at least
+ * @param any		the slots of which one is sufficient (NULL if ``an'' is 0)
+ * @param an		amount of slots in ``any''
+ *
+ * @return the set of matching members, to be probed with slotset_result_has()
+ * and which remains valid until the next call or member allocation.
+ */
+const uint64 *
+slotset_match(slotset_t *ss,
+	const uint32 *all, uint n, uint need, const uint32 *any, uint an)
+{
+	const uint64 *rows[SLOTSET_MAX_HITS];
+	uint64 *r = ss->result;
+	size_t w, words = ss->words;
+	uint i;
+
+	slotset_check(ss);
+	g_assert(n <= SLOTSET_MAX_HITS);
+	g_assert(0 == n || all != NULL);
+	g_assert(0 == an || any != NULL);
+
+	if G_UNLIKELY(0 == words)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		g_assert(all[i] < ss->slots);
+		rows[i] = slotset_row(ss, all[i]);
+	}
+
+	if (0 == n || need > n) {
+		memset(r, 0, words * sizeof r[0]);
+	} else if (0 == need) {
+		memcpy(r, ss->used, words * sizeof r[0]);
+	} else if (need == n) {
+		memcpy(r, rows[0], words * sizeof r[0]);
+		for (i = 1; i < n; i++) {
+			const uint64 *row = rows[i];
+			for (w = 0; w < words; w++)
+				r[w] &= row[w];
+		}
+	} else if (1 == need) {
+		memcpy(r, rows[0], words * sizeof r[0]);
+		for (i = 1; i < n; i++) {
+			const uint64 *row = rows[i];
+			for (w = 0; w < words; w++)
+				r[w] |= row[w];
+		}
+	} else {
+		slotset_threshold(ss, rows, n, need, r);
+	}
+
+	for (i = 0; i < an; i++) {
+		const uint64 *row;
+
+		g_assert(any[i] < ss->slots);
+
+		row = slotset_row(ss, any[i]);
+		for (w = 0; w < words; w++)
+			r[w] |= row[w];
+	}
+
+	return r;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
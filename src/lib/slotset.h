@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Slot sets -- transposed bitmap index mapping slots to member sets.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _slotset_h_
+#define _slotset_h_
+
+#include "common.h"
+
+#define SLOTSET_MAX_HITS	MAX_INT_VAL(uint8)	/**< Max slots per match */
+
+typedef struct slotset slotset_t;
+
+/**
+ * Check whether member is part of a slotset_match() result.
+ *
+ * @param set		the result of slotset_match()
+ * @param m			the member number
+ */
+static inline bool
+slotset_result_has(const uint64 *set, uint m)
+{
+	return 0 != (set[m >> 6] & ((uint64) 1 << (m & 0x3f)));
+}
+
+/*
+ * Public interface.
+ */
+
+slotset_t *slotset_make(uint bits);
+void slotset_free_null(slotset_t **ss_ptr);
+
+uint slotset_bits(const slotset_t *ss);
+size_t slotset_members(const slotset_t *ss);
+size_t slotset_memory(const slotset_t *ss);
+
+uint slotset_member_alloc(slotset_t *ss);
+void slotset_member_free(slotset_t *ss, uint m);
+
+void slotset_add(slotset_t *ss, uint32 slot, uint m);
+void slotset_remove(slotset_t *ss, uint32 slot, uint m);
+bool slotset_contains(const slotset_t *ss, uint32 slot, uint m);
+
+const uint64 *slotset_match(slotset_t *ss,
+	const uint32 *all, uint n, uint need, const uint32 *any, uint an);
+
+#endif /* _slotset_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
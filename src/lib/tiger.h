@@ -36,8 +36,12 @@
 
 #include "common.h"
 
+#define TIGER_LANES		4	/**< Messages hashed at once by tiger_lanes() */
+
 void tiger_check(void);
 void tiger(const void *data, uint64 length, char hash[24]);
+void tiger_lanes(const void *data[TIGER_LANES], uint64 length,
+	char *hash[TIGER_LANES]);
 
 #endif /* _tiger_h_ */
 /* vi: set ts=4 sw=4 cindent: */
@@ -108,10 +108,11 @@ struct TTH_CONTEXT {
 	unsigned depth;			/* current tree depth */
 	unsigned good_depth;	/* the desired depth of the final leaves */
 	unsigned flags;
+	unsigned lane;			/* current leaf block being filled */
 	union {
 		uint64 u64;	/* Better alignment */
 		char bytes[TTH_BLOCKSIZE + 1];
-	} block;
+	} block[TIGER_LANES];	/* leaf blocks, hashed TIGER_LANES at a time */
 	struct tth stack[56];
 	struct tth leaves[TTH_MAX_LEAVES];
 };
@@ -225,17 +226,28 @@ tt_blocks_per_leaf(filesize_t filesize)
 	return n_bpl;
 }
 
+/**
+ * Message hashed to compute an internal node from its two children.
+ */
+union tt_node {
+	uint64 u64;	/* Better alignment */
+	char bytes[TIGERSIZE * 2 + 1];
+};
+
+static inline void
+tt_node_fill(union tt_node *node, const struct tth *a, const struct tth *b)
+{
+	node->bytes[0] = 0x01;
+	memcpy(&node->bytes[1 + 0 * TIGERSIZE], a, TIGERSIZE);
+	memcpy(&node->bytes[1 + 1 * TIGERSIZE], b, TIGERSIZE);
+}
+
 static void
 tt_internal_hash(const struct tth *a, const struct tth *b, struct tth *dst)
 {
-	union {
-		uint64 u64;	/* Better alignment */
-		char bytes[TIGERSIZE * 2 + 1];
-	} buf;
+	union tt_node buf;
 
-	buf.bytes[0] = 0x01;
-	memcpy(&buf.bytes[1 + 0 * TIGERSIZE], a, TIGERSIZE);
-	memcpy(&buf.bytes[1 + 1 * TIGERSIZE], b, TIGERSIZE);
+	tt_node_fill(&buf, a, b);
 	tiger(buf.bytes, sizeof buf.bytes, dst->data);
 }
 
@@ -271,19 +283,20 @@ tt_collapse(TTH_CONTEXT *ctx)
 	}
 }
 
+/**
+ * Record new leaf block hash, which has been stored in the stack.
+ */
 static void
-tt_block(TTH_CONTEXT *ctx)
+tt_leaf(TTH_CONTEXT *ctx)
 {
 	g_assert(ctx);
+	g_assert(ctx->si < N_ITEMS(ctx->stack));
 
-	tiger(ctx->block.bytes, ctx->block_fill, ctx->stack[ctx->si].data);
 	if (ctx->bpl == 1) {
 		ctx->leaves[ctx->li] = ctx->stack[ctx->si];
 		ctx->li++;
 	}
 
-	ctx->block_fill = 1;
-
 	ctx->si++;
 	ctx->n++;
 
@@ -294,11 +307,67 @@ tt_block(TTH_CONTEXT *ctx)
 	tt_collapse(ctx);
 }
 
+/**
+ * Hash the first ``count'' leaf blocks, which must be complete except the
+ * last one, which can be partially filled.
+ */
+static void
+tt_block(TTH_CONTEXT *ctx, unsigned count)
+{
+	unsigned i;
+
+	g_assert(ctx);
+	g_assert(count <= N_ITEMS(ctx->block));
+
+	if (TIGER_LANES == count && sizeof ctx->block[0].bytes == ctx->block_fill) {
+		const void *data[TIGER_LANES];
+		struct tth hash[TIGER_LANES];
+		char *hp[TIGER_LANES];
+
+		/*
+		 * Leaves are independent, hash them all at once.
+		 */
+
+		for (i = 0; i < TIGER_LANES; i++) {
+			data[i] = ctx->block[i].bytes;
+			hp[i] = hash[i].data;
+		}
+
+		tiger_lanes(data, sizeof ctx->block[0].bytes, hp);
+
+		for (i = 0; i < TIGER_LANES; i++) {
+			ctx->stack[ctx->si] = hash[i];
+			tt_leaf(ctx);
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			size_t len = i + 1 == count ?
+				ctx->block_fill : sizeof ctx->block[i].bytes;
+
+			tiger(ctx->block[i].bytes, len, ctx->stack[ctx->si].data);
+			tt_leaf(ctx);
+		}
+	}
+
+	ctx->lane = 0;
+	ctx->block_fill = 1;
+}
+
 static void
 tt_finish(TTH_CONTEXT *ctx)
 {
-	if (0 == ctx->n || ctx->block_fill > 1) {
-		tt_block(ctx);
+	/*
+	 * Hash the pending complete leaves, plus the last partial one if any.
+	 * When the file is empty, we still need to hash the empty leaf.
+	 */
+
+	if (0 == ctx->n || ctx->block_fill > 1 || ctx->lane != 0) {
+		if (ctx->block_fill > 1 || 0 == ctx->lane) {
+			tt_block(ctx, ctx->lane + 1);
+		} else {
+			ctx->block_fill = sizeof ctx->block[0].bytes;
+			tt_block(ctx, ctx->lane);
+		}
 	}
 
 	if (ctx->bpl > 1) {
@@ -340,7 +409,34 @@ tt_compute_parents(struct tth *dst, const struct tth *src, size_t src_leaves)
 	size_t i, n;
 
 	n = src_leaves / 2;
-	for (i = 0; i < n; i++) {
+
+	/*
+	 * Parents are computed TIGER_LANES at a time.  Since ``dst'' and ``src''
+	 * can be the same array, all the children of a batch are read before
+	 * the parents are written.
+	 */
+
+	for (i = 0; i + TIGER_LANES <= n; i += TIGER_LANES) {
+		union tt_node node[TIGER_LANES];
+		const void *data[TIGER_LANES];
+		struct tth hash[TIGER_LANES];
+		char *hp[TIGER_LANES];
+		unsigned j;
+
+		for (j = 0; j < TIGER_LANES; j++) {
+			tt_node_fill(&node[j], &src[(i + j) * 2], &src[(i + j) * 2 + 1]);
+			data[j] = node[j].bytes;
+			hp[j] = hash[j].data;
+		}
+
+		tiger_lanes(data, sizeof node[0].bytes, hp);
+
+		for (j = 0; j < TIGER_LANES; j++) {
+			dst[i + j] = hash[j];
+		}
+	}
+
+	for (/* empty */; i < n; i++) {
 		tt_internal_hash(&src[i * 2], &src[i * 2 + 1], &dst[i]);
 	}
 	if (src_leaves & 1) {
@@ -375,10 +471,15 @@ tt_root_hash(const struct tth *src, size_t n_leaves)
 void
 tt_init(TTH_CONTEXT *ctx, filesize_t filesize)
 {
+	unsigned i;
+
 	g_assert(ctx);
 
 	ctx->block_fill = 1;
-	ctx->block.bytes[0] = 0x00;
+	ctx->lane = 0;
+	for (i = 0; i < N_ITEMS(ctx->block); i++) {
+		ctx->block[i].bytes[0] = 0x00;
+	}
 	ctx->si = 0;
 	ctx->li = 0;
 	ctx->n = 0;
@@ -399,16 +500,24 @@ tt_update(TTH_CONTEXT *ctx, const void *data, size_t size)
 	g_assert(size == 0 || NULL != data);
 
 	while (size > 0) {
-		size_t n = sizeof ctx->block.bytes - ctx->block_fill;
+		size_t n = sizeof ctx->block[0].bytes - ctx->block_fill;
 
 		n = MIN(n, size);
-		memmove(&ctx->block.bytes[ctx->block_fill], block, n);
+		memmove(&ctx->block[ctx->lane].bytes[ctx->block_fill], block, n);
 		ctx->block_fill += n;
 		block += n;
 		size -= n;
 
-		if (sizeof ctx->block.bytes == ctx->block_fill) {
-			tt_block(ctx);
+		/*
+		 * Complete leaves are hashed TIGER_LANES at a time.
+		 */
+
+		if (sizeof ctx->block[0].bytes == ctx->block_fill) {
+			if (TIGER_LANES == ++ctx->lane) {
+				tt_block(ctx, TIGER_LANES);
+			} else {
+				ctx->block_fill = 1;
+			}
 		}
 	}
 }
@@ -97,9 +97,11 @@
 #include "core/tsync.h"
 #include "core/tx.h"
 #include "core/udp.h"
+#include "core/udp_ingress.h"
 #include "core/uhc.h"
 #include "core/upload_stats.h"
 #include "core/urpc.h"
+#include "core/verify_huge.h"
 #include "core/verify_sha1.h"
 #include "core/verify_tth.h"
 #include "core/version.h"
@@ -714,6 +716,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(upload_stats_close);
 	DO(parq_close_pre);
 	DO(verify_sha1_close);
+	DO(verify_huge_shutdown);
 	DO(verify_tth_shutdown);
 	DO(download_close);
 	DO(file_info_store_if_dirty);	/* In case downloads had buffered data */
@@ -929,6 +932,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(g2_node_close);
 	DO(share_close);	/* After node_close() */
 	DO(udp_close);
+	DO(udp_ingress_close);
 	DO(urpc_close);
 	DO(g2_rpc_close);
 	DO(routing_close);	/* After node_close() */
@@ -967,7 +971,6 @@ gtk_gnutella_exit(int exit_code)
 	DO(tls_global_close);
 	DO(misc_close);
 	DO(mingw_close);
-	DO(verify_tth_close);
 	DO(inputevt_close);
 	DO(locale_close);
 	DO(wq_close);
@@ -2498,6 +2501,7 @@ main(int argc, char **argv)
 	ghc_init();
 	gwc_init();
 	verify_sha1_init();
+	verify_huge_init();
 	verify_tth_init();
 	move_init();
 	ignore_init();
@@ -30,6 +30,7 @@
 #include "lib/pow2.h"
 #include "lib/stringify.h"
 #include "lib/unsigned.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -93,6 +94,12 @@ struct DBMBIG {
 	ulong bigwrite;			/* stats: amount of big data write syscalls */
 	ulong bigread_blk;		/* stats: amount of big data blocks read */
 	ulong bigwrite_blk;		/* stats: amount of big data blocks written */
+#ifdef MMAP
+	char *map;				/* memory-mapped .dat file, NULL if none */
+	size_t maplen;			/* length of the mapping */
+	ulong bigmapped_blk;	/* stats: amount of big data blocks mapped */
+	uint8 mapped;			/* whether to read from a memory mapping */
+#endif
 	uint8 bitbuf_dirty;		/* whether bitbuf needs flushing to disk */
 };
 
@@ -166,8 +173,94 @@ log_bigstats(DBM *db)
 	g_info("sdbm: \"%s\" big blocks written = %lu (%lu system call%s)",
 		sdbm_name(db),
 		dbg->bigwrite_blk, dbg->bigwrite, plural(dbg->bigwrite));
+#ifdef MMAP
+	if (dbg->mapped) {
+		g_info("sdbm: \"%s\" big blocks copied from mapping = %lu",
+			sdbm_name(db), dbg->bigmapped_blk);
+	}
+#endif
 }
 
+#ifdef MMAP
+/**
+ * Discard the memory mapping of the .dat file, if any.
+ */
+static void
+big_unmap(DBMBIG *dbg)
+{
+	if (dbg->map != NULL) {
+		vmm_munmap(dbg->map, dbg->maplen);
+		dbg->map = NULL;
+		dbg->maplen = 0;
+	}
+}
+
+/**
+ * Copy data from the memory-mapped .dat file, mapping it again if it grew.
+ *
+ * @return TRUE if data was copied, FALSE if it must be read from the file.
+ */
+static bool
+big_mapread(DBM *db, char *dest, size_t len, fileoffset_t off)
+{
+	DBMBIG *dbg = db->big;
+
+	if (!dbg->mapped)
+		return FALSE;
+
+	if (UNSIGNED(off) + len > dbg->maplen) {
+		filestat_t buf;
+		void *p;
+
+		if (-1 == fstat(dbg->fd, &buf))
+			return FALSE;
+
+		if (
+			UNSIGNED(buf.st_size) < UNSIGNED(off) + len ||
+			buf.st_size > (fileoffset_t) MAX_INT_VAL(ssize_t)
+		)
+			return FALSE;
+
+		p = vmm_mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, dbg->fd, 0);
+
+		if G_UNLIKELY(MAP_FAILED == p) {
+			s_warning("sdbm: \"%s\": cannot map %zu bytes of .dat file: %m",
+				sdbm_name(db), (size_t) buf.st_size);
+			dbg->mapped = FALSE;
+			return FALSE;
+		}
+
+		big_unmap(dbg);
+		dbg->map = p;
+		dbg->maplen = buf.st_size;
+	}
+
+	memcpy(dest, dbg->map + off, len);
+	dbg->bigmapped_blk += bigblocks(len);
+
+	return TRUE;
+}
+
+/**
+ * Turn reading of the .dat file through a memory mapping on or off.
+ */
+void
+big_set_mmap(DBM *db, bool on)
+{
+	DBMBIG *dbg = db->big;
+
+	if (NULL == dbg)
+		return;
+
+	sdbm_big_check(dbg);
+
+	if (!on)
+		big_unmap(dbg);
+
+	dbg->mapped = booleanize(on);
+}
+#endif	/* MMAP */
+
 /**
  * Allocate a new descriptor for managing large keys and values.
  */
@@ -202,6 +295,9 @@ big_close(DBM *db)
 	if (-1 == dbg->fd)
 		return FALSE;
 
+#ifdef MMAP
+	big_unmap(dbg);
+#endif
 	fd_forget_and_close(&dbg->fd);
 	return TRUE;
 }
@@ -244,6 +340,9 @@ big_free(DBM *db)
 	WFREE_NULL(dbg->bitbuf, BIG_BLKSIZE);
 	HFREE_NULL(dbg->bitcheck);
 	HFREE_NULL(dbg->scratch);
+#ifdef MMAP
+	big_unmap(dbg);
+#endif
 	fd_forget_and_close(&dbg->fd);
 	dbg->magic = 0;
 	WFREE(dbg);
@@ -803,6 +902,11 @@ big_fetch(DBM *db, const void *bvec, size_t len)
 			remain = size_saturate_sub(remain, amount);
 		}
 
+#ifdef MMAP
+		if (big_mapread(db, q, toread, OFF_DAT(bno)))
+			goto copied;
+#endif
+
 		dbg->bigread++;
 		if (-1 == compat_pread(dbg->fd, q, toread, OFF_DAT(bno))) {
 			s_critical("sdbm: \"%s\": "
@@ -813,6 +917,9 @@ big_fetch(DBM *db, const void *bvec, size_t len)
 			return -1;
 		}
 
+#ifdef MMAP
+	copied:
+#endif
 		q += toread;
 		dbg->bigread_blk += bigblocks(toread);
 		g_assert(UNSIGNED(q - dbg->scratch) <= dbg->scratch_len);
@@ -1815,6 +1922,10 @@ big_shrink(DBM *db)
 		}
 	}
 
+#ifdef MMAP
+	big_unmap(dbg);			/* Mapped blocks beyond the end would fault */
+#endif
+
 	if (-1 == ftruncate(dbg->fd, offset))
 		return FALSE;
 
@@ -1853,6 +1964,10 @@ big_clear(DBM *db)
 
 	g_assert(dbg->fd != -1);
 
+#ifdef MMAP
+	big_unmap(dbg);
+#endif
+
 	if (-1 == fd_forget_and_close(&dbg->fd))
 		return FALSE;
 
@@ -25,6 +25,7 @@
 #define bigkey_mark_used sdbm__bigkey_mark_used
 #define bigval_mark_used sdbm__bigval_mark_used
 #define big_check_end sdbm__big_check_end
+#define big_set_mmap sdbm__big_set_mmap
 
 typedef struct DBMBIG DBMBIG;
 
@@ -44,6 +45,7 @@ bool big_clear(DBM *);
 bool big_close(DBM *);
 int big_reopen(DBM *);
 size_t big_check_end(DBM *, bool);
+void big_set_mmap(DBM *, bool);
 bool bigkey_put(DBM *, char *, size_t, const char *, size_t);
 bool bigval_put(DBM *, char *, size_t, const char *, size_t);
 bool bigkey_free(DBM *, const char *, size_t);
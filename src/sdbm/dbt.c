@@ -47,6 +47,7 @@ static bool shrink, rebuild, thread_safe;
 static bool randomize;
 static unsigned rseed;
 static bool unlink_db;
+static bool wal;
 static bool large_keys, large_values, common_head_tail;
 
 #define WR_DELAY	(1 << 0)
@@ -58,7 +59,7 @@ static void G_NORETURN
 usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-bdeiikprstvwBDEKSTUV] [-R seed] [-c pages] dbname count\n"
+		"Usage: %s [-bdeiikprstvwBDEKLSTUV] [-R seed] [-c pages] dbname count\n"
 		"  -b : rebuild the database\n"
 		"  -c : set LRU cache size\n"
 		"  -d : perform delete test\n"
@@ -75,6 +76,7 @@ usage(void)
 		"  -D : enable LRU cache write delay\n"
 		"  -E : empty existing database on write test\n"
 		"  -K : use large keys with common head/tail parts\n"
+		"  -L : enable the write-ahead log on writable databases\n"
 		"  -R : seed for repeatable random key sequence\n"
 		"  -S : shrink database before testing\n"
 		"  -T : make database handle thread-safe\n"
@@ -118,6 +120,12 @@ open_db(const char *name, bool writeable, long cache, int wflags)
 		oops("error %sabling write delay for \"%s\"",
 			(wflags & WR_DELAY) ? "en" : "dis", name);
 	}
+	/* With enough keys, splits span several dir blocks between commits */
+	if (wal && flags != O_RDONLY) {
+		if (-1 == sdbm_set_wal(db, TRUE)) {
+			oops("error enabling write-ahead log for \"%s\"", name);
+		}
+	}
 	if (shrink)
 		sdbm_shrink(db);
 	if (rebuild) {
@@ -437,7 +445,7 @@ main(int argc, char **argv)
 
 	progstart(argc, argv);
 
-	while ((c = getopt(argc, argv, "bBc:dDeEikKprR:sStTUvVw")) != EOF) {
+	while ((c = getopt(argc, argv, "bBc:dDeEikKLprR:sStTUvVw")) != EOF) {
 		switch (c) {
 		case 'B':			/* rebuild before testing */
 			rebuild++;
@@ -470,6 +478,9 @@ main(int argc, char **argv)
 			large_keys++;
 			common_head_tail++;
 			break;
+		case 'L':			/* write-ahead log */
+			wal++;
+			break;
 		case 'p':			/* show test progress */
 			progress++;
 			break;
@@ -532,6 +543,9 @@ main(int argc, char **argv)
 	if (thread_safe)
 		printf("Database handle will be opened in thread-safe mode.\n");
 
+	if (wal)
+		printf("Updates will go through the write-ahead log.\n");
+
 	if (large_keys)
 		printf("Will be using large keys%s.\n",
 			common_head_tail ? " with zeroed first and last 4 bytes" : "");
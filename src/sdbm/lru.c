@@ -17,10 +17,13 @@
 #include "tune.h"
 #include "lru.h"
 #include "private.h"
+#include "wal.h"
 
+#include "lib/bit_array.h"
 #include "lib/compat_pio.h"
 #include "lib/debug.h"
 #include "lib/fd.h"
+#include "lib/halloc.h"
 #include "lib/hashlist.h"
 #include "lib/htable.h"
 #include "lib/log.h"
@@ -53,6 +56,17 @@ struct lru_cache {
 	unsigned long rmisses;		/* Stats: amount of cache misses on reads */
 	unsigned long whits;		/* Stats: amount of cache hits on writes */
 	unsigned long wmisses;		/* Stats: amount of cache misses on writes */
+#ifdef MMAP
+	char *map;					/* Memory-mapped .pag file, NULL if none */
+	size_t maplen;				/* Length of the mapping */
+	long mappages;				/* Amount of pages in the mapping */
+	bit_array_t *touched;		/* System pages of the mapping accessed */
+	int mmap_mode;				/* How mapping is used (DBM_MMAP_*) */
+	unsigned long mhits;		/* Stats: page reads served by the mapping */
+	unsigned long mcopies;		/* Stats: mapped pages loaded for writing */
+	unsigned long mfaults;		/* Stats: first access to mapped system pages */
+	unsigned long mremaps;		/* Stats: amount of mappings made */
+#endif
 };
 
 static inline void
@@ -150,6 +164,22 @@ log_lrustats(DBM *db)
 	s_info("sdbm: \"%s\" LRU write cache hits = %.2f%% on %lu request%s",
 		sdbm_name(db), cache->whits * 100.0 / MAX(waccesses, 1), waccesses,
 		plural(waccesses));
+#ifdef MMAP
+	if (cache->mmap_mode != DBM_MMAP_NONE) {
+		unsigned long maccesses = raccesses + cache->mhits;
+
+		s_info("sdbm: \"%s\" mmap %s reads = %.2f%% on %lu request%s "
+			"(%lu page%s loaded for writing, %lu mapping%s)",
+			sdbm_name(db),
+			DBM_MMAP_COW == cache->mmap_mode ? "copy-on-write" : "read-only",
+			cache->mhits * 100.0 / MAX(maccesses, 1), maccesses,
+			plural(maccesses), cache->mcopies, plural(cache->mcopies),
+			cache->mremaps, plural(cache->mremaps));
+		s_info("sdbm: \"%s\" mmap page faults = %lu (first access to "
+			"each mapped system page)",
+			sdbm_name(db), cache->mfaults);
+	}
+#endif
 }
 
 /**
@@ -374,6 +404,9 @@ lru_close(DBM *db)
 		if (common_stats)
 			log_lrustats(db);
 
+#ifdef MMAP
+		lru_unmap(db);
+#endif
 		free_cache(cache);
 		cache->magic = 0;
 		WFREE(cache);
@@ -417,6 +450,10 @@ dirtypag(DBM *db, bool force)
 
 	if (flushpag(db, db->pagbuf, db->pagbno)) {
 		cache->dirty[n] = FALSE;
+#ifdef WAL
+		if (wal_enabled(db))
+			return TRUE;	/* Durability handled by the group commit */
+#endif
 		if G_UNLIKELY(force)
 			fd_fdatasync(db->pagf);
 		return TRUE;
@@ -721,6 +758,224 @@ readbuf(DBM *db, long num, bool *loaded)
 	return TRUE;
 }
 
+#ifdef MMAP
+/**
+ * Discard the memory mapping of the .pag file, if any.
+ *
+ * This must be called before the file is truncated, since accessing pages
+ * mapped beyond the end of the file would fault.
+ */
+void
+lru_unmap(DBM *db)
+{
+	struct lru_cache *cache = db->cache;
+
+	if (NULL == cache || NULL == cache->map)
+		return;
+
+	sdbm_lru_check(cache);
+
+	if (db->pagbuf >= cache->map && db->pagbuf < cache->map + cache->maplen) {
+		db->pagbuf = NULL;
+		db->pagbno = -1;
+	}
+
+	vmm_munmap(cache->map, cache->maplen);
+	HFREE_NULL(cache->touched);
+	cache->map = NULL;
+	cache->maplen = 0;
+	cache->mappages = 0;
+}
+
+/**
+ * Map the .pag file again if it grew enough to now hold the page.
+ *
+ * @return TRUE if the page is now mapped.
+ */
+static bool
+lru_remap(DBM *db, long num)
+{
+	struct lru_cache *cache = db->cache;
+	filestat_t buf;
+	size_t len;
+	void *p;
+
+	if (-1 == fstat(db->pagf, &buf))
+		return FALSE;
+
+	if (
+		buf.st_size < OFF_PAG(num + 1) ||
+		buf.st_size > (fileoffset_t) MAX_INT_VAL(ssize_t)
+	)
+		return FALSE;
+
+	len = buf.st_size - buf.st_size % DBM_PBLKSIZ;
+	p = vmm_mmap(NULL, len, PROT_READ, MAP_SHARED, db->pagf, 0);
+
+	if G_UNLIKELY(MAP_FAILED == p) {
+		s_warning("sdbm: \"%s\": cannot map %zu bytes: %m",
+			sdbm_name(db), len);
+		return FALSE;
+	}
+
+	lru_unmap(db);
+
+	cache->map = p;
+	cache->maplen = len;
+	cache->mappages = len / DBM_PBLKSIZ;
+	cache->touched =
+		halloc0(BIT_ARRAY_BYTE_SIZE(len / compat_pagesize() + 1));
+	cache->mremaps++;
+
+	vmm_madvise_normal(p, len);
+
+	return TRUE;
+}
+
+/**
+ * Point db->pagbuf to the page in the memory-mapped .pag file, for reading.
+ *
+ * Pages held in the LRU cache take precedence since they can be dirty, and
+ * pages beyond the end of the file are not mapped.
+ *
+ * @return TRUE if db->pagbuf now points to the mapped page.
+ */
+bool
+lru_mapbuf(DBM *db, long num)
+{
+	struct lru_cache *cache = db->cache;
+	size_t spage;
+
+	sdbm_lru_check(cache);
+	g_assert(num >= 0);
+
+	if (DBM_MMAP_NONE == cache->mmap_mode)
+		return FALSE;
+
+	if (htable_contains(cache->pagnum, ulong_to_pointer(num)))
+		return FALSE;
+
+	if (num >= cache->mappages && !lru_remap(db, num))
+		return FALSE;
+
+	db->pagbuf = cache->map + OFF_PAG(num);
+	cache->mhits++;
+
+	/*
+	 * The first access to each system page of a fresh mapping will fault,
+	 * which is what we count here: the kernel may also reclaim pages later
+	 * on, so this is a lower bound.
+	 */
+
+	spage = OFF_PAG(num) / compat_pagesize();
+
+	if (!bit_array_get(cache->touched, spage)) {
+		bit_array_set(cache->touched, spage);
+		cache->mfaults++;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Make sure db->pagbuf can be modified.
+ *
+ * When the current page is read from the memory-mapped .pag file, it is
+ * loaded into the LRU cache: copied from the mapping in DBM_MMAP_COW mode,
+ * read again from the file in DBM_MMAP_RDONLY mode.
+ *
+ * @return TRUE on success.
+ */
+bool
+lru_own(DBM *db)
+{
+	struct lru_cache *cache = db->cache;
+	const char *pag = db->pagbuf;
+	long num = db->pagbno;
+	bool loaded;
+
+	if (
+		NULL == cache || NULL == cache->map ||
+		pag < cache->map || pag >= cache->map + cache->maplen
+	)
+		return TRUE;
+
+	sdbm_lru_check(cache);
+	g_assert(num >= 0);
+	g_assert(pag == cache->map + OFF_PAG(num));
+
+	if (!readbuf(db, num, &loaded))
+		return FALSE;
+
+	if (loaded)
+		return TRUE;
+
+	cache->mcopies++;
+
+	if (DBM_MMAP_COW == cache->mmap_mode) {
+		memcpy(db->pagbuf, pag, DBM_PBLKSIZ);
+	} else {
+		ssize_t got;
+
+		db->pagread++;
+		got = compat_pread(db->pagf, db->pagbuf, DBM_PBLKSIZ, OFF_PAG(num));
+
+		if G_UNLIKELY(got != DBM_PBLKSIZ) {
+			s_critical("sdbm: \"%s\": cannot read page #%ld: %s",
+				sdbm_name(db), num,
+				-1 == got ? g_strerror(errno) : "partial read");
+			lru_invalidate(db, num);
+			db->pagbno = -1;
+			ioerr(db, FALSE);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Configure how the memory-mapped .pag file is used.
+ * @return 0 if OK, -1 on failure with errno set.
+ */
+int
+setmmap(DBM *db, int mode)
+{
+	struct lru_cache *cache = db->cache;
+
+	if (mode < DBM_MMAP_NONE || mode > DBM_MMAP_COW) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (NULL == cache) {
+		if (-1 == init_cache(db, LRU_PAGES, FALSE))
+			return -1;
+		cache = db->cache;
+	}
+
+	sdbm_lru_check(cache);
+
+	if (mode != cache->mmap_mode) {
+		lru_unmap(db);				/* Mapping created on next access */
+		cache->mmap_mode = mode;
+	}
+
+	return 0;
+}
+
+/**
+ * @return how the memory-mapped .pag file is used (DBM_MMAP_*).
+ */
+int
+getmmap(const DBM *db)
+{
+	const struct lru_cache *cache = db->cache;
+
+	return NULL == cache ? DBM_MMAP_NONE : cache->mmap_mode;
+}
+#endif	/* MMAP */
+
 /**
  * Cache new page held in memory if there are deferred writes configured.
  * @return TRUE on success.
@@ -832,6 +1087,12 @@ flushpag(DBM *db, char *pag, long num)
 	g_assert(num >= 0);
 
 	db->pagwrite++;
+
+#ifdef WAL
+	if (wal_enabled(db))
+		return wal_put(db, WAL_PAG, num, pag);
+#endif
+
 	w = compat_pwrite(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num));
 
 	if (w < 0 || w != DBM_PBLKSIZ) {
@@ -14,6 +14,11 @@
 #define setwdelay sdbm__setwdelay
 #define getwdelay sdbm__getwdelay
 #define cachepag sdbm__cachepag
+#define setmmap sdbm__setmmap
+#define getmmap sdbm__getmmap
+#define lru_mapbuf sdbm__lru_mapbuf
+#define lru_own sdbm__lru_own
+#define lru_unmap sdbm__lru_unmap
 
 void lru_init(DBM *);
 void lru_close(DBM *);
@@ -30,3 +35,8 @@ char *lru_cached_page(DBM *, long);
 void lru_discard(DBM *, long);
 void lru_invalidate(DBM *, long);
 fileoffset_t lru_tail_offset(const DBM *);
+int setmmap(DBM *, int);
+int getmmap(const DBM *);
+bool lru_mapbuf(DBM *, long);
+bool lru_own(DBM *);
+void lru_unmap(DBM *);
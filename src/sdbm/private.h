@@ -5,6 +5,7 @@
  */
 
 struct DBMBIG;
+struct DBMREBUILD;
 struct lmutex;			/* Avoid including "mutex.h" here */
 
 enum sdbm_magic { SDBM_MAGIC = 0x1dac340e };
@@ -28,6 +29,10 @@ struct DBM {
 #ifdef LRU
 	void *cache;		/* LRU page cache */
 #endif
+#ifdef WAL
+	struct DBMWAL *wal;	/* write-ahead log, NULL when disabled */
+#endif
+	struct DBMREBUILD *rebuild;	/* incremental rebuild, NULL if none */
 #ifdef THREADS
 	struct lmutex *lock;	/* thread-safe lock at the API level */
 #endif
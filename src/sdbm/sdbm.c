@@ -15,6 +15,7 @@
 #include "lru.h"
 #include "big.h"
 #include "private.h"
+#include "wal.h"
 
 #include "lib/compat_misc.h"
 #include "lib/compat_pio.h"
@@ -48,6 +49,11 @@ static bool getpage(DBM *, long);
 static datum getnext(DBM *);
 static bool makroom(DBM *, long, size_t);
 static void validpage(DBM *, long);
+static long getpageb(DBM *, long, bool);
+static void rebuild_free(DBM *);
+static void rebuild_store(DBM *, datum, datum);
+static void rebuild_delete(DBM *, datum);
+static void rebuild_abort(DBM *, const char *);
 
 /*
  * Thread-safety macros.
@@ -420,6 +426,15 @@ sdbm_prep(const char *dirname, const char *pagname,
 	if ((db->pagf = file_open(pagname, flags, mode)) > -1) {
 		if ((db->dirf = file_open(dirname, flags, mode)) > -1) {
 
+#ifdef WAL
+			/*
+			 * Replay any write-ahead log left over by a crash before
+			 * looking at the size of the dirfile, which can change.
+			 */
+
+			wal_replay(db, pagname, flags);
+#endif
+
 			/*
 			 * need the dirfile size to establish max bit number.
 			 */
@@ -665,6 +680,60 @@ log_sdbm_warnings(DBM *db)
 #endif
 }
 
+#ifdef MMAP
+/**
+ * Point db->pagbuf to the specified page in the memory-mapped .pag file,
+ * when the database is configured to read pages from the mapping.
+ *
+ * @return TRUE if the page is available, FALSE if it must be read.
+ */
+static bool
+fetch_mapped(DBM *db, long pagnum)
+{
+#ifdef WAL
+	/*
+	 * Pages logged but not committed yet have not reached the file.
+	 */
+
+	if (wal_enabled(db) && wal_pending(db, WAL_PAG, pagnum))
+		return FALSE;
+#endif
+
+	if (!lru_mapbuf(db, pagnum))
+		return FALSE;
+
+	/*
+	 * A corrupted page will be cleared, which requires a private copy:
+	 * let the regular path read it again and handle it.
+	 */
+
+	if G_UNLIKELY(!sdbm_internal_chkpage(db->pagbuf)) {
+		db->pagbno = -1;
+		return FALSE;
+	}
+
+	db->pagbno = pagnum;
+	return TRUE;
+}
+#endif	/* MMAP */
+
+/**
+ * Make sure db->pagbuf is not read from a memory-mapped file before
+ * modifying it.
+ *
+ * @return TRUE on success
+ */
+static inline bool
+own_pagbuf(DBM *db)
+{
+#ifdef MMAP
+	return lru_own(db);
+#else
+	(void) db;
+	return TRUE;
+#endif
+}
+
 /**
  * Fetch the specified page number into db->pagbuf and update db->pagbno
  * on success.  Otherwise, set db->pagbno to -1 to indicate invalid db->pagbuf.
@@ -692,6 +761,11 @@ fetch_pagbuf(DBM *db, long pagnum)
 	if (pagnum != db->pagbno) {
 		ssize_t got;
 
+#ifdef MMAP
+		if (fetch_mapped(db, pagnum))
+			return TRUE;
+#endif
+
 #ifdef LRU
 		{
 			bool loaded;
@@ -716,6 +790,17 @@ fetch_pagbuf(DBM *db, long pagnum)
 		 * no holes on these systems.  See makroom().
 		 */
 
+#ifdef WAL
+		/*
+		 * Pages logged but not committed yet have not reached the file.
+		 */
+
+		if (wal_enabled(db) && wal_get(db, WAL_PAG, pagnum, db->pagbuf)) {
+			db->pagbno = pagnum;
+			return TRUE;
+		}
+#endif
+
 		db->pagread++;
 		got = compat_pread(db->pagf, db->pagbuf, DBM_PBLKSIZ, OFF_PAG(pagnum));
 		if G_UNLIKELY(got < 0) {
@@ -791,6 +876,18 @@ flush_dirbuf(DBM *db)
 	assert_sdbm_locked(db);
 
 	db->dirwrite++;
+
+#ifdef WAL
+	if (wal_enabled(db)) {
+		if G_UNLIKELY(!wal_put(db, WAL_DIR, db->dirbno, db->dirbuf))
+			return FALSE;
+#ifdef LRU
+		db->dirbuf_dirty = FALSE;
+#endif
+		return TRUE;
+	}
+#endif
+
 	w = compat_pwrite(db->dirf, db->dirbuf, DBM_DBLKSIZ, OFF_DIR(db->dirbno));
 
 	/*
@@ -818,6 +915,35 @@ flush_dirbuf(DBM *db)
 	return TRUE;
 }
 
+#ifdef WAL
+/**
+ * Signal end of an API operation, committing the pending group of the
+ * write-ahead log when it has grown large enough.
+ *
+ * Before committing, the pages whose write is deferred and the dir block
+ * are logged into the group, so that the group does not hold only part
+ * of an operation, such as the new page of a split without the old one.
+ *
+ * @return TRUE on success.
+ */
+static bool
+wal_end(DBM *db)
+{
+	if (!wal_full(db))
+		return TRUE;
+
+#ifdef LRU
+	if (db->cache != NULL && -1 == flush_dirtypag(db))
+		return FALSE;
+
+	if (db->dirbuf_dirty && !flush_dirbuf(db))
+		return FALSE;
+#endif
+
+	return wal_commit(db);
+}
+#endif	/* WAL */
+
 static void
 sdbm_unlink_file(const char *name, const char *path)
 {
@@ -840,11 +966,16 @@ sdbm_close_internal(DBM *db, bool clearfiles, bool destroy)
 	sdbm_check(db);
 	assert_sdbm_locked(db);
 
+	rebuild_free(db);
+
 #ifdef LRU
 	if (is_valid_fd(db->pagf))
 		lru_close(db);
 #else
 	WFREE_NULL(db->pagbuf, DBM_PBLKSIZ);
+#endif
+#ifdef WAL
+	wal_close(db, clearfiles);
 #endif
 	WFREE_NULL(db->dirbuf, DBM_DBLKSIZ);
 	fd_forget_and_close(&db->dirf);
@@ -1029,7 +1160,7 @@ sdbm_delete(DBM *db, datum key)
 		goto done;
 	}
 	SDBM_WARN_ITERATING(db);
-	if G_UNLIKELY(!getpage(db, exhash(key))) {
+	if G_UNLIKELY(!getpage(db, exhash(key)) || !own_pagbuf(db)) {
 		ioerr(db, FALSE);
 		goto done;
 	}
@@ -1038,6 +1169,9 @@ sdbm_delete(DBM *db, datum key)
 		goto done;
 	}
 
+	if (db->rebuild != NULL)
+		rebuild_delete(db, key);
+
 	/*
 	 * update the page file
 	 */
@@ -1048,6 +1182,10 @@ sdbm_delete(DBM *db, datum key)
 	status = 0;
 
 done:
+#ifdef WAL
+	if (wal_enabled(db) && !wal_end(db))
+		status = -1;
+#endif
 	sdbm_return(db, status);
 }
 
@@ -1103,7 +1241,7 @@ storepair(DBM *db, datum key, datum val, int flags, bool *existed)
 	}
 
 	hash = exhash(key);
-	if G_UNLIKELY(!getpage(db, hash)) {
+	if G_UNLIKELY(!getpage(db, hash) || !own_pagbuf(db)) {
 		ioerr(db, FALSE);
 		return -1;
 	}
@@ -1209,6 +1347,14 @@ sdbm_store(DBM *db, datum key, datum val, int flags)
 	SDBM_WARN_ITERATING(db);
 	r = storepair(db, key, val, flags, NULL);
 
+	if (0 == r && db->rebuild != NULL)
+		rebuild_store(db, key, val);
+
+#ifdef WAL
+	if (wal_enabled(db) && !wal_end(db))
+		r = -1;
+#endif
+
 	sdbm_return(db, r);
 }
 
@@ -1233,9 +1379,34 @@ sdbm_replace(DBM *db, datum key, datum val, bool *existed)
 	SDBM_WARN_ITERATING(db);
 	r = storepair(db, key, val, DBM_REPLACE, existed);
 
+	if (0 == r && db->rebuild != NULL)
+		rebuild_store(db, key, val);
+
+#ifdef WAL
+	if (wal_enabled(db) && !wal_end(db))
+		r = -1;
+#endif
+
 	sdbm_return(db, r);
 }
 
+/**
+ * Write page image directly at the specified page number, going through
+ * the write-ahead log if enabled.
+ *
+ * @return TRUE on success.
+ */
+static bool
+pwrite_pag(DBM *db, const char *pag, long num)
+{
+#ifdef WAL
+	if (wal_enabled(db))
+		return wal_put(db, WAL_PAG, num, pag);
+#endif
+
+	return compat_pwrite(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num)) >= 0;
+}
+
 /*
  * makroom - make room by splitting the overfull page
  * this routine will attempt to make room for DBM_SPLTMAX times before
@@ -1388,10 +1559,7 @@ makroom(DBM *db, long int hash, size_t need)
 			}
 		}
 #endif	/* LRU */
-		else if G_UNLIKELY((
-			db->pagwrite++,
-			compat_pwrite(db->pagf, New, DBM_PBLKSIZ, OFF_PAG(newp)) < 0)
-		) {
+		else if G_UNLIKELY((db->pagwrite++, !pwrite_pag(db, New, newp))) {
 			s_warning("sdbm: \"%s\": cannot flush new page #%ld: %m",
 				sdbm_name(db), newp);
 			ioerr(db, TRUE);
@@ -1540,7 +1708,7 @@ restore:
 		lru_invalidate(db, newp);	/* We're about to commit a newer version */
 #endif
 		memset(New, 0, DBM_PBLKSIZ);
-		if (compat_pwrite(db->pagf, New, DBM_PBLKSIZ, OFF_PAG(newp)) < 0) {
+		if (!pwrite_pag(db, New, newp)) {
 			s_critical("sdbm: \"%s\": cannot zero-back new split page #%ld: %m",
 				sdbm_name(db), newp);
 			ioerr(db, TRUE);
@@ -1591,6 +1759,49 @@ iteration_done(DBM *db, bool completed)
 	return nullitem;
 }
 
+/**
+ * Compute the end of the .pag file for iterating, accounting for pages
+ * not flushed to disk yet.
+ *
+ * @return the offset past which no page needs to be read, -1 on error.
+ */
+static fileoffset_t
+sdbm_pagtail(DBM *db)
+{
+	fileoffset_t tail;
+
+	tail = lseek(db->pagf, 0L, SEEK_END);
+
+#ifdef LRU
+	if (db->cache != NULL) {
+		fileoffset_t lrutail;
+
+		/*
+		 * Ask the LRU for the highest dirty page it has in stock, to possibly
+		 * amend the tail value: we need to iterate over the data held
+		 * in the LRU cache!
+		 *		--RAM, 2012-10-21
+		 */
+
+		lrutail = lru_tail_offset(db);
+		if (lrutail > tail)
+			tail = lrutail - 1;		/* This is the real database end */
+	}
+#endif	/* LRU */
+
+#ifdef WAL
+	if (wal_enabled(db)) {
+		fileoffset_t waltail = wal_tail_offset(db);
+
+		/* Same thing for pages logged but not committed yet */
+		if (waltail > tail)
+			tail = waltail - 1;
+	}
+#endif	/* WAL */
+
+	return tail;
+}
+
 /*
  * the sdbm_firstkey() and sdbm_nextkey() routines will break if
  * deletions aren't taken into account. (ndbm bug)
@@ -1639,24 +1850,7 @@ sdbm_firstkey(DBM *db)
 #endif	/* THREADS */
 
 	db->flags |= DBM_ITERATING;
-	db->pagtail = lseek(db->pagf, 0L, SEEK_END);
-
-#ifdef LRU
-	if (db->cache != NULL) {
-		fileoffset_t lrutail;
-
-		/*
-		 * Ask the LRU for the highest dirty page it has in stock, to possibly
-		 * amend the db->pagtail value: we need to iterate over the data held
-		 * in the LRU cache!
-		 *		--RAM, 2012-10-21
-		 */
-
-		lrutail = lru_tail_offset(db);
-		if (lrutail > db->pagtail)
-			db->pagtail = lrutail - 1;	/* This is the real database end */
-	}
-#endif	/* LRU */
+	db->pagtail = sdbm_pagtail(db);
 
 	if G_UNLIKELY(db->pagtail < 0) {
 		value = iteration_done(db, FALSE);
@@ -1900,6 +2094,9 @@ validpage(DBM *db, long pagb)
 		kpag = getpageb(db, hash, FALSE);
 
 		if G_UNLIKELY(kpag != pagb) {
+			if G_UNLIKELY(!own_pagbuf(db))
+				break;
+			pag = db->pagbuf;
 			if (delipair(db, pag, i, TRUE)) {
 				removed++;
 			} else {
@@ -1910,6 +2107,9 @@ validpage(DBM *db, long pagb)
 			}
 		} else if G_UNLIKELY(!chkipair(db, pag, i)) {
 			/* Don't delete big data here, bitmap will be fixed later */
+			if G_UNLIKELY(!own_pagbuf(db))
+				break;
+			pag = db->pagbuf;
 			if (delipair(db, pag, i, FALSE)) {
 				corrupted++;
 			} else {
@@ -1956,6 +2156,17 @@ fetch_dirbuf(DBM *db, long dirb)
 			return FALSE;
 #endif
 
+#ifdef WAL
+		/*
+		 * Dir blocks logged but not committed yet have not reached the file.
+		 */
+
+		if (wal_enabled(db) && wal_get(db, WAL_DIR, dirb, db->dirbuf)) {
+			db->dirbno = dirb;
+			return TRUE;
+		}
+#endif
+
 		db->dirread++;
 		got = compat_pread(db->dirf, db->dirbuf, DBM_DBLKSIZ, OFF_DIR(dirb));
 		if G_UNLIKELY(got < 0) {
@@ -2142,8 +2353,22 @@ sdbm_deletekey(DBM *db)
 	if G_UNLIKELY(0 == db->keyptr)
 		goto no_entry;
 
-	if G_UNLIKELY(!delnpair(db, db->pagbuf, db->keyptr))
+	if G_UNLIKELY(!own_pagbuf(db))
+		goto done;
+
+	/*
+	 * The key is propagated before being deleted since it can lie in the
+	 * page we are about to compact.
+	 */
+
+	if (db->rebuild != NULL)
+		rebuild_delete(db, getnkey(db, db->pagbuf, db->keyptr));
+
+	if G_UNLIKELY(!delnpair(db, db->pagbuf, db->keyptr)) {
+		if (db->rebuild != NULL)
+			rebuild_abort(db, "cannot delete key");
 		goto done;
+	}
 
 	db->keyptr--;
 
@@ -2157,6 +2382,10 @@ sdbm_deletekey(DBM *db)
 	status = 0;
 
 done:
+#ifdef WAL
+	if (wal_enabled(db) && !wal_end(db))
+		status = -1;
+#endif
 	sdbm_return(db, status);
 
 no_entry:
@@ -2374,6 +2603,15 @@ sdbm_sync(DBM *db)
 		npag++;
 #endif
 
+#ifdef WAL
+	/*
+	 * Group commit of all the blocks we flushed above.
+	 */
+
+	if (wal_enabled(db) && !wal_commit(db))
+		npag = (ssize_t) -1;
+#endif
+
 done:
 	sdbm_return(db, npag);
 }
@@ -2402,6 +2640,15 @@ sdbm_shrink(DBM *db)
 		goto error;
 	}
 
+#ifdef WAL
+	/*
+	 * Commit all logged pages: we are going to look at the files directly.
+	 */
+
+	if (wal_enabled(db) && !wal_checkpoint(db))
+		goto error;
+#endif
+
 	if G_UNLIKELY(-1 == fstat(db->pagf, &buf))
 		goto error;
 
@@ -2411,19 +2658,22 @@ sdbm_shrink(DBM *db)
 	}
 
 	/*
-	 * Look how many full pages we need in the .pag file by remembering the
-	 * page block number after the last non-empty page we saw.
+	 * Look how many full pages we need in the .pag file by locating the
+	 * last non-empty page.  Only the trailing empty pages can be removed,
+	 * so we scan backwards from the end of the file and stop at the first
+	 * non-empty page we find, instead of reading the whole file.
 	 */
 
 	paglen = buf.st_size;
 
-	while ((offset = OFF_PAG(bno)) < paglen) {
+	for (bno = (paglen + DBM_PBLKSIZ - 1) / DBM_PBLKSIZ; bno > 0; bno--) {
+		long num = bno - 1;
 		unsigned short count;
 		int r;
 
 #ifdef LRU
 		{
-			const char *pag = lru_cached_page(db, bno);
+			const char *pag = lru_cached_page(db, num);
 			const unsigned short *ino = (const unsigned short *) pag;
 
 			if (ino != NULL) {
@@ -2435,7 +2685,7 @@ sdbm_shrink(DBM *db)
 			/* FALLTHROUGH */
 		}
 #else
-		if (db->pagbno == bno) {
+		if (db->pagbno == num) {
 			const unsigned short *ino = (const unsigned short *) db->pagbuf;
 			count = ino[0];
 			goto computed;
@@ -2445,20 +2695,22 @@ sdbm_shrink(DBM *db)
 		/* FALLTHROUGH */
 #endif
 
-		r = compat_pread(db->pagf, &count, sizeof count, offset);
+		r = compat_pread(db->pagf, &count, sizeof count, OFF_PAG(num));
 		if G_UNLIKELY(-1 == r || r != sizeof count)
-			return FALSE;
+			goto error;
 
 	computed:
 		if (count != 0)
-			truncate_bno = bno + 1;		/* Block # after non-empty page */
-
-		bno++;
+			break;				/* Last non-empty page */
 	}
 
+	truncate_bno = bno;			/* Block # after last non-empty page */
 	offset = OFF_PAG(truncate_bno);
 
 	if (offset < paglen) {
+#ifdef MMAP
+		lru_unmap(db);		/* Mapped pages beyond the end would fault */
+#endif
 		if (-1 == ftruncate(db->pagf, offset))
 			goto error;
 #ifdef LRU
@@ -2624,8 +2876,18 @@ sdbm_rename_files(DBM *db,
 	 *
 	 * If any of the rename fails or we cannot re-open the new file, then
 	 * we undo the renaming and try to reopen the original files.
+	 *
+	 * The write-ahead log, whose name derives from the .pag file, must be
+	 * emptied and removed first: it is re-created on the next commit.
 	 */
 
+#ifdef WAL
+	if (wal_enabled(db) && !wal_detach(db)) {
+		errno = EIO;
+		goto error;
+	}
+#endif
+
 	fd_forget_and_close(&db->dirf);
 	fd_forget_and_close(&db->pagf);
 
@@ -2776,6 +3038,8 @@ sdbm_rename(DBM *db, const char *base)
 		goto error;
 	}
 
+	rebuild_free(db);		/* New database is named after the old files */
+
 #ifdef BIGDATA
 	if (db->datname != NULL) {
 		datname = h_strconcat(base, DBM_DATFEXT, NULL_PTR);
@@ -2820,41 +3084,116 @@ error:
 }
 
 /**
- * Rebuild database from scratch, thereby compacting it on disk since only
- * the required pages will be allocated.
+ * Incremental rebuild state.
  *
- * @return 0 if OK, -1 on failure.
+ * Pages are copied in increasing page number order: all the pages before
+ * ``bno'' have been copied to the new database, and updates made to keys
+ * lying in these pages are propagated so that the new database remains
+ * current for them.  Keys can move to higher pages when a page is split,
+ * so deletions are always propagated.
  */
-int
-sdbm_rebuild(DBM *db)
+struct DBMREBUILD {
+	DBM *ndb;				/* the new database being filled */
+	long bno;				/* next page to copy */
+	long pages;				/* amount of pages to scan, last computed */
+	unsigned items;			/* stats: items copied or skipped */
+	unsigned skipped;		/* stats: unreadable items skipped */
+	unsigned mirrored;		/* stats: updates propagated */
+};
+
+/**
+ * Discard incremental rebuild, if any, removing the new database.
+ */
+static void
+rebuild_free(DBM *db)
+{
+	struct DBMREBUILD *rb = db->rebuild;
+
+	if (rb != NULL) {
+		int saved_errno = errno;
+
+		db->rebuild = NULL;
+		sdbm_unlink(rb->ndb);
+		WFREE(rb);
+		errno = saved_errno;
+	}
+}
+
+/**
+ * Abort incremental rebuild after an error, loudly.
+ */
+static void
+rebuild_abort(DBM *db, const char *what)
+{
+	s_warning("sdbm: \"%s\": %s: %m -- aborting rebuild", sdbm_name(db), what);
+	rebuild_free(db);
+}
+
+/**
+ * Propagate a foreground update to the database being rebuilt, when the
+ * key lies in a page that was already copied.
+ */
+static void
+rebuild_store(DBM *db, datum key, datum val)
+{
+	struct DBMREBUILD *rb = db->rebuild;
+
+	if (getpageb(db, exhash(key), FALSE) >= rb->bno)
+		return;				/* Will be copied when the scan reaches its page */
+
+	rb->mirrored++;
+
+	if G_UNLIKELY(0 != sdbm_replace(rb->ndb, key, val, NULL))
+		rebuild_abort(db, "cannot propagate update");
+}
+
+/**
+ * Propagate a foreground deletion to the database being rebuilt.
+ */
+static void
+rebuild_delete(DBM *db, datum key)
 {
+	struct DBMREBUILD *rb = db->rebuild;
+
+	rb->mirrored++;
+
+	if G_UNLIKELY(0 != sdbm_delete(rb->ndb, key) && errno != 0)
+		rebuild_abort(db, "cannot propagate deletion");
+}
+
+/**
+ * Create the new database for the rebuild.
+ *
+ * @return 0 if OK, -1 on failure with errno set.
+ */
+static int
+rebuild_start(DBM *db)
+{
+	struct DBMREBUILD *rb;
 	DBM *ndb;
 	char ext[10];
 	char *dirname, *pagname, *datname;
-	int error = 0, result;
 	long cache;
-	datum key;
-	unsigned items = 0, skipped = 0, duplicate = 0;
+	int error;
 
-	sdbm_check(db);
-
-	sdbm_synchronize(db);
+	assert_sdbm_locked(db);
+	g_assert(NULL == db->rebuild);
 
 	if (sdbm_rdonly(db)) {
 		errno = EPERM;
-		goto failed;
+		return -1;
 	}
 	if (sdbm_error(db)) {
 		errno = EIO;		/* Already got an error reported */
-		goto failed;
+		return -1;
 	}
 	if (db->flags & DBM_ITERATING) {
 		errno = EBUSY;		/* Already iterating */
-		goto failed;
+		return -1;
 	}
 	if G_UNLIKELY(db->flags & DBM_BROKEN) {
 		errno = ESTALE;		/* Already broken handle */
-		goto failed;
+		return -1;
 	}
 
 	str_bprintf(ext, sizeof ext, ".%08x", random_u32());
@@ -2866,9 +3205,14 @@ sdbm_rebuild(DBM *db)
 	ndb = sdbm_prep(dirname, pagname, datname,
 		db->openflags | O_CREAT | O_EXCL, db->openmode);
 
+	error = errno;
+	HFREE_NULL(dirname);
+	HFREE_NULL(pagname);
+	HFREE_NULL(datname);
+
 	if (NULL == ndb) {
-		error = errno;
-		goto error;
+		errno = error;
+		return -1;
 	}
 
 	/*
@@ -2882,49 +3226,91 @@ sdbm_rebuild(DBM *db)
 	if (sdbm_is_volatile(db))	sdbm_set_volatile(ndb, TRUE);
 	if (sdbm_get_wdelay(db))	sdbm_set_wdelay(ndb, TRUE);
 	if (cache != 0)				sdbm_set_cache(ndb, cache);
+	if (sdbm_get_mmap(db))		sdbm_set_mmap(ndb, sdbm_get_mmap(db));
 
-	/*
-	 * Copy all the keys/values from the database to the new database.
-	 */
+	WALLOC0(rb);
+	rb->ndb = ndb;
+	db->rebuild = rb;
 
-	for (key = sdbm_firstkey_safe(db); key.dptr; key = sdbm_nextkey(db)) {
-		datum value = sdbm_value(db);
+	return 0;
+}
 
-		items++;
+/**
+ * Copy the next pages to the new database.
+ *
+ * @return 0 if OK, -1 on failure with errno set.
+ */
+static int
+rebuild_copy(DBM *db, long pages)
+{
+	struct DBMREBUILD *rb = db->rebuild;
+	fileoffset_t tail;
+	long n;
 
-		if (NULL == value.dptr) {
-			if (sdbm_error(db))
-				sdbm_clearerr(db);
-			skipped++;				/* Unreadable value skipped */
-			continue;
-		}
+	assert_sdbm_locked(db);
+
+	tail = sdbm_pagtail(db);
+	rb->pages = tail < 0 ? 0 : tail / DBM_PBLKSIZ + 1;
+
+	for (n = 0; n < pages && rb->bno < rb->pages; n++, rb->bno++) {
+		int i;
+
+		if G_UNLIKELY(!fetch_pagbuf(db, rb->bno))
+			continue;			/* Skip faulty page */
 
-		if (0 != sdbm_store(ndb, key, value, DBM_INSERT)) {
-			if (sdbm_error(db))
-				sdbm_clearerr(db);
-			if (EEXIST == errno) {
-				/* Duplicate key, that's bad, but we can survive */
-				duplicate++;
-				skipped++;
+		validpage(db, rb->bno);
+
+		for (i = 1; /* empty */; i++) {
+			datum key = getnkey(db, db->pagbuf, i);
+			datum value;
+
+			if (NULL == key.dptr)
+				break;
+
+			rb->items++;
+			value = getnval(db, db->pagbuf, i);
+
+			if (NULL == value.dptr) {
+				if (sdbm_error(db))
+					sdbm_clearerr(db);
+				rb->skipped++;			/* Unreadable value skipped */
 				continue;
 			}
-			/* Other errors are fatal */
-			error = errno;
-			sdbm_endkey(db);		/* Finish iteration */
-			break;
+
+			/*
+			 * Use DBM_REPLACE since the key may have been copied already,
+			 * before a split moved it to this page: we copy its latest value.
+			 */
+
+			if (0 != sdbm_replace(rb->ndb, key, value, NULL))
+				return -1;
 		}
 	}
 
-	if (error != 0)
-		goto error;
+	return 0;
+}
 
-	/*
-	 * At this point, the database was successfully copied over.
-	 */
+/**
+ * Switch to the new database once all the pages have been copied.
+ *
+ * @return 0 if OK, -1 on failure with errno set.
+ */
+static int
+rebuild_finish(DBM *db)
+{
+	struct DBMREBUILD *rb = db->rebuild;
+	DBM *ndb = rb->ndb;
+	char *dirname, *pagname, *datname;
+	unsigned items = rb->items, skipped = rb->skipped;
+	int error = 0;
+#ifdef WAL
+	bool wal;
+#endif
 
-	HFREE_NULL(dirname);
-	HFREE_NULL(pagname);
-	HFREE_NULL(datname);
+	assert_sdbm_locked(db);
+
+	db->rebuild = NULL;
+	WFREE(rb);
 
 	dirname = h_strdup(db->dirname);
 	pagname = h_strdup(db->pagname);
@@ -2932,6 +3318,9 @@ sdbm_rebuild(DBM *db)
 
 #ifdef THREADS
 	ndb->lock = db->lock;
+#endif
+#ifdef WAL
+	wal = wal_enabled(db);
 #endif
 	sdbm_close_internal(db, TRUE, FALSE);		/* Keep object around */
 	*db = *ndb;									/* struct copy */
@@ -2948,20 +3337,23 @@ sdbm_rebuild(DBM *db)
 	if (-1 == sdbm_rename_files(db, dirname, pagname, datname))
 		error = errno;
 
-	/* FALL THROUGH */
+	/*
+	 * The write-ahead log is only turned on again after the copy, to avoid
+	 * journaling the whole database during the rebuild.
+	 */
+
+#ifdef WAL
+	if (0 == error && wal && -1 == wal_enable(db, TRUE))
+		error = errno;
+#endif
 
-error:
 	HFREE_NULL(dirname);
 	HFREE_NULL(pagname);
 	HFREE_NULL(datname);
 
-	if (ndb != NULL) {
-		sdbm_unlink(ndb);
-	}
-
 	if (0 != error) {
 		errno = error;
-		goto failed;
+		return -1;
 	}
 
 	/*
@@ -2973,20 +3365,170 @@ error:
 	 */
 
 	if (skipped != 0) {
-		s_critical("sdbm: \"%s\": had to skip %u/%u item%s (%u duplicate%s)"
-			" during rebuild",
-			sdbm_name(db), skipped, items, 1 == skipped ? "" : "s",
-			duplicate, 1 == duplicate ? "" : "s");
+		s_critical("sdbm: \"%s\": had to skip %u/%u item%s during rebuild",
+			sdbm_name(db), skipped, items, plural(skipped));
+	}
+
+	return 0;
+}
+
+/**
+ * Start an incremental rebuild of the database, to compact it on disk.
+ *
+ * The database remains fully usable whilst it is being rebuilt: the work
+ * is done by calling sdbm_rebuild_step() until it reports completion.
+ *
+ * @return 0 if OK, -1 on failure with errno set.
+ */
+int
+sdbm_rebuild_start(DBM *db)
+{
+	int result = 0;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+	if (NULL == db->rebuild)
+		result = rebuild_start(db);
+
+	sdbm_return(db, result);
+}
+
+/**
+ * Perform the next slice of an incremental rebuild, copying at most the
+ * specified amount of pages.
+ *
+ * When all the pages have been copied, the rebuilt database replaces the
+ * original one.  Nothing is done whilst the database is being iterated over.
+ *
+ * @return 1 if more work remains, 0 when the rebuild completed, -1 on error
+ * with errno set, the rebuild being then aborted.
+ */
+int
+sdbm_rebuild_step(DBM *db, long pages)
+{
+	struct DBMREBUILD *rb;
+	int result;
+
+	sdbm_check(db);
+	g_assert(pages > 0);
+
+	sdbm_synchronize(db);
+
+	rb = db->rebuild;
+
+	if G_UNLIKELY(NULL == rb) {
+		errno = ENOENT;		/* Never started, or aborted */
+		result = -1;
+		goto done;
+	}
+	if G_UNLIKELY(db->flags & DBM_BROKEN) {
+		rebuild_free(db);
+		errno = ESTALE;
+		result = -1;
+		goto done;
+	}
+	if (db->flags & DBM_ITERATING) {
+		result = 1;			/* Will resume after iteration */
+		goto done;
 	}
 
-	result = 0;		/* OK, we rebuilt the database */
+	if G_UNLIKELY(-1 == rebuild_copy(db, pages)) {
+		rebuild_abort(db, "cannot copy page");
+		result = -1;
+		goto done;
+	}
+
+	if (rb->bno < rb->pages) {
+		result = 1;
+#ifdef WAL
+		if (wal_enabled(db))
+			(void) wal_end(db);		/* Pages fixed by validpage() */
+#endif
+	} else {
+		result = rebuild_finish(db);
+	}
 
 done:
 	sdbm_return(db, result);
+}
 
-failed:
-	result = -1;
-	goto done;
+/**
+ * Abort incremental rebuild, if any.
+ */
+void
+sdbm_rebuild_abort(DBM *db)
+{
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+	rebuild_free(db);
+	sdbm_unsynchronize(db);
+}
+
+/**
+ * Fetch progress of the incremental rebuild.
+ *
+ * @param db		the database
+ * @param done		if non-NULL, written with the amount of pages copied
+ * @param total		if non-NULL, written with the amount of pages to copy
+ *
+ * @return whether an incremental rebuild is in progress.
+ */
+bool
+sdbm_rebuild_progress(const DBM *db, long *done, long *total)
+{
+	const struct DBMREBUILD *rb;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+	rb = db->rebuild;
+
+	if (done != NULL)
+		*done = NULL == rb ? 0 : rb->bno;
+	if (total != NULL)
+		*total = NULL == rb ? 0 : MAX(rb->pages, rb->bno);
+
+	sdbm_return(db, rb != NULL);
+}
+
+/**
+ * Rebuild database from scratch, thereby compacting it on disk since only
+ * the required pages will be allocated.
+ *
+ * If an incremental rebuild was started, it is completed.
+ *
+ * @return 0 if OK, -1 on failure.
+ */
+int
+sdbm_rebuild(DBM *db)
+{
+	int result;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+	if (db->flags & DBM_ITERATING) {
+		errno = EBUSY;		/* Already iterating */
+		result = -1;
+		goto done;
+	}
+
+	if (NULL == db->rebuild && -1 == rebuild_start(db)) {
+		result = -1;
+		goto done;
+	}
+
+	do {
+		result = sdbm_rebuild_step(db, MAX_INT_VAL(long));
+	} while (1 == result);
+
+done:
+	sdbm_return(db, result);
 }
 
 /**
@@ -3015,6 +3557,14 @@ sdbm_clear(DBM *db)
 		errno = ESTALE;
 		goto error;
 	}
+	rebuild_free(db);
+#ifdef WAL
+	if (wal_enabled(db))
+		wal_discard(db);
+#endif
+#ifdef MMAP
+	lru_unmap(db);
+#endif
 	if G_UNLIKELY(-1 == ftruncate(db->pagf, 0))
 		goto error;
 	db->pagbno = -1;
@@ -3181,6 +3731,113 @@ sdbm_set_volatile(DBM *db, bool yes)
 	sdbm_return(db, result);
 }
 
+/**
+ * @return how pages are read from memory-mapped files (DBM_MMAP_*).
+ */
+int
+sdbm_get_mmap(const DBM *db)
+{
+	int mode;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef MMAP
+	mode = getmmap(db);
+#else
+	mode = DBM_MMAP_NONE;
+#endif
+
+	sdbm_return(db, mode);
+}
+
+/**
+ * Configure reading of pages through memory-mapped files.
+ *
+ * With DBM_MMAP_RDONLY or DBM_MMAP_COW, pages not held in the LRU cache are
+ * read directly from a shared read-only mapping of the .pag file, sparing
+ * the read() system call and the copy into the cache.  A page about to be
+ * modified is loaded into the LRU cache: DBM_MMAP_RDONLY reads it again
+ * from the file whereas DBM_MMAP_COW copies it from the mapping.
+ *
+ * Large keys and values are also copied from a mapping of the .dat file.
+ *
+ * @return 0 if OK, -1 on failure with errno set.
+ */
+int
+sdbm_set_mmap(DBM *db, int mode)
+{
+	int result;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef MMAP
+	result = setmmap(db, mode);
+#ifdef BIGDATA
+	if (0 == result)
+		big_set_mmap(db, mode != DBM_MMAP_NONE);
+#endif
+#else
+	(void) mode;
+	errno = ENOTSUP;
+	result = -1;
+#endif
+
+	sdbm_return(db, result);
+}
+
+/**
+ * @return whether the write-ahead log is enabled.
+ */
+bool
+sdbm_get_wal(const DBM *db)
+{
+	bool enabled;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef WAL
+	enabled = wal_enabled(db);
+#else
+	enabled = FALSE;
+#endif
+
+	sdbm_return(db, enabled);
+}
+
+/**
+ * Turn the write-ahead log on or off.
+ *
+ * When enabled, page and index writes are first appended to a log that is
+ * synced to disk in groups, at each sdbm_sync() or when enough blocks have
+ * accumulated.  Should the process crash, committed groups are replayed
+ * when the database is re-opened, so splits are never left half-done.
+ */
+int
+sdbm_set_wal(DBM *db, bool on)
+{
+	int result;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef WAL
+	result = wal_enable(db, on);
+#else
+	(void) on;
+	errno = ENOTSUP;
+	result = -1;
+#endif
+
+	sdbm_return(db, result);
+}
+
 bool
 sdbm_rdonly(const DBM *db)
 {
@@ -16,6 +16,7 @@
 #define DBM_DIRFEXT	".dir"
 #define DBM_PAGFEXT	".pag"
 #define DBM_DATFEXT	".dat"		/* for large keys or values */
+#define DBM_WALFEXT	".wal"		/* for the write-ahead log */
 
 typedef struct DBM DBM;
 
@@ -45,6 +46,13 @@ extern const datum nullitem;
 #define DBM_F_SAFE		(1 << 1)	/* activate keycheck during iteration */
 #define DBM_F_SKIP		(1 << 2)	/* skip unreadable keys/values */
 
+/*
+ * modes for sdbm_set_mmap().
+ */
+#define DBM_MMAP_NONE	0	/* read pages with pread() into the LRU cache */
+#define DBM_MMAP_RDONLY	1	/* read from mapping, re-read pages to modify */
+#define DBM_MMAP_COW	2	/* read from mapping, copy pages to modify */
+
 typedef void (*sdbm_cb_t)(const datum key, const datum value, void *arg);
 typedef bool (*sdbm_cbr_t)(const datum key, const datum value, void *arg);
 
@@ -86,12 +94,20 @@ int sdbm_set_wdelay(DBM *db, bool on);
 bool sdbm_get_wdelay(const DBM *) G_PURE;
 int sdbm_set_volatile(DBM *db, bool yes);
 bool sdbm_is_volatile(const DBM *) G_PURE;
+int sdbm_set_wal(DBM *db, bool on);
+bool sdbm_get_wal(const DBM *) G_PURE;
+int sdbm_set_mmap(DBM *db, int mode);
+int sdbm_get_mmap(const DBM *) G_PURE;
 bool sdbm_shrink(DBM *db);
 int sdbm_clear(DBM *db);
 void sdbm_unlink(DBM *);
 int sdbm_rename(DBM *, const char *);
 int sdbm_rename_files(DBM *, const char *, const char *, const char *);
 int sdbm_rebuild(DBM *);
+int sdbm_rebuild_start(DBM *);
+int sdbm_rebuild_step(DBM *, long);
+void sdbm_rebuild_abort(DBM *);
+bool sdbm_rebuild_progress(const DBM *, long *, long *);
 size_t sdbm_foreach(DBM *db, int flags, sdbm_cb_t cb, void *arg);
 size_t sdbm_foreach_remove(DBM *db, int flags, sdbm_cbr_t cb, void *arg);
 
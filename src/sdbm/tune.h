@@ -15,6 +15,12 @@
 #define LRU_PAGES	64	/* default amount of pages in LRU cache */
 #define BIGDATA			/* can store large keys/values */
 #define THREADS			/* thread-safe */
+#define WAL				/* optional write-ahead log */
+#define WAL_GROUP	64	/* pending blocks triggering a group commit */
+
+#if defined(LRU) && defined(HAS_MMAP)
+#define MMAP			/* can read pages from memory-mapped files */
+#endif
 
 /*
  * misc
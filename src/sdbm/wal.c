@@ -0,0 +1,854 @@
+/*
+ * sdbm - ndbm work-alike hashed database library
+ *
+ * Write-ahead log (WAL) with group commit.
+ * author: agent <agent@local>
+ * status: public domain.
+ *
+ * When the WAL is enabled, physical writes to the .pag and .dir files are
+ * not done in place: the full image of the block is appended to a pending
+ * group held in memory instead.  When the group is committed, it is written
+ * at the end of the log file and synced to disk with a single fdatasync(),
+ * after which the blocks are written in place without any further sync.
+ *
+ * Groups are only committed between two API calls, never in the middle of
+ * an operation.  Pages whose write is deferred in the page cache and the
+ * dirty dir block are logged into the group before it is committed, hence
+ * a page split is always either entirely in the log or not at all, and the
+ * database can no longer be left half-split by a crash.
+ *
+ * When the database is re-opened, committed groups found in the log are
+ * written back in place.  The log is truncated when it grows too large,
+ * once the .pag and .dir files have been synced (checkpoint).
+ *
+ * Data in the .dat file is not journaled, but it is synced before each
+ * commit so that committed pages never refer to unwritten large values.
+ *
+ * @ingroup sdbm
+ * @file
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "sdbm.h"
+#include "tune.h"
+#include "big.h"
+#include "private.h"
+#include "wal.h"
+
+#include "lib/compat_pio.h"
+#include "lib/crc.h"
+#include "lib/debug.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/hstrfn.h"
+#include "lib/htable.h"
+#include "lib/log.h"
+#include "lib/misc.h"
+#include "lib/stringify.h"		/* For plural() */
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#ifdef WAL
+enum sdbm_wal_magic { SDBM_WAL_MAGIC = 0x17a9c3e5 };
+
+#define WAL_REC_MAGIC	0x5357414cU		/* "SWAL" */
+#define WAL_COMMIT		0x7f			/* Commit record type */
+#define WAL_HDRSIZE		16				/* Size of record header */
+#define WAL_CHECKPOINT	(1024 * 1024)	/* Log size triggering a checkpoint */
+
+/*
+ * Each record starts with a header made of 4 big-endian 32-bit quantities:
+ *
+ *   magic		WAL_REC_MAGIC
+ *   type		WAL_PAG, WAL_DIR or WAL_COMMIT (in the leading byte)
+ *   number		block number, or amount of records for a commit
+ *   crc		CRC32 of the group records, for a commit only
+ *
+ * followed by the block image for WAL_PAG and WAL_DIR records.
+ */
+
+/**
+ * The write-ahead log.
+ */
+struct DBMWAL {
+	enum sdbm_wal_magic magic;	/* Magic number */
+	htable_t *pending;			/* Block key -> offset of record in buf */
+	char *path;					/* Log file path, computed lazily */
+	char *buf;					/* Records of the pending group */
+	size_t len;					/* Length of data held in buf */
+	size_t size;				/* Allocated size of buf */
+	size_t records;				/* Amount of records in pending group */
+	long maxpag;				/* Highest page number in pending group */
+	fileoffset_t tail;			/* Length of the log file */
+	int fd;						/* Log file descriptor, -1 if not opened */
+	unsigned long commits;		/* Stats: amount of group commits */
+	unsigned long logged;		/* Stats: amount of blocks logged */
+	unsigned long coalesced;	/* Stats: amount of rewrites in same group */
+	unsigned long inplace;		/* Stats: amount of blocks written in place */
+	unsigned long checkpoints;	/* Stats: amount of log truncations */
+	unsigned long reads;		/* Stats: amount of reads from pending group */
+};
+
+static inline void
+sdbm_wal_check(const struct DBMWAL * const w)
+{
+	g_assert(w != NULL);
+	g_assert(SDBM_WAL_MAGIC == w->magic);
+}
+
+/**
+ * @return size of the block image carried by records of the given type,
+ * 0 if the type is invalid.
+ */
+static size_t
+wal_blksize(unsigned type)
+{
+	switch (type) {
+	case WAL_PAG:	return DBM_PBLKSIZ;
+	case WAL_DIR:	return DBM_DBLKSIZ;
+	}
+	return 0;
+}
+
+/**
+ * @return the key under which a block is recorded in the pending table.
+ */
+static inline void *
+wal_key(enum wal_type type, long num)
+{
+	return ulong_to_pointer(((ulong) num << 1) | (WAL_DIR == type ? 1 : 0));
+}
+
+/**
+ * Compute the log file name from the .pag file name.
+ *
+ * @return the name of the log file, to be freed with hfree().
+ */
+static char *
+wal_filename(const char *pagname)
+{
+	size_t len = strlen(pagname), elen = CONST_STRLEN(DBM_PAGFEXT);
+
+	if (len > elen && 0 == strcmp(pagname + len - elen, DBM_PAGFEXT)) {
+		char *base = h_strndup(pagname, len - elen);
+		char *path = h_strconcat(base, DBM_WALFEXT, NULL_PTR);
+		hfree(base);
+		return path;
+	}
+
+	return h_strconcat(pagname, DBM_WALFEXT, NULL_PTR);
+}
+
+static void
+log_walstats(DBM *db)
+{
+	DBMWAL *wal = db->wal;
+
+	s_info("sdbm: \"%s\" WAL group commits = %lu, blocks logged = %lu "
+		"(coalesced %lu, written %lu)",
+		sdbm_name(db), wal->commits, wal->logged,
+		wal->coalesced, wal->inplace);
+	s_info("sdbm: \"%s\" WAL checkpoints = %lu, pending block reads = %lu",
+		sdbm_name(db), wal->checkpoints, wal->reads);
+}
+
+/**
+ * Discard the pending group.
+ */
+static void
+wal_reset(DBMWAL *wal)
+{
+	htable_free_null(&wal->pending);
+	wal->pending = htable_create(HASH_KEY_SELF, 0);
+	wal->len = 0;
+	wal->records = 0;
+	wal->maxpag = -1;
+}
+
+/**
+ * Make sure there is room for ``len'' more bytes in the pending group.
+ */
+static void
+wal_reserve(DBMWAL *wal, size_t len)
+{
+	if G_UNLIKELY(wal->len + len > wal->size) {
+		size_t size = MAX(wal->size, DBM_DBLKSIZ);
+
+		while (size < wal->len + len)
+			size *= 2;
+
+		wal->buf = hrealloc(wal->buf, size);
+		wal->size = size;
+	}
+}
+
+/**
+ * Append record header to the pending group.
+ */
+static void
+wal_header(DBMWAL *wal, unsigned type, uint32 num, uint32 crc)
+{
+	char *p;
+
+	wal_reserve(wal, WAL_HDRSIZE);
+	p = wal->buf + wal->len;
+
+	poke_be32(p, WAL_REC_MAGIC);
+	poke_be32(p + 4, type << 24);
+	poke_be32(p + 8, num);
+	poke_be32(p + 12, crc);
+
+	wal->len += WAL_HDRSIZE;
+}
+
+/**
+ * Turn the write-ahead log on or off.
+ *
+ * When turned off, pending blocks are committed and the log is removed.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+wal_enable(DBM *db, bool on)
+{
+	DBMWAL *wal = db->wal;
+	int result = 0;
+
+	if (on) {
+		if (wal != NULL)
+			return 0;
+
+		if (db->flags & DBM_RDONLY) {
+			errno = EPERM;
+			return -1;
+		}
+
+		crc_init();
+
+		WALLOC0(wal);
+		wal->magic = SDBM_WAL_MAGIC;
+		wal->fd = -1;
+		wal_reset(wal);
+		db->wal = wal;
+
+		return 0;
+	}
+
+	if (NULL == wal)
+		return 0;
+
+	if (!wal_detach(db))
+		result = -1;
+
+	wal_close(db, FALSE);
+	return result;
+}
+
+/**
+ * Record the image of a block in the pending group.
+ *
+ * If the block was already logged since the last commit, its image is
+ * simply updated.
+ *
+ * @param db		the database
+ * @param type		the type of block
+ * @param num		the block number
+ * @param image		the block image
+ *
+ * @return TRUE on success.
+ */
+bool
+wal_put(DBM *db, enum wal_type type, long num, const char *image)
+{
+	DBMWAL *wal = db->wal;
+	size_t blksize = wal_blksize(type);
+	void *key = wal_key(type, num);
+	void *value;
+
+	sdbm_wal_check(wal);
+	g_assert(num >= 0);
+	g_assert(blksize != 0);
+
+	wal->logged++;
+
+	if (htable_lookup_extended(wal->pending, key, NULL, &value)) {
+		size_t offset = pointer_to_ulong(value);
+
+		memcpy(wal->buf + offset + WAL_HDRSIZE, image, blksize);
+		wal->coalesced++;
+		return TRUE;
+	}
+
+	htable_insert(wal->pending, key, ulong_to_pointer(wal->len));
+
+	wal_header(wal, type, num, 0);
+	wal_reserve(wal, blksize);
+	memcpy(wal->buf + wal->len, image, blksize);
+	wal->len += blksize;
+	wal->records++;
+
+	if (WAL_PAG == type)
+		wal->maxpag = MAX(wal->maxpag, num);
+
+	return TRUE;
+}
+
+/**
+ * Fetch the image of a block from the pending group, if present.
+ *
+ * Blocks are not written in place until their group is committed, so this
+ * must be checked before reading a block from the disk.
+ *
+ * @return TRUE if the block was found and copied to ``buf''.
+ */
+bool
+wal_get(DBM *db, enum wal_type type, long num, char *buf)
+{
+	DBMWAL *wal = db->wal;
+	void *value;
+
+	sdbm_wal_check(wal);
+
+	if (0 == wal->records)
+		return FALSE;
+
+	if (htable_lookup_extended(wal->pending, wal_key(type, num), NULL, &value)) {
+		size_t offset = pointer_to_ulong(value);
+
+		memcpy(buf, wal->buf + offset + WAL_HDRSIZE, wal_blksize(type));
+		wal->reads++;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * @return whether a block is part of the pending group.
+ */
+bool
+wal_pending(const DBM *db, enum wal_type type, long num)
+{
+	const DBMWAL *wal = db->wal;
+
+	sdbm_wal_check(wal);
+
+	if (0 == wal->records)
+		return FALSE;
+
+	return htable_contains(wal->pending, wal_key(type, num));
+}
+
+/**
+ * Compute the .pag file offset right after the last page of the pending
+ * group.
+ *
+ * @return 0 if no pending page, the offset after the last one otherwise.
+ */
+fileoffset_t
+wal_tail_offset(const DBM *db)
+{
+	const DBMWAL *wal = db->wal;
+
+	sdbm_wal_check(wal);
+
+	return OFF_PAG(wal->maxpag + 1);
+}
+
+/**
+ * Make sure data written to the .dat file reached the disk.
+ *
+ * @return TRUE on success.
+ */
+static bool
+wal_sync_dat(DBM *db)
+{
+#ifdef BIGDATA
+	if (db->big != NULL) {
+		int fd;
+
+		if (!big_sync(db))
+			return FALSE;
+
+		fd = big_datfno(db);
+		if (is_valid_fd(fd) && -1 == fd_fdatasync(fd)) {
+			s_warning("sdbm: \"%s\": cannot sync .dat file: %m",
+				sdbm_name(db));
+			return FALSE;
+		}
+	}
+#else
+	(void) db;
+#endif
+
+	return TRUE;
+}
+
+/**
+ * Open the log file, if not already done.
+ *
+ * A log left over because it could not be replayed or checkpointed can
+ * still hold committed blocks that did not reach the database: it is
+ * replayed first, and we refuse to start a new log if it has to be kept.
+ *
+ * @return TRUE on success.
+ */
+static bool
+wal_open(DBM *db)
+{
+	DBMWAL *wal = db->wal;
+
+	if (is_valid_fd(wal->fd))
+		return TRUE;
+
+	if (NULL == wal->path)
+		wal->path = wal_filename(db->pagname);
+
+	if G_UNLIKELY(file_exists(wal->path)) {
+		wal_replay(db, db->pagname, 0);
+
+		if (file_exists(wal->path)) {
+			s_warning("sdbm: \"%s\": \"%s\" still needs to be replayed",
+				sdbm_name(db), wal->path);
+			errno = EIO;
+			return FALSE;
+		}
+	}
+
+	wal->fd = file_open(wal->path, O_WRONLY | O_CREAT | O_TRUNC, db->openmode);
+	wal->tail = 0;
+
+	return is_valid_fd(wal->fd);
+}
+
+/**
+ * Write the blocks of the committed group in place.
+ *
+ * Errors are not fatal for the database consistency since the blocks are
+ * safely held in the log, which will be replayed when re-opening.
+ */
+static void
+wal_apply(DBM *db)
+{
+	DBMWAL *wal = db->wal;
+	const char *p = wal->buf;
+	const char *end = wal->buf + wal->len;
+
+	while (p < end) {
+		unsigned type = peek_u8(p + 4);
+		long num = peek_be32(p + 8);
+		size_t blksize = wal_blksize(type);
+		ssize_t w;
+
+		if (WAL_COMMIT == type)
+			break;
+
+		g_assert(blksize != 0);
+
+		if (WAL_PAG == type)
+			w = compat_pwrite(db->pagf, p + WAL_HDRSIZE, blksize, OFF_PAG(num));
+		else
+			w = compat_pwrite(db->dirf, p + WAL_HDRSIZE, blksize, OFF_DIR(num));
+
+		if G_UNLIKELY(w != (ssize_t) blksize) {
+			s_critical("sdbm: \"%s\": cannot write logged %s block #%ld: %s",
+				sdbm_name(db), WAL_PAG == type ? "page" : "dir", num,
+				-1 == w ? g_strerror(errno) : "partial write");
+			ioerr(db, TRUE);
+		} else {
+			wal->inplace++;
+		}
+
+		p += WAL_HDRSIZE + blksize;
+	}
+}
+
+/**
+ * Sync the .pag and .dir files and truncate the log.
+ *
+ * @return TRUE on success.
+ */
+static bool
+wal_truncate(DBM *db)
+{
+	DBMWAL *wal = db->wal;
+
+	if (!is_valid_fd(wal->fd) || 0 == wal->tail)
+		return TRUE;
+
+	if (db->flags & DBM_IOERR_W)
+		return FALSE;		/* Keep log around, could not write in place */
+
+	if (-1 == fd_fdatasync(db->pagf) || -1 == fd_fdatasync(db->dirf)) {
+		s_warning("sdbm: \"%s\": cannot sync database for checkpoint: %m",
+			sdbm_name(db));
+		return FALSE;
+	}
+
+	if (-1 == ftruncate(wal->fd, 0)) {
+		s_warning("sdbm: \"%s\": cannot truncate \"%s\": %m",
+			sdbm_name(db), wal->path);
+		return FALSE;
+	}
+
+	wal->tail = 0;
+	wal->checkpoints++;
+
+	return TRUE;
+}
+
+/**
+ * Commit the pending group: append it to the log, sync the log, then
+ * write the blocks in place.
+ *
+ * @return TRUE on success.
+ */
+bool
+wal_commit(DBM *db)
+{
+	DBMWAL *wal = db->wal;
+	size_t len;
+	ssize_t w;
+
+	sdbm_wal_check(wal);
+
+	if (0 == wal->records)
+		return TRUE;
+
+	if G_UNLIKELY(!wal_sync_dat(db))
+		goto failed;
+
+	if G_UNLIKELY(!wal_open(db)) {
+		s_warning("sdbm: \"%s\": cannot open write-ahead log: %m",
+			sdbm_name(db));
+		goto failed;
+	}
+
+	len = wal->len;
+	wal_header(wal, WAL_COMMIT, wal->records, crc32_update(0, wal->buf, len));
+
+	w = compat_pwrite(wal->fd, wal->buf, wal->len, wal->tail);
+	wal->len = len;			/* Strip commit record, in case we fail */
+
+	if G_UNLIKELY(w != (ssize_t) (len + WAL_HDRSIZE)) {
+		s_warning("sdbm: \"%s\": cannot append to \"%s\": %s",
+			sdbm_name(db), wal->path,
+			-1 == w ? g_strerror(errno) : "partial write");
+		goto failed;
+	}
+
+	if G_UNLIKELY(-1 == fd_fdatasync(wal->fd)) {
+		s_warning("sdbm: \"%s\": cannot sync \"%s\": %m",
+			sdbm_name(db), wal->path);
+		goto failed;
+	}
+
+	/*
+	 * The group is now durable, write blocks in place.
+	 */
+
+	wal->tail += len + WAL_HDRSIZE;
+	wal->commits++;
+
+	wal_apply(db);
+	wal_reset(wal);
+
+	if (wal->tail >= WAL_CHECKPOINT)
+		(void) wal_truncate(db);
+
+	return TRUE;
+
+failed:
+	/*
+	 * The pending group is kept so that reads remain consistent, but we
+	 * flag the database as having write errors: nothing more can be
+	 * written until the error is cleared.
+	 */
+
+	ioerr(db, TRUE);
+	return FALSE;
+}
+
+/**
+ * @return whether the pending group has grown large enough to be committed
+ * at the end of the current API operation.
+ */
+bool
+wal_full(const DBM *db)
+{
+	const DBMWAL *wal = db->wal;
+
+	sdbm_wal_check(wal);
+
+	return wal->records >= WAL_GROUP;
+}
+
+/**
+ * Commit pending blocks and truncate the log.
+ *
+ * @return TRUE on success.
+ */
+bool
+wal_checkpoint(DBM *db)
+{
+	sdbm_wal_check(db->wal);
+
+	if (!wal_commit(db))
+		return FALSE;
+
+	return wal_truncate(db);
+}
+
+/**
+ * Checkpoint the log and remove the log file, which will be re-created
+ * on the next commit.
+ *
+ * This is used before renaming the database files, since the log file
+ * name is derived from the .pag file name.
+ *
+ * @return TRUE on success, FALSE if the log had to be kept around.
+ */
+bool
+wal_detach(DBM *db)
+{
+	DBMWAL *wal = db->wal;
+	bool ok;
+
+	sdbm_wal_check(wal);
+
+	ok = wal_checkpoint(db);
+	fd_forget_and_close(&wal->fd);
+
+	if (ok && wal->path != NULL && -1 == unlink(wal->path) && ENOENT != errno) {
+		s_warning("sdbm: \"%s\": cannot unlink \"%s\": %m",
+			sdbm_name(db), wal->path);
+	}
+
+	HFREE_NULL(wal->path);
+
+	return ok;
+}
+
+/**
+ * Discard the pending group and truncate the log, when the database
+ * is cleared.
+ */
+void
+wal_discard(DBM *db)
+{
+	DBMWAL *wal = db->wal;
+
+	sdbm_wal_check(wal);
+
+	wal_reset(wal);
+
+	if (is_valid_fd(wal->fd) && -1 == ftruncate(wal->fd, 0)) {
+		s_warning("sdbm: \"%s\": cannot truncate \"%s\": %m",
+			sdbm_name(db), wal->path);
+	}
+
+	wal->tail = 0;
+}
+
+/**
+ * Close the log and free the WAL descriptor.
+ *
+ * @param db			the database
+ * @param clearfiles	whether database files are being removed
+ */
+void
+wal_close(DBM *db, bool clearfiles)
+{
+	DBMWAL *wal = db->wal;
+
+	if (NULL == wal)
+		return;
+
+	sdbm_wal_check(wal);
+
+	if (clearfiles) {
+		wal_discard(db);
+		fd_forget_and_close(&wal->fd);
+		if (NULL == wal->path)
+			wal->path = wal_filename(db->pagname);
+		if (-1 == unlink(wal->path) && ENOENT != errno) {
+			s_warning("sdbm: \"%s\": cannot unlink \"%s\": %m",
+				sdbm_name(db), wal->path);
+		}
+	} else if (!wal_detach(db)) {
+		s_warning("sdbm: \"%s\": write-ahead log kept for replay",
+			sdbm_name(db));
+	}
+
+	if (common_stats)
+		log_walstats(db);
+
+	fd_forget_and_close(&wal->fd);
+	htable_free_null(&wal->pending);
+	HFREE_NULL(wal->buf);
+	HFREE_NULL(wal->path);
+	wal->magic = 0;
+	WFREE(wal);
+	db->wal = NULL;
+}
+
+/**
+ * Replay committed groups from the log left over by a crash.
+ *
+ * This is called when opening the database, before the size of the .dir
+ * file is looked at.  A trailing group without a valid commit record was
+ * never acknowledged and is ignored.
+ *
+ * @param db		the database being opened
+ * @param pagname	the name of the .pag file
+ * @param flags		the open() flags
+ */
+void
+wal_replay(DBM *db, const char *pagname, int flags)
+{
+	char *path, *buf = NULL;
+	filestat_t sb;
+	size_t size, pos, groups = 0, pages = 0;
+	ssize_t got;
+	int fd;
+
+	path = wal_filename(pagname);
+
+	if (flags & O_TRUNC) {
+		if (!(db->flags & DBM_RDONLY) && -1 == unlink(path) && ENOENT != errno)
+			s_warning("sdbm: cannot delete \"%s\": %m", path);
+		goto done;
+	}
+
+	fd = file_open_missing_silent(path, O_RDONLY);
+	if (!is_valid_fd(fd))
+		goto done;
+
+	if (-1 == fstat(fd, &sb) || 0 == sb.st_size) {
+		fd_forget_and_close(&fd);
+		goto unlink;
+	}
+
+	if (db->flags & DBM_RDONLY) {
+		s_warning("sdbm: cannot replay \"%s\" on read-only database", path);
+		fd_forget_and_close(&fd);
+		goto done;
+	}
+
+	crc_init();
+
+	size = sb.st_size;
+	buf = halloc(size);
+	got = compat_pread(fd, buf, size, 0);
+	fd_forget_and_close(&fd);
+
+	if (-1 == got) {
+		s_warning("sdbm: cannot read \"%s\": %m", path);
+		goto done;
+	}
+
+	size = got;
+	pos = 0;
+
+	while (pos < size) {
+		size_t start = pos, count = 0;
+		bool committed = FALSE;
+
+		while (pos + WAL_HDRSIZE <= size) {
+			const char *p = buf + pos;
+			unsigned type;
+			size_t blksize;
+
+			if (WAL_REC_MAGIC != peek_be32(p))
+				break;
+
+			type = peek_u8(p + 4);
+
+			if (WAL_COMMIT == type) {
+				committed = count == peek_be32(p + 8) &&
+					peek_be32(p + 12) == crc32_update(0, buf + start, pos - start);
+				pos += WAL_HDRSIZE;
+				break;
+			}
+
+			blksize = wal_blksize(type);
+			if (0 == blksize || pos + WAL_HDRSIZE + blksize > size)
+				break;
+
+			pos += WAL_HDRSIZE + blksize;
+			count++;
+		}
+
+		if (!committed) {
+			pos = start;
+			break;
+		}
+
+		/*
+		 * Write back the group in place.
+		 */
+
+		while (start < pos - WAL_HDRSIZE) {
+			const char *p = buf + start;
+			unsigned type = peek_u8(p + 4);
+			long num = peek_be32(p + 8);
+			size_t blksize = wal_blksize(type);
+			ssize_t w;
+
+			if (WAL_PAG == type)
+				w = compat_pwrite(db->pagf, p + WAL_HDRSIZE, blksize, OFF_PAG(num));
+			else
+				w = compat_pwrite(db->dirf, p + WAL_HDRSIZE, blksize, OFF_DIR(num));
+
+			if G_UNLIKELY(w != (ssize_t) blksize) {
+				s_critical("sdbm: cannot replay block #%ld from \"%s\": %s",
+					num, path, -1 == w ? g_strerror(errno) : "partial write");
+				ioerr(db, TRUE);
+				goto done;		/* Keep log around */
+			}
+
+			start += WAL_HDRSIZE + blksize;
+		}
+
+		groups++;
+		pages += count;
+	}
+
+	if (-1 == fd_fdatasync(db->pagf) || -1 == fd_fdatasync(db->dirf)) {
+		s_warning("sdbm: cannot sync database after replaying \"%s\": %m",
+			path);
+		goto done;		/* Keep log around */
+	}
+
+	if (groups != 0) {
+		s_info("sdbm: replayed %zu block%s from %zu committed group%s in \"%s\"",
+			pages, plural(pages), groups, plural(groups), path);
+	}
+
+	if (pos < size) {
+		s_warning("sdbm: ignored %zu trailing byte%s of uncommitted data "
+			"in \"%s\"", size - pos, plural(size - pos), path);
+	}
+
+	/* FALL THROUGH */
+
+unlink:
+	if (-1 == unlink(path) && ENOENT != errno)
+		s_warning("sdbm: cannot delete \"%s\": %m", path);
+
+	/* FALL THROUGH */
+
+done:
+	HFREE_NULL(buf);
+	HFREE_NULL(path);
+}
+
+#endif	/* WAL */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,49 @@
+/* Mini EMBED (wal.c) */
+#define wal_enable sdbm__wal_enable
+#define wal_close sdbm__wal_close
+#define wal_put sdbm__wal_put
+#define wal_get sdbm__wal_get
+#define wal_pending sdbm__wal_pending
+#define wal_full sdbm__wal_full
+#define wal_commit sdbm__wal_commit
+#define wal_checkpoint sdbm__wal_checkpoint
+#define wal_detach sdbm__wal_detach
+#define wal_discard sdbm__wal_discard
+#define wal_replay sdbm__wal_replay
+#define wal_tail_offset sdbm__wal_tail_offset
+
+/**
+ * Type of blocks logged in the WAL.
+ */
+enum wal_type {
+	WAL_PAG = 1,		/* .pag page image, DBM_PBLKSIZ bytes */
+	WAL_DIR = 2			/* .dir block image, DBM_DBLKSIZ bytes */
+};
+
+typedef struct DBMWAL DBMWAL;
+
+int wal_enable(DBM *, bool);
+void wal_close(DBM *, bool);
+bool wal_put(DBM *, enum wal_type, long, const char *);
+bool wal_get(DBM *, enum wal_type, long, char *);
+bool wal_pending(const DBM *, enum wal_type, long);
+bool wal_full(const DBM *);
+bool wal_commit(DBM *);
+bool wal_checkpoint(DBM *);
+bool wal_detach(DBM *);
+void wal_discard(DBM *);
+void wal_replay(DBM *, const char *, int);
+fileoffset_t wal_tail_offset(const DBM *);
+
+#ifdef WAL
+/**
+ * @return whether database updates go through the write-ahead log.
+ */
+static inline bool
+wal_enabled(const DBM *db)
+{
+	return db->wal != NULL;
+}
+#endif
+
+/* vi: set ts=4 sw=4 cindent: */
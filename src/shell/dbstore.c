@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "dbstore" command.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "lib/ascii.h"
+#include "lib/dbstore.h"
+#include "lib/pslist.h"
+#include "lib/str.h"
+#include "lib/stringify.h"			/* For compact_time() */
+
+#include "lib/override.h"		/* Must be the last header included */
+
+static enum shell_reply
+shell_exec_dbstore_compact(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	str_t *s;
+	pslist_t *info, *sl;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	info = dbstore_compact_info_list();
+
+	if (NULL == info) {
+		shell_write(sh, "100 No database being compacted\n");
+		return REPLY_READY;
+	}
+
+	shell_write(sh, "100~\n");
+	shell_write(sh, "    Copied     Pages Progress  Run-time Name\n");
+
+	s = str_new(80);
+
+	PSLIST_FOREACH(info, sl) {
+		dbstore_info_t *di = sl->data;
+
+		dbstore_info_check(di);
+
+		str_printf(s, "%'10ld ", di->done);
+		str_catf(s, "%'9ld ", di->total);
+		str_catf(s, "%7.2f%% ", di->done * 100.0 / MAX(di->total, 1));
+		str_catf(s, "%9s ", compact_time(di->elapsed));
+		str_catf(s, "\"%s\"\n", di->name);
+		shell_write(sh, str_2c(s));
+	}
+
+	str_destroy_null(&s);
+	dbstore_compact_info_list_free_null(&info);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
+/**
+ * Handles the dbstore command.
+ */
+enum shell_reply
+shell_exec_dbstore(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_dbstore_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(compact);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_dbstore(void)
+{
+	return "Persistent database monitoring interface";
+}
+
+const char *
+shell_help_dbstore(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "compact")) {
+			return "dbstore compact\n"
+				"show progress of background database compactions\n";
+		}
+	} else {
+		return "dbstore compact\n";
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -35,9 +35,18 @@
 
 #include "cmd.h"
 #include "core/gnet_stats.h"
+#include "core/verify.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
 
 #include "lib/ascii.h"
+#include "lib/dbmw.h"
+#include "lib/inputevt.h"
+#include "lib/misc.h"
 #include "lib/options.h"
+#include "lib/pslist.h"
+#include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/teq.h"
 #include "lib/xmalloc.h"
@@ -191,6 +200,184 @@ shell_exec_stats_drop(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+static enum shell_reply
+shell_exec_stats_verify(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *pretty;
+	const option_t options[] = {
+		{ "p", &pretty },			/* pretty-print values */
+	};
+	struct verify_worker_stats vws[VERIFY_WORKER_MAX];
+	int parsed;
+	size_t i, n;
+	bool metric = GNET_PROPERTY(display_metric_units);
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	n = verify_worker_stats(vws, N_ITEMS(vws));
+
+	shell_write(sh, "#  State   Files        Read      Hashed   Busy      Rate\n");
+
+	for (i = 0; i < n; i++) {
+		const struct verify_worker_stats *w = &vws[i];
+		uint64 rate;
+		char buf[256];
+
+		if (!w->running && 0 == w->files)
+			continue;
+
+		rate = 0 == w->busy_ms ? 0 : w->read * 1000 / w->busy_ms;
+
+		str_bprintf(buf, sizeof buf, "%zu  %-6s %6s  %10s  %10s  %5s  %8s\n",
+			i, w->active ? "busy" : w->running ? "idle" : "gone",
+			pretty ?
+				uint64_to_gstring(w->files) : uint64_to_string(w->files),
+			short_size(w->read, metric), short_size2(w->hashed, metric),
+			short_time_ascii(w->busy_ms / 1000),
+			short_rate(rate, metric));
+
+		shell_write(sh, buf);
+	}
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_stats_reactors(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *pretty;
+	const option_t options[] = {
+		{ "p", &pretty },			/* pretty-print values */
+	};
+	struct inputevt_reactor_stats rs[INPUTEVT_REACTOR_MAX];
+	int parsed;
+	size_t i, n;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	n = inputevt_reactor_stats(rs, N_ITEMS(rs));
+
+	if (0 == n) {
+		shell_write(sh, "No reactor running.\n");
+		return REPLY_READY;
+	}
+
+	shell_write(sh, "#  Sockets     Wakeups      Events     Batches"
+		"   Stale  Avg(us)  Max(us)\n");
+
+	for (i = 0; i < n; i++) {
+		const struct inputevt_reactor_stats *r = &rs[i];
+		const uint64 values[] = { r->wakeups, r->events, r->batches };
+		char vbuf[N_ITEMS(values)][UINT64_DEC_GRP_BUFLEN];
+		char buf[256];
+		uint64 avg;
+		size_t j;
+
+		for (j = 0; j < N_ITEMS(values); j++) {
+			if (pretty)
+				uint64_to_gstring_buf(values[j], vbuf[j], sizeof vbuf[j]);
+			else
+				uint64_to_string_buf(values[j], vbuf[j], sizeof vbuf[j]);
+		}
+
+		avg = 0 == r->dispatched ? 0 : r->latency_us / r->dispatched;
+
+		str_bprintf(buf, sizeof buf,
+			"%zu  %7u  %10s  %10s  %10s  %6s  %7s  %7s\n",
+			i, r->sockets, vbuf[0], vbuf[1], vbuf[2],
+			uint64_to_string(r->stale), uint64_to_string2(avg),
+			uint64_to_gstring(r->latency_max_us));
+
+		shell_write(sh, buf);
+	}
+
+	return REPLY_READY;
+}
+
+static void *
+stats_dbmw_info_list(void *unused_arg)
+{
+	(void) unused_arg;
+
+	return dbmw_info_list();
+}
+
+static enum shell_reply
+shell_exec_stats_dbmw(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *pretty;
+	const option_t options[] = {
+		{ "p", &pretty },			/* pretty-print values */
+	};
+	pslist_t *info, *sl;
+	int parsed;
+	bool metric = GNET_PROPERTY(display_metric_units);
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	/*
+	 * The DBMW caches are only accessed from the main thread.
+	 */
+
+	info = teq_rpc(THREAD_MAIN_ID, stats_dbmw_info_list, NULL);
+
+	shell_write(sh, "  Items    Hot    Memory    Budget  Read%  Write%"
+		"      Ghosts     Evicted  Filter%  Name\n");
+
+	PSLIST_FOREACH(info, sl) {
+		const dbmw_info_t *di = sl->data;
+		const uint64 values[] = { di->g_hits, di->evicted };
+		char vbuf[N_ITEMS(values)][UINT64_DEC_GRP_BUFLEN];
+		char buf[256];
+		size_t j;
+
+		dbmw_info_check(di);
+
+		for (j = 0; j < N_ITEMS(values); j++) {
+			if (pretty)
+				uint64_to_gstring_buf(values[j], vbuf[j], sizeof vbuf[j]);
+			else
+				uint64_to_string_buf(values[j], vbuf[j], sizeof vbuf[j]);
+		}
+
+		str_bprintf(buf, sizeof buf,
+			"%7zu  %5zu  %8s  %8s  %5.1f  %6.1f  %10s  %10s  %6.1f%%  %s\n",
+			di->count, di->hot,
+			short_size(di->bytes, metric), short_size2(di->max_bytes, metric),
+			di->r_hits * 100.0 / MAX(1, di->r_access),
+			di->w_hits * 100.0 / MAX(1, di->w_access),
+			vbuf[0], vbuf[1],
+			di->f_avoided * 100.0 / MAX(1, di->f_probes),
+			di->name);
+
+		shell_write(sh, buf);
+	}
+
+	dbmw_info_list_free_null(&info);
+	return REPLY_READY;
+}
+
 /**
  * Handle the stats command.
  */
@@ -213,6 +400,9 @@ shell_exec_stats(struct gnutella_shell *sh, int argc, const char *argv[])
 
 	CMD(general);
 	CMD(drop);
+	CMD(verify);
+	CMD(reactors);
+	CMD(dbmw);
 
 #undef CMD
 
@@ -245,10 +435,31 @@ shell_help_stats(int argc, const char *argv[])
 				"-t : only show TCP messages.\n"
 				"-u : only show UDP messages.\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "verify")) {
+			return "stats verify [-p]\n"
+				"prints the throughput of each file hashing thread.\n"
+				"-p : pretty-print with thousands separators.\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "reactors")) {
+			return "stats reactors [-p]\n"
+				"prints the event counters and dispatching latency of each\n"
+				"I/O reactor thread.\n"
+				"-p : pretty-print with thousands separators.\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "dbmw")) {
+			return "stats dbmw [-p]\n"
+				"prints the value cache usage and hit ratios of each\n"
+				"database, along with the ratio of lookups answered by\n"
+				"the key filter without accessing the disk.\n"
+				"-p : pretty-print with thousands separators.\n";
+		}
 	} else {
 		return
 			"stats [general] [-p]\n"
 			"stats drop [-ptu]\n"
+			"stats verify [-p]\n"
+			"stats reactors [-p]\n"
+			"stats dbmw [-p]\n"
 			;
 	}
 	return NULL;